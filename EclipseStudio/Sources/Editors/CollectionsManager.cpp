@@ -1053,6 +1053,16 @@ void CollectionsManager::RebuildElementTypeIndices()
 
 //////////////////////////////////////////////////////////////////////////
 
+void CollectionsManager::StartVisibility(JobChief::TaskGroup &group)
+{
+	if (!g_trees->GetInt() || !quadTree)
+		return ;
+
+	quadTree->StartComputeVisibility(group);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 void CollectionsManager::ComputeVisibility(bool shadows, bool directionalSM)
 {
 	if (!g_trees->GetInt() || !quadTree)
@@ -78,6 +78,9 @@ public:
 #ifndef WO_SERVER
 	void Save();
 
+	/**	Start frustum test of quad tree nodes as tasks of group, so it runs along with other work. Wait group before ComputeVisibility. */
+	void StartVisibility(JobChief::TaskGroup &group);
+
 	/**	Compute visibility here. */
 	void ComputeVisibility(bool shadows, bool directionalSM);
 	void SaveVisibility();
@@ -1810,6 +1810,13 @@ void ParticleEditor_Process_NEW()
 	*/
 	ParticleObj->Torch->bRenderUntextured = !bTex;
 
+	// gradients are edited in place (and restored by undo), keep simulation tables in sync
+	for( int i = 0; i < r3dParticleData::MAX_EMITTER_SLOTS; i ++ )
+	{
+		if( EditTorch->PType[ i ] )
+			EditTorch->PType[ i ]->BakeOverLife();
+	}
+
 	if ( ParticleObj && DummyTargetObj )
 	{
 		r3dVector vDirOrg = EditTorch->OrgDirection;
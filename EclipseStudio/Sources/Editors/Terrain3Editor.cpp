@@ -4,6 +4,7 @@
 #if !defined(FINAL_BUILD) && !defined(WO_SERVER)
 
 #include "TrueNature2/Terrain3.h"
+#include "TrueNature2/Terrain3Kernels.h"
 
 #include "GameLevel.h"
 
@@ -352,6 +353,8 @@ void Terrain3Editor::ApplyHeightBrushT( const r3dPoint3D &pnt, const float stren
 
 	undo = static_cast< CHeightChanged3* >( genericUndo );
 
+	Terrain3UndoRecordDab( pnt, strength, radius, hardness );
+
 	int L = 0;
 	{
 		// and convert to cells
@@ -422,6 +425,11 @@ void Terrain3Editor::ApplyHeightBrushT( const r3dPoint3D &pnt, const float stren
 
 				UnpackedHeightTile* uht = GetUnpackedHeightTile( tx, tz, L );
 
+				if( undo )
+				{
+					undo->CaptureTile( tx, tz, uht->Data );
+				}
+
 				if( gatherSize )
 				{
 					m_TempFloatHeights.Resize( curQS.HeightNormalAtlasTileDim * curQS.HeightNormalAtlasTileDim );
@@ -686,20 +694,8 @@ void Terrain3Editor::ApplyHeightBrushT( const r3dPoint3D &pnt, const float stren
 						if( h < 0 )
 							h = 0;
 
-						CHeightChanged3::UndoHeight_t data;
-
 						UINT16 newVal = UINT16 ( R3D_MAX( R3D_MIN( ( h - desc.MinHeight ) / heightRange * 65535.0f, 65535.0f ), 0.0f ) );
 
-						if( undo )
-						{
-							data.X			= lpx + tx * curQS.HeightNormalAtlasTileDim;
-							data.Z			= lpz + tz * curQS.HeightNormalAtlasTileDim;
-							data.PrevHeight	= uht->Data[ nIndex ];
-							data.CurrHeight = newVal;
-
-							undo->AddData( data );
-						}
-
 						uht->FloatData[ nIndex ] = h;
 						uht->Data[ nIndex ] = newVal;
 					}
@@ -1137,7 +1133,7 @@ void Terrain3Editor::EndHeightEditing()
 				}
 			}
 
-			Terrain3->RecalcNormalMap( heights, &m_TempFloatHeights, &m_TempVectors0, &m_TempVectors1, &m_TempUShorts, i->second.L );
+			Terrain3->RecalcNormalMap( heights, &m_TempFloatHeights, &m_TempNormalFloats, &m_TempUShorts, i->second.L );
 			Terrain3->UpdateNormals( &m_TempUShorts, i->second.X, i->second.Z, i->second.L, m_TempUnpackedMaskTexture, m_TempPackedMaskTexture, &m_TempUShorts2 );
 
 			Terrain3->MarkDirtyPhysChunk( i->second.X, i->second.Z );
@@ -1168,69 +1164,6 @@ void Terrain3Editor::StartLayerBrush_G( int layerIdx )
 
 //------------------------------------------------------------------------
 
-void Terrain3Editor::ApplyRect( int xStart, int zStart, int xSize, int zSize, int L, const uint16_t* data )
-{
-	const r3dTerrain3::QualitySettings& curQS = Terrain3->GetCurrentQualitySettings();
-	const r3dTerrainDesc& desc = Terrain3->GetDesc();
-
-	int tileDim = curQS.MaskAtlasTileDim;
-
-	int px0 = xStart;
-	int pz0 = zStart;
-	int px1 = xStart + xSize;
-	int pz1 = zStart + zSize;
-
-	int tx0 = px0 / tileDim;
-	int tz0 = pz0 / tileDim;
-
-	int tx1 = px1 / tileDim;
-	int tz1 = pz1 / tileDim;
-
-	int tileCountX = desc.TileCountX / curQS.VertexTilesInMegaTexTileCount;
-	int tileCountZ = desc.TileCountZ / curQS.VertexTilesInMegaTexTileCount;
-
-	tileCountX >>= L;
-	tileCountZ >>= L;
-
-	tx0 = R3D_MIN( R3D_MAX( tx0, 0 ), tileCountX - 1 );
-	tz0 = R3D_MIN( R3D_MAX( tz0, 0 ), tileCountZ - 1 );
-
-	tx1 = R3D_MIN( R3D_MAX( tx1, 0 ), tileCountX - 1 );
-	tz1 = R3D_MIN( R3D_MAX( tz1, 0 ), tileCountZ - 1 );		
-
-	int splatIdx = LayerToSplat( m_PaintLayerIdx );
-
-	for( int tz = tz0; tz <= tz1; tz ++ )
-	{
-		for( int tx = tx0; tx <= tx1; tx ++ )
-		{
-			UnpackedMaskTile* maskTile = GetUnpackedMaskTile( tx, tz, L, splatIdx );
-
-			maskTile->Synced = 0;
-
-			for( int tpz = tz * curQS.MaskAtlasTileDim, lz = 0, e = (tz + 1) * curQS.MaskAtlasTileDim; tpz < e; tpz ++, lz ++ )
-			{
-				if( tpz < pz0 || tpz >= pz1 )
-					continue;
-
-				int undoZ = tpz - pz0;
-
-				for( int tpx = tx * curQS.MaskAtlasTileDim, lx = 0, e = (tx + 1) * curQS.MaskAtlasTileDim; tpx < e; tpx ++, lx ++ )
-				{
-					if( tpx < px0 || tpx >= px1 )
-						continue;
-
-					int undoX = tpx - px0;
-
-					maskTile->Data[ lx + lz * curQS.MaskAtlasTileDim ] = data[ undoZ * xSize + undoX ];
-				}
-			}
-		}
-	}
-}
-
-//------------------------------------------------------------------------
-
 void Terrain3Editor::ApplyLayerBrush_G(const r3dTerrainPaintBoundControl& boundCtrl, const r3dPoint3D &pnt, int opType, int layerIdx, float val, float radius, const float hardness )
 {
 	int orgLayerIdx = layerIdx;
@@ -1369,27 +1302,7 @@ void Terrain3Editor::ApplyLayerBrush_G(const r3dTerrainPaintBoundControl& boundC
 				float centerPx = pxx0 + tileDim / 2 + 0.5f;
 				float centerPz = pzz0 + tileDim / 2 + 0.5f;
 
-				int undoX0 = R3D_MAX( pxx0, px0 - 4 );
-				int undoX1 = R3D_MIN( pxx1, px1 + 4 );
-
-				int undoZ0 = R3D_MAX( pzz0, pz0 - 4 );
-				int undoZ1 = R3D_MIN( pzz1, pz1 + 4 );
-
-				CLayerMaskPaint3::PaintData_t undo;
-
-				int nLine = undoX1 - undoX0;
-				int zSize = ( undoZ1 - undoZ0 );
-				int nSize = nLine * zSize;
-
-				undo.rc.left = undoX0;
-				undo.rc.right = undoX1;
-				undo.rc.top = undoZ0;
-				undo.rc.bottom = undoZ1;
-
-				undo.L = L;
-				undo.pData = game_new uint16_t[ nSize * 2 ];
-
-				pUndoItem->AddData( undo );
+				pUndoItem->CaptureTile( tx, tz, L, SplatIdx, maskTile->Data );
 
 				for( int pz = pzz0, lpz = 0; pz < pzz1; lpz ++, pz ++ )
 				{
@@ -1398,25 +1311,6 @@ void Terrain3Editor::ApplyLayerBrush_G(const r3dTerrainPaintBoundControl& boundC
 						float llpx = ( px - centerPx ) * paddingExtraSpace + centerPx;
 						float llpz = ( pz - centerPz ) * paddingExtraSpace + centerPz;
 
-						int undoIdx = -1;
-
-						if( px >= undoX0 && px < undoX1 )
-						{
-							int dx = px - undoX0;
-							int dz = pz - undoZ0;
-
-							if( dx >= 0 && dx < nLine 
-									&&
-								dz >= 0 && dz < zSize
-								)
-							{
-								undoIdx = dz * nLine + dx;
-								uint16_t val = maskTile->Data[ lpx + lpz * tileDim ];
-								undo.pData[ undoIdx ] = val;
-								undo.pData[ undoIdx + nSize ] = val;
-							}
-						}
-
 						float coef = 1.0f;
 						if( np > 0 )
 						{
@@ -1489,11 +1383,6 @@ void Terrain3Editor::ApplyLayerBrush_G(const r3dTerrainPaintBoundControl& boundC
 							rgb->b = to16bit( (UINT8)pix, 31 );
 							break;
 						}
-
-						if( undoIdx != -1 )
-						{
-							undo.pData[ undoIdx + nSize ] = *(uint16_t*)rgb;
-						}
 					}
 				}
 
@@ -2222,6 +2111,13 @@ void Terrain3Editor::RecalcTileCoordBorders( const TileCoords& tcoords )
 
 //------------------------------------------------------------------------
 
+static void ReportMaskMipsRecalc( int i, int e )
+{
+	char buf[ 512 ];
+	sprintf( buf, "Calculating %d of %d", i, e );
+	Terrain3->ReportProgress( buf );
+}
+
 void Terrain3Editor::RecalcAllMasksMipMaps()
 {
 	CreateTempTextures();
@@ -2269,31 +2165,7 @@ void Terrain3Editor::RecalcAllMasksMipMaps()
 
 	for( int L = 1, e = Terrain3->GetInfo().NumActiveMegaTexLayers; L < e; L ++ )
 	{
-		for( int tz = 0, e = info.MegaTileCountZ >> L; tz < e; tz ++ )
-		{
-			for( int tx = 0, e = info.MegaTileCountX >> L; tx < e; tx ++ )
-			{
-				for( int m = 0, e = maskCount; m < e; m ++ )
-				{
-					if( r3dGetTime() - lastInfoFrame > INFO_DELTA )
-					{
-						lastInfoFrame = r3dGetTime();
-						char buf[ 512 ];
-						sprintf( buf, "Calculating (%d,%d,%d)", tx, tz, L );
-						Terrain3->ReportProgress( buf );
-					}
-
-					if( Terrain3->HasMask( tx * 2 + 0, tz * 2 + 0, L - 1, m ) ||
-						Terrain3->HasMask( tx * 2 + 1, tz * 2 + 0, L - 1, m ) ||
-						Terrain3->HasMask( tx * 2 + 0, tz * 2 + 1, L - 1, m ) ||
-						Terrain3->HasMask( tx * 2 + 1, tz * 2 + 1, L - 1, m )
-						)
-					{
-						UpdateLayerMaskMipFromLevelBelow( tx, tz, L, m );
-					}
-				}
-			}
-		}
+		Terrain3->UpdateLayerMaskMipsFromLevelBelow( L, m_TempPackedMaskTexture, m_TempUnpackedMaskTexture, ReportMaskMipsRecalc );
 
 		TileCoords tileCoords;
 
@@ -2422,92 +2294,42 @@ void Terrain3Editor::RecalcAllHeightMipMaps()
 
 	FinishTasksWithReporting();
 
-	r3dTerrain3::Info info = Terrain3->GetInfo();
-
-	int tcx = info.MegaTileCountX / 2;
-	int tcz = info.MegaTileCountZ / 2;
-
-	int heightDim = Terrain3->GetCurrentQualitySettings().HeightNormalAtlasTileDim;
-	int halfHeightDim = heightDim / 2;
-
-	float lastInfoFrame = r3dGetTime();
-
-	const float INFO_DELTA = 0.125f;
-
-	for( int L = 1, e = (int)Terrain3->GetInfo().NumActiveMegaTexLayers; L < e; L ++, tcx /= 2, tcz /= 2 )
+	struct EditorFileWriter : r3dTerrain3::HeightMipWriter
 	{
-		for( int tz = 0; tz < tcz; tz ++ )
+		virtual void WriteHeights( const UShorts& heights, int X, int Z, int L ) OVERRIDE
 		{
-			for( int tx = 0; tx < tcx; tx ++ )
+			if( r3dGetTime() - LastInfoFrame > 0.125f )
 			{
-				if( r3dGetTime() - lastInfoFrame > INFO_DELTA )
-				{
-					lastInfoFrame = r3dGetTime();
-					char buf[ 512 ];
-					sprintf( buf, "Rebuilding height mips (%d,%d,%d)", tx, tz, L );
-					Terrain3->ReportProgress( buf );
-				}
-
-				Terrain3->UnpackHeight( &m_TempUShorts, tx, tz, L );
-
-				for( int ttz = tz * 2, lz = 0,e = tz * 2 + 2; ttz < e; ttz ++, lz += halfHeightDim )
-				{
-					for( int ttx = tx * 2, lx = 0, e = tx * 2 + 2; ttx < e; ttx ++, lx += halfHeightDim )
-					{
-						Terrain3->UnpackHeight( &m_TempUShorts2, ttx, ttz, L - 1 );
-
-						for( int z = 0, e = heightDim / 2; z < e; z ++ )
-						{
-							for( int x = 0, e = heightDim / 2; x < e; x ++ )
-							{
-								int avg = 0;
-
-								avg += m_TempUShorts2[ x * 2 + 0 + ( z * 2 + 0 ) * heightDim ];
-								avg += m_TempUShorts2[ x * 2 + 1 + ( z * 2 + 0 ) * heightDim ];
-								avg += m_TempUShorts2[ x * 2 + 0 + ( z * 2 + 1 ) * heightDim ];
-								avg += m_TempUShorts2[ x * 2 + 1 + ( z * 2 + 1 ) * heightDim ];
-
-								avg /= 4;
-
-								m_TempUShorts[ x + lx + ( z + lz ) * heightDim ] = avg;
-							}
-						}
-					}
-				}
-
-				//------------------------------------------------------------------------
-				Terrain3->UpdateHeight( &m_TempUShorts, &m_TempNormalData, tx, tz, L );
-
-				const UShorts* heights[ 9 ] = { 0 };
-
-				for( int z = 0; z < 3; z ++ )
-				{
-					for( int x = 0; x < 3; x ++ )
-					{
-						if( x == 1 && z == 1 )
-							continue;
-
-						int finalTX = tx + x - 1;
-						int finalTZ = tz + z - 1;
+				LastInfoFrame = r3dGetTime();
+				char buf[ 512 ];
+				sprintf( buf, "Rebuilding height mips (%d,%d,%d)", X, Z, L );
+				Terrain3->ReportProgress( buf );
+			}
 
-						if( finalTX < 0 || finalTZ < 0 
-							||
-							finalTX >= tcx || finalTZ >= tcz )
-							continue;
+			Terrain3->UpdateHeight( &heights, TempNormalData, X, Z, L );
+		}
 
-						UnpackedHeightTile* uht = GetUnpackedHeightTile( finalTX, finalTZ, L );
+		virtual void WriteNormals( const UShorts& normals, int X, int Z, int L ) OVERRIDE
+		{
+			Terrain3->UpdateNormals( &normals, X, Z, L, UnpackedTexture, PackedTexture, TempUShorts );
+		}
 
-						heights[ z * 3 + x ] = &uht->Data;
-					}
-				}
+		r3dTerrain3::Bytes*	TempNormalData;
+		UShorts*			TempUShorts;
+		IDirect3DTexture9*	UnpackedTexture;
+		IDirect3DTexture9*	PackedTexture;
+		float				LastInfoFrame;
+	} writer;
 
-				heights[ 4 ] = &m_TempUShorts;
+	writer.TempNormalData	= &m_TempNormalData;
+	writer.TempUShorts		= &m_TempUShorts2;
+	writer.UnpackedTexture	= m_TempUnpackedMaskTexture;
+	writer.PackedTexture	= m_TempPackedMaskTexture;
+	writer.LastInfoFrame	= r3dGetTime();
 
-				Terrain3->RecalcNormalMap( heights, &m_TempFloatHeights, &m_TempVectors0, &m_TempVectors1, &m_TempUShorts, L );
-				Terrain3->UpdateNormals( &m_TempUShorts, tx, tz, L, m_TempUnpackedMaskTexture, m_TempPackedMaskTexture, &m_TempUShorts2 );
-				//------------------------------------------------------------------------
-			}
-		}
+	for( int L = 1, e = (int)Terrain3->GetInfo().NumActiveMegaTexLayers; L < e; L ++ )
+	{
+		Terrain3->RebuildHeightNormalMips( L, &writer );
 	}
 
 	Terrain3->RefreshAllMaskAtlasTiles();
@@ -2603,53 +2425,9 @@ void Terrain3Editor::UpdateLayerMaskMipFromTemps( int tx, int tz, int maskId, Ti
 			zTargetEnd += HALF_MEGA_TEX_BORDER;
 		}
 
-		for( int z = zTargetStart, lz = 0; z < zTargetEnd; z ++, lz ++ )
-		{
-			for( int x = xTargetStart, lx = 0; x < xTargetEnd; x ++, lx ++ )
-			{
-				int srcIdxes[ 4 ];
-
-				srcIdxes[ 0 ] = ( zStart + lz * 2 + 0 ) * qs.MaskAtlasTileDim + xStart + lx * 2 + 0;
-				srcIdxes[ 1 ] = ( zStart + lz * 2 + 1 ) * qs.MaskAtlasTileDim + xStart + lx * 2 + 0;
-				srcIdxes[ 2 ] = ( zStart + lz * 2 + 0 ) * qs.MaskAtlasTileDim + xStart + lx * 2 + 1;
-				srcIdxes[ 3 ] = ( zStart + lz * 2 + 1 ) * qs.MaskAtlasTileDim + xStart + lx * 2 + 1;
-
-				int rsum = 0;
-				int gsum = 0;
-				int bsum = 0;
-
-				union
-				{
-					struct
-					{
-						UINT16 r : 5;
-						UINT16 g : 6;
-						UINT16 b : 5;
-					};
-
-					UINT16 sample;
-				};
-
-				for( int i = 0; i < 4; i ++ )
-				{
-					sample = m_TempUShorts[ srcIdxes[ i ] ];
-
-					rsum += r;
-					gsum += g;
-					bsum += b;
-				}
-
-				rsum /= 4;
-				gsum /= 4;
-				bsum /= 4;
-
-				r = rsum;
-				g = gsum;
-				b = bsum;
-
-				m_TempUShorts2[ z * qs.MaskAtlasTileDim + x ] = sample;
-			}
-		}
+		r3dTerrain3DownsampleMask(	&m_TempUShorts[ zStart * qs.MaskAtlasTileDim + xStart ], qs.MaskAtlasTileDim,
+									&m_TempUShorts2[ zTargetStart * qs.MaskAtlasTileDim + xTargetStart ], qs.MaskAtlasTileDim,
+									xTargetEnd - xTargetStart, zTargetEnd - zTargetStart );
 
 		xStart = xTargetStartOrg;
 		zStart = zTargetStartOrg;
@@ -2662,13 +2440,6 @@ void Terrain3Editor::UpdateLayerMaskMipFromTemps( int tx, int tz, int maskId, Ti
 
 //------------------------------------------------------------------------
 
-void Terrain3Editor::UpdateLayerMaskMipFromLevelBelow( int tx, int tz, int L, int maskId )
-{
-	Terrain3->UpdateLayerMaskMipFromLevelBelow( tx, tz, L, maskId, m_TempUShorts, m_TempUShorts2, m_TempPackedMaskTexture, m_TempUnpackedMaskTexture );
-}
-
-//------------------------------------------------------------------------
-
 int Terrain3Editor::ImportLayer( const char* path, int layerIndex, int cellOffsetX, int cellOffsetZ )
 {
 	r3dRenderer->EndFrame();
@@ -3258,24 +3029,7 @@ Terrain3Editor::RecalcTileHeightMipChain( int tileX, int tileZ, UShortsPtrArr& d
 		int sx = inParentX * dim;
 		int sz = inParentZ * dim;
 
-		for( int z = sz, e = z + dim; z < e; z ++ )
-		{
-			for( int x = sx, e = x + dim; x < e; x ++ )
-			{
-				int cx = ( x - sx ) * 2 + prevSX;
-				int cz = ( z - sz ) * 2 + prevSZ;
-
-				UINT32 sum = src[ cx + cz * fullDim ];
-
-				sum += src[ ( cx + 1 ) + ( cz + 0 ) * fullDim ];
-				sum += src[ ( cx + 0 ) + ( cz + 1 ) * fullDim ];
-				sum += src[ ( cx + 1 ) + ( cz + 1 ) * fullDim ];
-
-				sum /= 4;
-
-				dest[ x + z * fullDim ] = sum;
-			}
-		}
+		r3dTerrain3DownsampleHeights( &src[ prevSX + prevSZ * fullDim ], fullDim, &dest[ sx + sz * fullDim ], fullDim, dim, dim );
 
 		prevSX = sx;
 		prevSZ = sz;
@@ -3304,11 +3058,12 @@ void Terrain3Editor::RecalcNormalEdges()
 		int tileSizeX = info.MegaTileCountX >> L;
 		int tileSizeZ = info.MegaTileCountZ >> L;
 
+		Terrain3->UpdateNormalEdgesOfLevel( L, NULL );
+
 		for( int tz = 0, te = tileSizeZ; tz < te; tz ++ )
 		{
 			for( int tx = 0, te = tileSizeX; tx < te; tx ++ )
 			{
-				Terrain3->UpdateTileNormalEdges( tx, tz, L, &m_TempUShorts, &m_TempUShorts2, &m_TempUShorts3 );
 				Terrain3->RefreshHeightNormalAtlasTile( tx, tz, L, r3dTerrain3::LOADTILE_NORMAL );
 			}
 		}
@@ -3336,6 +3091,22 @@ Terrain3Editor::BeginUndoRecord( const char * title, UndoAction_e eAction )
 void
 Terrain3Editor::EndUndoRecord()
 {
+	// tiles still hold data after the stroke, pack undo while they do
+	if( m_UndoItem )
+	{
+		switch( m_UndoItem->GetActionID() )
+		{
+		case UA_TERRAIN3_HEIGHT:
+			static_cast< CHeightChanged3* >( m_UndoItem )->FinishRecord();
+			break;
+		case UA_TERRAIN3_MASK_PAINT:
+			static_cast< CLayerMaskPaint3* >( m_UndoItem )->FinishRecord();
+			break;
+		}
+	}
+
+	Terrain3UndoRecordStrokeEnd();
+
 	m_InUndoRecord = 0;
 	m_UndoItem = NULL;
 }
@@ -3536,73 +3307,56 @@ void CHeightChanged3::UndoRedo( bool redo )
 	typedef r3dTL::TArray< UINT16 > UShorts;
 	typedef r3dTL::TArray< UShorts* > UShortsPtrArr;
 
+	// undo requested in the middle of a stroke
+	if( m_Delta.IsRecording() )
+	{
+		FinishRecord();
+	}
+
 	UShortsPtrArr ushorts;
 
-	typedef std::set< Terrain3Editor::UnpackedHeightTile* > UnpackedHeightTileSet;
-	UnpackedHeightTileSet uhts;
+	typedef r3dTL::TArray< Terrain3Editor::UnpackedHeightTile* > UnpackedHeightTileArr;
+	UnpackedHeightTileArr uhts;
 
 	const r3dTerrain3::Info& info = Terrain3->GetInfo();
-	const r3dTerrain3::QualitySettings& qs = Terrain3->GetCurrentQualitySettings();
-
-	Terrain3Editor::UnpackedHeightTile* uht = NULL;
-
-	int curTileX = -1;
-	int curTileZ = -1;
 
 	const r3dTerrainDesc& tdesc = Terrain3->GetDesc();
 
 	r3dFinishBackGroundTasks();
 	g_pTerrain3Editor->StartHeightEditing();
 	{
-		int tileCountX = info.MegaTileCountX;
-		int tileCountZ = info.MegaTileCountZ;
+		for( int i = 0, e = m_Delta.GetTileCount(); i < e; i ++ )
+		{
+			const Terrain3UndoDelta::TileKey& key = m_Delta.GetTileKey( i );
 
-		int tileResX = tileCountX * qs.HeightNormalAtlasTileDim;
-		int tileResZ = tileCountZ * qs.HeightNormalAtlasTileDim;
+			Terrain3Editor::UnpackedHeightTile* uht = g_pTerrain3Editor->GetUnpackedHeightTile( key.X, key.Z, 0 );
+			uht->Synced = 0;
 
-		float heightCoef = ( tdesc.MaxHeight - tdesc.MinHeight ) / 65535.f;
+			uhts.PushBack( uht );
+			ushorts.PushBack( &uht->Data );
+		}
 
-		for( int i =	redo ?		0 : DataArr.Count() - 1; 
-						redo ?		i < (int)DataArr.Count() : i >= 0;
-						redo ? 		i ++ : i-- )
+		if( ushorts.Count() )
 		{
-			const UndoHeight_t &data = DataArr[ i ];
-			r3d_assert( data.X >= 0 && data.X < tileResX
-							&&
-						data.Z >= 0 && data.Z < tileResZ );
-
-			int tileX = data.X / qs.HeightNormalAtlasTileDim;
-			int tileZ = data.Z / qs.HeightNormalAtlasTileDim;
+			m_Delta.Apply( &ushorts[ 0 ], redo );
+		}
 
-			if( tileX != curTileX || tileZ != curTileZ )
-			{
-				uht = g_pTerrain3Editor->GetUnpackedHeightTile( tileX, tileZ, 0 );
-				uhts.insert( uht );
+		float heightCoef = ( tdesc.MaxHeight - tdesc.MinHeight ) / 65535.f;
 
-				uht->Synced = 0;
+		for( int i = 0, e = uhts.Count(); i < e; i ++ )
+		{
+			Terrain3Editor::UnpackedHeightTile* uht = uhts[ i ];
 
-				curTileX = tileX;
-				curTileZ = tileZ;
+			for( int j = 0, je = uht->Data.Count(); j < je; j ++ )
+			{
+				uht->FloatData[ j ] = uht->Data[ j ] * heightCoef + tdesc.MinHeight;
 			}
-
-			r3d_assert( uht );
-
-			int lx = data.X % qs.HeightNormalAtlasTileDim;
-			int lz = data.Z % qs.HeightNormalAtlasTileDim;
-
-			int idx = lx + lz * qs.HeightNormalAtlasTileDim;
-
-			uht->Data[ idx ] = redo ? data.CurrHeight : data.PrevHeight;
-			uht->FloatData[ idx ] = uht->Data[ idx ] * heightCoef + tdesc.MinHeight;
 		}
 	}
 
-
-	for( UnpackedHeightTileSet::iterator i = uhts.begin(), e = uhts.end();
-										i != e;
-										++ i )
+	for( int i = 0, e = uhts.Count(); i < e; i ++ )
 	{
-		Terrain3Editor::UnpackedHeightTile* uht = *i;
+		Terrain3Editor::UnpackedHeightTile* uht = uhts[ i ];
 
 		ushorts.Clear();
 		ushorts.PushBack( &uht->Data );
@@ -3639,9 +3393,28 @@ CHeightChanged3::Redo()
 //------------------------------------------------------------------------
 
 void
-CHeightChanged3::AddData( const UndoHeight_t & data )
+CHeightChanged3::CaptureTile( int tileX, int tileZ, const Terrain3Editor::UShorts& data )
 {
-	DataArr.PushBack( data );
+	Terrain3UndoDelta::TileKey key = { tileX, tileZ, 0, 0 };
+	m_Delta.CaptureTile( key, data );
+}
+
+//------------------------------------------------------------------------
+
+void
+CHeightChanged3::FinishRecord()
+{
+	typedef r3dTL::TArray< Terrain3UndoDelta::UShorts* > UShortsPtrArr;
+
+	UShortsPtrArr current;
+
+	for( int i = 0, e = m_Delta.GetTileCount(); i < e; i ++ )
+	{
+		const Terrain3UndoDelta::TileKey& key = m_Delta.GetTileKey( i );
+		current.PushBack( &g_pTerrain3Editor->GetUnpackedHeightTile( key.X, key.Z, key.L )->Data );
+	}
+
+	m_Delta.Finish( current.Count() ? &current[ 0 ] : NULL, size_t( R3D_MAX( e_terrain_undo_budget->GetInt(), 0 ) ) * 1024 * 1024 );
 }
 
 //------------------------------------------------------------------------
@@ -3692,10 +3465,6 @@ CHeightChanged3::Register()
 void
 CLayerMaskPaint3::Release()
 { 
-	for ( int i = 0; i < (int)m_pData.Count(); i++ )
-	{
-		SAFE_DELETE_ARRAY( m_pData[ i ].pData );
-	}
 	PURE_DELETE( this ); 
 };
 
@@ -3712,37 +3481,33 @@ CLayerMaskPaint3::GetActionID()
 void
 CLayerMaskPaint3::UndoRedo( bool redo )
 {
+	typedef r3dTL::TArray< Terrain3UndoDelta::UShorts* > UShortsPtrArr;
+
+	if( m_Delta.IsRecording() )
+	{
+		FinishRecord();
+	}
+
 	// don't undo pointless stuff
 	g_pTerrain3Editor->StartLayerBrush_G( LayerIdx ); 
 
 	r3d_assert( LayerIdx > 0 );
 
-	for( int i = 		
-				redo ?
-					0
-					:
-					m_pData.Count() - 1; 
-
-				redo ?
-					i < (int)m_pData.Count()
-					:
-					i >= 0; 
-
-				redo ?
-					i ++
-					:
-					i -- 		
-				) 
+	UShortsPtrArr masks;
+
+	for( int i = 0, e = m_Delta.GetTileCount(); i < e; i ++ )
 	{
-		const PaintData_t &data = m_pData[ i ];
+		const Terrain3UndoDelta::TileKey& key = m_Delta.GetTileKey( i );
 
-		r3d_assert( data.rc.right > data.rc.left );
-		r3d_assert( data.rc.bottom > data.rc.top );
+		Terrain3Editor::UnpackedMaskTile* maskTile = g_pTerrain3Editor->GetUnpackedMaskTile( key.X, key.Z, key.L, key.MaskId );
+		maskTile->Synced = 0;
 
-		int xSize = data.rc.right - data.rc.left;
-		int zSize = data.rc.bottom - data.rc.top;
+		masks.PushBack( &maskTile->Data );
+	}
 
-		g_pTerrain3Editor->ApplyRect( data.rc.left, data.rc.top, xSize, zSize, data.L, redo ? data.pData + xSize * zSize : data.pData );
+	if( masks.Count() )
+	{
+		m_Delta.Apply( &masks[ 0 ], redo );
 	}
 
 	g_pTerrain3Editor->EndLayerBrush_G();
@@ -3766,9 +3531,28 @@ CLayerMaskPaint3::Redo()
 //------------------------------------------------------------------------
 
 void
-CLayerMaskPaint3::AddData( const PaintData_t & data )
+CLayerMaskPaint3::CaptureTile( int tileX, int tileZ, int L, int maskId, const Terrain3Editor::UShorts& data )
 {
-	m_pData.PushBack( data );
+	Terrain3UndoDelta::TileKey key = { tileX, tileZ, L, maskId };
+	m_Delta.CaptureTile( key, data );
+}
+
+//------------------------------------------------------------------------
+
+void
+CLayerMaskPaint3::FinishRecord()
+{
+	typedef r3dTL::TArray< Terrain3UndoDelta::UShorts* > UShortsPtrArr;
+
+	UShortsPtrArr current;
+
+	for( int i = 0, e = m_Delta.GetTileCount(); i < e; i ++ )
+	{
+		const Terrain3UndoDelta::TileKey& key = m_Delta.GetTileKey( i );
+		current.PushBack( &g_pTerrain3Editor->GetUnpackedMaskTile( key.X, key.Z, key.L, key.MaskId )->Data );
+	}
+
+	m_Delta.Finish( current.Count() ? &current[ 0 ] : NULL, size_t( R3D_MAX( e_terrain_undo_budget->GetInt(), 0 ) ) * 1024 * 1024 );
 }
 
 //------------------------------------------------------------------------
@@ -3788,22 +3572,6 @@ CLayerMaskPaint3::AddRectUpdate	( const RECT &rc )
 
 //------------------------------------------------------------------------
 
-CLayerMaskPaint3::PaintData_t::PaintData_t()
-: pData( 0 )
-, L ( 0 )
-{
-
-}
-
-//------------------------------------------------------------------------
-
-CLayerMaskPaint3::PaintData_t::~PaintData_t()
-{
-
-}
-
-//------------------------------------------------------------------------
-
 CLayerMaskPaint3::CLayerMaskPaint3()
 {
 	LayerIdx = -1;
@@ -5,6 +5,7 @@
 #if !defined(FINAL_BUILD) && !defined(WO_SERVER)
 
 #include "TrueNature2/Terrain3.h"
+#include "Terrain3Undo.h"
 
 class Terrain3Editor
 {
@@ -123,7 +124,6 @@ public:
 	void EndHeightEditing();
 
 	void StartLayerBrush_G( int layerIdx );
-	void ApplyRect( int xStart, int zStart, int xSize, int zSize, int L, const uint16_t* data );
 	void ApplyLayerBrush_G(const r3dTerrainPaintBoundControl& boundCtrl, const r3dPoint3D &pnt, int opType, int layerIdx, float val, float radius, const float hardness );
 	void EndLayerBrush_G();
 
@@ -147,7 +147,6 @@ public:
 	void RecalcAllHeightMipMaps();
 
 	void UpdateLayerMaskMipFromTemps( int tx, int tz, int maskId, TileCoords* oTileCoords );
-	void UpdateLayerMaskMipFromLevelBelow( int tx, int tz, int L, int maskId );
 
 	int ImportLayer( const char* path, int layerIndex, int cellOffsetX, int cellOffsetZ );
 	int ImportLayer_RawTiles( const char* path, int layerIndex );
@@ -199,13 +198,11 @@ private:
 
 	Floats		m_TempFloatHeightsAdj[ ADJ_COUNT ];
 
-	Vectors		m_TempVectors0;
-	Vectors		m_TempVectors1;
+	Floats		m_TempNormalFloats;
 
 	Shorts		m_ShortHeights;
 	UShorts		m_TempUShorts;
 	UShorts		m_TempUShorts2;
-	UShorts		m_TempUShorts3;
 
 	Bytes		m_TempBytes;
 
@@ -229,22 +226,10 @@ private:
 
 class CHeightChanged3 : public IUndoItem
 {
-public:
-#pragma pack(push,1)
-	struct UndoHeight_t
-	{
-		uint16_t	PrevHeight;
-		uint16_t	CurrHeight;
-		uint16_t	X;
-		uint16_t	Z;
-	};
-#pragma pack(pop)
-
 private:
 	static const UndoAction_e	ms_eActionID = UA_TERRAIN3_HEIGHT;
 
-	typedef r3dTL::TArray< UndoHeight_t > UndoArray;
-	UndoArray			DataArr;
+	Terrain3UndoDelta	m_Delta;
 
 	RECT				m_rc;
 
@@ -258,7 +243,9 @@ public:
 	void				Undo ();
 	void				Redo ();
 
-	void				AddData ( const UndoHeight_t & data );
+	// level 0 height tile, before brush changes it
+	void				CaptureTile ( int tileX, int tileZ, const Terrain3Editor::UShorts& data );
+	void				FinishRecord ();
 	void				AddRectUpdate ( const RECT &rc );
 
 	CHeightChanged3 ();
@@ -273,22 +260,12 @@ class CLayerMaskPaint3 : public IUndoItem
 {
 public:
 
-	struct PaintData_t
-	{
-		PaintData_t();
-		~PaintData_t();
-
-		uint16_t	*	pData; // old data + new data
-		RECT			rc;
-		int				L;
-	};
-
 	int	LayerIdx;
 
 private:
 
 	static const UndoAction_e		ms_eActionID = UA_TERRAIN3_MASK_PAINT;
-	r3dTL::TArray< PaintData_t >	m_pData;
+	Terrain3UndoDelta				m_Delta;
 
 	RECT				m_rc;
 
@@ -302,7 +279,9 @@ public:
 	void				Undo			();
 	void				Redo			();
 
-	void				AddData			( const PaintData_t & data );
+	// mask tile, before brush changes it
+	void				CaptureTile		( int tileX, int tileZ, int L, int maskId, const Terrain3Editor::UShorts& data );
+	void				FinishRecord	();
 	void				AddRectUpdate	( const RECT &rc );
 
 	CLayerMaskPaint3();
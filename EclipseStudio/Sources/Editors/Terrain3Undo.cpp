@@ -0,0 +1,996 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#if !defined(FINAL_BUILD) && !defined(WO_SERVER)
+
+#include "TrueNature2/Terrain3.h"
+
+#include "JobChief.h"
+
+#include "Terrain3Undo.h"
+
+namespace
+{
+	enum
+	{
+		// packed delta is a sequence of runs, each starts with control word:
+		// ZERO_RUN | n - n unchanged words
+		// BYTE_RUN | n - n deltas which fit into a byte after zigzag, two per word, low byte first
+		// n - n deltas as is
+		ZERO_RUN		= 0x8000,
+		BYTE_RUN		= 0x4000,
+		MAX_ZERO_RUN	= 0x7fff,
+		MAX_RUN			= 0x3fff
+	};
+
+	R3D_FORCEINLINE UINT16 ZigZag( UINT16 d )
+	{
+		return UINT16( ( d << 1 ) ^ ( (INT16)d >> 15 ) );
+	}
+
+	R3D_FORCEINLINE UINT16 UnZigZag( UINT16 z )
+	{
+		return UINT16( ( z >> 1 ) ^ ( 0 - ( z & 1 ) ) );
+	}
+
+	R3D_FORCEINLINE bool IsByteDelta( UINT16 d )
+	{
+		return ZigZag( d ) < 256;
+	}
+
+	R3D_FORCEINLINE UINT16 ApplyDelta( UINT16 val, UINT16 d, bool redo )
+	{
+		return redo ? UINT16( val + d ) : UINT16( val - d );
+	}
+
+	R3D_FORCEINLINE bool IsSameTile( const Terrain3UndoDelta::TileKey& a, const Terrain3UndoDelta::TileKey& b )
+	{
+		return a.X == b.X && a.Z == b.Z && a.L == b.L && a.MaskId == b.MaskId;
+	}
+
+	FILE*	g_UndoJournal;
+	INT64	g_UndoJournalSize;
+	char	g_UndoJournalPath[ MAX_PATH ];
+}
+
+/*static*/ Terrain3UndoDelta::Block* Terrain3UndoDelta::ms_Oldest;
+/*static*/ Terrain3UndoDelta::Block* Terrain3UndoDelta::ms_Newest;
+/*static*/ Terrain3UndoDelta::Stats Terrain3UndoDelta::ms_Stats;
+
+//------------------------------------------------------------------------
+
+Terrain3UndoDelta::Terrain3UndoDelta()
+: mLastCapture( -1 )
+, mRecording( 1 )
+{
+
+}
+
+//------------------------------------------------------------------------
+
+Terrain3UndoDelta::~Terrain3UndoDelta()
+{
+	for( int i = 0, e = mCaptures.Count(); i < e; i ++ )
+	{
+		SAFE_DELETE( mCaptures[ i ] );
+	}
+
+	for( int i = 0, e = mBlocks.Count(); i < e; i ++ )
+	{
+		Block* block = mBlocks[ i ];
+
+		if( block->JournalOffset < 0 )
+			Unlink( block );
+		else
+			ReleaseJournalBlock( block );
+
+		SAFE_DELETE( block );
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+Terrain3UndoDelta::CaptureTile( const TileKey& key, const UShorts& data )
+{
+	r3d_assert( mRecording );
+
+	if( mLastCapture >= 0 && IsSameTile( mCaptures[ mLastCapture ]->Key, key ) )
+		return;
+
+	for( int i = 0, e = mCaptures.Count(); i < e; i ++ )
+	{
+		if( IsSameTile( mCaptures[ i ]->Key, key ) )
+		{
+			mLastCapture = i;
+			return;
+		}
+	}
+
+	Capture* capture = game_new Capture;
+
+	capture->Key	= key;
+	capture->Data	= data;
+
+	mLastCapture = mCaptures.Count();
+	mCaptures.PushBack( capture );
+}
+
+//------------------------------------------------------------------------
+
+void
+Terrain3UndoDelta::Finish( UShorts* const* currentData, size_t memoryBudget )
+{
+	r3d_assert( mRecording );
+
+	UShorts packed;
+
+	for( int i = 0, e = mCaptures.Count(); i < e; i ++ )
+	{
+		Capture* capture = mCaptures[ i ];
+
+		const UShorts& current = *currentData[ i ];
+
+		int count = capture->Data.Count();
+		r3d_assert( (int)current.Count() == count );
+
+		if( count && PackDelta( &capture->Data[ 0 ], &current[ 0 ], count, packed ) )
+		{
+			Block* block = game_new Block;
+
+			block->Key				= capture->Key;
+			block->Count			= count;
+			block->PackedCount		= packed.Count();
+			block->JournalOffset	= -1;
+
+			block->Packed.Resize( packed.Count() );
+			memcpy( &block->Packed[ 0 ], &packed[ 0 ], packed.Count() * sizeof packed[ 0 ] );
+
+			LinkNewest( block );
+
+			mBlocks.PushBack( block );
+		}
+
+		SAFE_DELETE( capture );
+	}
+
+	r3dTL::TArray< Capture* >().Swap( mCaptures );
+
+	mLastCapture	= -1;
+	mRecording		= 0;
+
+	if( memoryBudget )
+	{
+		while( ms_Oldest && ms_Stats.MemoryBytes > memoryBudget )
+		{
+			if( !Spill( ms_Oldest ) )
+				break;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+Terrain3UndoDelta::Apply( UShorts* const* tileData, bool redo )
+{
+	r3d_assert( !mRecording );
+
+	int count = mBlocks.Count();
+
+	if( !count )
+		return;
+
+	r3dTL::TArray< ApplyJob > jobs;
+	r3dTL::TArray< UShorts > spilled;
+
+	jobs.Resize( count );
+	spilled.Resize( count );
+
+	// journal is read here, decoding is what runs in parallel
+	for( int i = 0; i < count; i ++ )
+	{
+		const Block* block = mBlocks[ i ];
+
+		r3d_assert( (int)tileData[ i ]->Count() == block->Count );
+
+		ApplyJob& job = jobs[ i ];
+
+		if( block->JournalOffset >= 0 )
+		{
+			ReadSpilled( block, spilled[ i ] );
+			job.Packed = &spilled[ i ][ 0 ];
+		}
+		else
+		{
+			job.Packed = &block->Packed[ 0 ];
+		}
+
+		job.Target	= tileData[ i ];
+		job.Count	= block->Count;
+	}
+
+	ApplyParams params;
+
+	params.Jobs = &jobs[ 0 ];
+	params.Redo = redo;
+
+	if( count > 1 && g_pJobChief )
+		g_pJobChief->Exec( ApplyJobsMT, &params, count );
+	else
+		ApplyJobsMT( &params, 0, count, 0 );
+}
+
+//------------------------------------------------------------------------
+
+int
+Terrain3UndoDelta::GetTileCount() const
+{
+	return mRecording ? mCaptures.Count() : mBlocks.Count();
+}
+
+//------------------------------------------------------------------------
+
+const Terrain3UndoDelta::TileKey&
+Terrain3UndoDelta::GetTileKey( int idx ) const
+{
+	return mRecording ? mCaptures[ idx ]->Key : mBlocks[ idx ]->Key;
+}
+
+//------------------------------------------------------------------------
+
+size_t
+Terrain3UndoDelta::GetPackedSize() const
+{
+	size_t size = 0;
+
+	for( int i = 0, e = mBlocks.Count(); i < e; i ++ )
+	{
+		size += mBlocks[ i ]->PackedCount * sizeof( UINT16 );
+	}
+
+	return size;
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+Terrain3UndoDelta::GetStats( Stats* oStats )
+{
+	*oStats = ms_Stats;
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+bool
+Terrain3UndoDelta::PackDelta( const UINT16* oldData, const UINT16* newData, int count, UShorts& oPacked )
+{
+	oPacked.Clear();
+
+	bool changed = false;
+
+	for( int i = 0; i < count; )
+	{
+		UINT16 d = UINT16( newData[ i ] - oldData[ i ] );
+
+		int j = i + 1;
+
+		// lone zero inside of changed cells doesn't deserve a run
+		if( !d && ( j == count || newData[ j ] == oldData[ j ] ) )
+		{
+			for( ; j < count && j - i < MAX_ZERO_RUN && newData[ j ] == oldData[ j ]; j ++ ) { }
+
+			oPacked.PushBack( UINT16( ZERO_RUN | ( j - i ) ) );
+		}
+		else if( IsByteDelta( d ) )
+		{
+			for( ; j < count && j - i < MAX_RUN; j ++ )
+			{
+				UINT16 dj = UINT16( newData[ j ] - oldData[ j ] );
+
+				if( !IsByteDelta( dj ) )
+					break;
+
+				if( !dj && ( j + 1 == count || newData[ j + 1 ] == oldData[ j + 1 ] ) )
+					break;
+			}
+
+			oPacked.PushBack( UINT16( BYTE_RUN | ( j - i ) ) );
+
+			for( int k = i; k < j; k += 2 )
+			{
+				UINT16 lo = ZigZag( UINT16( newData[ k ] - oldData[ k ] ) );
+				UINT16 hi = k + 1 < j ? ZigZag( UINT16( newData[ k + 1 ] - oldData[ k + 1 ] ) ) : 0;
+
+				oPacked.PushBack( UINT16( lo | hi << 8 ) );
+			}
+
+			changed = true;
+		}
+		else
+		{
+			// single small delta between big ones costs less inside of the run
+			for( ; j < count && j - i < MAX_RUN; j ++ )
+			{
+				UINT16 dj = UINT16( newData[ j ] - oldData[ j ] );
+
+				if( IsByteDelta( dj ) && ( j + 1 == count || IsByteDelta( UINT16( newData[ j + 1 ] - oldData[ j + 1 ] ) ) ) )
+					break;
+			}
+
+			oPacked.PushBack( UINT16( j - i ) );
+
+			for( int k = i; k < j; k ++ )
+			{
+				oPacked.PushBack( UINT16( newData[ k ] - oldData[ k ] ) );
+			}
+
+			changed = true;
+		}
+
+		i = j;
+	}
+
+	return changed;
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+Terrain3UndoDelta::UnpackDelta( const UINT16* packed, UINT16* data, int count, bool redo )
+{
+	for( int i = 0; i < count; )
+	{
+		UINT16 ctrl = *packed ++;
+
+		if( ctrl & ZERO_RUN )
+		{
+			i += ctrl & MAX_ZERO_RUN;
+		}
+		else if( ctrl & BYTE_RUN )
+		{
+			int n = ctrl & MAX_RUN;
+
+			r3d_assert( i + n <= count );
+
+			for( int k = 0; k < n; k ++ )
+			{
+				UINT16 z = k & 1 ? packed[ k >> 1 ] >> 8 : packed[ k >> 1 ] & 0xff;
+				data[ i + k ] = ApplyDelta( data[ i + k ], UnZigZag( z ), redo );
+			}
+
+			packed += ( n + 1 ) / 2;
+			i += n;
+		}
+		else
+		{
+			int n = ctrl;
+
+			r3d_assert( i + n <= count );
+
+			for( int k = 0; k < n; k ++ )
+			{
+				data[ i + k ] = ApplyDelta( data[ i + k ], packed[ k ], redo );
+			}
+
+			packed += n;
+			i += n;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+Terrain3UndoDelta::ApplyJobsMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+{
+	const ApplyParams* params = static_cast< const ApplyParams* >( Data );
+
+	for( size_t i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+	{
+		const ApplyJob& job = params->Jobs[ i ];
+		UnpackDelta( job.Packed, &( *job.Target )[ 0 ], job.Count, params->Redo );
+	}
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+Terrain3UndoDelta::LinkNewest( Block* block )
+{
+	block->Older = ms_Newest;
+	block->Newer = NULL;
+
+	if( ms_Newest )
+		ms_Newest->Newer = block;
+	else
+		ms_Oldest = block;
+
+	ms_Newest = block;
+
+	ms_Stats.MemoryBytes += block->PackedCount * sizeof( UINT16 );
+	ms_Stats.MemoryBlocks ++;
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+Terrain3UndoDelta::Unlink( Block* block )
+{
+	if( block->Older )
+		block->Older->Newer = block->Newer;
+	else
+		ms_Oldest = block->Newer;
+
+	if( block->Newer )
+		block->Newer->Older = block->Older;
+	else
+		ms_Newest = block->Older;
+
+	block->Older = NULL;
+	block->Newer = NULL;
+
+	ms_Stats.MemoryBytes -= block->PackedCount * sizeof( UINT16 );
+	ms_Stats.MemoryBlocks --;
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+bool
+Terrain3UndoDelta::Spill( Block* block )
+{
+	r3d_assert( block->JournalOffset < 0 );
+
+	if( !g_UndoJournal )
+	{
+		char tempPath[ MAX_PATH ] = { 0 };
+		GetTempPath( sizeof tempPath - 1, tempPath );
+
+		_snprintf( g_UndoJournalPath, sizeof g_UndoJournalPath - 1, "%s\\terrain3_undo_%u.tmp", tempPath, (unsigned)GetCurrentProcessId() );
+
+		g_UndoJournal = fopen( g_UndoJournalPath, "w+b" );
+		g_UndoJournalSize = 0;
+
+		if( !g_UndoJournal )
+		{
+			r3dOutToLog( "Terrain3UndoDelta: couldn't create undo journal %s, keeping undo in memory\n", g_UndoJournalPath );
+			return false;
+		}
+	}
+
+	size_t bytes = block->PackedCount * sizeof( UINT16 );
+
+	if( _fseeki64( g_UndoJournal, g_UndoJournalSize, SEEK_SET )
+			||
+		fwrite( &block->Packed[ 0 ], bytes, 1, g_UndoJournal ) != 1 )
+	{
+		r3dOutToLog( "Terrain3UndoDelta: couldn't write undo journal %s, keeping undo in memory\n", g_UndoJournalPath );
+		return false;
+	}
+
+	Unlink( block );
+
+	block->JournalOffset = g_UndoJournalSize;
+	g_UndoJournalSize += bytes;
+
+	UShorts().Swap( block->Packed );
+
+	ms_Stats.JournalBytes += bytes;
+	ms_Stats.JournalBlocks ++;
+
+	return true;
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+Terrain3UndoDelta::ReadSpilled( const Block* block, UShorts& oPacked )
+{
+	r3d_assert( g_UndoJournal && block->JournalOffset >= 0 );
+
+	oPacked.Resize( block->PackedCount );
+
+	if( _fseeki64( g_UndoJournal, block->JournalOffset, SEEK_SET )
+			||
+		fread( &oPacked[ 0 ], block->PackedCount * sizeof( UINT16 ), 1, g_UndoJournal ) != 1 )
+	{
+		r3dError( "Terrain3UndoDelta: couldn't read undo journal %s\n", g_UndoJournalPath );
+	}
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+Terrain3UndoDelta::ReleaseJournalBlock( const Block* block )
+{
+	ms_Stats.JournalBytes -= block->PackedCount * sizeof( UINT16 );
+	ms_Stats.JournalBlocks --;
+
+	// space of released blocks is not reused, file goes away with the last of them
+	if( !ms_Stats.JournalBlocks && g_UndoJournal )
+	{
+		fclose( g_UndoJournal );
+		g_UndoJournal = NULL;
+		g_UndoJournalSize = 0;
+
+		remove( g_UndoJournalPath );
+	}
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+	FILE*	g_StrokeFile;
+	int		g_StrokeHasDabs;
+}
+
+void Terrain3UndoRecordStrokes( const char* path )
+{
+	if( g_StrokeFile )
+	{
+		fclose( g_StrokeFile );
+		g_StrokeFile = NULL;
+	}
+
+	if( !path )
+		return;
+
+	g_StrokeFile = fopen( path, "wt" );
+
+	if( !g_StrokeFile )
+	{
+		r3dOutToLog( "Terrain3UndoRecordStrokes: couldn't open %s\n", path );
+		return;
+	}
+
+	fprintf( g_StrokeFile, "terrain3_strokes 1\ncellsize %f\n", Terrain3 ? Terrain3->GetDesc().CellSize : 1.f );
+
+	g_StrokeHasDabs = 0;
+}
+
+//------------------------------------------------------------------------
+
+int Terrain3UndoIsRecordingStrokes()
+{
+	return !!g_StrokeFile;
+}
+
+//------------------------------------------------------------------------
+
+void Terrain3UndoRecordDab( const r3dPoint3D& pnt, float strength, float radius, float hardness )
+{
+	if( !g_StrokeFile )
+		return;
+
+	fprintf( g_StrokeFile, "d %f %f %f %f %f\n", pnt.x, pnt.z, strength, radius, hardness );
+
+	g_StrokeHasDabs = 1;
+}
+
+//------------------------------------------------------------------------
+
+void Terrain3UndoRecordStrokeEnd()
+{
+	if( !g_StrokeFile || !g_StrokeHasDabs )
+		return;
+
+	fprintf( g_StrokeFile, "e\n" );
+
+	g_StrokeHasDabs = 0;
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+	enum
+	{
+		BENCH_TILE_DIM		= 256,
+		BENCH_MAP_DIM		= 8192,
+		BENCH_STROKES		= 300,
+		BENCH_STROKE_DABS	= 40
+	};
+
+	struct BenchDab
+	{
+		float	X;			// cells
+		float	Z;
+		float	Strength;	// height units, 65535 is full range
+		float	Radius;		// cells
+		float	Hardness;
+	};
+
+	struct BenchStroke
+	{
+		int		FirstDab;
+		int		DabCount;
+	};
+
+	typedef r3dTL::TArray< BenchDab > BenchDabs;
+	typedef r3dTL::TArray< BenchStroke > BenchStrokes;
+	typedef std::map< INT64, Terrain3UndoDelta::UShorts* > BenchTiles;
+
+	struct BenchRandom
+	{
+		uint32_t State;
+
+		float Get( float from, float to )
+		{
+			State = State * 1664525u + 1013904223u;
+			return from + ( to - from ) * ( State >> 8 ) / float( 1 << 24 );
+		}
+	};
+
+	UINT16 BenchInitialHeight( int x, int z )
+	{
+		return UINT16( 20000 + ( ( x * 7 + z * 13 ) & 4095 ) );
+	}
+
+	INT64 BenchTileId( int tx, int tz )
+	{
+		return ( INT64( tz ) << 32 ) | (uint32_t)tx;
+	}
+
+	Terrain3UndoDelta::UShorts* BenchGetTile( BenchTiles& tiles, int tx, int tz )
+	{
+		BenchTiles::iterator found = tiles.find( BenchTileId( tx, tz ) );
+
+		if( found != tiles.end() )
+			return found->second;
+
+		Terrain3UndoDelta::UShorts* tile = game_new Terrain3UndoDelta::UShorts;
+		tile->Resize( BENCH_TILE_DIM * BENCH_TILE_DIM );
+
+		for( int z = 0; z < BENCH_TILE_DIM; z ++ )
+		{
+			for( int x = 0; x < BENCH_TILE_DIM; x ++ )
+			{
+				( *tile )[ x + z * BENCH_TILE_DIM ] = BenchInitialHeight( tx * BENCH_TILE_DIM + x, tz * BENCH_TILE_DIM + z );
+			}
+		}
+
+		tiles.insert( BenchTiles::value_type( BenchTileId( tx, tz ), tile ) );
+
+		return tile;
+	}
+
+	bool BenchLoadStrokes( const char* path, BenchDabs& dabs, BenchStrokes& strokes )
+	{
+		FILE* fin = fopen( path, "rt" );
+
+		if( !fin )
+		{
+			r3dOutToLog( "Terrain3UndoBenchmark: couldn't open %s\n", path );
+			return false;
+		}
+
+		int version = 0;
+		float cellSize = 1.f;
+
+		if( fscanf( fin, " terrain3_strokes %d cellsize %f", &version, &cellSize ) != 2 || version != 1 || cellSize <= 0.f )
+		{
+			r3dOutToLog( "Terrain3UndoBenchmark: %s is not a stroke file\n", path );
+			fclose( fin );
+			return false;
+		}
+
+		BenchStroke stroke = { 0, 0 };
+
+		char tag[ 8 ];
+
+		while( fscanf( fin, " %7s", tag ) == 1 )
+		{
+			if( !strcmp( tag, "d" ) )
+			{
+				BenchDab dab;
+
+				if( fscanf( fin, "%f %f %f %f %f", &dab.X, &dab.Z, &dab.Strength, &dab.Radius, &dab.Hardness ) != 5 )
+					break;
+
+				dab.X /= cellSize;
+				dab.Z /= cellSize;
+				dab.Radius /= cellSize;
+
+				dabs.PushBack( dab );
+				stroke.DabCount ++;
+			}
+			else if( !strcmp( tag, "e" ) )
+			{
+				if( stroke.DabCount )
+					strokes.PushBack( stroke );
+
+				stroke.FirstDab = dabs.Count();
+				stroke.DabCount = 0;
+			}
+		}
+
+		if( stroke.DabCount )
+			strokes.PushBack( stroke );
+
+		fclose( fin );
+
+		return true;
+	}
+
+	void BenchMakeStrokes( BenchDabs& dabs, BenchStrokes& strokes )
+	{
+		BenchRandom rnd = { 12345 };
+
+		for( int s = 0; s < BENCH_STROKES; s ++ )
+		{
+			BenchStroke stroke;
+
+			stroke.FirstDab = dabs.Count();
+			stroke.DabCount = BENCH_STROKE_DABS;
+
+			float x = rnd.Get( 0.f, BENCH_MAP_DIM );
+			float z = rnd.Get( 0.f, BENCH_MAP_DIM );
+			float angle = rnd.Get( 0.f, 2.f * R3D_PI );
+
+			BenchDab dab;
+
+			dab.Radius		= rnd.Get( 8.f, 64.f );
+			dab.Strength	= rnd.Get( 20.f, 400.f ) * ( rnd.Get( 0.f, 1.f ) < 0.3f ? -1.f : 1.f );
+			dab.Hardness	= rnd.Get( 0.2f, 0.9f );
+
+			for( int d = 0; d < BENCH_STROKE_DABS; d ++ )
+			{
+				angle += rnd.Get( -0.3f, 0.3f );
+
+				x = R3D_CLAMP( x + cosf( angle ) * dab.Radius * 0.25f, 0.f, float( BENCH_MAP_DIM - 1 ) );
+				z = R3D_CLAMP( z + sinf( angle ) * dab.Radius * 0.25f, 0.f, float( BENCH_MAP_DIM - 1 ) );
+
+				dab.X = x;
+				dab.Z = z;
+
+				dabs.PushBack( dab );
+			}
+
+			strokes.PushBack( stroke );
+		}
+	}
+
+	// raise/lower brush with the same falloff as Terrain3Editor height brushes, returns touched cells
+	int BenchApplyDab( BenchTiles& tiles, Terrain3UndoDelta& delta, const BenchDab& dab )
+	{
+		int x0 = R3D_MAX( int( dab.X - dab.Radius ), 0 );
+		int z0 = R3D_MAX( int( dab.Z - dab.Radius ), 0 );
+		int x1 = int( dab.X + dab.Radius );
+		int z1 = int( dab.Z + dab.Radius );
+
+		int touched = 0;
+
+		for( int tz = z0 / BENCH_TILE_DIM, tz1 = z1 / BENCH_TILE_DIM; tz <= tz1; tz ++ )
+		{
+			for( int tx = x0 / BENCH_TILE_DIM, tx1 = x1 / BENCH_TILE_DIM; tx <= tx1; tx ++ )
+			{
+				Terrain3UndoDelta::UShorts& tile = *BenchGetTile( tiles, tx, tz );
+
+				Terrain3UndoDelta::TileKey key = { tx, tz, 0, 0 };
+				delta.CaptureTile( key, tile );
+
+				int cx0 = R3D_MAX( x0, tx * BENCH_TILE_DIM );
+				int cz0 = R3D_MAX( z0, tz * BENCH_TILE_DIM );
+				int cx1 = R3D_MIN( x1, tx * BENCH_TILE_DIM + BENCH_TILE_DIM - 1 );
+				int cz1 = R3D_MIN( z1, tz * BENCH_TILE_DIM + BENCH_TILE_DIM - 1 );
+
+				for( int z = cz0; z <= cz1; z ++ )
+				{
+					for( int x = cx0; x <= cx1; x ++ )
+					{
+						float dx = x - dab.X;
+						float dz = z - dab.Z;
+
+						float coef = sqrtf( dx * dx + dz * dz ) / dab.Radius;
+
+						if( coef > 1.f )
+							continue;
+
+						if( coef <= dab.Hardness )
+							coef = 1.f;
+						else
+							coef = 1.f - ( coef - dab.Hardness ) / ( 1.f - dab.Hardness );
+
+						UINT16& h = tile[ ( x - tx * BENCH_TILE_DIM ) + ( z - tz * BENCH_TILE_DIM ) * BENCH_TILE_DIM ];
+
+						h = UINT16( R3D_CLAMP( h + dab.Strength * coef, 0.f, 65535.f ) );
+
+						touched ++;
+					}
+				}
+			}
+		}
+
+		return touched;
+	}
+
+	void BenchGatherTiles( BenchTiles& tiles, const Terrain3UndoDelta& delta, r3dTL::TArray< Terrain3UndoDelta::UShorts* >& oData )
+	{
+		oData.Clear();
+
+		for( int i = 0, e = delta.GetTileCount(); i < e; i ++ )
+		{
+			const Terrain3UndoDelta::TileKey& key = delta.GetTileKey( i );
+			oData.PushBack( BenchGetTile( tiles, key.X, key.Z ) );
+		}
+	}
+
+	uint32_t BenchChecksum( const BenchTiles& tiles )
+	{
+		uint32_t hash = 2166136261u;
+
+		for( BenchTiles::const_iterator i = tiles.begin(), e = tiles.end(); i != e; ++ i )
+		{
+			const Terrain3UndoDelta::UShorts& tile = *i->second;
+
+			for( int j = 0, je = tile.Count(); j < je; j ++ )
+			{
+				hash = ( hash ^ tile[ j ] ) * 16777619u;
+			}
+		}
+
+		return hash;
+	}
+
+	int BenchCountInitialMismatches( const BenchTiles& tiles )
+	{
+		int mismatches = 0;
+
+		for( BenchTiles::const_iterator i = tiles.begin(), e = tiles.end(); i != e; ++ i )
+		{
+			int tx = int( i->first & 0xffffffff );
+			int tz = int( i->first >> 32 );
+
+			const Terrain3UndoDelta::UShorts& tile = *i->second;
+
+			for( int z = 0; z < BENCH_TILE_DIM; z ++ )
+			{
+				for( int x = 0; x < BENCH_TILE_DIM; x ++ )
+				{
+					if( tile[ x + z * BENCH_TILE_DIM ] != BenchInitialHeight( tx * BENCH_TILE_DIM + x, tz * BENCH_TILE_DIM + z ) )
+						mismatches ++;
+				}
+			}
+		}
+
+		return mismatches;
+	}
+}
+
+void Terrain3UndoBenchmark( const char* strokeFile, int budgetMB )
+{
+	BenchDabs dabs;
+	BenchStrokes strokes;
+
+	if( strokeFile )
+	{
+		if( !BenchLoadStrokes( strokeFile, dabs, strokes ) )
+			return;
+	}
+	else
+	{
+		BenchMakeStrokes( dabs, strokes );
+	}
+
+	if( !strokes.Count() )
+	{
+		r3dOutToLog( "Terrain3UndoBenchmark: no strokes\n" );
+		return;
+	}
+
+	size_t budget = size_t( R3D_MAX( budgetMB, 0 ) ) * 1024 * 1024;
+
+	BenchTiles tiles;
+	r3dTL::TArray< Terrain3UndoDelta* > deltas;
+	r3dTL::TArray< Terrain3UndoDelta::UShorts* > tileData;
+
+	INT64 legacyBytes = 0;
+	size_t peakMemory = 0;
+	size_t packedBytes = 0;
+
+	float finishTime = 0.f;
+
+	for( int s = 0, e = strokes.Count(); s < e; s ++ )
+	{
+		const BenchStroke& stroke = strokes[ s ];
+
+		Terrain3UndoDelta* delta = game_new Terrain3UndoDelta;
+
+		for( int d = stroke.FirstDab, de = stroke.FirstDab + stroke.DabCount; d < de; d ++ )
+		{
+			// editor used to store 8 bytes per cell of every dab
+			legacyBytes += BenchApplyDab( tiles, *delta, dabs[ d ] ) * 8;
+		}
+
+		BenchGatherTiles( tiles, *delta, tileData );
+
+		float start = r3dGetTime();
+		delta->Finish( &tileData[ 0 ], budget );
+		finishTime += r3dGetTime() - start;
+
+		packedBytes += delta->GetPackedSize();
+
+		Terrain3UndoDelta::Stats stats;
+		Terrain3UndoDelta::GetStats( &stats );
+
+		peakMemory = R3D_MAX( peakMemory, stats.MemoryBytes );
+
+		deltas.PushBack( delta );
+	}
+
+	Terrain3UndoDelta::Stats stats;
+	Terrain3UndoDelta::GetStats( &stats );
+
+	uint32_t paintedChecksum = BenchChecksum( tiles );
+
+	float undoTime = 0.f, undoMax = 0.f;
+
+	for( int s = deltas.Count() - 1; s >= 0; s -- )
+	{
+		BenchGatherTiles( tiles, *deltas[ s ], tileData );
+
+		float start = r3dGetTime();
+		if( tileData.Count() )
+			deltas[ s ]->Apply( &tileData[ 0 ], false );
+		float took = r3dGetTime() - start;
+
+		undoTime += took;
+		undoMax = R3D_MAX( undoMax, took );
+	}
+
+	int undoMismatches = BenchCountInitialMismatches( tiles );
+
+	float redoTime = 0.f, redoMax = 0.f;
+
+	for( int s = 0, e = deltas.Count(); s < e; s ++ )
+	{
+		BenchGatherTiles( tiles, *deltas[ s ], tileData );
+
+		float start = r3dGetTime();
+		if( tileData.Count() )
+			deltas[ s ]->Apply( &tileData[ 0 ], true );
+		float took = r3dGetTime() - start;
+
+		redoTime += took;
+		redoMax = R3D_MAX( redoMax, took );
+	}
+
+	bool redoOk = BenchChecksum( tiles ) == paintedChecksum;
+
+	int strokeCount = strokes.Count();
+
+	r3dOutToLog( "Terrain3 undo benchmark: %d strokes, %d dabs, %d tiles of %dx%d, budget %d MB, %d threads\n",
+					strokeCount, dabs.Count(), (int)tiles.size(), BENCH_TILE_DIM, BENCH_TILE_DIM, budgetMB, g_pJobChief ? g_pJobChief->GetThreadCount() : 1 );
+	r3dOutToLog( "  per cell records : %.2f MB\n", legacyBytes / 1024.0 / 1024.0 );
+	r3dOutToLog( "  packed deltas    : %.2f MB (%.1fx smaller), %.2f MB in memory (peak %.2f MB), %.2f MB in journal\n",
+					packedBytes / 1024.0 / 1024.0, packedBytes ? double( legacyBytes ) / packedBytes : 0.0,
+					stats.MemoryBytes / 1024.0 / 1024.0, peakMemory / 1024.0 / 1024.0, stats.JournalBytes / 1024.0 / 1024.0 );
+	r3dOutToLog( "  finish stroke    : %.3f ms avg\n", finishTime * 1000.f / strokeCount );
+	r3dOutToLog( "  undo             : %.3f ms avg, %.3f ms max, %s\n", undoTime * 1000.f / strokeCount, undoMax * 1000.f, undoMismatches ? "MISMATCH" : "restored" );
+	r3dOutToLog( "  redo             : %.3f ms avg, %.3f ms max, %s\n", redoTime * 1000.f / strokeCount, redoMax * 1000.f, redoOk ? "restored" : "MISMATCH" );
+
+	if( undoMismatches )
+		r3dOutToLog( "  %d cells differ from original after undo\n", undoMismatches );
+
+	for( int i = 0, e = deltas.Count(); i < e; i ++ )
+	{
+		SAFE_DELETE( deltas[ i ] );
+	}
+
+	for( BenchTiles::iterator i = tiles.begin(), e = tiles.end(); i != e; ++ i )
+	{
+		SAFE_DELETE( i->second );
+	}
+}
+
+#endif
@@ -0,0 +1,131 @@
+#pragma once
+
+#if !defined(FINAL_BUILD) && !defined(WO_SERVER)
+
+//------------------------------------------------------------------------
+// Packed per tile undo data of Terrain3 height and mask strokes.
+//
+// While stroke is recorded, every tile is copied once, when brush touches it
+// first time. When stroke ends, copy is replaced by packed difference of tile
+// data after and before the stroke (new - old, wrapping 16 bit), so undo
+// subtracts it and redo adds it back. Untouched cells of a tile pack to a
+// couple of words, tiles which didn't change are dropped.
+//
+// Packed blocks of all strokes are kept in age order. When they take more
+// memory than the budget, oldest ones are moved to a journal file in temp
+// folder and read back when their stroke is undone or redone.
+//------------------------------------------------------------------------
+
+class Terrain3UndoDelta
+{
+public:
+	typedef r3dTL::TArray< UINT16 > UShorts;
+
+	struct TileKey
+	{
+		int X;
+		int Z;
+		int L;
+		int MaskId;		// 0 for heights
+	};
+
+	struct Stats
+	{
+		size_t	MemoryBytes;
+		size_t	JournalBytes;
+		int		MemoryBlocks;
+		int		JournalBlocks;
+	};
+
+	Terrain3UndoDelta();
+	~Terrain3UndoDelta();
+
+	// copies tile data the first time tile is touched during stroke
+	void			CaptureTile( const TileKey& key, const UShorts& data );
+
+	// currentData[ i ] is data of GetTileKey( i ) after the stroke. Packs differences,
+	// frees copies and spills oldest blocks to journal while memory is over budget (0 - no limit)
+	void			Finish( UShorts* const* currentData, size_t memoryBudget );
+	int				IsRecording() const		{ return mRecording; }
+
+	// tileData[ i ] is data of GetTileKey( i ), tiles are processed in parallel
+	void			Apply( UShorts* const* tileData, bool redo );
+
+	int				GetTileCount() const;
+	const TileKey&	GetTileKey( int idx ) const;
+
+	// packed bytes of this stroke, both in memory and in journal
+	size_t			GetPackedSize() const;
+
+	static void		GetStats( Stats* oStats );
+
+	// false if data didn't change
+	static bool		PackDelta( const UINT16* oldData, const UINT16* newData, int count, UShorts& oPacked );
+	static void		UnpackDelta( const UINT16* packed, UINT16* data, int count, bool redo );
+
+private:
+	struct Capture
+	{
+		TileKey		Key;
+		UShorts		Data;
+	};
+
+	struct Block
+	{
+		TileKey		Key;
+		int			Count;			// words in unpacked tile
+		int			PackedCount;	// words in packed delta
+		UShorts		Packed;			// empty while block is in journal
+		INT64		JournalOffset;	// -1 while block is in memory
+
+		Block*		Older;
+		Block*		Newer;
+	};
+
+	struct ApplyJob
+	{
+		const UINT16*	Packed;
+		UShorts*		Target;
+		int				Count;
+	};
+
+	struct ApplyParams
+	{
+		const ApplyJob*	Jobs;
+		bool			Redo;
+	};
+
+	static void		ApplyJobsMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex );
+
+	static void		LinkNewest( Block* block );
+	static void		Unlink( Block* block );
+	static bool		Spill( Block* block );
+	static void		ReadSpilled( const Block* block, UShorts& oPacked );
+	static void		ReleaseJournalBlock( const Block* block );
+
+	r3dTL::TArray< Capture* >	mCaptures;
+	r3dTL::TArray< Block* >		mBlocks;
+
+	int							mLastCapture;
+	int							mRecording;
+
+	static Block*				ms_Oldest;
+	static Block*				ms_Newest;
+	static Stats				ms_Stats;
+
+	// make copy constructor and assignment operator inaccessible
+	Terrain3UndoDelta( const Terrain3UndoDelta& );
+	Terrain3UndoDelta& operator = ( const Terrain3UndoDelta& );
+};
+
+// starts writing height brush dabs to file for terraundobench, NULL stops
+void Terrain3UndoRecordStrokes( const char* path );
+int Terrain3UndoIsRecordingStrokes();
+void Terrain3UndoRecordDab( const r3dPoint3D& pnt, float strength, float radius, float hardness );
+void Terrain3UndoRecordStrokeEnd();
+
+// replays recorded strokes (or random ones if file is NULL) on a heightfield in memory,
+// prints undo memory against per cell records, undo/redo latency and checks that everything is restored
+void Terrain3UndoBenchmark( const char* strokeFile, int budgetMB );
+
+#endif
@@ -657,6 +657,10 @@ void GameStateGameLoop()
 	GameWorld().Update();
 	R3DPROFILE_END("Obj Manager");
 
+	// send packets queued by objects this tick
+	if(gClientLogic().net_)
+		gClientLogic().net_->FlushBatches();
+
 	if( r3dRenderer->DeviceAvailable && r_decals->GetInt() )
 	{
 		R3DPROFILE_START("Decals");
@@ -0,0 +1,570 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include "Tsg_stl/TStringHashMap.h"
+
+#include "GameLevel_Binary.h"
+
+static const char COMPILED_LEVEL_SIG[ 8 ] = "R3DLVLB";
+
+//------------------------------------------------------------------------
+
+namespace
+{
+	template< typename T >
+	R3D_FORCEINLINE const T* SectionPtr( const char* data, UINT32 offset )
+	{
+		return reinterpret_cast< const T* >( data + offset );
+	}
+
+	// size and crc of xml the file has to be compiled from. Crc is skipped in final build,
+	// there xml and bin come from the same archive and only editor changes xml
+	int GetSourceStamp( const char* xmlPath, UINT32* oSize, UINT32* oCRC, int needCRC )
+	{
+		r3dFile* f = r3d_open( xmlPath, "rb" );
+
+		if( !f )
+			return 0;
+
+		*oSize = f->size;
+		*oCRC = 0;
+
+		if( needCRC && f->size )
+		{
+			r3dTL::TArray< BYTE > data( f->size );
+			fread( &data[ 0 ], f->size, 1, f );
+
+			*oCRC = r3dCRC32( &data[ 0 ], f->size );
+		}
+
+		fclose( f );
+
+		return 1;
+	}
+
+	class CompiledLevelWriter
+	{
+	public:
+		CompiledLevelWriter()
+		{
+			// offset 0 is empty string
+			mStrings.PushBack( 0 );
+			mStringOffsets.Add( "", 0 );
+		}
+
+		UINT32 AddString( const char* str )
+		{
+			UINT32 offset;
+
+			if( mStringOffsets.Find( str, &offset ) )
+				return offset;
+
+			offset = mStrings.Count();
+
+			for( const char* p = str; ; p ++ )
+			{
+				mStrings.PushBack( *p );
+
+				if( !*p )
+					break;
+			}
+
+			mStringOffsets.Add( str, offset );
+
+			return offset;
+		}
+
+		UINT32 AddClass( const char* name )
+		{
+			UINT32 idx;
+
+			if( mClassIndices.Find( name, &idx ) )
+				return idx;
+
+			idx = mClasses.Count();
+
+			mClasses.PushBack( AddString( name ) );
+			mClassIndices.Add( name, idx );
+
+			return idx;
+		}
+
+		UINT32 AddNode( const pugi::xml_node& xmlNode, int withChildren )
+		{
+			UINT32 idx = mNodes.Count();
+
+			mNodes.PushBack( CompiledLevelFile::Node() );
+
+			CompiledLevelFile::Node node;
+
+			node.Name			= AddString( xmlNode.name() );
+			node.Value			= AddString( xmlNode.child_value() );
+			node.AttribStart	= mAttribs.Count();
+			node.AttribCount	= 0;
+			node.ChildCount		= 0;
+
+			for( pugi::xml_attribute a = xmlNode.first_attribute(); a; a = a.next_attribute() )
+			{
+				CompiledLevelFile::Attrib attrib;
+
+				attrib.Name		= AddString( a.name() );
+				attrib.Value	= AddString( a.value() );
+
+				mAttribs.PushBack( attrib );
+				node.AttribCount ++;
+			}
+
+			if( withChildren )
+			{
+				for( pugi::xml_node c = xmlNode.first_child(); c; c = c.next_sibling() )
+				{
+					if( c.type() != pugi::node_element )
+						continue;
+
+					AddNode( c, 1 );
+					node.ChildCount ++;
+				}
+			}
+
+			node.Next = mNodes.Count();
+
+			mNodes[ idx ] = node;
+
+			return idx;
+		}
+
+		void AddObject( const pugi::xml_node& xmlNode )
+		{
+			const char* className = xmlNode.attribute( "className" ).value();
+
+			pugi::xml_node posNode = xmlNode.child( "position" );
+
+			CompiledLevelFile::Object obj;
+
+			obj.Class		= AddClass( className );
+			obj.FileName	= AddString( xmlNode.attribute( "fileName" ).value() );
+			obj.Position[ 0 ] = posNode.attribute( "x" ).as_float();
+			obj.Position[ 1 ] = posNode.attribute( "y" ).as_float();
+			obj.Position[ 2 ] = posNode.attribute( "z" ).as_float();
+			obj.Node		= AddNode( xmlNode, 1 );
+
+			mObjects.PushBack( obj );
+
+			if( !stricmp( className, "obj_Terrain" ) )
+			{
+				mHasTerrain = 1;
+			}
+		}
+
+		int Write( const char* path, UINT32 sourceSize, UINT32 sourceCRC )
+		{
+			// keep sections aligned
+			while( mStrings.Count() & 3 )
+				mStrings.PushBack( 0 );
+
+			CompiledLevelFile::Header header;
+			memset( &header, 0, sizeof header );
+
+			memcpy( header.Signature, COMPILED_LEVEL_SIG, sizeof header.Signature );
+			header.Version		= CompiledLevelFile::VERSION;
+			header.SourceSize	= sourceSize;
+			header.SourceCRC	= sourceCRC;
+
+			header.ClassCount	= mClasses.Count();
+			header.ObjectCount	= mObjects.Count();
+			header.NodeCount	= mNodes.Count();
+			header.AttribCount	= mAttribs.Count();
+			header.StringSize	= mStrings.Count();
+
+			header.ClassOffset	= sizeof header;
+			header.ObjectOffset	= header.ClassOffset + header.ClassCount * sizeof( UINT32 );
+			header.NodeOffset	= header.ObjectOffset + header.ObjectCount * sizeof( CompiledLevelFile::Object );
+			header.AttribOffset	= header.NodeOffset + header.NodeCount * sizeof( CompiledLevelFile::Node );
+			header.StringOffset	= header.AttribOffset + header.AttribCount * sizeof( CompiledLevelFile::Attrib );
+
+			header.HasTerrain	= mHasTerrain;
+
+			FILE* fout = fopen( path, "wb" );
+
+			if( !fout )
+				return 0;
+
+			int ok = fwrite( &header, sizeof header, 1, fout ) == 1;
+
+			ok = ok && WriteArray( fout, mClasses );
+			ok = ok && WriteArray( fout, mObjects );
+			ok = ok && WriteArray( fout, mNodes );
+			ok = ok && WriteArray( fout, mAttribs );
+			ok = ok && WriteArray( fout, mStrings );
+
+			ok = !fclose( fout ) && ok;
+
+			if( !ok )
+			{
+				remove( path );
+			}
+
+			return ok;
+		}
+
+		int mHasTerrain;
+
+	private:
+		template< typename T >
+		static int WriteArray( FILE* fout, const r3dTL::TArray< T >& arr )
+		{
+			return !arr.Count() || fwrite( &arr[ 0 ], sizeof( T ) * arr.Count(), 1, fout ) == 1;
+		}
+
+		r3dTL::TArray< char >								mStrings;
+		r3dTL::TStringHashMap< UINT32 >						mStringOffsets;
+
+		r3dTL::TArray< UINT32 >								mClasses;
+		r3dTL::TStringHashMap< UINT32 >						mClassIndices;
+
+		r3dTL::TArray< CompiledLevelFile::Object >			mObjects;
+		r3dTL::TArray< CompiledLevelFile::Node >			mNodes;
+		r3dTL::TArray< CompiledLevelFile::Attrib >			mAttribs;
+	};
+}
+
+//------------------------------------------------------------------------
+
+CompiledLevelFile::CompiledLevelFile()
+: mData( NULL )
+, mFile( INVALID_HANDLE_VALUE )
+, mMapping( NULL )
+{
+
+}
+
+//------------------------------------------------------------------------
+
+CompiledLevelFile::~CompiledLevelFile()
+{
+	Close();
+}
+
+//------------------------------------------------------------------------
+
+int
+CompiledLevelFile::Open( const char* binPath, const char* xmlPath )
+{
+	Close();
+
+	UINT32 sourceSize = 0;
+	UINT32 sourceCRC = 0;
+
+#ifdef FINAL_BUILD
+	int needCRC = 0;
+#else
+	int needCRC = 1;
+#endif
+
+	// without xml there is nothing to be stale against
+	int hasSource = GetSourceStamp( xmlPath, &sourceSize, &sourceCRC, needCRC );
+
+	UINT32 size = 0;
+
+	// loose file is mapped, file inside of archive has to be read
+	HANDLE file = CreateFile( binPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if( file != INVALID_HANDLE_VALUE )
+	{
+		LARGE_INTEGER fileSize;
+		fileSize.QuadPart = 0;
+
+		GetFileSizeEx( file, &fileSize );
+
+		if( fileSize.QuadPart >= (LONGLONG)sizeof( Header ) && fileSize.QuadPart < 0x7fffffff )
+		{
+			mMapping = CreateFileMapping( file, NULL, PAGE_READONLY, 0, 0, NULL );
+
+			if( mMapping )
+			{
+				mData = static_cast< const char* >( MapViewOfFile( mMapping, FILE_MAP_READ, 0, 0, 0 ) );
+				size = (UINT32)fileSize.QuadPart;
+			}
+		}
+
+		mFile = file;
+	}
+	else if( r3dFile* f = r3d_open( binPath, "rb" ) )
+	{
+		if( f->size >= (int)sizeof( Header ) )
+		{
+			mReadData.Resize( ( f->size + 3 ) / 4 );
+
+			if( fread( &mReadData[ 0 ], f->size, 1, f ) == 1 )
+			{
+				mData = reinterpret_cast< const char* >( &mReadData[ 0 ] );
+				size = f->size;
+			}
+		}
+
+		fclose( f );
+	}
+
+	if( !mData )
+	{
+		Close();
+		return 0;
+	}
+
+	const Header& header = GetHeader();
+
+	int ok = !memcmp( header.Signature, COMPILED_LEVEL_SIG, sizeof header.Signature )
+				&&
+			header.Version == VERSION
+				&&
+			( !hasSource || ( header.SourceSize == sourceSize && ( !needCRC || header.SourceCRC == sourceCRC ) ) )
+				&&
+			Validate( size );
+
+	if( !ok )
+	{
+		Close();
+		return 0;
+	}
+
+	return 1;
+}
+
+//------------------------------------------------------------------------
+
+void
+CompiledLevelFile::Close()
+{
+	if( mMapping )
+	{
+		if( mData )
+			UnmapViewOfFile( mData );
+
+		CloseHandle( mMapping );
+		mMapping = NULL;
+	}
+
+	if( mFile != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( mFile );
+		mFile = INVALID_HANDLE_VALUE;
+	}
+
+	r3dTL::TArray< UINT32 >().Swap( mReadData );
+
+	mData = NULL;
+}
+
+//------------------------------------------------------------------------
+
+const CompiledLevelFile::Header&
+CompiledLevelFile::GetHeader() const
+{
+	return *SectionPtr< Header >( mData, 0 );
+}
+
+//------------------------------------------------------------------------
+
+const char*
+CompiledLevelFile::GetClass( UINT32 idx ) const
+{
+	return GetString( SectionPtr< UINT32 >( mData, GetHeader().ClassOffset )[ idx ] );
+}
+
+//------------------------------------------------------------------------
+
+const CompiledLevelFile::Object&
+CompiledLevelFile::GetLevelObject( UINT32 idx ) const
+{
+	return SectionPtr< Object >( mData, GetHeader().ObjectOffset )[ idx ];
+}
+
+//------------------------------------------------------------------------
+
+const char*
+CompiledLevelFile::GetString( UINT32 offset ) const
+{
+	return mData + GetHeader().StringOffset + offset;
+}
+
+//------------------------------------------------------------------------
+
+pugi::xml_node
+CompiledLevelFile::AppendNode( pugi::xml_node parent, UINT32 nodeIdx ) const
+{
+	const Header& header = GetHeader();
+
+	const Node* nodes = SectionPtr< Node >( mData, header.NodeOffset );
+	const Attrib* attribs = SectionPtr< Attrib >( mData, header.AttribOffset );
+
+	const Node& node = nodes[ nodeIdx ];
+
+	pugi::xml_node xmlNode = parent.append_child();
+	xmlNode.set_name( GetString( node.Name ) );
+
+	for( UINT32 i = node.AttribStart, e = node.AttribStart + node.AttribCount; i < e; i ++ )
+	{
+		xmlNode.append_attribute( GetString( attribs[ i ].Name ) ).set_value( GetString( attribs[ i ].Value ) );
+	}
+
+	if( node.Value )
+	{
+		xmlNode.append_child( pugi::node_pcdata ).set_value( GetString( node.Value ) );
+	}
+
+	for( UINT32 i = 0, child = nodeIdx + 1; i < node.ChildCount; i ++ )
+	{
+		AppendNode( xmlNode, child );
+		child = nodes[ child ].Next;
+	}
+
+	return xmlNode;
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+int
+CompiledLevelFile::Compile( const char* xmlPath, const char* binPath )
+{
+	r3dFile* f = r3d_open( xmlPath, "rb" );
+
+	if( !f )
+		return 0;
+
+	UINT32 sourceSize = f->size;
+
+	char* xmlData = game_new char[ sourceSize + 1 ];
+	fread( xmlData, sourceSize, 1, f );
+	xmlData[ sourceSize ] = 0;
+
+	fclose( f );
+
+	// before parsing in place changes the buffer
+	UINT32 sourceCRC = r3dCRC32( (const BYTE*)xmlData, sourceSize );
+
+	pugi::xml_document xmlDoc;
+	pugi::xml_parse_result parseResult = xmlDoc.load_buffer_inplace( xmlData, sourceSize );
+
+	int ok = 0;
+
+	if( parseResult )
+	{
+		pugi::xml_node root = xmlDoc.first_child();
+
+		while( root && root.type() != pugi::node_element )
+			root = root.next_sibling();
+
+		CompiledLevelWriter writer;
+
+		writer.mHasTerrain = 0;
+		writer.AddNode( root, 0 );
+
+		// same objects LoadLevelObjects walks: first <object> and all siblings after it
+		for( pugi::xml_node xmlObject = root.child( "object" ); xmlObject; xmlObject = xmlObject.next_sibling() )
+		{
+			if( xmlObject.type() == pugi::node_element )
+			{
+				writer.AddObject( xmlObject );
+			}
+		}
+
+		ok = writer.Write( binPath, sourceSize, sourceCRC );
+	}
+	else
+	{
+		r3dOutToLog( "CompiledLevelFile::Compile: failed to parse %s, error: %s\n", xmlPath, parseResult.description() );
+	}
+
+	delete [] xmlData;
+
+	return ok;
+}
+
+//------------------------------------------------------------------------
+
+int
+CompiledLevelFile::Validate( UINT32 size ) const
+{
+	const Header& header = GetHeader();
+
+	// sections have to fit and counts must not overflow offsets
+	if( header.ClassOffset != sizeof( Header )
+			||
+		header.ClassCount > size / sizeof( UINT32 ) || header.ObjectCount > size / sizeof( Object )
+			||
+		header.NodeCount > size / sizeof( Node ) || header.AttribCount > size / sizeof( Attrib )
+			||
+		header.ObjectOffset != header.ClassOffset + header.ClassCount * sizeof( UINT32 )
+			||
+		header.NodeOffset != header.ObjectOffset + header.ObjectCount * sizeof( Object )
+			||
+		header.AttribOffset != header.NodeOffset + header.NodeCount * sizeof( Node )
+			||
+		header.StringOffset != header.AttribOffset + header.AttribCount * sizeof( Attrib )
+			||
+		header.StringOffset > size || header.StringSize != size - header.StringOffset
+			||
+		!header.StringSize || mData[ size - 1 ] || !header.NodeCount )
+	{
+		return 0;
+	}
+
+	const UINT32 stringSize = header.StringSize;
+
+	const UINT32* classes = SectionPtr< UINT32 >( mData, header.ClassOffset );
+
+	for( UINT32 i = 0, e = header.ClassCount; i < e; i ++ )
+	{
+		if( classes[ i ] >= stringSize )
+			return 0;
+	}
+
+	const Attrib* attribs = SectionPtr< Attrib >( mData, header.AttribOffset );
+
+	for( UINT32 i = 0, e = header.AttribCount; i < e; i ++ )
+	{
+		if( attribs[ i ].Name >= stringSize || attribs[ i ].Value >= stringSize )
+			return 0;
+	}
+
+	const Node* nodes = SectionPtr< Node >( mData, header.NodeOffset );
+
+	for( UINT32 i = 0, e = header.NodeCount; i < e; i ++ )
+	{
+		const Node& node = nodes[ i ];
+
+		if( node.Name >= stringSize || node.Value >= stringSize
+				||
+			node.AttribStart > header.AttribCount || node.AttribCount > header.AttribCount - node.AttribStart
+				||
+			node.Next <= i || node.Next > e )
+		{
+			return 0;
+		}
+
+		// children have to tile the subtree exactly, AppendNode relies on it
+		UINT32 child = i + 1;
+
+		for( UINT32 c = 0; c < node.ChildCount; c ++ )
+		{
+			if( child >= node.Next )
+				return 0;
+
+			child = nodes[ child ].Next;
+		}
+
+		if( child != node.Next )
+			return 0;
+	}
+
+	const Object* objects = SectionPtr< Object >( mData, header.ObjectOffset );
+
+	for( UINT32 i = 0, e = header.ObjectCount; i < e; i ++ )
+	{
+		if( objects[ i ].Class >= header.ClassCount || objects[ i ].FileName >= stringSize || objects[ i ].Node >= header.NodeCount )
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+//------------------------------------------------------------------------
+// Compiled form of LevelData.xml, SoundData.xml and ServerData.xml.
+//
+// RSBuild writes <name>.bin next to <name>.xml of a level. Xml stays what
+// editor saves, loader takes .bin only while it was compiled from xml of
+// the same size ( and crc, outside of final build ).
+//
+// Layout, every section is 4 byte aligned:
+//	Header
+//	Classes			- string of every distinct className, objects refer to them by index
+//	Objects			- class, fileName and position of every child of root
+//	Nodes			- elements with their attributes and text, children of a node
+//					  follow it and Next of a node points past its subtree.
+//					  Node 0 is the root element without children
+//	Attributes
+//	Strings			- zero terminated, each distinct string stored once, 0 is ""
+//------------------------------------------------------------------------
+
+class CompiledLevelFile
+{
+public:
+	enum
+	{
+		VERSION = 1
+	};
+
+	struct Header
+	{
+		char	Signature[ 8 ];
+		UINT32	Version;
+
+		UINT32	SourceSize;
+		UINT32	SourceCRC;
+
+		UINT32	ClassCount;
+		UINT32	ObjectCount;
+		UINT32	NodeCount;
+		UINT32	AttribCount;
+		UINT32	StringSize;
+
+		UINT32	ClassOffset;
+		UINT32	ObjectOffset;
+		UINT32	NodeOffset;
+		UINT32	AttribOffset;
+		UINT32	StringOffset;
+
+		UINT32	HasTerrain;
+	};
+
+	struct Object
+	{
+		UINT32	Class;
+		UINT32	FileName;
+		float	Position[ 3 ];
+		UINT32	Node;		// <object> element itself, for ReadSerializedData
+	};
+
+	struct Node
+	{
+		UINT32	Name;
+		UINT32	Value;		// first pcdata child
+		UINT32	AttribStart;
+		UINT32	AttribCount;
+		UINT32	ChildCount;
+		UINT32	Next;
+	};
+
+	struct Attrib
+	{
+		UINT32	Name;
+		UINT32	Value;
+	};
+
+public:
+	CompiledLevelFile();
+	~CompiledLevelFile();
+
+	// maps binPath ( or reads it from archive ), fails if it is missing, broken or stale against xmlPath
+	int				Open( const char* binPath, const char* xmlPath );
+	void			Close();
+
+	int				IsValid() const { return mData != NULL; }
+
+	const Header&	GetHeader() const;
+	const char*		GetClass( UINT32 idx ) const;
+	const Object&	GetLevelObject( UINT32 idx ) const;
+	const char*		GetString( UINT32 offset ) const;
+
+	// appends node with its attributes, text and children to parent
+	pugi::xml_node	AppendNode( pugi::xml_node parent, UINT32 nodeIdx ) const;
+
+	static int		Compile( const char* xmlPath, const char* binPath );
+
+private:
+	int				Validate( UINT32 size ) const;
+
+	const char*				mData;
+
+	HANDLE					mFile;
+	HANDLE					mMapping;
+
+	r3dTL::TArray< UINT32 >	mReadData;	// when file is in archive
+
+	// make copy constructor and assignment operator inaccessible
+	CompiledLevelFile( const CompiledLevelFile& );
+	CompiledLevelFile& operator = ( const CompiledLevelFile& );
+};
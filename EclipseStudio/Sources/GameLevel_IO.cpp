@@ -8,6 +8,9 @@
 #include "TrueNature2/Terrain2.h"
 
 #include "GameLevel.h"
+#include "GameLevel_Binary.h"
+
+#include "JobChief.h"
 
 #ifdef WO_SERVER
 
@@ -24,28 +27,36 @@ AUTOREGISTER_CLASS(obj_ServerDummyObject);
 
 #endif
 
-GameObject * LoadLevelObject ( pugi::xml_node & curNode )
+static int GetLevelObjectClassID( const char*& class_name )
 {
-	pugi::xml_node posNode = curNode.child("position");
-	const char* class_name = curNode.attribute("className").value();
-	const char* load_name = curNode.attribute("fileName").value();
-	r3dPoint3D pos(0, 0, 0);
-	pos.x = posNode.attribute("x").as_float();
-	pos.y = posNode.attribute("y").as_float();
-	pos.z = posNode.attribute("z").as_float();
-
-	GameObject* obj = NULL;
+	int class_id = AObjectTable_GetClassID(class_name, "Object");
 
 #ifdef WO_SERVER
-	int class_id = AObjectTable_GetClassID(class_name, "Object");
 	if(class_id == -1)
 	{
 		r3dOutToLog("skipped not defined server object %s\n", class_name);
 		class_name = "obj_ServerDummyObject";
+		class_id = AObjectTable_GetClassID(class_name, "Object");
+	}
+#else
+	if(class_id == -1)
+	{
+		r3dOutToLog("srv_CreateGameObject: class %s isn't present\n", class_name);
 	}
 #endif
 
-	obj = srv_CreateGameObject(class_name, load_name, pos, 0, 0, &curNode);
+	return class_id;
+}
+
+static GameObject * CreateLevelObject ( int class_id, const char* class_name, const char* load_name, const r3dPoint3D& pos, pugi::xml_node & curNode )
+{
+	GameObject* obj = NULL;
+
+	if(class_id != -1)
+	{
+		obj = srv_CreateGameObject(class_id, load_name, pos, 0, 0, &curNode);
+	}
+
 	if(!obj)
 	{
 		r3dOutToLog("!!!Failed to create object! class: %s, name: %s\n", class_name, load_name);
@@ -63,6 +74,21 @@ GameObject * LoadLevelObject ( pugi::xml_node & curNode )
 	return obj;
 }
 
+GameObject * LoadLevelObject ( pugi::xml_node & curNode )
+{
+	pugi::xml_node posNode = curNode.child("position");
+	const char* class_name = curNode.attribute("className").value();
+	const char* load_name = curNode.attribute("fileName").value();
+	r3dPoint3D pos(0, 0, 0);
+	pos.x = posNode.attribute("x").as_float();
+	pos.y = posNode.attribute("y").as_float();
+	pos.z = posNode.attribute("z").as_float();
+
+	int class_id = GetLevelObjectClassID(class_name);
+
+	return CreateLevelObject(class_id, class_name, load_name, pos, curNode);
+}
+
 void LoadLevelObjectsGroups ( pugi::xml_node & curNode, r3dTL::TArray < GameObject * > & dObjects )
 {
 	dObjects.Clear ();
@@ -78,6 +104,45 @@ void LoadLevelObjectsGroups ( pugi::xml_node & curNode, r3dTL::TArray < GameObje
 }
 
 
+// sets terrain part of progress, returns progress of every other object
+static float BeginLevelObjectsProgress( int count, int hasTerrain, float range )
+{
+	if( hasTerrain )
+	{
+		range -= 0.1f ;
+	}
+
+	float delta = 0.f;
+
+	if( hasTerrain )
+	{
+		r3dITerrain::LoadingProgress = 0.25f * range;
+		delta = count ? ( range * 0.75f ) / ( count - 1 ) : 0.f;
+	}
+	else
+	{
+		r3dITerrain::LoadingProgress = 0.0f;
+		delta = count ? range / count : 0.f;
+	}
+
+	return delta;
+}
+
+static void AdvanceLevelObjectsProgress( GameObject* obj, float delta )
+{
+	void AdvanceLoadingProgress( float );
+
+	if( obj && obj->ObjTypeFlags & OBJTYPE_Terrain )
+	{
+		AdvanceLoadingProgress( r3dITerrain::LoadingProgress );
+		r3dITerrain::LoadingProgress = 0.f;
+	}
+	else
+	{
+		AdvanceLoadingProgress( delta );
+	}
+}
+
 void LoadLevelObjects ( pugi::xml_node & curNode, float range, ESerializeFile sfType )
 {
 	int count = 0;
@@ -102,42 +167,148 @@ void LoadLevelObjects ( pugi::xml_node & curNode, float range, ESerializeFile sf
 		xmlObject = xmlObject.next_sibling();
 	}
 
-	if( hasTerrain )
+	float delta = BeginLevelObjectsProgress( count, hasTerrain, range );
+
+	xmlObject = curNode.child("object");
+	while(!xmlObject.empty())
+	{		
+		GameObject* obj = LoadLevelObject ( xmlObject );
+
+		AdvanceLevelObjectsProgress( obj, delta );
+
+		xmlObject = xmlObject.next_sibling();
+	}
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+	// objects of compiled file are turned back into xml nodes for ReadSerializedData
+	// a batch at a time, next batch is decoded by jobs while current one is created
+	struct CompiledLevelBatch
 	{
-		range -= 0.1f ;
+		enum
+		{
+			CHUNK_SIZE	= 64,
+			CHUNK_COUNT	= 8,
+			SIZE		= CHUNK_SIZE * CHUNK_COUNT
+		};
+
+		const CompiledLevelFile*	File;
+
+		UINT32						Start;
+		UINT32						Count;
+
+		pugi::xml_document*			Docs[ CHUNK_COUNT ];
+		pugi::xml_node				Nodes[ SIZE ];
+
+		CompiledLevelBatch()
+		: File( NULL )
+		, Start( 0 )
+		, Count( 0 )
+		{
+			memset( Docs, 0, sizeof Docs );
+		}
+
+		~CompiledLevelBatch()
+		{
+			for( int i = 0; i < CHUNK_COUNT; i ++ )
+			{
+				SAFE_DELETE( Docs[ i ] );
+			}
+		}
+
+		UINT32 GetChunkCount() const
+		{
+			return ( Count + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+		}
+	};
+
+	void DecodeCompiledLevelChunks( void* data, size_t itemStart, size_t itemCount, size_t /*threadIndex*/ )
+	{
+		CompiledLevelBatch* batch = static_cast< CompiledLevelBatch* >( data );
+
+		for( size_t c = itemStart, e = itemStart + itemCount; c < e; c ++ )
+		{
+			// pugi has no way to clear a document, nodes of previous batch go with it
+			SAFE_DELETE( batch->Docs[ c ] );
+			batch->Docs[ c ] = game_new pugi::xml_document;
+
+			UINT32 i = UINT32( c ) * CompiledLevelBatch::CHUNK_SIZE;
+			UINT32 end = R3D_MIN( i + (UINT32)CompiledLevelBatch::CHUNK_SIZE, batch->Count );
+
+			for( ; i < end; i ++ )
+			{
+				const CompiledLevelFile::Object& obj = batch->File->GetLevelObject( batch->Start + i );
+				batch->Nodes[ i ] = batch->File->AppendNode( *batch->Docs[ c ], obj.Node );
+			}
+		}
 	}
 
-	float delta = 0.f;
+	void StartCompiledLevelBatch( JobChief::TaskGroup& group, CompiledLevelBatch& batch, UINT32 start )
+	{
+		batch.Start = start;
+		batch.Count = R3D_MIN( batch.File->GetHeader().ObjectCount - start, (UINT32)CompiledLevelBatch::SIZE );
 
-	if( hasTerrain )
+		group.ParallelFor( DecodeCompiledLevelChunks, &batch, batch.GetChunkCount(), 1 );
+	}
+}
+
+void LoadLevelObjects ( const CompiledLevelFile& file, float range, ESerializeFile sfType )
+{
+	const CompiledLevelFile::Header& header = file.GetHeader();
+
+	// class ids are runtime ones, so compiled file only has names
+	r3dTL::TArray< int > classIds( header.ClassCount );
+	r3dTL::TArray< const char* > classNames( header.ClassCount );
+
+	for( UINT32 i = 0, e = header.ClassCount; i < e; i ++ )
 	{
-		r3dITerrain::LoadingProgress = 0.25f * range;
-		delta = count ? ( range * 0.75f ) / ( count - 1 ) : 0.f;
+		classNames[ i ] = file.GetClass( i );
+		classIds[ i ] = GetLevelObjectClassID( classNames[ i ] );
 	}
-	else
+
+	float delta = BeginLevelObjectsProgress( header.ObjectCount, header.HasTerrain, range );
+
+	if( !header.ObjectCount )
+		return;
+
+	CompiledLevelBatch batches[ 2 ];
+
+	batches[ 0 ].File = &file;
+	batches[ 1 ].File = &file;
+
 	{
-		r3dITerrain::LoadingProgress = 0.0f;
-		delta = count ? range / count : 0.f;
+		JobChief::TaskGroup group;
+		StartCompiledLevelBatch( group, batches[ 0 ], 0 );
+		group.Wait();
 	}
 
-	xmlObject = curNode.child("object");
-	while(!xmlObject.empty())
-	{		
-		GameObject* obj = LoadLevelObject ( xmlObject );
+	for( UINT32 start = 0, b = 0; start < header.ObjectCount; start += CompiledLevelBatch::SIZE, b ^= 1 )
+	{
+		CompiledLevelBatch& batch = batches[ b ];
 
-		void AdvanceLoadingProgress( float );
+		JobChief::TaskGroup group;
 
-		if( obj && obj->ObjTypeFlags & OBJTYPE_Terrain )
+		if( start + CompiledLevelBatch::SIZE < header.ObjectCount )
 		{
-			AdvanceLoadingProgress( r3dITerrain::LoadingProgress );
-			r3dITerrain::LoadingProgress = 0.f;
+			StartCompiledLevelBatch( group, batches[ b ^ 1 ], start + CompiledLevelBatch::SIZE );
 		}
-		else
+
+		// game world is not thread safe, objects are created in file order here
+		for( UINT32 i = 0; i < batch.Count; i ++ )
 		{
-			AdvanceLoadingProgress( delta );
+			const CompiledLevelFile::Object& o = file.GetLevelObject( start + i );
+
+			r3dPoint3D pos( o.Position[ 0 ], o.Position[ 1 ], o.Position[ 2 ] );
+
+			GameObject* obj = CreateLevelObject( classIds[ o.Class ], classNames[ o.Class ], file.GetString( o.FileName ), pos, batch.Nodes[ i ] );
+
+			AdvanceLevelObjectsProgress( obj, delta );
 		}
 
-		xmlObject = xmlObject.next_sibling();
+		group.Wait();
 	}
 }
 
@@ -157,6 +328,43 @@ bool ParseXMLFile(const char *xmlFileName, pugi::xml_document &outXml, char *& o
 	return true;
 }
 
+// takes .bin compiled from xml while it is up to date, only root element is put into xmlFile then
+static pugi::xml_node OpenLevelDataFile(const char *xmlFileName, const char *rootName, pugi::xml_document &xmlFile, char *& xmlBuf, CompiledLevelFile &binFile)
+{
+	if( g_level_binary->GetBool() )
+	{
+		char binFileName[MAX_PATH];
+		r3dscpy(binFileName, xmlFileName);
+
+		if( char* ext = strrchr(binFileName, '.') )
+		{
+			strcpy(ext, ".bin");
+
+			if( binFile.Open(binFileName, xmlFileName) )
+			{
+				pugi::xml_node root = binFile.AppendNode(xmlFile, 0);
+
+				if( !strcmp(root.name(), rootName) )
+					return root;
+
+				// parsing xml below clears the document
+				binFile.Close();
+			}
+		}
+	}
+
+	ParseXMLFile(xmlFileName, xmlFile, xmlBuf);
+	return xmlFile.child(rootName);
+}
+
+static void LoadLevelObjects( pugi::xml_node & xmlRoot, const CompiledLevelFile & binFile, float range, ESerializeFile sfType )
+{
+	if( binFile.IsValid() )
+		LoadLevelObjects( binFile, range, sfType );
+	else
+		LoadLevelObjects( xmlRoot, range, sfType );
+}
+
 int LoadLevel_Objects( float BarRange )
 {
 	char fname[MAX_PATH];
@@ -164,9 +372,8 @@ int LoadLevel_Objects( float BarRange )
 
 	pugi::xml_document xmlLevelFile;
 	char *levelData = 0;
-	ParseXMLFile(fname, xmlLevelFile, levelData);
-
-	pugi::xml_node xmlLevel = xmlLevelFile.child("level");
+	CompiledLevelFile levelBin;
+	pugi::xml_node xmlLevel = OpenLevelDataFile(fname, "level", xmlLevelFile, levelData, levelBin);
 
 	g_leveldata_xml_ver->SetInt( 0 );
 	if( !xmlLevel.attribute("version").empty() )
@@ -201,7 +408,7 @@ int LoadLevel_Objects( float BarRange )
 
 	const float SOUND_BAR_RATIO = 0.25f;
 
-	LoadLevelObjects ( xmlLevel, BarRange * ( 1.f - SOUND_BAR_RATIO ), SF_LevelData );
+	LoadLevelObjects ( xmlLevel, levelBin, BarRange * ( 1.f - SOUND_BAR_RATIO ), SF_LevelData );
 
 	//	Sound data (do not load on server)
 #ifndef WO_SERVER
@@ -209,10 +416,10 @@ int LoadLevel_Objects( float BarRange )
 
 	pugi::xml_document xmlSoundFile;
 	char *soundData = 0;
-	ParseXMLFile(fname, xmlSoundFile, soundData);
+	CompiledLevelFile soundBin;
+	xmlLevel = OpenLevelDataFile(fname, "sounds", xmlSoundFile, soundData, soundBin);
 
-	xmlLevel = xmlSoundFile.child("sounds");
-	LoadLevelObjects ( xmlLevel, BarRange * SOUND_BAR_RATIO, SF_SoundData );
+	LoadLevelObjects ( xmlLevel, soundBin, BarRange * SOUND_BAR_RATIO, SF_SoundData );
 #endif
 
 	//	Don't load server data in final build (will load on server automatically)
@@ -223,10 +430,10 @@ int LoadLevel_Objects( float BarRange )
 
 		pugi::xml_document xmlServerFile;
 		char *serverData = 0;
-		ParseXMLFile(fname, xmlServerFile, serverData);
+		CompiledLevelFile serverBin;
+		xmlLevel = OpenLevelDataFile(fname, "server_objects", xmlServerFile, serverData, serverBin);
 
-		xmlLevel = xmlServerFile.child("server_objects");
-		LoadLevelObjects ( xmlLevel, 0.f, SF_ServerData);
+		LoadLevelObjects ( xmlLevel, serverBin, 0.f, SF_ServerData);
 
 		delete [] serverData;
 #endif
@@ -200,7 +200,7 @@ BOOL obj_UAV::Update()
 			if(pktFlags & 0x1)
 				p2pSendToHost(this, &n1, sizeof(n1), true);
 			if(pktFlags & 0x2)
-				p2pSendToHost(this, &n2, sizeof(n2), false);
+				p2pSendToHost(this, &n2, n2.GetPacketSize(), false);
 		}
 	}
 	else
@@ -451,7 +451,7 @@ BOOL obj_UAV::OnNetReceive(DWORD EventID, const void* packetData, int packetSize
 	case PKT_C2C_MoveRel:
 		{
 			const PKT_C2C_MoveRel_s& n = *(PKT_C2C_MoveRel_s*)packetData;
-			r3d_assert(packetSize == sizeof(n));
+			r3d_assert(n.IsValidSize(packetSize));
 			
 			OnNetPacket(n);
 			break;
@@ -3289,7 +3289,7 @@ BOOL obj_Zombie::OnNetReceive(DWORD EventID, const void* packetData, int packetS
 	{
 		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_S2C_MoveTeleport);
 		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_C2C_MoveSetCell);
-		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_C2C_MoveRel);
+		DEFINE_GAMEOBJ_VARSIZE_PACKET_HANDLER(PKT_C2C_MoveRel);
 		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_S2C_ZombieSetState);
 		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_S2C_ZombieSetTurnState);
 		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_S2C_ZombieSprint);
@@ -1319,10 +1319,7 @@ void obj_Mech::RemoveAnimation(int i)
 			--additionalAnimData[k].animIndexRemap;
 	}
 
-	m_AnimPool.Anims[idx]->pAnimPool = NULL;
-	delete m_AnimPool.Anims[idx];
-	m_AnimPool.Anims[idx] = 0;
-	m_AnimPool.Anims.erase(m_AnimPool.Anims.begin() + idx);
+	m_AnimPool.Remove(idx);
 	m_Animation->AnimTracks.clear();
 }
 
@@ -113,8 +113,7 @@ BOOL obj_Terrain::OnCreate()
 {
 	parent::OnCreate();
 
-	if(m_SceneBox)
-		m_SceneBox->Remove(this);
+	GameWorld().RemoveFromScene(this);
 	m_SceneBox = 0;
 
 	return TRUE;
@@ -243,7 +243,7 @@ BOOL obj_Grenade::OnNetReceive(DWORD EventID, const void* packetData, int packet
 	switch(EventID)
 	{
 		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_C2C_MoveSetCell);
-		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_C2C_MoveRel);
+		DEFINE_GAMEOBJ_VARSIZE_PACKET_HANDLER(PKT_C2C_MoveRel);
 		DEFINE_GAMEOBJ_PACKET_HANDLER(PKT_S2C_Explosion);
 	}
 
@@ -43,8 +43,7 @@ BOOL obj_Tree::OnCreate()
 	DrawOrder	= OBJ_DRAWORDER_LAST-10;
 	ObjFlags      |= OBJFLAG_SkipCastRay;
 
-	if(m_SceneBox)
-		m_SceneBox->Remove(this);
+	GameWorld().RemoveFromScene(this);
 	m_SceneBox = 0;
 
 	return 1;
@@ -5,8 +5,11 @@
 #include "GameLevel.h"
 
 #include "GameObjects/ObjManag.h"
+#include "GameObjects/obj_Mesh.h"
+#include "TrueNature/ITerrain.h"
 
 #include "VisibilityGrid.h"
+#include "VisibilityGridBake.h"
 
 extern class r3dITerrain* Terrain ;
 
@@ -953,6 +956,224 @@ VisibiltyGrid::Load()
 	return 1 ;
 }
 
+//------------------------------------------------------------------------
+
+namespace
+{
+	typedef r3dTL::TArray< VisGridBakeCluster > BakeClusters ;
+	typedef r3dTL::TArray< VisGridBakeTriangle > BakeTriangles ;
+
+	void BeginBakeCluster( BakeClusters& clusters, const BakeTriangles& triangles )
+	{
+		VisGridBakeCluster cl ;
+
+		for( int i = 0 ; i < 3 ; i ++ )
+		{
+			cl.Min[ i ] = +FLT_MAX ;
+			cl.Max[ i ] = -FLT_MAX ;
+		}
+
+		cl.FirstTriangle	= triangles.Count() ;
+		cl.NumTriangles		= 0 ;
+
+		clusters.PushBack( cl ) ;
+	}
+
+	void AddBakeTriangle( BakeClusters& clusters, BakeTriangles& triangles, const r3dPoint3D& v0, const r3dPoint3D& v1, const r3dPoint3D& v2 )
+	{
+		VisGridBakeCluster& cl = clusters[ clusters.Count() - 1 ] ;
+		VisGridBakeTriangle tri ;
+
+		const r3dPoint3D* v[ 3 ] = { &v0, &v1, &v2 } ;
+
+		for( int i = 0 ; i < 3 ; i ++ )
+		{
+			tri.V[ i ][ 0 ] = v[ i ]->x ;
+			tri.V[ i ][ 1 ] = v[ i ]->y ;
+			tri.V[ i ][ 2 ] = v[ i ]->z ;
+
+			for( int k = 0 ; k < 3 ; k ++ )
+			{
+				cl.Min[ k ] = R3D_MIN( cl.Min[ k ], tri.V[ i ][ k ] ) ;
+				cl.Max[ k ] = R3D_MAX( cl.Max[ k ], tri.V[ i ][ k ] ) ;
+			}
+		}
+
+		triangles.PushBack( tri ) ;
+		cl.NumTriangles ++ ;
+	}
+
+	void EndBakeCluster( BakeClusters& clusters )
+	{
+		if( !clusters[ clusters.Count() - 1 ].NumTriangles )
+		{
+			clusters.Resize( clusters.Count() - 1 ) ;
+		}
+	}
+}
+
+int
+VisibiltyGrid::ExportBakeInput( const char* fileName, int terrainStep ) const
+{
+	if( !m_IsInited || m_CellHeightRanges.Count() != m_CellCountX * m_CellCountZ )
+	{
+		r3dOutToLog( "VisibiltyGrid::ExportBakeInput: grid isn't set up, load Grid.vis or set it up in the editor first\n" ) ;
+		return 0 ;
+	}
+
+	BakeClusters clusters ;
+	BakeTriangles triangles ;
+
+	// same objects Calculate() renders into depth, LOD 0 as distance cull is off there
+	for( ObjectIterator iter = GameWorld().GetFirstOfAllObjects(); iter.current ; iter = GameWorld().GetNextOfAllObjects( iter ) )
+	{
+		GameObject* obj = iter.current ;
+
+		if( !IsVisGridObj( obj ) || obj->ObjFlags & ( OBJFLAG_SkipDraw | OBJFLAG_Removed ) )
+			continue ;
+
+		const r3dMesh* mesh = static_cast< MeshGameObject* >( obj )->MeshLOD[ 0 ] ;
+
+		if( !SoftOcclusionBuffer::GetMeshTriangleCount( mesh ) )
+			continue ;
+
+		const D3DXMATRIX& world = obj->GetTransformMatrix() ;
+
+		BeginBakeCluster( clusters, triangles ) ;
+
+		for( int i = 0, e = mesh->NumMatChunks ; i < e ; i ++ )
+		{
+			const r3dTriBatch& batch = mesh->MatChunks[ i ] ;
+
+			if( !SoftOcclusionBuffer::IsOccluderBatch( batch ) )
+				continue ;
+
+			for( int j = batch.StartIndex, je = batch.StartIndex + ( batch.EndIndex - batch.StartIndex ) / 3 * 3 ; j < je ; j += 3 )
+			{
+				r3dPoint3D v[ 3 ] ;
+
+				for( int k = 0 ; k < 3 ; k ++ )
+				{
+					D3DXVec3TransformCoord( v[ k ].d3dx(), mesh->VertexPositions[ mesh->Indices[ j + k ] ].d3dx(), &world ) ;
+				}
+
+				AddBakeTriangle( clusters, triangles, v[ 0 ], v[ 1 ], v[ 2 ] ) ;
+			}
+		}
+
+		EndBakeCluster( clusters ) ;
+	}
+
+	int numMeshTriangles = triangles.Count() ;
+
+	if( Terrain )
+	{
+		const r3dTerrainDesc& desc = Terrain->GetDesc() ;
+
+		const int CLUSTER_QUADS = 16 ;
+
+		terrainStep = R3D_MAX( terrainStep, 1 ) ;
+
+		int quadCountX = desc.CellCountX / terrainStep ;
+		int quadCountZ = desc.CellCountZ / terrainStep ;
+
+		float step = desc.CellSize * terrainStep ;
+
+		for( int cz = 0 ; cz < quadCountZ ; cz += CLUSTER_QUADS )
+		{
+			for( int cx = 0 ; cx < quadCountX ; cx += CLUSTER_QUADS )
+			{
+				BeginBakeCluster( clusters, triangles ) ;
+
+				for( int z = cz, ze = R3D_MIN( cz + CLUSTER_QUADS, quadCountZ ) ; z < ze ; z ++ )
+				{
+					for( int x = cx, xe = R3D_MIN( cx + CLUSTER_QUADS, quadCountX ) ; x < xe ; x ++ )
+					{
+						r3dPoint3D v[ 4 ] ;
+
+						for( int k = 0 ; k < 4 ; k ++ )
+						{
+							v[ k ].x = ( x + ( k & 1 ) ) * step ;
+							v[ k ].z = ( z + ( k >> 1 ) ) * step ;
+							v[ k ].y = 0.f ;
+							v[ k ].y = Terrain->GetHeight( v[ k ] ) ;
+						}
+
+						AddBakeTriangle( clusters, triangles, v[ 0 ], v[ 1 ], v[ 2 ] ) ;
+						AddBakeTriangle( clusters, triangles, v[ 1 ], v[ 3 ], v[ 2 ] ) ;
+					}
+				}
+
+				EndBakeCluster( clusters ) ;
+			}
+		}
+	}
+
+	FILE* file = fopen( fileName, "wb" ) ;
+
+	if( !file )
+	{
+		r3dOutToLog( "VisibiltyGrid::ExportBakeInput: can't open %s\n", fileName ) ;
+		return 0 ;
+	}
+
+	VisGridBakeHeader header ;
+
+	memcpy( header.Tag, VISGRID_BAKE_TAG, sizeof header.Tag ) ;
+
+	header.Width				= m_Width ;
+	header.Height				= m_Height ;
+	header.Depth				= m_Depth ;
+
+	header.Start[ 0 ]			= m_Start.x ;
+	header.Start[ 1 ]			= m_Start.y ;
+	header.Start[ 2 ]			= m_Start.z ;
+
+	header.CellCountX			= m_CellCountX ;
+	header.CellCountY			= m_CellCountY ;
+	header.CellCountZ			= m_CellCountZ ;
+
+	header.DesiredCellHeight	= m_DesiredCellHeight ;
+
+	header.NumClusters			= clusters.Count() ;
+	header.NumTriangles			= triangles.Count() ;
+
+	COMPILE_ASSERT( sizeof( HeightRange ) == sizeof( VisGridBakeHeightRange ) ) ;
+
+	fwrite( &header, sizeof header, 1, file ) ;
+	fwrite( &m_CellHeightRanges[ 0 ], sizeof( HeightRange ) * m_CellHeightRanges.Count(), 1, file ) ;
+
+	if( clusters.Count() )
+	{
+		fwrite( &clusters[ 0 ], sizeof clusters[ 0 ] * clusters.Count(), 1, file ) ;
+		fwrite( &triangles[ 0 ], sizeof triangles[ 0 ] * triangles.Count(), 1, file ) ;
+	}
+
+	fclose( file ) ;
+
+	r3dOutToLog( "Exported visibility grid bake input to %s: %dx%dx%d cells, %d clusters, %d mesh and %d terrain triangles\n", 
+					fileName, m_CellCountX, m_CellCountY, m_CellCountZ, clusters.Count(), numMeshTriangles, triangles.Count() - numMeshTriangles ) ;
+
+	return 1 ;
+}
+
+//------------------------------------------------------------------------
+
+void VisibilityGridExportBakeInput( const char* fileName, int terrainStep )
+{
+	if( !g_pVisibilityGrid )
+		return ;
+
+	if( !g_pVisibilityGrid->IsInited() )
+	{
+		g_pVisibilityGrid->Load() ;
+	}
+
+	g_pVisibilityGrid->ExportBakeInput( fileName, terrainStep ) ;
+}
+
+//------------------------------------------------------------------------
+
 int	VisibiltyGrid::GetCellCountX ( ) const
 {
 	return m_CellCountX ;
@@ -35,6 +35,9 @@ public:
 	void			Save();
 	int				Load();
 
+	// writes input of Tools/VisGridBaker, see VisibilityGridBake.h. Terrain is sampled every terrainStep cells
+	int				ExportBakeInput( const char* fileName, int terrainStep ) const ;
+
 	void			DebugCells() const;
 
 	int				IsBBoxVisibleFrom( int cellX, int cellY, int cellZ, const r3dBoundBox& bbox ) ;
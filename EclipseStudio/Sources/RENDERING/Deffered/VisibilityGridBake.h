@@ -0,0 +1,64 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//	>	Input of Tools/VisGridBaker, CPU baker of VisibiltyGrid
+//
+//	Written by VisibiltyGrid::ExportBakeInput from the editor. Contains grid layout and world space
+//	triangles of everything VisibiltyGrid::Calculate renders into depth, grouped into clusters with
+//	bounds for culling. Baker writes Grid.vis in the same format as VisibiltyGrid::Save.
+//
+//	Shared with the tool, so no engine types here.
+//
+//	File layout:
+//		VisGridBakeHeader
+//		VisGridBakeHeightRange	[ CellCountX * CellCountZ ]
+//		VisGridBakeCluster		[ NumClusters ]
+//		VisGridBakeTriangle		[ NumTriangles ]
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define VISGRID_BAKE_TAG		"VGBAKE01"
+
+struct VisGridBakeHeader
+{
+	char	Tag[ 8 ];
+
+	float	Width;
+	float	Height;
+	float	Depth;
+
+	float	Start[ 3 ];
+
+	int		CellCountX;
+	int		CellCountY;
+	int		CellCountZ;
+
+	float	DesiredCellHeight;
+
+	int		NumClusters;
+	int		NumTriangles;
+};
+
+// same layout as VisibiltyGrid::HeightRange
+struct VisGridBakeHeightRange
+{
+	float	Min;
+	float	Max;
+
+	int		CellCount;
+};
+
+struct VisGridBakeCluster
+{
+	float	Min[ 3 ];
+	float	Max[ 3 ];
+
+	int		FirstTriangle;
+	int		NumTriangles;
+};
+
+struct VisGridBakeTriangle
+{
+	float	V[ 3 ][ 3 ];
+};
@@ -10,6 +10,8 @@
 
 Sector::Sector()
 : Loaded( 0 )
+, LoadedSlot( -1 )
+, Bytes( 0 )
 {
 
 }
@@ -29,7 +31,27 @@ SectorMaster::Settings::Settings()
 
 //------------------------------------------------------------------------
 
+SectorMaster::FrameStats::FrameStats()
+: Requests( 0 )
+, LateRequests( 0 )
+, LoadedSectors( 0 )
+, UnloadedSectors( 0 )
+, TouchedMeshes( 0 )
+, ReleasedMeshes( 0 )
+, Bytes( 0 )
+{
+
+}
+
+//------------------------------------------------------------------------
+
 SectorMaster::SectorMaster()
+: m_LastCamPos( 0, 0, 0 )
+, m_CamVelocity( 0, 0, 0 )
+, m_LastUpdateTime( 0.f )
+, m_HasLastCam( 0 )
+, m_ResidentBytes( 0 )
+, m_Simulate( 0 )
 {
 
 }
@@ -100,6 +122,8 @@ void SectorMaster::Save( const char* path )
 void SectorMaster::Reset()
 {
 	m_Sectors.Clear();
+
+	ResetStreaming();
 }
 
 //------------------------------------------------------------------------
@@ -116,6 +140,8 @@ void SectorMaster::Init( float mapStartX, float mapStartZ, float mapSizeX, float
 	m_Sectors.Resize(	int( m_Settings.MapSizeX / m_Settings.SectorSize ) + 1, 
 						int( m_Settings.MapSizeZ / m_Settings.SectorSize ) + 1 );
 
+	ResetStreaming();
+
 	r3dResetCachedMeshSectorReferences();
 }
 
@@ -148,6 +174,21 @@ void SectorMaster::AddObject( GameObject* obj )
 
 void SectorMaster::InitSectors( bool allLoaded )
 {
+	// instances of the same mesh in one sector need one reference only
+	for( int si = 0, e = m_Sectors.Count(); si < e; si ++ )
+	{
+		Sector::MeshArr& meshes = m_Sectors.AtIndex( si ).Meshes;
+
+		if( meshes.Count() > 1 )
+		{
+			r3dMesh** first = &meshes[ 0 ];
+			r3dMesh** last = first + meshes.Count();
+
+			std::sort( first, last );
+			meshes.Resize( uint32_t( std::unique( first, last ) - first ) );
+		}
+	}
+
 #ifndef FINAL_BUILD
 
 	int totalMeshes = 0;
@@ -167,10 +208,14 @@ void SectorMaster::InitSectors( bool allLoaded )
 	r3dOutToLog( "SectorMaster::InitSectors: average mesh count per sector: %.2f\n", float( totalMeshes ) / m_Sectors.Count() );
 #endif
 
+	ResetStreaming();
+
 	for( int si = 0, e = m_Sectors.Count(); si < e; si ++ )
 	{
 		Sector& s = m_Sectors.AtIndex( si );
 
+		s.Bytes = 0;
+
 		if( allLoaded )
 		{
 			for( int i = 0, e = (int)s.Meshes.Count(); i < e; i ++ )
@@ -181,10 +226,14 @@ void SectorMaster::InitSectors( bool allLoaded )
 			}
 
 			s.Loaded = 1;
+			s.LoadedSlot = m_LoadedSectors.Count();
+
+			m_LoadedSectors.PushBack( si );
 		}
 		else
 		{
 			s.Loaded = 0;
+			s.LoadedSlot = -1;
 		}
 
 	}
@@ -192,54 +241,267 @@ void SectorMaster::InitSectors( bool allLoaded )
 
 //------------------------------------------------------------------------
 
+static R3D_FORCEINLINE float DistanceXZ( const r3dPoint3D& a, const r3dPoint3D& b )
+{
+	float dx = a.x - b.x;
+	float dz = a.z - b.z;
+
+	return sqrtf( dx * dx + dz * dz );
+}
+
+//------------------------------------------------------------------------
+
+// video memory TouchMaterials of the mesh would load. Materials don't know sizes
+// of textures which were never loaded, those count as 1024x1024 DXT with mips
+static INT64 EstimateMeshBytes( r3dMesh* mesh )
+{
+	const INT64 UNKNOWN_TEXTURE_BYTES = 1024 * 1024;
+
+	INT64 bytes = 0;
+
+	for( int i = 0, e = mesh->NumMatChunks; i < e; i ++ )
+	{
+		r3dMaterial* mat = mesh->MatChunks[ i ].Mat;
+
+		// only thumbnailed materials load textures on touch
+		if( !mat || !( mat->Flags & R3D_MAT_THUMBNAILS ) )
+			continue;
+
+		r3dTexture* textures[ r3dMaterial::TEX_COUNT ];
+		mat->GetTextures( textures );
+
+		for( int t = 0; t < r3dMaterial::TEX_COUNT; t ++ )
+		{
+			r3dTexture* tex = textures[ t ];
+
+			if( !tex )
+				continue;
+
+			if( tex->GetWidth() > 0 && tex->GetHeight() > 0 && tex->GetD3DFormat() != D3DFMT_FROM_FILE )
+			{
+				bytes += INT64( tex->GetWidth() * tex->GetHeight() * GetD3DTexFormatSize( tex->GetD3DFormat() ) * 4.0f / 3.0f );
+			}
+			else
+			{
+				bytes += UNKNOWN_TEXTURE_BYTES;
+			}
+		}
+	}
+
+	return bytes;
+}
+
+//------------------------------------------------------------------------
+
 void SectorMaster::Update( const r3dCamera& cam )
 {
-	int loadedCount = 0;
-	int unloadedCount = 0;
+	UpdateStreaming( cam, r3dGetTime() );
 
-	float effectiveKeepAliveRadius = GetEffectiveKeepAliveRadius();
+#ifndef FINAL_BUILD
+	if( m_FrameStats.TouchedMeshes || m_FrameStats.ReleasedMeshes )
+	{
+		r3dOutToLog( "SectorMaster::Update: unloaded %d, loaded %d mesh materials ( %.2f MB ), %d sectors wait\n", m_FrameStats.ReleasedMeshes, m_FrameStats.TouchedMeshes,
+						m_FrameStats.Bytes / 1024.f / 1024.f, m_FrameStats.Requests - m_FrameStats.LoadedSectors );
+	}
+#endif
+}
 
-	for( int z = 0, e = m_Sectors.Height(); z < e; z ++ )
+//------------------------------------------------------------------------
+
+// Sectors within keep alive radius of camera are required, sectors within it
+// of the point camera will reach in r_sector_predict_time are prefetched.
+// Loaded sectors stay until both points are r_sector_hysteresis further away,
+// so moving along the radius doesn't reload them every other frame.
+// Only sectors around these points are looked at, loaded ones are kept in a list.
+void SectorMaster::UpdateStreaming( const r3dPoint3D& camPos, float time )
+{
+	// how fast velocity estimate follows camera, 1 / seconds
+	const float VELOCITY_RESPONSE = 4.0f;
+
+	m_FrameStats = FrameStats();
+
+	if( !m_Sectors.Count() )
+		return;
+
+	float enterRadius = GetEffectiveKeepAliveRadius();
+	float leaveRadius = enterRadius * ( 1.0f + r_sector_hysteresis->GetFloat() );
+
+	// first update or jump over keep alive radius: nothing to predict from
+	int teleported = 1;
+
+	if( m_HasLastCam && DistanceXZ( camPos, m_LastCamPos ) < enterRadius )
 	{
-		for( int x = 0, e = m_Sectors.Width(); x < e; x ++ )
+		teleported = 0;
+
+		float dt = time - m_LastUpdateTime;
+
+		if( dt > 0.0001f )
 		{
-			Sector& s = m_Sectors[ z ][ x ];
+			r3dPoint3D velocity = ( camPos - m_LastCamPos ) / dt;
+			velocity.y = 0.f;
+
+			m_CamVelocity += ( velocity - m_CamVelocity ) * R3D_MIN( dt * VELOCITY_RESPONSE, 1.0f );
+		}
+	}
+
+	if( teleported )
+	{
+		m_CamVelocity = r3dPoint3D( 0, 0, 0 );
+	}
+
+	m_LastCamPos		= camPos;
+	m_LastUpdateTime	= time;
+	m_HasLastCam		= 1;
+
+	r3dPoint3D predictedPos = camPos + m_CamVelocity * r_sector_predict_time->GetFloat();
+
+	int width = (int)m_Sectors.Width();
+	int height = (int)m_Sectors.Height();
+
+	// going backwards, unloading swaps last loaded sector into freed slot
+	for( int i = (int)m_LoadedSectors.Count() - 1; i >= 0; i -- )
+	{
+		int idx = m_LoadedSectors[ i ];
+
+		r3dPoint3D pos = GetSectorPosition( idx % width, idx / width );
+
+		if( DistanceXZ( pos, camPos ) > leaveRadius && DistanceXZ( pos, predictedPos ) > leaveRadius )
+		{
+			UnloadSector( idx );
+		}
+	}
+
+	float invSectorSize = 1.0f / m_Settings.SectorSize;
+
+	int x0 = R3D_MAX( int( ceilf( ( R3D_MIN( camPos.x, predictedPos.x ) - enterRadius - m_Settings.MapStartX ) * invSectorSize ) ), 0 );
+	int z0 = R3D_MAX( int( ceilf( ( R3D_MIN( camPos.z, predictedPos.z ) - enterRadius - m_Settings.MapStartZ ) * invSectorSize ) ), 0 );
+	int x1 = R3D_MIN( int( floorf( ( R3D_MAX( camPos.x, predictedPos.x ) + enterRadius - m_Settings.MapStartX ) * invSectorSize ) ), width - 1 );
+	int z1 = R3D_MIN( int( floorf( ( R3D_MAX( camPos.z, predictedPos.z ) + enterRadius - m_Settings.MapStartZ ) * invSectorSize ) ), height - 1 );
+
+	m_Requests.Clear();
+
+	for( int z = z0; z <= z1; z ++ )
+	{
+		for( int x = x0; x <= x1; x ++ )
+		{
+			int idx = z * width + x;
+
+			if( m_Sectors.AtIndex( idx ).Loaded )
+				continue;
 
 			r3dPoint3D pos = GetSectorPosition( x, z );
 
-			pos.y = cam.y;
+			LoadRequest req;
+
+			req.SectorIdx = idx;
 
-			float distance = ( cam - pos ).Length();
+			float distance = DistanceXZ( pos, camPos );
+
+			if( distance <= enterRadius )
+			{
+				req.Required = 1;
+				req.Priority = distance;
+			}
+			else
+			{
+				float predictedDistance = DistanceXZ( pos, predictedPos );
+
+				if( predictedDistance > enterRadius )
+					continue;
+
+				// after all required ones
+				req.Required = 0;
+				req.Priority = enterRadius + predictedDistance;
+			}
+
+			m_Requests.PushBack( req );
+		}
+	}
+
+	m_FrameStats.Requests = m_Requests.Count();
+
+	if( !m_Requests.Count() )
+		return;
+
+	std::sort( &m_Requests[ 0 ], &m_Requests[ 0 ] + m_Requests.Count(), LoadRequestCompare() );
+
+	INT64 ioBudget = INT64( R3D_MAX( r_sector_io_budget_kb->GetInt(), 0 ) ) * 1024;
+	INT64 memBudget = INT64( R3D_MAX( r_sector_mem_budget_mb->GetInt(), 0 ) ) * 1024 * 1024;
+
+	for( int i = 0, e = m_Requests.Count(); i < e; i ++ )
+	{
+		const LoadRequest& req = m_Requests[ i ];
+
+		INT64 bytes = EstimateLoadBytes( m_Sectors.AtIndex( req.SectorIdx ) );
+
+		// at least one sector a frame goes whatever it costs. After teleport
+		// there is nothing on screen to hitch, required sectors go at once
+		if( m_FrameStats.LoadedSectors && m_FrameStats.Bytes + bytes > ioBudget && !( teleported && req.Required ) )
+			break;
+
+		// prefetching is only worth it while there is memory for it
+		if( !req.Required && m_ResidentBytes + bytes > memBudget )
+			continue;
+
+		LoadSector( req.SectorIdx );
+	}
+
+	for( int i = 0, e = m_Requests.Count(); i < e; i ++ )
+	{
+		const LoadRequest& req = m_Requests[ i ];
+
+		if( req.Required && !m_Sectors.AtIndex( req.SectorIdx ).Loaded )
+		{
+			m_FrameStats.LateRequests ++;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+#ifndef FINAL_BUILD
+
+// what Update used to do, benchmark compares streaming against it
+void SectorMaster::UpdateAllSectors( const r3dPoint3D& camPos )
+{
+	m_FrameStats = FrameStats();
+
+	float effectiveKeepAliveRadius = GetEffectiveKeepAliveRadius();
+
+	for( int z = 0, e = m_Sectors.Height(); z < e; z ++ )
+	{
+		for( int x = 0, e = m_Sectors.Width(); x < e; x ++ )
+		{
+			int idx = z * m_Sectors.Width() + x;
+
+			float distance = DistanceXZ( GetSectorPosition( x, z ), camPos );
 
 			if( distance > effectiveKeepAliveRadius )
 			{
-				if( s.Loaded )
+				if( m_Sectors.AtIndex( idx ).Loaded )
 				{
-					unloadedCount += UnloadSector( s );
+					UnloadSector( idx );
 				}
 			}
 			else
 			{
-				if( !s.Loaded )
+				if( !m_Sectors.AtIndex( idx ).Loaded )
 				{
-					loadedCount += LoadSector( s );
+					LoadSector( idx );
 				}
 			}
 		}
 	}
-
-#ifndef FINAL_BUILD
-	if( loadedCount || unloadedCount )
-	{
-		r3dOutToLog( "SectorMaster::Update: unloaded %d, loaded %d mesh materials\n", unloadedCount, loadedCount );
-	}
-#endif
 }
 
+#endif
 //------------------------------------------------------------------------
 
-int SectorMaster::UnloadSector( Sector& s )
+int SectorMaster::UnloadSector( int idx )
 {
+	Sector& s = m_Sectors.AtIndex( idx );
+
+	r3d_assert( s.Loaded );
+
 	int count = 0;
 
 	for( int i = 0, e = s.Meshes.Count(); i < e; i ++ )
@@ -252,20 +514,40 @@ int SectorMaster::UnloadSector( Sector& s )
 
 		if( !mesh->SectorRefCount )
 		{
-			mesh->ReleaseMaterials();
+			if( !m_Simulate )
+				mesh->ReleaseMaterials();
 			count ++;
 		}
 	}
 
+	int lastIdx = m_LoadedSectors.GetLast();
+
+	m_LoadedSectors[ s.LoadedSlot ] = lastIdx;
+	m_Sectors.AtIndex( lastIdx ).LoadedSlot = s.LoadedSlot;
+	m_LoadedSectors.PopBack();
+
+	m_ResidentBytes -= s.Bytes;
+
 	s.Loaded = 0;
+	s.LoadedSlot = -1;
+	s.Bytes = 0;
+
+	m_FrameStats.UnloadedSectors ++;
+	m_FrameStats.ReleasedMeshes += count;
+
 	return count;
 }
 
 //------------------------------------------------------------------------
 
-int SectorMaster::LoadSector( Sector& s )
+int SectorMaster::LoadSector( int idx )
 {
+	Sector& s = m_Sectors.AtIndex( idx );
+
+	r3d_assert( !s.Loaded );
+
 	int count = 0;
+	INT64 bytes = 0;
 
 	for( int i = 0, e = s.Meshes.Count(); i < e; i ++ )
 	{
@@ -275,7 +557,10 @@ int SectorMaster::LoadSector( Sector& s )
 
 		if( !mesh->SectorRefCount )
 		{
-			mesh->TouchMaterials();
+			bytes += EstimateMeshBytes( mesh );
+
+			if( !m_Simulate )
+				mesh->TouchMaterials();
 			count ++;
 		}
 
@@ -283,22 +568,68 @@ int SectorMaster::LoadSector( Sector& s )
 	}
 
 	s.Loaded = 1;
+	s.LoadedSlot = m_LoadedSectors.Count();
+	s.Bytes = bytes;
+
+	m_LoadedSectors.PushBack( idx );
+
+	m_ResidentBytes += bytes;
+
+	m_FrameStats.LoadedSectors ++;
+	m_FrameStats.TouchedMeshes += count;
+	m_FrameStats.Bytes += bytes;
 
 	return count;
 }
 
 //------------------------------------------------------------------------
 
+INT64 SectorMaster::EstimateLoadBytes( const Sector& s ) const
+{
+	INT64 bytes = 0;
+
+	for( int i = 0, e = s.Meshes.Count(); i < e; i ++ )
+	{
+		r3dMesh* mesh = s.Meshes[ i ];
+
+		if( !mesh->SectorRefCount )
+		{
+			bytes += EstimateMeshBytes( mesh );
+		}
+	}
+
+	return bytes;
+}
+
+//------------------------------------------------------------------------
+
+void SectorMaster::ResetStreaming()
+{
+	m_LoadedSectors.Clear();
+	m_Requests.Clear();
+
+	m_LastCamPos = r3dPoint3D( 0, 0, 0 );
+	m_CamVelocity = r3dPoint3D( 0, 0, 0 );
+	m_LastUpdateTime = 0.f;
+	m_HasLastCam = 0;
+
+	m_ResidentBytes = 0;
+
+	m_FrameStats = FrameStats();
+}
+
+//------------------------------------------------------------------------
+
 void SectorMaster::LoadAllSectors()
 {
 	for( int z = 0, e = m_Sectors.Height(); z < e; z ++ )
 	{
 		for( int x = 0, e = m_Sectors.Width(); x < e; x ++ )
 		{
-			Sector& s = m_Sectors[ z ][ x ];
+			int idx = z * m_Sectors.Width() + x;
 
-			if( !s.Loaded )
-				LoadSector( s );
+			if( !m_Sectors.AtIndex( idx ).Loaded )
+				LoadSector( idx );
 		}
 	}
 }
@@ -357,4 +688,175 @@ float SectorMaster::GetEffectiveKeepAliveRadius() const
 
 //------------------------------------------------------------------------
 
+const SectorMaster::FrameStats&
+SectorMaster::GetFrameStats() const
+{
+	return m_FrameStats;
+}
+
+//------------------------------------------------------------------------
+
+INT64 SectorMaster::GetResidentBytes() const
+{
+	return m_ResidentBytes;
+}
+
+//------------------------------------------------------------------------
+#ifndef FINAL_BUILD
+
+void SectorMaster::DEBUG_FlythroughBenchmark( int frameCount )
+{
+	const float FRAME_TIME	= 1.0f / 60.0f;
+	const float SPEED		= 25.0f;	// m/s, vehicle on a road
+	const float WEAVE_TIME	= 4.0f;		// seconds, period of weaving across the road
+
+	ObjectManager& GW = GameWorld();
+
+	float minX = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxZ = -FLT_MAX;
+
+	int objCount = 0;
+
+	for( int i = 0, e = GW.GetStaticObjectCount(); i < e; i ++ )
+	{
+		GameObject* obj = GW.GetStaticObject( i );
+
+		if( !obj->IsStatic() || !( obj->ObjTypeFlags & OBJTYPE_Mesh ) )
+			continue;
+
+		const r3dPoint3D& pos = obj->GetPosition();
+
+		minX = R3D_MIN( minX, pos.x );
+		minZ = R3D_MIN( minZ, pos.z );
+		maxX = R3D_MAX( maxX, pos.x );
+		maxZ = R3D_MAX( maxZ, pos.z );
+
+		objCount ++;
+	}
+
+	if( !objCount || frameCount <= 0 )
+	{
+		r3dOutToLog( "sectorbench: level has no static meshes\n" );
+		return;
+	}
+
+	// simulation counts its own sector references, real ones are put back at the end
+	r3dTL::TArray< int > savedRefCounts( r3dMesh::AllMeshes.Count() );
+
+	for( int i = 0, e = r3dMesh::AllMeshes.Count(); i < e; i ++ )
+	{
+		savedRefCounts[ i ] = r3dMesh::AllMeshes[ i ]->SectorRefCount;
+	}
+
+	SectorMaster* sim = game_new SectorMaster;
+
+	sim->m_Simulate = 1;
+	sim->m_Settings = m_Settings;
+	sim->Init( minX, minZ, maxX - minX, maxZ - minZ );
+
+	for( int i = 0, e = GW.GetStaticObjectCount(); i < e; i ++ )
+	{
+		GameObject* obj = GW.GetStaticObject( i );
+
+		if( obj->IsStatic() && ( obj->ObjTypeFlags & OBJTYPE_Mesh ) )
+		{
+			sim->AddObject( obj );
+		}
+	}
+
+	// drive along x through the middle of the level and back, weaving by half a sector
+	float length = R3D_MAX( maxX - minX, m_Settings.SectorSize );
+	float midZ = ( minZ + maxZ ) * 0.5f;
+
+	INT64 ioBudget = INT64( R3D_MAX( r_sector_io_budget_kb->GetInt(), 0 ) ) * 1024;
+
+	r3dOutToLog( "sectorbench: %d frames at %.0f m/s over %.0fx%.0f m, %dx%d sectors, keep alive radius %.0f m, io budget %d KB\n",
+					frameCount, SPEED, maxX - minX, maxZ - minZ, sim->m_Sectors.Width(), sim->m_Sectors.Height(), GetEffectiveKeepAliveRadius(), r_sector_io_budget_kb->GetInt() );
+
+	CLOG_INDENT;
+
+	for( int pass = 0; pass < 2; pass ++ )
+	{
+		for( int i = 0, e = r3dMesh::AllMeshes.Count(); i < e; i ++ )
+		{
+			r3dMesh::AllMeshes[ i ]->SectorRefCount = 0;
+		}
+
+		sim->InitSectors( false );
+
+		INT64 totalBytes = 0;
+		INT64 peakBytes = 0;
+		int loads = 0;
+		int unloads = 0;
+		int hitchFrames = 0;
+		int lateFrames = 0;
+		int lateSectors = 0;
+
+		float timeStart = r3dGetTime();
+
+		for( int f = 0; f < frameCount; f ++ )
+		{
+			float t = f * FRAME_TIME;
+
+			float u = fmodf( t * SPEED, length * 2.0f );
+
+			r3dPoint3D camPos;
+
+			camPos.x = minX + ( u < length ? u : length * 2.0f - u );
+			camPos.y = 0.f;
+			camPos.z = midZ + sinf( t * 2.0f * R3D_PI / WEAVE_TIME ) * m_Settings.SectorSize * 0.5f;
+
+			if( pass )
+				sim->UpdateStreaming( camPos, t );
+			else
+				sim->UpdateAllSectors( camPos );
+
+			const FrameStats& fs = sim->m_FrameStats;
+
+			totalBytes += fs.Bytes;
+			loads += fs.LoadedSectors;
+			unloads += fs.UnloadedSectors;
+
+			// first frame loads surroundings of spawn point either way
+			if( f )
+			{
+				peakBytes = R3D_MAX( peakBytes, fs.Bytes );
+
+				if( fs.Bytes > ioBudget )
+					hitchFrames ++;
+			}
+
+			if( fs.LateRequests )
+			{
+				lateFrames ++;
+				lateSectors += fs.LateRequests;
+			}
+		}
+
+		float cpuTime = r3dGetTime() - timeStart;
+
+		r3dOutToLog( "%s: %.1f MB loaded, %d sector loads, %d unloads, peak %.2f MB a frame, %d frames over io budget, %d frames with late sectors ( %d sector frames ), %.4f ms per update\n",
+						pass ? "streaming" : "full grid", totalBytes / 1024.f / 1024.f, loads, unloads, peakBytes / 1024.f / 1024.f,
+						hitchFrames, lateFrames, lateSectors, cpuTime * 1000.f / frameCount );
+	}
+
+	SAFE_DELETE( sim );
+
+	for( int i = 0, e = r3dMesh::AllMeshes.Count(); i < e; i ++ )
+	{
+		r3dMesh::AllMeshes[ i ]->SectorRefCount = savedRefCounts[ i ];
+	}
+}
+
+//------------------------------------------------------------------------
+
+void SectorFlythroughBenchmark( int frameCount )
+{
+	g_pSectorMaster->DEBUG_FlythroughBenchmark( frameCount );
+}
+
+#endif
+
+//------------------------------------------------------------------------
+
 SectorMaster* g_pSectorMaster;
\ No newline at end of file
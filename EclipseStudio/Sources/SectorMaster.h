@@ -10,6 +10,8 @@ struct Sector
 
 	MeshArr	Meshes;
 	int		Loaded;
+	int		LoadedSlot;	// index in SectorMaster loaded list, -1 if not loaded
+	INT64	Bytes;		// approximate texture bytes requested when the sector was loaded
 };
 
 class SectorMaster
@@ -30,6 +32,20 @@ public:
 		float MapSizeZ;
 	};
 
+	// what last Update did
+	struct FrameStats
+	{
+		FrameStats();
+
+		int		Requests;			// sectors in load bands which are not loaded
+		int		LateRequests;		// sectors within keep alive radius left for next frames
+		int		LoadedSectors;
+		int		UnloadedSectors;
+		int		TouchedMeshes;
+		int		ReleasedMeshes;
+		INT64	Bytes;
+	};
+
 public:
 	SectorMaster();
 	~SectorMaster();
@@ -44,11 +60,10 @@ public:
 
 	void InitSectors( bool allLoaded );
 
+	// streams sectors around camera and where camera is heading, spreading loads
+	// over frames by r_sector_io_budget_kb and r_sector_mem_budget_mb
 	void Update( const r3dCamera& cam );
 
-	int UnloadSector( Sector& s );
-	int LoadSector( Sector& s );
-
 	void LoadAllSectors();
 
 	R3D_FORCEINLINE r3dPoint3D GetSectorPosition( int x, int z ) const;
@@ -60,10 +75,57 @@ public:
 
 	float GetEffectiveKeepAliveRadius() const;
 
+	const FrameStats&	GetFrameStats() const;
+	INT64				GetResidentBytes() const;
+
+#ifndef FINAL_BUILD
+	// drives simulated vehicle over static objects of the level with old full grid update
+	// and with streaming, logs stalls and bytes loaded. Doesn't touch materials
+	void DEBUG_FlythroughBenchmark( int frameCount );
+#endif
+
 private:
+	struct LoadRequest
+	{
+		int		SectorIdx;
+		int		Required;	// within keep alive radius of camera, otherwise predicted
+		float	Priority;	// lower goes first
+	};
+
+	struct LoadRequestCompare
+	{
+		bool operator()( const LoadRequest& a, const LoadRequest& b ) const { return a.Priority < b.Priority; }
+	};
+
+	void UpdateStreaming( const r3dPoint3D& camPos, float time );
+#ifndef FINAL_BUILD
+	void UpdateAllSectors( const r3dPoint3D& camPos );
+#endif
+
+	int UnloadSector( int idx );
+	int LoadSector( int idx );
+
+	INT64 EstimateLoadBytes( const Sector& s ) const;
+
+	void ResetStreaming();
+
 	Settings	m_Settings;
 	SectorGrid	m_Sectors;
 
+	r3dTL::TArray< int >			m_LoadedSectors;
+	r3dTL::TArray< LoadRequest >	m_Requests;
+
+	r3dPoint3D	m_LastCamPos;
+	r3dPoint3D	m_CamVelocity;
+	float		m_LastUpdateTime;
+	int			m_HasLastCam;
+
+	INT64		m_ResidentBytes;
+	FrameStats	m_FrameStats;
+
+	// benchmark only, keeps sector and mesh bookkeeping but doesn't touch materials
+	int			m_Simulate;
+
 } extern * g_pSectorMaster;
 
 //------------------------------------------------------------------------
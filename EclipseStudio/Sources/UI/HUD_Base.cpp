@@ -6,6 +6,8 @@
 
 #include "HUD_Base.h"
 
+#include "multiplayer/ClientGameLogic.h"
+
 
 BaseHUD::BaseHUD () 
 : bInited ( 0 )
@@ -360,6 +362,196 @@ DECLARE_CMD( ragdoll )
 	DebugPlayerRagdoll();
 }
 
+DECLARE_CMD( jobbench )
+{
+	void JobChiefBenchmark();
+	JobChiefBenchmark();
+}
+
+DECLARE_CMD( allocbench )
+{
+#ifdef USE_R3D_MEMORY_ALLOCATOR
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo( &sysinfo );
+
+	const int OPS = 2000000;
+
+	int threadCounts[] = { 1, 2, (int)sysinfo.dwNumberOfProcessors };
+	for( int i = 0; i < _countof( threadCounts ); i ++ )
+	{
+		r3dAllocatorBenchResult locked = r3dBenchmarkAllocator( threadCounts[ i ], OPS, false );
+		r3dAllocatorBenchResult cached = r3dBenchmarkAllocator( threadCounts[ i ], OPS, true );
+
+		r3dOutToLog( "allocbench %d threads: locked %.2f Mops/s (%u locks, %u contended), cached %.2f Mops/s (%u locks, %u contended)\n",
+						threadCounts[ i ],
+						locked.opsPerSecond / 1e6, locked.numLockAcquires, locked.numLockContended,
+						cached.opsPerSecond / 1e6, cached.numLockAcquires, cached.numLockContended );
+	}
+#else
+	r3dOutToLog( "allocbench: r3d memory allocator is disabled\n" );
+#endif
+}
+
+DECLARE_CMD( particlebench )
+{
+	void r3dParticleSystemBenchmark( float simTime );
+	r3dParticleSystemBenchmark( ev.NumArgs() > 1 ? ev.GetFloat( 1 ) : 10.f );
+}
+
+DECLARE_CMD( profiletrace )
+{
+#if !DISABLE_PROFILER
+	int numFrames = ev.NumArgs() > 1 ? ev.GetInteger( 1 ) : 60;
+
+	r3dProfilerTimeline::StartCapture( numFrames, "profile_trace.json" );
+	r3dOutToLog( "profiletrace: capturing %d frames into profile_trace.json\n", numFrames );
+#else
+	r3dOutToLog( "profiletrace: profiler is disabled\n" );
+#endif
+}
+
+DECLARE_CMD( netholbench )
+{
+	void p2pNetLoopbackBenchmark( float packetLoss, int latencyMs );
+	p2pNetLoopbackBenchmark( ev.NumArgs() > 1 ? ev.GetFloat( 1 ) / 100.f : 0.05f, ev.NumArgs() > 2 ? ev.GetInteger( 2 ) : 50 );
+}
+
+DECLARE_CMD( netstats )
+{
+	r3dNetwork* net = gClientLogic().net_;
+	if( !net )
+	{
+		r3dOutToLog( "netstats: not connected\n" );
+		return;
+	}
+
+	const r3dNetSendStats& st = net->sendPerSec_;
+	r3dOutToLog( "netstats: batching %s\n", net->batchSends_ ? "on" : "off" );
+	r3dOutToLog( "  packets:  %u/sec, %u bytes/sec\n", st.packets, st.bytes );
+	r3dOutToLog( "  messages: %u/sec, %u bytes/sec (%.2f packets per message)\n", st.messages, st.messageBytes, st.messages ? (float)st.packets / st.messages : 0.f );
+	r3dOutToLog( "  wire:     %u bytes/sec\n", st.wireBytes );
+}
+
+DECLARE_CMD( netmovetrace )
+{
+	void NetMoverStartTrace( const char* fileName, float seconds );
+	NetMoverStartTrace( ev.NumArgs() > 2 ? ev.GetString( 2 ) : "movetrace.bin", ev.NumArgs() > 1 ? ev.GetFloat( 1 ) : 60.f );
+}
+
+DECLARE_CMD( netmovebench )
+{
+	void NetMoverBandwidthBenchmark( const char* fileName );
+	NetMoverBandwidthBenchmark( ev.NumArgs() > 1 ? ev.GetString( 1 ) : NULL );
+}
+
+DECLARE_CMD( netcapture )
+{
+	gClientLogic().ToggleNetCapture( ev.NumArgs() > 1 ? ev.GetString( 1 ) : "netcapture.bin" );
+}
+
+DECLARE_CMD( netreplay )
+{
+	gClientLogic().ReplayNetCapture( ev.NumArgs() > 1 ? ev.GetString( 1 ) : "netcapture.bin" );
+}
+
+DECLARE_CMD( objmgrbench )
+{
+	void ObjectManagerBenchmark( int numObjects );
+	ObjectManagerBenchmark( ev.NumArgs() > 1 ? ev.GetInteger( 1 ) : 50000 );
+}
+
+DECLARE_CMD( scenebvhdump )
+{
+	void SceneBVHDumpBounds( const char* fileName );
+	SceneBVHDumpBounds( ev.NumArgs() > 1 ? ev.GetString( 1 ) : "scenebounds.bin" );
+}
+
+DECLARE_CMD( scenebvhbench )
+{
+	void SceneBVHBenchmark( const char* fileName, int numQueries );
+	SceneBVHBenchmark( ev.NumArgs() > 1 ? ev.GetString( 1 ) : "scenebounds.bin", ev.NumArgs() > 2 ? ev.GetInteger( 2 ) : 1000 );
+}
+
+DECLARE_CMD( socrecord )
+{
+	void SoftOcclusionStartRecording( const char* fileName, float seconds );
+	SoftOcclusionStartRecording( ev.NumArgs() > 1 ? ev.GetString( 1 ) : "socpath.bin", ev.NumArgs() > 2 ? ev.GetFloat( 2 ) : 30.f );
+}
+
+DECLARE_CMD( socbench )
+{
+	void SoftOcclusionBenchmark( const char* fileName );
+	SoftOcclusionBenchmark( ev.NumArgs() > 1 ? ev.GetString( 1 ) : "socpath.bin" );
+}
+
+DECLARE_CMD( vgridexport )
+{
+	void VisibilityGridExportBakeInput( const char* fileName, int terrainStep );
+	VisibilityGridExportBakeInput( ev.NumArgs() > 1 ? ev.GetString( 1 ) : "vgrid_bake.bin", ev.NumArgs() > 2 ? ev.GetInteger( 2 ) : 4 );
+}
+
+DECLARE_CMD( meshraybench )
+{
+	void MeshRayBenchmark( int numRays );
+	MeshRayBenchmark( ev.NumArgs() > 1 ? ev.GetInteger( 1 ) : 1000000 );
+}
+
+DECLARE_CMD( reslookupbench )
+{
+	void r3dTextureLookupBenchmark( int passes );
+	void r3dMeshCacheLookupBenchmark( int passes );
+
+	int passes = ev.NumArgs() > 1 ? ev.GetInteger( 1 ) : 100;
+
+	r3dTextureLookupBenchmark( passes );
+	r3dMeshCacheLookupBenchmark( passes );
+}
+
+DECLARE_CMD( terraundorec )
+{
+	int Terrain3UndoIsRecordingStrokes();
+	void Terrain3UndoRecordStrokes( const char* path );
+
+	if( Terrain3UndoIsRecordingStrokes() )
+		Terrain3UndoRecordStrokes( NULL );
+	else
+		Terrain3UndoRecordStrokes( ev.NumArgs() > 1 ? ev.GetString( 1 ) : "terrastrokes.txt" );
+}
+
+DECLARE_CMD( terraundobench )
+{
+	void Terrain3UndoBenchmark( const char* strokeFile, int budgetMB );
+
+	// "-" - random strokes
+	const char* strokeFile = ev.NumArgs() > 1 ? ev.GetString( 1 ) : "-";
+
+	Terrain3UndoBenchmark( strcmp( strokeFile, "-" ) ? strokeFile : NULL, ev.NumArgs() > 2 ? ev.GetInteger( 2 ) : 16 );
+}
+
+DECLARE_CMD( terra3mips )
+{
+	void RebuildTerrain3Mips();
+	RebuildTerrain3Mips();
+}
+
+DECLARE_CMD( terra3mipbench )
+{
+	void r3dTerrain3MipKernelBenchmark( int tileDim, int tileCount );
+	r3dTerrain3MipKernelBenchmark( ev.NumArgs() > 1 ? ev.GetInteger( 1 ) : 256, ev.NumArgs() > 2 ? ev.GetInteger( 2 ) : 256 );
+}
+
+DECLARE_CMD( terra3hfbench )
+{
+	void Terrain3HeightFieldBenchmark( int pointCount );
+	Terrain3HeightFieldBenchmark( ev.NumArgs() > 1 ? ev.GetInteger( 1 ) : 1000000 );
+}
+
+DECLARE_CMD( sectorbench )
+{
+	void SectorFlythroughBenchmark( int frameCount );
+	SectorFlythroughBenchmark( ev.NumArgs() > 1 ? ev.GetInteger( 1 ) : 18000 );
+}
+
 DECLARE_CMD( export_physx_scene )
 {
 	void DebugExportPhysxScene();
@@ -407,6 +599,30 @@ void RegisterHUDCommands()
 	REG_CCOMMAND( aura, 0, "Cycle player aura state"  );
 	REG_CCOMMAND( die, 0, "Make character die!" );
 	REG_CCOMMAND( ragdoll, 0, "Switch character to ragdoll" );
+	REG_CCOMMAND( jobbench, 0, "Benchmark job scheduler" );
+	REG_CCOMMAND( allocbench, 0, "Benchmark small allocations from several threads" );
+	REG_CCOMMAND( particlebench, 0, "Simulate all particle effects for N seconds (default 10) with scalar and SIMD update" );
+	REG_CCOMMAND( profiletrace, 0, "Capture timeline of all threads for N frames (default 60) into profile_trace.json" );
+	REG_CCOMMAND( netholbench, 0, "Simulate game traffic over lossy link (loss percent, default 5; latency ms, default 50) and log head-of-line latency per packet type" );
+	REG_CCOMMAND( netstats, 0, "Log game server send rates over last second, before and after packet batching" );
+	REG_CCOMMAND( netmovetrace, 0, "Record movement updates of local player and vehicle for N seconds (default 60) into file (default movetrace.bin)" );
+	REG_CCOMMAND( netmovebench, 0, "Replay movement trace file (synthetic if not given) through old and bit packed movement encoding and log bytes per player per second" );
+	REG_CCOMMAND( netcapture, 0, "Start/stop recording of received game server packets into file (default netcapture.bin)" );
+	REG_CCOMMAND( netreplay, 0, "Replay packet capture file through client packet handlers while disconnected and log handler time per packet type" );
+	REG_CCOMMAND( objmgrbench, 0, "Measure object update walk and lookups with N objects (default 50000) in separate object storage" );
+	REG_CCOMMAND( scenebvhdump, 0, "Save bounds of all scene objects to file (default scenebounds.bin) for scenebvhbench" );
+	REG_CCOMMAND( scenebvhbench, 0, "Measure scene BVH build, refit, frustum and box queries on saved scene bounds against brute force" );
+	REG_CCOMMAND( socrecord, 0, "Save occluders and boxes of level, then record camera path for given seconds (default socpath.bin, 30) for socbench" );
+	REG_CCOMMAND( socbench, 0, "Replay recorded camera path through software occlusion buffer, check it against per pixel reference and measure it" );
+	REG_CCOMMAND( vgridexport, 0, "Export level geometry and visibility grid layout (default vgrid_bake.bin, terrain every 4 cells) for Tools/VisGridBaker" );
+	REG_CCOMMAND( meshraybench, 0, "Trace random rays (default 1000000) at level meshes brute force and through triangle BVH, check results and measure" );
+	REG_CCOMMAND( reslookupbench, 0, "Replay texture and mesh lookups of loaded level (default 100 passes) through old list walk and resource registry, check results and measure" );
+	REG_CCOMMAND( terraundorec, 0, "Start/stop writing Terrain 3 height brush strokes to file (default terrastrokes.txt) for terraundobench" );
+	REG_CCOMMAND( terraundobench, 0, "Replay terrain strokes from file (- for random ones) through packed undo with memory budget in MB (default 16), print memory and undo/redo latency" );
+	REG_CCOMMAND( terra3mips, 0, "Rebuild Terrain 3 mips file of loaded level (level has to be saved) and log tiles per second" );
+	REG_CCOMMAND( terra3mipbench, 0, "Run Terrain 3 mip and normal kernels on N synthetic tiles of given size (default 256, 256) against scalar loops on 1 and all threads, log tiles per second" );
+	REG_CCOMMAND( terra3hfbench, 0, "Query N random points (default 1000000) through physics chunks and whole level heightfield, scalar and batched, and cast rays against it; log timings and differences" );
+	REG_CCOMMAND( sectorbench, 0, "Drive simulated vehicle through sectors of loaded level for N frames (default 18000) with full grid update and with streaming, log bytes loaded and stalls" );
 	REG_CCOMMAND( export_physx_scene, 0, "Export whole physx scene into collection file" );
 }
 #endif
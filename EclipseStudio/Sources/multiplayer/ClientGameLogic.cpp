@@ -159,9 +159,41 @@ void p2pSendToHost(const GameObject* from, DefaultPacket* packetData, int packet
 	gClientLogic().net_->SendToHost(packetData, packetSize, guaranteedAndOrdered);
 }
 
+#ifndef FINAL_BUILD
+// client side traffic mix of one player under fire, see r3dNetwork::RunLoopbackBenchmark
+void p2pNetLoopbackBenchmark(float packetLoss, int latencyMs)
+{
+	// other player entering view every few seconds (index 0 - its create packet), then moving and
+	// getting vitals/inventory updates. those can overtake create, see OnNetData
+	r3dNetBenchTraffic traffic[] = {
+		{ "CreatePlayer",     PKT_S2C_CreatePlayer,      4000, -1 },
+		{ "MoveRel",          PKT_C2C_MoveRel,           100,  0 },
+		{ "MoveSetCell",      PKT_C2C_MoveSetCell,       2000, 0 },
+		{ "PlayerFired",      PKT_C2C_PlayerFired,       150,  -1 },
+		{ "PlayerHitDynamic", PKT_C2C_PlayerHitDynamic,  150,  -1 },
+		{ "SetPlayerVitals",  PKT_S2C_SetPlayerVitals,   1000, 0 },
+		{ "BackpackModify",   PKT_S2C_BackpackModify,    3000, 0 },
+		{ "BackpackSwap",     PKT_C2S_BackpackSwap,      3000, -1 },
+		{ "ChatMessage",      PKT_C2C_ChatMessage,       5000, -1 },
+		{ "PlayerUseItem",    PKT_C2C_PlayerUseItem,     7000, -1 },
+	};
+
+	r3dNetwork net;
+	p2pSetPacketClasses(net);
+	for(int i=0; i<R3D_ARRAYSIZE(traffic); i++)
+		traffic[i].keptIfEarly = traffic[i].createdBy >= 0 && p2pKeepPacketOfPendingObject(net.GetPacketClass(traffic[i].eventId));
+
+	net.RunLoopbackBenchmark(traffic, R3D_ARRAYSIZE(traffic), packetLoss, latencyMs, 120);
+}
+#endif
+
 ClientGameLogic::ClientGameLogic()
 {
 	isGameStarted = 0; //gamehardcore
+#ifndef FINAL_BUILD
+	replayingCapture_ = false;
+	replayDropped_    = 0;
+#endif
 	Reset();
 }
 
@@ -212,6 +244,10 @@ void ClientGameLogic::Reset()
 		playerNames[i].DevIsHide = false;
 	}
 	
+	pendingNetPackets_.Clear();
+	pendingNetData_.Clear();
+	recentlyDestroyed_.Clear();
+
 	// clearing scoping.  Particularly important for Spectator modes. 
 	g_RenderScopeEffect = 0;
 
@@ -268,10 +304,39 @@ void ClientGameLogic::OnNetData(DWORD peerId, const r3dNetPacketHeader* packetDa
 
 	// pass to world event processor first.
 	if(ProcessWorldEvent(fromObj, evt->EventID, peerId, packetData, packetSize)) 
+	{
+		// object create packets are world events
+		if(pendingNetPackets_.Count())
+			ReplayPendingNetPackets();
 		return;
+	}
 
 	if(evt->FromID && fromObj == NULL) 
 	{
+		// only default channel is ordered with object create/destroy packets
+		const r3dNetPacketClass& pc = g_net.GetPacketClass(evt->EventID);
+		if(p2pKeepPacketOfPendingObject(pc))
+		{
+			AddPendingNetPacket(peerId, evt, packetSize, r3dGetTime());
+			return;
+		}
+		if(pc.channel != P2P_CHANNEL_DEFAULT || pc.delivery != R3D_NET_RELIABLE_ORDERED)
+		{
+#ifndef FINAL_BUILD
+			r3dOutToLog("event %d from non registered object %d dropped\n", evt->EventID, evt->FromID);
+#endif
+			return;
+		}
+
+#ifndef FINAL_BUILD
+		// capture can start in the middle of game, after object was created
+		if(replayingCapture_)
+		{
+			replayDropped_++;
+			return;
+		}
+#endif
+
 		r3dError("bad event %d sent from non registered object %d\n", evt->EventID, evt->FromID);
 		return; 
 	}
@@ -289,6 +354,288 @@ void ClientGameLogic::OnNetData(DWORD peerId, const r3dNetPacketHeader* packetDa
 	return;
 }
 
+namespace
+{
+	// how long movement packets wait for their object to be created
+	const float PENDING_NET_PACKET_TIMEOUT = 2.0f;
+	const int   MAX_PENDING_NET_PACKETS    = 512;
+}
+
+void ClientGameLogic::AddPendingNetPacket(DWORD peerId, const DefaultPacket* evt, int packetSize, float recvTime)
+{
+	const float curTime = r3dGetTime();
+
+	for(uint32_t i = 0; i < recentlyDestroyed_.Count(); i++)
+	{
+		// late packet of destroyed object
+		if(recentlyDestroyed_[i].netId == evt->FromID && curTime - recentlyDestroyed_[i].time <= PENDING_NET_PACKET_TIMEOUT)
+			return;
+	}
+
+	if((int)pendingNetPackets_.Count() >= MAX_PENDING_NET_PACKETS)
+		RemovePendingNetPackets(invalidGameObjectID);
+
+	if((int)pendingNetPackets_.Count() >= MAX_PENDING_NET_PACKETS)
+	{
+#ifndef FINAL_BUILD
+		r3dOutToLog("event %d from non registered object %d dropped, too many pending packets\n", evt->EventID, evt->FromID);
+#endif
+		return;
+	}
+
+	PendingNetPacket pp;
+	pp.peerId   = peerId;
+	pp.fromId   = evt->FromID;
+	pp.recvTime = recvTime;
+	pp.offset   = pendingNetData_.Count();
+	pp.size     = packetSize;
+	pendingNetPackets_.PushBack(pp);
+
+	pendingNetData_.Resize(pp.offset + packetSize);
+	memcpy(&pendingNetData_[pp.offset], evt, packetSize);
+}
+
+void ClientGameLogic::ReplayPendingNetPackets()
+{
+	// take queue out, packets of objects that are still missing are put back
+	r3dTL::TArray<PendingNetPacket> packets;
+	r3dTL::TArray<BYTE> data;
+	packets.Swap(pendingNetPackets_);
+	data.Swap(pendingNetData_);
+
+	const float curTime = r3dGetTime();
+	for(uint32_t i = 0; i < packets.Count(); i++)
+	{
+		const PendingNetPacket& pp = packets[i];
+		if(curTime - pp.recvTime > PENDING_NET_PACKET_TIMEOUT)
+			continue;
+
+		const DefaultPacket* evt = (const DefaultPacket*)&data[pp.offset];
+		if(GameWorld().GetNetworkObject(pp.fromId))
+			OnNetData(pp.peerId, evt, pp.size);
+		else
+			AddPendingNetPacket(pp.peerId, evt, pp.size, pp.recvTime);
+	}
+
+	// network id was given to new object, its packets are not late ones anymore
+	for(uint32_t i = 0; i < recentlyDestroyed_.Count(); )
+	{
+		if(GameWorld().GetNetworkObject(recentlyDestroyed_[i].netId))
+			recentlyDestroyed_.Erase(i);
+		else
+			i++;
+	}
+}
+
+void ClientGameLogic::RemovePendingNetPackets(DWORD fromId)
+{
+	const float curTime = r3dGetTime();
+
+	uint32_t count = 0;
+	int dataSize = 0;
+	for(uint32_t i = 0; i < pendingNetPackets_.Count(); i++)
+	{
+		PendingNetPacket pp = pendingNetPackets_[i];
+		if(pp.fromId == fromId || curTime - pp.recvTime > PENDING_NET_PACKET_TIMEOUT)
+			continue;
+
+		if(pp.offset != dataSize)
+			memmove(&pendingNetData_[dataSize], &pendingNetData_[pp.offset], pp.size);
+
+		pp.offset = dataSize;
+		dataSize += pp.size;
+		pendingNetPackets_[count++] = pp;
+	}
+
+	pendingNetPackets_.Resize(count);
+	pendingNetData_.Resize(dataSize);
+}
+
+#ifndef FINAL_BUILD
+namespace
+{
+	// log2 of handler time in microseconds, last bucket is everything above
+	const int NET_REPLAY_BUCKETS = 16;
+
+	struct NetReplayStats
+	{
+		DWORD	count;
+		DWORD	bytes;
+		__int64	totalTicks;
+		__int64	maxTicks;
+		DWORD	buckets[NET_REPLAY_BUCKETS];
+	};
+
+	int NetReplayBucket(double usec)
+	{
+		int b = 0;
+		while(usec >= 1.0 && b < NET_REPLAY_BUCKETS - 1)
+		{
+			usec *= 0.5;
+			b++;
+		}
+		return b;
+	}
+}
+
+void ClientGameLogic::ToggleNetCapture(const char* fileName)
+{
+	if(g_net.IsCapturing())
+		g_net.StopCapture();
+	else
+		g_net.StartCapture(fileName, P2PNET_VERSION);
+}
+
+void ClientGameLogic::ReplayNetCapture(const char* fileName)
+{
+	if(serverConnected_ || g_net.IsCapturing())
+	{
+		r3dOutToLog("netreplay: disconnect from game server and stop capture first\n");
+		return;
+	}
+
+	for(GameObject* obj = GameWorld().GetFirstObject(); obj; obj = GameWorld().GetNextObject(obj))
+	{
+		if(obj->GetNetworkID() != invalidGameObjectID)
+		{
+			r3dOutToLog("netreplay: world already has network objects\n");
+			return;
+		}
+	}
+
+	FILE* f = fopen(fileName, "rb");
+	if(!f)
+	{
+		r3dOutToLog("netreplay: can't open %s\n", fileName);
+		return;
+	}
+
+	fseek(f, 0, SEEK_END);
+	const long fileSize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	r3dNetCaptureHeader hdr;
+	if(fileSize < (long)sizeof(hdr) || fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != r3dNetCaptureHeader::MAGIC || hdr.version != r3dNetCaptureHeader::VERSION)
+	{
+		r3dOutToLog("netreplay: %s is not a capture file\n", fileName);
+		fclose(f);
+		return;
+	}
+	if(hdr.userVersion != P2PNET_VERSION)
+	{
+		r3dOutToLog("netreplay: %s was captured with protocol %x, current is %x\n", fileName, hdr.userVersion, P2PNET_VERSION);
+		fclose(f);
+		return;
+	}
+
+	const int dataSize = fileSize - sizeof(hdr);
+	r3dTL::TArray<BYTE> data;
+	data.Resize(dataSize + 1);
+	const bool readOk = fread(&data[0], dataSize, 1, f) == 1;
+	fclose(f);
+	if(!readOk)
+	{
+		r3dOutToLog("netreplay: can't read %s\n", fileName);
+		return;
+	}
+
+	// check whole file before feeding anything to handlers
+	int numPackets = 0;
+	DWORD captureTimeMs = 0;
+	for(int pos = 0; pos < dataSize; )
+	{
+		const r3dNetCaptureRecord* rec = (const r3dNetCaptureRecord*)&data[pos];
+		if(pos + (int)sizeof(*rec) > dataSize || rec->size < sizeof(DefaultPacket) || pos + (int)sizeof(*rec) + (int)rec->size > dataSize)
+		{
+			r3dOutToLog("netreplay: %s is truncated after %d packets\n", fileName, numPackets);
+			return;
+		}
+		captureTimeMs = rec->timeMs;
+		numPackets++;
+		pos += sizeof(*rec) + rec->size;
+	}
+
+	NetReplayStats* stats = game_new NetReplayStats[256];
+	memset(stats, 0, sizeof(NetReplayStats) * 256);
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	const double ticksToUsec = 1000000.0 / (double)freq.QuadPart;
+
+	replayingCapture_ = true;
+	replayDropped_    = 0;
+
+	__int64 replayTicks = 0;
+	DWORD replayBytes = 0;
+	for(int pos = 0; pos < dataSize; )
+	{
+		const r3dNetCaptureRecord* rec = (const r3dNetCaptureRecord*)&data[pos];
+		const r3dNetPacketHeader* packetData = (const r3dNetPacketHeader*)&data[pos + sizeof(*rec)];
+
+		LARGE_INTEGER t0, t1;
+		QueryPerformanceCounter(&t0);
+		OnNetData(rec->peerId, packetData, rec->size);
+		QueryPerformanceCounter(&t1);
+
+		const __int64 ticks = t1.QuadPart - t0.QuadPart;
+		NetReplayStats& st = stats[packetData->EventID];
+		st.count++;
+		st.bytes      += rec->size;
+		st.totalTicks += ticks;
+		st.maxTicks    = R3D_MAX(st.maxTicks, ticks);
+		st.buckets[NetReplayBucket(ticks * ticksToUsec)]++;
+
+		replayTicks += ticks;
+		replayBytes += rec->size;
+		pos += sizeof(*rec) + rec->size;
+	}
+
+	replayingCapture_ = false;
+
+	// remove everything capture created, so replay can be repeated
+	for(GameObject* obj = GameWorld().GetFirstObject(); obj; obj = GameWorld().GetNextObject(obj))
+	{
+		if(obj->GetNetworkID() != invalidGameObjectID)
+			obj->setActiveFlag(0);
+	}
+	Reset();
+
+	const double replayMs = replayTicks * ticksToUsec / 1000.0;
+	r3dOutToLog("netreplay: %s, %d packets, %u bytes, %.1f sec of traffic\n", fileName, numPackets, replayBytes, captureTimeMs / 1000.0f);
+	r3dOutToLog("netreplay: handled in %.2f ms, %.0fx realtime, %u packets from unknown objects dropped\n", 
+		replayMs, replayMs > 0 ? captureTimeMs / replayMs : 0.0, replayDropped_);
+
+	// most expensive packet types first
+	int order[256];
+	int numOrder = 0;
+	for(int i = 0; i < 256; i++)
+	{
+		if(stats[i].count == 0)
+			continue;
+
+		int j = numOrder++;
+		for(; j > 0 && stats[order[j - 1]].totalTicks < stats[i].totalTicks; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	r3dOutToLog("event  count    bytes  total ms   avg us   max us | handler time histogram, us: <1 <2 <4 .. <16k >=16k\n");
+	for(int k = 0; k < numOrder; k++)
+	{
+		const NetReplayStats& st = stats[order[k]];
+
+		char hist[NET_REPLAY_BUCKETS * 12] = "";
+		for(int b = 0; b < NET_REPLAY_BUCKETS; b++)
+			sprintf(hist + strlen(hist), " %u", st.buckets[b]);
+
+		r3dOutToLog("%5d %6u %8u %9.2f %8.2f %8.1f |%s\n", order[k], st.count, st.bytes, 
+			st.totalTicks * ticksToUsec / 1000.0, st.totalTicks * ticksToUsec / st.count, st.maxTicks * ticksToUsec, hist);
+	}
+
+	SAFE_DELETE_ARRAY(stats);
+}
+#endif
+
 r3dPoint3D ClientGameLogic::AdjustSpawnPositionToGround(const r3dPoint3D& pos)
 {
 	//
@@ -717,6 +1064,22 @@ IMPL_PACKET_FUNC(ClientGameLogic, PKT_S2C_CreateNetObject)
 
 IMPL_PACKET_FUNC(ClientGameLogic, PKT_S2C_DestroyNetObject)
 {
+	// movement of this object that is still waiting or arrives late must not go to next object with same id
+	RemovePendingNetPackets(n.spawnID);
+
+	DestroyedNetObject dno;
+	dno.netId = n.spawnID;
+	dno.time  = r3dGetTime();
+
+	// entries are in time order
+	uint32_t numExpired = 0;
+	while(numExpired < recentlyDestroyed_.Count() && dno.time - recentlyDestroyed_[numExpired].time > PENDING_NET_PACKET_TIMEOUT)
+		numExpired++;
+	if(numExpired)
+		recentlyDestroyed_.Erase(0, numExpired);
+
+	recentlyDestroyed_.PushBack(dno);
+
 	GameObject* obj = GameWorld().GetNetworkObject(n.spawnID);
 	//r3d_assert(obj);
 	if (!obj)
@@ -2001,6 +2364,7 @@ bool ClientGameLogic::Connect(const char* host, int port)
 	r3d_assert(disconnectStatus_ == 0);
 
 	g_net.Initialize(this, "p2pNet");
+	p2pSetPacketClasses(g_net);
 	g_net.CreateClient(0);
 	g_net.Connect(host, port);
 
@@ -2227,6 +2591,7 @@ void ClientGameLogic::Tick()
 	if(net_)
 	{
 		R3DPROFILE_FUNCTION("Net update");
+		net_->batchSends_ = g_net_batch_packets->GetBool();
 		net_->Update();
 	}
 
@@ -227,6 +227,43 @@ public:
 	int		ValidateServerVersion(__int64 sessionId);
 	
 	void		Tick();
+#ifndef FINAL_BUILD
+	// start/stop recording of received packets, see r3dNetwork::StartCapture
+	void		ToggleNetCapture(const char* fileName);
+	// feed capture through OnNetData as fast as possible and log handler time per packet type.
+	// must be called with loaded level and no game server connection, objects created by capture are removed after
+	void		ReplayNetCapture(const char* fileName);
+	bool		replayingCapture_;
+	DWORD		replayDropped_;	// packets from objects created before capture start
+#endif
+  private:
+	// movement channel is not ordered with object create/destroy on default channel, so its packets
+	// can arrive before the object exists. They are kept here and replayed after the create packet
+	struct PendingNetPacket
+	{
+		DWORD	peerId;
+		DWORD	fromId;
+		float	recvTime;
+		int	offset;		// in pendingNetData_
+		int	size;
+	};
+	r3dTL::TArray<PendingNetPacket> pendingNetPackets_;
+	r3dTL::TArray<BYTE> pendingNetData_;
+
+	// objects destroyed within pending timeout, their late movement packets are dropped, not kept
+	struct DestroyedNetObject
+	{
+		DWORD	netId;
+		float	time;
+	};
+	r3dTL::TArray<DestroyedNetObject> recentlyDestroyed_;
+
+	void		AddPendingNetPacket(DWORD peerId, const DefaultPacket* evt, int packetSize, float recvTime);
+	void		ReplayPendingNetPackets();
+	// removes packets of fromId and all packets that waited too long
+	void		RemovePendingNetPackets(DWORD fromId);
+
+  public:
 	void		SendScreenshotToServer(const char* FoundPlayer);
 	void		SendScreenshot(IDirect3DTexture9* texture,const char* FoundPlayer);
 	void		 SendScreenshotFailed(int code);
@@ -1,12 +1,129 @@
 #include "r3dPCH.h"
 #include "r3d.h"
 
+#include "r3dBitStream.h"
+
 #include "NetCellMover.h"
 
-bool CNetCellMover::IsDataChanged(const netMoveData_s& md)
+namespace
+{
+	typedef PKT_C2C_MoveRel_s        MoveRel;
+	typedef PKT_C2C_VehicleMoveRel_s VehicleMoveRel;
+
+	// position within cell, in cell radius units
+	const r3dBitQuant QUANT_REL_POS         = { -1.0f, 1.0f, MoveRel::POS_BITS };
+	const r3dBitQuant QUANT_TURN            = { 0.0f, 360.0f, MoveRel::TURN_BITS };
+	const r3dBitQuant QUANT_BEND            = { -R3D_PI_2, R3D_PI_2, MoveRel::BEND_BITS };
+
+	const r3dBitQuant QUANT_VEH_REL_POS     = { -1.0f, 1.0f, VehicleMoveRel::POS_BITS };
+	const int         VEH_ROT_COMPONENT_BITS = 10;
+	const r3dBitQuant QUANT_VEH_SPEED       = { 0.0f, 100.0f, 10 };
+	const r3dBitQuant QUANT_VEH_RPM         = { 0.0f, 10000.0f, 10 };
+	const r3dBitQuant QUANT_VEH_SIDE_SPEED  = { 0.0f, 1.0f, 5 };
+	const r3dBitQuant QUANT_WHEEL_SUSP      = { -0.5f, 0.5f, 8 };
+	const r3dBitQuant QUANT_WHEEL_ROT       = { 0.0f, 2.0f * R3D_PI, 8 };
+	const r3dBitQuant QUANT_WHEEL_TURN      = { -1.0f, 1.0f, 8 };
+
+	// sum of declared bits must match packet layout
+	COMPILE_ASSERT(2 + VEH_ROT_COMPONENT_BITS * 3 == VehicleMoveRel::ROT_BITS);
+	COMPILE_ASSERT(10 + 10 + 5 == VehicleMoveRel::ENGINE_BITS);
+	COMPILE_ASSERT(8 + 8 + 8 == VehicleMoveRel::WHEEL_BITS);
+
+#ifndef FINAL_BUILD
+	FILE*	gMoveTraceFile = NULL;
+	float	gMoveTraceEnd  = 0;
+	void	NetMoverTraceAdd(int type, const void* mover, float updateDelta, float cellSize, const void* md, int mdSize);
+#endif
+
+	float WrapAngle360(float a)
+	{
+		a = fmodf(a, 360.0f);
+		if(a < 0) a += 360.0f;
+		return a;
+	}
+
+	int QuantizeRelPos(float d, float cellSize, const r3dBitQuant& q)
+	{
+		return (int)q.Quantize(d / cellSize);
+	}
+
+	// same as D3DXQuaternionRotationYawPitchRoll, angles in degrees
+	void YawPitchRollToQuat(const r3dPoint3D& rot, float* q)
+	{
+		const float y = R3D_DEG2RAD(rot.x) * 0.5f;
+		const float p = R3D_DEG2RAD(rot.y) * 0.5f;
+		const float r = R3D_DEG2RAD(rot.z) * 0.5f;
+
+		const float sy = sinf(y), cy = cosf(y);
+		const float sp = sinf(p), cp = cosf(p);
+		const float sr = sinf(r), cr = cosf(r);
+
+		q[0] = cy * sp * cr + sy * cp * sr;
+		q[1] = sy * cp * cr - cy * sp * sr;
+		q[2] = cy * cp * sr - sy * sp * cr;
+		q[3] = cy * cp * cr + sy * sp * sr;
+	}
+
+	// inverse of YawPitchRollToQuat, same as MatrixGetYawPitchRoll of quaternion matrix. degrees in [0..360)
+	r3dPoint3D QuatToYawPitchRoll(const float* q)
+	{
+		const float x = q[0], y = q[1], z = q[2], w = q[3];
+
+		const float m00 = 1.0f - 2.0f * (y * y + z * z);
+		const float m01 = 2.0f * (x * y + w * z);
+		const float m10 = 2.0f * (x * y - w * z);
+		const float m11 = 1.0f - 2.0f * (x * x + z * z);
+		const float m20 = 2.0f * (x * z + w * y);
+		const float m21 = 2.0f * (y * z - w * x);
+		const float m22 = 1.0f - 2.0f * (x * x + y * y);
+
+		float yaw, pitch, roll;
+		if(m21 >= 1.0f)
+		{
+			yaw   = atan2f(-m10, m00);
+			pitch = -R3D_PI_2;
+			roll  = 0.0f;
+		}
+		else if(m21 <= -1.0f)
+		{
+			yaw   = atan2f(m10, m00);
+			pitch = R3D_PI_2;
+			roll  = 0.0f;
+		}
+		else
+		{
+			yaw   = atan2f(m20, m22);
+			pitch = asinf(-m21);
+			roll  = atan2f(m01, m11);
+		}
+
+		return r3dPoint3D(WrapAngle360(R3D_RAD2DEG(yaw)), WrapAngle360(R3D_RAD2DEG(pitch)), WrapAngle360(R3D_RAD2DEG(roll)));
+	}
+
+	DWORD PackRotation(const r3dPoint3D& rot)
+	{
+		float q[4];
+		YawPitchRollToQuat(rot, q);
+
+		DWORD packed = 0;
+		r3dBitWriter bw(&packed, sizeof(packed));
+		bw.WriteQuaternion(q, VEH_ROT_COMPONENT_BITS);
+		return packed;
+	}
+
+	r3dPoint3D UnpackRotation(DWORD packed)
+	{
+		float q[4];
+		r3dBitReader br(&packed, sizeof(packed));
+		br.ReadQuaternion(q, VEH_ROT_COMPONENT_BITS);
+		return QuatToYawPitchRoll(q);
+	}
+}
+
+bool CNetCellMover::IsDataChanged(const netMoveData_s& md, float curTime)
 {
 	// always send update every 60 sec (just in case)
-	if(r3dGetTime() >= nextUpdate + 60.0f)
+	if(curTime >= nextUpdate + 60.0f)
 		return true;
 
 	if(md.state != lastMd.state)
@@ -29,78 +146,102 @@ DWORD CNetCellMover::SendPosUpdate(const moveData_s& in_data, PKT_C2C_MoveSetCel
 {
 	r3d_assert(owner->NetworkLocal);
 	R3DPROFILE_FUNCTION("CNetCellMover_SendPosUpdate");
-	
+
+#ifndef FINAL_BUILD
+	if(gMoveTraceFile)
+		NetMoverTraceAdd(0, this, updateDelta, cellSize, &in_data, sizeof(in_data));
+#endif
+
+	return BuildPosUpdate(in_data, n1, n2, r3dGetTime());
+}
+
+DWORD CNetCellMover::BuildPosUpdate(const moveData_s& in_data, PKT_C2C_MoveSetCell_s* n1, PKT_C2C_MoveRel_s* n2, float curTime)
+{
 	DWORD pktFlags = 0;
 
 	// do not send anything before update ticks
-	const float curTime = r3dGetTime();
 	if(curTime < nextUpdate)
 	  return pktFlags;
 	
-	// bring angle to [0..360] and pack to [0..255]
-	int turnAngle = (int)in_data.turnAngle;
-	while(turnAngle < 0)   turnAngle += 360;
-	while(turnAngle > 360) turnAngle -= 360;
-	turnAngle *= 255;
-	turnAngle /= 360;
-	r3d_assert(turnAngle >= 0 && turnAngle <= 255);
-	
-	// bring bend angle (it's in radian) from [-PI/2...PI/2] to [0..255]
-	float bendAngle = R3D_CLAMP(in_data.bendAngle, -R3D_PI_2, R3D_PI_2);
-	bendAngle = (bendAngle + R3D_PI_2) / R3D_PI * 255.0f;
-	r3d_assert(bendAngle >= 0 && bendAngle <= 255);
-	
 	// build new movement data
 	netMoveData_s md;
 	md.pos       = in_data.pos;
-	md.turnAngle = (BYTE)turnAngle;
-	md.bendAngle = (BYTE)bendAngle;
-	md.state     = (USHORT)in_data.state;
+	md.turnAngle = (BYTE)QUANT_TURN.Quantize(WrapAngle360(in_data.turnAngle));
+	md.bendAngle = (BYTE)QUANT_BEND.Quantize(in_data.bendAngle);
+	md.state     = (USHORT)(in_data.state & ((1 << MoveRel::STATE_BITS) - 1));
 
 	// check if we moved away from our cell, if so, send absolute position update
-	float dx = md.pos.x - lastMd.cell.x;
-	float dy = md.pos.y - lastMd.cell.y;
-	float dz = md.pos.z - lastMd.cell.z;
+	float dx = md.pos.x - baseMd.pos.x;
+	float dy = md.pos.y - baseMd.pos.y;
+	float dz = md.pos.z - baseMd.pos.z;
 	if(fabs(dx) >= cellSize || 
 	   fabs(dy) >= cellSize ||
 	   fabs(dz) >= cellSize)
 	{
-		// fill change cell packet
-		n1->pos = md.pos;
+		// fill change cell packet, it's reliable and becomes new baseline
+		n1->pos       = md.pos;
+		n1->turnAngle = md.turnAngle;
+		n1->bendAngle = md.bendAngle;
+		n1->state     = md.state;
 		pktFlags |= 1;
 		
-		lastMd.cell = md.pos;
+		baseMd = md;
 		dx = 0;
 		dy = 0;
 		dz = 0;
 	}
 
 	// don't send update if nothing was changed
-	if(!IsDataChanged(md))
+	if(IsDataChanged(md, curTime))
+	  idleResends = NUM_IDLE_RESENDS;
+	else if(idleResends > 0)
+	  idleResends--;
+	else
 	  return pktFlags;
 	
-	// convert to [0..254] within cell of last update
-	int rel_x = 127 + (int)(dx * 127.0f / cellSize);
-	int rel_y = 127 + (int)(dy * 127.0f / cellSize);
-	int rel_z = 127 + (int)(dz * 127.0f / cellSize);
-	r3d_assert(rel_x < 255);
-	r3d_assert(rel_y < 255);
-	r3d_assert(rel_z < 255);
+	const int rel_x = QuantizeRelPos(dx, cellSize, QUANT_REL_POS);
+	const int rel_y = QuantizeRelPos(dy, cellSize, QUANT_REL_POS);
+	const int rel_z = QuantizeRelPos(dz, cellSize, QUANT_REL_POS);
+	const int rel_0 = QuantizeRelPos(0, cellSize, QUANT_REL_POS);
+
+	// send only fields that differ from baseline
+	int flags = 0;
+	if(++movesSinceKeyframe >= KEYFRAME_INTERVAL)
+	{
+		movesSinceKeyframe = 0;
+		flags = MoveRel::FLAG_POS | MoveRel::FLAG_TURN | MoveRel::FLAG_BEND | MoveRel::FLAG_STATE;
+	}
+	if(rel_x != rel_0 || rel_y != rel_0 || rel_z != rel_0)
+		flags |= MoveRel::FLAG_POS;
+	if(md.turnAngle != baseMd.turnAngle)
+		flags |= MoveRel::FLAG_TURN;
+	if(md.bendAngle != baseMd.bendAngle)
+		flags |= MoveRel::FLAG_BEND;
+	if(md.state != baseMd.state)
+		flags |= MoveRel::FLAG_STATE;
 
 	// build delta packet
 	pktFlags |= 2;
-	n2->rel_x     = (BYTE)rel_x;
-	n2->rel_y     = (BYTE)rel_y;
-	n2->rel_z     = (BYTE)rel_z;
-	n2->turnAngle = md.turnAngle;
-	n2->bendAngle = md.bendAngle;
-	n2->state     = md.state;
+	r3dBitWriter bw(n2->data, sizeof(n2->data));
+	bw.WriteBits(flags, MoveRel::FLAG_BITS);
+	if(flags & MoveRel::FLAG_POS)
+	{
+		bw.WriteBits(rel_x, MoveRel::POS_BITS);
+		bw.WriteBits(rel_y, MoveRel::POS_BITS);
+		bw.WriteBits(rel_z, MoveRel::POS_BITS);
+	}
+	if(flags & MoveRel::FLAG_TURN)
+		bw.WriteBits(md.turnAngle, MoveRel::TURN_BITS);
+	if(flags & MoveRel::FLAG_BEND)
+		bw.WriteBits(md.bendAngle, MoveRel::BEND_BITS);
+	if(flags & MoveRel::FLAG_STATE)
+		bw.WriteBits(md.state, MoveRel::STATE_BITS);
+
+	r3d_assert(!bw.IsOverflow());
+	r3d_assert(bw.GetNumBits() == MoveRel::GetDataBits(flags));
 	
 	// update last send values
-	lastMd.turnAngle = md.turnAngle;
-	lastMd.bendAngle = md.bendAngle;
-	lastMd.state     = md.state;
-	lastMd.pos       = md.pos;
+	lastMd = md;
 
 	// update next send time
 	nextUpdate += updateDelta;
@@ -114,36 +255,59 @@ DWORD CNetCellMover::SendPosUpdate(const moveData_s& in_data, PKT_C2C_MoveSetCel
 void CNetCellMover::SetCell(const PKT_C2C_MoveSetCell_s& n)
 {
 	r3d_assert(!owner->NetworkLocal);
-	//r3dOutToLog("... %p PKT_C2C_MoveSetCell_s %f\n", this, lastMd.cell.y);
+	SetCellData(n);
+}
 
-	lastMd.cell = n.pos;
+void CNetCellMover::SetCellData(const PKT_C2C_MoveSetCell_s& n)
+{
+	//r3dOutToLog("... %p PKT_C2C_MoveSetCell_s %f\n", this, baseMd.pos.y);
+
+	baseMd.pos       = n.pos;
+	baseMd.turnAngle = n.turnAngle;
+	baseMd.bendAngle = n.bendAngle;
+	baseMd.state     = n.state;
 }
 
 const CNetCellMover::moveData_s& CNetCellMover::DecodeMove(const PKT_C2C_MoveRel_s& n)
 {
 	r3d_assert(!owner->NetworkLocal);
-	
+	return DecodeMoveData(n);
+}
+
+const CNetCellMover::moveData_s& CNetCellMover::DecodeMoveData(const PKT_C2C_MoveRel_s& n)
+{
 	// relative packet must always follow correct cell
-	if(!(lastMd.cell.y > -99999)) 
+	if(!(baseMd.pos.y > -99999)) 
 	{
 		// for now, just DROP it.
 #ifndef FINAL_BUILD
-		r3dOutToLog("!!!! PKT_C2C_MoveRel_s %p move %f\n", this, lastMd.cell.y);
+		r3dOutToLog("!!!! PKT_C2C_MoveRel_s %p move %f\n", this, baseMd.pos.y);
 #endif
 		return lastMove;
 	}
-	r3d_assert(lastMd.cell.y > -99999);
+	r3d_assert(baseMd.pos.y > -99999);
+
+	// fields that are not present are same as in baseline
+	r3dBitReader br(n.data, sizeof(n.data));
+	const int flags = br.ReadBits(MoveRel::FLAG_BITS);
 	
 	// build new target position
-	r3dPoint3D pos = lastMd.cell;
-	pos.x += (float)(n.rel_x - 127) * cellSize / 127.0f;
-	pos.y += (float)(n.rel_y - 127) * cellSize / 127.0f;
-	pos.z += (float)(n.rel_z - 127) * cellSize / 127.0f;
+	r3dPoint3D pos = baseMd.pos;
+	if(flags & MoveRel::FLAG_POS)
+	{
+		pos.x += br.ReadQuantized(QUANT_REL_POS) * cellSize;
+		pos.y += br.ReadQuantized(QUANT_REL_POS) * cellSize;
+		pos.z += br.ReadQuantized(QUANT_REL_POS) * cellSize;
+	}
+
+	const BYTE   turnAngle = (flags & MoveRel::FLAG_TURN)  ? (BYTE)br.ReadBits(MoveRel::TURN_BITS) : baseMd.turnAngle;
+	const BYTE   bendAngle = (flags & MoveRel::FLAG_BEND)  ? (BYTE)br.ReadBits(MoveRel::BEND_BITS) : baseMd.bendAngle;
+	const USHORT state     = (flags & MoveRel::FLAG_STATE) ? (USHORT)br.ReadBits(MoveRel::STATE_BITS) : baseMd.state;
 	
 	lastMove.pos        = pos;
-	lastMove.turnAngle  = (float)n.turnAngle / 255.0f * 360.0f;
-	lastMove.bendAngle  = ((float)n.bendAngle / 255.0f) * R3D_PI - R3D_PI_2;
-	lastMove.state      = n.state;
+	lastMove.turnAngle  = QUANT_TURN.Dequantize(turnAngle);
+	lastMove.bendAngle  = QUANT_BEND.Dequantize(bendAngle);
+	lastMove.state      = state;
 
 	lastRecv = r3dGetTime();
 	return lastMove;
@@ -183,10 +347,10 @@ r3dPoint3D CNetCellMover::GetVelocityToNetTarget(const r3dPoint3D& pos, float ch
 
 #ifdef VEHICLES_ENABLED
 
-bool CVehicleNetCellMover::IsDataChanged(const netMoveData_s& md)
+bool CVehicleNetCellMover::IsDataChanged(const netMoveData_s& md, float curTime)
 {
 	// always send update every 60 sec (just in case)
-	if(r3dGetTime() >= nextUpdate + 60.0f)
+	if(curTime >= nextUpdate + 60.0f)
 		return true;
 
 	if(md.state != lastMd.state)
@@ -195,7 +359,8 @@ bool CVehicleNetCellMover::IsDataChanged(const netMoveData_s& md)
 	if((md.pos - lastMd.pos).Length() > 0.1f)
 		return true;
 
-	if ((md.rot - lastMd.rot).Length() > 0.1f)
+	// ~0.1 degree difference
+	if(md.rot != lastMd.rot)
 		return true;
 
 	return false;			
@@ -207,63 +372,111 @@ DWORD CVehicleNetCellMover::SendPosUpdate(const moveData_s& in_data, PKT_C2C_Veh
 	//r3d_assert(owner->NetworkLocal);
 	R3DPROFILE_FUNCTION("CNetCellMover_SendPosUpdate");
 
+#ifndef FINAL_BUILD
+	if(gMoveTraceFile)
+		NetMoverTraceAdd(1, this, updateDelta, cellSize, &in_data, sizeof(in_data));
+#endif
+
+	return BuildPosUpdate(in_data, n1, n2, r3dGetTime());
+}
+
+DWORD CVehicleNetCellMover::BuildPosUpdate(const moveData_s& in_data, PKT_C2C_VehicleMoveSetCell_s* n1, PKT_C2C_VehicleMoveRel_s* n2, float curTime)
+{
 	DWORD pktFlags = 0;
 
 	// do not send anything before update ticks
-	const float curTime = r3dGetTime();
 	if(curTime < nextUpdate)
 		return pktFlags;
 
 	// build new movement data
 	netMoveData_s md;
 	md.pos   = in_data.pos;
-	md.rot	 = in_data.rot;
+	md.rot	 = PackRotation(in_data.rot);
 	md.state = (USHORT)in_data.state;
 
 	// check if we moved away from our cell, if so, send absolute position update
-	float dx = md.pos.x - lastMd.cell.x;
-	float dy = md.pos.y - lastMd.cell.y;
-	float dz = md.pos.z - lastMd.cell.z;
+	float dx = md.pos.x - baseMd.pos.x;
+	float dy = md.pos.y - baseMd.pos.y;
+	float dz = md.pos.z - baseMd.pos.z;
 	if(fabs(dx) >= cellSize || 
 		fabs(dy) >= cellSize ||
 		fabs(dz) >= cellSize)
 	{
-		// fill change cell packet
-		n1->pos = md.pos;
+		// fill change cell packet, it's reliable and becomes new baseline
+		n1->pos   = md.pos;
+		n1->rot   = md.rot;
+		n1->state = md.state;
 		pktFlags |= 1;
 
-		lastMd.cell = md.pos;
+		baseMd = md;
 		dx = 0;
 		dy = 0;
 		dz = 0;
 	}
 
 	// don't send update if nothing was changed
-	if(!IsDataChanged(md))
+	if(IsDataChanged(md, curTime))
+		idleResends = NUM_IDLE_RESENDS;
+	else if(idleResends > 0)
+		idleResends--;
+	else
 		return pktFlags;
 
-	// convert to [0..254] within cell of last update
-	int rel_x = 127 + (int)(dx * 127.0f / cellSize);
-	int rel_y = 127 + (int)(dy * 127.0f / cellSize);
-	int rel_z = 127 + (int)(dz * 127.0f / cellSize);
-	r3d_assert(rel_x < 255);
-	r3d_assert(rel_y < 255);
-	r3d_assert(rel_z < 255);
+	const int rel_x = QuantizeRelPos(dx, cellSize, QUANT_VEH_REL_POS);
+	const int rel_y = QuantizeRelPos(dy, cellSize, QUANT_VEH_REL_POS);
+	const int rel_z = QuantizeRelPos(dz, cellSize, QUANT_VEH_REL_POS);
+	const int rel_0 = QuantizeRelPos(0, cellSize, QUANT_VEH_REL_POS);
+
+	// send only fields that differ from baseline, engine and wheels are always sent
+	int flags = 0;
+	if(++movesSinceKeyframe >= KEYFRAME_INTERVAL)
+	{
+		movesSinceKeyframe = 0;
+		flags = VehicleMoveRel::FLAG_POS | VehicleMoveRel::FLAG_ROT | VehicleMoveRel::FLAG_STATE;
+	}
+	if(rel_x != rel_0 || rel_y != rel_0 || rel_z != rel_0)
+		flags |= VehicleMoveRel::FLAG_POS;
+	if(md.rot != baseMd.rot)
+		flags |= VehicleMoveRel::FLAG_ROT;
+	if(md.state != baseMd.state)
+		flags |= VehicleMoveRel::FLAG_STATE;
+
+	const int numWheels = R3D_CLAMP(in_data.numWheels, 0, (int)MAX_WHEELS);
 
 	// build delta packet
 	pktFlags |= 2;
-	n2->rel_x     = (BYTE)rel_x;
-	n2->rel_y     = (BYTE)rel_y;
-	n2->rel_z     = (BYTE)rel_z;
-	n2->rot_x	  = (short)floor(in_data.rot.x * 65535 / 1000);
-	n2->rot_y	  = (short)floor(in_data.rot.y * 65535 / 1000);
-	n2->rot_z	  = (short)floor(in_data.rot.z * 65535 / 1000);
+	r3dBitWriter bw(n2->data, sizeof(n2->data));
+	bw.WriteBits(flags, VehicleMoveRel::FLAG_BITS);
+	bw.WriteBits(numWheels, VehicleMoveRel::WHEEL_COUNT_BITS);
+	if(flags & VehicleMoveRel::FLAG_POS)
+	{
+		bw.WriteBits(rel_x, VehicleMoveRel::POS_BITS);
+		bw.WriteBits(rel_y, VehicleMoveRel::POS_BITS);
+		bw.WriteBits(rel_z, VehicleMoveRel::POS_BITS);
+	}
+	if(flags & VehicleMoveRel::FLAG_ROT)
+		bw.WriteBits(md.rot, VehicleMoveRel::ROT_BITS);
+	if(flags & VehicleMoveRel::FLAG_STATE)
+		bw.WriteBits(md.state, VehicleMoveRel::STATE_BITS);
+
+	bw.WriteQuantized(in_data.speed, QUANT_VEH_SPEED);
+	bw.WriteQuantized(in_data.engineRpm, QUANT_VEH_RPM);
+	bw.WriteQuantized(in_data.sideSpeed, QUANT_VEH_SIDE_SPEED);
+	for(int i = 0; i < numWheels; i++)
+	{
+		// wheel rotation is only visual, wrap it to single turn
+		float wheelRot = fmodf(in_data.wheelRotation[i], 2.0f * R3D_PI);
+		if(wheelRot < 0) wheelRot += 2.0f * R3D_PI;
 
-	n2->state     = md.state;
+		bw.WriteQuantized(in_data.wheelSuspTravel[i], QUANT_WHEEL_SUSP);
+		bw.WriteQuantized(wheelRot, QUANT_WHEEL_ROT);
+		bw.WriteQuantized(in_data.wheelTurnAngle[i], QUANT_WHEEL_TURN);
+	}
+
+	r3d_assert(!bw.IsOverflow());
+	r3d_assert(bw.GetNumBits() == VehicleMoveRel::GetDataBits(flags, numWheels));
 
-	lastMd.rot		 = md.rot;
-	lastMd.state     = md.state;
-	lastMd.pos       = md.pos;
+	lastMd = md;
 
 	// update next send time
 	nextUpdate += updateDelta;
@@ -276,36 +489,63 @@ DWORD CVehicleNetCellMover::SendPosUpdate(const moveData_s& in_data, PKT_C2C_Veh
 void CVehicleNetCellMover::SetCell(const PKT_C2C_VehicleMoveSetCell_s& n)
 {
 	r3d_assert(!owner->NetworkLocal);
+	SetCellData(n);
+}
 
-	lastMd.cell = n.pos;
+void CVehicleNetCellMover::SetCellData(const PKT_C2C_VehicleMoveSetCell_s& n)
+{
+	baseMd.pos   = n.pos;
+	baseMd.rot   = n.rot;
+	baseMd.state = n.state;
 }
 
 const CVehicleNetCellMover::moveData_s& CVehicleNetCellMover::DecodeMove(const PKT_C2C_VehicleMoveRel_s& n)
 {
 	r3d_assert(!owner->NetworkLocal);
+	return DecodeMoveData(n);
+}
 
-	if(!(lastMd.cell.y > -99999)) 
+const CVehicleNetCellMover::moveData_s& CVehicleNetCellMover::DecodeMoveData(const PKT_C2C_VehicleMoveRel_s& n)
+{
+	if(!(baseMd.pos.y > -99999)) 
 	{
 #ifndef FINAL_BUILD
-		r3dOutToLog("!!!! PKT_C2C_MoveRel_s %p move %f\n", this, lastMd.cell.y);
+		r3dOutToLog("!!!! PKT_C2C_VehicleMoveRel_s %p move %f\n", this, baseMd.pos.y);
 #endif
 		return lastMove;
 	}
-	r3d_assert(lastMd.cell.y > -99999);
+	r3d_assert(baseMd.pos.y > -99999);
 
-	r3dPoint3D pos = lastMd.cell;
-	pos.x += (float)(n.rel_x - 127) * cellSize / 127.0f;
-	pos.y += (float)(n.rel_y - 127) * cellSize / 127.0f;
-	pos.z += (float)(n.rel_z - 127) * cellSize / 127.0f;
-	
-	r3dPoint3D rot;
-	rot.x = (float)n.rot_x * 1000 / 65535;
-	rot.y = (float)n.rot_y * 1000 / 65535;
-	rot.z = (float)n.rot_z * 1000 / 65535;
+	// fields that are not present are same as in baseline
+	r3dBitReader br(n.data, sizeof(n.data));
+	const int flags     = br.ReadBits(VehicleMoveRel::FLAG_BITS);
+	const int numWheels = R3D_MIN((int)br.ReadBits(VehicleMoveRel::WHEEL_COUNT_BITS), (int)MAX_WHEELS);
+
+	r3dPoint3D pos = baseMd.pos;
+	if(flags & VehicleMoveRel::FLAG_POS)
+	{
+		pos.x += br.ReadQuantized(QUANT_VEH_REL_POS) * cellSize;
+		pos.y += br.ReadQuantized(QUANT_VEH_REL_POS) * cellSize;
+		pos.z += br.ReadQuantized(QUANT_VEH_REL_POS) * cellSize;
+	}
+
+	const DWORD  rot   = (flags & VehicleMoveRel::FLAG_ROT)   ? br.ReadBits(VehicleMoveRel::ROT_BITS) : baseMd.rot;
+	const USHORT state = (flags & VehicleMoveRel::FLAG_STATE) ? (USHORT)br.ReadBits(VehicleMoveRel::STATE_BITS) : baseMd.state;
 
 	lastMove.pos        = pos;
-	lastMove.rot		= rot;
-	lastMove.state      = n.state;
+	lastMove.rot        = UnpackRotation(rot);
+	lastMove.state      = state;
+
+	lastMove.speed      = br.ReadQuantized(QUANT_VEH_SPEED);
+	lastMove.engineRpm  = br.ReadQuantized(QUANT_VEH_RPM);
+	lastMove.sideSpeed  = br.ReadQuantized(QUANT_VEH_SIDE_SPEED);
+	lastMove.numWheels  = numWheels;
+	for(int i = 0; i < numWheels; i++)
+	{
+		lastMove.wheelSuspTravel[i] = br.ReadQuantized(QUANT_WHEEL_SUSP);
+		lastMove.wheelRotation[i]   = br.ReadQuantized(QUANT_WHEEL_ROT);
+		lastMove.wheelTurnAngle[i]  = br.ReadQuantized(QUANT_WHEEL_TURN);
+	}
 
 	lastRecv = r3dGetTime();
 	return lastMove;
@@ -344,3 +584,441 @@ r3dPoint3D CVehicleNetCellMover::GetVelocityToNetTarget(const r3dPoint3D& pos, f
 #endif
 
 
+
+#ifndef FINAL_BUILD
+
+//
+// movement traces and bandwidth benchmark
+//
+namespace
+{
+	const DWORD MOVE_TRACE_MAGIC   = 'MVTR';
+	const DWORD MOVE_TRACE_VERSION = 1;
+
+	enum { TRACE_PLAYER = 0, TRACE_VEHICLE = 1 };
+
+	struct MoveTraceRecord
+	{
+		int		type;
+		DWORD		moverId;
+		float		time;
+		float		updateDelta;
+		float		cellSize;
+		int		mdSize;
+		BYTE		md[192];
+	};
+
+	// packet layout before bit packing, payload bytes without DefaultPacket header
+	const int LEGACY_MOVEREL_SIZE         = 3 + 1 + 1 + 2;
+	const int LEGACY_MOVESETCELL_SIZE     = 12;
+	const int LEGACY_VEHICLE_MOVEREL_SIZE = 3 + 3 * 2 + 2 * 2 + 1 + 2 + 8 * 2 * 3;
+
+	// RakNet per message header: flags, bit length, message/ordering index, channel
+	const int RAKNET_MESSAGE_HEADER = 10;
+
+	void NetMoverTraceAdd(int type, const void* mover, float updateDelta, float cellSize, const void* md, int mdSize)
+	{
+		const float curTime = r3dGetTime();
+		if(curTime >= gMoveTraceEnd)
+		{
+			fclose(gMoveTraceFile);
+			gMoveTraceFile = NULL;
+			r3dOutToLog("netmovetrace: done\n");
+			return;
+		}
+
+		const BYTE  t  = (BYTE)type;
+		const DWORD id = (DWORD)(UINT_PTR)mover;
+		const WORD  sz = (WORD)mdSize;
+		fwrite(&t, sizeof(t), 1, gMoveTraceFile);
+		fwrite(&id, sizeof(id), 1, gMoveTraceFile);
+		fwrite(&curTime, sizeof(curTime), 1, gMoveTraceFile);
+		fwrite(&updateDelta, sizeof(updateDelta), 1, gMoveTraceFile);
+		fwrite(&cellSize, sizeof(cellSize), 1, gMoveTraceFile);
+		fwrite(&sz, sizeof(sz), 1, gMoveTraceFile);
+		fwrite(md, mdSize, 1, gMoveTraceFile);
+	}
+
+	bool NetMoverLoadTrace(const char* fileName, r3dTL::TArray<MoveTraceRecord>& records)
+	{
+		FILE* f = fopen(fileName, "rb");
+		if(!f)
+			return false;
+
+		DWORD hdr[2] = {0};
+		if(fread(hdr, sizeof(hdr), 1, f) != 1 || hdr[0] != MOVE_TRACE_MAGIC || hdr[1] != MOVE_TRACE_VERSION)
+		{
+			r3dOutToLog("netmovebench: %s is not a move trace\n", fileName);
+			fclose(f);
+			return false;
+		}
+
+		for(;;)
+		{
+			MoveTraceRecord r;
+			BYTE t;
+			WORD sz;
+			if(fread(&t, sizeof(t), 1, f) != 1 ||
+			   fread(&r.moverId, sizeof(r.moverId), 1, f) != 1 ||
+			   fread(&r.time, sizeof(r.time), 1, f) != 1 ||
+			   fread(&r.updateDelta, sizeof(r.updateDelta), 1, f) != 1 ||
+			   fread(&r.cellSize, sizeof(r.cellSize), 1, f) != 1 ||
+			   fread(&sz, sizeof(sz), 1, f) != 1 ||
+			   sz > sizeof(r.md) ||
+			   fread(r.md, sz, 1, f) != 1)
+				break;
+
+			r.type   = t;
+			r.mdSize = sz;
+			records.PushBack(r);
+		}
+
+		fclose(f);
+		return true;
+	}
+
+	DWORD NetMoverRand(DWORD& seed)
+	{
+		seed = seed * 1664525 + 1013904223;
+		return seed >> 8;
+	}
+
+	float NetMoverRandFloat(DWORD& seed, float a, float b)
+	{
+		return a + (b - a) * (float)(NetMoverRand(seed) & 0xFFFF) / 65535.0f;
+	}
+
+	// players switching between standing, walking, running and sprinting, vehicles driving curves.
+	// sampled at 60 fps, as SendPosUpdate is called every frame
+	void NetMoverSyntheticTrace(r3dTL::TArray<MoveTraceRecord>& records)
+	{
+		const int   NUM_PLAYERS  = 16;
+		const float TRACE_TIME   = 60.0f;
+		const float FRAME_TIME   = 1.0f / 60;
+		const float PHASE_SPEED[] = { 0.0f, 1.5f, 4.5f, 6.5f };
+
+		DWORD seed = 12345;
+		for(int p = 0; p < NUM_PLAYERS; p++)
+		{
+			r3dPoint3D pos(NetMoverRandFloat(seed, 0, 1000), 0, NetMoverRandFloat(seed, 0, 1000));
+			float heading = NetMoverRandFloat(seed, 0, 360);
+			float turnRate = 0;
+			int   phase = 0;
+			float phaseEnd = 0;
+			int   dir = 0;
+
+			for(float t = 0; t < TRACE_TIME; t += FRAME_TIME)
+			{
+				if(t >= phaseEnd)
+				{
+					phase    = NetMoverRand(seed) % R3D_ARRAYSIZE(PHASE_SPEED);
+					phaseEnd = t + NetMoverRandFloat(seed, 2.0f, 8.0f);
+					turnRate = NetMoverRand(seed) % 3 ? NetMoverRandFloat(seed, -60.0f, 60.0f) : 0.0f;
+					dir      = phase ? NetMoverRand(seed) % 8 : 0;
+				}
+
+				heading += turnRate * FRAME_TIME;
+				const float speed = PHASE_SPEED[phase];
+				pos.x += sinf(R3D_DEG2RAD(heading)) * speed * FRAME_TIME;
+				pos.z += cosf(R3D_DEG2RAD(heading)) * speed * FRAME_TIME;
+				pos.y  = 30.0f + sinf(pos.x * 0.05f) * 3.0f + cosf(pos.z * 0.03f) * 2.0f;
+
+				CNetCellMover::moveData_s md;
+				md.pos       = pos;
+				md.turnAngle = heading;
+				md.bendAngle = sinf(t * 0.3f + p) * 0.2f;
+				md.state     = (USHORT)(phase | (dir << 8));
+
+				MoveTraceRecord r;
+				r.type        = TRACE_PLAYER;
+				r.moverId     = p;
+				r.time        = t;
+				r.updateDelta = 1.0f / 10;
+				r.cellSize    = (float)PKT_C2C_MoveSetCell_s::PLAYER_CELL_RADIUS;
+				r.mdSize      = sizeof(md);
+				memcpy(r.md, &md, sizeof(md));
+				records.PushBack(r);
+			}
+		}
+
+#ifdef VEHICLES_ENABLED
+		const int NUM_VEHICLES = 4;
+		for(int v = 0; v < NUM_VEHICLES; v++)
+		{
+			r3dPoint3D pos(NetMoverRandFloat(seed, 0, 1000), 0, NetMoverRandFloat(seed, 0, 1000));
+			float heading = NetMoverRandFloat(seed, 0, 360);
+			float speed = 0, targetSpeed = 0, steer = 0;
+			float wheelRot = 0;
+			float phaseEnd = 0;
+
+			for(float t = 0; t < TRACE_TIME; t += FRAME_TIME)
+			{
+				if(t >= phaseEnd)
+				{
+					phaseEnd    = t + NetMoverRandFloat(seed, 3.0f, 10.0f);
+					targetSpeed = NetMoverRand(seed) % 4 ? NetMoverRandFloat(seed, 5.0f, 25.0f) : 0.0f;
+					steer       = NetMoverRandFloat(seed, -0.4f, 0.4f);
+				}
+
+				speed += R3D_CLAMP(targetSpeed - speed, -8.0f * FRAME_TIME, 4.0f * FRAME_TIME);
+				heading += R3D_RAD2DEG(steer) * speed * 0.1f * FRAME_TIME;
+				pos.x += sinf(R3D_DEG2RAD(heading)) * speed * FRAME_TIME;
+				pos.z += cosf(R3D_DEG2RAD(heading)) * speed * FRAME_TIME;
+				pos.y  = 30.0f + sinf(pos.x * 0.05f) * 3.0f + cosf(pos.z * 0.03f) * 2.0f;
+				wheelRot += speed / 0.4f * FRAME_TIME;
+
+				CVehicleNetCellMover::moveData_s md;
+				memset(&md, 0, sizeof(md));
+				md.pos       = pos;
+				md.rot       = r3dPoint3D(heading, sinf(pos.z * 0.03f) * 5.0f, speed > 0.1f ? sinf(t * 2.0f) * 2.0f : 0.0f);
+				md.state     = 0;
+				md.speed     = speed;
+				md.engineRpm = 800.0f + speed * 200.0f;
+				md.sideSpeed = R3D_CLAMP(fabsf(steer) * speed / 15.0f, 0.0f, 1.0f);
+				md.numWheels = 4;
+				for(int i = 0; i < md.numWheels; i++)
+				{
+					md.wheelSuspTravel[i] = speed > 0.1f ? sinf(t * 7.0f + i) * 0.05f : 0.0f;
+					md.wheelRotation[i]   = wheelRot;
+					md.wheelTurnAngle[i]  = i < 2 ? steer : 0.0f;
+				}
+
+				MoveTraceRecord r;
+				r.type        = TRACE_VEHICLE;
+				r.moverId     = NUM_PLAYERS + v;
+				r.time        = t;
+				r.updateDelta = 0.1f;
+				r.cellSize    = (float)PKT_C2C_MoveSetCell_s::VEHICLE_CELL_RADIUS;
+				r.mdSize      = sizeof(md);
+				memcpy(r.md, &md, sizeof(md));
+				records.PushBack(r);
+			}
+		}
+#endif
+	}
+
+	struct MoveBenchStats
+	{
+		int	movers;
+		float	seconds;
+		int	setCells;
+		int	moveRels;
+		int	bytes;
+		int	legacyBytes;
+		float	maxPosErr;
+		float	maxAngleErr;
+	};
+
+	float AngleDiff360(float a, float b)
+	{
+		const float d = WrapAngle360(a - b);
+		return R3D_MIN(d, 360.0f - d);
+	}
+
+	void NetMoverBenchPlayer(const r3dTL::TArray<MoveTraceRecord>& records, DWORD moverId, MoveBenchStats& st)
+	{
+		CNetCellMover* sender   = NULL;
+		CNetCellMover* receiver = NULL;
+		float t0 = 0, t1 = 0;
+
+		for(unsigned int i = 0; i < records.Count(); i++)
+		{
+			const MoveTraceRecord& r = records[i];
+			if(r.moverId != moverId)
+				continue;
+
+			if(!sender)
+			{
+				sender   = game_new CNetCellMover(NULL, r.updateDelta, r.cellSize);
+				receiver = game_new CNetCellMover(NULL, r.updateDelta, r.cellSize);
+				t0 = r.time;
+			}
+			t1 = r.time;
+
+			CNetCellMover::moveData_s md;
+			memcpy(&md, r.md, R3D_MIN(r.mdSize, (int)sizeof(md)));
+
+			PKT_C2C_MoveSetCell_s n1;
+			PKT_C2C_MoveRel_s     n2;
+			const DWORD pktFlags = sender->BuildPosUpdate(md, &n1, &n2, r.time);
+			if(pktFlags & 0x1)
+			{
+				st.setCells++;
+				st.bytes       += sizeof(n1) + RAKNET_MESSAGE_HEADER;
+				st.legacyBytes += sizeof(DefaultPacket) + LEGACY_MOVESETCELL_SIZE + RAKNET_MESSAGE_HEADER;
+				receiver->SetCellData(n1);
+			}
+			if(pktFlags & 0x2)
+			{
+				const int size = n2.GetPacketSize();
+				r3d_assert(n2.IsValidSize(size));
+
+				st.moveRels++;
+				st.bytes       += size + RAKNET_MESSAGE_HEADER;
+				st.legacyBytes += sizeof(DefaultPacket) + LEGACY_MOVEREL_SIZE + RAKNET_MESSAGE_HEADER;
+
+				const CNetCellMover::moveData_s& dec = receiver->DecodeMoveData(n2);
+				st.maxPosErr   = R3D_MAX(st.maxPosErr, (dec.pos - md.pos).Length());
+				st.maxAngleErr = R3D_MAX(st.maxAngleErr, AngleDiff360(dec.turnAngle, md.turnAngle));
+			}
+		}
+
+		if(sender)
+		{
+			st.movers++;
+			st.seconds += t1 - t0;
+		}
+		SAFE_DELETE(sender);
+		SAFE_DELETE(receiver);
+	}
+
+#ifdef VEHICLES_ENABLED
+	void NetMoverBenchVehicle(const r3dTL::TArray<MoveTraceRecord>& records, DWORD moverId, MoveBenchStats& st)
+	{
+		CVehicleNetCellMover* sender   = NULL;
+		CVehicleNetCellMover* receiver = NULL;
+		float t0 = 0, t1 = 0;
+
+		for(unsigned int i = 0; i < records.Count(); i++)
+		{
+			const MoveTraceRecord& r = records[i];
+			if(r.moverId != moverId)
+				continue;
+
+			if(!sender)
+			{
+				sender   = game_new CVehicleNetCellMover(NULL, r.updateDelta, r.cellSize);
+				receiver = game_new CVehicleNetCellMover(NULL, r.updateDelta, r.cellSize);
+				t0 = r.time;
+			}
+			t1 = r.time;
+
+			CVehicleNetCellMover::moveData_s md;
+			memset(&md, 0, sizeof(md));
+			memcpy(&md, r.md, R3D_MIN(r.mdSize, (int)sizeof(md)));
+
+			PKT_C2C_VehicleMoveSetCell_s n1;
+			PKT_C2C_VehicleMoveRel_s     n2;
+			const DWORD pktFlags = sender->BuildPosUpdate(md, &n1, &n2, r.time);
+			if(pktFlags & 0x1)
+			{
+				st.setCells++;
+				st.bytes       += sizeof(n1) + RAKNET_MESSAGE_HEADER;
+				st.legacyBytes += sizeof(DefaultPacket) + LEGACY_MOVESETCELL_SIZE + RAKNET_MESSAGE_HEADER;
+				receiver->SetCellData(n1);
+			}
+			if(pktFlags & 0x2)
+			{
+				const int size = n2.GetPacketSize();
+				r3d_assert(n2.IsValidSize(size));
+
+				st.moveRels++;
+				st.bytes       += size + RAKNET_MESSAGE_HEADER;
+				st.legacyBytes += sizeof(DefaultPacket) + LEGACY_VEHICLE_MOVEREL_SIZE + RAKNET_MESSAGE_HEADER;
+
+				// rotation error as angle between quaternions
+				const CVehicleNetCellMover::moveData_s& dec = receiver->DecodeMoveData(n2);
+				float q0[4], q1[4];
+				YawPitchRollToQuat(md.rot, q0);
+				YawPitchRollToQuat(dec.rot, q1);
+				const float dot = fabsf(q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] + q0[3] * q1[3]);
+				const float angle = R3D_RAD2DEG(2.0f * acosf(R3D_MIN(dot, 1.0f)));
+
+				st.maxPosErr   = R3D_MAX(st.maxPosErr, (dec.pos - md.pos).Length());
+				st.maxAngleErr = R3D_MAX(st.maxAngleErr, angle);
+			}
+		}
+
+		if(sender)
+		{
+			st.movers++;
+			st.seconds += t1 - t0;
+		}
+		SAFE_DELETE(sender);
+		SAFE_DELETE(receiver);
+	}
+#endif
+
+	void NetMoverBenchReport(const char* name, const MoveBenchStats& st)
+	{
+		if(!st.movers || st.seconds <= 0)
+			return;
+
+		// bytes per mover per second
+		const float sec       = st.seconds;
+		const float legacy    = st.legacyBytes / sec;
+		const float packed    = st.bytes / sec;
+		const float hdrs      = (st.setCells + st.moveRels) * (float)RAKNET_MESSAGE_HEADER / sec;
+
+		r3dOutToLog("%-8s %3d movers, %.1f sec each: %.1f moves/sec, %.2f cells/sec\n", name, st.movers, sec / st.movers, st.moveRels / sec, st.setCells / sec);
+		r3dOutToLog("         bytes per %s per sec: legacy %.1f, packed %.1f (%.0f%%); payload only: legacy %.1f, packed %.1f (%.0f%%)\n",
+			name, legacy, packed, packed * 100.0f / legacy, legacy - hdrs, packed - hdrs, (packed - hdrs) * 100.0f / (legacy - hdrs));
+		r3dOutToLog("         max error: position %.3fm, angle %.2f deg\n", st.maxPosErr, st.maxAngleErr);
+	}
+}
+
+void NetMoverStartTrace(const char* fileName, float seconds)
+{
+	if(gMoveTraceFile)
+		fclose(gMoveTraceFile);
+
+	gMoveTraceFile = fopen(fileName, "wb");
+	if(!gMoveTraceFile)
+	{
+		r3dOutToLog("netmovetrace: can't open %s\n", fileName);
+		return;
+	}
+
+	const DWORD hdr[2] = { MOVE_TRACE_MAGIC, MOVE_TRACE_VERSION };
+	fwrite(hdr, sizeof(hdr), 1, gMoveTraceFile);
+
+	gMoveTraceEnd = r3dGetTime() + seconds;
+	r3dOutToLog("netmovetrace: recording %.0f sec of local movement to %s\n", seconds, fileName);
+}
+
+void NetMoverBandwidthBenchmark(const char* fileName)
+{
+	r3dTL::TArray<MoveTraceRecord> records;
+
+	const char* source = fileName;
+	if(!fileName || !NetMoverLoadTrace(fileName, records))
+	{
+		source = "synthetic";
+		NetMoverSyntheticTrace(records);
+	}
+
+	r3dOutToLog("netmovebench: %s trace, %d samples\n", source, records.Count());
+
+	MoveBenchStats plrStats, vehStats;
+	memset(&plrStats, 0, sizeof(plrStats));
+	memset(&vehStats, 0, sizeof(vehStats));
+
+	const float t0 = r3dGetTime();
+
+	// replay every mover separately, in order of first appearance
+	r3dTL::TArray<DWORD> done;
+	for(unsigned int i = 0; i < records.Count(); i++)
+	{
+		const MoveTraceRecord& r = records[i];
+
+		bool seen = false;
+		for(unsigned int k = 0; k < done.Count() && !seen; k++)
+			seen = done[k] == r.moverId;
+		if(seen)
+			continue;
+		done.PushBack(r.moverId);
+
+		if(r.type == TRACE_PLAYER)
+			NetMoverBenchPlayer(records, r.moverId, plrStats);
+#ifdef VEHICLES_ENABLED
+		else if(r.type == TRACE_VEHICLE)
+			NetMoverBenchVehicle(records, r.moverId, vehStats);
+#endif
+	}
+
+	NetMoverBenchReport("player", plrStats);
+	NetMoverBenchReport("vehicle", vehStats);
+	r3dOutToLog("netmovebench: done in %.2f sec\n", r3dGetTime() - t0);
+}
+
+#endif // FINAL_BUILD
@@ -10,17 +10,25 @@ class CNetCellMover
 	float		updateDelta;
 	float		nextUpdate;
 	float		cellSize;	// radius of cell
+
+	// move updates are unreliable, so last state is repeated few times after it stopped changing
+	enum { NUM_IDLE_RESENDS = 3 };
+	int		idleResends;
+
+	// every Nth move update carries all fields, for receivers that missed baseline (object was created for them later)
+	enum { KEYFRAME_INTERVAL = 10 };
+	int		movesSinceKeyframe;
 	
-	// last sended values of moveData_s
+	// packed values of moveData_s
 	struct netMoveData_s {
-	  r3dPoint3D	cell;		// center position of last sended cell
 	  r3dPoint3D	pos;
 	  BYTE		turnAngle;
 	  BYTE		bendAngle;
 	  USHORT	state;
 	};
-	netMoveData_s	lastMd;
-	bool		IsDataChanged(const netMoveData_s& md);
+	netMoveData_s	lastMd;		// last sended values
+	netMoveData_s	baseMd;		// values from last PKT_C2C_MoveSetCell_s, pos is cell center. PKT_C2C_MoveRel_s is delta against it
+	bool		IsDataChanged(const netMoveData_s& md, float curTime);
 	
   public:
 	// input-output move data
@@ -39,26 +47,37 @@ class CNetCellMover
 		cellSize    = in_cellSize;
 		nextUpdate  = 0;
 		lastRecv    = 0;
+		idleResends = 0;
+		movesSinceKeyframe = 0;
 
 		lastMd.pos        = r3dPoint3D(-99999, -99999, -99999);
-		lastMd.cell       = r3dPoint3D(-99999, -99999, -99999);
 		lastMd.turnAngle  = 0;
 		lastMd.bendAngle  = 0;
 		lastMd.state      = 0xFFFF;
 
+		baseMd.pos        = r3dPoint3D(-99999, -99999, -99999);
+		baseMd.turnAngle  = 0;
+		baseMd.bendAngle  = 128;	// zero bend
+		baseMd.state      = 0;
+
 		lastMove.pos       = r3dPoint3D(-99999, -99999, -99999);
 		lastMove.bendAngle = 0.0f;
 		lastMove.turnAngle = 0.0f;
 		lastMove.state     = 0;
 	};
 
-	// local functions, build movement update packet
+	// local functions, build movement update packet. n2 must be sent with n2->GetPacketSize() bytes
 	DWORD		SendPosUpdate(const moveData_s& in_data, PKT_C2C_MoveSetCell_s* n1, PKT_C2C_MoveRel_s* n2);
+	// same as SendPosUpdate, without owner checks and at given time (movement benchmark)
+	DWORD		BuildPosUpdate(const moveData_s& in_data, PKT_C2C_MoveSetCell_s* n1, PKT_C2C_MoveRel_s* n2, float curTime);
 
 	// remote functions
 	float		lastRecv;	// last time network update was received
 	void		SetCell(const PKT_C2C_MoveSetCell_s& n);
 	const moveData_s& DecodeMove(const PKT_C2C_MoveRel_s& n);
+	// same as SetCell/DecodeMove, without owner checks
+	void		SetCellData(const PKT_C2C_MoveSetCell_s& n);
+	const moveData_s& DecodeMoveData(const PKT_C2C_MoveRel_s& n);
 	
   	moveData_s	lastMove;	// last data from network update
 	const moveData_s& NetData() {
@@ -70,7 +89,7 @@ class CNetCellMover
 	}
 	void		SetStartCell(const r3dPoint3D& pos) {
 		r3d_assert(!owner->NetworkLocal);
-		lastMd.cell = pos;
+		baseMd.pos = pos;
 		lastMove.pos = pos;
 	}
 	
@@ -79,17 +98,17 @@ class CNetCellMover
 	// reset mover state to specific position	
 	void		Teleport(const r3dPoint3D& pos) {
 		lastMd.pos   = r3dPoint3D(-99999, -99999, -99999);
-		lastMd.cell  = r3dPoint3D(-99999, -99999, -99999);
+		baseMd.pos   = r3dPoint3D(-99999, -99999, -99999);
 		lastMove.pos = pos;
 	}
 
 #ifdef WO_SERVER	
 	// server helper functions - only it can directly modify cell
 	const r3dPoint3D&	SrvGetCell() const { 
-		return lastMd.cell;
+		return baseMd.pos;
 	}
 	void			SrvSetCell(const r3dPoint3D& pos) { 
-		lastMd.cell = pos;
+		baseMd.pos = pos;
 	}
 #endif
 };
@@ -101,21 +120,32 @@ class CVehicleNetCellMover : public CNetCellMover
 private:
 	struct netMoveData_s 
 	{
-		r3dPoint3D	cell;
 		r3dPoint3D	pos;
-		r3dPoint3D	rot;
-		USHORT	state;
+		DWORD		rot;	// smallest three quaternion
+		USHORT		state;
 	};
 
 	netMoveData_s lastMd;
-	bool IsDataChanged(const netMoveData_s& md);
+	netMoveData_s baseMd;
+	bool IsDataChanged(const netMoveData_s& md, float curTime);
 
 public:
+	enum { MAX_WHEELS = PKT_C2C_VehicleMoveRel_s::MAX_WHEELS };
+
 	struct moveData_s 
 	{
 		r3dPoint3D	pos;
-		r3dPoint3D	rot;
-		USHORT	state;
+		r3dPoint3D	rot;	// yaw, pitch, roll in degrees
+		USHORT		state;
+
+		float		speed;
+		float		engineRpm;
+		float		sideSpeed;	// [0..1]
+
+		int		numWheels;
+		float		wheelSuspTravel[MAX_WHEELS];
+		float		wheelRotation[MAX_WHEELS];
+		float		wheelTurnAngle[MAX_WHEELS];
 	};
 
 public:
@@ -129,18 +159,24 @@ public:
 		lastRecv    = 0;
 
 		lastMd.pos        = r3dPoint3D(-99999, -99999, -99999);
-		lastMd.cell       = r3dPoint3D(-99999, -99999, -99999);
-		lastMd.rot		  = r3dPoint3D(0, 0 , 0);
+		lastMd.rot        = 0;
 		lastMd.state      = 0xFFFF;
 
+		baseMd.pos        = r3dPoint3D(-99999, -99999, -99999);
+		baseMd.rot        = 0;
+		baseMd.state      = 0;
+
+		memset(&lastMove, 0, sizeof(lastMove));
 		lastMove.pos       = r3dPoint3D(-99999, -99999, -99999);
-		lastMove.rot	   = r3dPoint3D(0, 0 , 0);
-		lastMove.state     = 0;
 	};
 
+	// n2 must be sent with n2->GetPacketSize() bytes
 	DWORD SendPosUpdate(const moveData_s& in_data, PKT_C2C_VehicleMoveSetCell_s* n1, PKT_C2C_VehicleMoveRel_s* n2);
+	DWORD BuildPosUpdate(const moveData_s& in_data, PKT_C2C_VehicleMoveSetCell_s* n1, PKT_C2C_VehicleMoveRel_s* n2, float curTime);
 	void SetCell(const PKT_C2C_VehicleMoveSetCell_s& n);
 	const moveData_s& DecodeMove(const PKT_C2C_VehicleMoveRel_s& n);
+	void SetCellData(const PKT_C2C_VehicleMoveSetCell_s& n);
+	const moveData_s& DecodeMoveData(const PKT_C2C_VehicleMoveRel_s& n);
 	r3dPoint3D	GetVelocityToNetTarget(const r3dPoint3D& pos, float chase_speed, float teleport_delta_sec);
 
 	moveData_s lastMove;
@@ -158,27 +194,34 @@ public:
 	void SetStartCell(const r3dPoint3D& pos) 
 	{
 		r3d_assert(!owner->NetworkLocal);
-		lastMd.cell = pos;
+		baseMd.pos = pos;
 		lastMove.pos = pos;
 	}
 
 	void Teleport(const r3dPoint3D& pos) 
 	{
 		lastMd.pos   = r3dPoint3D(-99999, -99999, -99999);
-		lastMd.cell  = r3dPoint3D(-99999, -99999, -99999);
+		baseMd.pos   = r3dPoint3D(-99999, -99999, -99999);
 		lastMove.pos = pos;
 	}
 
 #ifdef WO_SERVER	
 	const r3dPoint3D& SrvGetCell() const 
 	{ 
-		return lastMd.cell;
+		return baseMd.pos;
 	}
 	void SrvSetCell(const r3dPoint3D& pos) 
 	{ 
-		lastMd.cell = pos;
+		baseMd.pos = pos;
 	}
 #endif
 };
 
 #endif
+
+#ifndef FINAL_BUILD
+// records move data of all local movers for given time
+void	NetMoverStartTrace(const char* fileName, float seconds);
+// replays recorded (or synthetic, if file can't be opened) traces through old and new packing and logs bytes per mover per second
+void	NetMoverBandwidthBenchmark(const char* fileName);
+#endif
@@ -22,7 +22,7 @@ class GameObject;
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 // needs to be upped EACH time WarZ.exe changes to make sure that PunkBuster will work properly
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-#define P2PNET_VERSION		(0x000001ce + GBWEAPINFO_VERSION + GBGAMEINFO_VERSION + GAMEPLAYPARAM_VERSION)
+#define P2PNET_VERSION		(0x000001d0 + GBWEAPINFO_VERSION + GBGAMEINFO_VERSION + GAMEPLAYPARAM_VERSION)
 
 #define NETID_PLAYERS_START	1		// players [1--MAX_NUM_PLAYERS]
 #define MAX_NUM_PLAYERS		512
@@ -276,6 +276,103 @@ enum pkttype_e
   #error Shit happens, more that 255 packet ids
 #endif
 
+// ordering channels. packets of different channels are not ordered relative to each other,
+// so packet is moved out of default channel only if it doesn't depend on order of other subsystems.
+// packets from object that is not created yet (or already destroyed) can arrive on every channel except default.
+enum p2pchannel_e
+{
+  P2P_CHANNEL_DEFAULT = 0,	// object create/destroy, game state and everything not listed in p2pSetPacketClasses
+  P2P_CHANNEL_MOVEMENT,		// cell updates, teleports, packet barrier
+  P2P_CHANNEL_COMBAT,		// fire and hit events, must stay ordered for server fire/hit counter
+  P2P_CHANNEL_VITALS,
+  P2P_CHANNEL_INVENTORY,	// backpack/inventory operations and their answers
+  P2P_CHANNEL_CHAT,
+};
+
+// must be called by both client and server right after r3dNetwork::Initialize
+inline void p2pSetPacketClasses(r3dNetwork& net)
+{
+  // movement: relative updates are sequenced on the same channel as cell/teleport/barrier packets,
+  // so they never arrive before cell they're relative to and stale ones are dropped after barrier
+  net.SetPacketClass(PKT_S2C_MoveTeleport,            R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_MOVEMENT);
+  net.SetPacketClass(PKT_C2C_MoveSetCell,             R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_MOVEMENT);
+  net.SetPacketClass(PKT_C2C_MoveRel,                 R3D_NET_UNRELIABLE_SEQUENCED, P2P_CHANNEL_MOVEMENT);
+  net.SetPacketClass(PKT_C2C_PacketBarrier,           R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_MOVEMENT);
+#ifdef VEHICLES_ENABLED
+  net.SetPacketClass(PKT_C2C_VehicleMoveSetCell,      R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_MOVEMENT);
+  net.SetPacketClass(PKT_C2C_VehicleMoveRel,          R3D_NET_UNRELIABLE_SEQUENCED, P2P_CHANNEL_MOVEMENT);
+#endif
+
+  // vitals are sent only when changed, so they can't be lost
+  net.SetPacketClass(PKT_S2C_SetPlayerVitals,         R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_VITALS);
+
+  net.SetPacketClass(PKT_C2C_PlayerSwitchWeapon,      R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_COMBAT);
+  net.SetPacketClass(PKT_C2C_PlayerReload,            R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_COMBAT);
+  net.SetPacketClass(PKT_C2C_PlayerFired,             R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_COMBAT);
+  net.SetPacketClass(PKT_C2C_PlayerHitNothing,        R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_COMBAT);
+  net.SetPacketClass(PKT_C2C_PlayerHitStatic,         R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_COMBAT);
+  net.SetPacketClass(PKT_C2C_PlayerHitStaticPierced,  R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_COMBAT);
+  net.SetPacketClass(PKT_C2C_PlayerHitDynamic,        R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_COMBAT);
+  net.SetPacketClass(PKT_C2C_PlayerHitResource,       R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_COMBAT);
+
+  // pure visual effects
+  net.SetPacketClass(PKT_S2C_SpawnExplosion,          R3D_NET_RELIABLE_UNORDERED,   P2P_CHANNEL_DEFAULT);
+
+  static const int inventoryPackets[] = {
+    PKT_C2S_PlayerUnloadClip,
+    PKT_C2S_PlayerCombineClip,
+    PKT_C2C_PlayerUseItem,
+    PKT_S2C_PlayerUsedItemAns,
+    PKT_C2S_PlayerChangeBackpack,
+    PKT_C2S_BackpackDrop,
+    PKT_C2S_BackpackSwap,
+    PKT_C2S_BackpackJoin,
+    PKT_C2S_BackpackDisassembleItem,
+    PKT_S2C_BackpackAddNew,
+    PKT_S2C_BackpackModify,
+    PKT_S2C_BackpackReplace,
+    PKT_S2C_BackpackUnlock,
+    PKT_S2C_InventoryAddNew,
+    PKT_S2C_InventoryModify,
+    PKT_C2S_ShopBuyReq,
+    PKT_C2S_FromInventoryReq,
+    PKT_C2S_ToInventoryReq,
+    PKT_S2C_InventoryOpAns,
+    PKT_C2S_RepairItemReq,
+    PKT_S2C_RepairItemAns,
+    PKT_C2S_LearnRecipe,
+    PKT_C2S_CraftItem,
+    PKT_S2C_CraftAns,
+    PKT_C2S_LockboxItemBackpackToLockbox,
+    PKT_C2S_LockboxItemLockboxToBackpack,
+  };
+  for(int i=0; i<R3D_ARRAYSIZE(inventoryPackets); i++)
+    net.SetPacketClass(inventoryPackets[i],           R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_INVENTORY);
+
+  net.SetPacketClass(PKT_C2C_ChatMessage,             R3D_NET_RELIABLE_ORDERED,     P2P_CHANNEL_CHAT);
+}
+
+// packet from object that is not created yet. Ordered default channel packets can't overtake create.
+// movement and all reliable packets of other channels are kept until object is created (vitals and
+// inventory are sent only when changed), unreliable ones are dropped
+inline bool p2pKeepPacketOfPendingObject(const r3dNetPacketClass& pc)
+{
+  if(pc.channel == P2P_CHANNEL_MOVEMENT)
+    return true;
+  if(pc.channel == P2P_CHANNEL_DEFAULT && pc.delivery == R3D_NET_RELIABLE_ORDERED)
+    return false;
+  return pc.delivery != R3D_NET_UNRELIABLE_SEQUENCED;
+}
+
+// for bit packed packets sent with their actual size, see PKT_C2C_MoveRel_s
+#define DEFINE_GAMEOBJ_VARSIZE_PACKET_HANDLER(xxx) \
+  case xxx: { \
+    const xxx##_s&n = *(xxx##_s*)packetData; \
+    r3d_assert(n.IsValidSize(packetSize)); \
+    OnNetPacket(n); \
+    return TRUE; \
+  }
+
 #define DEFINE_PACKET_HANDLER(xxx) \
   case xxx: { \
     const xxx##_s&n = *(xxx##_s*)packetData; \
@@ -596,18 +693,51 @@ struct PKT_C2C_MoveSetCell_s : public DefaultPacketMixin<PKT_C2C_MoveSetCell>
 	const static int VEHICLE_CELL_RADIUS = 10;
 
 	r3dPoint3D	pos;
+
+	// baseline for following PKT_C2C_MoveRel_s, same packing
+	BYTE		turnAngle;
+	BYTE		bendAngle;
+	USHORT		state;
 };
 
 struct PKT_C2C_MoveRel_s : public DefaultPacketMixin<PKT_C2C_MoveRel>
 {
-	// (CELL_RADIUS*2)/[0-255] offset from previously received absolute position
-	BYTE		rel_x;
-	BYTE		rel_y;
-	BYTE		rel_z;
+	// bit packed delta against last PKT_C2C_MoveSetCell_s, see CNetCellMover::SendPosUpdate.
+	// first FLAG_BITS tell which fields follow, packet is sent with GetPacketSize() bytes
+	enum
+	{
+		FLAG_POS	= (1<<0),	// position within cell, (CELL_RADIUS*2)/[0..255]
+		FLAG_TURN	= (1<<1),	// [0..360] packed to [0..255]
+		FLAG_BEND	= (1<<2),	// [-PI/2..PI/2] packed to [0..255]
+		FLAG_STATE	= (1<<3),	// reflected PlayerState. [0..7] bits - state, [8..11] - dir
+
+		FLAG_BITS	= 4,
+		POS_BITS	= 8,
+		TURN_BITS	= 8,
+		BEND_BITS	= 8,
+		STATE_BITS	= 12,
+
+		MAX_DATA_SIZE = (FLAG_BITS + POS_BITS * 3 + TURN_BITS + BEND_BITS + STATE_BITS + 7) / 8,
+	};
 
-	BYTE		turnAngle;	// [0..360] packed to [0..255]
-	BYTE		bendAngle;	// [-PI/2..PI/2] packet to [0..255]
-	USHORT		state;		// reflected PlayerState. [0..8] bits - state, [9,11] - dir
+	BYTE		data[MAX_DATA_SIZE];
+
+	static int	GetDataBits(int flags)
+	{
+		return FLAG_BITS + 
+			((flags & FLAG_POS)   ? POS_BITS * 3 : 0) +
+			((flags & FLAG_TURN)  ? TURN_BITS : 0) +
+			((flags & FLAG_BEND)  ? BEND_BITS : 0) +
+			((flags & FLAG_STATE) ? STATE_BITS : 0);
+	}
+	int		GetPacketSize() const
+	{
+		return sizeof(*this) - MAX_DATA_SIZE + (GetDataBits(data[0]) + 7) / 8;
+	}
+	bool		IsValidSize(int packetSize) const
+	{
+		return packetSize > (int)sizeof(*this) - MAX_DATA_SIZE && packetSize == GetPacketSize();
+	}
 };
 
 struct PKT_C2S_MoveCameraLocation_s : public DefaultPacketMixin<PKT_C2S_MoveCameraLocation>
@@ -1528,29 +1658,55 @@ struct PKT_C2S_DBG_LogMessage_s : public DefaultPacketMixin<PKT_C2S_DBG_LogMessa
 #ifdef VEHICLES_ENABLED
 struct PKT_C2C_VehicleMoveSetCell_s : public DefaultPacketMixin<PKT_C2C_VehicleMoveSetCell>
 {
-	r3dPoint3D pos;	
+	r3dPoint3D	pos;
+
+	// baseline for following PKT_C2C_VehicleMoveRel_s, same packing
+	DWORD		rot;
+	USHORT		state;
 };
 
 struct PKT_C2C_VehicleMoveRel_s : public DefaultPacketMixin<PKT_C2C_VehicleMoveRel>
-{	
-	BYTE		rel_x;
-	BYTE		rel_y;
-	BYTE		rel_z;
-	
-	short		rot_x;
-	short		rot_y;
-	short		rot_z;
+{
+	// bit packed delta against last PKT_C2C_VehicleMoveSetCell_s, see CVehicleNetCellMover::SendPosUpdate.
+	// first FLAG_BITS and WHEEL_COUNT_BITS tell which fields follow, packet is sent with GetPacketSize() bytes
+	enum
+	{
+		FLAG_POS	= (1<<0),	// position within cell, (CELL_RADIUS*2)/[0..1023]
+		FLAG_ROT	= (1<<1),	// rotation quaternion, smallest three
+		FLAG_STATE	= (1<<2),
 
-	short		speed;
-	short		engineRpm;
+		FLAG_BITS	= 3,
+		WHEEL_COUNT_BITS = 4,
+		MAX_WHEELS	= 8,
 
-	BYTE		sideSpeed;
+		POS_BITS	= 10,
+		ROT_BITS	= 2 + 10 * 3,	// r3dBitQuaternionSize(10)
+		STATE_BITS	= 16,
+		ENGINE_BITS	= 10 + 10 + 5,	// speed, engine rpm, side speed
+		WHEEL_BITS	= 8 + 8 + 8,	// suspension travel, rotation, turn angle
 
-	USHORT		state;
+		MAX_DATA_SIZE = (FLAG_BITS + WHEEL_COUNT_BITS + POS_BITS * 3 + ROT_BITS + STATE_BITS + ENGINE_BITS + WHEEL_BITS * MAX_WHEELS + 7) / 8,
+	};
+
+	BYTE		data[MAX_DATA_SIZE];
 
-	short wheelSuspTravel[8];
-	short wheelRotation[8];
-	short wheelTurnAngle[8];
+	static int	GetDataBits(int flags, int numWheels)
+	{
+		return FLAG_BITS + WHEEL_COUNT_BITS + ENGINE_BITS + WHEEL_BITS * numWheels +
+			((flags & FLAG_POS)   ? POS_BITS * 3 : 0) +
+			((flags & FLAG_ROT)   ? ROT_BITS : 0) +
+			((flags & FLAG_STATE) ? STATE_BITS : 0);
+	}
+	int		GetPacketSize() const
+	{
+		const int flags     = data[0] & ((1 << FLAG_BITS) - 1);
+		const int numWheels = R3D_MIN((data[0] >> FLAG_BITS) & ((1 << WHEEL_COUNT_BITS) - 1), (int)MAX_WHEELS);
+		return sizeof(*this) - MAX_DATA_SIZE + (GetDataBits(flags, numWheels) + 7) / 8;
+	}
+	bool		IsValidSize(int packetSize) const
+	{
+		return packetSize > (int)sizeof(*this) - MAX_DATA_SIZE && packetSize == GetPacketSize();
+	}
 };
 
 struct PKT_C2S_TurrerAngles_s : public DefaultPacketMixin<PKT_C2S_TurrerAngles>
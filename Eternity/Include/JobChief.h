@@ -1,13 +1,73 @@
 #ifndef R3D_JOBCHIEF_H
 #define R3D_JOBCHIEF_H
 
+//------------------------------------------------------------------------
+// Work stealing task scheduler.
+//
+// Every thread (worker threads and the thread that called Init) owns a deque
+// of tasks. Owner pushes/pops at the top, idle threads steal the oldest task.
+// Tasks are grouped by TaskGroup (fork/join scope); waiting on a group runs
+// its pending tasks (and tasks of groups nested into it) on the waiting thread.
+//
+// ThreadIndex passed to task functions is in [0, GetThreadCount()), 0 is the
+// thread that called Init. Other threads may submit work too, but it is
+// executed inline on them with ThreadIndex 0.
+//------------------------------------------------------------------------
+
 class JobChief
 {
 public:
 	typedef void (*ExecFunc)( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex );
+	typedef void (*TaskFunc)( void* Data, size_t ThreadIndex );
 
 	typedef r3dTL::TArray< HANDLE > ThreadHandles;
 
+	class TaskGroup
+	{
+	public:
+		TaskGroup();
+		~TaskGroup();
+
+	public:
+		void Run( TaskFunc func, void* data );
+
+		// items are split adaptively - range is halved only while other threads are hungry.
+		// grain 0 - pick automatically
+		void ParallelFor( ExecFunc func, void* data, size_t itemCount, size_t grain = 0 );
+
+		// func is run as a task of this group once all previous tasks finish, Wait() waits for it too.
+		// call after all Run/ParallelFor of the owner thread
+		void SetContinuation( TaskFunc func, void* data );
+
+		void Wait();
+
+	private:
+		friend class JobChief;
+
+		volatile LONG	mPending;	// queued and running tasks, high bit - owner sleeps in Wait()
+		TaskGroup*		mParent;
+
+		TaskFunc		mContFunc;
+		void*			mContData;
+
+		HANDLE volatile	mWaitEvent;
+
+		// make copy constructor and assignment operator inaccessible
+		TaskGroup( const TaskGroup& );
+		TaskGroup& operator = ( const TaskGroup& );
+	};
+
+	struct Task
+	{
+		TaskFunc	Func;
+		ExecFunc	RangeFunc;
+		void*		Data;
+		size_t		Start;
+		size_t		Count;
+		size_t		Grain;
+		TaskGroup*	Group;
+	};
+
 public:
 	JobChief();
 	~JobChief();
@@ -16,6 +76,7 @@ public:
 	void Init();
 	void Close();
 
+	// parallel for over all items, returns when done. Can be called from inside of tasks
 	void Exec( ExecFunc func, void* data, size_t itemCount );
 
 	void BeginQueueMode();
@@ -23,14 +84,41 @@ public:
 
 	uint32_t GetThreadCount() const;
 
+	bool IsMultithreaded() const;
+
+	// index of calling thread, -1 for threads which don't belong to scheduler
+	int GetCurrentThreadIndex() const;
+
 private:
-	void FireThreads() ;
+	friend class TaskGroup;
+
+	void Push( int threadIdx, const Task& task );
+	bool Pop( int threadIdx, TaskGroup* filter, Task* out );
+	bool Steal( int threadIdx, TaskGroup* filter, Task* out );
+	void Execute( int threadIdx, Task& task );
+	void FinishTask( TaskGroup* group, int threadIdx );
+	void WakeWaiters( TaskGroup* group );
+	static bool IsGroupAllowed( const TaskGroup* group, const TaskGroup* filter );
+
+	static unsigned int WINAPI WorkerThreadFunc( void* );
+	void WorkerLoop( int threadIdx );
 
 private:
 	ThreadHandles	mThreadHandles;
 	bool			mInQueueMode;
 
+	struct Deque;
+	Deque*			mDeques;
+	uint32_t		mDequeCount;
+
+	HANDLE*			mThreadEvents;	// to wake thread sleeping in TaskGroup::Wait
+
+	HANDLE			mWorkSemaphore;	// sleeping workers
+	volatile LONG	mNumSleeping;
+	volatile LONG	mNumWaiters;	// threads sleeping in TaskGroup::Wait
+	volatile LONG	mNumQueued;
+	volatile LONG	mTimeToExit;
 };
 extern JobChief* g_pJobChief;
 
-#endif
\ No newline at end of file
+#endif
@@ -14,32 +14,29 @@ typedef int (*CompareFunc)(const void *, const void *);
 
 class ParallelQSort
 {
-	struct SortRange
+	struct SortTask
 	{
+		ParallelQSort *owner;
 		void *start;
 		size_t size;
-		SortRange(): start(0), size(0) {}
 	};
 
-	struct SortParams
-	{
-		SortRange *ranges;
-		CompareFunc cmp;
-		size_t elemntSize;
-	};
+	/** Maximum tasks that we can spawn, rest of ranges are sorted in place */
+	static const int MAX_TASKS = 256;
 
-	/** Maximum ranges that we can handle */
-	static const int MAX_RANGES = 32;
+	/**	Sort ranges that are given away to other threads. */
+	SortTask tasks[MAX_TASKS];
 
-	/**	Sort ranges that will be executed in parallel. */
-	SortRange ranges[MAX_RANGES];
-
-	/**	Current number of ranges. */
-	size_t rangesMaxIdx;
+	/**	Current number of tasks. */
+	volatile LONG numTasks;
 
 	/**	Set minimum number of elements that considered as splitted. Should be approximately */
 	size_t splittableRangeSize;
 
+	JobChief::TaskGroup *group;
+	CompareFunc cmp;
+	size_t elementSize;
+
 	/**	Byte-order aware memory copy function. Copy paste from crt qsort algorithm. */
 	void SwapMemoryCRT(char *a, char *b, size_t w)
 	{
@@ -67,29 +64,22 @@ class ParallelQSort
 		}
 	}
 
-	/**
-	* Split range of values into sort chunks. Size of chunks controlled by splittableRangeSize var.
-	* This function will return false if it is no enough memory for all splits, so we need fallback to ordinary sequential sort.
-	*/
-	bool SplitRange(void *start, size_t elementSize, size_t numOfElements, CompareFunc cmp)
+	/**	Partition range around pivot element (median of three), return final pivot index. */
+	size_t Partition(void *start, size_t numOfElements)
 	{
-		if (numOfElements == 0) return true;
-		//	Range too small to split or enough splits
-		if (numOfElements < splittableRangeSize)
-		{
-			//	If we exceed number of space for splits, return false and fallback to sequential algorithm.
-			if (rangesMaxIdx == MAX_RANGES) return false;
-			ranges[rangesMaxIdx].start = start;
-			ranges[rangesMaxIdx].size = numOfElements;
-			++rangesMaxIdx;
-			return true;
-		}
-
 		char *byteStart = reinterpret_cast<char*>(start);
 
-		//	Slit range by choosing pivot element
+		//	Move median of first, middle and last to the end - sorted input doesn't degrade
 		size_t pivotIndex = numOfElements - 1;
-		void *pivot = byteStart + pivotIndex * elementSize;
+		char *lo = byteStart;
+		char *mid = byteStart + (numOfElements / 2) * elementSize;
+		char *hi = byteStart + pivotIndex * elementSize;
+		if (cmp(lo, mid) > 0) SwapMemoryCRT(lo, mid, elementSize);
+		if (cmp(mid, hi) > 0) SwapMemoryCRT(mid, hi, elementSize);
+		if (cmp(lo, mid) > 0) SwapMemoryCRT(lo, mid, elementSize);
+		SwapMemoryCRT(mid, hi, elementSize);
+
+		void *pivot = hi;
 		size_t storeIdx = 0;
 		for (size_t i = 0; i < numOfElements - 1; ++i)
 		{
@@ -102,52 +92,81 @@ class ParallelQSort
 			}
 		}
 		//	Place pivot at designated position
-		SwapMemoryCRT(byteStart + storeIdx * elementSize, byteStart + pivotIndex * elementSize, elementSize);
+		SwapMemoryCRT(byteStart + storeIdx * elementSize, hi, elementSize);
+		return storeIdx;
+	}
+
+	/**
+	* Split range by pivot until it is small enough, lower parts are sorted by other threads.
+	* Tasks may be spawned from any thread that runs a part of this sort.
+	*/
+	void SortRange(void *start, size_t numOfElements)
+	{
+		while (numOfElements > 1 && numOfElements >= splittableRangeSize)
+		{
+			size_t pivotIdx = Partition(start, numOfElements);
 
-		//	Now split 2 ranges
-		bool rv = true;
-		rv &= SplitRange(start, elementSize, storeIdx, cmp);
-		rv &= SplitRange(byteStart + (storeIdx + 1) * elementSize, elementSize, numOfElements - storeIdx - 1, cmp);
-		return rv;
+			LONG idx = InterlockedIncrement(&numTasks) - 1;
+			if (idx < MAX_TASKS)
+			{
+				SortTask &t = tasks[idx];
+				t.owner = this;
+				t.start = start;
+				t.size = pivotIdx;
+				group->Run(&SortWorker, &t);
+			}
+			else
+			{
+				SortRange(start, pivotIdx);
+			}
+
+			start = reinterpret_cast<char*>(start) + (pivotIdx + 1) * elementSize;
+			numOfElements -= pivotIdx + 1;
+		}
+
+		if (numOfElements > 1)
+			qsort(start, numOfElements, elementSize, cmp);
 	}
 
-	/**	Worker function for JobChief. */
-	static void SortWorker(void* data, size_t itemStart, size_t itemCount, size_t threadIndex )
+	/**	Task function for JobChief. */
+	static void SortWorker(void* data, size_t threadIndex )
 	{
 		(void)threadIndex;
 
-		SortParams *sp = reinterpret_cast<SortParams*>(data);
-		for (size_t i = itemStart; i < itemStart + itemCount; ++i)
-		{
-			SortRange &r = sp->ranges[i];
-			qsort(r.start, r.size, sp->elemntSize, sp->cmp);
-		}
+		SortTask *t = reinterpret_cast<SortTask*>(data);
+		t->owner->SortRange(t->start, t->size);
 	}
 
 public:
 	explicit ParallelQSort(size_t approxRangeSize)
-	: splittableRangeSize(approxRangeSize)
-	, rangesMaxIdx(0)
+	: numTasks(0)
+	, splittableRangeSize(approxRangeSize)
+	, group(0)
+	, cmp(0)
+	, elementSize(0)
 	{
 
 	}
 
 	/**	Execute sort algorithm. Function signature are the same as for CRT qsort call. */
-	void Sort(void *data, size_t numOfElements, size_t sizeOfElement, CompareFunc cmp)
+	void Sort(void *data, size_t numOfElements, size_t sizeOfElement, CompareFunc cmpFunc)
 	{
-		bool doParallel = SplitRange(data, sizeOfElement, numOfElements, cmp);
-		if (doParallel)
+		if (!g_pJobChief->IsMultithreaded() || g_pJobChief->GetCurrentThreadIndex() < 0)
 		{
-			SortParams sp;
-			sp.ranges = ranges;
-			sp.cmp = cmp;
-			sp.elemntSize = sizeOfElement;
-
-			g_pJobChief->Exec(&SortWorker, &sp, rangesMaxIdx);
-		}
-		else
-		{
-			qsort(data, numOfElements, sizeOfElement, cmp);
+			qsort(data, numOfElements, sizeOfElement, cmpFunc);
+			return;
 		}
+
+		JobChief::TaskGroup tg;
+
+		numTasks = 0;
+		group = &tg;
+		cmp = cmpFunc;
+		elementSize = sizeOfElement;
+
+		SortRange(data, numOfElements);
+		tg.Wait();
+
+		group = 0;
 	}
 };
\ No newline at end of file
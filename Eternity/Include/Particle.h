@@ -168,6 +168,9 @@ class r3dParticleSystem
 	int			AddType(int EmitterIdx, float CurTime, const r3dPoint3D& BPosition, bool bDistanceBased, bool bUpdate, int iCurLod);
 	void		CreateParticle(r3dSingleParticle* P, const r3dParticleEmitter& PE, int EmitterIdx, float CurTime, const r3dPoint3D& BPosition);
 	void		ProcessParticle(r3dSingleParticle* P, float CurTime);
+	void		ProcessParticlesSIMD(float CurTime, int iLod, r3dPoint3D& bbMin, r3dPoint3D& bbMax);
+	void		FinishParticle(r3dSingleParticle* P, const r3dParticleEmitter& PE, const r3dPoint3D& prevPos, float CurTime);
+	void		GrowBBox(const r3dSingleParticle& part, const r3dParticleEmitter& PE, float PSize, bool bTrails, r3dPoint3D& bbMin, r3dPoint3D& bbMax);
 	void		 GetOverTimeParams(const r3dSingleParticle* P, r3dSingleParticle_OverTime* pot);
 
 	template <class T>
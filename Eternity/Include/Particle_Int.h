@@ -162,6 +162,47 @@ struct r3dSingleParticle_OverTime
   float		RayWidth;
 };
 
+class r3dParticleEmitter;
+
+// over life gradients used by particle simulation, baked into fixed size tables.
+// Channels are interleaved so one sample of all of them is a single 16 byte load.
+struct r3dParticleOverLifeLUT
+{
+	enum { NUM_SAMPLES = 128 };
+
+	enum
+	{
+		VELOCITY,
+		GRAVITY,
+		BIND_GRAVITY,
+		SIZE,
+		NUM_CHANNELS
+	};
+
+	// one extra sample so time 1 interpolates without clamping the next index
+	float	Values[ NUM_SAMPLES + 1 ][ NUM_CHANNELS ];
+	float	MotionRandLerp[ NUM_SAMPLES + 1 ];
+
+	void	Bake( const r3dParticleEmitter& PE );
+
+	R3D_FORCEINLINE float Get( int channel, float time ) const
+	{
+		float x = R3D_MIN( R3D_MAX( time, 0.f ), 1.f ) * NUM_SAMPLES;
+		int i = (int)x;
+		i = R3D_MIN( i, (int)NUM_SAMPLES - 1 );
+		float v0 = Values[ i ][ channel ];
+		return v0 + ( Values[ i + 1 ][ channel ] - v0 ) * ( x - i );
+	}
+
+	R3D_FORCEINLINE float GetMotionRandLerp( float k ) const
+	{
+		float x = R3D_MIN( R3D_MAX( k, 0.f ), 1.f ) * NUM_SAMPLES;
+		int i = (int)x;
+		i = R3D_MIN( i, (int)NUM_SAMPLES - 1 );
+		return MotionRandLerp[ i ] + ( MotionRandLerp[ i + 1 ] - MotionRandLerp[ i ] ) * ( x - i );
+	}
+};
+
 class r3dParticleEmitter
 {
  public:
@@ -254,6 +295,14 @@ class r3dParticleEmitter
 	r3dTimeGradient2    BirthSizeOverLife;
 	float               BirthChartsTimeLapse;
 
+	// must be rebaked after gradients or MotionRandSmooth change
+	r3dParticleOverLifeLUT	OverLifeLUT;
+
+	void		BakeOverLife()
+	{
+		OverLifeLUT.Bake( *this );
+	}
+
 	R3D_FORCEINLINE void SetNumFrames( int NumFrames )
 	{
 		iNumFrames = NumFrames ;
@@ -0,0 +1,422 @@
+#ifndef	TL_TSTRINGHASHMAP_H
+#define	TL_TSTRINGHASHMAP_H
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "r3dHash.h"
+#include "r3dAssert.h"
+
+namespace r3dTL
+{
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//
+	//	>	String keyed hash map (open addressing, robin hood probing)
+	//
+	//	Slots hold only key hash, offset of key in shared string pool and value, so
+	//	there is no per-node allocation and no fixed size key copies. Table grows
+	//	when load factor goes above 0.8.
+	//	Keys are compared exactly - caller must normalize them (case, slashes).
+	//	Values are moved with memcpy, so keep them simple (pointers, PODs).
+	//
+	//////////////////////////////////////////////////////////////////////////////////////////////////////////
+	template <typename T>
+	class TStringHashMap
+	{
+		// construction/ destruction
+	public:
+		TStringHashMap();
+		~TStringHashMap();
+
+		// manipulation/ access
+	public:
+		bool		Add			( const char* key, const T& val );	// false if key already exist
+		bool		Remove		( const char* key );
+
+		const T*	FindPtr		( const char* key ) const;
+		bool		Find		( const char* key, T* pResult ) const;
+		bool		IsExists	( const char* key ) const			{ return FindPtr( key ) != NULL; }
+
+		uint32_t	Count		() const							{ return mCount; }
+		bool		IsEmpty		() const							{ return mCount == 0; }
+		uint32_t	GetCapacity	() const							{ return mCapacity; }
+		size_t		GetMemoryUsage() const;
+
+		void		Reserve		( uint32_t count );
+		void		Clear		();
+
+		// helpers
+	private:
+		struct Slot
+		{
+			uint32_t	Hash;		// 0 - empty slot
+			uint32_t	KeyOffset;	// offset in mPool
+			T			Value;
+		};
+
+		static uint32_t	HashKey		( const char* key );
+		uint32_t		ProbeDist	( uint32_t hash, uint32_t idx ) const	{ return ( idx - ( hash & ( mCapacity - 1 ) ) ) & ( mCapacity - 1 ); }
+		int				FindSlot	( const char* key, uint32_t hash ) const;
+		void			InsertSlot	( uint32_t hash, uint32_t keyOffset, const T& val );
+		uint32_t		AddKey		( const char* key );
+		void			Rehash		( uint32_t newCapacity );
+
+		static void*	Allocate	( size_t size );
+		static void		Free		( void* ptr );
+
+		// make copy constructor and assignment operator inaccessible
+		TStringHashMap( const TStringHashMap& );
+		TStringHashMap& operator = ( const TStringHashMap& );
+
+		// data
+	private:
+		Slot*		mSlots;
+		uint32_t	mCapacity;	// always power of 2 or 0
+		uint32_t	mCount;
+
+		// interned key strings
+		char*		mPool;
+		uint32_t	mPoolSize;
+		uint32_t	mPoolSpace;
+		uint32_t	mPoolGarbage;	// bytes of removed keys
+	};
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	TStringHashMap<T>::TStringHashMap() :
+	mSlots( NULL ),
+	mCapacity( 0 ),
+	mCount( 0 ),
+	mPool( NULL ),
+	mPoolSize( 0 ),
+	mPoolSpace( 0 ),
+	mPoolGarbage( 0 )
+	{
+
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	TStringHashMap<T>::~TStringHashMap()
+	{
+		Clear();
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	void
+	TStringHashMap<T>::Clear()
+	{
+		for( uint32_t i = 0; i < mCapacity; i ++ )
+		{
+			if( mSlots[ i ].Hash )
+				mSlots[ i ].Value.~T();
+		}
+
+		Free( mSlots );
+		Free( mPool );
+
+		mSlots		= NULL;
+		mCapacity	= 0;
+		mCount		= 0;
+		mPool		= NULL;
+		mPoolSize	= 0;
+		mPoolSpace	= 0;
+		mPoolGarbage= 0;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	size_t
+	TStringHashMap<T>::GetMemoryUsage() const
+	{
+		return sizeof( Slot ) * mCapacity + mPoolSpace;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	/*static*/
+	uint32_t
+	TStringHashMap<T>::HashKey( const char* key )
+	{
+		uint32_t hash = r3dHash::MakeHash( key );
+
+		// FNV low bits are weak for power of 2 tables, fold high bits in
+		hash ^= hash >> 16;
+
+		// 0 is reserved for empty slot
+		return hash ? hash : 1;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	int
+	TStringHashMap<T>::FindSlot( const char* key, uint32_t hash ) const
+	{
+		if( !mCount )
+			return -1;
+
+		const uint32_t mask = mCapacity - 1;
+		uint32_t idx = hash & mask;
+
+		for( uint32_t dist = 0; ; dist ++, idx = ( idx + 1 ) & mask )
+		{
+			const Slot& s = mSlots[ idx ];
+
+			// robin hood invariant: key can't be further than any resident we pass by
+			if( !s.Hash || ProbeDist( s.Hash, idx ) < dist )
+				return -1;
+
+			if( s.Hash == hash && !strcmp( mPool + s.KeyOffset, key ) )
+				return (int)idx;
+		}
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	const T*
+	TStringHashMap<T>::FindPtr( const char* key ) const
+	{
+		int idx = FindSlot( key, HashKey( key ) );
+		return idx >= 0 ? &mSlots[ idx ].Value : NULL;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	bool
+	TStringHashMap<T>::Find( const char* key, T* pResult ) const
+	{
+		r3d_assert( pResult );
+
+		const T* val = FindPtr( key );
+		if( !val )
+			return false;
+
+		*pResult = *val;
+		return true;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	bool
+	TStringHashMap<T>::Add( const char* key, const T& val )
+	{
+		const uint32_t hash = HashKey( key );
+		if( FindSlot( key, hash ) >= 0 )
+			return false;
+
+		// keep load factor below 0.8
+		if( ( mCount + 1 ) * 5 > mCapacity * 4 )
+			Rehash( mCapacity ? mCapacity * 2 : 16 );
+
+		InsertSlot( hash, AddKey( key ), val );
+		mCount ++;
+
+		return true;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	bool
+	TStringHashMap<T>::Remove( const char* key )
+	{
+		int found = FindSlot( key, HashKey( key ) );
+		if( found < 0 )
+			return false;
+
+		const uint32_t mask = mCapacity - 1;
+		uint32_t idx = (uint32_t)found;
+
+		mPoolGarbage += (uint32_t)strlen( mPool + mSlots[ idx ].KeyOffset ) + 1;
+		mSlots[ idx ].Value.~T();
+
+		// backward shift deletion - no tombstones
+		for( ;; )
+		{
+			uint32_t next = ( idx + 1 ) & mask;
+			Slot& n = mSlots[ next ];
+			if( !n.Hash || ProbeDist( n.Hash, next ) == 0 )
+				break;
+
+			memcpy( &mSlots[ idx ], &n, sizeof( Slot ) );
+			idx = next;
+		}
+
+		mSlots[ idx ].Hash = 0;
+		mCount --;
+
+		// a lot of removed keys - repack pool
+		if( mPoolGarbage > 64 * 1024 && mPoolGarbage > mPoolSize / 2 )
+			Rehash( mCapacity );
+
+		return true;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	void
+	TStringHashMap<T>::Reserve( uint32_t count )
+	{
+		uint32_t cap = 16;
+		while( cap * 4 < count * 5 )
+			cap <<= 1;
+
+		if( cap > mCapacity )
+			Rehash( cap );
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	void
+	TStringHashMap<T>::InsertSlot( uint32_t hash, uint32_t keyOffset, const T& val )
+	{
+		const uint32_t mask = mCapacity - 1;
+
+		Slot cur;
+		cur.Hash		= hash;
+		cur.KeyOffset	= keyOffset;
+		cur.Value		= val;
+
+		uint32_t idx = hash & mask;
+		for( uint32_t dist = 0; ; dist ++, idx = ( idx + 1 ) & mask )
+		{
+			Slot& s = mSlots[ idx ];
+			if( !s.Hash )
+			{
+				memcpy( &s, &cur, sizeof( Slot ) );
+				return;
+			}
+
+			// steal slot from richer resident and continue inserting it
+			uint32_t sdist = ProbeDist( s.Hash, idx );
+			if( sdist < dist )
+			{
+				char tmp[ sizeof( Slot ) ];
+				memcpy( tmp, &s, sizeof( Slot ) );
+				memcpy( &s, &cur, sizeof( Slot ) );
+				memcpy( &cur, tmp, sizeof( Slot ) );
+				dist = sdist;
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	uint32_t
+	TStringHashMap<T>::AddKey( const char* key )
+	{
+		const uint32_t len = (uint32_t)strlen( key ) + 1;
+
+		if( mPoolSize + len > mPoolSpace )
+		{
+			uint32_t newSpace = mPoolSpace ? mPoolSpace * 2 : 4096;
+			while( newSpace < mPoolSize + len )
+				newSpace *= 2;
+
+			char* newPool = (char*)Allocate( newSpace );
+			if( mPoolSize )
+				memcpy( newPool, mPool, mPoolSize );
+			Free( mPool );
+
+			mPool		= newPool;
+			mPoolSpace	= newSpace;
+		}
+
+		uint32_t offset = mPoolSize;
+		memcpy( mPool + offset, key, len );
+		mPoolSize += len;
+
+		return offset;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	void
+	TStringHashMap<T>::Rehash( uint32_t newCapacity )
+	{
+		r3d_assert( newCapacity && !( newCapacity & ( newCapacity - 1 ) ) );
+
+		Slot*		oldSlots	= mSlots;
+		uint32_t	oldCapacity	= mCapacity;
+		char*		oldPool		= mPool;
+
+		mSlots		= (Slot*)Allocate( sizeof( Slot ) * newCapacity );
+		mCapacity	= newCapacity;
+		for( uint32_t i = 0; i < newCapacity; i ++ )
+			mSlots[ i ].Hash = 0;
+
+		// repack pool while we're here, if it has holes
+		const bool repack = mPoolGarbage != 0;
+		if( repack )
+		{
+			mPool		= NULL;
+			mPoolSize	= 0;
+			mPoolSpace	= 0;
+			mPoolGarbage= 0;
+		}
+
+		for( uint32_t i = 0; i < oldCapacity; i ++ )
+		{
+			Slot& s = oldSlots[ i ];
+			if( !s.Hash )
+				continue;
+
+			uint32_t keyOffset = repack ? AddKey( oldPool + s.KeyOffset ) : s.KeyOffset;
+			InsertSlot( s.Hash, keyOffset, s.Value );
+			s.Value.~T();
+		}
+
+		Free( oldSlots );
+		if( repack )
+			Free( oldPool );
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	/*static*/
+	void*
+	TStringHashMap<T>::Allocate( size_t size )
+	{
+#ifdef USE_R3D_MEMORY_ALLOCATOR
+		void* res = r3dAllocateMemory( size, 1, ALLOC_TYPE_GAME );
+#else
+		void* res = malloc( size );
+#endif
+		r3d_assert( res );
+		return res;
+	}
+
+	//------------------------------------------------------------------------
+
+	template< typename T>
+	/*static*/
+	void
+	TStringHashMap<T>::Free( void* ptr )
+	{
+		if( !ptr )
+			return;
+
+#ifdef USE_R3D_MEMORY_ALLOCATOR
+		r3dDeallocateMemory( ptr, 1, ALLOC_TYPE_GAME );
+#else
+		free( ptr );
+#endif
+	}
+}
+
+#endif
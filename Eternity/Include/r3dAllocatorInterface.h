@@ -28,8 +28,13 @@ struct r3dAllocatorMemoryStats
 	size_t numDeallocations;
 	size_t totalAllocatedMemory;
 
+	/**	Allocator lock usage, small allocations should rarely touch it. */
+	size_t numLockAcquires;
+	size_t numLockContended;
+
 	r3dAllocatorMemoryStats()
 	: numAllocations(0), numDeallocations(0), totalAllocatedMemory(0)
+	, numLockAcquires(0), numLockContended(0)
 	{}
 };
 
@@ -39,6 +44,16 @@ void * r3dAllocateMemory(size_t size, unsigned int alignment, r3dAllocationTypes
 void r3dDeallocateMemory(void *ptr, unsigned int alignment, r3dAllocationTypes t);
 r3dAllocatorMemoryStats r3dGetAllocatorStats(r3dAllocationTypes t);
 
+struct r3dAllocatorBenchResult
+{
+	double opsPerSecond;
+	size_t numLockAcquires;
+	size_t numLockContended;
+};
+
+/**	Random small allocations/deallocations from numThreads threads, blocks are freed by random threads. Uses private allocator. */
+r3dAllocatorBenchResult r3dBenchmarkAllocator(int numThreads, int opsPerThread, bool useThreadCaches);
+
 //	Pugi xml
 void * r3dPugiAllocateMemory(size_t size);
 void r3dPugiDeallocateMemory(void *ptr);
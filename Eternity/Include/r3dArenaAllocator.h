@@ -84,6 +84,24 @@ public:
 	bool FreeMemory(void *mem);
 	inline bool IsMemoryAvailable() const { return pages != 0; }
 
+	/**	Check if memory lies in this arena. Doesn't need allocator lock - arena address range never changes. */
+	inline bool Contains(const void *mem) const
+	{
+		const byte *byteMem = reinterpret_cast<const byte*>(mem);
+		const byte *bytePages = reinterpret_cast<const byte*>(pages);
+		return pages && byteMem >= bytePages && byteMem < bytePages + PAGE_SIZE * NUM_PAGES_IN_ARENA;
+	}
+
+	/**
+	* Free list index of allocated block (block size is 16 << index). Doesn't need allocator lock too:
+	* index bits of page table entry don't change while page has allocated blocks.
+	*/
+	inline int GetBlockClass(const void *mem) const
+	{
+		ptrdiff_t pageTableIdx = (reinterpret_cast<const byte*>(mem) - reinterpret_cast<const byte*>(pages)) / PAGE_SIZE;
+		return static_cast<int>(pageTable[pageTableIdx] & 0xf);
+	}
+
 	const r3dAllocatorMemoryStats & GetMemStats() const;
 };
 
@@ -91,18 +109,50 @@ public:
 
 const int MAX_NUM_ARENAS = 20;
 
+/**
+* Per thread cache of free small blocks. Allocations and deallocations up to 1024 bytes
+* are served from it without taking allocator lock, blocks are moved from/to arenas in batches.
+* Blocks don't belong to threads, so block freed by other thread just goes to cache of that thread.
+*/
+struct r3dArenaThreadCache;
+
 class r3dArenaAllocator
 {
 	/**	Multithreading guard. */
 	CRITICAL_SECTION *guard;
 
-	int lastArenaIdx;
+	volatile LONG lastArenaIdx;
 
 	MemoryArena *arenas[MAX_NUM_ARENAS];
 
 	r3dAllocatorMemoryStats memStats;
 
+	/**	Index in thread cache table, -1 if this allocator works without thread caches. */
+	int cacheSlot;
+
+	/**	Generation of cacheSlot at the moment this allocator took it. */
+	LONG cacheGeneration;
+
+	/**	Caches of all threads that used this allocator. */
+	r3dArenaThreadCache *threadCaches;
+
+	/**	Blocks moved to and from thread caches, they are not user allocations. */
+	size_t cacheBlocksIn;
+	size_t cacheBlocksOut;
+
+	int numRefills;
+
 	MemoryArena * CreateNewArena();
+	MemoryArena * FindArena(const void *ptr) const;
+	void * AllocateFromArenas(size_t size, size_t alignment);
+
+	r3dArenaThreadCache * GetThreadCache();
+	void RefillThreadCache(r3dArenaThreadCache *tc, int blockClass);
+	void FlushThreadCache(r3dArenaThreadCache *tc, int blockClass, int count);
+	void ReclaimDeadThreadCaches();
+
+	void Lock();
+	void Unlock();
 
 public:
 	r3dArenaAllocator(CRITICAL_SECTION *cs);
@@ -116,6 +166,9 @@ public:
 
 	/**	Get allocator memory statistics. */
 	r3dAllocatorMemoryStats GetMemStats() const;
+
+	/**	Turn thread caches on/off for all allocators (for benchmarking). Cached blocks stay in caches. */
+	static void EnableThreadCaches(bool enable);
 };
 
 #endif //USE_R3D_MEMORY_ALLOCATOR
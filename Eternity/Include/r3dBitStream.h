@@ -0,0 +1,74 @@
+#pragma once
+
+#include "r3dTypedefs.h"
+#include "r3dAssert.h"
+
+//------------------------------------------------------------------------
+// Bit level packing for small network packets.
+//
+// Float fields are declared with r3dBitQuant - value range and number of
+// bits, both sides use the same declaration. Writer and reader never go
+// past given buffer, overflow is reported by IsOverflow().
+//------------------------------------------------------------------------
+
+struct r3dBitQuant
+{
+	float		Min;
+	float		Max;
+	int			Bits;
+
+	uint32_t	Quantize( float val ) const;
+	float		Dequantize( uint32_t q ) const;
+
+	// largest error of Quantize/Dequantize round trip
+	float		GetPrecision() const;
+};
+
+class r3dBitWriter
+{
+public:
+	r3dBitWriter( void* buf, int sizeInBytes );
+
+	void		WriteBits( uint32_t val, int numBits );
+	void		WriteBool( bool val );
+	void		WriteQuantized( float val, const r3dBitQuant& q );
+
+	// unit quaternion (x,y,z,w) as index of largest component + other three, "smallest three"
+	void		WriteQuaternion( const float* quat, int bitsPerComponent );
+
+	int			GetNumBits() const		{ return mBitPos; }
+	int			GetNumBytes() const		{ return ( mBitPos + 7 ) >> 3; }
+	bool		IsOverflow() const		{ return mOverflow; }
+
+private:
+	BYTE*		mBuf;
+	int			mBitSize;
+	int			mBitPos;
+	bool		mOverflow;
+};
+
+class r3dBitReader
+{
+public:
+	r3dBitReader( const void* buf, int sizeInBytes );
+
+	uint32_t	ReadBits( int numBits );
+	bool		ReadBool();
+	float		ReadQuantized( const r3dBitQuant& q );
+	void		ReadQuaternion( float* quat, int bitsPerComponent );
+
+	int			GetNumBits() const		{ return mBitPos; }
+	bool		IsOverflow() const		{ return mOverflow; }
+
+private:
+	const BYTE*	mBuf;
+	int			mBitSize;
+	int			mBitPos;
+	bool		mOverflow;
+};
+
+// number of bits written by r3dBitWriter::WriteQuaternion
+inline int r3dBitQuaternionSize( int bitsPerComponent )
+{
+	return 2 + bitsPerComponent * 3;
+}
@@ -36,6 +36,7 @@ class r3dFile
 	FILE*		stream;
 	const BYTE*	data;
 	int		pos;
+	struct r3dFSFileView* fsView;	// if data points directly to archive mapping
   
   public:
 	r3dFileLoc	Location;
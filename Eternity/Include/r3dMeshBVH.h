@@ -0,0 +1,112 @@
+#ifndef __R3D_MESHBVH_H
+#define __R3D_MESHBVH_H
+
+//------------------------------------------------------------------------
+// Triangle BVH of r3dMesh for ray casts.
+//
+// Tree is 4 wide, node keeps bounds of its 4 children as SoA so one SSE
+// pass tests ray against all of them. Leaves are quads of up to 4 triangles,
+// also SoA, tested against ray at once. Triangle test is the same as
+// intersect_triangle_floats_cull: back faces are skipped, t >= 0.
+//
+// Tree is read only after Build(), any number of threads can trace it.
+//------------------------------------------------------------------------
+
+struct r3dMeshRayHit
+{
+	float	T;
+	int		Face;		// triangle index, -1 if nothing was hit
+
+	r3dMeshRayHit() : T( 9999999.f ), Face( -1 ) { }
+};
+
+class r3dMeshBVH
+{
+public:
+	enum
+	{
+		// meshes with less triangles are traced brute force
+		MIN_TRIANGLES	= 64,
+
+		MAX_DEPTH		= 64,
+		PACKET_SIZE		= 4,
+
+		EMPTY_CHILD		= -1,	// quads are stored as -2 - quad
+
+		MIN_X = 0, MIN_Y, MIN_Z,
+		MAX_X, MAX_Y, MAX_Z
+	};
+
+	struct Node
+	{
+		float	Bounds[ 6 ][ 4 ];	// MIN_X..MAX_Z rows, one column per child
+		int		Child[ 4 ];
+	};
+
+	// vertex 0 and two edges of 4 triangles, unused lanes have zero edges and face -1
+	struct TriangleQuad
+	{
+		float	V0[ 3 ][ 4 ];
+		float	E1[ 3 ][ 4 ];
+		float	E2[ 3 ][ 4 ];
+		int		Face[ 4 ];
+	};
+
+	r3dMeshBVH();
+
+	void	Build( const r3dPoint3D* positions, const uint32_t* indices, int numTriangles );
+
+	// nearest hit closer than hit.T, hit is left alone if there is none
+	void	IntersectRay( const r3dPoint3D& org, const r3dPoint3D& dir, r3dMeshRayHit& hit ) const;
+	// stops at first hit closer than hit.T, not necessarily nearest one
+	bool	IntersectRayAny( const r3dPoint3D& org, const r3dPoint3D& dir, r3dMeshRayHit& hit ) const;
+	// rays from common origin traced PACKET_SIZE at a time, same result as IntersectRay for each
+	void	IntersectPacket( const r3dPoint3D& org, const r3dPoint3D* dirs, int count, r3dMeshRayHit* hits ) const;
+
+	int		GetNodeCount() const		{ return mNodes.Count(); }
+	int		GetQuadCount() const		{ return mQuads.Count(); }
+	int		GetMemorySize() const		{ return mNodes.Count() * sizeof( Node ) + mQuads.Count() * sizeof( TriangleQuad ); }
+
+	// reference for meshes without tree, same loop r3dMesh::ContainsRay used to run
+	static void	IntersectRayBruteForce( const r3dPoint3D* positions, const uint32_t* indices, int numTriangles, const r3dPoint3D& org, const r3dPoint3D& dir, r3dMeshRayHit& hit );
+	static bool	IntersectRayAnyBruteForce( const r3dPoint3D* positions, const uint32_t* indices, int numTriangles, const r3dPoint3D& org, const r3dPoint3D& dir, r3dMeshRayHit& hit );
+
+private:
+	struct BuildTriangle
+	{
+		float	Min[ 3 ];
+		float	Max[ 3 ];
+		float	Center[ 3 ];
+	};
+
+	struct Range
+	{
+		int		Begin;
+		int		End;
+	};
+
+	struct CenterLess;
+	struct InLeftBins;
+
+	int		BuildNode( int begin, int end, int depth );
+	int		BuildQuad( int begin, int end );
+	int		SplitRange( int begin, int end, bool median );
+	void	GetRangeBounds( int begin, int end, float (&mn)[ 3 ], float (&mx)[ 3 ] ) const;
+
+	r3dTL::TArray< Node >			mNodes;
+	r3dTL::TArray< TriangleQuad >	mQuads;
+
+	// build temporaries
+	const r3dPoint3D*				mBuildPositions;
+	const uint32_t*					mBuildIndices;
+	float							mBuildPad;
+	r3dTL::TArray< BuildTriangle >	mBuildTriangles;
+	r3dTL::TArray< int >			mBuildOrder;
+};
+
+#ifndef FINAL_BUILD
+// traces random rays at meshes through brute force, BVH and packets, checks results and prints timings
+void r3dMeshRayBenchmark( r3dMesh* const* meshes, int count, int numRays );
+#endif
+
+#endif //__R3D_MESHBVH_H
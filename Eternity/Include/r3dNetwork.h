@@ -7,6 +7,60 @@ struct r3dNetPacketHeader;
 
 enum { r3dInvalidNetPeerID = 0xFFFFFFFF };
 
+// delivery class of packet, selected by packet EventID (see r3dNetwork::SetPacketClass)
+enum r3dNetDelivery
+{
+  R3D_NET_RELIABLE_ORDERED = 0,		// default. delivered in send order with other ordered packets of same channel
+  R3D_NET_RELIABLE_UNORDERED,		// delivered as soon as arrived, never waits for lost packets
+  R3D_NET_UNRELIABLE_SEQUENCED,		// can be lost, older packets of same channel are dropped.
+					// never overtakes ordered packets of same channel that were sent before it
+};
+
+struct r3dNetPacketClass
+{
+  BYTE		delivery;	// r3dNetDelivery
+  BYTE		channel;	// ordering channel, [0..MAX_NET_CHANNELS)
+};
+
+struct r3dNetSendStats
+{
+  DWORD		packets;	// packets passed to Send* functions
+  DWORD		bytes;
+  DWORD		messages;	// RakNet messages they were sent as
+  DWORD		messageBytes;
+  DWORD		wireBytes;	// RakNet datagram bytes, including headers and resends
+};
+
+// traffic description for r3dNetwork::RunLoopbackBenchmark
+struct r3dNetBenchTraffic
+{
+  const char*	name;
+  BYTE		eventId;
+  int		periodMs;
+  int		createdBy;	// traffic index of create packet of sender object, -1 if none
+  bool		keptIfEarly;	// receiver keeps packet that overtook its create until create arrives, otherwise drops it
+};
+
+// capture file written by r3dNetwork::StartCapture:
+// r3dNetCaptureHeader, then r3dNetCaptureRecord followed by packet data for every received packet
+#pragma pack(push)
+#pragma pack(1)
+struct r3dNetCaptureHeader
+{
+  enum { MAGIC = 0x5043454E, VERSION = 1 }; // 'NECP'
+  DWORD		magic;
+  DWORD		version;
+  DWORD		userVersion;	// game protocol version, packets are meaningless with other one
+};
+
+struct r3dNetCaptureRecord
+{
+  DWORD		timeMs;		// since capture start
+  WORD		peerId;
+  DWORD		size;
+};
+#pragma pack(pop)
+
 class r3dNetCallback
 {
   public:
@@ -33,6 +87,13 @@ class r3dNetwork
 	DWORD		firstBindIP_;
 	const static int FIRST_FREE_PACKET_ID = 0;
 	const static int RAKNET_USER_PACKET   = 134; // must be more that RakNet::ID_USER_PACKET_ENUM
+	const static int MAX_NET_CHANNELS     = 32;  // RakNet NUMBER_OF_ORDERED_STREAMS
+	const static int RAKNET_BATCH_PACKET  = 135; // several user packets in one RakNet message
+	const static int MAX_BATCH_SIZE       = 1200; // below MTU, so batch is never split by RakNet
+
+	bool		batchSends_;	// coalesce packets until FlushBatches(), receiver side always understands batches
+	r3dNetSendStats	sendTotal_;
+	r3dNetSendStats	sendPerSec_;	// over last second
 
   public:
 	r3dNetwork();
@@ -58,6 +119,42 @@ class r3dNetwork
 	void		SendToHost(const r3dNetPacketHeader* data, int dataSize, bool isReliable = true);
 	void		SendToPeer(const r3dNetPacketHeader* data, int dataSize, DWORD peerId, bool isReliable = true);
 	void		SendToAddress(char *data, int dataSize, char *address, unsigned short port);
+
+	// send packets queued since last flush, one RakNet message per destination and channel.
+	// called once per tick after game update and automatically from Update()
+	void		FlushBatches();
+
+	// per packet type delivery. must match on both sides only for packets where
+	// relative order matters, unregistered packets are reliable ordered on channel 0.
+	// isReliable=false in Send* functions downgrades packet to unreliable sequenced on its channel.
+	void		SetPacketClass(int eventId, r3dNetDelivery delivery, int channel);
+	const r3dNetPacketClass& GetPacketClass(int eventId) const { return packetClass_[eventId & 0xFF]; }
+
+#ifndef FINAL_BUILD
+	// simulates lossy link between two peers with RakNet delivery rules and logs head-of-line latency
+	// of every traffic entry, with all packets reliable ordered on channel 0 and with current packet classes
+	void		RunLoopbackBenchmark(const r3dNetBenchTraffic* traffic, int numTraffic, float packetLoss, int latencyMs, int seconds) const;
+#endif
+
+	// record every packet passed to r3dNetCallback::OnNetData into file, see r3dNetCaptureHeader.
+	// capture is not tied to connection and continues until StopCapture or destruction
+	bool		StartCapture(const char* fileName, DWORD userVersion);
+	void		StopCapture();
+	bool		IsCapturing() const { return captureFile_ != NULL; }
+
+  private:
+	r3dNetPacketClass packetClass_[256];
+
+	r3dNetSendStats	lastSecTotal_;
+	float		lastSecTime_;
+
+	FILE*		captureFile_;
+	float		captureStartTime_;
+	DWORD		capturePackets_;
+	DWORD		captureBytes_;
+
+	void		ReceiveBatch(DWORD peerId, const BYTE* data, int len);
+	void		ReceiveData(DWORD peerId, const BYTE* data, int len);
 };
 
 #pragma pack(push)
@@ -9,6 +9,7 @@
 #define R3D_ALLOW_ASYNC_MESH_LOADING 1
 
 class r3dVertexBuffer;
+class r3dMeshBVH;
 
 #pragma pack(push)
 #pragma pack(1)
@@ -149,6 +150,9 @@ private:
 	volatile LONG							m_Loaded ;
 	volatile LONG							m_Drawable ;
 
+	// built on first ray cast, see GetRayBVH()
+	r3dMeshBVH* volatile					m_RayBVH ;
+
 public:
 
 #if R3D_CHECK_MESH_MATERIAL_CONSISTENCY
@@ -370,6 +374,12 @@ public:
 	// collisions
 	virtual	BOOL		ContainsRay(const r3dPoint3D& vStart, const r3dPoint3D& vNormalizedDirection, float RayLen, float *ClipDist, r3dMaterial **material, const r3dVector& pos, const D3DXMATRIX& rotation, int * OutMinFace = NULL );
 	virtual	BOOL		ContainsQuickRay(const r3dPoint3D& vStart, const r3dPoint3D& vNormalizedDirection, float RayLen, float *ClipDist, r3dMaterial **material, const r3dVector& pos, const D3DXMATRIX& rotation);
+	// rays from common origin, e.g. shotgun pellets. OutFaces are -1 for rays that missed, returns number of hits
+	int					ContainsRayPacket(const r3dPoint3D& vStart, const r3dPoint3D* vNormalizedDirections, int count, float *ClipDists, int *OutFaces, const r3dVector& pos, const D3DXMATRIX& rotation);
+
+	// NULL for meshes too small to need it. Thread safe
+	const r3dMeshBVH*	GetRayBVH();
+	void				ReleaseRayBVH();
 
 	int			IsSkeletal() const ;
 
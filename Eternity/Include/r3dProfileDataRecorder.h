@@ -10,6 +10,7 @@
 
 extern r3dString gProfileDataXMLOutFile;
 extern r3dString gProfileDataTXTOutFile;
+extern r3dString gProfileDataTraceOutFile;
 extern float gScheduledProfileTime;
 extern bool gProfileD3DFromCommandLine;
 //	Delay (in seconds) after loading screen was removed.
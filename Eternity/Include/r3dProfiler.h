@@ -8,6 +8,7 @@
 #include "r3dTreeNode.h"
 //#include "r3dRender.h"
 #include "r3dProfileDataRecorder.h"
+#include "r3dProfilerTimeline.h"
 
 #define R3DPROFILE_ENABLED
 
@@ -209,10 +210,8 @@ inline r3dProfiler *r3dProfiler::Instance()
 	if(sInstance == NULL)
 		return NULL;
 
-// in future when we will have more than one thread
-//	if(index == 0)
-//		index = (int)TlsGetValue(THREAD_ID_INDEX);
-
+// sample tree is kept for main thread only, samples of other threads
+// go to r3dProfilerTimeline (see StartSample/EndSample)
 	int index = 1;
 	if(index > 0 && index <= m_NumInstances)
 		return &(sInstance[index-1]);
@@ -228,6 +227,9 @@ inline void r3dProfiler::StartSample( const char* aName, uint32_t aHashName)
 		if ( inst && !inst->IsPaused() )
 			inst->Start(aName, aHashName);
 	}
+
+	if( r3dProfilerTimeline::IsCapturing() )
+		r3dProfilerTimeline::AddEvent( aName, aHashName, r3dProfilerTimeline::EVENT_BEGIN );
 }
 
 inline void r3dProfiler::EndSample( const char* aName, uint32_t aHashName )
@@ -239,6 +241,9 @@ inline void r3dProfiler::EndSample( const char* aName, uint32_t aHashName )
 		if ( inst && !inst->IsPaused() )
 			inst->End(aName, aHashName);
 	}
+
+	if( r3dProfilerTimeline::IsCapturing() )
+		r3dProfilerTimeline::AddEvent( aName, aHashName, r3dProfilerTimeline::EVENT_END );
 }
 
 #endif // !DISABLE_PROFILER
@@ -0,0 +1,56 @@
+#ifndef __R3D_PROFILER_TIMELINE_H__
+#define __R3D_PROFILER_TIMELINE_H__
+
+#if !DISABLE_PROFILER
+
+//------------------------------------------------------------------------
+// Timeline capture of profiler samples from all threads.
+//
+// Every thread appends begin/end events into its own buffer (no locks,
+// only owner thread writes it). Capture starts and stops on main thread
+// frame boundaries, so all threads share the same frame window, and is
+// written out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//------------------------------------------------------------------------
+
+class r3dProfilerTimeline
+{
+public:
+	enum EventType
+	{
+		EVENT_BEGIN,
+		EVENT_END,
+		EVENT_FRAME
+	};
+
+	struct Event
+	{
+		uint32_t	NameHash;
+		int			Type;
+		LONGLONG	Ticks;
+	};
+
+	struct ThreadBuffer;
+
+	// capture numFrames frames starting from next frame, then write trace to fileName
+	static void		StartCapture( int numFrames, const char* fileName );
+	static bool		IsCapturing()	{ return sCapturing != 0; }
+
+	// name shows up in trace, call from thread itself
+	static void		SetThreadName( const char* name );
+
+	// called by r3dProfiler, aName is copied once per thread
+	static void		AddEvent( const char* aName, uint32_t aHashName, int aType );
+
+	static void		OnFrameStart();
+	static void		OnFrameEnd();
+
+private:
+	static ThreadBuffer*	GetThreadBuffer();
+	static bool				WriteTrace( const char* fileName );
+
+	static volatile LONG	sCapturing;
+};
+
+#endif // !DISABLE_PROFILER
+
+#endif //__R3D_PROFILER_TIMELINE_H__
@@ -0,0 +1,327 @@
+#ifndef __R3D_RESOURCEREGISTRY_H
+#define __R3D_RESOURCEREGISTRY_H
+
+//------------------------------------------------------------------------
+// Hash index of named resources - textures, meshes, animations.
+//
+// Resources are bucketed by hash of lowercased file name without directory,
+// so exact and loosely filtered candidates (r3dCompareFileNameInPath) of a path
+// end up in the same bucket and caller applies its own match rule to them.
+// Every entry remembers when it was added, Find returns the newest match,
+// same as walking a list that is inserted at head.
+//
+// Registry is not locked, owner guards it the same way it guards resource
+// list itself (textures and meshes - g_ResourceCritSection).
+//------------------------------------------------------------------------
+
+template <typename T>
+class r3dResourceRegistry
+{
+public:
+	r3dResourceRegistry();
+
+	void		Add( T* res, const char* path );
+	bool		Remove( const T* res );
+	// moves resource to bucket of new path, it keeps its age. false if resource is not registered
+	bool		Rename( const T* res, const char* path );
+	void		Clear();
+
+	// newest resource registered under file name of path for which match( res ) is true
+	template <typename Match>
+	T*			Find( const char* path, const Match& match ) const;
+
+	int			Count() const	{ return mCount; }
+
+	static uint32_t	HashFileName( const char* path );
+
+private:
+	enum
+	{
+		NONE		= -1,
+		MIN_BUCKETS	= 256
+	};
+
+	struct Entry
+	{
+		T*			Res;		// NULL if entry is free
+		uint32_t	NameHash;
+		uint32_t	Seq;
+		int			NextByName;
+		int			PrevByName;	// lots of resources can share a name (unnamed ones), keep unlinking O(1)
+		int			NextByRes;	// next free entry for free ones
+	};
+
+	static uint32_t	HashPointer( const T* res );
+
+	int			Unlink( const T* res );
+	void		LinkName( int idx );
+	void		Rehash( int bucketCount );
+
+	r3dTL::TArray< Entry >	mEntries;
+	r3dTL::TArray< int >	mNameBuckets;
+	r3dTL::TArray< int >	mResBuckets;
+
+	int			mFreeEntry;
+	int			mCount;
+	uint32_t	mSeq;
+};
+
+//------------------------------------------------------------------------
+
+template <typename T>
+r3dResourceRegistry<T>::r3dResourceRegistry()
+: mFreeEntry( NONE )
+, mCount( 0 )
+, mSeq( 0 )
+{
+
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+/*static*/
+uint32_t
+r3dResourceRegistry<T>::HashFileName( const char* path )
+{
+	const char* name = path;
+	for( const char* p = path; *p; p ++ )
+	{
+		if( *p == '/' || *p == '\\' )
+			name = p + 1;
+	}
+
+	// FNV-1a of lowercased name, like r3dHash but without a lowercased copy
+	uint32_t hash = 2166136261u;
+	for( ; *name; name ++ )
+	{
+		char c = *name;
+		if( c >= 'A' && c <= 'Z' )
+			c += 'a' - 'A';
+
+		hash ^= (unsigned char)c;
+		hash *= 16777619u;
+	}
+
+	// FNV low bits are weak for power of 2 tables, fold high bits in
+	return hash ^ ( hash >> 16 );
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+/*static*/
+uint32_t
+r3dResourceRegistry<T>::HashPointer( const T* res )
+{
+	uint32_t hash = (uint32_t)(size_t)res;
+
+	// allocations are aligned, low bits are always the same
+	hash ^= hash >> 4;
+	hash *= 0x9e3779b1u;
+
+	return hash ^ ( hash >> 16 );
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+void
+r3dResourceRegistry<T>::Add( T* res, const char* path )
+{
+	r3d_assert( res );
+
+	if( mCount >= (int)mNameBuckets.Count() )
+	{
+		Rehash( R3D_MAX( (int)MIN_BUCKETS, (int)mNameBuckets.Count() * 2 ) );
+	}
+
+	int idx = mFreeEntry;
+
+	if( idx != NONE )
+	{
+		mFreeEntry = mEntries[ idx ].NextByRes;
+	}
+	else
+	{
+		idx = mEntries.Count();
+		mEntries.PushBack( Entry() );
+	}
+
+	Entry& e = mEntries[ idx ];
+
+	e.Res		= res;
+	e.NameHash	= HashFileName( path );
+	e.Seq		= mSeq ++;
+
+	int& resHead = mResBuckets[ HashPointer( res ) & ( mResBuckets.Count() - 1 ) ];
+	e.NextByRes	= resHead;
+	resHead		= idx;
+
+	LinkName( idx );
+
+	mCount ++;
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+bool
+r3dResourceRegistry<T>::Remove( const T* res )
+{
+	int idx = Unlink( res );
+
+	if( idx == NONE )
+		return false;
+
+	int* link = &mResBuckets[ HashPointer( res ) & ( mResBuckets.Count() - 1 ) ];
+	for( ; *link != idx; link = &mEntries[ *link ].NextByRes ) { }
+
+	Entry& e = mEntries[ idx ];
+
+	*link		= e.NextByRes;
+
+	e.Res		= NULL;
+	e.NextByRes	= mFreeEntry;
+	mFreeEntry	= idx;
+
+	mCount --;
+
+	return true;
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+bool
+r3dResourceRegistry<T>::Rename( const T* res, const char* path )
+{
+	int idx = Unlink( res );
+
+	if( idx == NONE )
+		return false;
+
+	mEntries[ idx ].NameHash = HashFileName( path );
+	LinkName( idx );
+
+	return true;
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+void
+r3dResourceRegistry<T>::Clear()
+{
+	r3dTL::TArray< Entry >().Swap( mEntries );
+	r3dTL::TArray< int >().Swap( mNameBuckets );
+	r3dTL::TArray< int >().Swap( mResBuckets );
+
+	mFreeEntry	= NONE;
+	mCount		= 0;
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+template <typename Match>
+T*
+r3dResourceRegistry<T>::Find( const char* path, const Match& match ) const
+{
+	if( !mCount )
+		return NULL;
+
+	uint32_t hash = HashFileName( path );
+
+	const Entry* best = NULL;
+
+	for( int idx = mNameBuckets[ hash & ( mNameBuckets.Count() - 1 ) ]; idx != NONE; )
+	{
+		const Entry& e = mEntries[ idx ];
+
+		if( e.NameHash == hash && ( !best || e.Seq > best->Seq ) && match( e.Res ) )
+		{
+			best = &e;
+		}
+
+		idx = e.NextByName;
+	}
+
+	return best ? best->Res : NULL;
+}
+
+//------------------------------------------------------------------------
+
+// removes entry of res from its name chain, returns entry index or NONE
+template <typename T>
+int
+r3dResourceRegistry<T>::Unlink( const T* res )
+{
+	if( !mCount )
+		return NONE;
+
+	int idx = mResBuckets[ HashPointer( res ) & ( mResBuckets.Count() - 1 ) ];
+	for( ; idx != NONE && mEntries[ idx ].Res != res; idx = mEntries[ idx ].NextByRes ) { }
+
+	if( idx == NONE )
+		return NONE;
+
+	const Entry& e = mEntries[ idx ];
+
+	if( e.PrevByName != NONE )
+		mEntries[ e.PrevByName ].NextByName = e.NextByName;
+	else
+		mNameBuckets[ e.NameHash & ( mNameBuckets.Count() - 1 ) ] = e.NextByName;
+
+	if( e.NextByName != NONE )
+		mEntries[ e.NextByName ].PrevByName = e.PrevByName;
+
+	return idx;
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+void
+r3dResourceRegistry<T>::LinkName( int idx )
+{
+	Entry& e = mEntries[ idx ];
+
+	int& head		= mNameBuckets[ e.NameHash & ( mNameBuckets.Count() - 1 ) ];
+	e.NextByName	= head;
+	e.PrevByName	= NONE;
+
+	if( head != NONE )
+		mEntries[ head ].PrevByName = idx;
+
+	head			= idx;
+}
+
+//------------------------------------------------------------------------
+
+template <typename T>
+void
+r3dResourceRegistry<T>::Rehash( int bucketCount )
+{
+	mNameBuckets.Clear();
+	mNameBuckets.Resize( bucketCount, NONE );
+
+	mResBuckets.Clear();
+	mResBuckets.Resize( bucketCount, NONE );
+
+	for( int i = 0, e = mEntries.Count(); i < e; i ++ )
+	{
+		Entry& entry = mEntries[ i ];
+
+		if( !entry.Res )
+			continue;
+
+		int& resHead	= mResBuckets[ HashPointer( entry.Res ) & ( bucketCount - 1 ) ];
+		entry.NextByRes	= resHead;
+		resHead			= i;
+
+		LinkName( i );
+	}
+}
+
+#endif //__R3D_RESOURCEREGISTRY_H
@@ -96,7 +96,7 @@ public:
 	void		MarkPlayerTexture() ;
 
 	const r3dFileLoc& getFileLoc() const { return Location; }
-	void OverwriteFileLocation(const char* file) { r3d_assert(file); r3dscpy(Location.FileName, file); }
+	void OverwriteFileLocation(const char* file);
 
 	r3dTexture	*pNext, *pPrev;
 	bool		bPersistent;
@@ -108,6 +108,7 @@ private:
 	void	LoadTextureInternal(int index, const char* FName);
 
 	void	UpdateTextureStats( int size ) ;
+	void	UpdateRegistryName();
 
 	int		Flags;
 	int		ID;
@@ -309,6 +310,8 @@ R3D_FORCEINLINE int r3dThumbnailTexture::GetHeight() const
 
 #ifndef FINAL_BUILD
 void DEBUG_ReportTexStats();
+// replays texture lookups of loaded level through FirstTexture walk and registry, checks they agree and prints timings
+void r3dTextureLookupBenchmark( int passes );
 #endif
 
 #endif // __ETERNITY_R3DTEXTURE_H
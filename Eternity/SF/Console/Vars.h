@@ -70,8 +70,6 @@ REG_VAR( d_url_navigate,			"",				0 );
 REG_VAR( d_show_browser,			false,			0 );
 #endif
 
-REG_VAR( d_job_chief_idle_events,	true,			0 );
-
 REG_VAR( r_bpp,						32,				0 );		// color bpp
 
 REG_VAR( r_near_plane,				1.f,			0 );
@@ -207,8 +205,13 @@ REG_VAR( r_show_d3dmarks			, false		, 0 );
 #endif
 
 REG_VAR( r_instanced_particles		, true		, 0 );
+REG_VAR( r_particles_simd			, true		, 0 );
 REG_VAR( r_multithreading			, true		, 0 );
 REG_VAR( r_use_oq					, true		, 0 );
+REG_VAR( r_scene_bvh				, true		, 0 );
+REG_VAR( r_soft_oq				, false		, 0 );
+REG_VAR( r_soft_oq_max_tris		, 65536		, 0 );
+REG_VAR( r_soft_oq_min_occluder	, 0.1f		, 0 );
 REG_VAR( r_use_shared_animtracks	, true		, 0);
 
 REG_VAR( r_use_instancing	, true		, 0);
@@ -443,6 +446,7 @@ REG_VAR( r_last_def_rend_count,		0,				0 );
 //------------------------------------------------------------------------
 #ifndef FINAL_BUILD
 REG_VAR( e_undo_depth,				64,				0 );		// 
+REG_VAR( e_terrain_undo_budget,		128,			0 );		// MB of packed terrain undo kept in memory, older strokes go to temp file, 0 - no limit
 REG_VAR( e_reposition_obj_5d,		false,			0 );		// 
 REG_VAR( e_auto_save,				0,				0 );
 REG_VAR( e_auto_save_folder,		"",				0 );
@@ -463,8 +467,10 @@ REG_VAR( g_cursor_mode,				0,				VF_HIDDEN );
 REG_VAR( g_hide_minimap,			0,				0 );
 
 REG_VAR( g_level_settings_ver,		0,				0 );
+REG_VAR( g_level_binary,			true,			0 );		// load compiled LevelData/SoundData/ServerData .bin while it matches .xml
 
 REG_VAR( g_async_d3dqueue,			0,				0 );
+REG_VAR( g_net_batch_packets,		true,			0 );		// coalesce packets sent to game server within one tick
 REG_VAR( r_local_vmem_size,			0,				0 );
 REG_VAR( r_local_vmem_ddraw,		0,				0 );
 REG_VAR( r_local_vmem_wmi,			0,				0 );
@@ -665,6 +671,10 @@ REG_VAR( r_full_zombie_update,			0,				0 );
 REG_VAR( g_enable_zombie_sprint,		true,			0 );
 
 REG_VAR_C( r_sector_keep_alive_coef, 1.0f, 0.25f, 1.0f, 0 );
+REG_VAR_C( r_sector_hysteresis,		0.15f,	0.0f,	1.0f,	VF_CONSTRAINT );	// loaded sectors are kept up to keep alive radius * ( 1 + this )
+REG_VAR_C( r_sector_predict_time,		1.5f,	0.0f,	10.0f,	VF_CONSTRAINT );	// seconds of camera movement sectors are prefetched for
+REG_VAR( r_sector_io_budget_kb,			8192,			0 );
+REG_VAR( r_sector_mem_budget_mb,		768,			0 );
 
 #ifndef FINAL_BUILD
 REG_VAR( d_print_postfx,				0,				0 );
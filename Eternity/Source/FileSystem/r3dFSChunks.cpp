@@ -0,0 +1,385 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include "r3dFSChunks.h"
+#include "r3dFSCompress.h"
+
+// gear table for rolling hash, fixed pseudo random values
+static DWORD gear_tab[256];
+
+static struct r3dFSGearTabInit
+{
+  r3dFSGearTabInit()
+  {
+    DWORD seed = 0x2F0B3C5D;
+    for(int i=0; i<256; i++) {
+      seed = seed * 1664525 + 1013904223;
+      DWORD hi = seed & 0xFFFF0000;
+      seed = seed * 1664525 + 1013904223;
+      gear_tab[i] = hi | (seed >> 16);
+    }
+  }
+} gear_tab_init;
+
+void r3dFSSplitChunks(const BYTE* data, DWORD size, std::vector<DWORD>& out_ends)
+{
+  out_ends.clear();
+  out_ends.reserve(size / (1 << R3D_FS_CHUNK_BITS) + 1);
+
+  DWORD start = 0;
+  while(start < size)
+  {
+    DWORD left = size - start;
+    if(left <= R3D_FS_CHUNK_MIN) {
+      out_ends.push_back(size);
+      break;
+    }
+
+    // gear hash: h = (h << 1) + gear[b], top bits depend on last 32 bytes
+    const DWORD maxEnd = start + R3D_MIN(left, (DWORD)R3D_FS_CHUNK_MAX);
+    DWORD end = maxEnd;
+    DWORD h   = 0;
+    for(DWORD i = start + R3D_FS_CHUNK_MIN; i < maxEnd; i++)
+    {
+      h = (h << 1) + gear_tab[data[i]];
+      if((h >> (32 - R3D_FS_CHUNK_BITS)) == 0) {
+        end = i + 1;
+        break;
+      }
+    }
+
+    out_ends.push_back(end);
+    start = end;
+  }
+}
+
+// murmur3 x86_32
+DWORD r3dFSChunkHash2(const BYTE* data, DWORD size)
+{
+  const DWORD c1 = 0xcc9e2d51;
+  const DWORD c2 = 0x1b873593;
+  DWORD h = 0x9747b28c;
+
+  const DWORD nblocks = size / 4;
+  for(DWORD i=0; i<nblocks; i++)
+  {
+    DWORD k;
+    memcpy(&k, data + i * 4, 4);
+    k *= c1;
+    k  = _rotl(k, 15);
+    k *= c2;
+
+    h ^= k;
+    h  = _rotl(h, 13);
+    h  = h * 5 + 0xe6546b64;
+  }
+
+  const BYTE* tail = data + nblocks * 4;
+  DWORD k = 0;
+  switch(size & 3)
+  {
+    case 3: k ^= tail[2] << 16;
+    case 2: k ^= tail[1] << 8;
+    case 1: k ^= tail[0];
+            k *= c1; k = _rotl(k, 15); k *= c2; h ^= k;
+  }
+
+  h ^= size;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+#pragma pack(push,1)
+struct r3dFSChunkManifestHeader
+{
+  DWORD		id;
+  DWORD		version;
+  DWORD		numFiles;
+  DWORD		numChunks;
+  DWORD		namesSize;
+};
+#pragma pack(pop)
+
+r3dFSChunkManifest::r3dFSChunkManifest()
+{
+}
+
+r3dFSChunkManifest::~r3dFSChunkManifest()
+{
+}
+
+void r3dFSChunkManifest::Clear()
+{
+  files_.clear();
+  chunks_.clear();
+  names_.clear();
+  nameHash_.Clear();
+}
+
+void r3dFSChunkManifest::AddFile(const char* name, DWORD crc32, DWORD size, const r3dFSChunk* chunks, DWORD numChunks)
+{
+  file_s f;
+  f.nameOffset = (DWORD)names_.size();
+  f.crc32      = crc32;
+  f.size       = size;
+  f.firstChunk = (DWORD)chunks_.size();
+  f.numChunks  = numChunks;
+
+  if(!nameHash_.Add(name, (DWORD)files_.size()))
+    r3dError("r3dFSChunkManifest: duplicate file %s\n", name);
+
+  names_.insert(names_.end(), name, name + strlen(name) + 1);
+  chunks_.insert(chunks_.end(), chunks, chunks + numChunks);
+  files_.push_back(f);
+}
+
+const r3dFSChunkManifest::file_s* r3dFSChunkManifest::Find(const char* name, DWORD crc32) const
+{
+  const DWORD* idx = nameHash_.FindPtr(name);
+  if(idx == NULL)
+    return NULL;
+
+  const file_s& f = files_[*idx];
+  if(f.crc32 != crc32)
+    return NULL;
+
+  return &f;
+}
+
+bool r3dFSChunkManifest::Load(const BYTE* data, DWORD size)
+{
+  Clear();
+
+  r3dFSChunkManifestHeader hdr;
+  if(size < sizeof(hdr))
+    return false;
+  memcpy(&hdr, data, sizeof(hdr));
+
+  if(hdr.id != ID || hdr.version != VERSION) {
+    r3dOutToLog("r3dFS: bad chunk manifest header\n");
+    return false;
+  }
+
+  const unsigned __int64 need = (unsigned __int64)sizeof(hdr) +
+    (unsigned __int64)hdr.numFiles * sizeof(file_s) +
+    (unsigned __int64)hdr.numChunks * sizeof(r3dFSChunk) +
+    hdr.namesSize;
+  if(need != size || hdr.numFiles == 0) {
+    r3dOutToLog("r3dFS: bad chunk manifest size\n");
+    return false;
+  }
+
+  DWORD mpos = sizeof(hdr);
+  files_.resize(hdr.numFiles);
+  memcpy(&files_[0], data + mpos, hdr.numFiles * sizeof(file_s));
+  mpos += hdr.numFiles * sizeof(file_s);
+
+  if(hdr.numChunks) {
+    chunks_.resize(hdr.numChunks);
+    memcpy(&chunks_[0], data + mpos, hdr.numChunks * sizeof(r3dFSChunk));
+    mpos += hdr.numChunks * sizeof(r3dFSChunk);
+  }
+
+  names_.assign((const char*)data + mpos, (const char*)data + mpos + hdr.namesSize);
+  if(names_.empty() || names_.back() != 0) {
+    Clear();
+    return false;
+  }
+
+  nameHash_.Reserve(hdr.numFiles);
+  for(DWORD i=0; i<hdr.numFiles; i++)
+  {
+    const file_s& f = files_[i];
+    if(f.nameOffset >= hdr.namesSize || (unsigned __int64)f.firstChunk + f.numChunks > hdr.numChunks) {
+      r3dOutToLog("r3dFS: chunk manifest is corrupt\n");
+      Clear();
+      return false;
+    }
+    nameHash_.Add(&names_[f.nameOffset], i);
+  }
+
+  return true;
+}
+
+bool r3dFSChunkManifest::Save(const char* fname) const
+{
+  FILE* f = fopen(fname, "wb");
+  if(f == NULL) {
+    r3dOutToLog("r3dFS: can't open %s for writing\n", fname);
+    return false;
+  }
+
+  r3dFSChunkManifestHeader hdr;
+  hdr.id        = ID;
+  hdr.version   = VERSION;
+  hdr.numFiles  = (DWORD)files_.size();
+  hdr.numChunks = (DWORD)chunks_.size();
+  hdr.namesSize = (DWORD)names_.size();
+  fwrite(&hdr, sizeof(hdr), 1, f);
+
+  if(!files_.empty())  fwrite(&files_[0],  sizeof(file_s),     files_.size(),  f);
+  if(!chunks_.empty()) fwrite(&chunks_[0], sizeof(r3dFSChunk), chunks_.size(), f);
+  if(!names_.empty())  fwrite(&names_[0],  1,                  names_.size(),  f);
+
+  fclose(f);
+  return true;
+}
+
+//
+// delta rebuild
+//
+struct r3dFSOldChunk
+{
+  unsigned __int64 key;
+  DWORD		size;
+  DWORD		offset;
+
+  bool operator < (const r3dFSOldChunk& rhs) const {
+    if(key != rhs.key) return key < rhs.key;
+    return size < rhs.size;
+  }
+};
+
+static inline unsigned __int64 r3dFSChunkKey(DWORD crc32, DWORD hash2)
+{
+  return ((unsigned __int64)crc32 << 32) | hash2;
+}
+
+bool r3dFSRebuildFromChunks(
+	const r3dFSChunkManifest& man,
+	const r3dFSChunkManifest::file_s& file,
+	const BYTE* oldData,
+	DWORD oldSize,
+	r3dFSChunkSource& src,
+	BYTE** out_data,
+	r3dFSDeltaStats* stats)
+{
+  // index chunks of old file
+  std::vector<r3dFSOldChunk> olds;
+  if(oldSize)
+  {
+    std::vector<DWORD> oldEnds;
+    r3dFSSplitChunks(oldData, oldSize, oldEnds);
+
+    olds.resize(oldEnds.size());
+    DWORD start = 0;
+    for(size_t i=0; i<oldEnds.size(); i++)
+    {
+      const DWORD csize = oldEnds[i] - start;
+      olds[i].key    = r3dFSChunkKey(r3dCRC32(oldData + start, csize), r3dFSChunkHash2(oldData + start, csize));
+      olds[i].size   = csize;
+      olds[i].offset = start;
+      start = oldEnds[i];
+    }
+    std::sort(olds.begin(), olds.end());
+  }
+
+  BYTE* data = game_new BYTE[file.size + 1];
+
+  // copy matching chunks, collect missing
+  std::vector<DWORD> missing;
+  std::vector<DWORD> positions(file.numChunks);
+  DWORD pos = 0;
+  for(DWORD i=0; i<file.numChunks; i++)
+  {
+    const r3dFSChunk& ch = man.chunks_[file.firstChunk + i];
+    positions[i] = pos;
+    if(pos + ch.size > file.size || ch.size == 0) {
+      delete[] data;
+      return false;
+    }
+
+    r3dFSOldChunk look;
+    look.key  = r3dFSChunkKey(ch.crc32, ch.hash2);
+    look.size = ch.size;
+    std::vector<r3dFSOldChunk>::const_iterator it = std::lower_bound(olds.begin(), olds.end(), look);
+    if(it != olds.end() && it->key == look.key && it->size == look.size)
+    {
+      memcpy(data + pos, oldData + it->offset, ch.size);
+      if(stats) {
+        stats->reusedBytes += ch.size;
+        stats->reusedChunks++;
+      }
+    }
+    else
+    {
+      missing.push_back(i);
+    }
+
+    pos += ch.size;
+  }
+  if(pos != file.size) {
+    delete[] data;
+    return false;
+  }
+
+  // download missing chunks. neighbour chunks in store are fetched by one request
+  const DWORD MAX_REQUEST = 1024 * 1024;
+  const DWORD MAX_GAP     = 16 * 1024;
+
+  r3dFSCompress comp;
+  comp.failOnError = false;
+  std::vector<BYTE> buf;
+
+  for(size_t m=0; m<missing.size(); )
+  {
+    const r3dFSChunk& first = man.chunks_[file.firstChunk + missing[m]];
+    DWORD reqStart = first.offset;
+    DWORD reqEnd   = first.offset + first.csize;
+
+    size_t mend = m + 1;
+    for(; mend < missing.size(); mend++)
+    {
+      const r3dFSChunk& ch = man.chunks_[file.firstChunk + missing[mend]];
+      if(ch.volume != first.volume || ch.offset < reqEnd || ch.offset - reqEnd > MAX_GAP)
+        break;
+      if(ch.offset + ch.csize - reqStart > MAX_REQUEST)
+        break;
+      reqEnd = ch.offset + ch.csize;
+    }
+
+    buf.resize(reqEnd - reqStart);
+    if(!src.Read(first.volume, reqStart, reqEnd - reqStart, &buf[0])) {
+      delete[] data;
+      return false;
+    }
+
+    if(stats) {
+      stats->downloadedBytes += reqEnd - reqStart;
+      stats->requests++;
+    }
+
+    for(; m < mend; m++)
+    {
+      const DWORD i = missing[m];
+      const r3dFSChunk& ch = man.chunks_[file.firstChunk + i];
+      BYTE* out = data + positions[i];
+
+      DWORD out_size = 0;
+      if(!comp.Decompress("", ch.cmethod, &buf[ch.offset - reqStart], ch.csize, ch.size, out, &out_size) ||
+         out_size != ch.size ||
+         r3dCRC32(out, ch.size) != ch.crc32 ||
+         r3dFSChunkHash2(out, ch.size) != ch.hash2)
+      {
+        r3dOutToLog("r3dFS: bad chunk %d:%d\n", ch.volume, ch.offset);
+        delete[] data;
+        return false;
+      }
+
+      if(stats)
+        stats->downloadedChunks++;
+    }
+  }
+
+  if(r3dCRC32(data, file.size) != file.crc32) {
+    delete[] data;
+    return false;
+  }
+
+  *out_data = data;
+  return true;
+}
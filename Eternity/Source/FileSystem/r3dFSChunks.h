@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Tsg_stl/TStringHashMap.h"
+
+//
+// content defined chunking for delta updates.
+// every archive file is split to chunks with rolling hash boundaries, so small edit changes
+// only chunks around it. chunks are stored (deduplicated, compressed one by one) in chunk store
+// volumes next to archive: <base>_cm.bin - manifest, <base>_chNN.bin - chunk data.
+// updater rebuilds new file from chunks of old local file and downloads only missing ones.
+//
+
+// chunking parameters, must be same for builder and updater
+#define R3D_FS_CHUNK_MIN	(2 * 1024)
+#define R3D_FS_CHUNK_BITS	(14)		// ~16kb average
+#define R3D_FS_CHUNK_MAX	(64 * 1024)
+
+#pragma pack(push,1)
+struct r3dFSChunk
+{
+	BYTE		volume;		// chunk store volume
+	BYTE		cmethod;	// r3dFSCompress::EMethod
+	WORD		pad;
+	DWORD		offset;		// in chunk store volume
+	DWORD		csize;		// in chunk store volume
+	DWORD		size;
+	DWORD		crc32;		// crc32 and hash2 are 64bit chunk key
+	DWORD		hash2;
+};
+#pragma pack(pop)
+
+// split data to chunks, out_ends receive end offset of every chunk
+extern	void		r3dFSSplitChunks(const BYTE* data, DWORD size, std::vector<DWORD>& out_ends);
+// second (independent from crc32) chunk hash
+extern	DWORD		r3dFSChunkHash2(const BYTE* data, DWORD size);
+
+class r3dFSChunkManifest
+{
+  public:
+	enum { ID = 'mcra', VERSION = 1, };
+
+	struct file_s
+	{
+	  DWORD		nameOffset;	// in names_
+	  DWORD		crc32;		// crc of whole file
+	  DWORD		size;
+	  DWORD		firstChunk;
+	  DWORD		numChunks;
+	};
+
+	std::vector<file_s>	files_;
+	std::vector<r3dFSChunk>	chunks_;
+	std::vector<char>	names_;
+	r3dTL::TStringHashMap<DWORD> nameHash_;	// name -> index in files_
+
+  public:
+	r3dFSChunkManifest();
+	~r3dFSChunkManifest();
+
+	void		Clear();
+	bool		IsValid() const {
+	  return !files_.empty();
+	}
+
+	void		AddFile(const char* name, DWORD crc32, DWORD size, const r3dFSChunk* chunks, DWORD numChunks);
+	// return NULL if there is no such file or it have different crc
+	const file_s*	Find(const char* name, DWORD crc32) const;
+
+	bool		Load(const BYTE* data, DWORD size);
+	bool		Save(const char* fname) const;
+};
+
+// source of missing chunks data - http for updater, local files for testing
+class r3dFSChunkSource
+{
+  public:
+	virtual ~r3dFSChunkSource() {}
+	virtual bool	Read(int volume, DWORD offset, DWORD size, BYTE* out_data) = 0;
+};
+
+struct r3dFSDeltaStats
+{
+	__int64		reusedBytes;
+	__int64		downloadedBytes;	// compressed chunk store bytes
+	int		reusedChunks;
+	int		downloadedChunks;
+	int		requests;
+
+	r3dFSDeltaStats() {
+	  reusedBytes      = 0;
+	  downloadedBytes  = 0;
+	  reusedChunks     = 0;
+	  downloadedChunks = 0;
+	  requests         = 0;
+	}
+};
+
+// rebuild file from chunks of old file data and missing chunks from source.
+// out_data allocated by game_new[], size is file.size. result is crc checked
+extern	bool		r3dFSRebuildFromChunks(
+			  const r3dFSChunkManifest& man,
+			  const r3dFSChunkManifest::file_s& file,
+			  const BYTE* oldData,
+			  DWORD oldSize,
+			  r3dFSChunkSource& src,
+			  BYTE** out_data,
+			  r3dFSDeltaStats* stats);
@@ -54,12 +54,51 @@ static DWORD crc_32_tab[] = { /* CRC polynomial 0xedb88320 */
 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+// slice-by-8 tables, crc_32_tab8[0] is crc_32_tab, [k] is crc of byte followed by k zero bytes
+static DWORD crc_32_tab8[8][256];
+
+static struct r3dCRC32TablesInit
+{
+  r3dCRC32TablesInit()
+  {
+    for(int i=0; i<256; i++) 
+    {
+      DWORD c = crc_32_tab[i];
+      crc_32_tab8[0][i] = c;
+      for(int k=1; k<8; k++) {
+        c = crc_32_tab[c & 0xff] ^ (c >> 8);
+        crc_32_tab8[k][i] = c;
+      }
+    }
+  }
+} g_crc32TablesInit;
+
 DWORD r3dCRC32(const BYTE* data, DWORD size)
 {
   DWORD crc32 = 0xFFFFFFFF;
 
   #define UPDC32(octet,crc) (crc_32_tab[((crc) ^ ((BYTE)octet)) & 0xff] ^ ((crc) >> 8))
 
+  // align to dword
+  for(; size && ((size_t)data & 3); --size, ++data) {
+    crc32 = UPDC32(*data, crc32);
+  }
+  
+  // 8 bytes per iteration, little endian only
+  for(; size >= 8; size -= 8, data += 8) 
+  {
+    DWORD one = *(const DWORD*)(data + 0) ^ crc32;
+    DWORD two = *(const DWORD*)(data + 4);
+    crc32 = crc_32_tab8[7][ one        & 0xff] ^
+            crc_32_tab8[6][(one >>  8) & 0xff] ^
+            crc_32_tab8[5][(one >> 16) & 0xff] ^
+            crc_32_tab8[4][ one >> 24        ] ^
+            crc_32_tab8[3][ two        & 0xff] ^
+            crc_32_tab8[2][(two >>  8) & 0xff] ^
+            crc_32_tab8[1][(two >> 16) & 0xff] ^
+            crc_32_tab8[0][ two >> 24        ];
+  }
+
   for(; size; --size, ++data) {
     crc32 = UPDC32(*data, crc32);
   }
@@ -0,0 +1,155 @@
+// only standard and POSIX headers outside of windows build, so it can be tested standalone (see Tools/FSVolumeMapTest).
+// file is excluded from precompiled header in Eternity.vcproj
+#ifdef _WIN32
+  #include "r3dPCH.h"
+  #include "r3d.h"
+#else
+  #include <assert.h>
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+
+  #define r3d_assert(x) assert(x)
+#endif
+
+#include "r3dFSVolumeMap.h"
+
+r3dFSMappedFile::r3dFSMappedFile()
+{
+#ifdef _WIN32
+  hFile_ = INVALID_HANDLE_VALUE;
+  hMap_  = NULL;
+#else
+  fd_    = -1;
+#endif
+  size_  = 0;
+}
+
+r3dFSMappedFile::~r3dFSMappedFile()
+{
+  Close();
+}
+
+bool r3dFSMappedFile::Open(const char* fname)
+{
+  Close();
+
+#ifdef _WIN32
+  HANDLE h = ::CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(h == INVALID_HANDLE_VALUE)
+    return false;
+    
+  LARGE_INTEGER size;
+  if(!::GetFileSizeEx(h, &size) || size.QuadPart == 0) {
+    CloseHandle(h);
+    return false;
+  }
+
+  HANDLE hMap = ::CreateFileMapping(h, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(hMap == NULL) {
+    CloseHandle(h);
+    return false;
+  }
+  
+  hFile_ = h;
+  hMap_  = hMap;
+  size_  = size.QuadPart;
+#else
+  int fd = ::open(fname, O_RDONLY);
+  if(fd < 0)
+    return false;
+    
+  struct stat st;
+  if(::fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  
+  fd_   = fd;
+  size_ = st.st_size;
+#endif
+
+  return true;
+}
+
+void r3dFSMappedFile::Close()
+{
+#ifdef _WIN32
+  if(hMap_ != NULL)
+    CloseHandle(hMap_);
+  if(hFile_ != INVALID_HANDLE_VALUE)
+    CloseHandle(hFile_);
+  hMap_  = NULL;
+  hFile_ = INVALID_HANDLE_VALUE;
+#else
+  if(fd_ >= 0)
+    ::close(fd_);
+  fd_ = -1;
+#endif
+  size_ = 0;
+}
+
+size_t r3dFSMappedFile::GetGranularity()
+{
+  static size_t granularity = 0;
+  if(granularity == 0)
+  {
+#ifdef _WIN32
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    granularity = sysInfo.dwAllocationGranularity;
+#else
+    granularity = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+  }
+  
+  return granularity;
+}
+
+int r3dFSMappedFile::GetLastErrorCode()
+{
+#ifdef _WIN32
+  return (int)::GetLastError();
+#else
+  return errno;
+#endif
+}
+
+const unsigned char* r3dFSMappedFile::MapRegion(long long offset, size_t size, void** out_base, size_t* out_mapSize) const
+{
+  r3d_assert(IsOpen());
+  r3d_assert(offset >= 0 && offset + (long long)size <= size_);
+
+  const long long gran  = (long long)GetGranularity();
+  const long long start = (offset / gran) * gran;
+  const size_t    delta = (size_t)(offset - start);
+  const size_t  mapSize = delta + size;
+
+#ifdef _WIN32
+  void* base = ::MapViewOfFile(hMap_, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)(start & 0xFFFFFFFF), mapSize);
+  if(base == NULL)
+    return NULL;
+#else
+  void* base = ::mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd_, (off_t)start);
+  if(base == MAP_FAILED)
+    return NULL;
+#endif
+
+  *out_base    = base;
+  *out_mapSize = mapSize;
+  return (const unsigned char*)base + delta;
+}
+
+void r3dFSMappedFile::UnmapRegion(void* base, size_t mapSize)
+{
+  if(base == NULL)
+    return;
+    
+#ifdef _WIN32
+  ::UnmapViewOfFile(base);
+#else
+  ::munmap(base, mapSize);
+#endif
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+// portable read-only memory mapping of archive volume file.
+// only standard types are used here, so this can be built and tested without windows headers
+class r3dFSMappedFile
+{
+  public:
+#ifdef _WIN32
+	void*		hFile_;
+	void*		hMap_;
+#else
+	int		fd_;
+#endif
+	long long	size_;
+
+  private:	
+	// make copy constructor and assignment operator inaccessible
+	r3dFSMappedFile(const r3dFSMappedFile& rhs);
+	r3dFSMappedFile& operator=(const r3dFSMappedFile& rhs);
+
+  public:
+	r3dFSMappedFile();
+	~r3dFSMappedFile();
+
+	bool		Open(const char* fname);
+	void		Close();
+	bool		IsOpen() const {
+	  return size_ > 0;
+	}
+
+	// map [offset, offset+size) of file. out_base/out_mapSize must be passed back to UnmapRegion
+	const unsigned char* MapRegion(long long offset, size_t size, void** out_base, size_t* out_mapSize) const;
+	static void	UnmapRegion(void* base, size_t mapSize);
+	
+	// mapping offset alignment
+	static size_t	GetGranularity();
+	// last OS error of Open/MapRegion
+	static int	GetLastErrorCode();
+};
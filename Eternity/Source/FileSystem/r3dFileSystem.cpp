@@ -8,7 +8,86 @@
 
 extern void r3dCopyFixedFileName(const char* in_fname, char* out_fname);
 
+// persistent mapping windows. volume is mapped by windows, so 32bit client won't run out of address space
+#ifdef _WIN64
+  #define R3D_FS_MAP_WINDOW_SIZE	(4LL * 1024 * 1024 * 1024)	// whole volume
+  #define R3D_FS_MAP_WINDOW_OVERLAP	(0LL)
+  #define R3D_FS_MAP_BUDGET		(0x7FFFFFFFFFFFFFFFLL)
+#else
+  #define R3D_FS_MAP_WINDOW_SIZE	(64LL * 1024 * 1024)
+  #define R3D_FS_MAP_WINDOW_OVERLAP	(16LL * 1024 * 1024)		// files starting near window end still fit
+  #define R3D_FS_MAP_BUDGET		(384LL * 1024 * 1024)
+#endif
+
 CRITICAL_SECTION g_FileSysCritSection;
+r3dFS_RWLock	g_FileSysRWLock;
+
+bool r3dFS_RWLock::LockShared()
+{
+  // writer thread is allowed to read without counting itself as reader
+  if(writerThread_ == GetCurrentThreadId())
+    return false;
+
+  for(;;)
+  {
+    LONG s = state_;
+    if((s & WRITER_BIT) == 0) {
+      if(InterlockedCompareExchange(&state_, s + 1, s) == s)
+        return true;
+      continue;
+    }
+
+    // writer is active or waiting for readers to drain
+    Sleep(0);
+  }
+}
+
+void r3dFS_RWLock::UnlockShared()
+{
+  LONG s = InterlockedDecrement(&state_);
+  r3d_assert((s & ~WRITER_BIT) >= 0);
+}
+
+void r3dFS_RWLock::LockExclusive()
+{
+  // writers are serialized by g_FileSysCritSection, so only recursion is possible here
+  const DWORD tid = GetCurrentThreadId();
+  if(writerThread_ == tid) {
+    writerDepth_++;
+    return;
+  }
+
+  r3d_assert((state_ & WRITER_BIT) == 0);
+  InterlockedExchangeAdd(&state_, WRITER_BIT);
+
+  // wait for active readers
+  while((state_ & ~WRITER_BIT) != 0)
+    Sleep(0);
+
+  writerThread_ = tid;
+  writerDepth_  = 1;
+}
+
+void r3dFS_RWLock::UnlockExclusive()
+{
+  r3d_assert(writerThread_ == GetCurrentThreadId());
+  if(--writerDepth_ > 0)
+    return;
+
+  writerThread_ = 0;
+  InterlockedExchangeAdd(&state_, -WRITER_BIT);
+}
+
+r3dFS_WriteLock::r3dFS_WriteLock() 
+: csHolder(g_FileSysCritSection)
+{
+  g_FileSysRWLock.LockExclusive();
+}
+
+r3dFS_WriteLock::~r3dFS_WriteLock()
+{
+  g_FileSysRWLock.UnlockExclusive();
+}
 
 r3dFS_FileList::r3dFS_FileList()
 {
@@ -79,7 +158,7 @@ const char* r3dFS_FileList::GetBuildDate(DWORD buildVersion, char* buf)
 
 void r3dFS_FileList::AddToNameHash(const r3dFS_FileEntry* fe)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
 
   r3d_assert(fe->name[0]);
   if(Find(fe->name) != NULL)
@@ -93,9 +172,10 @@ void r3dFS_FileList::AddToNameHash(const r3dFS_FileEntry* fe)
 
 void r3dFS_FileList::InitAllNamesHash()
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
   // populate hash
   r3d_assert(namesHash_.IsEmpty());
+  namesHash_.Reserve((uint32_t)files_.size());
   for(size_t i=0; i<files_.size(); i++) 
   {
     AddToNameHash(files_[i]);
@@ -106,14 +186,14 @@ void r3dFS_FileList::InitAllNamesHash()
 
 const r3dFS_FileEntry* r3dFS_FileList::Find(const char* in_fname) const
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
-
   char fname[MAX_PATH];
   r3dCopyFixedFileName(in_fname, fname);
   strlwr(fname);
+
+  r3dFS_ReadLock rdLock;
   
   const r3dFS_FileEntry* fe = NULL;
-  if(namesHash_.GetObject(fname, &fe)) {
+  if(namesHash_.Find(fname, &fe)) {
     r3d_assert(fe);
     return fe;
   }
@@ -135,7 +215,7 @@ const r3dFS_FileEntry* r3dFS_FileList::Find(const char* in_fname) const
 
 r3dFS_FileEntry* r3dFS_FileList::AddNew(const char* fname)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
 
   r3dFS_FileEntry* fe = game_new r3dFS_FileEntry();
   r3dscpy(fe->name, fname);
@@ -147,7 +227,7 @@ r3dFS_FileEntry* r3dFS_FileList::AddNew(const char* fname)
 
 bool r3dFS_FileList::Remove(const char* fname)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
 
   const r3dFS_FileEntry* fe = Find(fname);
   if(!fe) {
@@ -174,7 +254,7 @@ bool r3dFS_FileList::Remove(const char* fname)
 
 bool r3dFS_FileList::Create(const BYTE* data, unsigned int size, const char* fname)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
 
   unsigned int mpos = 0;
   
@@ -287,6 +367,14 @@ bool r3dFS_FileList::WriteFileList(FILE* f)
 r3dFileSystem::r3dFileSystem()
 {
   InitializeCriticalSection(&g_FileSysCritSection);
+  InitializeCriticalSection(&mapCritSection_);
+  mappedBytes_   = 0;
+  mapUseCounter_ = 0;
+  crcCheckMode_     = CRC_CHECK_ALWAYS;
+  archiveValidated_ = false;
+  verified_         = NULL;
+  verifiedSize_     = 0;
+  verifiedCount_    = 0;
   VOLUME_SIZE = 1 * 1024 * 1024 * 1024; // 1gb
   failOnError_ = true;
 
@@ -296,9 +384,100 @@ r3dFileSystem::r3dFileSystem()
 
 r3dFileSystem::~r3dFileSystem()
 {
+  // close volumes first, CloseVolumes require critical section to be alive
+  CloseVolumes();
+
+  DeleteCriticalSection(&mapCritSection_);
   DeleteCriticalSection(&g_FileSysCritSection);
   
-  CloseVolumes();
+  delete[] verified_;
+}
+
+static inline DWORD FSVerifiedHash(const r3dFS_FileEntry* fe)
+{
+  // entries are heap allocated, low bits are always the same
+  DWORD h = (DWORD)(size_t)fe >> 4;
+  return h * 2654435761u;
+}
+
+bool r3dFileSystem::NeedCrcCheck(const r3dFS_FileEntry* fe) const
+{
+  switch(crcCheckMode_)
+  {
+    default:
+    case CRC_CHECK_ALWAYS:
+      return true;
+      
+    case CRC_CHECK_VALIDATED:
+      return !archiveValidated_;
+      
+    case CRC_CHECK_FIRST_READ:
+      break;
+  }
+  
+  if(verified_ == NULL)
+    return true;
+  
+  const DWORD mask = verifiedSize_ - 1;
+  DWORD idx = FSVerifiedHash(fe) & mask;
+  for(DWORD i=0; i<verifiedSize_; i++, idx = (idx + 1) & mask)
+  {
+    const r3dFS_FileEntry* v = verified_[idx];
+    if(v == fe)   return false;
+    if(v == NULL) return true;
+  }
+  
+  return true;
+}
+
+void r3dFileSystem::MarkVerified(const r3dFS_FileEntry* fe)
+{
+  if(crcCheckMode_ != CRC_CHECK_FIRST_READ || verified_ == NULL)
+    return;
+
+  const DWORD mask = verifiedSize_ - 1;
+  DWORD idx = FSVerifiedHash(fe) & mask;
+  for(DWORD i=0; i<verifiedSize_; i++, idx = (idx + 1) & mask)
+  {
+    const r3dFS_FileEntry* v = verified_[idx];
+    if(v == fe)
+      return;
+    if(v != NULL)
+      continue;
+      
+    v = (const r3dFS_FileEntry*)InterlockedCompareExchangePointer((PVOID volatile*)&verified_[idx], (PVOID)fe, NULL);
+    if(v == NULL) {
+      InterlockedIncrement(&verifiedCount_);
+      return;
+    }
+    if(v == fe)
+      return;
+  }
+  
+  // set is full (files were added after opening) - entry will be checked again next time
+}
+
+void r3dFileSystem::ResetVerified()
+{
+  // called from writer paths only, so there is no readers at this moment
+  DWORD size = 1024;
+  while(size < fl_.files_.size() * 2)
+    size *= 2;
+    
+  if(size != verifiedSize_) 
+  {
+    delete[] verified_;
+    verified_     = game_new const r3dFS_FileEntry*[size];
+    verifiedSize_ = size;
+  }
+  else if(verifiedCount_ == 0)
+  {
+    // nothing to clear, this is called for each written file
+    return;
+  }
+  
+  memset((void*)verified_, 0, sizeof(verified_[0]) * verifiedSize_);
+  verifiedCount_ = 0;
 }
 
 void r3dFileSystem::GetVolumeName(char* fname, int idx) const
@@ -324,7 +503,9 @@ void r3dFileSystem::RemoveVolumeFiles()
 
 bool r3dFileSystem::OpenVolumesEx(bool forRead, bool fail_if_error)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
+  ResetVerified();
+
   for(size_t i=0; i<MAX_VOLUMES; i++) 
   {
     r3d_assert(volumeHandles[i] == INVALID_HANDLE_VALUE);
@@ -345,6 +526,27 @@ bool r3dFileSystem::OpenVolumesEx(bool forRead, bool fail_if_error)
     }
     
     volumeHandles[i] = h;
+    
+    if(!forRead)
+      continue;
+
+    // create persistent mapping once, windows will be mapped on demand
+    if(!volumeMaps[i].Open(fname)) {
+      if(fail_if_error)
+        r3dError("FileSystem corrupt: can't map %s, %d\n", fname, r3dFSMappedFile::GetLastErrorCode());
+
+      r3dOutToLog("r3dFS: can't map %s\n", fname);
+      return false;
+    }
+    
+    const __int64 volSize = volumeMaps[i].size_;
+    volumeWindows[i].resize((size_t)((volSize + R3D_FS_MAP_WINDOW_SIZE - 1) / R3D_FS_MAP_WINDOW_SIZE));
+    for(size_t k=0; k<volumeWindows[i].size(); k++)
+    {
+      r3dFSMapWindow& w = volumeWindows[i][k];
+      w.start = k * R3D_FS_MAP_WINDOW_SIZE;
+      w.size  = (size_t)R3D_MIN(R3D_FS_MAP_WINDOW_SIZE + R3D_FS_MAP_WINDOW_OVERLAP, volSize - w.start);
+    }
   }
   
   return true;
@@ -352,6 +554,33 @@ bool r3dFileSystem::OpenVolumesEx(bool forRead, bool fail_if_error)
 
 void r3dFileSystem::CloseVolumes()
 {
+  r3dFS_WriteLock wrLock;
+  if(verified_)
+    ResetVerified();
+
+  // views point into windows - unmapping them would leave dangling pointers
+  for(size_t i=0; i<MAX_VOLUMES; i++) 
+  {
+    for(size_t k=0; k<volumeWindows[i].size(); k++)
+    {
+      if(volumeWindows[i][k].refs > 0)
+        r3dError("r3dFS: volume %d closed with %d active file views, ReleaseFileView wasn't called\n", i, volumeWindows[i][k].refs);
+    }
+  }
+
+  for(size_t i=0; i<MAX_VOLUMES; i++) 
+  {
+    for(size_t k=0; k<volumeWindows[i].size(); k++)
+    {
+      r3dFSMapWindow& w = volumeWindows[i][k];
+      if(w.data)
+        r3dFSMappedFile::UnmapRegion(w.mapBase, w.mapSize);
+    }
+    volumeWindows[i].clear();
+    volumeMaps[i].Close();
+  }
+  mappedBytes_ = 0;
+
   for(size_t i=0; i<MAX_VOLUMES; i++) 
   {
     if(volumeHandles[i] == INVALID_HANDLE_VALUE)
@@ -436,10 +665,14 @@ bool r3dFileSystem::ReadFileList()
   
 bool r3dFileSystem::WriteFileData(const r3dFS_FileEntry& fe, const BYTE* cdata, DWORD csize)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
   r3d_assert(fe.IsValid());
   r3d_assert(fe.csize == csize);
   
+  // volume data is changing
+  ResetVerified();
+  archiveValidated_ = false;
+  
   // open volume handle if it wasn't opened already
   HANDLE h = volumeHandles[fe.volume];
   if(h == INVALID_HANDLE_VALUE) 
@@ -480,9 +713,9 @@ bool r3dFileSystem::WriteFileData(const r3dFS_FileEntry& fe, const BYTE* cdata,
   return true;
 }
 
-bool r3dFileSystem::UncompressFileData(const r3dFS_FileEntry* fe, const BYTE* cdata, DWORD csize, BYTE** out_data, DWORD* out_size)
+bool r3dFileSystem::UncompressFileData(const r3dFS_FileEntry* fe, const BYTE* cdata, DWORD csize, BYTE** out_data, DWORD* out_size, bool checkCrc)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  // no locking here - works only with passed data, so can be called from any thread
   r3d_assert(fe && fe->IsValid());
   r3d_assert(fe->csize == csize);
 
@@ -497,8 +730,7 @@ bool r3dFileSystem::UncompressFileData(const r3dFS_FileEntry* fe, const BYTE* cd
     return false;
   }
   
-  // check CRC - TODO: remove later
-  if(1)
+  if(checkCrc)
   {
     DWORD crc32 = r3dCRC32(*out_data, *out_size);
     if(crc32 != fe->crc32) {
@@ -511,22 +743,103 @@ bool r3dFileSystem::UncompressFileData(const r3dFS_FileEntry* fe, const BYTE* cd
   return true;
 }
 
-bool r3dFileSystem::GetFileData(const r3dFS_FileEntry* fe, BYTE** out_data, DWORD* out_size)
+static void FSReportMapError(int lastError)
 {
-  // enter CS, otherwise if entered from two threads at the same time we will crash with Decompress Failed. 
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  if(lastError == 5) // access denied
+  {
+    MessageBox(NULL, "Error: access denied trying to open data file.\nPlease turn off your anti virus and restart your machine\n", "Error", MB_OK);
+    TerminateProcess(r3d_CurrentProcess, 0);
+  }
+  else if(lastError == 1816) // not enough quota to process this request (some kind of out of memory)
+  {
+    MessageBox(NULL, "Error: out of system memory when opening data file\n", "Error", MB_OK);
+    TerminateProcess(r3d_CurrentProcess, 0);
+  }
+  else
+    r3dError("GetFileData() failed. MapViewOfFile Error: %d\n", lastError);
+}
 
-  r3d_assert(fe && fe->IsValid());
+void r3dFileSystem::EvictWindows(size_t needSize)
+{
+  // mapCritSection_ must be held
+  while(mappedBytes_ + (__int64)needSize > R3D_FS_MAP_BUDGET)
+  {
+    // find least recently used unpinned window
+    r3dFSMapWindow* lru = NULL;
+    for(int i=0; i<MAX_VOLUMES; i++)
+    {
+      for(size_t k=0; k<volumeWindows[i].size(); k++)
+      {
+        r3dFSMapWindow& w = volumeWindows[i][k];
+        if(w.data == NULL || w.refs > 0)
+          continue;
+        if(lru == NULL || w.lastUse < lru->lastUse)
+          lru = &w;
+      }
+    }
+    
+    // everything is in use, go over budget
+    if(lru == NULL)
+      return;
+
+    r3dFSMappedFile::UnmapRegion(lru->mapBase, lru->mapSize);
+    mappedBytes_ -= lru->mapSize;
+    lru->data    = NULL;
+    lru->mapBase = NULL;
+    lru->mapSize = 0;
+  }
+}
+
+// map file chunk (header + compressed data). read lock must be held
+bool r3dFileSystem::MapChunk(const r3dFS_FileEntry* fe, r3dFSFileView* out_chunk)
+{
+  const DWORD chunkSize = fe->csize + sizeof(r3dFS_FileHeader);
   
-  // early exit for zero length files, because of MapViewOfFile
-  if(fe->size == 0)
+  const r3dFSMappedFile& vmap = volumeMaps[fe->volume];
+  if(vmap.IsOpen())
   {
-    *out_size = 0;
-    *out_data = game_new BYTE[1];
-	
-	return true;
+    if((__int64)fe->offset + chunkSize > vmap.size_) {
+      r3dOutToLog("GetFileData() failed. %s is outside of volume %d\n", fe->name, fe->volume);
+      return false;
+    }
+
+    // try persistent window first
+    MapWindowsVec& windows = volumeWindows[fe->volume];
+    r3dFSMapWindow& w = windows[(size_t)(fe->offset / R3D_FS_MAP_WINDOW_SIZE)];
+    if((__int64)fe->offset + chunkSize <= w.start + (__int64)w.size)
+    {
+      r3dCSHolder csHolder(mapCritSection_);
+      if(w.data == NULL)
+      {
+        EvictWindows(w.size);
+        w.data = vmap.MapRegion(w.start, w.size, &w.mapBase, &w.mapSize);
+        if(w.data == NULL) {
+          FSReportMapError(r3dFSMappedFile::GetLastErrorCode());
+          return false;
+        }
+        mappedBytes_ += w.mapSize;
+      }
+      
+      w.refs++;
+      w.lastUse = ++mapUseCounter_;
+      
+      out_chunk->window_ = &w;
+      out_chunk->data    = w.data + (fe->offset - w.start);
+      out_chunk->size    = chunkSize;
+      return true;
+    }
+    
+    // big file crossing window boundary - map it separately, mapping object is already there
+    out_chunk->data = vmap.MapRegion(fe->offset, chunkSize, &out_chunk->mapBase_, &out_chunk->mapSize_);
+    if(out_chunk->data == NULL) {
+      FSReportMapError(r3dFSMappedFile::GetLastErrorCode());
+      return false;
+    }
+    out_chunk->size = chunkSize;
+    return true;
   }
 
+  // volumes opened for write (updater) - they're growing, so map each file separately
   HANDLE h = volumeHandles[fe->volume];
   r3d_assert(h != INVALID_HANDLE_VALUE);
   
@@ -536,50 +849,145 @@ bool r3dFileSystem::GetFileData(const r3dFS_FileEntry* fe, BYTE** out_data, DWOR
     return false;
   }
   
-  SYSTEM_INFO sysInfo;
-  GetSystemInfo(&sysInfo);
-  DWORD mmapStart  = (fe->offset / sysInfo.dwAllocationGranularity) * sysInfo.dwAllocationGranularity;
+  const DWORD gran = (DWORD)r3dFSMappedFile::GetGranularity();
+  DWORD mmapStart  = (fe->offset / gran) * gran;
   DWORD mmapOff    = fe->offset - mmapStart;
-  DWORD mmapSize   = mmapOff + fe->csize + sizeof(r3dFS_FileHeader);
-  const BYTE* mmap = (const BYTE*)MapViewOfFile(hFileMap, FILE_MAP_READ, 0, mmapStart, mmapSize);
-  if(mmap == NULL) { // failed
-	DWORD lastError = GetLastError();
-	if(lastError == 5) // access denied
-	{
-		MessageBox(NULL, "Error: access denied trying to open data file.\nPlease turn off your anti virus and restart your machine\n", "Error", MB_OK);
-		TerminateProcess(r3d_CurrentProcess, 0);
-		return false;
-	}
-	else if(lastError == 1816) // not enough quota to process this request (some kind of out of memory)
-	{
-		MessageBox(NULL, "Error: out of system memory when opening data file\n", "Error", MB_OK);
-		TerminateProcess(r3d_CurrentProcess, 0);
-		return false;
-	}
-	else
-		r3dError("GetFileData() failed. MapViewOfFile Error: %d\n", lastError);
+  DWORD mmapSize   = mmapOff + chunkSize;
+  void* mmap = MapViewOfFile(hFileMap, FILE_MAP_READ, 0, mmapStart, mmapSize);
+  if(mmap == NULL) {
+    DWORD lastError = GetLastError();
+    CloseHandle(hFileMap);
+    FSReportMapError(lastError);
     return false;
   }
+  
+  out_chunk->hFileMap_ = hFileMap;
+  out_chunk->mapBase_  = mmap;
+  out_chunk->mapSize_  = mmapSize;
+  out_chunk->data      = (const BYTE*)mmap + mmapOff;
+  out_chunk->size      = chunkSize;
+  return true;
+}
+
+void r3dFileSystem::UnmapChunk(r3dFSFileView* chunk)
+{
+  if(chunk->window_)
+  {
+    // keep window mapped, it'll be evicted when we'll be out of budget
+    r3dCSHolder csHolder(mapCritSection_);
+    r3d_assert(chunk->window_->refs > 0);
+    chunk->window_->refs--;
+  }
+  else
+  {
+    r3dFSMappedFile::UnmapRegion(chunk->mapBase_, chunk->mapSize_);
+    if(chunk->hFileMap_)
+      CloseHandle(chunk->hFileMap_);
+  }
+  
+  *chunk = r3dFSFileView();
+}
+
+bool r3dFileSystem::GetFileData(const r3dFS_FileEntry* fe, BYTE** out_data, DWORD* out_size)
+{
+  // shared lock - volume handles must not be closed/reopened while we're mapping them.
+  // several threads can map & decompress different files at the same time
+  r3dFS_ReadLock rdLock;
+
+  r3d_assert(fe && fe->IsValid());
+  
+  // early exit for zero length files, because of MapViewOfFile
+  if(fe->size == 0)
+  {
+    *out_size = 0;
+    *out_data = game_new BYTE[1];
+	
+	return true;
+  }
+
+  r3dFSFileView chunk;
+  if(!MapChunk(fe, &chunk))
+    return false;
 
-  const BYTE* data = mmap + mmapOff;
-  const r3dFS_FileHeader& hdr1 = *(r3dFS_FileHeader*)data;
+  const r3dFS_FileHeader& hdr1 = *(const r3dFS_FileHeader*)chunk.data;
   if(hdr1.id != hdr1.ID) {
+    UnmapChunk(&chunk);
     if(failOnError_) r3dError("GetFileData() failed. %s, bad header\n", fe->name);
     else             r3dOutToLog("GetFileData() failed. %s, bad header\n", fe->name);
     return false;
   }
 
-  bool res = UncompressFileData(fe, (data + sizeof(r3dFS_FileHeader)), fe->csize, out_data, out_size);
+  // decompress directly from mapped memory
+  const bool checkCrc = NeedCrcCheck(fe);
+  bool res = UncompressFileData(fe, (chunk.data + sizeof(r3dFS_FileHeader)), fe->csize, out_data, out_size, checkCrc);
+  
+  UnmapChunk(&chunk);
+  
+  if(res && checkCrc)
+    MarkVerified(fe);
+  
+  return res;
+}
+
+bool r3dFileSystem::GetFileView(const r3dFS_FileEntry* fe, r3dFSFileView* out_view)
+{
+  r3dFS_ReadLock rdLock;
+
+  r3d_assert(fe && fe->IsValid());
+  if(fe->cmethod != r3dFSCompress::COMPRESS_STORE)
+    return false;
+
+  if(fe->size == 0)
+  {
+    static const BYTE emptyData[1] = {0};
+    out_view->data = emptyData;
+    out_view->size = 0;
+    return true;
+  }
+  
+  if(!MapChunk(fe, out_view))
+    return false;
+    
+  const r3dFS_FileHeader& hdr1 = *(const r3dFS_FileHeader*)out_view->data;
+  if(hdr1.id != hdr1.ID) {
+    UnmapChunk(out_view);
+    if(failOnError_) r3dError("GetFileView() failed. %s, bad header\n", fe->name);
+    else             r3dOutToLog("GetFileView() failed. %s, bad header\n", fe->name);
+    return false;
+  }
   
-  UnmapViewOfFile(mmap);
-  CloseHandle(hFileMap);
+  out_view->data += sizeof(r3dFS_FileHeader);
+  out_view->size  = fe->size;
+
+  if(NeedCrcCheck(fe))
+  {
+    DWORD crc32 = r3dCRC32(out_view->data, out_view->size);
+    if(crc32 != fe->crc32) {
+      UnmapChunk(out_view);
+      if(failOnError_) r3dError("GetFileView() crc failed %s\n", fe->name);
+      else             r3dOutToLog("GetFileView() crc failed %s\n", fe->name);
+      return false;
+    }
+    MarkVerified(fe);
+  }
   
-   return res;
+  return true;
+}
+
+void r3dFileSystem::ReleaseFileView(r3dFSFileView* view)
+{
+  // zero sized file view
+  if(view->window_ == NULL && view->mapBase_ == NULL) {
+    *view = r3dFSFileView();
+    return;
+  }
+
+  UnmapChunk(view);
 }
 
 bool r3dFileSystem::ExtractFile(const r3dFS_FileEntry* fe, const char* outDir)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  // note: do not take read lock here, GetFileData will do it
   BYTE* data;
   DWORD size;
   GetFileData(fe, &data, &size);
@@ -602,9 +1010,69 @@ bool r3dFileSystem::ExtractFile(const r3dFS_FileEntry* fe, const char* outDir)
   return true;
 }
 
-bool r3dFileSystem::BuildNewArchive(const char* baseName)
+// archive building pipeline: workers compress files out of order, caller thread
+// is the only writer and takes results strictly in file list order, so volume layout
+// is exactly the same as with single thread build
+struct r3dFSBuildJob
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_FileEntry* fe;
+  int		cmethod;
+  BYTE*		cdata;
+  DWORD		fsize;
+  DWORD		csize;
+  DWORD		crc32;
+  volatile LONG	done;
+};
+
+struct r3dFSBuildPipe
+{
+  r3dFSBuildJob* jobs;
+  int		numJobs;
+  volatile LONG	nextJob;
+  HANDLE	slotsSem;	// limits number of compressed files waiting for writer
+  HANDLE	doneEvent;	// auto reset, signaled when any job is finished
+};
+
+static void BuildArchive_CompressJob(r3dFSCompress& compress, r3dFSBuildJob& job)
+{
+  job.cmethod = r3dFSCompress::COMPRESS_INFLATE;
+
+  // hack: terrain3 files must be uncompressed
+  if(strstr(job.fe->name, "\\Terrain3\\") != NULL)
+    job.cmethod = r3dFSCompress::COMPRESS_STORE;
+
+  compress.CompressFile(job.fe->name, &job.cmethod, &job.cdata, &job.fsize, &job.csize, &job.crc32);
+}
+
+static unsigned int __stdcall BuildArchive_WorkerThread(LPVOID in_ptr)
+{
+  r3dFSBuildPipe* pipe = (r3dFSBuildPipe*)in_ptr;
+  r3dFSCompress compress;
+
+  for(;;)
+  {
+    WaitForSingleObject(pipe->slotsSem, INFINITE);
+
+    int idx = InterlockedIncrement(&pipe->nextJob) - 1;
+    if(idx >= pipe->numJobs) {
+      // give slot back, so other workers can see the end too
+      ReleaseSemaphore(pipe->slotsSem, 1, NULL);
+      break;
+    }
+
+    r3dFSBuildJob& job = pipe->jobs[idx];
+    BuildArchive_CompressJob(compress, job);
+
+    InterlockedExchange(&job.done, 1);
+    SetEvent(pipe->doneEvent);
+  }
+
+  return 0;
+}
+
+bool r3dFileSystem::BuildNewArchive(const char* baseName, int numThreads)
+{
+  r3dFS_WriteLock wrLock;
   const int numFiles = GetNumFiles();
   if(numFiles == 0)
     r3dError("there is no files");
@@ -616,37 +1084,78 @@ bool r3dFileSystem::BuildNewArchive(const char* baseName)
   ResetVolumes();
 
   // build volumes
+  
+  numThreads = R3D_MAX(numThreads, 1);
+  numThreads = R3D_MIN(numThreads, MAXIMUM_WAIT_OBJECTS);
+
+  r3dFSBuildJob* jobs = game_new r3dFSBuildJob[numFiles];
+  memset(jobs, 0, sizeof(r3dFSBuildJob) * numFiles);
+  for(int i=0; i<numFiles; i++)
+    jobs[i].fe = fl_.files_[i];
+
+  r3dFSBuildPipe pipe;
+  pipe.jobs      = jobs;
+  pipe.numJobs   = numFiles;
+  pipe.nextJob   = 0;
+  pipe.slotsSem  = NULL;
+  pipe.doneEvent = NULL;
+
+  HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+  int    numStarted = 0;
+  if(numThreads > 1)
+  {
+    const int maxInFlight = numThreads * 4;
+    pipe.slotsSem  = CreateSemaphore(NULL, maxInFlight, maxInFlight, NULL);
+    pipe.doneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if(pipe.slotsSem == NULL || pipe.doneEvent == NULL)
+      r3dError("BuildNewArchive: can't create sync objects, err=%d\n", GetLastError());
+
+    for(numStarted=0; numStarted<numThreads; numStarted++) {
+      threads[numStarted] = (HANDLE)_beginthreadex(NULL, 0, BuildArchive_WorkerThread, &pipe, 0, NULL);
+      if(threads[numStarted] == NULL)
+        r3dError("BuildNewArchive: failed to begin thread");
+    }
+  }
+  
+  r3dOutToLog("Compressing %d files, %d threads\n", numFiles, numThreads);
 
   r3dFSCompress compress;
   __int64 stat_size = 0;
   __int64 stat_csize = 0;
+  float   stat_stall = 0;
+  const float timeStart = r3dGetTime();
     
   for(int i=0; i<numFiles; i++)
   {
-    r3dFS_FileEntry& fe = *fl_.files_[i];
+    r3dFSBuildJob& job = jobs[i];
+    r3dFS_FileEntry& fe = *job.fe;
 
     float cperc = (float)stat_size / stat_csize;
 	r3dOutToLog("[%04d/%04d] file: %s ratio:%.2fx, size:%.0f mb              \n", i, numFiles, fe.name, cperc, (float)stat_csize / 1024 / 1024);
     OutputDebugStringA(fe.name);
-    
-    // compress
-    int cmethod = r3dFSCompress::COMPRESS_INFLATE; 
-    
-    // hack: terrain3 files must be uncompressed
+
     if(strstr(fe.name, "\\Terrain3\\") != NULL) {
-      cmethod = r3dFSCompress::COMPRESS_STORE;
       r3dOutToLog("****** storing Terrain3 file: %s\n", fe.name);
     }
     
-    BYTE* cdata = NULL;
-    DWORD fsize = 0; // uncompressed size
-    DWORD csize = 0; // compressed size
-    DWORD crc32 = 0;
-    compress.CompressFile(fe.name, &cmethod, &cdata, &fsize, &csize, &crc32);
-    if(fsize != fe.size)
-      r3dError("file %s size was changed %d vs %d\n", fe.name, fsize, fe.size);
+    // compress, or wait for worker to do it
+    if(numStarted == 0) 
+    {
+      BuildArchive_CompressJob(compress, job);
+    }
+    else
+    {
+      const float t1 = r3dGetTime();
+      while(job.done == 0)
+        WaitForSingleObject(pipe.doneEvent, INFINITE);
+      stat_stall += r3dGetTime() - t1;
+    }
+
+    const DWORD csize = job.csize;
+    if(job.fsize != fe.size)
+      r3dError("file %s size was changed %d vs %d\n", fe.name, job.fsize, fe.size);
       
-    stat_size += fsize;
+    stat_size += job.fsize;
     stat_csize += csize;
     
     // allocate space for file inside archive
@@ -656,21 +1165,37 @@ bool r3dFileSystem::BuildNewArchive(const char* baseName)
 
     // fill header
     fe.csize   = csize;
-    fe.cmethod = cmethod;
+    fe.cmethod = job.cmethod;
     fe.volume  = (BYTE)volume;
     fe.offset  = offset;
-    fe.crc32   = crc32;
+    fe.crc32   = job.crc32;
     if(!fe.IsValid())
       r3dError("!fe.IsValid()");
       
-    WriteFileData(fe, cdata, csize);
+    WriteFileData(fe, job.cdata, csize);
     
-    delete[] cdata;
+    delete[] job.cdata;
+    job.cdata = NULL;
+
+    // let workers go further
+    if(numStarted)
+      ReleaseSemaphore(pipe.slotsSem, 1, NULL);
+  }
+
+  if(numStarted)
+  {
+    WaitForMultipleObjects(numStarted, threads, TRUE, INFINITE);
+    for(int i=0; i<numStarted; i++)
+      CloseHandle(threads[i]);
+    CloseHandle(pipe.slotsSem);
+    CloseHandle(pipe.doneEvent);
   }
+  delete[] jobs;
   
   CloseVolumes();
   
   r3dOutToLog("== All Compressed: %I64d -> %I64d\n", stat_size, stat_csize);
+  r3dOutToLog("== Compress+write: %.2f sec, writer waited for compression %.2f sec\n", r3dGetTime() - timeStart, stat_stall);
   
   WriteFileList();
   return true;
@@ -685,7 +1210,7 @@ static bool FileEntrySortByVolume(const r3dFS_FileEntry* d1, const r3dFS_FileEnt
 
 float r3dFileSystem::GetArchiveWastedPerc()
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
 
   std::sort(fl_.files_.begin(), fl_.files_.end(), FileEntrySortByVolume);
 
@@ -718,7 +1243,7 @@ float r3dFileSystem::GetArchiveWastedPerc()
 
 bool r3dFileSystem::RebuildArchive(__int64& outTotal, __int64& outCur)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
   r3dOutToLog("r3dFS: rebuilding archive\n"); CLOG_INDENT;
 
   std::sort(fl_.files_.begin(), fl_.files_.end(), FileEntrySortByVolume);
@@ -809,6 +1334,8 @@ bool r3dFileSystem::RelocateFile(r3dFS_FileEntry& fe, int newVolume, DWORD newOf
   // relocate file
   fe.volume = newVolume;
   fe.offset = newOffset;
+  ResetVerified();
+  archiveValidated_ = false;
 
   // and write it
   h = volumeHandles[fe.volume];
@@ -839,6 +1366,11 @@ bool r3dFileSystem::ValidateArchive(bool validateData, __int64& outCheckingTotal
   failOnError_ = false;
   r3dgameVector(r3dSTLString) todelete;
   
+  // validation must always check crc
+  const int prevCrcMode = crcCheckMode_;
+  crcCheckMode_    = CRC_CHECK_ALWAYS;
+  archiveValidated_ = false;
+  
   outCheckingTotal = 0;
   outCheckingSize  = 0;
   for(size_t i=0; i<fl_.files_.size(); i++) 
@@ -887,9 +1419,13 @@ bool r3dFileSystem::ValidateArchive(bool validateData, __int64& outCheckingTotal
 
   CloseVolumes();
 
-  failOnError_ = true;
+  failOnError_   = true;
+  crcCheckMode_  = prevCrcMode;
   
   if(todelete.size() == 0) {
+    // all data was checked, reads can skip crc in CRC_CHECK_VALIDATED mode
+    extern bool g_bExit;
+    archiveValidated_ = validateData && !g_bExit;
     r3dOutToLog("archive Ok\n");
     return true;
   }
@@ -928,7 +1464,7 @@ void r3dFileSystem::DetectVolumeSizes()
 
 bool r3dFileSystem::OpenArchive(const char* baseName)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  r3dFS_WriteLock wrLock;
   if(GetNumFiles() != 0)
     r3dError("r3dFileSystem::Archive already opened");
     
@@ -1,10 +1,48 @@
 #pragma once
 #include "Tsg_stl/HashTable.h"
 #include "Tsg_stl/TString.h"
+#include "Tsg_stl/TStringHashMap.h"
 #include "dbghelp.h"  // for MakeSureDirectoryPathExists
+#include "r3dFSVolumeMap.h"
 
 class r3dFS_FileEntry;
 
+// shared/exclusive guard for archive file list and volume handles.
+// readers (Find, GetFileData) only bump a counter and never block each other,
+// writers must hold g_FileSysCritSection and wait until active readers drain.
+// hand made, because SRWLOCK is not available on XP.
+class r3dFS_RWLock
+{
+  public:
+	enum { WRITER_BIT = 0x40000000, };
+	volatile LONG	state_;		// number of active readers | WRITER_BIT
+	volatile DWORD	writerThread_;
+	int		writerDepth_;
+
+  public:
+	r3dFS_RWLock() : state_(0), writerThread_(0), writerDepth_(0) {}
+
+	bool		LockShared();	// return false if current thread is already a writer
+	void		UnlockShared();
+	void		LockExclusive();// g_FileSysCritSection must be held
+	void		UnlockExclusive();
+};
+extern	r3dFS_RWLock	g_FileSysRWLock;
+
+struct r3dFS_ReadLock
+{
+	bool		locked;
+	r3dFS_ReadLock() { locked = g_FileSysRWLock.LockShared(); }
+	~r3dFS_ReadLock() { if(locked) g_FileSysRWLock.UnlockShared(); }
+};
+
+struct r3dFS_WriteLock
+{
+	r3dCSHolderWithDeviceQueue csHolder;
+	r3dFS_WriteLock();
+	~r3dFS_WriteLock();
+};
+
 class r3dFS_FileList
 {
   public:
@@ -14,14 +52,8 @@ class r3dFS_FileList
 	FileEntriesVec files_;
 	typedef FileEntriesVec::iterator iterator;
 
-	struct NameHashFunc_T
-	{
-		inline int operator () ( const char * szKey )
-		{
-			return r3dHash::MakeHash( szKey );// & ( LENGTH-1 );
-		}
-	};
-	HashTableDynamic<const r3dFS_FileEntry*, FixedString256, NameHashFunc_T, 1024> namesHash_;
+	// lowercased name -> entry
+	r3dTL::TStringHashMap<const r3dFS_FileEntry*> namesHash_;
 	void		AddToNameHash(const r3dFS_FileEntry* fe);
 	void		InitAllNamesHash();
 
@@ -48,17 +80,94 @@ class r3dFS_FileList
 	static const char* GetBuildDate(DWORD buildVersion, char* buf);
 };
 
+// window of persistently mapped volume
+struct r3dFSMapWindow
+{
+	const BYTE*	data;		// NULL if window is not mapped right now
+	__int64		start;
+	size_t		size;
+	void*		mapBase;
+	size_t		mapSize;
+	int		refs;		// number of active views
+	DWORD		lastUse;
+	
+	r3dFSMapWindow() {
+	  data    = NULL;
+	  start   = 0;
+	  size    = 0;
+	  mapBase = NULL;
+	  mapSize = 0;
+	  refs    = 0;
+	  lastUse = 0;
+	}
+};
+
+// zero-copy view into archive data, must be released with r3dFileSystem::ReleaseFileView
+struct r3dFSFileView
+{
+	const BYTE*	data;
+	DWORD		size;
+
+	r3dFSMapWindow*	window_;	// pinned persistent window
+	void*		mapBase_;	// or one-off mapping
+	size_t		mapSize_;
+	HANDLE		hFileMap_;	// for volumes opened for write
+	
+	r3dFSFileView() {
+	  data      = NULL;
+	  size      = 0;
+	  window_   = NULL;
+	  mapBase_  = NULL;
+	  mapSize_  = 0;
+	  hFileMap_ = NULL;
+	}
+};
+
 class r3dFileSystem
 {
   public:
 	char		baseName_[MAX_PATH];	// base name of volume files
 	r3dFS_FileList	fl_;
 	bool		failOnError_;
+
+	// crc validation of data read from archive
+	enum ECrcCheckMode
+	{
+	  CRC_CHECK_ALWAYS = 0,		// on every read
+	  CRC_CHECK_FIRST_READ,		// only on first read of each entry
+	  CRC_CHECK_VALIDATED,		// skip after ValidateArchive(validateData=true) passed, always before that
+	};
+	int		crcCheckMode_;
+	bool		archiveValidated_;
+	void		SetCrcCheckMode(int mode) {
+	  crcCheckMode_ = mode;
+	}
+
+	// entries verified in CRC_CHECK_FIRST_READ mode - lock-free open addressing set of entry pointers.
+	// reset by all operations that can change volume data
+	const r3dFS_FileEntry* volatile* verified_;
+	DWORD		verifiedSize_;
+	volatile LONG	verifiedCount_;
+	bool		 NeedCrcCheck(const r3dFS_FileEntry* fe) const;
+	void		 MarkVerified(const r3dFS_FileEntry* fe);
+	void		 ResetVerified();
 	
 	const static int MAX_VOLUMES = 64;
 	__int64		VOLUME_SIZE;
 	__int64		volumeSizes[MAX_VOLUMES];
 	HANDLE		volumeHandles[MAX_VOLUMES];
+	
+	// persistent read-only mappings, created by OpenVolumesEx(forRead=true) and mapped by windows on demand
+	r3dFSMappedFile	volumeMaps[MAX_VOLUMES];
+	typedef r3dgameVector(r3dFSMapWindow) MapWindowsVec;
+	MapWindowsVec	volumeWindows[MAX_VOLUMES];
+	CRITICAL_SECTION mapCritSection_;	// guards windows state, never held during decompression
+	__int64		mappedBytes_;
+	DWORD		mapUseCounter_;
+	bool		 MapChunk(const r3dFS_FileEntry* fe, r3dFSFileView* out_chunk);
+	void		 UnmapChunk(r3dFSFileView* chunk);
+	void		 EvictWindows(size_t needSize);
+
 	void		ResetVolumes() 
 	{
 	  for(int i=0; i<MAX_VOLUMES; i++) 
@@ -102,7 +211,7 @@ class r3dFileSystem
 
 	void		GetVolumeName(char* fname, int idx) const;
 	
-	bool		BuildNewArchive(const char* baseName);
+	bool		BuildNewArchive(const char* baseName, int numThreads = 1);
 
 	bool		OpenArchive(const char* baseName);
 	void		 DetectVolumeSizes();
@@ -119,7 +228,11 @@ class r3dFileSystem
 	}
 
 	bool		GetFileData(const r3dFS_FileEntry* fe, BYTE** out_data, DWORD* out_size);
-	bool		UncompressFileData(const r3dFS_FileEntry* fe, const BYTE* cdata, DWORD csize, BYTE** out_data, DWORD* out_size);
+	// zero-copy access for COMPRESS_STORE files. return false for compressed files.
+	// views must be released before volumes are closed
+	bool		GetFileView(const r3dFS_FileEntry* fe, r3dFSFileView* out_view);
+	void		ReleaseFileView(r3dFSFileView* view);
+	bool		UncompressFileData(const r3dFS_FileEntry* fe, const BYTE* cdata, DWORD csize, BYTE** out_data, DWORD* out_size, bool checkCrc = true);
 	
 	bool		ExtractFile(const r3dFS_FileEntry* fe, const char* outDir);
 };
@@ -9,53 +9,211 @@ JobChief* g_pJobChief = 0;
 
 namespace
 {
-	unsigned int WINAPI JobChiefThreadFunc( void* );
-	volatile LONG gTimeToExit = false;
+	__declspec(thread) int					tThreadIdx		= -1;
+	__declspec(thread) JobChief::TaskGroup*	tCurrentGroup	= NULL;
 
-	struct JobDesc
+	// set in TaskGroup::mPending when owner thread sleeps in Wait() and must be signaled
+	const LONG WAITER_BIT = 0x40000000;
+
+	JobChief::Task MakeTask( JobChief::TaskGroup* group )
 	{
-		JobChief::ExecFunc	Func ;
-		void*				Data ;
+		JobChief::Task task;
+		memset( &task, 0, sizeof task );
+		task.Group = group;
+		return task;
+	}
+}
+
+//------------------------------------------------------------------------
+
+struct JobChief::Deque
+{
+	enum { CAPACITY = 1024 };	// power of 2
 
-		int					ChunkSize ;
-		int					Left ;
+	volatile LONG	Lock;
+	volatile LONG	Count;
+	LONG			Head;		// oldest task, owner pushes and pops at Head + Count - 1
+	Task			Tasks[ CAPACITY ];
 
-		volatile LONG		InAccess ;
+	char			Pad[ 64 ];	// keep locks of neighbour deques in different cache lines
 
-		JobDesc();
-	} gJobDesc ;
+	void Acquire()
+	{
+		for( ; InterlockedExchange( &Lock, 1 ) ; )
+			YieldProcessor();
+	}
 
-	struct ThreadData
+	void Release()
 	{
-		HANDLE			StartEvent ;
-		volatile LONG	Idle ;
-		HANDLE			IdleEvent;
+		InterlockedExchange( &Lock, 0 );
+	}
+};
 
-		int				ThreadIndex;
+//------------------------------------------------------------------------
 
-		ThreadData()
-		: StartEvent(INVALID_HANDLE_VALUE)
-		, IdleEvent(INVALID_HANDLE_VALUE)
-		, ThreadIndex( 0 )
-		{}
-	};
+JobChief::TaskGroup::TaskGroup()
+: mPending( 0 )
+, mParent( tCurrentGroup )
+, mContFunc( NULL )
+, mContData( NULL )
+, mWaitEvent( NULL )
+{
+
+}
+
+//------------------------------------------------------------------------
+
+JobChief::TaskGroup::~TaskGroup()
+{
+	Wait();
+}
+
+//------------------------------------------------------------------------
+
+void
+JobChief::TaskGroup::Run( TaskFunc func, void* data )
+{
+	JobChief* chief = g_pJobChief;
+	const int threadIdx = chief ? chief->GetCurrentThreadIndex() : -1;
+
+	if( threadIdx < 0 || !chief->IsMultithreaded() )
+	{
+		func( data, R3D_MAX( threadIdx, 0 ) );
+		return;
+	}
+
+	Task task = MakeTask( this );
+	task.Func = func;
+	task.Data = data;
 
-	typedef r3dTL::TArray< ThreadData > ThreadDataVec;
+	InterlockedIncrement( &mPending );
+	chief->Push( threadIdx, task );
+}
+
+//------------------------------------------------------------------------
+
+void
+JobChief::TaskGroup::ParallelFor( ExecFunc func, void* data, size_t itemCount, size_t grain )
+{
+	if( !itemCount )
+		return;
 
-	ThreadDataVec		gThreadDataVec;
+	JobChief* chief = g_pJobChief;
+	const int threadIdx = chief ? chief->GetCurrentThreadIndex() : -1;
+
+	if( threadIdx < 0 || !chief->IsMultithreaded() )
+	{
+		func( data, 0, itemCount, R3D_MAX( threadIdx, 0 ) );
+		return;
+	}
+
+	if( !grain )
+		grain = R3D_MAX( itemCount / ( chief->GetThreadCount() * 8 ), (size_t)1 );
+
+	Task task = MakeTask( this );
+	task.RangeFunc	= func;
+	task.Data		= data;
+	task.Start		= 0;
+	task.Count		= itemCount;
+	task.Grain		= grain;
+
+	InterlockedIncrement( &mPending );
+	chief->Push( threadIdx, task );
+}
+
+//------------------------------------------------------------------------
+
+void
+JobChief::TaskGroup::SetContinuation( TaskFunc func, void* data )
+{
+	JobChief* chief = g_pJobChief;
+	const int threadIdx = chief ? chief->GetCurrentThreadIndex() : -1;
 
-	typedef r3dTL::TArray<HANDLE> IdleHandles;
+	if( threadIdx < 0 || !chief->IsMultithreaded() )
+	{
+		// everything was executed inline already
+		func( data, R3D_MAX( threadIdx, 0 ) );
+		return;
+	}
 
-	IdleHandles			gIdleHandles;
+	r3d_assert( !mContFunc );
 
-	void DoJob( int threadIndex );
+	// hold group while continuation is set, so it is picked by whoever finishes last
+	InterlockedIncrement( &mPending );
+	mContFunc = func;
+	mContData = data;
+	chief->FinishTask( this, threadIdx );
 }
 
+//------------------------------------------------------------------------
+
+void
+JobChief::TaskGroup::Wait()
+{
+	if( !mPending )
+		return;
+
+	JobChief* chief = g_pJobChief;
+	const int threadIdx = chief->GetCurrentThreadIndex();
+	r3d_assert( threadIdx >= 0 );
+
+	for( int idle = 0 ; ; )
+	{
+		const LONG pending = mPending;
+		if( !pending )
+			break;
+
+		// help with tasks of this group and groups nested into it.
+		// foreign tasks are not allowed, they could reenter per thread data of the task we're waiting in
+		Task task;
+		if( chief->Pop( threadIdx, this, &task ) || chief->Steal( threadIdx, this, &task ) )
+		{
+			chief->Execute( threadIdx, task );
+			idle = 0;
+			continue;
+		}
+
+		if( ++ idle < 64 )
+		{
+			YieldProcessor();
+			continue;
+		}
+
+		// remaining tasks are being executed by other threads - sleep till last of them finishes
+		// or one of them pushes a task of this group or a group nested into it (see WakeWaiters)
+		mWaitEvent = chief->mThreadEvents[ threadIdx ];
+		if( InterlockedCompareExchange( &mPending, pending | WAITER_BIT, pending ) != pending )
+			continue;
+
+		InterlockedIncrement( &chief->mNumWaiters );
+
+		// task pushed before waiter bit could be seen is picked up here
+		if( chief->Pop( threadIdx, this, &task ) || chief->Steal( threadIdx, this, &task ) )
+		{
+			InterlockedDecrement( &chief->mNumWaiters );
+			chief->Execute( threadIdx, task );
+			idle = 0;
+			continue;
+		}
+
+		WaitForSingleObject( mWaitEvent, INFINITE );
+
+		InterlockedDecrement( &chief->mNumWaiters );
+	}
+}
 
 //------------------------------------------------------------------------
 
 JobChief::JobChief()
 : mInQueueMode( false )
+, mDeques( NULL )
+, mDequeCount( 0 )
+, mThreadEvents( NULL )
+, mWorkSemaphore( NULL )
+, mNumSleeping( 0 )
+, mNumWaiters( 0 )
+, mNumQueued( 0 )
+, mTimeToExit( 0 )
 {
 }
 
@@ -74,49 +232,35 @@ JobChief::Init()
 	SYSTEM_INFO sysinfo;
 	GetSystemInfo( &sysinfo );
 
-#if 0
-	if( !r_multithreading->GetInt() )
-		sysinfo.dwNumberOfProcessors = 1;
-#endif
-
-
-#if 1
 	mThreadHandles.Resize( sysinfo.dwNumberOfProcessors - 1 );
-#else
-	mThreadHandles.Resize( R3D_MAX( (int)sysinfo.dwNumberOfProcessors - 2, 0 ) );
-#endif
-
-	gThreadDataVec.Resize( mThreadHandles.Count() );
-	gIdleHandles.Resize( mThreadHandles.Count() );
 
-	gTimeToExit = false;
+	mDequeCount = mThreadHandles.Count() + 1;
+	mDeques = game_new Deque[ mDequeCount ];
+	mThreadEvents = game_new HANDLE[ mDequeCount ];
 
-	char EventName[ 128 ] = { 0 };
-
-	DWORD procID = GetCurrentProcessId( );
-
-	for( uint32_t i = 0, e = mThreadHandles.Count(); i < e; i ++ )
+	for( uint32_t i = 0; i < mDequeCount; i ++ )
 	{
-		_snprintf( EventName, sizeof EventName - 1, "WarInc_Start_Multithreading%u,%u", procID, i );
+		mDeques[ i ].Lock = 0;
+		mDeques[ i ].Count = 0;
+		mDeques[ i ].Head = 0;
 
-		ThreadData& td = gThreadDataVec	[ i ];
-
-		td.ThreadIndex				= i + 1;
+		mThreadEvents[ i ] = CreateEvent( NULL, FALSE, FALSE, NULL );
+		r3d_assert( mThreadEvents[ i ] );
+	}
 
-		td.StartEvent				= CreateEvent( NULL, FALSE, FALSE, EventName ) ;
-		td.Idle						= 1 ;
-		
-		_snprintf( EventName, sizeof EventName - 1, "WarInc_Idle_Event%u,%u", procID, i );
-		td.IdleEvent				= CreateEvent( NULL, TRUE, TRUE, EventName ) ;
-		gIdleHandles		[ i ]	= td.IdleEvent;
+	mWorkSemaphore = CreateSemaphore( NULL, 0, 0x7FFFFFFF, NULL );
+	r3d_assert( mWorkSemaphore );
 
-		mThreadHandles		[ i ]	= (HANDLE)_beginthreadex( NULL, 0, JobChiefThreadFunc, &td, 0, NULL ) ;
-        if(mThreadHandles[ i ] == NULL)
-            r3dError("Failed to begin thread");
+	mTimeToExit = 0;
 
+	// calling thread is slot 0
+	tThreadIdx = 0;
 
-		r3d_assert( mThreadHandles[ i ] );
-		r3d_assert( td.StartEvent );
+	for( uint32_t i = 0, e = mThreadHandles.Count(); i < e; i ++ )
+	{
+		mThreadHandles[ i ] = (HANDLE)_beginthreadex( NULL, 0, WorkerThreadFunc, (void*)(size_t)( i + 1 ), 0, NULL ) ;
+		if(mThreadHandles[ i ] == NULL)
+			r3dError("Failed to begin thread");
 	}
 }
 
@@ -125,27 +269,36 @@ JobChief::Init()
 void
 JobChief::Close()
 {
-	InterlockedExchange( &gTimeToExit, 1 );
+	InterlockedExchange( &mTimeToExit, 1 );
 
-	FireThreads();
+	if( mThreadHandles.Count() )
+	{
+		ReleaseSemaphore( mWorkSemaphore, mThreadHandles.Count(), NULL );
+		WaitForMultipleObjects( mThreadHandles.Count(), &mThreadHandles[ 0 ], TRUE, INFINITE );
+	}
 
 	for( uint32_t i = 0, e = mThreadHandles.Count(); i < e; i ++ )
 	{
-		DWORD exitCode ( 0 ) ;
-
-		for( ; !GetExitCodeThread( mThreadHandles[ i ], &exitCode ); )
-		{
-			Sleep( 0 );
-		}
-		
 		CloseHandle( mThreadHandles[ i ] );
 	}
+	mThreadHandles.Clear();
 
-	for( uint32_t i = 0, e = gThreadDataVec.Count(); i < e; i ++ )
+	for( uint32_t i = 0; i < mDequeCount; i ++ )
 	{
-		CloseHandle( gThreadDataVec[ i ].StartEvent );
-		CloseHandle( gThreadDataVec[ i ].IdleEvent );
+		r3d_assert( !mDeques[ i ].Count );
+		CloseHandle( mThreadEvents[ i ] );
 	}
+
+	CloseHandle( mWorkSemaphore );
+	mWorkSemaphore = NULL;
+
+	delete [] mDeques;
+	delete [] mThreadEvents;
+	mDeques = NULL;
+	mThreadEvents = NULL;
+	mDequeCount = 0;
+
+	tThreadIdx = -1;
 }
 
 //------------------------------------------------------------------------
@@ -154,162 +307,692 @@ void
 JobChief::Exec( ExecFunc func, void* data, size_t itemCount )
 {
 	R3DPROFILE_FUNCTION("JobChief::Exec");
-	uint32_t coreCount = mThreadHandles.Count() + 1 ;
-	uint32_t perCore = itemCount / coreCount ;
 
-	gJobDesc.Func		= func;
-	gJobDesc.Data		= data;
-	gJobDesc.Left		= itemCount;
+	if( !itemCount )
+		return;
 
-	int use_multithreading = r_multithreading->GetInt() && gThreadDataVec.Count();
+	const int threadIdx = GetCurrentThreadIndex();
+	if( threadIdx < 0 || !IsMultithreaded() )
+	{
+		func( data, 0, itemCount, R3D_MAX( threadIdx, 0 ) );
+		return;
+	}
 
-	if( use_multithreading )
+	TaskGroup group;
+	group.ParallelFor( func, data, itemCount );
+
+	R3DPROFILE_START("JobChief::Exec Wait for result");
+	group.Wait();
+	R3DPROFILE_END("JobChief::Exec Wait for result");
+}
+
+//------------------------------------------------------------------------
+
+void
+JobChief::BeginQueueMode()
+{
+	r3d_assert( !mInQueueMode );
+	mInQueueMode = true ;
+}
+
+//------------------------------------------------------------------------
+
+void
+JobChief::EndQueueMode()
+{
+	r3d_assert( mInQueueMode );
+	mInQueueMode = false ;
+}
+
+//------------------------------------------------------------------------
+
+uint32_t
+JobChief::GetThreadCount() const
+{
+	return mThreadHandles.Count() + 1;
+}
+
+//------------------------------------------------------------------------
+
+bool
+JobChief::IsMultithreaded() const
+{
+	return mDequeCount > 1 && r_multithreading->GetInt();
+}
+
+//------------------------------------------------------------------------
+
+int
+JobChief::GetCurrentThreadIndex() const
+{
+	return tThreadIdx;
+}
+
+//------------------------------------------------------------------------
+
+void
+JobChief::Push( int threadIdx, const Task& task )
+{
+	Deque& dq = mDeques[ threadIdx ];
+
+	dq.Acquire();
+	if( dq.Count == Deque::CAPACITY )
 	{
-		gJobDesc.ChunkSize	= R3D_MAX( (int)itemCount / 32, 1 );
-		FireThreads();
+		dq.Release();
+
+		// too deep, just do it now
+		Task copy = task;
+		Execute( threadIdx, copy );
+		return;
 	}
-	else
+
+	dq.Tasks[ ( dq.Head + dq.Count ) & ( Deque::CAPACITY - 1 ) ] = task;
+	dq.Count ++;
+	dq.Release();
+
+	// full barrier - task is visible before waiters are checked, pairs with one in TaskGroup::Wait
+	InterlockedIncrement( &mNumQueued );
+
+	if( mNumWaiters )
+		WakeWaiters( task.Group );
+
+	if( mNumSleeping )
+		ReleaseSemaphore( mWorkSemaphore, 1, NULL );
+}
+
+//------------------------------------------------------------------------
+
+bool
+JobChief::Pop( int threadIdx, TaskGroup* filter, Task* out )
+{
+	Deque& dq = mDeques[ threadIdx ];
+	if( !dq.Count )
+		return false;
+
+	bool res = false;
+
+	dq.Acquire();
+	if( dq.Count )
 	{
-		gJobDesc.ChunkSize = itemCount ;
+		const Task& top = dq.Tasks[ ( dq.Head + dq.Count - 1 ) & ( Deque::CAPACITY - 1 ) ];
+
+		if( IsGroupAllowed( top.Group, filter ) )
+		{
+			*out = top;
+			dq.Count --;
+			res = true;
+		}
 	}
+	dq.Release();
 
-	DoJob( 0 );
+	if( res )
+		InterlockedDecrement( &mNumQueued );
 
-	R3DPROFILE_START("JobChief::Exec Wait for result");
-	if( use_multithreading )
+	return res;
+}
+
+//------------------------------------------------------------------------
+
+bool
+JobChief::Steal( int threadIdx, TaskGroup* filter, Task* out )
+{
+	if( !mNumQueued )
+		return false;
+
+	for( uint32_t i = 1; i < mDequeCount; i ++ )
 	{
-		if (d_job_chief_idle_events->GetBool())
+		Deque& dq = mDeques[ ( threadIdx + i ) % mDequeCount ];
+		if( !dq.Count )
+			continue;
+
+		bool res = false;
+
+		dq.Acquire();
+		// oldest tasks are the biggest ones. When the oldest belongs to a foreign group
+		// the victim is skipped - its owner or a free worker gets to it
+		if( dq.Count && IsGroupAllowed( dq.Tasks[ dq.Head ].Group, filter ) )
 		{
-			WaitForMultipleObjects(gIdleHandles.Count(), &gIdleHandles[0], TRUE, INFINITE);
+			*out = dq.Tasks[ dq.Head ];
+			dq.Head = ( dq.Head + 1 ) & ( Deque::CAPACITY - 1 );
+			dq.Count --;
+			res = true;
 		}
-		else
+		dq.Release();
+
+		if( res )
 		{
-			bool notAllDone = true ;
+			InterlockedDecrement( &mNumQueued );
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//------------------------------------------------------------------------
+
+void
+JobChief::Execute( int threadIdx, Task& task )
+{
+	TaskGroup* prevGroup = tCurrentGroup;
+	tCurrentGroup = task.Group;
 
-			for( ; notAllDone ; )
+	if( task.Func )
+	{
+		task.Func( task.Data, threadIdx );
+	}
+	else
+	{
+		// lazy binary splitting: give half of the range away when nobody took our previous half
+		size_t start	= task.Start;
+		size_t end		= task.Start + task.Count;
+
+		while( end - start > task.Grain )
+		{
+			if( !mDeques[ threadIdx ].Count )
 			{
-				notAllDone = false ;
-
-				for( uint32_t i = 0, e = gThreadDataVec.Count(); i < e; i ++ )
-				{
-					if( !gThreadDataVec[ i ].Idle )
-					{
-						notAllDone = true ;
-						break ;
-					}
-				}
+				const size_t mid = start + ( end - start ) / 2;
+
+				Task half = task;
+				half.Start	= mid;
+				half.Count	= end - mid;
+
+				InterlockedIncrement( &task.Group->mPending );
+				Push( threadIdx, half );
+
+				end = mid;
+				continue;
 			}
+
+			task.RangeFunc( task.Data, start, task.Grain, threadIdx );
+			start += task.Grain;
 		}
+
+		if( end > start )
+			task.RangeFunc( task.Data, start, end - start, threadIdx );
 	}
-	R3DPROFILE_END("JobChief::Exec Wait for result");
+
+	tCurrentGroup = prevGroup;
+
+	FinishTask( task.Group, threadIdx );
 }
 
 //------------------------------------------------------------------------
 
 void
-JobChief::BeginQueueMode()
+JobChief::FinishTask( TaskGroup* group, int threadIdx )
 {
-	r3d_assert( !mInQueueMode );
-	mInQueueMode = true ;
+	for( ; ; )
+	{
+		const LONG pending = group->mPending;
+		const LONG count = pending & ~WAITER_BIT;
+		r3d_assert( count > 0 );
+
+		if( count == 1 && group->mContFunc )
+		{
+			// we are the last one - continuation takes over our reference
+			Task task = MakeTask( group );
+			task.Func = group->mContFunc;
+			task.Data = group->mContData;
+			group->mContFunc = NULL;
+			group->mContData = NULL;
+
+			Push( threadIdx, task );
+			return;
+		}
+
+		// read event before group can be released by waiter
+		HANDLE waitEvent = ( pending & WAITER_BIT ) ? group->mWaitEvent : NULL;
+
+		const LONG newPending = count == 1 ? 0 : pending - 1;
+		if( InterlockedCompareExchange( &group->mPending, newPending, pending ) != pending )
+			continue;
+
+		// group must not be touched from here
+		if( !newPending && waitEvent )
+			SetEvent( waitEvent );
+
+		return;
+	}
 }
 
 //------------------------------------------------------------------------
 
-void
-JobChief::EndQueueMode()
+/*static*/
+unsigned int WINAPI
+JobChief::WorkerThreadFunc( void* Par )
 {
-	r3d_assert( mInQueueMode );
-	mInQueueMode = false ;
+	r3dThreadAutoInstallCrashHelper crashHelper;
+	r3dRandInitInTread rand_in_thread;
+
+#if !DISABLE_PROFILER
+	char name[ 32 ];
+	sprintf_s( name, sizeof name, "JobChief %d", (int)(size_t)Par );
+	r3dProfilerTimeline::SetThreadName( name );
+#endif
+
+	g_pJobChief->WorkerLoop( (int)(size_t)Par );
+	return 0;
 }
 
 //------------------------------------------------------------------------
 
 void
-JobChief::FireThreads()
+JobChief::WorkerLoop( int threadIdx )
 {
-	R3DPROFILE_FUNCTION("JobChief::FireThreads");
-	for( uint32_t i = 0, e = gThreadDataVec.Count(); i < e; i ++ )
+	tThreadIdx = threadIdx;
+
+	for( ; !mTimeToExit ; )
 	{
-		ThreadData& td = gThreadDataVec[ i ] ;
-		r3d_assert( td.Idle );
+		Task task;
+		if( Pop( threadIdx, NULL, &task ) || Steal( threadIdx, NULL, &task ) )
+		{
+			Execute( threadIdx, task );
+			continue;
+		}
+
+		// spin a bit - parallel-for halves appear in bursts
+		bool hasWork = false;
+		for( int i = 0; i < 256 && !hasWork; i ++ )
+		{
+			YieldProcessor();
+			hasWork = mNumQueued != 0;
+		}
 
-		td.Idle = 0 ;
-		ResetEvent(td.IdleEvent);
+		if( hasWork )
+			continue;
 
-		SetEvent( td.StartEvent );
+		InterlockedIncrement( &mNumSleeping );
+		if( !mNumQueued && !mTimeToExit )
+		{
+			WaitForSingleObject( mWorkSemaphore, INFINITE );
+		}
+		InterlockedDecrement( &mNumSleeping );
 	}
+
+	tThreadIdx = -1;
 }
 
 //------------------------------------------------------------------------
 
-uint32_t
-JobChief::GetThreadCount() const
+// groups up the chain stay alive while task of a nested group exists - each of them
+// has a pending task which is waiting on the group below it
+void
+JobChief::WakeWaiters( TaskGroup* group )
 {
-	return mThreadHandles.Count() + 1;
+	for( ; group ; group = group->mParent )
+	{
+		if( group->mPending & WAITER_BIT )
+			SetEvent( group->mWaitEvent );
+	}
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+bool
+JobChief::IsGroupAllowed( const TaskGroup* group, const TaskGroup* filter )
+{
+	if( !filter )
+		return true;
+
+	for( ; group ; group = group->mParent )
+	{
+		if( group == filter )
+			return true;
+	}
+
+	return false;
 }
 
 //------------------------------------------------------------------------
 
 namespace
 {
-	unsigned int WINAPI JobChiefThreadFunc( void* Par)
+	struct BenchItem
 	{
-		r3dThreadAutoInstallCrashHelper crashHelper;
-		ThreadData* data = (ThreadData*)Par ;
-		HANDLE StartHandle = data->StartEvent ;
+		float	Value;
+		int		Cost;
+	};
 
-		r3dRandInitInTread rand_in_thread;
+	void BenchWork( void* data, size_t itemStart, size_t itemCount, size_t threadIndex )
+	{
+		BenchItem* items = (BenchItem*)data;
 
-		for( ;!gTimeToExit; )
+		for( size_t i = itemStart, e = itemStart + itemCount; i < e; i ++ )
 		{
-			if( !r_multithreading->GetInt() )
-				Sleep( 1 );
-			else
-			{
-				WaitForSingleObject( StartHandle, INFINITE );
-				DoJob( data->ThreadIndex );
-				data->Idle = 1 ;
-				SetEvent(data->IdleEvent);
-			}
+			float v = items[ i ].Value;
+			for( int k = 0, ke = items[ i ].Cost; k < ke; k ++ )
+				v = sqrtf( v * 1.0001f + 1.f );
+
+			items[ i ].Value = v;
 		}
+	}
 
-		return 0;
+	struct BenchNested
+	{
+		BenchItem*	Items;
+		size_t		InnerCount;
+	};
+
+	void BenchNestedWork( void* data, size_t itemStart, size_t itemCount, size_t threadIndex )
+	{
+		BenchNested* nested = (BenchNested*)data;
+
+		for( size_t i = itemStart, e = itemStart + itemCount; i < e; i ++ )
+		{
+			g_pJobChief->Exec( BenchWork, nested->Items + i * nested->InnerCount, nested->InnerCount );
+		}
+	}
+
+	// old scheduler does not support nesting - inner ranges run serially inside of the job
+	void BenchNestedSerialWork( void* data, size_t itemStart, size_t itemCount, size_t threadIndex )
+	{
+		BenchNested* nested = (BenchNested*)data;
+
+		for( size_t i = itemStart, e = itemStart + itemCount; i < e; i ++ )
+		{
+			BenchWork( nested->Items + i * nested->InnerCount, 0, nested->InnerCount, threadIndex );
+		}
+	}
+
+	void FillBenchItems( BenchItem* items, size_t count, int cost, int heavyEvery, int heavyCost )
+	{
+		for( size_t i = 0; i < count; i ++ )
+		{
+			items[ i ].Value	= (float)i;
+			items[ i ].Cost		= heavyEvery && !( i % heavyEvery ) ? heavyCost : cost;
+		}
 	}
 
 	//------------------------------------------------------------------------
+	// Single job slot scheduler JobChief used before task groups, kept as the
+	// reference for jobbench: one global range split into itemCount / 32 chunks,
+	// every Exec fires all threads and waits for all of them to go idle.
+
+	class LegacyJobChief
+	{
+	public:
+		LegacyJobChief();
+
+		void Init( uint32_t threadCount );
+		void Close();
+
+		void Exec( JobChief::ExecFunc func, void* data, size_t itemCount );
+
+	private:
+		struct ThreadData
+		{
+			LegacyJobChief*	Chief;
+			HANDLE			StartEvent;
+			HANDLE			IdleEvent;
+			int				ThreadIndex;
+		};
+
+		static unsigned int WINAPI ThreadFunc( void* par );
+
+		void DoJob( int threadIndex );
+
+		JobChief::ThreadHandles		mThreadHandles;
+		r3dTL::TArray< ThreadData >	mThreadData;
+
+		JobChief::ExecFunc	mFunc;
+		void*				mData;
+		int					mChunkSize;
+		int					mLeft;
+		volatile LONG		mInAccess;
+		volatile LONG		mTimeToExit;
+	};
+
+	LegacyJobChief::LegacyJobChief()
+	: mFunc( NULL )
+	, mData( NULL )
+	, mChunkSize( 0 )
+	, mLeft( 0 )
+	, mInAccess( 0 )
+	, mTimeToExit( 0 )
+	{
+
+	}
+
+	void LegacyJobChief::Init( uint32_t threadCount )
+	{
+		mThreadHandles.Resize( threadCount - 1 );
+		mThreadData.Resize( mThreadHandles.Count() );
+
+		mTimeToExit = 0;
 
-	void DoJob( int threadIndex )
+		for( uint32_t i = 0, e = mThreadHandles.Count(); i < e; i ++ )
+		{
+			ThreadData& td = mThreadData[ i ];
+
+			td.Chief		= this;
+			td.ThreadIndex	= i + 1;
+			td.StartEvent	= CreateEvent( NULL, FALSE, FALSE, NULL );
+			td.IdleEvent	= CreateEvent( NULL, FALSE, FALSE, NULL );
+
+			r3d_assert( td.StartEvent && td.IdleEvent );
+
+			mThreadHandles[ i ] = (HANDLE)_beginthreadex( NULL, 0, ThreadFunc, &td, 0, NULL ) ;
+			if( mThreadHandles[ i ] == NULL )
+				r3dError( "Failed to begin thread" );
+		}
+	}
+
+	void LegacyJobChief::Close()
+	{
+		InterlockedExchange( &mTimeToExit, 1 );
+
+		for( uint32_t i = 0, e = mThreadData.Count(); i < e; i ++ )
+		{
+			SetEvent( mThreadData[ i ].StartEvent );
+		}
+
+		if( mThreadHandles.Count() )
+		{
+			WaitForMultipleObjects( mThreadHandles.Count(), &mThreadHandles[ 0 ], TRUE, INFINITE );
+		}
+
+		for( uint32_t i = 0, e = mThreadHandles.Count(); i < e; i ++ )
+		{
+			CloseHandle( mThreadHandles[ i ] );
+			CloseHandle( mThreadData[ i ].StartEvent );
+			CloseHandle( mThreadData[ i ].IdleEvent );
+		}
+
+		mThreadHandles.Clear();
+		mThreadData.Clear();
+	}
+
+	void LegacyJobChief::Exec( JobChief::ExecFunc func, void* data, size_t itemCount )
+	{
+		mFunc	= func;
+		mData	= data;
+		mLeft	= (int)itemCount;
+
+		bool multithreaded = r_multithreading->GetInt() && mThreadData.Count();
+
+		if( multithreaded )
+		{
+			mChunkSize = R3D_MAX( (int)itemCount / 32, 1 );
+
+			for( uint32_t i = 0, e = mThreadData.Count(); i < e; i ++ )
+			{
+				SetEvent( mThreadData[ i ].StartEvent );
+			}
+		}
+		else
+		{
+			mChunkSize = (int)itemCount;
+		}
+
+		DoJob( 0 );
+
+		if( multithreaded )
+		{
+			for( uint32_t i = 0, e = mThreadData.Count(); i < e; i ++ )
+			{
+				WaitForSingleObject( mThreadData[ i ].IdleEvent, INFINITE );
+			}
+		}
+	}
+
+	unsigned int WINAPI LegacyJobChief::ThreadFunc( void* par )
 	{
+		ThreadData* td = (ThreadData*)par;
+
 		for( ; ; )
 		{
-			for( ; InterlockedExchange( &gJobDesc.InAccess, 1 ) == 1 ; ) ;
+			WaitForSingleObject( td->StartEvent, INFINITE );
 
-			int newLeft = R3D_MAX( gJobDesc.Left - gJobDesc.ChunkSize, 0 );
+			if( td->Chief->mTimeToExit )
+				break;
 
-			int count = gJobDesc.Left - newLeft ;
+			td->Chief->DoJob( td->ThreadIndex );
+			SetEvent( td->IdleEvent );
+		}
 
-			gJobDesc.Left = newLeft ;
+		return 0;
+	}
 
-			gJobDesc.InAccess = 0 ;
+	void LegacyJobChief::DoJob( int threadIndex )
+	{
+		for( ; ; )
+		{
+			for( ; InterlockedExchange( &mInAccess, 1 ) == 1 ; ) ;
+
+			int newLeft = R3D_MAX( mLeft - mChunkSize, 0 );
+			int count = mLeft - newLeft ;
+
+			mLeft = newLeft ;
+
+			InterlockedExchange( &mInAccess, 0 );
 
 			if( !count )
 				break ;
 
-			gJobDesc.Func( gJobDesc.Data, (size_t)newLeft, count, threadIndex );
+			mFunc( mData, (size_t)newLeft, count, threadIndex );
 		}
 	}
+}
 
-	//------------------------------------------------------------------------
+//------------------------------------------------------------------------
+
+// compares serial execution, the old single slot Exec (LegacyJobChief) and JobChief
+// on uniform, irregular, nested and zombie update like loads
+void JobChiefBenchmark()
+{
+	r3d_assert( g_pJobChief );
+
+	const size_t COUNT = 64 * 1024;
+	const int PASSES = 8;
+
+	BenchItem* items = game_new BenchItem[ COUNT ];
+
+	LegacyJobChief legacy;
+	legacy.Init( g_pJobChief->GetThreadCount() );
+
+	r3dOutToLog( "JobChief benchmark: %d threads, times per pass\n", g_pJobChief->GetThreadCount() );
+	CLOG_INDENT;
 
-	JobDesc::JobDesc()
-	: Func		( NULL )
-	, Data		( NULL )
-	, ChunkSize	( 0 )
-	, Left		( 0 )
-	, InAccess	( 0 )
+	// uniform items
 	{
+		FillBenchItems( items, COUNT, 64, 0, 0 );
+		float t0 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			BenchWork( items, 0, COUNT, 0 );
 
+		float t1 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			legacy.Exec( BenchWork, items, COUNT );
+
+		float t2 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			g_pJobChief->Exec( BenchWork, items, COUNT );
+
+		float t3 = r3dGetTime();
+		r3dOutToLog( "uniform: serial %.2f ms, old exec %.2f ms, new exec %.2f ms\n", ( t1 - t0 ) * 1000.f / PASSES, ( t2 - t1 ) * 1000.f / PASSES, ( t3 - t2 ) * 1000.f / PASSES );
 	}
-}
 
-//------------------------------------------------------------------------
+	// irregular cost inside of single range
+	{
+		FillBenchItems( items, COUNT, 16, 97, 1024 );
+
+		float t0 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			BenchWork( items, 0, COUNT, 0 );
+
+		float t1 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			legacy.Exec( BenchWork, items, COUNT );
+
+		float t2 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			g_pJobChief->Exec( BenchWork, items, COUNT );
+
+		float t3 = r3dGetTime();
+		r3dOutToLog( "spiky: serial %.2f ms, old exec %.2f ms, new exec %.2f ms\n", ( t1 - t0 ) * 1000.f / PASSES, ( t2 - t1 ) * 1000.f / PASSES, ( t3 - t2 ) * 1000.f / PASSES );
+	}
+
+	// nested parallel for - old scheduler runs inner ranges serially inside of jobs
+	{
+		FillBenchItems( items, COUNT, 32, 0, 0 );
+
+		BenchNested nested;
+		nested.Items		= items;
+		nested.InnerCount	= 1024;
+
+		float t0 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			BenchWork( items, 0, COUNT, 0 );
+
+		float t1 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			legacy.Exec( BenchNestedSerialWork, &nested, COUNT / nested.InnerCount );
+
+		float t2 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			g_pJobChief->Exec( BenchNestedWork, &nested, COUNT / nested.InnerCount );
+
+		float t3 = r3dGetTime();
+		r3dOutToLog( "nested: serial %.2f ms, old exec %.2f ms, new exec %.2f ms\n", ( t1 - t0 ) * 1000.f / PASSES, ( t2 - t1 ) * 1000.f / PASSES, ( t3 - t2 ) * 1000.f / PASSES );
+	}
+
+	// zombie update as in UpdateZombies: ANIMATED_ZOMBIES_COUNT expensive animated zombies
+	// followed by cheap non animated ones. Old path - two execs with a barrier in between,
+	// new path - both sets in one group, animated ones with grain 1
+	{
+		const size_t ANIMATED = 96;
+		const size_t ZOMBIES = 1024;
+
+		FillBenchItems( items, ANIMATED, 8192, 0, 0 );
+		FillBenchItems( items + ANIMATED, ZOMBIES - ANIMATED, 256, 0, 0 );
+
+		float t0 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+			BenchWork( items, 0, ZOMBIES, 0 );
+
+		float t1 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+		{
+			legacy.Exec( BenchWork, items, ANIMATED );
+			legacy.Exec( BenchWork, items + ANIMATED, ZOMBIES - ANIMATED );
+		}
+
+		float t2 = r3dGetTime();
+		for( int p = 0; p < PASSES; p ++ )
+		{
+			JobChief::TaskGroup group;
+			group.ParallelFor( BenchWork, items, ANIMATED, 1 );
+			group.ParallelFor( BenchWork, items + ANIMATED, ZOMBIES - ANIMATED );
+			group.Wait();
+		}
+
+		float t3 = r3dGetTime();
+		r3dOutToLog( "zombies: serial %.2f ms, old two execs %.2f ms, new one group %.2f ms\n", ( t1 - t0 ) * 1000.f / PASSES, ( t2 - t1 ) * 1000.f / PASSES, ( t3 - t2 ) * 1000.f / PASSES );
+	}
+
+	legacy.Close();
+
+	delete [] items;
+}
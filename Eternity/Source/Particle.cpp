@@ -3,6 +3,8 @@
 
 #include "JobChief.h"
 
+#include <emmintrin.h>
+
 #include "Particle_Int.h"
 #include "Particle.h"
 
@@ -629,6 +631,38 @@ r3dParticleTrailData* r3dParticleTrailCache::Acquire(int* out_idx)
 	return &data[idx];
 }
 
+// random motion interpolation curve, MotionRandSmooth shapes it
+static float GetMotionRandLerp( float lerpK, float smooth )
+{
+	if( lerpK > 0.5f ) 
+	{
+		lerpK = powf( ( lerpK - 0.5f ) * 2, smooth ) ;
+		lerpK = ( lerpK + 1.0f ) * 0.5f ;
+	}
+	else
+	{
+		lerpK = powf( ( 0.5f - lerpK ) * 2, smooth ) ;
+		lerpK = ( 1.f - lerpK ) * 0.5f ;
+	}
+
+	return lerpK ;
+}
+
+void r3dParticleOverLifeLUT::Bake( const r3dParticleEmitter& PE )
+{
+	for( int i = 0; i <= NUM_SAMPLES; i ++ )
+	{
+		float t = (float)i / NUM_SAMPLES;
+
+		Values[ i ][ VELOCITY ]		= PE.VelocityOverLife.GetFloatValue( t );
+		Values[ i ][ GRAVITY ]		= PE.GravityOverLife.GetFloatValue( t );
+		Values[ i ][ BIND_GRAVITY ]	= PE.BindGravityOverLife.GetFloatValue( t );
+		Values[ i ][ SIZE ]			= PE.SizeOverLife.GetFloatValue( t );
+
+		MotionRandLerp[ i ]			= GetMotionRandLerp( t, PE.MotionRandSmooth );
+	}
+}
+
 void r3dParticleEmitter::InitDefaults()
 {
 	bInited	= 0;
@@ -721,6 +755,8 @@ void r3dParticleEmitter::InitDefaults()
 	TrailTaleFadePow = 0.33f;
 	TrailDrift = 0.f;
 
+	BakeOverLife();
+
 	return;
 }
 
@@ -827,6 +863,8 @@ void r3dParticleEmitter::Copy(const r3dParticleEmitter* PE, const char* NewName)
 #endif
 		bMeshUseDistortTexture = PE->bMeshUseDistortTexture;
 	}
+
+	BakeOverLife();
 }
 
 
@@ -956,6 +994,7 @@ void r3dParticleEmitter::Load(const char* FName, const char* PartName)
 
 	}
 
+	BakeOverLife();
 }
 
 
@@ -1927,18 +1966,7 @@ void r3dParticleSystem::ProcessParticle(r3dSingleParticle* P, float CurTime)
 	}
 	else
 	{
-		float lerpK = R3D_MIN( ( CurTime - P->LastRandMotionChange ) / PE.MotionRandDelta, 1.f ) ;
-
-		if( lerpK > 0.5f ) 
-		{
-			lerpK = powf( ( lerpK - 0.5f ) * 2, PE.MotionRandSmooth ) ;
-			lerpK = ( lerpK + 1.0f ) * 0.5f ;
-		}
-		else
-		{
-			lerpK = powf( ( 0.5f - lerpK ) * 2, PE.MotionRandSmooth ) ;
-			lerpK = ( 1.f - lerpK ) * 0.5f ;
-		}
+		float lerpK = GetMotionRandLerp( R3D_MIN( ( CurTime - P->LastRandMotionChange ) / PE.MotionRandDelta, 1.f ), PE.MotionRandSmooth ) ;
 
 		P->Position += ( P->MotionRandSrc * ( 1.0f - lerpK ) + P->MotionRandTarg * lerpK ) * TimePassed ;
 	}
@@ -1964,6 +1992,12 @@ void r3dParticleSystem::ProcessParticle(r3dSingleParticle* P, float CurTime)
 
 	P->Position += SourceMoveDelta * PBindGravity;
 
+	FinishParticle(P, PE, prevPos, CurTime);
+}
+
+// trails, slave emitters and the rest of non simulation work, shared by scalar and SIMD update
+void r3dParticleSystem::FinishParticle(r3dSingleParticle* P, const r3dParticleEmitter& PE, const r3dPoint3D& prevPos, float CurTime)
+{
 	// trailidx can be invalid if particle type switched in editor
 	if(PE.ParticleType == R3D_PARTICLE_TRAIL && P->TrailIdx != 0xFFFF) 
 	{
@@ -2073,6 +2107,373 @@ R3D_FORCEINLINE void r3dParticleSystem::GetOverTimeParams(const r3dSingleParticl
 	return;
 }
 
+void r3dParticleSystem::GrowBBox(const r3dSingleParticle& part, const r3dParticleEmitter& PE, float PSize, bool bTrails, r3dPoint3D& bbMin, r3dPoint3D& bbMax)
+{
+	if( bTrails && PE.ParticleType == R3D_PARTICLE_TRAIL )
+	{
+		float hw = PE.RayWidth * 0.5f ;
+
+		float maxSizeCoef = 0.f ;
+
+		if( part.TrailIdx != 0xFFFF )
+		{
+			r3dParticleTrailData* ptd =	partTrailCache->Get( part.TrailIdx ) ;
+
+			for( int i = 0, e = ptd->MaxPos ; i < e; i ++ )
+			{
+				const r3dPoint3D& pos = ptd->PrevPos[ i ] ;
+
+				float sc = ptd->SizeCoefs[ i ] ;
+
+				maxSizeCoef = R3D_MAX( sc, maxSizeCoef ) ;
+
+				bbMin.x = R3D_MIN( bbMin.x, pos.x - hw * sc );
+				bbMin.y = R3D_MIN( bbMin.y, pos.y - hw * sc );
+				bbMin.z = R3D_MIN( bbMin.z, pos.z - hw * sc );
+
+				bbMax.x = R3D_MAX( bbMax.x, pos.x + hw * sc );
+				bbMax.y = R3D_MAX( bbMax.y, pos.y + hw * sc );
+				bbMax.z = R3D_MAX( bbMax.z, pos.z + hw * sc );
+			}
+		}
+
+		bbMin.x = R3D_MIN( bbMin.x, part.Position.x - hw * maxSizeCoef );
+		bbMin.y = R3D_MIN( bbMin.y, part.Position.y - hw * maxSizeCoef );
+		bbMin.z = R3D_MIN( bbMin.z, part.Position.z - hw * maxSizeCoef );
+
+		bbMax.x = R3D_MAX( bbMax.x, part.Position.x + hw * maxSizeCoef );
+		bbMax.y = R3D_MAX( bbMax.y, part.Position.y + hw * maxSizeCoef );
+		bbMax.z = R3D_MAX( bbMax.z, part.Position.z + hw * maxSizeCoef );
+	}
+	else
+	if( PE.ParticleType == R3D_PARTICLE_BEAM ) // special case
+	{
+		const r3dPoint3D& p0 = part.Position ;
+		const r3dPoint3D& p1 = BeamTargetPosition ;
+
+		float rayWidth = PE.RayWidth  ;
+
+		bbMin.x = R3D_MIN(bbMin.x, p0.x - rayWidth );
+		bbMin.y = R3D_MIN(bbMin.y, p0.y - rayWidth );
+		bbMin.z = R3D_MIN(bbMin.z, p0.z - rayWidth );
+		bbMin.x = R3D_MIN(bbMin.x, p1.x - rayWidth );
+		bbMin.y = R3D_MIN(bbMin.y, p1.y - rayWidth );
+		bbMin.z = R3D_MIN(bbMin.z, p1.z - rayWidth );
+
+		bbMax.x = R3D_MAX(bbMax.x, p0.x + rayWidth );
+		bbMax.y = R3D_MAX(bbMax.y, p0.y + rayWidth );
+		bbMax.z = R3D_MAX(bbMax.z, p0.z + rayWidth );
+		bbMax.x = R3D_MAX(bbMax.x, p1.x + rayWidth );
+		bbMax.y = R3D_MAX(bbMax.y, p1.y + rayWidth );
+		bbMax.z = R3D_MAX(bbMax.z, p1.z + rayWidth );
+	}
+	else
+	{
+		bbMin.x = R3D_MIN(bbMin.x, part.Position.x-PSize);
+		bbMin.y = R3D_MIN(bbMin.y, part.Position.y-PSize);
+		bbMin.z = R3D_MIN(bbMin.z, part.Position.z-PSize);
+		bbMax.x = R3D_MAX(bbMax.x, part.Position.x+PSize);
+		bbMax.y = R3D_MAX(bbMax.y, part.Position.y+PSize);
+		bbMax.z = R3D_MAX(bbMax.z, part.Position.z+PSize);
+	}
+}
+
+//------------------------------------------------------------------------
+// SIMD particle update.
+//
+// Particles are gathered from Array into structure of arrays batch, simulated
+// 4 at a time with SSE (over life gradients come from emitter's baked tables),
+// and written back. Random dependent parts (motion random retarget, wind,
+// deflector bounce direction) and trails/slave emitters stay scalar.
+
+struct r3dParticleBatch
+{
+	enum { MAX_PARTICLES = 64 };
+
+	enum Field
+	{
+		BIRTH_TIME,
+		LIFE_TIME,
+		BASE_VELOCITY,
+		BASE_GRAVITY,
+		BASE_SIZE,
+		POS_X, POS_Y, POS_Z,
+		PREV_X, PREV_Y, PREV_Z,
+		DIR_X, DIR_Y, DIR_Z,
+		MOTION_SRC_X, MOTION_SRC_Y, MOTION_SRC_Z,
+		MOTION_TARG_X, MOTION_TARG_Y, MOTION_TARG_Z,
+		MOTION_K,
+		WIND_X, WIND_Y, WIND_Z,
+		TRAVEL,
+
+		// outputs
+		NEW_X, NEW_Y, NEW_Z,
+		VELOCITY,
+		SIZE,
+
+		NUM_FIELDS
+	};
+
+	enum
+	{
+		DEFLECTED_TOP		= 1,
+		DEFLECTED_BOTTOM	= 2
+	};
+
+	__declspec(align(16)) float	F[ NUM_FIELDS ][ MAX_PARTICLES ];
+	__declspec(align(16)) int	Deflected[ MAX_PARTICLES ];
+
+	const float*				LUT[ MAX_PARTICLES ];
+	r3dSingleParticle*			Particles[ MAX_PARTICLES ];
+
+	int							Count;
+};
+
+static void SimulateParticleBatch( r3dParticleBatch& b, float curTime, float dt, const r3dPoint3D& moveDelta, float deflectorTop, float deflectorBottom )
+{
+	typedef r3dParticleBatch PB;
+	typedef r3dParticleOverLifeLUT LUT;
+
+	// pad to multiple of 4 with harmless particles
+	for( int n = b.Count, e = ( b.Count + 3 ) & ~3; n < e; n ++ )
+	{
+		for( int f = 0; f < PB::NUM_FIELDS; f ++ )
+			b.F[ f ][ n ] = 0.f;
+
+		b.F[ PB::BIRTH_TIME ][ n ] = curTime;
+		b.F[ PB::LIFE_TIME ][ n ] = 1.f;
+		b.LUT[ n ] = b.LUT[ 0 ];
+	}
+
+	const __m128 vZero			= _mm_setzero_ps();
+	const __m128 vOne			= _mm_set1_ps( 1.f );
+	const __m128 vCurTime		= _mm_set1_ps( curTime );
+	const __m128 vDt			= _mm_set1_ps( dt );
+	const __m128 vSamples		= _mm_set1_ps( (float)LUT::NUM_SAMPLES );
+	const __m128 vLastSample	= _mm_set1_ps( (float)( LUT::NUM_SAMPLES - 1 ) );
+	const __m128 vTop			= _mm_set1_ps( deflectorTop );
+	const __m128 vTopClamp		= _mm_set1_ps( deflectorTop - 1.f );
+	const __m128 vBottom		= _mm_set1_ps( deflectorBottom );
+	const __m128 vBottomClamp	= _mm_set1_ps( deflectorBottom + 1.f );
+	const __m128 vMoveX			= _mm_set1_ps( moveDelta.x );
+	const __m128 vMoveY			= _mm_set1_ps( moveDelta.y );
+	const __m128 vMoveZ			= _mm_set1_ps( moveDelta.z );
+
+#define PB_LOAD( f )		_mm_load_ps( &b.F[ PB::f ][ n ] )
+#define PB_STORE( f, v )	_mm_store_ps( &b.F[ PB::f ][ n ], v )
+#define PB_SELECT( m, a, c )	_mm_or_ps( _mm_and_ps( m, a ), _mm_andnot_ps( m, c ) )
+
+	for( int n = 0; n < b.Count; n += 4 )
+	{
+		// over life tables - sample index and lerp factor per lane
+		__m128 t = _mm_div_ps( _mm_sub_ps( vCurTime, PB_LOAD( BIRTH_TIME ) ), PB_LOAD( LIFE_TIME ) );
+		__m128 x = _mm_mul_ps( _mm_min_ps( _mm_max_ps( t, vZero ), vOne ), vSamples );
+		__m128 fi = _mm_min_ps( _mm_cvtepi32_ps( _mm_cvttps_epi32( x ) ), vLastSample );
+		__m128 frac = _mm_sub_ps( x, fi );
+
+		__declspec(align(16)) int idx[ 4 ];
+		_mm_store_si128( (__m128i*)idx, _mm_cvttps_epi32( fi ) );
+
+		// every lane fetches all channels at once, transpose turns them into channel per register
+		__m128 c[ 4 ];
+		for( int k = 0; k < 4; k ++ )
+		{
+			const float* s = b.LUT[ n + k ] + idx[ k ] * LUT::NUM_CHANNELS;
+			__m128 s0 = _mm_loadu_ps( s );
+			__m128 s1 = _mm_loadu_ps( s + LUT::NUM_CHANNELS );
+			__m128 fk;
+			switch( k )
+			{
+			case 0: fk = _mm_shuffle_ps( frac, frac, _MM_SHUFFLE( 0, 0, 0, 0 ) ); break;
+			case 1: fk = _mm_shuffle_ps( frac, frac, _MM_SHUFFLE( 1, 1, 1, 1 ) ); break;
+			case 2: fk = _mm_shuffle_ps( frac, frac, _MM_SHUFFLE( 2, 2, 2, 2 ) ); break;
+			default: fk = _mm_shuffle_ps( frac, frac, _MM_SHUFFLE( 3, 3, 3, 3 ) ); break;
+			}
+			c[ k ] = _mm_add_ps( s0, _mm_mul_ps( _mm_sub_ps( s1, s0 ), fk ) );
+		}
+
+		_MM_TRANSPOSE4_PS( c[ 0 ], c[ 1 ], c[ 2 ], c[ 3 ] );
+
+		__m128 velocity		= _mm_mul_ps( PB_LOAD( BASE_VELOCITY ), c[ LUT::VELOCITY ] );
+		__m128 gravity		= _mm_mul_ps( PB_LOAD( BASE_GRAVITY ), c[ LUT::GRAVITY ] );
+		__m128 bindGravity	= c[ LUT::BIND_GRAVITY ];
+
+		PB_STORE( VELOCITY, velocity );
+		PB_STORE( SIZE, _mm_mul_ps( PB_LOAD( BASE_SIZE ), c[ LUT::SIZE ] ) );
+
+		__m128 vx = _mm_mul_ps( PB_LOAD( DIR_X ), velocity );
+		__m128 vy = _mm_sub_ps( _mm_mul_ps( PB_LOAD( DIR_Y ), velocity ), gravity );
+		__m128 vz = _mm_mul_ps( PB_LOAD( DIR_Z ), velocity );
+
+		__m128 px = PB_LOAD( POS_X );
+		__m128 py = PB_LOAD( POS_Y );
+		__m128 pz = PB_LOAD( POS_Z );
+
+		// distance covered during previous frame
+		__m128 dx = _mm_sub_ps( px, PB_LOAD( PREV_X ) );
+		__m128 dy = _mm_sub_ps( py, PB_LOAD( PREV_Y ) );
+		__m128 dz = _mm_sub_ps( pz, PB_LOAD( PREV_Z ) );
+		__m128 dist = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) ) );
+		PB_STORE( TRAVEL, _mm_add_ps( PB_LOAD( TRAVEL ), dist ) );
+
+		// velocity, random motion and wind
+		__m128 motionK = PB_LOAD( MOTION_K );
+
+		__m128 mx = PB_LOAD( MOTION_SRC_X );
+		__m128 my = PB_LOAD( MOTION_SRC_Y );
+		__m128 mz = PB_LOAD( MOTION_SRC_Z );
+
+		mx = _mm_add_ps( mx, _mm_mul_ps( _mm_sub_ps( PB_LOAD( MOTION_TARG_X ), mx ), motionK ) );
+		my = _mm_add_ps( my, _mm_mul_ps( _mm_sub_ps( PB_LOAD( MOTION_TARG_Y ), my ), motionK ) );
+		mz = _mm_add_ps( mz, _mm_mul_ps( _mm_sub_ps( PB_LOAD( MOTION_TARG_Z ), mz ), motionK ) );
+
+		vx = _mm_add_ps( _mm_add_ps( vx, mx ), PB_LOAD( WIND_X ) );
+		vy = _mm_add_ps( _mm_add_ps( vy, my ), PB_LOAD( WIND_Y ) );
+		vz = _mm_add_ps( _mm_add_ps( vz, mz ), PB_LOAD( WIND_Z ) );
+
+		__m128 nx = _mm_add_ps( px, _mm_mul_ps( vx, vDt ) );
+		__m128 ny = _mm_add_ps( py, _mm_mul_ps( vy, vDt ) );
+		__m128 nz = _mm_add_ps( pz, _mm_mul_ps( vz, vDt ) );
+
+		// deflectors
+		__m128 above = _mm_cmpgt_ps( ny, vTop );
+		ny = PB_SELECT( above, vTopClamp, ny );
+
+		__m128 below = _mm_cmplt_ps( ny, vBottom );
+		ny = PB_SELECT( below, vBottomClamp, ny );
+
+		int maskAbove = _mm_movemask_ps( above );
+		int maskBelow = _mm_movemask_ps( below );
+		for( int l = 0; l < 4; l ++ )
+		{
+			b.Deflected[ n + l ] = ( ( maskAbove >> l ) & 1 ) * PB::DEFLECTED_TOP | ( ( maskBelow >> l ) & 1 ) * PB::DEFLECTED_BOTTOM;
+		}
+
+		// drag with the system
+		PB_STORE( NEW_X, _mm_add_ps( nx, _mm_mul_ps( vMoveX, bindGravity ) ) );
+		PB_STORE( NEW_Y, _mm_add_ps( ny, _mm_mul_ps( vMoveY, bindGravity ) ) );
+		PB_STORE( NEW_Z, _mm_add_ps( nz, _mm_mul_ps( vMoveZ, bindGravity ) ) );
+	}
+
+#undef PB_SELECT
+#undef PB_STORE
+#undef PB_LOAD
+}
+
+void r3dParticleSystem::ProcessParticlesSIMD(float CurTime, int iLod, r3dPoint3D& bbMin, r3dPoint3D& bbMax)
+{
+	typedef r3dParticleBatch PB;
+
+	PB batch;
+
+	for( int i = 0; i < NumAliveParticles; )
+	{
+		batch.Count = 0;
+
+		// gather, slave emitters may append particles, they are picked up by next batches
+		for( ; i < NumAliveParticles && batch.Count < PB::MAX_PARTICLES; i ++ )
+		{
+			r3dSingleParticle* P = &Array[ i ];
+
+			//lod update only for "unphased" effects
+			if( P->lod + 1 < iLod && PD->WarmUpTime > 0.0f )
+			{
+				const r3dParticleEmitter& PE = *PD->PType[ P->Type ];
+				const float PTime = ( CurTime - P->BirthTime ) / P->LifeTime;
+				GrowBBox( *P, PE, P->BaseSize * PE.OverLifeLUT.Get( r3dParticleOverLifeLUT::SIZE, PTime ), false, bbMin, bbMax );
+				continue;
+			}
+
+			if( !P->Active || !PD->PType[ P->Type ] )
+				continue;
+
+			const r3dParticleEmitter& PE = *PD->PType[ P->Type ];
+
+			r3d_assert( ( CurTime - P->BirthTime ) / P->LifeTime < 2.0f );
+
+			if( CurTime - P->LastRandMotionChange > PE.MotionRandDelta )
+			{
+				P->MotionRandSrc	= P->MotionRandTarg ;
+				P->MotionRandTarg	= GetVectorVariation( r3dPoint3D(0,0,0), PE.MotionRand ) ;
+
+				P->LastRandMotionChange = CurTime ;
+			}
+
+			float motionK = 1.f;
+			if( PE.MotionRandDelta >= 0.0001f )
+			{
+				motionK = PE.OverLifeLUT.GetMotionRandLerp( ( CurTime - P->LastRandMotionChange ) / PE.MotionRandDelta );
+			}
+
+			r3dVector wind( 0, 0, 0 );
+			if( P_WindPower )
+			{
+				wind = P_WindDirection * ( P_WindPower * u_GetRandom( 0.0f, 1.0f ) );
+			}
+
+			int n = batch.Count ++;
+
+			batch.Particles[ n ]	= P;
+			batch.LUT[ n ]			= PE.OverLifeLUT.Values[ 0 ];
+
+			batch.F[ PB::BIRTH_TIME ][ n ]		= P->BirthTime;
+			batch.F[ PB::LIFE_TIME ][ n ]		= P->LifeTime;
+			batch.F[ PB::BASE_VELOCITY ][ n ]	= P->BaseVelocity;
+			batch.F[ PB::BASE_GRAVITY ][ n ]	= P->BaseGravity;
+			batch.F[ PB::BASE_SIZE ][ n ]		= P->BaseSize;
+			batch.F[ PB::POS_X ][ n ]			= P->Position.x;
+			batch.F[ PB::POS_Y ][ n ]			= P->Position.y;
+			batch.F[ PB::POS_Z ][ n ]			= P->Position.z;
+			batch.F[ PB::PREV_X ][ n ]			= P->PrevPosition.x;
+			batch.F[ PB::PREV_Y ][ n ]			= P->PrevPosition.y;
+			batch.F[ PB::PREV_Z ][ n ]			= P->PrevPosition.z;
+			batch.F[ PB::DIR_X ][ n ]			= P->Direction.x;
+			batch.F[ PB::DIR_Y ][ n ]			= P->Direction.y;
+			batch.F[ PB::DIR_Z ][ n ]			= P->Direction.z;
+			batch.F[ PB::MOTION_SRC_X ][ n ]	= P->MotionRandSrc.x;
+			batch.F[ PB::MOTION_SRC_Y ][ n ]	= P->MotionRandSrc.y;
+			batch.F[ PB::MOTION_SRC_Z ][ n ]	= P->MotionRandSrc.z;
+			batch.F[ PB::MOTION_TARG_X ][ n ]	= P->MotionRandTarg.x;
+			batch.F[ PB::MOTION_TARG_Y ][ n ]	= P->MotionRandTarg.y;
+			batch.F[ PB::MOTION_TARG_Z ][ n ]	= P->MotionRandTarg.z;
+			batch.F[ PB::MOTION_K ][ n ]		= motionK;
+			batch.F[ PB::WIND_X ][ n ]			= wind.x;
+			batch.F[ PB::WIND_Y ][ n ]			= wind.y;
+			batch.F[ PB::WIND_Z ][ n ]			= wind.z;
+			batch.F[ PB::TRAVEL ][ n ]			= P->EmitTravelDistance;
+		}
+
+		if( !batch.Count )
+			continue;
+
+		SimulateParticleBatch( batch, CurTime, TimePassed, SourceMoveDelta, DeflectorTop, DeflectorBottom );
+
+		// scatter
+		for( int n = 0, e = batch.Count; n < e; n ++ )
+		{
+			r3dSingleParticle* P = batch.Particles[ n ];
+			const r3dParticleEmitter& PE = *PD->PType[ P->Type ];
+
+			const r3dPoint3D prevPos( batch.F[ PB::PREV_X ][ n ], batch.F[ PB::PREV_Y ][ n ], batch.F[ PB::PREV_Z ][ n ] );
+
+			P->Velocity				= batch.F[ PB::VELOCITY ][ n ];
+			P->EmitTravelDistance	= batch.F[ PB::TRAVEL ][ n ];
+			P->PrevPosition			= P->Position;
+			P->Position				= r3dPoint3D( batch.F[ PB::NEW_X ][ n ], batch.F[ PB::NEW_Y ][ n ], batch.F[ PB::NEW_Z ][ n ] );
+
+			if( batch.Deflected[ n ] & PB::DEFLECTED_TOP )
+				P->Direction.Assign( _RandomFloat(), 0, _RandomFloat() );
+
+			if( batch.Deflected[ n ] & PB::DEFLECTED_BOTTOM )
+				P->Direction.Assign( _RandomFloat(), 0, _RandomFloat() );
+
+			FinishParticle( P, PE, prevPos, CurTime );
+
+			GrowBBox( *P, PE, batch.F[ PB::SIZE ][ n ], true, bbMin, bbMax );
+		}
+	}
+}
+
 void r3dParticleSystem::Update(float CurTime, bool bUpdate)
 {
 	struct HackTimerz
@@ -2233,130 +2634,41 @@ void r3dParticleSystem::Update(float CurTime, bool bUpdate)
 	NumAliveQuads = 0;
 	
 
-	float minx = FLT_MAX, miny=FLT_MAX, minz=FLT_MAX, maxx=-FLT_MAX, maxy=-FLT_MAX, maxz=-FLT_MAX;
+	r3dPoint3D bbMin( FLT_MAX, FLT_MAX, FLT_MAX ), bbMax( -FLT_MAX, -FLT_MAX, -FLT_MAX );
 
-	for(int i=0; i<NumAliveParticles; i++)
+	if( r_particles_simd->GetBool() )
 	{
-		//lod update only for "unphased" effects
-
-		r3dSingleParticle& part = Array[ i ] ;
-
-		if(part.lod+1 < iLod && PD->WarmUpTime>0.0f)
-		{
-			const r3dParticleEmitter& PE = *PD->PType[part.Type];
-			const float PTime = (CurTime - part.BirthTime) / part.LifeTime;
-			float PSize       = part.BaseSize*PE.SizeOverLife.GetFloatValue(PTime); //NOTE: it is calculated here AND in GetOverTimeParams to save 4 bytes
-			if(PE.ParticleType == R3D_PARTICLE_BEAM) // special case
-			{
-				const r3dPoint3D& p0 = part.Position ;
-				const r3dPoint3D& p1 = BeamTargetPosition ;
-
-				float rayWidth = PE.RayWidth  ;
-
-				minx = R3D_MIN(minx, p0.x - rayWidth );
-				miny = R3D_MIN(miny, p0.y - rayWidth );
-				minz = R3D_MIN(minz, p0.z - rayWidth );
-				minx = R3D_MIN(minx, p1.x - rayWidth );
-				miny = R3D_MIN(miny, p1.y - rayWidth );
-				minz = R3D_MIN(minz, p1.z - rayWidth );
-
-				maxx = R3D_MAX(maxx, p0.x + rayWidth );
-				maxy = R3D_MAX(maxy, p0.y + rayWidth );
-				maxz = R3D_MAX(maxz, p0.z + rayWidth );
-				maxx = R3D_MAX(maxx, p1.x + rayWidth );
-				maxy = R3D_MAX(maxy, p1.y + rayWidth );
-				maxz = R3D_MAX(maxz, p1.z + rayWidth );
-			}
-			else
-			{
-				minx = R3D_MIN(minx, part.Position.x-PSize);
-				miny = R3D_MIN(miny, part.Position.y-PSize);
-				minz = R3D_MIN(minz, part.Position.z-PSize);
-				maxx = R3D_MAX(maxx, part.Position.x+PSize);
-				maxy = R3D_MAX(maxy, part.Position.y+PSize);
-				maxz = R3D_MAX(maxz, part.Position.z+PSize);
-			}
-			continue;
-		}
-		if(part.Active && PD->PType[part.Type])
+		ProcessParticlesSIMD( CurTime, iLod, bbMin, bbMax );
+	}
+	else
+	{
+		for(int i=0; i<NumAliveParticles; i++)
 		{
-			ProcessParticle(&part, CurTime);
-			const r3dParticleEmitter& PE = *PD->PType[part.Type];
-			const float PTime = (CurTime - part.BirthTime) / part.LifeTime;
-			float PSize       = part.BaseSize*PE.SizeOverLife.GetFloatValue(PTime); //NOTE: it is calculated here AND in GetOverTimeParams to save 4 bytes
+			//lod update only for "unphased" effects
 
-			if( PE.ParticleType == R3D_PARTICLE_TRAIL )
-			{
-				float hw = PE.RayWidth * 0.5f ;
-
-				float maxSizeCoef = 0.f ;
-
-				if( part.TrailIdx != 0xFFFF )
-				{
-					r3dParticleTrailData* ptd =	partTrailCache->Get( part.TrailIdx ) ;
-
-					for( int i = 0, e = ptd->MaxPos ; i < e; i ++ )
-					{
-						const r3dPoint3D& pos = ptd->PrevPos[ i ] ;
-
-						float sc = ptd->SizeCoefs[ i ] ;
-
-						maxSizeCoef = R3D_MAX( sc, maxSizeCoef ) ;
-
-						minx = R3D_MIN( minx, pos.x - hw * sc );
-						miny = R3D_MIN( miny, pos.y - hw * sc );
-						minz = R3D_MIN( minz, pos.z - hw * sc );
-
-						maxx = R3D_MAX( maxx, pos.x + hw * sc );
-						maxy = R3D_MAX( maxy, pos.y + hw * sc );
-						maxz = R3D_MAX( maxz, pos.z + hw * sc );
-					}
-				}
+			r3dSingleParticle& part = Array[ i ] ;
 
-				minx = R3D_MIN( minx, part.Position.x - hw * maxSizeCoef );
-				miny = R3D_MIN( miny, part.Position.y - hw * maxSizeCoef );
-				minz = R3D_MIN( minz, part.Position.z - hw * maxSizeCoef );
-
-				maxx = R3D_MAX( maxx, part.Position.x + hw * maxSizeCoef );
-				maxy = R3D_MAX( maxy, part.Position.y + hw * maxSizeCoef );
-				maxz = R3D_MAX( maxz, part.Position.z + hw * maxSizeCoef );
+			if(part.lod+1 < iLod && PD->WarmUpTime>0.0f)
+			{
+				const r3dParticleEmitter& PE = *PD->PType[part.Type];
+				const float PTime = (CurTime - part.BirthTime) / part.LifeTime;
+				float PSize       = part.BaseSize*PE.SizeOverLife.GetFloatValue(PTime); //NOTE: it is calculated here AND in GetOverTimeParams to save 4 bytes
+				GrowBBox( part, PE, PSize, false, bbMin, bbMax );
+				continue;
 			}
-			else
+			if(part.Active && PD->PType[part.Type])
 			{
-				if(PE.ParticleType == R3D_PARTICLE_BEAM) // special case
-				{
-					const r3dPoint3D& p0 = part.Position ;
-					const r3dPoint3D& p1 = BeamTargetPosition ;
-
-					float rayWidth = PE.RayWidth  ;
-
-					minx = R3D_MIN(minx, p0.x - rayWidth );
-					miny = R3D_MIN(miny, p0.y - rayWidth );
-					minz = R3D_MIN(minz, p0.z - rayWidth );
-					minx = R3D_MIN(minx, p1.x - rayWidth );
-					miny = R3D_MIN(miny, p1.y - rayWidth );
-					minz = R3D_MIN(minz, p1.z - rayWidth );
-
-					maxx = R3D_MAX(maxx, p0.x + rayWidth );
-					maxy = R3D_MAX(maxy, p0.y + rayWidth );
-					maxz = R3D_MAX(maxz, p0.z + rayWidth );
-					maxx = R3D_MAX(maxx, p1.x + rayWidth );
-					maxy = R3D_MAX(maxy, p1.y + rayWidth );
-					maxz = R3D_MAX(maxz, p1.z + rayWidth );
-				}
-				else
-				{
-					minx = R3D_MIN(minx, part.Position.x-PSize);
-					miny = R3D_MIN(miny, part.Position.y-PSize);
-					minz = R3D_MIN(minz, part.Position.z-PSize);
-					maxx = R3D_MAX(maxx, part.Position.x+PSize);
-					maxy = R3D_MAX(maxy, part.Position.y+PSize);
-					maxz = R3D_MAX(maxz, part.Position.z+PSize);
-				}
+				ProcessParticle(&part, CurTime);
+				const r3dParticleEmitter& PE = *PD->PType[part.Type];
+				const float PTime = (CurTime - part.BirthTime) / part.LifeTime;
+				float PSize       = part.BaseSize*PE.SizeOverLife.GetFloatValue(PTime); //NOTE: it is calculated here AND in GetOverTimeParams to save 4 bytes
+				GrowBBox( part, PE, PSize, true, bbMin, bbMax );
 			}
 		}
 	}
 
+	float minx = bbMin.x, miny = bbMin.y, minz = bbMin.z, maxx = bbMax.x, maxy = bbMax.y, maxz = bbMax.z;
+
 	// not a single particle participated
 	if( minx > maxx )
 	{
@@ -4119,3 +4431,210 @@ void ParticlePShaderId::FillMacros( ShaderMacros& defines )
 	if( shadow_type == 1 ) defines[ 4 ].Definition = "1" ;
 	if( shadow_type == 2 ) defines[ 4 ].Definition = "2" ;
 }
+
+#ifndef FINAL_BUILD
+//------------------------------------------------------------------------
+// Simulates every data\Particles\*.prt at 30 fps with scalar and SIMD
+// update, nothing is drawn. Finished effects are restarted.
+// Then both paths are stepped side by side from the same seed and their
+// particles are compared.
+
+static int ParticleBenchColorDiff( const r3dParticleEmitter& PE, const r3dSingleParticle& a, const r3dSingleParticle& b, float curTime )
+{
+	const float ta = ( curTime - a.BirthTime ) / a.LifeTime;
+	const float tb = ( curTime - b.BirthTime ) / b.LifeTime;
+
+	r3dColor24 ca = PE.ColorOverLife.GetColorValue( ta );
+	r3dColor24 cb = PE.ColorOverLife.GetColorValue( tb );
+
+	int diff = R3D_MAX( R3D_MAX( abs( ca.R - cb.R ), abs( ca.G - cb.G ) ), abs( ca.B - cb.B ) );
+	diff = R3D_MAX( diff, abs( int( PE.OpacityOverLife.GetFloatValue( ta ) ) - int( PE.OpacityOverLife.GetFloatValue( tb ) ) ) );
+
+	return diff;
+}
+
+void r3dParticleSystemBenchmark( float simTime )
+{
+	r3dTL::TArray< r3dString > names;
+
+	WIN32_FIND_DATA ffblk;
+	HANDLE h = FindFirstFile( "data\\Particles\\*.prt", &ffblk );
+	if( h != INVALID_HANDLE_VALUE )
+	{
+		do
+		{
+			names.PushBack( r3dString( "data\\Particles\\" ) + ffblk.cFileName );
+		} while( FindNextFile( h, &ffblk ) != 0 );
+		FindClose( h );
+	}
+
+	if( !names.Count() )
+	{
+		r3dOutToLog( "particlebench: no particle files found\n" );
+		return;
+	}
+
+	extern r3dCamera gCam;
+
+	const float DT = 1.f / 30.f;
+	const int numFrames = R3D_MAX( int( simTime / DT ), 1 );
+	const float baseTime = 1000.f;
+
+	const int prevMode = r_particles_simd->GetInt();
+
+	float modeTime[ 2 ] = { 0.f, 0.f };
+	double modeParticles[ 2 ] = { 0.0, 0.0 };
+
+	for( int mode = 0; mode < 2; mode ++ )
+	{
+		r_particles_simd->SetInt( mode );
+
+		for( int i = 0, e = names.Count(); i < e; i ++ )
+		{
+			r3dParticleSystem* ps = r3dParticleSystemLoad( names[ i ].c_str() );
+			if( !ps )
+				continue;
+
+			ps->Position = gCam;
+			ps->PrevPosition = gCam;
+
+			float t0 = r3dGetTime();
+
+			ps->Restart( baseTime );
+
+			for( int f = 1; f <= numFrames; f ++ )
+			{
+				float time = baseTime + f * DT;
+
+				ps->IsVisible = true;
+				ps->Update( time );
+
+				modeParticles[ mode ] += ps->NumAliveParticles;
+
+				if( !ps->bEmit && !ps->NumAliveParticles )
+					ps->Restart( time );
+			}
+
+			modeTime[ mode ] += r3dGetTime() - t0;
+
+			delete ps;
+		}
+	}
+
+	// scalar and SIMD systems updated in lockstep, seed is reset before each update so both get the same
+	// numbers. Paths draw random numbers in different order, so simulated fields of SIMD particles are
+	// synced back after every frame and the differences are of a single update from identical state.
+
+	const unsigned long SEED = 12345;
+
+	float maxPosDiff = 0.f, maxVelDiff = 0.f;
+	int maxColorDiff = 0;
+	int countMismatches = 0, typeMismatches = 0;
+	double comparedParticles = 0.0;
+
+	for( int i = 0, e = names.Count(); i < e; i ++ )
+	{
+		r3dParticleSystem* ps[ 2 ];
+		ps[ 0 ] = r3dParticleSystemLoad( names[ i ].c_str() );
+		ps[ 1 ] = r3dParticleSystemLoad( names[ i ].c_str() );
+
+		if( !ps[ 0 ] || !ps[ 1 ] )
+		{
+			SAFE_DELETE( ps[ 0 ] );
+			SAFE_DELETE( ps[ 1 ] );
+			continue;
+		}
+
+		for( int mode = 0; mode < 2; mode ++ )
+		{
+			ps[ mode ]->Position = gCam;
+			ps[ mode ]->PrevPosition = gCam;
+
+			u_srand( SEED );
+			ps[ mode ]->Restart( baseTime );
+		}
+
+		for( int f = 1; f <= numFrames; f ++ )
+		{
+			float time = baseTime + f * DT;
+
+			for( int mode = 0; mode < 2; mode ++ )
+			{
+				r_particles_simd->SetInt( mode );
+
+				u_srand( SEED + f );
+				ps[ mode ]->IsVisible = true;
+				ps[ mode ]->Update( time );
+			}
+
+			r3dParticleSystem* ref = ps[ 0 ];
+			r3dParticleSystem* sse = ps[ 1 ];
+
+			if( ref->NumAliveParticles != sse->NumAliveParticles )
+				countMismatches ++;
+
+			for( int p = 0, pe = R3D_MIN( ref->NumAliveParticles, sse->NumAliveParticles ); p < pe; p ++ )
+			{
+				const r3dSingleParticle& a = ref->Array[ p ];
+				r3dSingleParticle& b = sse->Array[ p ];
+
+				if( a.Type != b.Type )
+				{
+					typeMismatches ++;
+					continue;
+				}
+
+				if( !a.Active || !ref->PD->PType[ a.Type ] )
+					continue;
+
+				maxPosDiff = R3D_MAX( maxPosDiff, ( a.Position - b.Position ).Length() );
+				maxVelDiff = R3D_MAX( maxVelDiff, R3D_ABS( a.Velocity - b.Velocity ) );
+				maxColorDiff = R3D_MAX( maxColorDiff, ParticleBenchColorDiff( *ref->PD->PType[ a.Type ], a, b, time ) );
+
+				comparedParticles += 1.0;
+
+				b.Position				= a.Position;
+				b.PrevPosition			= a.PrevPosition;
+				b.Direction				= a.Direction;
+				b.Velocity				= a.Velocity;
+				b.EmitTravelDistance	= a.EmitTravelDistance;
+				b.MotionRandSrc			= a.MotionRandSrc;
+				b.MotionRandTarg		= a.MotionRandTarg;
+				b.LastRandMotionChange	= a.LastRandMotionChange;
+			}
+
+			if( !ref->bEmit && !ref->NumAliveParticles )
+			{
+				for( int mode = 0; mode < 2; mode ++ )
+				{
+					u_srand( SEED + f );
+					ps[ mode ]->Restart( time );
+				}
+			}
+		}
+
+		delete ps[ 0 ];
+		delete ps[ 1 ];
+	}
+
+	r_particles_simd->SetInt( prevMode );
+
+	r3dOutToLog( "particlebench: %d effects, %.1f sec each\n", names.Count(), numFrames * DT );
+	for( int mode = 0; mode < 2; mode ++ )
+	{
+		r3dOutToLog( "  %s: %.1f ms, %.0f particle updates, %.2f Mparticles/s\n",
+						mode ? "simd  " : "scalar",
+						modeTime[ mode ] * 1000.f, modeParticles[ mode ],
+						modeParticles[ mode ] / R3D_MAX( modeTime[ mode ], 0.0001f ) / 1e6 );
+	}
+
+	if( modeTime[ 1 ] > 0.f )
+		r3dOutToLog( "  speedup: %.2fx\n", modeTime[ 0 ] / modeTime[ 1 ] );
+
+	r3dOutToLog( "  scalar vs simd: %.0f particles compared, max position diff %g, max velocity diff %g, max color diff %d\n",
+					comparedParticles, maxPosDiff, maxVelDiff, maxColorDiff );
+
+	if( countMismatches || typeMismatches )
+		r3dOutToLog( "  scalar vs simd: particle count differs in %d frames, type differs for %d particles\n", countMismatches, typeMismatches );
+}
+#endif
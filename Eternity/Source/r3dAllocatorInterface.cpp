@@ -8,6 +8,8 @@
 #include "r3dArenaAllocator.h"
 
 #include "r3dAssert.h"
+#include <process.h>
+#include <algorithm>
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -85,6 +87,121 @@ r3dAllocatorMemoryStats r3dGetAllocatorStats(r3dAllocationTypes t)
 
 //////////////////////////////////////////////////////////////////////////
 
+namespace
+{
+	const int BENCH_SLOTS = 4096;
+
+	struct BenchParams
+	{
+		r3dArenaAllocator *allocator;
+		void * volatile *slots;
+		int numOps;
+		unsigned int seed;
+		HANDLE startEvent;
+	};
+
+	unsigned int WINAPI BenchAllocatorThread(void *param)
+	{
+		BenchParams *bp = reinterpret_cast<BenchParams*>(param);
+		unsigned int rnd = bp->seed;
+
+		WaitForSingleObject(bp->startEvent, INFINITE);
+
+		for (int i = 0; i < bp->numOps; ++i)
+		{
+			rnd ^= rnd << 13;
+			rnd ^= rnd >> 17;
+			rnd ^= rnd << 5;
+
+			//	Take block from random slot, it was allocated by random thread
+			void * volatile *slot = bp->slots + rnd % BENCH_SLOTS;
+			void *mem = InterlockedExchangePointer(slot, 0);
+			if (mem)
+			{
+				bp->allocator->Deallocate(mem, 1);
+				continue;
+			}
+
+			size_t size = 8 + (rnd >> 16) % 1017;
+			mem = bp->allocator->Allocate(size, 1);
+			*reinterpret_cast<char*>(mem) = 0;
+
+			void *prev = InterlockedExchangePointer(slot, mem);
+			if (prev)
+				bp->allocator->Deallocate(prev, 1);
+		}
+
+		return 0;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+r3dAllocatorBenchResult r3dBenchmarkAllocator(int numThreads, int opsPerThread, bool useThreadCaches)
+{
+	static CRITICAL_SECTION benchGuard;
+	static r3dArenaAllocator *benchAllocator = 0;
+	if (!benchAllocator)
+	{
+		InitializeCriticalSection(&benchGuard);
+		void *mem = malloc(sizeof(r3dArenaAllocator));
+		benchAllocator = new (mem) r3dArenaAllocator(&benchGuard);
+	}
+
+	r3dArenaAllocator::EnableThreadCaches(useThreadCaches);
+
+	void * volatile *slots = reinterpret_cast<void * volatile *>(calloc(BENCH_SLOTS, sizeof(void*)));
+	HANDLE startEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	const int MAX_BENCH_THREADS = 64;
+	numThreads = (std::min)((std::max)(numThreads, 1), MAX_BENCH_THREADS);
+
+	BenchParams params[MAX_BENCH_THREADS];
+	HANDLE threads[MAX_BENCH_THREADS];
+
+	for (int i = 0; i < numThreads; ++i)
+	{
+		params[i].allocator = benchAllocator;
+		params[i].slots = slots;
+		params[i].numOps = opsPerThread;
+		params[i].seed = 0x9E3779B9u * (i + 1);
+		params[i].startEvent = startEvent;
+		threads[i] = (HANDLE)_beginthreadex(NULL, 0, BenchAllocatorThread, &params[i], 0, NULL);
+	}
+
+	r3dAllocatorMemoryStats before = benchAllocator->GetMemStats();
+
+	LARGE_INTEGER freq, t0, t1;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+
+	SetEvent(startEvent);
+	WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
+
+	QueryPerformanceCounter(&t1);
+
+	r3dAllocatorMemoryStats after = benchAllocator->GetMemStats();
+
+	for (int i = 0; i < numThreads; ++i)
+		CloseHandle(threads[i]);
+	CloseHandle(startEvent);
+
+	for (int i = 0; i < BENCH_SLOTS; ++i)
+		benchAllocator->Deallocate(slots[i], 1);
+	free((void*)slots);
+
+	r3dArenaAllocator::EnableThreadCaches(true);
+
+	r3dAllocatorBenchResult res;
+	double seconds = double(t1.QuadPart - t0.QuadPart) / double(freq.QuadPart);
+	res.opsPerSecond = seconds > 0 ? double(numThreads) * opsPerThread / seconds : 0;
+	res.numLockAcquires = after.numLockAcquires - before.numLockAcquires;
+	res.numLockContended = after.numLockContended - before.numLockContended;
+	return res;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 //	Pugi xml
 void * r3dPugiAllocateMemory(size_t size)
 {
@@ -465,6 +465,120 @@ const r3dAllocatorMemoryStats & MemoryArena::GetMemStats() const
 	return memStats;
 }
 
+//-------------------------------------------------------------------------
+//	Thread caches
+//-------------------------------------------------------------------------
+
+namespace
+{
+	const int MAX_CACHED_ALLOCATORS = 16;
+
+	/**	Blocks from 16 to 1024 bytes are cached. */
+	const int NUM_CACHED_CLASSES = 7;
+	const size_t MAX_CACHED_BLOCK_SIZE = 16u << (NUM_CACHED_CLASSES - 1);
+
+	/**	Refill dead thread check period. */
+	const int RECLAIM_PERIOD = 256;
+
+	/**	Bit per cache slot, set while slot is owned by live allocator. */
+	volatile LONG gUsedCacheSlots = 0;
+	const LONG ALL_CACHE_SLOTS_USED = (1 << MAX_CACHED_ALLOCATORS) - 1;
+
+	/**	Bumped each time slot gets new owner, so thread caches of destroyed allocator in same slot are not reused. */
+	volatile LONG gCacheSlotGenerations[MAX_CACHED_ALLOCATORS];
+
+	volatile LONG gCacheSlotsExhaustedLogged = 0;
+	volatile bool gThreadCachesEnabled = true;
+
+	struct ThreadCacheRef
+	{
+		r3dArenaThreadCache *cache;
+		LONG generation;
+	};
+
+	__declspec(thread) ThreadCacheRef tThreadCaches[MAX_CACHED_ALLOCATORS];
+
+//////////////////////////////////////////////////////////////////////////
+
+	/**	Grab free cache slot. Return -1 if all slots are taken. */
+	int AcquireCacheSlot(LONG &generation)
+	{
+		for (;;)
+		{
+			LONG used = gUsedCacheSlots;
+			if (used == ALL_CACHE_SLOTS_USED)
+				return -1;
+
+			int slot = 0;
+			while (used & (1 << slot))
+				++slot;
+
+			if (InterlockedCompareExchange(&gUsedCacheSlots, used | (1 << slot), used) == used)
+			{
+				generation = InterlockedIncrement(&gCacheSlotGenerations[slot]);
+				return slot;
+			}
+		}
+	}
+
+//////////////////////////////////////////////////////////////////////////
+
+	void ReleaseCacheSlot(int slot)
+	{
+		for (;;)
+		{
+			LONG used = gUsedCacheSlots;
+			if (InterlockedCompareExchange(&gUsedCacheSlots, used & ~(1 << slot), used) == used)
+				return;
+		}
+	}
+
+//////////////////////////////////////////////////////////////////////////
+
+	/**	Number of blocks moved between arena and thread cache at once. About 8kb, but not too many tiny blocks. */
+	inline int CacheBatchSize(int blockClass)
+	{
+		int batch = 8192 / (16 << blockClass);
+		return (std::min)((std::max)(batch, 4), 64);
+	}
+
+//////////////////////////////////////////////////////////////////////////
+
+	inline int SmallBlockClass(size_t size, size_t alignment)
+	{
+		if (size == 0)
+			size = 1;
+
+		size_t blockSize = (std::max)(alignment, NextPow2(size));
+		       blockSize = (std::max)(blockSize, 16u);
+
+		return uintLog2(blockSize) - 4;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+struct r3dArenaThreadCache
+{
+	struct FreeBlock
+	{
+		FreeBlock *next;
+	};
+
+	FreeBlock *lists[NUM_CACHED_CLASSES];
+	int counts[NUM_CACHED_CLASSES];
+
+	/**	Statistics, written by owner thread only. */
+	size_t cachedBytes;
+	size_t numAllocations;
+	size_t numDeallocations;
+
+	/**	Owner thread, to return blocks of exited threads. */
+	HANDLE thread;
+
+	r3dArenaThreadCache *next;
+};
+
 //-------------------------------------------------------------------------
 //	class r3dArenaAllocator
 //-------------------------------------------------------------------------
@@ -472,8 +586,22 @@ const r3dAllocatorMemoryStats & MemoryArena::GetMemStats() const
 r3dArenaAllocator::r3dArenaAllocator(CRITICAL_SECTION *cs)
 : lastArenaIdx(0)
 , guard(cs)
+, cacheSlot(-1)
+, cacheGeneration(0)
+, threadCaches(0)
+, cacheBlocksIn(0)
+, cacheBlocksOut(0)
+, numRefills(0)
 {
 	::ZeroMemory(arenas, MAX_NUM_ARENAS * sizeof(void*));
+
+#ifndef ENABLE_ADDITIONAL_VALIDATION
+	cacheSlot = AcquireCacheSlot(cacheGeneration);
+
+	//	Allocator is below logging, OutputDebugString doesn't allocate
+	if (cacheSlot < 0 && InterlockedExchange(&gCacheSlotsExhaustedLogged, 1) == 0)
+		OutputDebugStringA("r3dArenaAllocator: all thread cache slots are taken, new allocators work without thread caches\n");
+#endif
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -485,6 +613,42 @@ r3dArenaAllocator::~r3dArenaAllocator()
 		MemoryArena *ma = arenas[i];
 		free(ma);
 	}
+
+	while (threadCaches)
+	{
+		r3dArenaThreadCache *tc = threadCaches;
+		threadCaches = tc->next;
+		if (tc->thread)
+			CloseHandle(tc->thread);
+		free(tc);
+	}
+
+	//	Other threads still point to freed caches in this slot, generation check makes them create new ones
+	if (cacheSlot >= 0)
+		ReleaseCacheSlot(cacheSlot);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void r3dArenaAllocator::Lock()
+{
+#ifndef FINAL_BUILD
+	if (!TryEnterCriticalSection(guard))
+	{
+		EnterCriticalSection(guard);
+		memStats.numLockContended++;
+	}
+	memStats.numLockAcquires++;
+#else
+	EnterCriticalSection(guard);
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void r3dArenaAllocator::Unlock()
+{
+	LeaveCriticalSection(guard);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -493,34 +657,30 @@ MemoryArena * r3dArenaAllocator::CreateNewArena()
 {
 	void *mem = malloc(sizeof(MemoryArena));
 	MemoryArena *ma = new (mem) MemoryArena;
-	arenas[lastArenaIdx++] = ma;
+	arenas[lastArenaIdx] = ma;
+
+	//	Publish arena for lock free FindArena
+	InterlockedIncrement(&lastArenaIdx);
 	return ma;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void * r3dArenaAllocator::Allocate(size_t size, size_t alignment)
+MemoryArena * r3dArenaAllocator::FindArena(const void *ptr) const
 {
-	CSHolder cs(guard);
-
-#ifdef ENABLE_ADDITIONAL_VALIDATION
-	size += sizeof(size_t); // for guard block
-#endif
-
-	//	Handle big requests separately
-	if (size > PAGE_SIZE)
+	for (int i = lastArenaIdx - 1; i >= 0; --i)
 	{
-		void *mem = _aligned_malloc(size, alignment);
-#ifndef FINAL_BUILD
-		if (mem)
-		{
-			memStats.numAllocations++;
-			memStats.totalAllocatedMemory += _aligned_msize(mem, alignment, 0);;
-		}
-#endif
-		return mem;
+		MemoryArena *ma = arenas[i];
+		if (ma->Contains(ptr))
+			return ma;
 	}
+	return 0;
+}
 
+//////////////////////////////////////////////////////////////////////////
+
+void * r3dArenaAllocator::AllocateFromArenas(size_t size, size_t alignment)
+{
 	//	Search for arena than can handle request
 	for (int i = lastArenaIdx - 1; i >= 0; --i)
 	{
@@ -544,22 +704,230 @@ void * r3dArenaAllocator::Allocate(size_t size, size_t alignment)
 
 //////////////////////////////////////////////////////////////////////////
 
+r3dArenaThreadCache * r3dArenaAllocator::GetThreadCache()
+{
+	ThreadCacheRef &ref = tThreadCaches[cacheSlot];
+	if (ref.cache && ref.generation == cacheGeneration)
+		return ref.cache;
+
+	r3dArenaThreadCache *tc = reinterpret_cast<r3dArenaThreadCache*>(malloc(sizeof(r3dArenaThreadCache)));
+	if (!tc)
+		return 0;
+
+	ZeroMemory(tc, sizeof(r3dArenaThreadCache));
+
+	if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &tc->thread, SYNCHRONIZE, FALSE, 0))
+		tc->thread = 0;
+
+	Lock();
+	tc->next = threadCaches;
+	threadCaches = tc;
+	Unlock();
+
+	ref.cache = tc;
+	ref.generation = cacheGeneration;
+	return tc;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void r3dArenaAllocator::RefillThreadCache(r3dArenaThreadCache *tc, int blockClass)
+{
+	const size_t blockSize = 16u << blockClass;
+	const int batch = CacheBatchSize(blockClass);
+
+	Lock();
+
+	if (++numRefills % RECLAIM_PERIOD == 0)
+		ReclaimDeadThreadCaches();
+
+	for (int i = 0; i < batch; ++i)
+	{
+		void *mem = AllocateFromArenas(blockSize, blockSize);
+		if (!mem)
+			break;
+
+		r3dArenaThreadCache::FreeBlock *b = reinterpret_cast<r3dArenaThreadCache::FreeBlock*>(mem);
+		b->next = tc->lists[blockClass];
+		tc->lists[blockClass] = b;
+		++tc->counts[blockClass];
+
+#ifndef FINAL_BUILD
+		tc->cachedBytes += blockSize;
+		cacheBlocksIn++;
+#endif
+	}
+
+	Unlock();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void r3dArenaAllocator::FlushThreadCache(r3dArenaThreadCache *tc, int blockClass, int count)
+{
+	const size_t blockSize = 16u << blockClass;
+
+	Lock();
+
+	for (int i = 0; i < count && tc->lists[blockClass]; ++i)
+	{
+		r3dArenaThreadCache::FreeBlock *b = tc->lists[blockClass];
+		tc->lists[blockClass] = b->next;
+		--tc->counts[blockClass];
+
+		MemoryArena *ma = FindArena(b);
+		r3d_assert(ma);
+		ma->FreeMemory(b);
+
+#ifndef FINAL_BUILD
+		tc->cachedBytes -= blockSize;
+		cacheBlocksOut++;
+#endif
+	}
+
+	Unlock();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void r3dArenaAllocator::ReclaimDeadThreadCaches()
+{
+	//	Called under lock. Caches of exited threads can't be touched by anyone else
+	r3dArenaThreadCache **link = &threadCaches;
+	while (*link)
+	{
+		r3dArenaThreadCache *tc = *link;
+		if (!tc->thread || WaitForSingleObject(tc->thread, 0) != WAIT_OBJECT_0)
+		{
+			link = &tc->next;
+			continue;
+		}
+
+		for (int c = 0; c < NUM_CACHED_CLASSES; ++c)
+		{
+			while (r3dArenaThreadCache::FreeBlock *b = tc->lists[c])
+			{
+				tc->lists[c] = b->next;
+				FindArena(b)->FreeMemory(b);
+#ifndef FINAL_BUILD
+				cacheBlocksOut++;
+#endif
+			}
+		}
+
+#ifndef FINAL_BUILD
+		//	Keep counters of finished thread
+		memStats.numAllocations += tc->numAllocations;
+		memStats.numDeallocations += tc->numDeallocations;
+#endif
+
+		*link = tc->next;
+		CloseHandle(tc->thread);
+		free(tc);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void * r3dArenaAllocator::Allocate(size_t size, size_t alignment)
+{
+#ifndef ENABLE_ADDITIONAL_VALIDATION
+	//	Small blocks fast path
+	if (cacheSlot >= 0 && size <= MAX_CACHED_BLOCK_SIZE && alignment <= MAX_CACHED_BLOCK_SIZE && gThreadCachesEnabled)
+	{
+		r3dArenaThreadCache *tc = GetThreadCache();
+		if (tc)
+		{
+			int blockClass = SmallBlockClass(size, alignment);
+
+			if (!tc->lists[blockClass])
+				RefillThreadCache(tc, blockClass);
+
+			r3dArenaThreadCache::FreeBlock *b = tc->lists[blockClass];
+			if (b)
+			{
+				tc->lists[blockClass] = b->next;
+				--tc->counts[blockClass];
+#ifndef FINAL_BUILD
+				tc->cachedBytes -= 16u << blockClass;
+				tc->numAllocations++;
+#endif
+				return b;
+			}
+		}
+	}
+#endif
+
+	Lock();
+
+#ifdef ENABLE_ADDITIONAL_VALIDATION
+	size += sizeof(size_t); // for guard block
+#endif
+
+	void *mem = 0;
+
+	//	Handle big requests separately
+	if (size > PAGE_SIZE)
+	{
+		mem = _aligned_malloc(size, alignment);
+#ifndef FINAL_BUILD
+		if (mem)
+		{
+			memStats.numAllocations++;
+			memStats.totalAllocatedMemory += _aligned_msize(mem, alignment, 0);;
+		}
+#endif
+	}
+	else
+	{
+		mem = AllocateFromArenas(size, alignment);
+	}
+
+	Unlock();
+	return mem;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 bool r3dArenaAllocator::DeallocateOnlyOwnMemory(void *ptr)
 {
 	if (!ptr) return false;
 
-	CSHolder cs(guard);
+	MemoryArena *ma = FindArena(ptr);
+	if (!ma)
+		return false;
 
-	//	Search for arena than can handle request
-	for (int i = lastArenaIdx - 1; i >= 0; --i)
+#ifndef ENABLE_ADDITIONAL_VALIDATION
+	if (cacheSlot >= 0 && gThreadCachesEnabled)
 	{
-		MemoryArena *ma = arenas[i];
+		int blockClass = ma->GetBlockClass(ptr);
+		r3dArenaThreadCache *tc = blockClass < NUM_CACHED_CLASSES ? GetThreadCache() : 0;
+		if (tc)
+		{
+			r3dArenaThreadCache::FreeBlock *b = reinterpret_cast<r3dArenaThreadCache::FreeBlock*>(ptr);
+			b->next = tc->lists[blockClass];
+			tc->lists[blockClass] = b;
+			++tc->counts[blockClass];
+#ifndef FINAL_BUILD
+			tc->cachedBytes += 16u << blockClass;
+			tc->numDeallocations++;
+#endif
+
+			//	Blocks allocated by other threads pile up here - give half back
+			const int batch = CacheBatchSize(blockClass);
+			if (tc->counts[blockClass] > batch * 2)
+				FlushThreadCache(tc, blockClass, batch);
 
-		if (ma->FreeMemory(ptr))
 			return true;
+		}
 	}
-	
-	return false;
+#endif
+
+	Lock();
+	ma->FreeMemory(ptr);
+	Unlock();
+
+	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -571,8 +939,10 @@ void r3dArenaAllocator::Deallocate(void *ptr, size_t alignment)
 	if (!DeallocateOnlyOwnMemory(ptr))
 	{
 #ifndef FINAL_BUILD
+		Lock();
 		memStats.numDeallocations++;
 		memStats.totalAllocatedMemory -= _aligned_msize(ptr, alignment, 0);
+		Unlock();
 #endif
 		//	Deallocation failed, assume this block is allocated using _aligned_malloc
 		_aligned_free(ptr);
@@ -583,6 +953,8 @@ void r3dArenaAllocator::Deallocate(void *ptr, size_t alignment)
 
 r3dAllocatorMemoryStats r3dArenaAllocator::GetMemStats() const
 {
+	CSHolder cs(guard);
+
 	r3dAllocatorMemoryStats rv = memStats;
 	//	Search for arena than can handle request
 	for (int i = lastArenaIdx - 1; i >= 0; --i)
@@ -593,11 +965,29 @@ r3dAllocatorMemoryStats r3dArenaAllocator::GetMemStats() const
 		rv.numDeallocations += arenaStats.numDeallocations;
 		rv.totalAllocatedMemory += arenaStats.totalAllocatedMemory;
 	}
+
+	//	Blocks in thread caches are free from application point of view
+	rv.numAllocations -= cacheBlocksIn;
+	rv.numDeallocations -= cacheBlocksOut;
+
+	for (const r3dArenaThreadCache *tc = threadCaches; tc; tc = tc->next)
+	{
+		rv.numAllocations += tc->numAllocations;
+		rv.numDeallocations += tc->numDeallocations;
+		rv.totalAllocatedMemory -= tc->cachedBytes;
+	}
 	return rv;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
+/*static*/ void r3dArenaAllocator::EnableThreadCaches(bool enable)
+{
+	gThreadCachesEnabled = enable;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 #ifndef ENABLE_ADDITIONAL_VALIDATION
 #pragma optimize("", on)
 #endif
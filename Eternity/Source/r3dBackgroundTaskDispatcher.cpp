@@ -62,6 +62,10 @@ unsigned int WINAPI BackgroundTaskDispatcherThreadFunc(void* Par)
 	r3dThreadAutoInstallCrashHelper crashHelper;
 	ThreadData *data = reinterpret_cast<ThreadData*>(Par);
 
+#if !DISABLE_PROFILER
+	r3dProfilerTimeline::SetThreadName( "Background tasks" );
+#endif
+
 	while (true)
 	{
 		WaitForSingleObject(data->startEvent, INFINITE);
@@ -153,6 +157,8 @@ unsigned int WINAPI BackgroundTaskDispatcherThreadFunc(void* Par)
 			{
 				td.Params->Cancel = 0;
 
+				R3DPROFILE_FUNCTION("Background task");
+
 				r3dCSHolder block( g_ResourceCritSection );
 				td.Fn(td.Params);
 			}
@@ -0,0 +1,207 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include "r3dBitStream.h"
+
+namespace
+{
+	// smallest three components of unit quaternion are within [-1/sqrt(2), 1/sqrt(2)]
+	const float QUAT_COMPONENT_RANGE = 0.70710678f;
+
+	inline uint32_t BitMask( int numBits )
+	{
+		return numBits >= 32 ? 0xFFFFFFFF : ( ( 1u << numBits ) - 1 );
+	}
+}
+
+//------------------------------------------------------------------------
+
+uint32_t
+r3dBitQuant::Quantize( float val ) const
+{
+	r3d_assert( Bits > 0 && Bits <= 24 && Max > Min );
+
+	const uint32_t maxQ = BitMask( Bits );
+
+	float t = ( val - Min ) / ( Max - Min );
+	t = R3D_CLAMP( t, 0.0f, 1.0f );
+
+	return R3D_MIN( (uint32_t)( t * maxQ + 0.5f ), maxQ );
+}
+
+//------------------------------------------------------------------------
+
+float
+r3dBitQuant::Dequantize( uint32_t q ) const
+{
+	const uint32_t maxQ = BitMask( Bits );
+	return Min + ( Max - Min ) * (float)R3D_MIN( q, maxQ ) / (float)maxQ;
+}
+
+//------------------------------------------------------------------------
+
+float
+r3dBitQuant::GetPrecision() const
+{
+	return ( Max - Min ) / (float)BitMask( Bits ) * 0.5f;
+}
+
+//------------------------------------------------------------------------
+
+r3dBitWriter::r3dBitWriter( void* buf, int sizeInBytes )
+: mBuf( (BYTE*)buf )
+, mBitSize( sizeInBytes * 8 )
+, mBitPos( 0 )
+, mOverflow( false )
+{
+	memset( mBuf, 0, sizeInBytes );
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dBitWriter::WriteBits( uint32_t val, int numBits )
+{
+	r3d_assert( numBits >= 0 && numBits <= 32 );
+
+	if( mBitPos + numBits > mBitSize )
+	{
+		mOverflow = true;
+		return;
+	}
+
+	val &= BitMask( numBits );
+
+	// low bits first, buffer is zeroed in constructor so OR is enough
+	while( numBits > 0 )
+	{
+		const int bitInByte = mBitPos & 7;
+		const int count = R3D_MIN( 8 - bitInByte, numBits );
+
+		mBuf[ mBitPos >> 3 ] |= (BYTE)( ( val & BitMask( count ) ) << bitInByte );
+
+		val >>= count;
+		numBits -= count;
+		mBitPos += count;
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dBitWriter::WriteBool( bool val )
+{
+	WriteBits( val ? 1 : 0, 1 );
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dBitWriter::WriteQuantized( float val, const r3dBitQuant& q )
+{
+	WriteBits( q.Quantize( val ), q.Bits );
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dBitWriter::WriteQuaternion( const float* quat, int bitsPerComponent )
+{
+	int largest = 0;
+	for( int i = 1; i < 4; i ++ )
+	{
+		if( fabsf( quat[ i ] ) > fabsf( quat[ largest ] ) )
+			largest = i;
+	}
+
+	// q and -q are the same rotation, make dropped component positive
+	const float sign = quat[ largest ] < 0.0f ? -1.0f : 1.0f;
+
+	const r3dBitQuant q = { -QUAT_COMPONENT_RANGE, QUAT_COMPONENT_RANGE, bitsPerComponent };
+
+	WriteBits( largest, 2 );
+	for( int i = 0; i < 4; i ++ )
+	{
+		if( i != largest )
+			WriteQuantized( quat[ i ] * sign, q );
+	}
+}
+
+//------------------------------------------------------------------------
+
+r3dBitReader::r3dBitReader( const void* buf, int sizeInBytes )
+: mBuf( (const BYTE*)buf )
+, mBitSize( sizeInBytes * 8 )
+, mBitPos( 0 )
+, mOverflow( false )
+{
+}
+
+//------------------------------------------------------------------------
+
+uint32_t
+r3dBitReader::ReadBits( int numBits )
+{
+	r3d_assert( numBits >= 0 && numBits <= 32 );
+
+	if( mBitPos + numBits > mBitSize )
+	{
+		mOverflow = true;
+		return 0;
+	}
+
+	uint32_t val = 0;
+	int shift = 0;
+
+	while( numBits > 0 )
+	{
+		const int bitInByte = mBitPos & 7;
+		const int count = R3D_MIN( 8 - bitInByte, numBits );
+
+		val |= ( ( mBuf[ mBitPos >> 3 ] >> bitInByte ) & BitMask( count ) ) << shift;
+
+		shift += count;
+		numBits -= count;
+		mBitPos += count;
+	}
+
+	return val;
+}
+
+//------------------------------------------------------------------------
+
+bool
+r3dBitReader::ReadBool()
+{
+	return ReadBits( 1 ) != 0;
+}
+
+//------------------------------------------------------------------------
+
+float
+r3dBitReader::ReadQuantized( const r3dBitQuant& q )
+{
+	return q.Dequantize( ReadBits( q.Bits ) );
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dBitReader::ReadQuaternion( float* quat, int bitsPerComponent )
+{
+	const r3dBitQuant q = { -QUAT_COMPONENT_RANGE, QUAT_COMPONENT_RANGE, bitsPerComponent };
+
+	const int largest = (int)ReadBits( 2 );
+
+	float sumSq = 0.0f;
+	for( int i = 0; i < 4; i ++ )
+	{
+		if( i == largest )
+			continue;
+
+		quat[ i ] = ReadQuantized( q );
+		sumSq += quat[ i ] * quat[ i ];
+	}
+
+	quat[ largest ] = sqrtf( R3D_MAX( 1.0f - sumSq, 0.0f ) );
+}
@@ -6,6 +6,7 @@
 
 #include "FileSystem/r3dFileSystem.h"
 #include "FileSystem\r3dFSStructs.h"
+#include "FileSystem\r3dFSCompress.h"
 
 static	r3dFileSystem	g_filesys;
 extern CRITICAL_SECTION g_FileSysCritSection ;
@@ -119,7 +120,8 @@ void r3dCopyFixedFileName(const char* in_fname, char* out_fname)
 // internal create r3dFile
 r3dFile* r3dFile_IntOpen(const char* fname, const char* mode)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
+  // no global lock here: archive lookups and reads are guarded by shared lock inside r3dFileSystem,
+  // so background loaders can open files in parallel with main thread
   bool allowDirectAccess = true;
 
 #if defined( FINAL_BUILD ) && 1
@@ -149,6 +151,24 @@ r3dFile* r3dFile_IntOpen(const char* fname, const char* mode)
   }
   
   const r3dFS_FileEntry* fe = g_filesys.GetFileEntry(fname);
+  if(fe != NULL && fe->cmethod == r3dFSCompress::COMPRESS_STORE)
+  {
+    // stored files are used directly from archive mapping, without copying
+    r3dFSFileView* view = game_new r3dFSFileView();
+    if(g_filesys.GetFileView(fe, view))
+    {
+      r3dFile* f = game_new r3dFile();
+      sprintf(f->Location.FileName, "%s", fname);
+      f->Location.Where  = FILELOC_Resource;
+      f->Location.id     = (DWORD)fe;
+      f->data   = view->data;
+      f->size   = (int)view->size;
+      f->fsView = view;
+      return f;
+    }
+    delete view;
+  }
+
   if(fe != NULL)
   {
     BYTE* data   = NULL;
@@ -184,11 +204,16 @@ void r3dFile::r3dFile_Init()
   data       = NULL;
   size       = 0;
   pos        = 0;
+  fsView     = NULL;
 }
 
 r3dFile::~r3dFile()
 {
-  if(data)
+  if(fsView) {
+    g_filesys.ReleaseFileView(fsView);
+    delete fsView;
+  }
+  else if(data)
     delete[] data;
   if(stream)
     fclose(stream);
@@ -895,6 +920,9 @@ int r3dFileManager_OpenArchive(const char* fname)
   if(!g_filesys.OpenArchive(fname))
     return 0;
 
+  // textures and meshes are reloaded often, check crc only on first read of each file
+  g_filesys.SetCrcCheckMode(r3dFileSystem::CRC_CHECK_FIRST_READ);
+
   g_filesys.OpenVolumesForRead();
   return 1;
 }
@@ -950,8 +978,6 @@ r3dChunkedWriteFile* r3d_open_write_chunked( const char* base, const char* ext,
 
 int r3d_access(const char* fname, int mode)
 {
-  r3dCSHolderWithDeviceQueue csHolder(g_FileSysCritSection);
-
   if(_access_s(fname, mode) == 0)
     return 0;
 
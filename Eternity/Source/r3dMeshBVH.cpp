@@ -0,0 +1,1156 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include <emmintrin.h>
+#include <algorithm>
+
+#include "r3dMeshBVH.h"
+
+int intersect_triangle_floats_cull(float orig[3], float dir[3], float vert0[3], float vert1[3], float vert2[3], float *t, float *u, float *v);
+
+namespace
+{
+	const float EMPTY_BOUND = 1e30f;
+
+	// same as in intersect_triangle_floats_cull
+	const float TRIRAYCOLL_EPSILON = 0.000001f;
+
+	const int SAH_BINS = 16;
+	// below this depth only median splits are made, so tree can't get deeper than MAX_DEPTH
+	const int MEDIAN_SPLIT_DEPTH = 40;
+
+	R3D_FORCEINLINE int MakeQuadChild( int quad )	{ return -2 - quad; }
+	R3D_FORCEINLINE bool IsQuadChild( int child )	{ return child <= -2; }
+	R3D_FORCEINLINE int GetChildQuad( int child )	{ return -2 - child; }
+
+	// 1 / d clamped so slab test never multiplies 0 by infinity
+	R3D_FORCEINLINE float SafeInverse( float d )
+	{
+		if( fabsf( d ) < 1e-30f )
+			return d < 0.f ? -1e30f : 1e30f;
+
+		return 1.f / d;
+	}
+
+	R3D_FORCEINLINE float HalfArea( const float (&mn)[ 3 ], const float (&mx)[ 3 ] )
+	{
+		float dx = mx[ 0 ] - mn[ 0 ];
+		float dy = mx[ 1 ] - mn[ 1 ];
+		float dz = mx[ 2 ] - mn[ 2 ];
+
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	struct SingleRay
+	{
+		__m128	Org[ 3 ];
+		__m128	Dir[ 3 ];
+		__m128	InvDir[ 3 ];
+
+		// Node::Bounds rows of child box planes ray enters and leaves through
+		int		Near[ 3 ];
+		int		Far[ 3 ];
+	};
+
+	void SetupRay( SingleRay& ray, const r3dPoint3D& org, const r3dPoint3D& dir )
+	{
+		const float o[ 3 ] = { org.X, org.Y, org.Z };
+		const float d[ 3 ] = { dir.X, dir.Y, dir.Z };
+
+		for( int i = 0; i < 3; i ++ )
+		{
+			float inv = SafeInverse( d[ i ] );
+
+			ray.Org[ i ]	= _mm_set1_ps( o[ i ] );
+			ray.Dir[ i ]	= _mm_set1_ps( d[ i ] );
+			ray.InvDir[ i ]	= _mm_set1_ps( inv );
+
+			ray.Near[ i ]	= inv < 0.f ? r3dMeshBVH::MAX_X + i : r3dMeshBVH::MIN_X + i;
+			ray.Far[ i ]	= inv < 0.f ? r3dMeshBVH::MIN_X + i : r3dMeshBVH::MAX_X + i;
+		}
+	}
+
+	// returns mask of children ray enters before maxT, tNear gets entry distances
+	R3D_FORCEINLINE int IntersectChildren( const r3dMeshBVH::Node& node, const SingleRay& ray, __m128 maxT, __m128& tNear )
+	{
+		__m128 tn = _mm_setzero_ps();
+		__m128 tf = maxT;
+
+		for( int i = 0; i < 3; i ++ )
+		{
+			__m128 t0 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( node.Bounds[ ray.Near[ i ] ] ), ray.Org[ i ] ), ray.InvDir[ i ] );
+			__m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( node.Bounds[ ray.Far[ i ] ] ), ray.Org[ i ] ), ray.InvDir[ i ] );
+
+			tn = _mm_max_ps( tn, t0 );
+			tf = _mm_min_ps( tf, t1 );
+		}
+
+		tNear = tn;
+		return _mm_movemask_ps( _mm_cmple_ps( tn, tf ) );
+	}
+
+	// intersect_triangle_floats_cull for one triangle per lane,
+	// operations are done in the same order so results match it exactly
+	R3D_FORCEINLINE __m128 IntersectTriangles(	const __m128 (&org)[ 3 ], const __m128 (&dir)[ 3 ],
+												const __m128 (&v0)[ 3 ], const __m128 (&e1)[ 3 ], const __m128 (&e2)[ 3 ],
+												__m128& t )
+	{
+		// pvec = dir x edge2
+		__m128 px = _mm_sub_ps( _mm_mul_ps( dir[ 1 ], e2[ 2 ] ), _mm_mul_ps( dir[ 2 ], e2[ 1 ] ) );
+		__m128 py = _mm_sub_ps( _mm_mul_ps( dir[ 2 ], e2[ 0 ] ), _mm_mul_ps( dir[ 0 ], e2[ 2 ] ) );
+		__m128 pz = _mm_sub_ps( _mm_mul_ps( dir[ 0 ], e2[ 1 ] ), _mm_mul_ps( dir[ 1 ], e2[ 0 ] ) );
+
+		__m128 det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1[ 0 ], px ), _mm_mul_ps( e1[ 1 ], py ) ), _mm_mul_ps( e1[ 2 ], pz ) );
+
+		__m128 tx = _mm_sub_ps( org[ 0 ], v0[ 0 ] );
+		__m128 ty = _mm_sub_ps( org[ 1 ], v0[ 1 ] );
+		__m128 tz = _mm_sub_ps( org[ 2 ], v0[ 2 ] );
+
+		__m128 u = _mm_add_ps( _mm_add_ps( _mm_mul_ps( tx, px ), _mm_mul_ps( ty, py ) ), _mm_mul_ps( tz, pz ) );
+
+		// qvec = tvec x edge1
+		__m128 qx = _mm_sub_ps( _mm_mul_ps( ty, e1[ 2 ] ), _mm_mul_ps( tz, e1[ 1 ] ) );
+		__m128 qy = _mm_sub_ps( _mm_mul_ps( tz, e1[ 0 ] ), _mm_mul_ps( tx, e1[ 2 ] ) );
+		__m128 qz = _mm_sub_ps( _mm_mul_ps( tx, e1[ 1 ] ), _mm_mul_ps( ty, e1[ 0 ] ) );
+
+		__m128 v = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dir[ 0 ], qx ), _mm_mul_ps( dir[ 1 ], qy ) ), _mm_mul_ps( dir[ 2 ], qz ) );
+		__m128 tt = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2[ 0 ], qx ), _mm_mul_ps( e2[ 1 ], qy ) ), _mm_mul_ps( e2[ 2 ], qz ) );
+
+		const __m128 zero = _mm_setzero_ps();
+
+		__m128 mask = _mm_cmpge_ps( det, _mm_set1_ps( TRIRAYCOLL_EPSILON ) );
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( u, zero ) );
+		mask = _mm_and_ps( mask, _mm_cmple_ps( u, det ) );
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( v, zero ) );
+		mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_add_ps( u, v ), det ) );
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( tt, zero ) );
+
+		t = _mm_mul_ps( tt, _mm_div_ps( _mm_set1_ps( 1.f ), det ) );
+
+		return mask;
+	}
+
+	// one ray against 4 triangles of quad, returns mask of lanes hit
+	R3D_FORCEINLINE int IntersectQuad( const r3dMeshBVH::TriangleQuad& q, const SingleRay& ray, __m128& t )
+	{
+		__m128 v0[ 3 ], e1[ 3 ], e2[ 3 ];
+
+		for( int i = 0; i < 3; i ++ )
+		{
+			v0[ i ] = _mm_loadu_ps( q.V0[ i ] );
+			e1[ i ] = _mm_loadu_ps( q.E1[ i ] );
+			e2[ i ] = _mm_loadu_ps( q.E2[ i ] );
+		}
+
+		return _mm_movemask_ps( IntersectTriangles( ray.Org, ray.Dir, v0, e1, e2, t ) );
+	}
+
+	// nearest hit wins, on equal distance the one with lower face index, same as brute force loop
+	R3D_FORCEINLINE bool IsCloserHit( float t, int face, float bestT, int bestFace )
+	{
+		return t < bestT || ( t == bestT && face < bestFace );
+	}
+}
+
+//------------------------------------------------------------------------
+
+struct r3dMeshBVH::CenterLess
+{
+	const BuildTriangle*	Triangles;
+	int						Axis;
+
+	bool operator()( int a, int b ) const
+	{
+		return Triangles[ a ].Center[ Axis ] < Triangles[ b ].Center[ Axis ];
+	}
+};
+
+struct r3dMeshBVH::InLeftBins
+{
+	const BuildTriangle*	Triangles;
+	int						Axis;
+	float					Org;
+	float					Scale;
+	int						LastBin;
+
+	R3D_FORCEINLINE static int GetBin( float c, float org, float scale )
+	{
+		int bin = (int)( ( c - org ) * scale );
+		return R3D_MIN( R3D_MAX( bin, 0 ), SAH_BINS - 1 );
+	}
+
+	bool operator()( int tri ) const
+	{
+		return GetBin( Triangles[ tri ].Center[ Axis ], Org, Scale ) <= LastBin;
+	}
+};
+
+//------------------------------------------------------------------------
+
+r3dMeshBVH::r3dMeshBVH()
+: mBuildPositions( NULL )
+, mBuildIndices( NULL )
+, mBuildPad( 0.f )
+{
+}
+
+//------------------------------------------------------------------------
+
+void r3dMeshBVH::Build( const r3dPoint3D* positions, const uint32_t* indices, int numTriangles )
+{
+	R3DPROFILE_FUNCTION( "r3dMeshBVH::Build" );
+
+	mNodes.Clear();
+	mQuads.Clear();
+
+	if( numTriangles <= 0 )
+		return;
+
+	mBuildPositions	= positions;
+	mBuildIndices	= indices;
+
+	mBuildTriangles.Resize( numTriangles );
+	mBuildOrder.Resize( numTriangles );
+
+	float rootMin[ 3 ] = { EMPTY_BOUND, EMPTY_BOUND, EMPTY_BOUND };
+	float rootMax[ 3 ] = { -EMPTY_BOUND, -EMPTY_BOUND, -EMPTY_BOUND };
+
+	for( int i = 0; i < numTriangles; i ++ )
+	{
+		const float* p0 = &positions[ indices[ i * 3 + 0 ] ].X;
+		const float* p1 = &positions[ indices[ i * 3 + 1 ] ].X;
+		const float* p2 = &positions[ indices[ i * 3 + 2 ] ].X;
+
+		BuildTriangle& bt = mBuildTriangles[ i ];
+
+		for( int k = 0; k < 3; k ++ )
+		{
+			bt.Min[ k ] = R3D_MIN( R3D_MIN( p0[ k ], p1[ k ] ), p2[ k ] );
+			bt.Max[ k ] = R3D_MAX( R3D_MAX( p0[ k ], p1[ k ] ), p2[ k ] );
+			bt.Center[ k ] = ( bt.Min[ k ] + bt.Max[ k ] ) * 0.5f;
+
+			rootMin[ k ] = R3D_MIN( rootMin[ k ], bt.Min[ k ] );
+			rootMax[ k ] = R3D_MAX( rootMax[ k ], bt.Max[ k ] );
+		}
+
+		mBuildOrder[ i ] = i;
+	}
+
+	// child boxes are padded so rays grazing triangle edges are not lost to rounding in slab test
+	float extent = R3D_MAX( R3D_MAX( rootMax[ 0 ] - rootMin[ 0 ], rootMax[ 1 ] - rootMin[ 1 ] ), rootMax[ 2 ] - rootMin[ 2 ] );
+	mBuildPad = extent * 1e-5f + 1e-6f;
+
+	mNodes.Reserve( numTriangles / 8 + 1 );
+	mQuads.Reserve( numTriangles / 3 + 1 );
+
+	BuildNode( 0, numTriangles, 0 );
+
+	// tree lives as long as mesh, don't keep reserve
+	r3dTL::TArray< Node >( mNodes ).Swap( mNodes );
+	r3dTL::TArray< TriangleQuad >( mQuads ).Swap( mQuads );
+
+	r3dTL::TArray< BuildTriangle >().Swap( mBuildTriangles );
+	r3dTL::TArray< int >().Swap( mBuildOrder );
+
+	mBuildPositions	= NULL;
+	mBuildIndices	= NULL;
+}
+
+//------------------------------------------------------------------------
+
+int r3dMeshBVH::BuildNode( int begin, int end, int depth )
+{
+	r3d_assert( depth < MAX_DEPTH );
+
+	int nodeIdx = mNodes.Count();
+
+	Node empty;
+	mNodes.PushBack( empty );
+
+	// split largest range in two until there are 4 of them or all fit into quads
+	Range ranges[ 4 ];
+	ranges[ 0 ].Begin	= begin;
+	ranges[ 0 ].End		= end;
+
+	int numRanges = 1;
+
+	while( numRanges < 4 )
+	{
+		int largest = -1;
+		int largestCount = 4;
+
+		for( int i = 0; i < numRanges; i ++ )
+		{
+			int count = ranges[ i ].End - ranges[ i ].Begin;
+			if( count > largestCount )
+			{
+				largest = i;
+				largestCount = count;
+			}
+		}
+
+		if( largest < 0 )
+			break;
+
+		Range& r = ranges[ largest ];
+		int mid = SplitRange( r.Begin, r.End, depth >= MEDIAN_SPLIT_DEPTH );
+
+		ranges[ numRanges ].Begin	= mid;
+		ranges[ numRanges ].End		= r.End;
+		r.End = mid;
+
+		numRanges ++;
+	}
+
+	for( int i = 0; i < 4; i ++ )
+	{
+		float mn[ 3 ] = { EMPTY_BOUND, EMPTY_BOUND, EMPTY_BOUND };
+		float mx[ 3 ] = { -EMPTY_BOUND, -EMPTY_BOUND, -EMPTY_BOUND };
+
+		int child = EMPTY_CHILD;
+
+		if( i < numRanges )
+		{
+			const Range& r = ranges[ i ];
+
+			GetRangeBounds( r.Begin, r.End, mn, mx );
+
+			for( int k = 0; k < 3; k ++ )
+			{
+				mn[ k ] -= mBuildPad;
+				mx[ k ] += mBuildPad;
+			}
+
+			if( r.End - r.Begin <= 4 )
+				child = MakeQuadChild( BuildQuad( r.Begin, r.End ) );
+			else
+				child = BuildNode( r.Begin, r.End, depth + 1 );
+		}
+
+		// children may have reallocated nodes
+		Node& node = mNodes[ nodeIdx ];
+
+		for( int k = 0; k < 3; k ++ )
+		{
+			node.Bounds[ MIN_X + k ][ i ] = mn[ k ];
+			node.Bounds[ MAX_X + k ][ i ] = mx[ k ];
+		}
+
+		node.Child[ i ] = child;
+	}
+
+	return nodeIdx;
+}
+
+//------------------------------------------------------------------------
+
+int r3dMeshBVH::BuildQuad( int begin, int end )
+{
+	TriangleQuad q;
+	memset( &q, 0, sizeof q );
+
+	for( int i = 0; i < 4; i ++ )
+	{
+		q.Face[ i ] = -1;
+	}
+
+	for( int i = begin; i < end; i ++ )
+	{
+		int lane = i - begin;
+		int face = mBuildOrder[ i ];
+
+		const float* p0 = &mBuildPositions[ mBuildIndices[ face * 3 + 0 ] ].X;
+		const float* p1 = &mBuildPositions[ mBuildIndices[ face * 3 + 1 ] ].X;
+		const float* p2 = &mBuildPositions[ mBuildIndices[ face * 3 + 2 ] ].X;
+
+		for( int k = 0; k < 3; k ++ )
+		{
+			q.V0[ k ][ lane ] = p0[ k ];
+			q.E1[ k ][ lane ] = p1[ k ] - p0[ k ];
+			q.E2[ k ][ lane ] = p2[ k ] - p0[ k ];
+		}
+
+		q.Face[ lane ] = face;
+	}
+
+	mQuads.PushBack( q );
+
+	return mQuads.Count() - 1;
+}
+
+//------------------------------------------------------------------------
+
+int r3dMeshBVH::SplitRange( int begin, int end, bool median )
+{
+	int* order = &mBuildOrder[ 0 ];
+	const BuildTriangle* tris = &mBuildTriangles[ 0 ];
+
+	float cmn[ 3 ] = { EMPTY_BOUND, EMPTY_BOUND, EMPTY_BOUND };
+	float cmx[ 3 ] = { -EMPTY_BOUND, -EMPTY_BOUND, -EMPTY_BOUND };
+
+	for( int i = begin; i < end; i ++ )
+	{
+		const BuildTriangle& bt = tris[ order[ i ] ];
+
+		for( int k = 0; k < 3; k ++ )
+		{
+			cmn[ k ] = R3D_MIN( cmn[ k ], bt.Center[ k ] );
+			cmx[ k ] = R3D_MAX( cmx[ k ], bt.Center[ k ] );
+		}
+	}
+
+	int axis = 0;
+	for( int k = 1; k < 3; k ++ )
+	{
+		if( cmx[ k ] - cmn[ k ] > cmx[ axis ] - cmn[ axis ] )
+			axis = k;
+	}
+
+	int mid = ( begin + end ) / 2;
+
+	float extent = cmx[ axis ] - cmn[ axis ];
+
+	// all centers are in one point, any split is as good
+	if( !( extent > 0.f ) )
+		return mid;
+
+	if( !median )
+	{
+		struct Bin
+		{
+			float	Min[ 3 ];
+			float	Max[ 3 ];
+			int		Count;
+		};
+
+		Bin bins[ SAH_BINS ];
+
+		for( int b = 0; b < SAH_BINS; b ++ )
+		{
+			for( int k = 0; k < 3; k ++ )
+			{
+				bins[ b ].Min[ k ] = EMPTY_BOUND;
+				bins[ b ].Max[ k ] = -EMPTY_BOUND;
+			}
+			bins[ b ].Count = 0;
+		}
+
+		float scale = SAH_BINS / extent;
+
+		for( int i = begin; i < end; i ++ )
+		{
+			const BuildTriangle& bt = tris[ order[ i ] ];
+			Bin& bin = bins[ InLeftBins::GetBin( bt.Center[ axis ], cmn[ axis ], scale ) ];
+
+			for( int k = 0; k < 3; k ++ )
+			{
+				bin.Min[ k ] = R3D_MIN( bin.Min[ k ], bt.Min[ k ] );
+				bin.Max[ k ] = R3D_MAX( bin.Max[ k ], bt.Max[ k ] );
+			}
+			bin.Count ++;
+		}
+
+		// cost of splitting after bin b, sweeping from the right
+		float rightCost[ SAH_BINS ];
+
+		float mn[ 3 ] = { EMPTY_BOUND, EMPTY_BOUND, EMPTY_BOUND };
+		float mx[ 3 ] = { -EMPTY_BOUND, -EMPTY_BOUND, -EMPTY_BOUND };
+		int count = 0;
+
+		for( int b = SAH_BINS - 1; b > 0; b -- )
+		{
+			for( int k = 0; k < 3; k ++ )
+			{
+				mn[ k ] = R3D_MIN( mn[ k ], bins[ b ].Min[ k ] );
+				mx[ k ] = R3D_MAX( mx[ k ], bins[ b ].Max[ k ] );
+			}
+			count += bins[ b ].Count;
+
+			rightCost[ b - 1 ] = count ? HalfArea( mn, mx ) * count : 0.f;
+		}
+
+		for( int k = 0; k < 3; k ++ )
+		{
+			mn[ k ] = EMPTY_BOUND;
+			mx[ k ] = -EMPTY_BOUND;
+		}
+		count = 0;
+
+		int bestBin = -1;
+		float bestCost = FLT_MAX;
+
+		for( int b = 0; b < SAH_BINS - 1; b ++ )
+		{
+			for( int k = 0; k < 3; k ++ )
+			{
+				mn[ k ] = R3D_MIN( mn[ k ], bins[ b ].Min[ k ] );
+				mx[ k ] = R3D_MAX( mx[ k ], bins[ b ].Max[ k ] );
+			}
+			count += bins[ b ].Count;
+
+			if( !count || count == end - begin )
+				continue;
+
+			float cost = HalfArea( mn, mx ) * count + rightCost[ b ];
+			if( cost < bestCost )
+			{
+				bestCost = cost;
+				bestBin = b;
+			}
+		}
+
+		if( bestBin >= 0 )
+		{
+			InLeftBins pred;
+			pred.Triangles	= tris;
+			pred.Axis		= axis;
+			pred.Org		= cmn[ axis ];
+			pred.Scale		= scale;
+			pred.LastBin	= bestBin;
+
+			int split = int( std::partition( order + begin, order + end, pred ) - order );
+
+			if( split > begin && split < end )
+				return split;
+		}
+	}
+
+	CenterLess less;
+	less.Triangles	= tris;
+	less.Axis		= axis;
+
+	std::nth_element( order + begin, order + mid, order + end, less );
+
+	return mid;
+}
+
+//------------------------------------------------------------------------
+
+void r3dMeshBVH::GetRangeBounds( int begin, int end, float (&mn)[ 3 ], float (&mx)[ 3 ] ) const
+{
+	for( int i = begin; i < end; i ++ )
+	{
+		const BuildTriangle& bt = mBuildTriangles[ mBuildOrder[ i ] ];
+
+		for( int k = 0; k < 3; k ++ )
+		{
+			mn[ k ] = R3D_MIN( mn[ k ], bt.Min[ k ] );
+			mx[ k ] = R3D_MAX( mx[ k ], bt.Max[ k ] );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dMeshBVH::IntersectRay( const r3dPoint3D& org, const r3dPoint3D& dir, r3dMeshRayHit& hit ) const
+{
+	if( !mNodes.Count() )
+		return;
+
+	SingleRay ray;
+	SetupRay( ray, org, dir );
+
+	float bestT = hit.T;
+	int bestFace = hit.Face;
+
+	int stack[ MAX_DEPTH * 3 + 4 ];
+	int stackSize = 0;
+
+	stack[ stackSize ++ ] = 0;
+
+	while( stackSize )
+	{
+		const Node& node = mNodes[ stack[ -- stackSize ] ];
+
+		__m128 tNear;
+		int mask = IntersectChildren( node, ray, _mm_set1_ps( bestT ), tNear );
+
+		if( !mask )
+			continue;
+
+		float nearT[ 4 ];
+		_mm_storeu_ps( nearT, tNear );
+
+		// quads are tested right away, nodes are queued nearest last so they are popped first
+		int queued[ 4 ];
+		float queuedT[ 4 ];
+		int numQueued = 0;
+
+		for( int i = 0; i < 4; i ++ )
+		{
+			if( !( mask & ( 1 << i ) ) )
+				continue;
+
+			int child = node.Child[ i ];
+
+			if( IsQuadChild( child ) )
+			{
+				const TriangleQuad& q = mQuads[ GetChildQuad( child ) ];
+
+				__m128 t;
+				int hitMask = IntersectQuad( q, ray, t );
+
+				if( hitMask )
+				{
+					float ts[ 4 ];
+					_mm_storeu_ps( ts, t );
+
+					for( int j = 0; j < 4; j ++ )
+					{
+						if( ( hitMask & ( 1 << j ) ) && IsCloserHit( ts[ j ], q.Face[ j ], bestT, bestFace ) )
+						{
+							bestT = ts[ j ];
+							bestFace = q.Face[ j ];
+						}
+					}
+				}
+			}
+			else if( child != EMPTY_CHILD )
+			{
+				int j = numQueued ++;
+				for( ; j > 0 && queuedT[ j - 1 ] < nearT[ i ]; j -- )
+				{
+					queued[ j ] = queued[ j - 1 ];
+					queuedT[ j ] = queuedT[ j - 1 ];
+				}
+
+				queued[ j ] = child;
+				queuedT[ j ] = nearT[ i ];
+			}
+		}
+
+		for( int i = 0; i < numQueued; i ++ )
+		{
+			// quads of this node may have found something closer
+			if( queuedT[ i ] <= bestT )
+				stack[ stackSize ++ ] = queued[ i ];
+		}
+	}
+
+	hit.T = bestT;
+	hit.Face = bestFace;
+}
+
+//------------------------------------------------------------------------
+
+bool r3dMeshBVH::IntersectRayAny( const r3dPoint3D& org, const r3dPoint3D& dir, r3dMeshRayHit& hit ) const
+{
+	if( !mNodes.Count() )
+		return false;
+
+	SingleRay ray;
+	SetupRay( ray, org, dir );
+
+	const __m128 maxT = _mm_set1_ps( hit.T );
+
+	int stack[ MAX_DEPTH * 3 + 4 ];
+	int stackSize = 0;
+
+	stack[ stackSize ++ ] = 0;
+
+	while( stackSize )
+	{
+		const Node& node = mNodes[ stack[ -- stackSize ] ];
+
+		__m128 tNear;
+		int mask = IntersectChildren( node, ray, maxT, tNear );
+
+		for( int i = 0; i < 4; i ++ )
+		{
+			if( !( mask & ( 1 << i ) ) )
+				continue;
+
+			int child = node.Child[ i ];
+
+			if( IsQuadChild( child ) )
+			{
+				const TriangleQuad& q = mQuads[ GetChildQuad( child ) ];
+
+				__m128 t;
+				int hitMask = IntersectQuad( q, ray, t ) & _mm_movemask_ps( _mm_cmplt_ps( t, maxT ) );
+
+				if( hitMask )
+				{
+					float ts[ 4 ];
+					_mm_storeu_ps( ts, t );
+
+					for( int j = 0; j < 4; j ++ )
+					{
+						if( hitMask & ( 1 << j ) )
+						{
+							hit.T = ts[ j ];
+							hit.Face = q.Face[ j ];
+							return true;
+						}
+					}
+				}
+			}
+			else if( child != EMPTY_CHILD )
+			{
+				stack[ stackSize ++ ] = child;
+			}
+		}
+	}
+
+	return false;
+}
+
+//------------------------------------------------------------------------
+
+void r3dMeshBVH::IntersectPacket( const r3dPoint3D& org, const r3dPoint3D* dirs, int count, r3dMeshRayHit* hits ) const
+{
+	if( !mNodes.Count() )
+		return;
+
+	for( int first = 0; first < count; first += PACKET_SIZE )
+	{
+		int numRays = R3D_MIN( count - first, (int)PACKET_SIZE );
+
+		SingleRay rays[ PACKET_SIZE ];
+		float bestT[ PACKET_SIZE ];
+		int bestFace[ PACKET_SIZE ];
+
+		// node test takes range of inverse directions over all rays, so signs of every component must agree
+		float invMin[ 3 ], invMax[ 3 ];
+		bool coherent = true;
+
+		for( int l = 0; l < numRays; l ++ )
+		{
+			SetupRay( rays[ l ], org, dirs[ first + l ] );
+
+			bestT[ l ] = hits[ first + l ].T;
+			bestFace[ l ] = hits[ first + l ].Face;
+
+			for( int k = 0; k < 3; k ++ )
+			{
+				float inv = _mm_cvtss_f32( rays[ l ].InvDir[ k ] );
+
+				invMin[ k ] = l ? R3D_MIN( invMin[ k ], inv ) : inv;
+				invMax[ k ] = l ? R3D_MAX( invMax[ k ], inv ) : inv;
+
+				coherent = coherent && rays[ l ].Near[ k ] == rays[ 0 ].Near[ k ];
+			}
+		}
+
+		if( !coherent )
+		{
+			for( int l = 0; l < numRays; l ++ )
+			{
+				IntersectRay( org, dirs[ first + l ], hits[ first + l ] );
+			}
+			continue;
+		}
+
+		const SingleRay& ray0 = rays[ 0 ];
+
+		__m128 invA[ 3 ], invB[ 3 ];
+
+		for( int k = 0; k < 3; k ++ )
+		{
+			invA[ k ] = _mm_set1_ps( invMin[ k ] );
+			invB[ k ] = _mm_set1_ps( invMax[ k ] );
+		}
+
+		int stack[ MAX_DEPTH * 3 + 4 ];
+		int stackSize = 0;
+
+		stack[ stackSize ++ ] = 0;
+
+		while( stackSize )
+		{
+			const Node& node = mNodes[ stack[ -- stackSize ] ];
+
+			float maxBestT = bestT[ 0 ];
+			for( int l = 1; l < numRays; l ++ )
+			{
+				maxBestT = R3D_MAX( maxBestT, bestT[ l ] );
+			}
+
+			// entry and exit distances of all rays are between those of extreme inverse directions
+			__m128 tn = _mm_setzero_ps();
+			__m128 tf = _mm_set1_ps( maxBestT );
+
+			for( int k = 0; k < 3; k ++ )
+			{
+				__m128 dn = _mm_sub_ps( _mm_loadu_ps( node.Bounds[ ray0.Near[ k ] ] ), ray0.Org[ k ] );
+				__m128 df = _mm_sub_ps( _mm_loadu_ps( node.Bounds[ ray0.Far[ k ] ] ), ray0.Org[ k ] );
+
+				tn = _mm_max_ps( tn, _mm_min_ps( _mm_mul_ps( dn, invA[ k ] ), _mm_mul_ps( dn, invB[ k ] ) ) );
+				tf = _mm_min_ps( tf, _mm_max_ps( _mm_mul_ps( df, invA[ k ] ), _mm_mul_ps( df, invB[ k ] ) ) );
+			}
+
+			int mask = _mm_movemask_ps( _mm_cmple_ps( tn, tf ) );
+
+			if( !mask )
+				continue;
+
+			float nearT[ 4 ];
+			_mm_storeu_ps( nearT, tn );
+
+			int queued[ 4 ];
+			float queuedT[ 4 ];
+			int numQueued = 0;
+
+			for( int i = 0; i < 4; i ++ )
+			{
+				if( !( mask & ( 1 << i ) ) )
+					continue;
+
+				int child = node.Child[ i ];
+
+				if( IsQuadChild( child ) )
+				{
+					const TriangleQuad& q = mQuads[ GetChildQuad( child ) ];
+
+					for( int l = 0; l < numRays; l ++ )
+					{
+						__m128 t;
+						int hitMask = IntersectQuad( q, rays[ l ], t );
+
+						if( !hitMask )
+							continue;
+
+						float ts[ 4 ];
+						_mm_storeu_ps( ts, t );
+
+						for( int j = 0; j < 4; j ++ )
+						{
+							if( ( hitMask & ( 1 << j ) ) && IsCloserHit( ts[ j ], q.Face[ j ], bestT[ l ], bestFace[ l ] ) )
+							{
+								bestT[ l ] = ts[ j ];
+								bestFace[ l ] = q.Face[ j ];
+							}
+						}
+					}
+				}
+				else if( child != EMPTY_CHILD )
+				{
+					int j = numQueued ++;
+					for( ; j > 0 && queuedT[ j - 1 ] < nearT[ i ]; j -- )
+					{
+						queued[ j ] = queued[ j - 1 ];
+						queuedT[ j ] = queuedT[ j - 1 ];
+					}
+
+					queued[ j ] = child;
+					queuedT[ j ] = nearT[ i ];
+				}
+			}
+
+			for( int i = 0; i < numQueued; i ++ )
+			{
+				stack[ stackSize ++ ] = queued[ i ];
+			}
+		}
+
+		for( int l = 0; l < numRays; l ++ )
+		{
+			hits[ first + l ].T = bestT[ l ];
+			hits[ first + l ].Face = bestFace[ l ];
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+void r3dMeshBVH::IntersectRayBruteForce( const r3dPoint3D* positions, const uint32_t* indices, int numTriangles, const r3dPoint3D& org, const r3dPoint3D& dir, r3dMeshRayHit& hit )
+{
+	for( int i = 0; i < numTriangles; i ++ )
+	{
+		float t, u, v;
+		if( !intersect_triangle_floats_cull( (float*)&org.X, (float*)&dir.X, (float*)&positions[ indices[ i * 3 + 0 ] ].X, (float*)&positions[ indices[ i * 3 + 1 ] ].X, (float*)&positions[ indices[ i * 3 + 2 ] ].X, &t, &u, &v ) )
+			continue;
+
+		if( t < hit.T )
+		{
+			hit.T = t;
+			hit.Face = i;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+bool r3dMeshBVH::IntersectRayAnyBruteForce( const r3dPoint3D* positions, const uint32_t* indices, int numTriangles, const r3dPoint3D& org, const r3dPoint3D& dir, r3dMeshRayHit& hit )
+{
+	for( int i = 0; i < numTriangles; i ++ )
+	{
+		float t, u, v;
+		if( intersect_triangle_floats_cull( (float*)&org.X, (float*)&dir.X, (float*)&positions[ indices[ i * 3 + 0 ] ].X, (float*)&positions[ indices[ i * 3 + 1 ] ].X, (float*)&positions[ indices[ i * 3 + 2 ] ].X, &t, &u, &v ) && t < hit.T )
+		{
+			hit.T = t;
+			hit.Face = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//------------------------------------------------------------------------
+
+#ifndef FINAL_BUILD
+
+namespace
+{
+	struct BenchRandom
+	{
+		uint32_t	State;
+
+		float Get()
+		{
+			State = State * 1664525u + 1013904223u;
+			return ( State >> 8 ) * ( 1.f / 16777216.f );
+		}
+	};
+
+	// different faces are fine when they are hit at the same distance - shared edges, coplanar triangles
+	bool IsSameHit( const r3dMeshRayHit& a, const r3dMeshRayHit& b )
+	{
+		if( a.Face < 0 || b.Face < 0 )
+			return a.Face == b.Face;
+
+		return fabsf( a.T - b.T ) <= 1e-4f * R3D_MAX( a.T, 1.f );
+	}
+
+	R3D_FORCEINLINE double RaysPerSecond( double rays, float time )
+	{
+		return rays / R3D_MAX( time, 1e-6f );
+	}
+}
+
+void r3dMeshRayBenchmark( r3dMesh* const* meshes, int count, int numRays )
+{
+	// brute force runs only on first rays of each mesh, about this many triangle tests in total
+	const double BRUTE_FORCE_BUDGET = 2e8;
+
+	r3dTL::TArray< r3dMesh* > used;
+	int totalTriangles = 0;
+
+	for( int i = 0; i < count; i ++ )
+	{
+		r3dMesh* mesh = meshes[ i ];
+
+		if( !mesh || !mesh->IsLoaded() || !mesh->VertexPositions || !mesh->Indices || mesh->NumIndices / 3 < r3dMeshBVH::MIN_TRIANGLES )
+			continue;
+
+		used.PushBack( mesh );
+		totalTriangles += mesh->NumIndices / 3;
+	}
+
+	if( !used.Count() )
+	{
+		r3dOutToLog( "meshraybench: no loaded meshes with %d or more triangles\n", (int)r3dMeshBVH::MIN_TRIANGLES );
+		return;
+	}
+
+	const int PACKET_SIZE = r3dMeshBVH::PACKET_SIZE;
+
+	int numMeshes = used.Count();
+	int raysPerMesh = ( R3D_MAX( numRays / numMeshes, 1 ) + PACKET_SIZE - 1 ) / PACKET_SIZE * PACKET_SIZE;
+	int packetsPerMesh = raysPerMesh / PACKET_SIZE;
+	int totalRays = raysPerMesh * numMeshes;
+
+	r3dOutToLog( "meshraybench: %d meshes, %d triangles, %d rays per mesh\n", numMeshes, totalTriangles, raysPerMesh ); CLOG_INDENT;
+
+	// build
+
+	r3dTL::TArray< r3dMeshBVH* > trees( numMeshes );
+
+	float buildTime = 0.f;
+	int memory = 0, numNodes = 0, numQuads = 0;
+
+	for( int m = 0; m < numMeshes; m ++ )
+	{
+		r3dMesh* mesh = used[ m ];
+
+		trees[ m ] = gfx_new r3dMeshBVH;
+
+		float t0 = r3dGetTime();
+		trees[ m ]->Build( mesh->VertexPositions, mesh->Indices, mesh->NumIndices / 3 );
+		buildTime += r3dGetTime() - t0;
+
+		memory += trees[ m ]->GetMemorySize();
+		numNodes += trees[ m ]->GetNodeCount();
+		numQuads += trees[ m ]->GetQuadCount();
+	}
+
+	// packets of shotgun like rays - common origin outside of mesh, directions spread around aim point inside of its box
+
+	r3dTL::TArray< r3dPoint3D > origins( numMeshes * packetsPerMesh );
+	r3dTL::TArray< r3dPoint3D > dirs( totalRays );
+	r3dTL::TArray< int > bruteRays( numMeshes );
+
+	BenchRandom rnd;
+	rnd.State = 12345;
+
+	for( int m = 0; m < numMeshes; m ++ )
+	{
+		const r3dMesh* mesh = used[ m ];
+		const r3dBox3D& box = mesh->localBBox;
+
+		r3dPoint3D center = box.Org + box.Size * 0.5f;
+		float radius = box.Size.Length() * 0.5f + 0.01f;
+
+		for( int p = 0; p < packetsPerMesh; p ++ )
+		{
+			r3dPoint3D u;
+			do
+			{
+				u = r3dPoint3D( rnd.Get() * 2.f - 1.f, rnd.Get() * 2.f - 1.f, rnd.Get() * 2.f - 1.f );
+			}
+			while( u.LengthSq() > 1.f || u.LengthSq() < 1e-4f );
+
+			u.Normalize();
+
+			r3dPoint3D org = center + u * radius * 1.5f;
+			r3dPoint3D aim = box.Org + r3dPoint3D( box.Size.x * rnd.Get(), box.Size.y * rnd.Get(), box.Size.z * rnd.Get() );
+
+			origins[ m * packetsPerMesh + p ] = org;
+
+			for( int j = 0; j < PACKET_SIZE; j ++ )
+			{
+				r3dPoint3D spread( rnd.Get() - 0.5f, rnd.Get() - 0.5f, rnd.Get() - 0.5f );
+
+				r3dPoint3D dir = aim + spread * radius * 0.05f - org;
+				dir.Normalize();
+
+				dirs[ ( m * packetsPerMesh + p ) * PACKET_SIZE + j ] = dir;
+			}
+		}
+
+		int rays = (int)( BRUTE_FORCE_BUDGET / numMeshes / ( mesh->NumIndices / 3 ) );
+		bruteRays[ m ] = R3D_MIN( R3D_MAX( rays, 1 ), raysPerMesh );
+	}
+
+	r3dTL::TArray< r3dMeshRayHit > bruteHits( totalRays );
+	r3dTL::TArray< r3dMeshRayHit > singleHits( totalRays );
+	r3dTL::TArray< r3dMeshRayHit > packetHits( totalRays );
+	r3dTL::TArray< int > anyHits( totalRays );
+
+	// brute force, time of all rays is extrapolated per mesh
+
+	double numBruteRays = 0;
+	float bruteTime = 0.f;
+
+	for( int m = 0; m < numMeshes; m ++ )
+	{
+		const r3dMesh* mesh = used[ m ];
+
+		float t0 = r3dGetTime();
+
+		for( int r = 0, e = bruteRays[ m ]; r < e; r ++ )
+		{
+			int ray = m * raysPerMesh + r;
+			r3dMeshRayHit& hit = bruteHits[ ray ];
+
+			r3dMeshBVH::IntersectRayBruteForce( mesh->VertexPositions, mesh->Indices, mesh->NumIndices / 3, origins[ ray / PACKET_SIZE ], dirs[ ray ], hit );
+		}
+
+		bruteTime += ( r3dGetTime() - t0 ) * raysPerMesh / bruteRays[ m ];
+		numBruteRays += bruteRays[ m ];
+	}
+
+	// single rays
+
+	float t0 = r3dGetTime();
+
+	for( int m = 0; m < numMeshes; m ++ )
+	{
+		const r3dMeshBVH* tree = trees[ m ];
+
+		for( int r = 0; r < raysPerMesh; r ++ )
+		{
+			int ray = m * raysPerMesh + r;
+			tree->IntersectRay( origins[ ray / PACKET_SIZE ], dirs[ ray ], singleHits[ ray ] );
+		}
+	}
+
+	float singleTime = r3dGetTime() - t0;
+
+	// packets
+
+	t0 = r3dGetTime();
+
+	for( int m = 0; m < numMeshes; m ++ )
+	{
+		const r3dMeshBVH* tree = trees[ m ];
+
+		for( int p = 0; p < packetsPerMesh; p ++ )
+		{
+			int packet = m * packetsPerMesh + p;
+			tree->IntersectPacket( origins[ packet ], &dirs[ packet * PACKET_SIZE ], PACKET_SIZE, &packetHits[ packet * PACKET_SIZE ] );
+		}
+	}
+
+	float packetTime = r3dGetTime() - t0;
+
+	// any hit
+
+	t0 = r3dGetTime();
+
+	for( int m = 0; m < numMeshes; m ++ )
+	{
+		const r3dMeshBVH* tree = trees[ m ];
+
+		for( int r = 0; r < raysPerMesh; r ++ )
+		{
+			int ray = m * raysPerMesh + r;
+
+			r3dMeshRayHit hit;
+			anyHits[ ray ] = tree->IntersectRayAny( origins[ ray / PACKET_SIZE ], dirs[ ray ], hit );
+		}
+	}
+
+	float anyTime = r3dGetTime() - t0;
+
+	// checks
+
+	int numHits = 0, bruteMismatches = 0, packetMismatches = 0, anyMismatches = 0;
+
+	for( int m = 0; m < numMeshes; m ++ )
+	{
+		for( int r = 0; r < raysPerMesh; r ++ )
+		{
+			int ray = m * raysPerMesh + r;
+
+			const r3dMeshRayHit& single = singleHits[ ray ];
+			const r3dMeshRayHit& packet = packetHits[ ray ];
+
+			if( single.Face >= 0 )
+				numHits ++;
+
+			if( r < bruteRays[ m ] && !IsSameHit( single, bruteHits[ ray ] ) )
+				bruteMismatches ++;
+
+			// same arithmetic, must match exactly
+			if( single.Face != packet.Face || single.T != packet.T )
+				packetMismatches ++;
+
+			if( ( anyHits[ ray ] != 0 ) != ( single.Face >= 0 ) )
+				anyMismatches ++;
+		}
+	}
+
+	for( int m = 0; m < numMeshes; m ++ )
+	{
+		SAFE_DELETE( trees[ m ] );
+	}
+
+	double bruteRate = RaysPerSecond( totalRays, bruteTime );
+	double singleRate = RaysPerSecond( totalRays, singleTime );
+	double packetRate = RaysPerSecond( totalRays, packetTime );
+	double anyRate = RaysPerSecond( totalRays, anyTime );
+
+	r3dOutToLog( "build: %.1f ms, %d nodes, %d quads, %.2f MB ( %.1f bytes per triangle )\n", buildTime * 1000.f, numNodes, numQuads, memory / 1024.f / 1024.f, (float)memory / totalTriangles );
+	r3dOutToLog( "brute force: %.0f rays traced, %.3f Mrays/s\n", numBruteRays, bruteRate * 1e-6 );
+	r3dOutToLog( "bvh: %d rays, %.3f Mrays/s, %.1fx brute force\n", totalRays, singleRate * 1e-6, singleRate / bruteRate );
+	r3dOutToLog( "bvh packets of %d: %.3f Mrays/s, %.1fx brute force\n", PACKET_SIZE, packetRate * 1e-6, packetRate / bruteRate );
+	r3dOutToLog( "bvh any hit: %.3f Mrays/s, %.1fx brute force\n", anyRate * 1e-6, anyRate / bruteRate );
+	r3dOutToLog( "checks: %.1f%% rays hit, %d differ from brute force, %d packet rays differ from single ones, %d any hit results differ\n",
+		numHits * 100.f / totalRays, bruteMismatches, packetMismatches, anyMismatches );
+}
+
+#endif
@@ -8,13 +8,30 @@
 #include "RakNetStatistics.h"
 #include "GetTime.h"
 
+#include <algorithm>
+
 	int	_r3d_Network_DoLog = 0;
 
+// packets queued for one destination and ordering channel
+struct r3dNetBatch
+{
+	DWORD		peerId;
+	PacketReliability reliability;
+	int		channel;
+	int		numPackets;
+	int		size;
+	BYTE		data[r3dNetwork::MAX_BATCH_SIZE];
+};
+
 class r3dNetworkImpl
 {
   public:
 	r3dNetworkImpl();
+	~r3dNetworkImpl();
 	
+	// unordered packets have own batch after all channels
+	enum { NUM_BATCH_SLOTS = r3dNetwork::MAX_NET_CHANNELS + 1 };
+
 	const char*	networkName;
 
 	RakNet::RakPeerInterface* peer;
@@ -26,6 +43,15 @@ class r3dNetworkImpl
 	RakNet::RakNetStatistics stat_;
 
 	r3dNetCallback*	callback;
+
+	r3dNetSendStats* sendTotal;
+	r3dNetBatch**	batches;	// [maxPeers * NUM_BATCH_SLOTS], allocated on first use
+	r3dTL::TArray<r3dNetBatch*> openBatches;
+
+	void		Send(DWORD peerId, const char* data, int size, PacketReliability reliability, int channel);
+	void		QueueSend(DWORD peerId, const char* data, int size, PacketReliability reliability, int channel);
+	void		FlushBatch(r3dNetBatch* b);
+	void		FlushBatches();
 };
 
 r3dNetworkImpl::r3dNetworkImpl()
@@ -40,17 +66,128 @@ r3dNetworkImpl::r3dNetworkImpl()
   callback     = NULL;
   
   memset(&stat_, 0, sizeof(stat_));
+
+  sendTotal    = NULL;
+  batches      = NULL;
+}
+
+r3dNetworkImpl::~r3dNetworkImpl()
+{
+  if(batches)
+  {
+    for(DWORD i=0; i<maxPeers * NUM_BATCH_SLOTS; i++)
+      SAFE_DELETE(batches[i]);
+    SAFE_DELETE_ARRAY(batches);
+  }
+}
+
+void r3dNetworkImpl::Send(DWORD peerId, const char* data, int size, PacketReliability reliability, int channel)
+{
+  peer->Send(data, size, HIGH_PRIORITY, reliability, (char)channel, peerData[peerId], false);
+
+  sendTotal->messages++;
+  sendTotal->messageBytes += size;
+}
+
+void r3dNetworkImpl::QueueSend(DWORD peerId, const char* data, int size, PacketReliability reliability, int channel)
+{
+  // ordered and sequenced packets of a channel share RakNet ordering index, so they must be
+  // sent in queue order - channel has single batch, switching reliability flushes it.
+  const int slot = reliability == RELIABLE ? r3dNetwork::MAX_NET_CHANNELS : channel;
+
+  if(batches == NULL)
+  {
+    batches = game_new r3dNetBatch*[maxPeers * NUM_BATCH_SLOTS];
+    memset(batches, 0, sizeof(r3dNetBatch*) * maxPeers * NUM_BATCH_SLOTS);
+  }
+
+  r3dNetBatch*& b = batches[peerId * NUM_BATCH_SLOTS + slot];
+  if(b == NULL)
+  {
+    b = game_new r3dNetBatch;
+    b->peerId     = peerId;
+    b->numPackets = 0;
+    b->size       = 0;
+  }
+
+  // packets too big for batch go as is, after everything queued before them
+  const bool noBatch = size > 0xFF;
+
+  if(b->numPackets && (noBatch || b->reliability != reliability || b->size + 1 + size > r3dNetwork::MAX_BATCH_SIZE))
+    FlushBatch(b);
+
+  if(noBatch)
+  {
+    Send(peerId, data, size, reliability, channel);
+    return;
+  }
+
+  if(b->numPackets == 0)
+  {
+    b->reliability = reliability;
+    b->channel     = channel;
+    b->data[0]     = r3dNetwork::RAKNET_BATCH_PACKET;
+    b->size        = 1;
+    openBatches.PushBack(b);
+  }
+
+  b->data[b->size] = (BYTE)size;
+  memcpy(&b->data[b->size + 1], data, size);
+  b->size += 1 + size;
+  b->numPackets++;
+}
+
+void r3dNetworkImpl::FlushBatch(r3dNetBatch* b)
+{
+  r3d_assert(b->numPackets);
+
+  // single packet is sent without batch header
+  if(b->numPackets == 1)
+    Send(b->peerId, (const char*)&b->data[2], b->data[1], b->reliability, b->channel);
+  else
+    Send(b->peerId, (const char*)b->data, b->size, b->reliability, b->channel);
+
+  b->numPackets = 0;
+  b->size       = 0;
+}
+
+void r3dNetworkImpl::FlushBatches()
+{
+  for(uint32_t i=0; i<openBatches.Count(); i++)
+  {
+    // can be flushed already by reliability switch or overflow
+    if(openBatches[i]->numPackets)
+      FlushBatch(openBatches[i]);
+  }
+  openBatches.Clear();
 }
 
 r3dNetwork::r3dNetwork()
 {
   impl = NULL;
   dumpStats_ = 0;
+  batchSends_ = false;
+
+  memset(&sendTotal_, 0, sizeof(sendTotal_));
+  memset(&sendPerSec_, 0, sizeof(sendPerSec_));
+  memset(&lastSecTotal_, 0, sizeof(lastSecTotal_));
+  lastSecTime_ = 0;
+
+  captureFile_ = NULL;
+  captureStartTime_ = 0;
+  capturePackets_ = 0;
+  captureBytes_ = 0;
+
+  for(int i=0; i<256; i++) {
+    packetClass_[i].delivery = R3D_NET_RELIABLE_ORDERED;
+    packetClass_[i].channel  = 0;
+  }
 }
 
 r3dNetwork::~r3dNetwork()
 {
   if(impl) r3dOutToLog("!!!! r3dNetwork %s is not deinitialized\n", impl->networkName);
+  StopCapture();
 }
 
 int r3dNetwork::Initialize(r3dNetCallback* callback, const char* networkName)
@@ -68,6 +205,7 @@ int r3dNetwork::Initialize(r3dNetCallback* callback, const char* networkName)
   impl->networkName = networkName;
   impl->callback    = callback;
   impl->callback->net_ = this;
+  impl->sendTotal   = &sendTotal_;
   
   return 1;
 }
@@ -81,6 +219,7 @@ void r3dNetwork::Deinitialize()
 
   if(impl->peer)
   {
+    FlushBatches();
     impl->peer->Shutdown(1000);
     RakNet::RakPeerInterface::DestroyInstance(impl->peer);
     impl->peer = NULL;
@@ -91,6 +230,8 @@ void r3dNetwork::Deinitialize()
     char statbuf[1024 * 8];
     RakNet::StatisticsToString(&impl->stat_, statbuf, 2);
     r3dOutToLog("r3dNetwork %s Global Stats:\n%s", impl->networkName, statbuf);
+    r3dOutToLog("r3dNetwork %s sent %u packets, %u bytes as %u messages, %u bytes\n", impl->networkName, 
+      sendTotal_.packets, sendTotal_.bytes, sendTotal_.messages, sendTotal_.messageBytes);
   }
 
   SAFE_DELETE_ARRAY(impl->peerData);
@@ -106,6 +247,9 @@ void r3dNetwork::Update()
 {
   if(!impl) 
     return;
+
+  // whatever was queued after last flush
+  FlushBatches();
     
   RakNet::Packet* p = NULL;
   while((p = impl->peer->Receive()) != NULL)
@@ -227,7 +371,13 @@ void r3dNetwork::Update()
 	DWORD peerId = p->systemAddress.systemIndex;
 	r3d_assert(peerId < impl->maxPeers);
 
-        impl->callback->OnNetData(peerId, (const r3dNetPacketHeader*)data, len);
+        if(data[0] == RAKNET_BATCH_PACKET)
+        {
+          ReceiveBatch(peerId, data, len);
+          break;
+        }
+
+        ReceiveData(peerId, data, len);
         break;
       }
     }
@@ -243,9 +393,107 @@ void r3dNetwork::Update()
       lastPing_ = ping;
   }
 
+  // send rates over last second
+  const float curTime = r3dGetTime();
+  if(impl && curTime >= lastSecTime_ + 1.0f)
+  {
+    sendPerSec_.packets      = sendTotal_.packets      - lastSecTotal_.packets;
+    sendPerSec_.bytes        = sendTotal_.bytes        - lastSecTotal_.bytes;
+    sendPerSec_.messages     = sendTotal_.messages     - lastSecTotal_.messages;
+    sendPerSec_.messageBytes = sendTotal_.messageBytes - lastSecTotal_.messageBytes;
+
+    RakNet::RakNetStatistics rns;
+    memset(&rns, 0, sizeof(rns));
+    impl->peer->GetStatistics(RakNet::UNASSIGNED_SYSTEM_ADDRESS, &rns);
+    sendPerSec_.wireBytes    = (DWORD)rns.valueOverLastSecond[RakNet::ACTUAL_BYTES_SENT];
+
+    lastSecTotal_ = sendTotal_;
+    lastSecTime_  = curTime;
+  }
+
   return;
 }
 
+void r3dNetwork::ReceiveBatch(DWORD peerId, const BYTE* data, int len)
+{
+  // [RAKNET_BATCH_PACKET] ([size] [packet])...
+  int pos = 1;
+  while(pos < len)
+  {
+    const int size = data[pos++];
+    if(size < (int)sizeof(r3dNetPacketHeader) || pos + size > len || data[pos] != RAKNET_USER_PACKET)
+    {
+      r3dOutToLog("!!!! r3dNetwork %s: bad batch from peer%d, %d bytes\n", impl->networkName, peerId, len);
+      return;
+    }
+
+    ReceiveData(peerId, &data[pos], size);
+    pos += size;
+
+    // callback can disconnect us
+    if(!impl)
+      return;
+  }
+}
+
+void r3dNetwork::ReceiveData(DWORD peerId, const BYTE* data, int len)
+{
+  if(captureFile_)
+  {
+    r3dNetCaptureRecord rec;
+    rec.timeMs = (DWORD)((r3dGetTime() - captureStartTime_) * 1000.0f);
+    rec.peerId = (WORD)peerId;
+    rec.size   = len;
+    fwrite(&rec, sizeof(rec), 1, captureFile_);
+    fwrite(data, len, 1, captureFile_);
+
+    capturePackets_++;
+    captureBytes_ += len;
+  }
+
+  impl->callback->OnNetData(peerId, (const r3dNetPacketHeader*)data, len);
+}
+
+bool r3dNetwork::StartCapture(const char* fileName, DWORD userVersion)
+{
+  StopCapture();
+
+  captureFile_ = fopen(fileName, "wb");
+  if(!captureFile_)
+  {
+    r3dOutToLog("r3dNetwork: can't create capture file %s\n", fileName);
+    return false;
+  }
+
+  // packets are small, don't hit disk for every one of them
+  setvbuf(captureFile_, NULL, _IOFBF, 256 * 1024);
+
+  r3dNetCaptureHeader hdr;
+  hdr.magic       = r3dNetCaptureHeader::MAGIC;
+  hdr.version     = r3dNetCaptureHeader::VERSION;
+  hdr.userVersion = userVersion;
+  fwrite(&hdr, sizeof(hdr), 1, captureFile_);
+
+  captureStartTime_ = r3dGetTime();
+  capturePackets_   = 0;
+  captureBytes_     = 0;
+
+  r3dOutToLog("r3dNetwork: capturing received packets to %s\n", fileName);
+  return true;
+}
+
+void r3dNetwork::StopCapture()
+{
+  if(!captureFile_)
+    return;
+
+  fclose(captureFile_);
+  captureFile_ = NULL;
+
+  r3dOutToLog("r3dNetwork: capture stopped, %u packets, %u bytes in %.1f sec\n", 
+    capturePackets_, captureBytes_, r3dGetTime() - captureStartTime_);
+}
+
 static int RakNet_FillBindAddresses(RakNet::SocketDescriptor* binds, int port, DWORD* firstIP)
 {
   // get all computer available ip addresses
@@ -432,6 +680,36 @@ void r3dNetwork::DisconnectPeer(DWORD peerId, bool immidiateDisconnect)
   impl->peer->CloseConnection(impl->peerData[peerId], !immidiateDisconnect);
 }
 
+void r3dNetwork::SetPacketClass(int eventId, r3dNetDelivery delivery, int channel)
+{
+  r3d_assert(eventId >= r3dNetwork::FIRST_FREE_PACKET_ID && eventId < 0xFF);
+  r3d_assert(channel >= 0 && channel < MAX_NET_CHANNELS);
+
+  packetClass_[eventId].delivery = (BYTE)delivery;
+  packetClass_[eventId].channel  = (BYTE)channel;
+}
+
+static PacketReliability r3dNet_GetReliability(const r3dNetPacketClass& pc, bool isReliable)
+{
+  /*NOTE from RakNet.
+    The sequenced messages will be in order, and the ordered messages will be in order. 
+    However, that doesn't mean that all messages will be in order because they are independent sets.
+    
+    (RakNet 4: sequenced packet is not returned before ordered packets of same channel sent before it, 
+     and is dropped if ordered packet sent after it was already returned)
+  */  
+  if(!isReliable)
+    return UNRELIABLE_SEQUENCED;
+
+  switch(pc.delivery)
+  {
+    case R3D_NET_RELIABLE_UNORDERED:   return RELIABLE;
+    case R3D_NET_UNRELIABLE_SEQUENCED: return UNRELIABLE_SEQUENCED;
+  }
+
+  return RELIABLE_ORDERED;
+}
+
 void r3dNetwork::SendToHost(const r3dNetPacketHeader* data, int dataSize, bool isReliable)
 {
   r3d_assert(impl && impl->peer);
@@ -441,14 +719,14 @@ void r3dNetwork::SendToHost(const r3dNetPacketHeader* data, int dataSize, bool i
   // make sure our logical packet id is valid
   r3d_assert(data->EventID >= r3dNetwork::FIRST_FREE_PACKET_ID);
   
-  /*NOTE from RakNet.
-    The sequenced messages will be in order, and the ordered messages will be in order. 
-    However, that doesn't mean that all messages will be in order because they are independent sets.
-  */  
-
-  //PacketPriority priority = isReliable ? HIGH_PRIORITY : MEDIUM_PRIORITY;
-  //PacketReliability reliability = isReliable ? RELIABLE_ORDERED : UNRELIABLE_SEQUENCED;
-  impl->peer->Send((const char*)data, dataSize, HIGH_PRIORITY, RELIABLE_ORDERED, 0, impl->peerData[0], false);
+  sendTotal_.packets++;
+  sendTotal_.bytes += dataSize;
+
+  const r3dNetPacketClass& pc = packetClass_[data->EventID];
+  if(batchSends_)
+    impl->QueueSend(0, (const char*)data, dataSize, r3dNet_GetReliability(pc, isReliable), pc.channel);
+  else
+    impl->Send(0, (const char*)data, dataSize, r3dNet_GetReliability(pc, isReliable), pc.channel);
    
   //r3dOutToLog("r3dNetwork: send to host, len:%d, %08x, %08x\n", dataSize, ((DWORD*)data)[0], ((DWORD*)data)[1]);
 
@@ -464,13 +742,24 @@ void r3dNetwork::SendToPeer(const r3dNetPacketHeader* data, int dataSize, DWORD
   // make sure our logical packet id is valid
   r3d_assert(data->EventID >= r3dNetwork::FIRST_FREE_PACKET_ID);
 
-  //PacketPriority priority = isReliable ? HIGH_PRIORITY : MEDIUM_PRIORITY;
-  //PacketReliability reliability = isReliable ? RELIABLE_ORDERED : UNRELIABLE_SEQUENCED;
-  impl->peer->Send((const char*)data, dataSize, HIGH_PRIORITY, RELIABLE_ORDERED, 0, impl->peerData[peerId], false);
+  sendTotal_.packets++;
+  sendTotal_.bytes += dataSize;
+
+  const r3dNetPacketClass& pc = packetClass_[data->EventID];
+  if(batchSends_)
+    impl->QueueSend(peerId, (const char*)data, dataSize, r3dNet_GetReliability(pc, isReliable), pc.channel);
+  else
+    impl->Send(peerId, (const char*)data, dataSize, r3dNet_GetReliability(pc, isReliable), pc.channel);
   
   return;
 }
 
+void r3dNetwork::FlushBatches()
+{
+  if(impl && impl->peer)
+    impl->FlushBatches();
+}
+
 void r3dNetwork::SendToAddress(char *data, int dataSize, char *address, unsigned short port)
 {
 	r3d_assert(impl && impl->peer);
@@ -501,3 +790,297 @@ void r3dNetwork::SendToAddress(char *data, int dataSize, char *address, unsigned
 
 	return;
 }
+
+#ifndef FINAL_BUILD
+
+//
+// loopback benchmark: deterministic simulation of one direction of a connection.
+// every packet goes in its own datagram, lost reliable packets are resent after fixed RTO,
+// receiver follows RakNet ReliabilityLayer ordering/sequencing rules per channel.
+//
+
+namespace
+{
+  struct netBenchPacket
+  {
+    int		traffic;
+    int		delivery;
+    int		channel;
+    int		orderingIndex;
+    int		sequencingIndex;
+    int		sendTime;
+    int		arriveTime;	// -1 - lost
+    int		deliverTime;	// -1 - not delivered to user
+    int		createIdx;	// last create packet of sender object sent before this one, -1 if none
+    bool	early;		// delivered before its create packet
+  };
+
+  struct netBenchChannel
+  {
+    int		readIndex;
+    int		highestSeq;
+    r3dTL::TArray<int> pending;	// arrived with ordering index ahead of readIndex
+  };
+
+  struct netBenchArriveLess
+  {
+    const netBenchPacket* pkts;
+    bool operator()(int a, int b) const {
+      if(pkts[a].arriveTime != pkts[b].arriveTime)
+        return pkts[a].arriveTime < pkts[b].arriveTime;
+      return a < b;
+    }
+  };
+
+  DWORD netBench_Rand(DWORD& seed)
+  {
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+  }
+
+  const char* netBench_DeliveryName(int delivery)
+  {
+    switch(delivery)
+    {
+      case R3D_NET_RELIABLE_UNORDERED:   return "unordered";
+      case R3D_NET_UNRELIABLE_SEQUENCED: return "sequenced";
+    }
+    return "ordered";
+  }
+
+  // return to user ordered packet at readIndex and everything that waited for it
+  void netBench_Drain(netBenchPacket* pkts, netBenchChannel& ch, int curTime)
+  {
+    for(;;)
+    {
+      // sequenced packets sent after ordered readIndex-1 go first, in sequence order
+      int orderedIdx = -1;
+      for(;;)
+      {
+        int best = -1;
+        for(uint32_t i=0; i<ch.pending.Count(); i++)
+        {
+          const netBenchPacket& p = pkts[ch.pending[i]];
+          if(p.orderingIndex != ch.readIndex)
+            continue;
+          if(p.delivery != R3D_NET_UNRELIABLE_SEQUENCED) {
+            orderedIdx = i;
+            continue;
+          }
+          if(best == -1 || p.sequencingIndex < pkts[ch.pending[best]].sequencingIndex)
+            best = i;
+        }
+        if(best == -1)
+          break;
+
+        netBenchPacket& p = pkts[ch.pending[best]];
+        p.deliverTime = curTime;
+        ch.highestSeq = p.sequencingIndex;
+        ch.pending.Erase(best);
+        orderedIdx = -1;
+      }
+
+      if(orderedIdx == -1)
+        return;
+
+      pkts[ch.pending[orderedIdx]].deliverTime = curTime;
+      ch.pending.Erase(orderedIdx);
+      ch.readIndex++;
+      ch.highestSeq = 0;
+    }
+  }
+
+  void netBench_Receive(netBenchPacket* pkts, int idx, netBenchChannel& ch)
+  {
+    netBenchPacket& p = pkts[idx];
+
+    if(p.delivery == R3D_NET_RELIABLE_UNORDERED) {
+      p.deliverTime = p.arriveTime;
+      return;
+    }
+
+    if(p.orderingIndex == ch.readIndex)
+    {
+      if(p.delivery == R3D_NET_UNRELIABLE_SEQUENCED)
+      {
+        // older than already returned - dropped
+        if(p.sequencingIndex >= ch.highestSeq) {
+          p.deliverTime = p.arriveTime;
+          ch.highestSeq = p.sequencingIndex + 1;
+        }
+        return;
+      }
+
+      p.deliverTime = p.arriveTime;
+      ch.readIndex++;
+      ch.highestSeq = 0;
+      netBench_Drain(pkts, ch, p.arriveTime);
+      return;
+    }
+
+    if(p.orderingIndex > ch.readIndex)
+      ch.pending.PushBack(idx);
+
+    // else sequenced packet sent before already returned ordered packet - dropped
+  }
+}
+
+void r3dNetwork::RunLoopbackBenchmark(const r3dNetBenchTraffic* traffic, int numTraffic, float packetLoss, int latencyMs, int seconds) const
+{
+  r3d_assert(numTraffic > 0);
+
+  const int jitterMs = latencyMs / 5;
+  const int rtoMs    = latencyMs * 2 + 30;
+  const int lossRand = (int)(R3D_CLAMP(packetLoss, 0.0f, 1.0f) * 65536.0f);
+
+  r3dOutToLog("r3dNetwork: loopback benchmark, %d sec, %.1f%% loss, %d+%d ms latency, %d ms rto\n", seconds, packetLoss * 100.0f, latencyMs, jitterMs, rtoMs); CLOG_INDENT;
+
+  r3dTL::TArray<netBenchPacket> pkts;
+  r3dTL::TArray<int> order;
+  r3dTL::TArray<int> lat;
+
+  for(int mode=0; mode<2; mode++)
+  {
+    r3dOutToLog("%s:\n", mode == 0 ? "all reliable ordered, channel 0" : "packet classes"); CLOG_INDENT;
+
+    DWORD seed = 0x1234567;
+    int orderedWrite[MAX_NET_CHANNELS] = {0};
+    int seqWrite[MAX_NET_CHANNELS]     = {0};
+    int lastSent[256];
+    for(int i=0; i<256; i++)
+      lastSent[i] = -1;
+
+    // sender
+    pkts.Clear();
+    for(int t=0; t<seconds * 1000; t++)
+    {
+      for(int i=0; i<numTraffic; i++)
+      {
+        const int period = R3D_MAX(traffic[i].periodMs, 1);
+        const int phase  = (i * 7) % period;
+        if(t < phase || (t - phase) % period)
+          continue;
+
+        netBenchPacket p;
+        p.traffic         = i;
+        p.delivery        = mode == 0 ? R3D_NET_RELIABLE_ORDERED : packetClass_[traffic[i].eventId].delivery;
+        p.channel         = mode == 0 ? 0 : packetClass_[traffic[i].eventId].channel;
+        p.orderingIndex   = 0;
+        p.sequencingIndex = 0;
+        p.sendTime        = t;
+        p.arriveTime      = -1;
+        p.deliverTime     = -1;
+        p.createIdx       = traffic[i].createdBy >= 0 ? lastSent[traffic[i].createdBy] : -1;
+        p.early           = false;
+
+        if(p.delivery == R3D_NET_UNRELIABLE_SEQUENCED) {
+          p.orderingIndex   = orderedWrite[p.channel];
+          p.sequencingIndex = seqWrite[p.channel]++;
+        } else if(p.delivery == R3D_NET_RELIABLE_ORDERED) {
+          p.orderingIndex   = orderedWrite[p.channel]++;
+          seqWrite[p.channel] = 0;
+        }
+
+        // transmit, resending reliable packets until they get through
+        for(int txTime = t, tries = 0; tries < 50; tries++, txTime += rtoMs)
+        {
+          if((int)(netBench_Rand(seed) & 0xFFFF) >= lossRand) {
+            p.arriveTime = txTime + latencyMs + (int)(netBench_Rand(seed) % (jitterMs + 1));
+            break;
+          }
+          if(p.delivery == R3D_NET_UNRELIABLE_SEQUENCED)
+            break;
+        }
+
+        lastSent[i] = pkts.Count();
+        pkts.PushBack(p);
+      }
+    }
+
+    // receiver
+    order.Clear();
+    for(uint32_t i=0; i<pkts.Count(); i++) {
+      if(pkts[i].arriveTime >= 0)
+        order.PushBack(i);
+    }
+    if(order.Count())
+    {
+      netBenchArriveLess pred;
+      pred.pkts = &pkts[0];
+      std::sort(&order[0], &order[0] + order.Count(), pred);
+    }
+
+    netBenchChannel* channels = game_new netBenchChannel[MAX_NET_CHANNELS];
+    for(int i=0; i<MAX_NET_CHANNELS; i++) {
+      channels[i].readIndex  = 0;
+      channels[i].highestSeq = 0;
+    }
+    for(uint32_t i=0; i<order.Count(); i++) {
+      netBench_Receive(&pkts[0], order[i], channels[pkts[order[i]].channel]);
+    }
+    SAFE_DELETE_ARRAY(channels);
+
+    // packets that overtook create of their object wait for it or are dropped
+    for(uint32_t i=0; i<pkts.Count(); i++)
+    {
+      netBenchPacket& p = pkts[i];
+      if(p.createIdx < 0 || p.deliverTime < 0)
+        continue;
+
+      const int createTime = pkts[p.createIdx].deliverTime;
+      if(createTime >= 0 && createTime <= p.deliverTime)
+        continue;
+
+      p.early       = true;
+      p.deliverTime = traffic[p.traffic].keptIfEarly ? createTime : -1;
+    }
+
+    // report
+    for(int i=0; i<numTraffic; i++)
+    {
+      int sent = 0, lost = 0, early = 0, holMax = 0;
+      double latSum = 0, holSum = 0;
+      int delivery = R3D_NET_RELIABLE_ORDERED, channel = 0;
+
+      lat.Clear();
+      for(uint32_t k=0; k<pkts.Count(); k++)
+      {
+        const netBenchPacket& p = pkts[k];
+        if(p.traffic != i)
+          continue;
+
+        sent++;
+        delivery = p.delivery;
+        channel  = p.channel;
+        if(p.early)
+          early++;
+        if(p.deliverTime < 0) {
+          lost++;
+          continue;
+        }
+
+        // head-of-line: time packet spent in receiver waiting for other packets
+        const int hol = p.deliverTime - p.arriveTime;
+        holSum += hol;
+        holMax  = R3D_MAX(holMax, hol);
+        latSum += p.deliverTime - p.sendTime;
+        lat.PushBack(p.deliverTime - p.sendTime);
+      }
+
+      const int delivered = (int)lat.Count();
+      int p99 = 0;
+      if(delivered) {
+        std::sort(&lat[0], &lat[0] + delivered);
+        p99 = lat[R3D_MIN(delivered - 1, delivered * 99 / 100)];
+      }
+
+      r3dOutToLog("%-24s %-9s ch%-2d sent:%5d dropped:%4d early:%4d %-5s latency avg:%6.1f p99:%5d  hol avg:%6.1f max:%5d\n",
+        traffic[i].name, netBench_DeliveryName(delivery), channel, sent, lost,
+        early, early ? (traffic[i].keptIfEarly ? "kept" : "lost") : "",
+        delivered ? latSum / delivered : 0.0, p99,
+        delivered ? holSum / delivered : 0.0, holMax);
+    }
+  }
+}
+
+#endif // FINAL_BUILD
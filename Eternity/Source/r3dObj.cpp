@@ -9,6 +9,7 @@
 #include "r3dDeviceQueue.h"
 #include "r3dVCacheOptimize.h"
 #include "r3dVCacheAnalyze.h"
+#include "r3dMeshBVH.h"
 
 int r3dMeshObject_SkipFillBuffers = 0;
 extern	r3dgfxMap(DWORD, r3dSTLString) _r3d_mVBufferMap;
@@ -438,6 +439,7 @@ r3dMesh::r3dMesh( int UsePreciseVertices )
 	m_Loaded = 0 ;
 	m_Drawable = 0 ;
 	numInstancesInVB = 0;
+	m_RayBVH = NULL ;
 	VertexPositions = NULL;
 
 	Indices			= NULL;
@@ -516,6 +518,8 @@ void r3dMesh::Unload()
 
 	MeshUnloaded ( FileName.c_str () );
 
+	ReleaseRayBVH();
+
 	SAFE_DELETE_ARRAY(VertexPositions);
 	SAFE_DELETE_ARRAY(Indices);
 
@@ -617,6 +621,9 @@ void r3dMesh::RecalcBoundBox()
 {
 	r3d_assert( m_Loaded ) ;
 
+	// geometry may have changed
+	ReleaseRayBVH();
+
 	r3dPoint3D *WV = VertexPositions;
 	r3dPoint3D *Sz = &VertexPositions[NumVertices];
 
@@ -2692,69 +2699,112 @@ int intersect_triangle_floats_nocull(float orig[3], float dir[3],
 #undef DOT
 #undef CROSS
 
+namespace
+{
+	// ContainsRay is called for the same few objects again and again (bullets, AI line of sight),
+	// so inverse rotations are cached per thread
+	struct RayInverseCacheEntry
+	{
+		float	Rotation[ 16 ];
+		float	Inverse[ 16 ];
+		int		Valid;
+	};
+
+	const int RAY_INVERSE_CACHE_SIZE = 16;
+
+	__declspec(thread) RayInverseCacheEntry tRayInverseCache[ RAY_INVERSE_CACHE_SIZE ];
+
+	const D3DXMATRIX& GetRayInverseRotation( const D3DXMATRIX& rotation )
+	{
+		const uint32_t* bits = (const uint32_t*)&rotation;
+
+		uint32_t hash = 0;
+		for( int i = 0; i < 16; i ++ )
+		{
+			hash = hash * 31 + bits[ i ];
+		}
+
+		RayInverseCacheEntry& entry = tRayInverseCache[ ( hash ^ ( hash >> 16 ) ) & ( RAY_INVERSE_CACHE_SIZE - 1 ) ];
+
+		if( !entry.Valid || memcmp( entry.Rotation, &rotation, sizeof entry.Rotation ) )
+		{
+			D3DXMatrixInverse( (D3DXMATRIX*)entry.Inverse, NULL, &rotation );
+
+			memcpy( entry.Rotation, &rotation, sizeof entry.Rotation );
+			entry.Valid = 1;
+		}
+
+		return *(const D3DXMATRIX*)entry.Inverse;
+	}
+}
+
+// world is rotation followed by translation to pos, so its inverse is translation back followed by inverse rotation
+static void mesh_GetLocalRay(r3dPoint3D& vLocalStart, r3dPoint3D& vLocalRay, const r3dPoint3D& vStart, const r3dPoint3D& vRay, const r3dVector& pos, const D3DXMATRIX& rotation)
+{
+	const D3DXMATRIX& mrI = GetRayInverseRotation(rotation);
+
+	r3dPoint3D vMoved = vStart - pos;
+	D3DXVec3TransformNormal(vLocalRay.d3dx(), vRay.d3dx(), &mrI);
+	D3DXVec3TransformCoord(vLocalStart.d3dx(), vMoved.d3dx(), &mrI);
+}
+
+const r3dMeshBVH* r3dMesh::GetRayBVH()
+{
+	if( r3dMeshBVH* bvh = m_RayBVH )
+		return bvh;
+
+	// tree is kept until geometry changes, so don't build it from mesh that is still loading
+	if( !m_Loaded || NumIndices / 3 < r3dMeshBVH::MIN_TRIANGLES || !VertexPositions || !Indices )
+		return NULL;
+
+	r3dMeshBVH* bvh = gfx_new r3dMeshBVH;
+	bvh->Build( VertexPositions, Indices, NumIndices / 3 );
+
+	// other thread may have built it at the same time
+	if( InterlockedCompareExchangePointer( (PVOID volatile*)&m_RayBVH, bvh, NULL ) != NULL )
+	{
+		SAFE_DELETE( bvh );
+		return m_RayBVH;
+	}
+
+	return bvh;
+}
+
+void r3dMesh::ReleaseRayBVH()
+{
+	r3dMeshBVH* bvh = m_RayBVH;
+	m_RayBVH = NULL;
+
+	SAFE_DELETE( bvh );
+}
+
 BOOL r3dMesh::ContainsRay(const r3dPoint3D& vStart, const r3dPoint3D& vRay, float RayLen, float *ClipDist, r3dMaterial **material, const r3dVector& pos, const D3DXMATRIX& rotation, int * OutMinFace /*= NULL*/ )
 {
 	if(!NumVertices) return FALSE;
 
 	R3DPROFILE_FUNCTION( "r3dMesh::ContainsRay" ) ;
 
-	float 	MinClipDist = 9999999;
-	int		MinFace     = -1;
 	*material = 0;
 
-	//NOTE: add caching of world matrix after changing RotateMatrix
-
-	D3DXMATRIX  mWorld;
-	mesh_CreateWorldMatrix(mWorld, vPivot, pos, r3dPoint3D(1, 1, 1), rotation);
-
-	D3DXMATRIX mwI, mrI;
-	D3DXMatrixInverse(&mwI, NULL, &mWorld);
-	D3DXMatrixInverse(&mrI, NULL, &rotation);
-
 	// transform ray to object local space
 	r3dPoint3D vRay1;
 	r3dPoint3D vStart1;
-	D3DXVec3TransformNormal(vRay1.d3dx(),  vRay.d3dx(),   &mrI);
-	D3DXVec3TransformCoord(vStart1.d3dx(), vStart.d3dx(), &mwI);
-
-	for(int i=0; i<NumIndices/3; i++) 
-	{
-		float t, u, v;   
-		if(!intersect_triangle_floats_cull((float *)vStart1, (float *)vRay1, (float *)&VertexPositions[Indices[i*3+0]], (float *)&VertexPositions[Indices[i*3+1]], (float *)&VertexPositions[Indices[i*3+2]], &t, &u, &v)) 
-			continue;
-
-		/*
-		if(t<0) {
-		r3dOutToLog("r3dPoint3D vStart(%f, %f, %f)\n", vStart1.X, vStart1.Y, vStart1.Z);
-		r3dOutToLog("r3dPoint3D vRay1(%f, %f, %f)\n", vRay1.X, vRay1.Y, vRay1.Z);
-		r3dOutToLog("r3dPoint3D f.Vertices[0](%f, %f, %f)\n", f.Vertices[0].X, f.Vertices[0].Y, f.Vertices[0].Z);
-		r3dOutToLog("r3dPoint3D f.Vertices[1](%f, %f, %f)\n", f.Vertices[1].X, f.Vertices[1].Y, f.Vertices[1].Z);
-		r3dOutToLog("r3dPoint3D f.Vertices[2](%f, %f, %f)\n", f.Vertices[2].X, f.Vertices[2].Y, f.Vertices[2].Z);
-		intersect_triangle_floats_cull((float *)vStart1, (float *)vRay1, (float *)*f.Vertices[0], (float *)*f.Vertices[1], (float *)*f.Vertices[2], &t, &u, &v);
-		intersect_triangle_floats_nocull((float *)vStart1, (float *)vRay1, (float *)*f.Vertices[0], (float *)*f.Vertices[1], (float *)*f.Vertices[2], &t, &u, &v);
-		}
+	mesh_GetLocalRay(vStart1, vRay1, vStart, vRay, pos, rotation);
 
-		extern void U_DLog(const char* , ...);
-		U_DLog("C %s %f\n", Name, t);
-		*/    
-		if(t < MinClipDist) 
-		{
-			if( r3dMaterial* mat = GetFaceMaterial( i ) )
-			{
-				*material = mat;
-			}
+	r3dMeshRayHit hit;
 
-			MinFace     = i;
-			MinClipDist = t;
-		}
-	}
+	if( const r3dMeshBVH* bvh = GetRayBVH() )
+		bvh->IntersectRay( vStart1, vRay1, hit );
+	else
+		r3dMeshBVH::IntersectRayBruteForce( VertexPositions, Indices, NumIndices / 3, vStart1, vRay1, hit );
 
-	if(MinFace != -1) 
+	if(hit.Face != -1) 
 	{
-		*ClipDist = MinClipDist;
+		*ClipDist = hit.T;
+		*material = GetFaceMaterial( hit.Face );
 
 		if( OutMinFace )
-			*OutMinFace = MinFace;
+			*OutMinFace = hit.Face;
 
 		return TRUE;
 	}
@@ -2767,47 +2817,96 @@ BOOL r3dMesh::ContainsQuickRay(const r3dPoint3D& vStart, const r3dPoint3D& vRay,
 {
 	if(!NumVertices) return FALSE;
 
-	float 	MinClipDist = 9999999;
-	int		MinFace     = -1;
 	*material = 0;
 
-	//NOTE: add caching of world matrix after changing RotateMatrix
-
-	D3DXMATRIX  mWorld;
-	mesh_CreateWorldMatrix(mWorld, vPivot, pos, r3dPoint3D(1, 1, 1), rotation);
-
-	D3DXMATRIX mwI, mrI;
-	D3DXMatrixInverse(&mwI, NULL, &mWorld);
-	D3DXMatrixInverse(&mrI, NULL, &rotation);
-
 	// transform ray to object local space
 	r3dPoint3D vRay1;
 	r3dPoint3D vStart1;
-	D3DXVec3TransformNormal(vRay1.d3dx(),  vRay.d3dx(),   &mrI);
-	D3DXVec3TransformCoord(vStart1.d3dx(), vStart.d3dx(), &mwI);
+	mesh_GetLocalRay(vStart1, vRay1, vStart, vRay, pos, rotation);
+
+	r3dMeshRayHit hit;
 
-	for(int i=0; i<NumIndices/3; i++) 
+	bool found;
+	if( const r3dMeshBVH* bvh = GetRayBVH() )
+		found = bvh->IntersectRayAny( vStart1, vRay1, hit );
+	else
+		found = r3dMeshBVH::IntersectRayAnyBruteForce( VertexPositions, Indices, NumIndices / 3, vStart1, vRay1, hit );
+
+	if( found )
 	{
-		float t, u, v;   
-		if(intersect_triangle_floats_cull((float *)vStart1, (float *)vRay1, (float *)&VertexPositions[Indices[i*3+0]], (float *)&VertexPositions[Indices[i*3+1]], (float *)&VertexPositions[Indices[i*3+2]], &t, &u, &v)) 
+		*ClipDist = hit.T;
+		// look for material
+		for(int m=0; m<NumMatChunks; ++m)
 		{
-			*ClipDist = t;
-			// look for material
-			for(int m=0; m<NumMatChunks; ++m)
+			if( ((hit.Face*3) >= MatChunks[m].StartIndex) && ((hit.Face*3) <= MatChunks[m].EndIndex))
 			{
-				if( ((i*3) >= MatChunks[m].StartIndex) && ((i*3) <= MatChunks[m].EndIndex))
-				{
-					*material = MatChunks[m].Mat;
-					break;
-				}
+				*material = MatChunks[m].Mat;
+				break;
 			}
-			return TRUE;
 		}
+		return TRUE;
 	}
 
 	return FALSE;
 }
 
+int r3dMesh::ContainsRayPacket(const r3dPoint3D& vStart, const r3dPoint3D* vRays, int count, float *ClipDists, int *OutFaces, const r3dVector& pos, const D3DXMATRIX& rotation)
+{
+	if(!NumVertices) 
+	{
+		for( int i = 0; i < count; i ++ )
+			OutFaces[ i ] = -1;
+
+		return 0;
+	}
+
+	R3DPROFILE_FUNCTION( "r3dMesh::ContainsRayPacket" ) ;
+
+	const D3DXMATRIX& mrI = GetRayInverseRotation(rotation);
+
+	r3dPoint3D vMoved = vStart - pos;
+	r3dPoint3D vStart1;
+	D3DXVec3TransformCoord(vStart1.d3dx(), vMoved.d3dx(), &mrI);
+
+	const r3dMeshBVH* bvh = GetRayBVH();
+
+	int numHits = 0;
+
+	for( int first = 0; first < count; first += r3dMeshBVH::PACKET_SIZE )
+	{
+		int num = R3D_MIN( count - first, (int)r3dMeshBVH::PACKET_SIZE );
+
+		r3dPoint3D vRays1[ r3dMeshBVH::PACKET_SIZE ];
+		r3dMeshRayHit hits[ r3dMeshBVH::PACKET_SIZE ];
+
+		for( int i = 0; i < num; i ++ )
+		{
+			D3DXVec3TransformNormal(vRays1[ i ].d3dx(), vRays[ first + i ].d3dx(), &mrI);
+		}
+
+		if( bvh )
+			bvh->IntersectPacket( vStart1, vRays1, num, hits );
+		else
+		{
+			for( int i = 0; i < num; i ++ )
+				r3dMeshBVH::IntersectRayBruteForce( VertexPositions, Indices, NumIndices / 3, vStart1, vRays1[ i ], hits[ i ] );
+		}
+
+		for( int i = 0; i < num; i ++ )
+		{
+			OutFaces[ first + i ] = hits[ i ].Face;
+
+			if( hits[ i ].Face != -1 )
+			{
+				ClipDists[ first + i ] = hits[ i ].T;
+				numHits ++;
+			}
+		}
+	}
+
+	return numHits;
+}
+
 /*static*/
 void
 r3dMesh::FlushLoadingBuffers()
@@ -18,6 +18,7 @@
 
 r3dString gProfileDataXMLOutFile;
 r3dString gProfileDataTXTOutFile;
+r3dString gProfileDataTraceOutFile;
 r3dString gProfileDataPath ;
 int gProfileRecorderStartFrame = -1;
 float gScheduledProfileTime = 0.0f;
@@ -247,6 +248,10 @@ void DumpProfileData()
 void ScheduleProfileDataDump()
 {
 	gProfileRecorderStartFrame = r3dProfiler::Instance()->GetCurrentFrame();
+
+	//	Timeline of all threads for the same frames
+	if( gProfileDataTraceOutFile.c_str()[ 0 ] )
+		r3dProfilerTimeline::StartCapture( d_profile_dump_num_frames->GetInt(), gProfileDataTraceOutFile.c_str() );
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -327,9 +332,11 @@ bool CreateProfileDumpFolders( const char* LevelDir )
 
 	gProfileDataXMLOutFile = fullPath;
 	gProfileDataTXTOutFile = fullPath;
+	gProfileDataTraceOutFile = fullPath;
 	gProfileDataPath = fullPath ;
 	gProfileDataXMLOutFile += "\\profile_data.xml";
 	gProfileDataTXTOutFile += "\\profile_data.txt";
+	gProfileDataTraceOutFile += "\\profile_trace.json";
 
 	return true ;
 }
@@ -861,6 +861,8 @@ void r3dProfiler::StartFrame()
 	::QueryPerformanceFrequency(&proc_freq);
 	sSecondPerTick = 1.0 / proc_freq.QuadPart;
 
+	r3dProfilerTimeline::OnFrameStart();
+
 	m_PausedFrame = m_PausedFlag;
 	if(IsPaused())
 		return;
@@ -942,6 +944,8 @@ void r3dProfiler::EndFrame()
 	GPUFreq = NewGPUFreq ;
 
 	m_CurrentSample = NULL;
+
+	r3dProfilerTimeline::OnFrameEnd();
 }
 
 void r3dSetShowD3DMarks( int show )
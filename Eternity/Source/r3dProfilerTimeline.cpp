@@ -0,0 +1,377 @@
+#include "r3dPCH.h"
+
+#if !DISABLE_PROFILER
+
+#include "r3d.h"
+
+#include "r3dProfilerTimeline.h"
+
+volatile LONG r3dProfilerTimeline::sCapturing = 0;
+
+namespace
+{
+	const int EVENTS_PER_THREAD		= 128 * 1024;
+	const int MAX_THREAD_NAME		= 32;
+
+	// per thread sample name table, hash -> name copy
+	const int NAME_TABLE_SIZE		= 4096;
+	const int NAME_POOL_SIZE		= 64 * 1024;
+
+	volatile LONG	gGeneration		= 0;
+	int				gPendingFrames	= 0;
+	int				gFramesLeft		= 0;
+	char			gTraceFile[ MAX_PATH ];
+	LONGLONG		gCaptureStart	= 0;
+	LONGLONG		gCaptureEnd		= 0;
+
+	void WriteJSONString( FILE* f, const char* str )
+	{
+		fputc( '"', f );
+		for( ; *str; str ++ )
+		{
+			char c = *str;
+			if( c == '"' || c == '\\' )
+				fputc( '\\', f );
+
+			if( (unsigned char)c >= 32 )
+				fputc( c, f );
+		}
+		fputc( '"', f );
+	}
+}
+
+struct r3dProfilerTimeline::ThreadBuffer
+{
+	struct NameEntry
+	{
+		uint32_t	Hash;
+		int			Offset;
+	};
+
+	DWORD			ThreadId;
+	char			Name[ MAX_THREAD_NAME ];
+
+	Event*			Events;
+	volatile LONG	Count;
+	LONG			Dropped;
+	LONG			Generation;
+
+	NameEntry		NameTable[ NAME_TABLE_SIZE ];
+	char			NamePool[ NAME_POOL_SIZE ];
+	int				NamePoolSize;
+
+	ThreadBuffer*	Next;
+
+	void			AddName( const char* name, uint32_t hash );
+	const char*		FindName( uint32_t hash ) const;
+};
+
+namespace
+{
+	r3dProfilerTimeline::ThreadBuffer* volatile		gBuffers = NULL;
+
+	__declspec(thread) r3dProfilerTimeline::ThreadBuffer*	tBuffer = NULL;
+	__declspec(thread) char									tThreadName[ MAX_THREAD_NAME ];
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dProfilerTimeline::ThreadBuffer::AddName( const char* name, uint32_t hash )
+{
+	for( uint32_t i = hash & ( NAME_TABLE_SIZE - 1 ), n = 0; n < NAME_TABLE_SIZE; i = ( i + 1 ) & ( NAME_TABLE_SIZE - 1 ), n ++ )
+	{
+		NameEntry& e = NameTable[ i ];
+
+		if( e.Hash == hash )
+			return;
+
+		if( !e.Hash )
+		{
+			int len = (int)strlen( name ) + 1;
+			if( NamePoolSize + len > NAME_POOL_SIZE )
+				return;
+
+			memcpy( NamePool + NamePoolSize, name, len );
+			e.Offset = NamePoolSize;
+			e.Hash = hash;
+			NamePoolSize += len;
+			return;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+const char*
+r3dProfilerTimeline::ThreadBuffer::FindName( uint32_t hash ) const
+{
+	for( uint32_t i = hash & ( NAME_TABLE_SIZE - 1 ), n = 0; n < NAME_TABLE_SIZE; i = ( i + 1 ) & ( NAME_TABLE_SIZE - 1 ), n ++ )
+	{
+		const NameEntry& e = NameTable[ i ];
+
+		if( e.Hash == hash )
+			return NamePool + e.Offset;
+
+		if( !e.Hash )
+			break;
+	}
+
+	return "?";
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+r3dProfilerTimeline::StartCapture( int numFrames, const char* fileName )
+{
+	if( sCapturing || numFrames <= 0 )
+		return;
+
+	r3dscpy( gTraceFile, fileName );
+	gPendingFrames = numFrames;
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+r3dProfilerTimeline::SetThreadName( const char* name )
+{
+	r3dscpy_s( tThreadName, MAX_THREAD_NAME, name );
+
+	if( tBuffer )
+		r3dscpy_s( tBuffer->Name, MAX_THREAD_NAME, name );
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+r3dProfilerTimeline::ThreadBuffer*
+r3dProfilerTimeline::GetThreadBuffer()
+{
+	if( tBuffer )
+		return tBuffer;
+
+	ThreadBuffer* buf = (ThreadBuffer*)malloc( sizeof( ThreadBuffer ) );
+	if( !buf )
+		return NULL;
+
+	memset( buf, 0, sizeof( ThreadBuffer ) );
+
+	buf->Events = (Event*)malloc( sizeof( Event ) * EVENTS_PER_THREAD );
+	if( !buf->Events )
+	{
+		free( buf );
+		return NULL;
+	}
+
+	buf->ThreadId = GetCurrentThreadId();
+	buf->Generation = -1;
+
+	extern DWORD MainThreadID;
+	if( tThreadName[ 0 ] )
+		r3dscpy_s( buf->Name, MAX_THREAD_NAME, tThreadName );
+	else if( buf->ThreadId == MainThreadID )
+		r3dscpy_s( buf->Name, MAX_THREAD_NAME, "Main thread" );
+	else
+		sprintf_s( buf->Name, MAX_THREAD_NAME, "Thread %u", buf->ThreadId );
+
+	// buffers are never freed, so simple lock free push is enough
+	for( ;; )
+	{
+		ThreadBuffer* head = gBuffers;
+		buf->Next = head;
+		if( InterlockedCompareExchangePointer( (void* volatile*)&gBuffers, buf, head ) == head )
+			break;
+	}
+
+	tBuffer = buf;
+	return buf;
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+r3dProfilerTimeline::AddEvent( const char* aName, uint32_t aHashName, int aType )
+{
+	ThreadBuffer* buf = GetThreadBuffer();
+	if( !buf )
+		return;
+
+	// first event of new capture on this thread
+	const LONG generation = gGeneration;
+	if( buf->Generation != generation )
+	{
+		buf->Count = 0;
+		buf->Dropped = 0;
+		buf->Generation = generation;
+	}
+
+	const LONG count = buf->Count;
+	if( count >= EVENTS_PER_THREAD )
+	{
+		buf->Dropped ++;
+		return;
+	}
+
+	if( aType == EVENT_BEGIN )
+		buf->AddName( aName, aHashName );
+
+	Event& e = buf->Events[ count ];
+	e.NameHash = aHashName;
+	e.Type = aType;
+	QueryPerformanceCounter( (LARGE_INTEGER*)&e.Ticks );
+
+	// publish after event is written
+	InterlockedExchange( &buf->Count, count + 1 );
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+r3dProfilerTimeline::OnFrameStart()
+{
+	if( !sCapturing )
+	{
+		if( !gPendingFrames )
+			return;
+
+		gFramesLeft = gPendingFrames;
+		gPendingFrames = 0;
+
+		// other threads pick new generation up with their next event and start from empty buffer
+		QueryPerformanceCounter( (LARGE_INTEGER*)&gCaptureStart );
+		InterlockedIncrement( &gGeneration );
+		InterlockedExchange( &sCapturing, 1 );
+
+		r3dOutToLog( "Profiler: capturing %d frames timeline\n", gFramesLeft );
+	}
+
+	AddEvent( "Frame", 0, EVENT_FRAME );
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+void
+r3dProfilerTimeline::OnFrameEnd()
+{
+	if( !sCapturing )
+		return;
+
+	if( -- gFramesLeft > 0 )
+		return;
+
+	InterlockedExchange( &sCapturing, 0 );
+	QueryPerformanceCounter( (LARGE_INTEGER*)&gCaptureEnd );
+
+	float t0 = r3dGetTime();
+	if( WriteTrace( gTraceFile ) )
+		r3dOutToLog( "Profiler: timeline written to %s in %.2f sec\n", gTraceFile, r3dGetTime() - t0 );
+}
+
+//------------------------------------------------------------------------
+/*static*/
+
+bool
+r3dProfilerTimeline::WriteTrace( const char* fileName )
+{
+	FILE* f = fopen( fileName, "wt" );
+	if( !f )
+	{
+		r3dOutToLog( "Profiler: can't open %s\n", fileName );
+		return false;
+	}
+
+	setvbuf( f, NULL, _IOFBF, 1024 * 1024 );
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency( &freq );
+	const double usPerTick = 1000000.0 / (double)freq.QuadPart;
+
+	const LONG generation = gGeneration;
+	const double endTs = ( gCaptureEnd - gCaptureStart ) * usPerTick;
+
+	fprintf( f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	fprintf( f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Frames\"}}" );
+
+	for( ThreadBuffer* buf = gBuffers; buf; buf = buf->Next )
+	{
+		if( buf->Generation != generation )
+			continue;
+
+		const LONG count = buf->Count;
+		if( !count )
+			continue;
+
+		fprintf( f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", buf->ThreadId );
+		WriteJSONString( f, buf->Name );
+		fprintf( f, "}}" );
+
+		int depth = 0;
+		int frameIdx = 0;
+		double frameStart = -1.0;
+
+		for( LONG i = 0; i < count; i ++ )
+		{
+			const Event& e = buf->Events[ i ];
+			const double ts = R3D_MAX( ( e.Ticks - gCaptureStart ) * usPerTick, 0.0 );
+
+			switch( e.Type )
+			{
+			case EVENT_BEGIN:
+				fprintf( f, ",\n{\"ph\":\"B\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"name\":", buf->ThreadId, ts );
+				WriteJSONString( f, buf->FindName( e.NameHash ) );
+				fprintf( f, "}" );
+				depth ++;
+				break;
+
+			case EVENT_END:
+				// sample was opened before capture started
+				if( !depth )
+					break;
+
+				fprintf( f, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", buf->ThreadId, ts );
+				depth --;
+				break;
+
+			case EVENT_FRAME:
+				// frames are shown on their own track and as global marks, to line up all threads
+				if( frameStart >= 0.0 )
+				{
+					fprintf( f, ",\n{\"name\":\"Frame %d\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}", frameIdx ++, frameStart, ts - frameStart );
+				}
+				fprintf( f, ",\n{\"name\":\"Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%.3f}", ts );
+				frameStart = ts;
+				break;
+			}
+		}
+
+		if( frameStart >= 0.0 )
+		{
+			fprintf( f, ",\n{\"name\":\"Frame %d\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}", frameIdx, frameStart, endTs - frameStart );
+		}
+
+		// samples still open at the end of capture
+		for( ; depth > 0; depth -- )
+		{
+			fprintf( f, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", buf->ThreadId, endTs );
+		}
+
+		if( buf->Dropped )
+		{
+			r3dOutToLog( "Profiler: thread '%s' dropped %d timeline events\n", buf->Name, buf->Dropped );
+		}
+	}
+
+	fprintf( f, "\n]}\n" );
+	fclose( f );
+
+	return true;
+}
+
+#endif // !DISABLE_PROFILER
@@ -5,6 +5,7 @@
 #include "r3dBackgroundTaskDispatcher.h"
 
 #include "r3dDeviceQueue.h"
+#include "r3dResourceRegistry.h"
 
 typedef r3dTL::TArray< TextureReloadListener > TextureReloadListeners ;
 
@@ -12,6 +13,9 @@ static TextureReloadListeners gTextureReloadListeners ;
 
 static 	int 	r3dLastTextureID     = 100;
 
+// textures of r3dRenderer->FirstTexture list by file name, guarded by g_ResourceCritSection
+static r3dResourceRegistry< r3dTexture > gTextureRegistry ;
+
 int	r3dTexture_ScaleCoef = 1;
 int	r3dTexture_MinSize   = 1;		// Minimum possible texture dimension after scaling
 int	r3dTexture_ScaleBoxInterpolate = 0;	// Use D3D_FILTER_BOX interpolation
@@ -880,6 +884,7 @@ void r3dTexture::LoadTextureInternal( int index, const char* FName )
 
 		sprintf(Location.FileName, "%s", FName);
 		strlwr(&Location.FileName[0]);
+		UpdateRegistryName();
 
 		m_TexArray[index].Set( 0 );
 		return;
@@ -981,6 +986,7 @@ void r3dTexture::SetLoadData( const char* fname, int downScale, int maxDim, D3DP
 {
 	sprintf(Location.FileName, "%s", fname);
 	strlwr(&Location.FileName[0]);
+	UpdateRegistryName();
 
 	m_DownScale = downScale;
 	m_MaxDim = maxDim;
@@ -992,6 +998,21 @@ void r3dTexture::SetLoadData( const char* fname, int downScale, int maxDim, D3DP
 	Flags |= fFileTexture;
 }
 
+void r3dTexture::OverwriteFileLocation( const char* file )
+{
+	r3d_assert( file );
+	r3dscpy( Location.FileName, file );
+	UpdateRegistryName();
+}
+
+// textures that are already in the list have to be looked up by new name
+void r3dTexture::UpdateRegistryName()
+{
+	r3dCSHolderWithDeviceQueue csholder( g_ResourceCritSection ) ; (void)csholder ;
+
+	gTextureRegistry.Rename( this, Location.FileName );
+}
+
 void r3dTexture::CheckPow2()
 {
 	if( !Instances )
@@ -1276,6 +1297,7 @@ void r3dTexture::RegisterCreated()
 {
 	Flags     |= fCreated;
 	sprintf(Location.FileName, "$Created");
+	UpdateRegistryName();
 	
 	InterlockedExchange( &Instances, 1 );
 }
@@ -1425,6 +1447,8 @@ void _InsertTexture(r3dTexture **FirstTexture, r3dTexture *Tex)
 	if(Tex->pNext)
 		Tex->pNext->pPrev = Tex;
 	*FirstTexture     = Tex;
+
+	gTextureRegistry.Add( Tex, Tex->Location.FileName );
 }
 
 r3dTexture* _CreateTexture()
@@ -1454,6 +1478,36 @@ r3dTexture *r3dRenderLayer::AllocateTexture()
 	return Tex;
 }
 
+namespace
+{
+	// same rule LoadTexture always used: exact name, or file name only with r_loose_texture_filter
+	struct TextureNameMatch
+	{
+		const char*	FileName;
+		D3DFORMAT	Format;
+		bool		CheckFormat;
+		bool		Loose;
+
+		TextureNameMatch( const char* fileName, D3DFORMAT format, bool checkFormat, bool loose )
+		: FileName( fileName )
+		, Format( format )
+		, CheckFormat( checkFormat )
+		, Loose( loose )
+		{
+		}
+
+		bool operator() ( const r3dTexture* tex ) const
+		{
+			if( CheckFormat && tex->GetD3DFormat() != Format )
+				return false;
+
+			return !strcmp( tex->getFileLoc().FileName, FileName )
+						|| 
+					( Loose && !r3dCompareFileNameInPath( tex->getFileLoc().FileName, FileName ) );
+		}
+	};
+}
+
 r3dTexture* r3dRenderLayer::LoadTexture( const char* TexFile, D3DFORMAT TexFormat, bool bCheckFormat, int DownScale /*= 1*/, int MaxDim /*= 0*/, D3DPOOL Pool /*= D3DPOOL_MANAGED*/, int gameResourcePool /*= 0*/, bool deferLoading /*= false*/ )
 {
 	if(!bInited)
@@ -1466,48 +1520,40 @@ r3dTexture* r3dRenderLayer::LoadTexture( const char* TexFile, D3DFORMAT TexForma
 	char szFileName[ MAX_PATH ];
 	FixFileName( TexFile, szFileName );
 
-	r3dTexture*	Tex;
+	// see if we already have texture with that name. Texture that is still being loaded
+	// is found as well, caller then shares its pending load
+	TextureNameMatch match( szFileName, TexFormat, bCheckFormat, r_loose_texture_filter->GetBool() );
 
-	// goes thru all textures and see if we already have with that name
-	for(Tex = FirstTexture; Tex; Tex = Tex->pNext)
-	{
-		int isLoose = 0;
+	r3dTexture*	Tex = gTextureRegistry.Find( szFileName, match );
 
-		int needLoad = (!bCheckFormat || (Tex->GetD3DFormat() == TexFormat) )
-								&& 
-						(
-							( strcmp(Tex->getFileLoc().FileName, szFileName ) == NULL)
-								||
-							( isLoose = r_loose_texture_filter->GetBool() && !r3dCompareFileNameInPath( Tex->getFileLoc().FileName, szFileName ) )
-						);
+	if( Tex ) 
+	{
+		int isLoose = strcmp( Tex->getFileLoc().FileName, szFileName ) != 0;
 
-		if( needLoad ) 
-		{
 #ifndef FINAL_BUILD
-			extern bool g_bEditMode;
-			if( isLoose && g_bEditMode )
+		extern bool g_bEditMode;
+		if( isLoose && g_bEditMode )
+		{
+			if( !r3dFilesEqual( Tex->getFileLoc().FileName, szFileName ) )
 			{
-				if( !r3dFilesEqual( Tex->getFileLoc().FileName, szFileName ) )
-				{
-					static std::set< std::string > reported;
+				static std::set< std::string > reported;
 
-					std::string compound = std::string( Tex->getFileLoc().FileName ) + szFileName;
+				std::string compound = std::string( Tex->getFileLoc().FileName ) + szFileName;
 
-					if( reported.find( compound ) == reported.end() )
-					{
-						reported.insert( compound );
-						r3dArtBug( "Textures '%s' and '%s' are loosely filtered but are different!\n", Tex->getFileLoc().FileName, szFileName );
-					}
+				if( reported.find( compound ) == reported.end() )
+				{
+					reported.insert( compound );
+					r3dArtBug( "Textures '%s' and '%s' are loosely filtered but are different!\n", Tex->getFileLoc().FileName, szFileName );
 				}
 			}
+		}
 #endif
 
-			if( !deferLoading )
-			{
-				Tex->Load();
-			}
-			return Tex;
+		if( !deferLoading )
+		{
+			Tex->Load();
 		}
+		return Tex;
 	}
 
 	Tex = _CreateTexture();
@@ -1722,6 +1768,8 @@ void r3dRenderLayer::DeleteTexture(r3dTexture* Tex, int bForceDelete )
 	if(Tex == FirstTexture)
 		FirstTexture      = Tex->pNext;
 
+	gTextureRegistry.Remove( Tex );
+
 	_DeleteTexture(Tex);
 }
 
@@ -2158,4 +2206,108 @@ void DEBUG_ReportTexStats()
 	}
 }
 
+//------------------------------------------------------------------------
+
+// FirstTexture walk LoadTexture did before registry, as reference
+static r3dTexture* FindTextureLinear( r3dTexture* first, const TextureNameMatch& match )
+{
+	for( r3dTexture* tex = first; tex; tex = tex->pNext )
+	{
+		if( match( tex ) )
+			return tex;
+	}
+
+	return NULL;
+}
+
+void r3dTextureLookupBenchmark( int passes )
+{
+	r3dCSHolderWithDeviceQueue csholder( g_ResourceCritSection ) ; (void)csholder ;
+
+	passes = R3D_MAX( passes, 1 );
+
+	// what level load asks for - names of loaded textures, same files from other folders
+	// (loose filter hits) and files that are not loaded yet
+	r3dTL::TArray< r3dSTLString > requests;
+
+	for( r3dTexture* tex = r3dRenderer->FirstTexture; tex; tex = tex->pNext )
+	{
+		if( !( tex->GetFlags() & r3dTexture::fFileTexture ) )
+			continue;
+
+		const char* name = tex->getFileLoc().FileName;
+		const char* slash = strrchr( name, '\\' );
+
+		requests.PushBack( name );
+		requests.PushBack( r3dSTLString( "data\\reslookupbench\\" ) + ( slash ? slash + 1 : name ) );
+		requests.PushBack( r3dSTLString( name ) + ".missing" );
+	}
+
+	if( !requests.Count() )
+	{
+		r3dOutToLog( "reslookupbench: no file textures loaded\n" );
+		return;
+	}
+
+	bool loose = r_loose_texture_filter->GetBool();
+
+	r3dOutToLog( "reslookupbench: %d textures, %d lookups x %d passes, loose filter %d\n", gTextureRegistry.Count(), requests.Count(), passes, (int)loose ); CLOG_INDENT;
+
+	int mismatches = 0;
+	int hits = 0;
+
+	for( int i = 0, e = requests.Count(); i < e; i ++ )
+	{
+		TextureNameMatch match( requests[ i ].c_str(), D3DFMT_UNKNOWN, false, loose );
+
+		r3dTexture* linear = FindTextureLinear( r3dRenderer->FirstTexture, match );
+		r3dTexture* hashed = gTextureRegistry.Find( requests[ i ].c_str(), match );
+
+		if( linear != hashed )
+		{
+			if( mismatches < 16 )
+			{
+				r3dOutToLog( "mismatch for '%s': %p vs %p\n", requests[ i ].c_str(), linear, hashed );
+			}
+
+			mismatches ++;
+		}
+
+		hits += hashed ? 1 : 0;
+	}
+
+	// keeps optimizer from dropping the loops
+	size_t sum = 0;
+
+	float t0 = r3dGetTime();
+
+	for( int p = 0; p < passes; p ++ )
+	{
+		for( int i = 0, e = requests.Count(); i < e; i ++ )
+		{
+			TextureNameMatch match( requests[ i ].c_str(), D3DFMT_UNKNOWN, false, loose );
+			sum += (size_t)FindTextureLinear( r3dRenderer->FirstTexture, match );
+		}
+	}
+
+	float t1 = r3dGetTime();
+
+	for( int p = 0; p < passes; p ++ )
+	{
+		for( int i = 0, e = requests.Count(); i < e; i ++ )
+		{
+			TextureNameMatch match( requests[ i ].c_str(), D3DFMT_UNKNOWN, false, loose );
+			sum += (size_t)gTextureRegistry.Find( requests[ i ].c_str(), match );
+		}
+	}
+
+	float t2 = r3dGetTime();
+
+	float numLookups = float( requests.Count() ) * passes;
+
+	r3dOutToLog( "hits %d, mismatches %d (%d)\n", hits, mismatches, (int)( sum & 1 ) );
+	r3dOutToLog( "list walk: %.2f ms, %.3f us per lookup\n", ( t1 - t0 ) * 1000.f, ( t1 - t0 ) * 1e6f / numLookups );
+	r3dOutToLog( "registry:  %.2f ms, %.3f us per lookup\n", ( t2 - t1 ) * 1000.f, ( t2 - t1 ) * 1e6f / numLookups );
+}
+
 #endif
\ No newline at end of file
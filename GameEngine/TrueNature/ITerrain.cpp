@@ -81,6 +81,12 @@ r3dITerrain::~r3dITerrain()
 	return 1;
 }
 
+//------------------------------------------------------------------------
+/*virtual*/ int r3dITerrain::FindRayIntersection( const r3dPoint3D& from, const r3dPoint3D& to, r3dPoint3D* oHit )
+{
+	return -1;
+}
+
 //------------------------------------------------------------------------
 
 void
@@ -638,6 +644,17 @@ BOOL terra_FindIntersection(const r3dPoint3D &vFrom, const r3dPoint3D &vTo, r3dP
 
 	R3DPROFILE_FUNCTION( "terra_FindIntersection" ) ;
 
+	// without iterations only end points are checked
+	if( iterations )
+	{
+		int res = Terrain->FindRayIntersection( vFrom, vTo, &colpos );
+
+		if( res >= 0 )
+		{
+			return res;
+		}
+	}
+
 	// if start is below terrain
 	if(vFrom.y <= Terrain->GetHeight(vFrom)) {
 		colpos   = vFrom;
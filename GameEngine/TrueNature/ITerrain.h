@@ -79,6 +79,9 @@ public:
 
 	virtual int					IsPosWithinPreciseHeights( const r3dPoint3D& pos ) const;
 
+	// first hit of segment with terrain surface: 1 - hit, 0 - no hit, -1 - not supported, caller has to march with GetHeight
+	virtual int					FindRayIntersection( const r3dPoint3D& from, const r3dPoint3D& to, r3dPoint3D* oHit );
+
 protected:
 	void SetDesc( const r3dTerrainDesc& desc ) ;
 	
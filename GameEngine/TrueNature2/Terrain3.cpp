@@ -23,6 +23,9 @@
 #include "r3dBackgroundTaskDispatcher.h"
 
 #include "Terrain3.h"
+#include "Terrain3Kernels.h"
+
+#include "JobChief.h"
 
 #ifdef ARTIFICIAL_FINAL_BUILD
 #define FINAL_BUILD
@@ -1908,6 +1911,8 @@ r3dTerrain3::Close()
 		m_MegaTexAtlasMipsFile = NULL;
 	}
 
+	m_HeightField.Close();
+
 	free( m_SharedPhysDescData );
 }
 
@@ -4253,6 +4258,19 @@ void r3dTerrain3::UpdateHeight( const r3dTL::TArray< UINT16 > * data, Bytes* tem
 
 	int res = 0;
 	res = UnmapViewOfFile( mvof.Mapped ); r3d_assert( res );
+
+	if( !L && m_HeightField.IsValid() )
+	{
+		if( m_HeightField.IsWritable() )
+		{
+			m_HeightField.SetTile( X, Z, m_MegaTexAtlasFile_HeightDim, &(*data)[ 0 ] );
+		}
+		else
+		{
+			// stale heights are worse than none, fall back to physics chunks
+			m_HeightField.Close();
+		}
+	}
 }
 
 //------------------------------------------------------------------------
@@ -4307,10 +4325,182 @@ void r3dTerrain3::UpdateTileNormalEdges( int X, int Z, int L, r3dTL::TArray< UIN
 
 //------------------------------------------------------------------------
 
+namespace
+{
+	struct NormalEdgeRowParams
+	{
+		r3dTerrain3*					Terrain;
+		const r3dTerrain3::UShorts*		Rows[ 3 ];	// packed normals of rows above, at and below, NULL outside of level
+		r3dTerrain3::UShorts*			Results;
+		int								TileCountX;
+		int								Z;
+		int								L;
+	};
+
+	void CopyNormalEdgeRowMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+	{
+		const NormalEdgeRowParams& p = *static_cast< const NormalEdgeRowParams* >( Data );
+
+		for( int x = (int)ItemStart, e = int( ItemStart + ItemCount ); x < e; x ++ )
+		{
+			const UINT16* neighbours[ 9 ] = { NULL };
+
+			for( int z = 0; z < 3; z ++ )
+			{
+				if( !p.Rows[ z ] )
+					continue;
+
+				for( int dx = -1; dx <= 1; dx ++ )
+				{
+					if( x + dx >= 0 && x + dx < p.TileCountX )
+					{
+						neighbours[ z * 3 + dx + 1 ] = &p.Rows[ z ][ x + dx ][ 0 ];
+					}
+				}
+			}
+
+			r3dTerrain3::UShorts& result = p.Results[ x ];
+
+			result = p.Rows[ 1 ][ x ];
+
+			p.Terrain->CopyNormalEdges( x, p.Z, p.L, &result[ 0 ], result.Count(), neighbours );
+		}
+	}
+}
+
+int r3dTerrain3::UpdateNormalEdgesOfLevel( int L, void (*reportCallBack)( int, int ) )
+{
+	m_WasEdited = 1;
+
+	Info info = GetInfo();
+
+	int tileCountX = info.MegaTileCountX >> L;
+	int tileCountZ = info.MegaTileCountZ >> L;
+
+	if( !tileCountX || !tileCountZ )
+		return 0;
+
+	// last 3 rows of packed normals, row z is at z % 3. Every tile is read once
+	r3dTL::TArray< UShorts > rows[ 3 ];
+
+	for( int i = 0; i < 3; i ++ )
+	{
+		rows[ i ].Resize( tileCountX );
+	}
+
+	r3dTL::TArray< UShorts > results;
+	results.Resize( tileCountX );
+
+	UShorts heights;
+
+	for( int z = 0; z < R3D_MIN( 2, tileCountZ ); z ++ )
+	{
+		for( int x = 0; x < tileCountX; x ++ )
+		{
+			ReadNormalsPacked( &rows[ z ][ x ], x, z, L );
+		}
+	}
+
+	for( int z = 0; z < tileCountZ; z ++ )
+	{
+		NormalEdgeRowParams params;
+
+		params.Terrain		= this;
+		params.Rows[ 0 ]	= z > 0 ? &rows[ ( z - 1 ) % 3 ][ 0 ] : NULL;
+		params.Rows[ 1 ]	= &rows[ z % 3 ][ 0 ];
+		params.Rows[ 2 ]	= z + 1 < tileCountZ ? &rows[ ( z + 1 ) % 3 ][ 0 ] : NULL;
+		params.Results		= &results[ 0 ];
+		params.TileCountX	= tileCountX;
+		params.Z			= z;
+		params.L			= L;
+
+		g_pJobChief->Exec( CopyNormalEdgeRowMT, &params, tileCountX );
+
+		for( int x = 0; x < tileCountX; x ++ )
+		{
+			MegaTexTile fakeTile;
+
+			fakeTile.X = x;
+			fakeTile.Z = z;
+			fakeTile.L = L;
+
+			// tile which moves to editor file takes its heights along
+			if( GetMegaTexHeightNormalOffsetInFile( &fakeTile ).IsInEditorFile )
+			{
+				UpdateHeightNormalsPacked( NULL, &results[ x ], x, z, L );
+			}
+			else
+			{
+				UnpackHeight( &heights, x, z, L );
+				UpdateHeightNormalsPacked( &heights, &results[ x ], x, z, L );
+			}
+		}
+
+		// row above is not needed anymore, its slot takes the row after next
+		if( z + 2 < tileCountZ )
+		{
+			for( int x = 0; x < tileCountX; x ++ )
+			{
+				ReadNormalsPacked( &rows[ ( z + 2 ) % 3 ][ x ], x, z + 2, L );
+			}
+		}
+
+		if( reportCallBack )
+		{
+			reportCallBack( z + 1, tileCountZ );
+		}
+	}
+
+	return tileCountX * tileCountZ;
+}
+
+//------------------------------------------------------------------------
+
 void r3dTerrain3::UpdateNormalEdges( int X, int Z, int L, UINT16* targ16, int targCount, r3dTL::TArray< UINT16 > * tempData )
 {
 	m_WasEdited = 1;
 
+	const Info& info = GetInfo();
+
+	int tileCountX = info.MegaTileCountX >> L;
+	int tileCountZ = info.MegaTileCountZ >> L;
+
+	int tileSize = GetNormalTileSizeInFile() / sizeof (*tempData) [ 0 ];
+
+	tempData->Resize( tileSize * 9 );
+
+	const UINT16* neighbours[ 9 ] = { NULL };
+
+	// edges are taken only from tiles which CopyNormalEdges uses
+	if( X > 0 )
+	{
+		for( int z = -1; z <= 1; z ++ )
+		{
+			for( int x = -1; x <= 1; x ++ )
+			{
+				int tx = X + x;
+				int tz = Z + z;
+
+				if( ( !x && !z ) || tx >= tileCountX || tz < 0 || tz >= tileCountZ )
+					continue;
+
+				int idx = ( z + 1 ) * 3 + x + 1;
+
+				UINT16* data = &(*tempData)[ idx * tileSize ];
+
+				ReadNormalsPacked( data, tx, tz, L );
+				neighbours[ idx ] = data;
+			}
+		}
+	}
+
+	CopyNormalEdges( X, Z, L, targ16, targCount, neighbours );
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3::CopyNormalEdges( int X, int Z, int L, UINT16* targ16, int targCount, const UINT16* const ( &neighbours )[ 9 ] )
+{
 	const QualitySettings& qs = GetCurrentQualitySettings();
 	const Info& info = GetInfo();
 
@@ -4320,8 +4510,6 @@ void r3dTerrain3::UpdateNormalEdges( int X, int Z, int L, UINT16* targ16, int ta
 	tileCountX >>= L;
 	tileCountZ >>= L;
 
-	tempData->Resize( GetNormalTileSizeInFile() / sizeof (*tempData) [ 0 ] );
-
 	struct MemCpy
 	{
 		void operator () ( int offset, const UINT16* src, int size )
@@ -4366,68 +4554,68 @@ void r3dTerrain3::UpdateNormalEdges( int X, int Z, int L, UINT16* targ16, int ta
 	COMPILE_ASSERT( TERRA3_MEGANORMAL_FORMAT == D3DFMT_DXT1 );
 	COMPILE_ASSERT( NORMAL_TILE_BORDER == BLOCK_SIZE );
 
-	int blockSize = r3dGetTextureBlockLineSize( BLOCK_SIZE, TERRA3_MEGANORMAL_FORMAT ) / sizeof (*tempData)[ 0 ];
+	int blockSize = r3dGetTextureBlockLineSize( BLOCK_SIZE, TERRA3_MEGANORMAL_FORMAT ) / sizeof( UINT16 );
 
 	int blockCount = qs.HeightNormalAtlasTileDim / BLOCK_SIZE;
 
 	if( X > 0 )
 	{
-		ReadNormalsPacked( tempData, X - 1, Z, L );
+		const UINT16* tempData = neighbours[ 3 ];
 
 		for( int z = 1; z < blockCount - 1; z ++ )
 		{
-			targCpy( z * blockCount * blockSize, &(*tempData)[ z * blockCount * blockSize + ( blockCount - 2 ) * blockSize], blockSize );
+			targCpy( z * blockCount * blockSize, &tempData[ z * blockCount * blockSize + ( blockCount - 2 ) * blockSize], blockSize );
 		}
 
 		if( Z > 0 )
 		{
-			ReadNormalsPacked( tempData, X - 1, Z - 1, L );
+			tempData = neighbours[ 0 ];
 
-			targCpy( 0, &(*tempData)[ ( blockCount - 2 ) * blockCount * blockSize + ( blockCount - 2 ) * blockSize], blockSize );
+			targCpy( 0, &tempData[ ( blockCount - 2 ) * blockCount * blockSize + ( blockCount - 2 ) * blockSize], blockSize );
 
-			ReadNormalsPacked( tempData, X, Z - 1, L );
+			tempData = neighbours[ 1 ];
 
 			for( int x = 1; x < blockCount - 1; x ++ )
 			{
-				targCpy( x * blockSize, &(*tempData)[ ( blockCount - 2 ) * blockCount * blockSize + x * blockSize ],	blockSize );
+				targCpy( x * blockSize, &tempData[ ( blockCount - 2 ) * blockCount * blockSize + x * blockSize ],	blockSize );
 			}
 		}
 
 		if( Z < tileCountZ - 1 )
 		{
-			ReadNormalsPacked( tempData, X - 1, Z + 1, L );
+			tempData = neighbours[ 6 ];
 
-			targCpy( ( blockCount - 1 ) * blockCount * blockSize, &(*tempData)[ 1 * blockCount * blockSize + ( blockCount - 2 ) * blockSize], blockSize );
+			targCpy( ( blockCount - 1 ) * blockCount * blockSize, &tempData[ 1 * blockCount * blockSize + ( blockCount - 2 ) * blockSize], blockSize );
 
-			ReadNormalsPacked( tempData, X, Z + 1, L );
+			tempData = neighbours[ 7 ];
 
 			for( int x = 1; x < blockCount - 1; x ++ )
 			{
-				targCpy( x * blockSize + ( blockCount - 1 ) * blockCount * blockSize, &(*tempData)[ 1 * blockCount * blockSize + x * blockSize ], blockSize );
+				targCpy( x * blockSize + ( blockCount - 1 ) * blockCount * blockSize, &tempData[ 1 * blockCount * blockSize + x * blockSize ], blockSize );
 			}
 		}
 
 		if( X < tileCountX - 1 )
 		{
-			ReadNormalsPacked( tempData, X + 1, Z, L );
+			tempData = neighbours[ 5 ];
 
 			for( int z = 1; z < blockCount - 1; z ++ )
 			{
-				targCpy( z * blockCount * blockSize + ( blockCount - 1 ) * blockSize, &(*tempData)[ z * blockCount * blockSize + 1 * blockSize ], blockSize );
+				targCpy( z * blockCount * blockSize + ( blockCount - 1 ) * blockSize, &tempData[ z * blockCount * blockSize + 1 * blockSize ], blockSize );
 			}
 
 			if( Z > 0 )
 			{
-				ReadNormalsPacked( tempData, X + 1, Z - 1, L );
+				tempData = neighbours[ 2 ];
 
-				targCpy( 0 * blockCount * blockSize + ( blockCount - 1 ) * blockSize, &(*tempData)[ ( blockCount - 2 ) * blockCount * blockSize + 1 * blockSize ], blockSize );
+				targCpy( 0 * blockCount * blockSize + ( blockCount - 1 ) * blockSize, &tempData[ ( blockCount - 2 ) * blockCount * blockSize + 1 * blockSize ], blockSize );
 			}
 
 			if( Z < tileCountZ - 1 )
 			{
-				ReadNormalsPacked( tempData, X + 1, Z + 1, L );
+				tempData = neighbours[ 8 ];
 
-				targCpy( ( blockCount - 1 ) * blockCount * blockSize + ( blockCount - 1 ) * blockSize, &(*tempData)[ 1 * blockCount * blockSize + 1 * blockSize ], blockSize );				
+				targCpy( ( blockCount - 1 ) * blockCount * blockSize + ( blockCount - 1 ) * blockSize, &tempData[ 1 * blockCount * blockSize + 1 * blockSize ], blockSize );				
 			}
 		}
 	}
@@ -4525,6 +4713,16 @@ r3dTerrain3::UpdateHeightNormalsPacked( const r3dTL::TArray< UINT16 > * heightDa
 
 void
 r3dTerrain3::ReadNormalsPacked( r3dTL::TArray< UINT16 > * oData, int X, int Z, int L )
+{
+	oData->Resize( GetNormalTileSizeInFile() / sizeof( (*oData)[ 0 ] ) );
+
+	ReadNormalsPacked( &(*oData)[ 0 ], X, Z, L );
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3::ReadNormalsPacked( UINT16* oData, int X, int Z, int L )
 {
 	MegaTexTile fakeTile;
 
@@ -4533,8 +4731,6 @@ r3dTerrain3::ReadNormalsPacked( r3dTL::TArray< UINT16 > * oData, int X, int Z, i
 
 	fakeTile.L = L;
 
-	oData->Resize( GetNormalTileSizeInFile() / sizeof( (*oData)[ 0 ] ) );
-
 	MegaTexFileGridOffset offset = GetMegaTexHeightNormalOffsetInFile( &fakeTile );
 
 #ifndef FINAL_BUILD
@@ -4542,7 +4738,7 @@ r3dTerrain3::ReadNormalsPacked( r3dTL::TArray< UINT16 > * oData, int X, int Z, i
 	{
 		int mapSize = GetHeightNormalRecordSizeInFile();
 		r3dMappedViewOfFile mappedViewOfFile = r3dCreateMappedViewOfFile( m_MegaTexAtlasFile_EDITOR_Mapping, FILE_MAP_READ, offset.EditorValue, mapSize );
-		DoLoadMegaTexTileHeightAndNormalFromFile( &mappedViewOfFile, 0, &fakeTile, &(*oData)[ 0 ], NULL, LOADTILE_NORMAL );
+		DoLoadMegaTexTileHeightAndNormalFromFile( &mappedViewOfFile, 0, &fakeTile, oData, NULL, LOADTILE_NORMAL );
 		UnmapViewOfFile( mappedViewOfFile.Mapped );
 	}
 	else
@@ -4550,7 +4746,7 @@ r3dTerrain3::ReadNormalsPacked( r3dTL::TArray< UINT16 > * oData, int X, int Z, i
 	{
 		if( offset.GridId == GRID_ID_MIPSFILE )
 		{
-			DoLoadMegaTexTileHeightAndNormalFromFile( m_MegaTexAtlasMipsFile, offset.Value, &fakeTile, &(*oData)[ 0 ], NULL, LOADTILE_NORMAL );
+			DoLoadMegaTexTileHeightAndNormalFromFile( m_MegaTexAtlasMipsFile, offset.Value, &fakeTile, oData, NULL, LOADTILE_NORMAL );
 		}
 		else
 		{
@@ -4558,7 +4754,7 @@ r3dTerrain3::ReadNormalsPacked( r3dTL::TArray< UINT16 > * oData, int X, int Z, i
 
 			int gridX, gridZ;
 			GetGridCoordinates( offset, &gridX, &gridZ );
-			DoLoadMegaTexTileHeightAndNormalFromFile( m_FileGrid[ gridZ ][ gridX ], offset.Value, &fakeTile, &(*oData)[ 0 ], NULL, LOADTILE_NORMAL );
+			DoLoadMegaTexTileHeightAndNormalFromFile( m_FileGrid[ gridZ ][ gridX ], offset.Value, &fakeTile, oData, NULL, LOADTILE_NORMAL );
 		}
 	}
 }
@@ -4568,7 +4764,7 @@ r3dTerrain3::ReadNormalsPacked( r3dTL::TArray< UINT16 > * oData, int X, int Z, i
 //------------------------------------------------------------------------
 
 void
-r3dTerrain3::RecalcNormalMap( const UShorts* ( &heights )[ 9 ], Floats* tempHeights, Vectors* tempVectors0, Vectors* tempVectors1, UShorts* oTempNormals, int L )
+r3dTerrain3::RecalcNormalMap( const UShorts* ( &heights )[ 9 ], Floats* tempHeights, Floats* tempNormals, UShorts* oTempNormals, int L )
 {
 	m_WasEdited = 1;
 
@@ -4688,136 +4884,11 @@ r3dTerrain3::RecalcNormalMap( const UShorts* ( &heights )[ 9 ], Floats* tempHeig
 		(*tempHeights)[ i ] = (*tempHeights)[ i ] * mulConv;
 	}
 
-	struct
-	{
-		float operator() ( int x, int z )
-		{
-			return (*heights)[ x + z * xTot ];
-		}
-
-		int xTot;
-
-		const Floats * heights;
-
-	} getHeight = { xTotal, tempHeights };
-
-	Vectors& NormalMapData = *tempVectors0;
-	Vectors& NormalBuf = *tempVectors1;
-
-	NormalMapData.Resize( xTotal * zTotal );
-	NormalBuf.Resize( NormalMapData.Count() );
-
-	r3d_assert( heights[ 4 ]->Count() == NormalMapData.Count() );
-	r3d_assert( heights[ 4 ]->Count() == NormalBuf.Count() );
-
-	int bx0 = 0;
-	int bx1 = xTotal;
-	int bz0 = 0;
-	int bz1 = zTotal;
-
 	float cellSize = m_CellSize * ( 1 << L );
 
-	for ( int z = bz0, ze = bz1; z < ze; z++ )
-	{
-		for ( int x = bx0, xe = bx1; x < xe; x++ )
-		{
-			int xx = R3D_MIN( x, xTotal - 1 );
-			int zz = R3D_MIN( z, zTotal - 1 );
-			float sx = getHeight( xx < xTotal-1 ? xx+1 : xx, zz) - getHeight(xx>0 ? xx-1 : xx, zz);
-			if (xx == 0 || xx == xTotal-1)
-				sx *= 2;
-
-			float sy = getHeight( xx, zz < zTotal - 1 ? zz+1 : zz) - getHeight(xx, zz>0 ?  zz-1 : zz);
-			if( zz == 0 || zz == zTotal - 1 )
-				sy *= 2;
-
-			r3dPoint3D vN(-sx, cellSize, -sy);
-			vN.Normalize();
-
-			NormalMapData[ zz * xTotal + xx ] = vN;
-		}
-	}
-
-	// do separable normal 'blur'
-	for( int i = 0; i < 4; i ++ )
-	{
-		r3dPoint3D* source;
-		r3dPoint3D* target;
-
-		int dirx;
-		int dirz;
-
-		if( i & 1 )
-		{
-			source = &NormalBuf[ 0 ];
-			target = &NormalMapData[ 0 ];
-
-			dirx = 1;
-			dirz = 0;
-		}
-		else
-		{
-			source = &NormalMapData[ 0 ];
-			target = &NormalBuf[ 0 ];
-
-			dirx = 0;
-			dirz = 1;
-		}
-
-		for ( int z = bz0, ze = bz1; z < ze; z++ )
-		{
-			for ( int x = bx0, xe = bx1; x < xe; x++ )
-			{
-
-				int xc = x, zc = z;
-
-				int x0	= R3D_MAX( xc - dirx, 0 ), 
-					x1	= R3D_MIN( xc + dirx, xTotal - 1 ),
-					z0	= R3D_MAX( zc - dirz, 0 ), 
-					z1	= R3D_MIN( zc + dirz, zTotal - 1 );
-
-
-				r3dPoint3D	vN =	source[ zc * xTotal + xc ];
-							vN +=	source[ z0 * xTotal + x0 ];
-							vN +=	source[ z1 * xTotal + x1 ];
-
-				vN.Normalize();
-
-				target[ zc * xTotal + xc ] = vN;
-			}
-		}
-	}
-
-	struct R5G6B5
-	{
-		UINT16 b : 5;
-		UINT16 g : 6;
-		UINT16 r : 5;
-	} * lockee = static_cast<R5G6B5*> ( (void*)&(*oTempNormals)[ 0 ] );
-
-	for( int z = 0, ze = zTotal; z < ze; z ++ )
-	{
-		for( int x = 0, xe = xTotal; x < xe; x ++ )
-		{
-			const r3dPoint3D& n = NormalMapData[ x + z * xTotal ];			
-
-			for( int nz = z * m_NormalDensity, e = nz + m_NormalDensity; nz < e; nz ++ )
-			{
-				for( int nx = x * m_NormalDensity, e = nx + m_NormalDensity; nx < e; nx ++ )
-				{
-					int idx = nx + nz * xTotal;
-
-					R5G6B5& sample = lockee[ idx ];
+	tempNormals->Resize( xTotal * zTotal * 6 );
 
-					r3dPoint3D fn = n;
-
-					sample.r = R3D_MIN( R3D_MAX( int( ( fn.x * 0.5f + 0.5f ) * 31 ), 0 ), 31 );
-					sample.g = R3D_MIN( R3D_MAX( int( ( fn.y * 0.5f + 0.5f ) * 63 ), 0 ), 63 );
-					sample.b = R3D_MIN( R3D_MAX( int( ( fn.z * 0.5f + 0.5f ) * 31 ), 0 ), 31 );
-				}
-			}
-		}
-	}	
+	r3dTerrain3CalcNormals( &(*tempHeights)[ 0 ], xTotal, cellSize, &(*tempNormals)[ 0 ], &(*oTempNormals)[ 0 ] );
 #endif
 }
 
@@ -5243,98 +5314,271 @@ void r3dTerrain3::DEBUG_PrintStats()
 
 //------------------------------------------------------------------------
 
-void r3dTerrain3::DEBUG_CheckTileInfoConsistency()
+void r3dTerrain3::DEBUG_HeightFieldBenchmark( int pointCount )
 {
-	for( FileTextureGridMap::iterator	i = m_MegaTexGridFile_Map.begin(),
-										e = m_MegaTexGridFile_Map.end();
-										i != e;
-										++ i
-										)
+	if( !m_HeightField.IsValid() )
 	{
-		short tx, tz;
-		char L;
-		int maskId;
+		r3dOutToLog( "terra3hfbench: terrain has no heightfield\n" );
+		return;
+	}
 
-		MegaTexTile::DecodeID( i->first, &tx, &tz, &L, &maskId );
+	const r3dTerrainDesc& desc = GetDesc();
 
-		MegaTexTileInfo& info = m_MegaTexTileInfoMipChain[ L ][ tz ][ tx ];
-		
-	}
-}
+	pointCount = R3D_MAX( pointCount, 4 );
 
-//------------------------------------------------------------------------
+	r3dTL::TArray< r3dPoint3D > points;
+	r3dTL::TArray< float > heights;
+	r3dTL::TArray< float > batchHeights;
 
-void r3dTerrain3::CreateDefaultPoolResources()
-{
-	for (size_t i = 0; i < m_HeightNormalAtlas.Count(); ++i)
-	{
-		HeightNormalAtlasVolume &v = m_HeightNormalAtlas[i];
-		CreateHeightNormalTexture(v.Height, TERRA3_MEGAHEIGHT_FORMAT);
-		CreateHeightNormalTexture(v.Normal, TERRA3_MEGANORMAL_FORMAT);
-	}
+	points.Resize( pointCount );
+	heights.Resize( pointCount );
+	batchHeights.Resize( pointCount );
 
-	for (size_t i = 0; i < m_MaskAtlas.Count(); ++i)
+	for( int i = 0; i < pointCount; i ++ )
 	{
-		MaskAtlasVolume &v = m_MaskAtlas[i];
-		CreateMaskTexture(v.Mask);
+		points[ i ] = r3dPoint3D( u_GetRandom( 0.f, desc.XSize ), 0.f, u_GetRandom( 0.f, desc.ZSize ) );
 	}
 
-	for( int L = 0, e = (int)m_AllocMegaTexTileLodArray.Count(); L < e; L ++ )
-	{
-		MegaTexTilePtrArr& ptrArr = m_AllocMegaTexTileLodArray[ L ];
+	r3dOutToLog( "terra3hfbench: %d random points over %.0fx%.0f m, heightfield %dx%d ( %.1f MB )\n", pointCount, desc.XSize, desc.ZSize,
+					m_HeightField.GetSampleCountX(), m_HeightField.GetSampleCountZ(), m_HeightField.GetDataSize() / 1024.f / 1024.f );
 
-		for( int i = 0, e = (int)ptrArr.Count(); i < e; i ++ )
-		{
-			MegaTexTile* mega = ptrArr[ i ];
+	CLOG_INDENT;
 
-			if( mega->IsInAtlas() && mega->IsLoaded )
-			{
-				AddMegaTexTileUpdateJobs( mega,	LOADTILE_MASKS | LOADTILE_NORMAL | 
-												LOADTILE_HEIGHT | LOADTILE_UPDATEATLAS );
-			}
-		}
+	float sum = 0.f;
+
+	// old path, returns MinHeight for most points because they are outside of physics chunks
+	float timeStart = r3dGetTime();
+
+	for( int i = 0; i < pointCount; i ++ )
+	{
+		sum += GetPhysicsHeight( points[ i ] );
 	}
-}
 
-//------------------------------------------------------------------------
+	float physTime = r3dGetTime() - timeStart;
 
-void r3dTerrain3::DestroyDefaultPoolResources()
-{
-	for (size_t i = 0; i < m_HeightNormalAtlas.Count(); ++i)
+	timeStart = r3dGetTime();
+
+	for( int i = 0; i < pointCount; i ++ )
 	{
-		HeightNormalAtlasVolume &v = m_HeightNormalAtlas[i];
-		v.Normal->Destroy();
-		v.Height->Destroy();
+		heights[ i ] = m_HeightField.GetHeight( points[ i ].x, points[ i ].z );
 	}
 
-	for (size_t i = 0; i < m_MaskAtlas.Count(); ++i)
+	float scalarTime = r3dGetTime() - timeStart;
+
+	timeStart = r3dGetTime();
+
+	m_HeightField.GetHeights( &points[ 0 ], &batchHeights[ 0 ], pointCount );
+
+	float batchTime = r3dGetTime() - timeStart;
+
+	int batchMismatches = 0;
+
+	for( int i = 0; i < pointCount; i ++ )
 	{
-		MaskAtlasVolume &v = m_MaskAtlas[i];
-		v.Mask->Destroy();
+		sum += batchHeights[ i ];
+
+		if( batchHeights[ i ] != heights[ i ] )
+			batchMismatches ++;
 	}
-}
 
-//------------------------------------------------------------------------
+	r3dOutToLog( "physics chunks: %.2f Mpoints/s\n", pointCount / R3D_MAX( physTime, 1e-6f ) * 1e-6f );
+	r3dOutToLog( "heightfield: %.2f Mpoints/s, batched %.2f Mpoints/s, %d batched results differ\n",
+					pointCount / R3D_MAX( scalarTime, 1e-6f ) * 1e-6f, pointCount / R3D_MAX( batchTime, 1e-6f ) * 1e-6f, batchMismatches );
 
-int
-r3dTerrain3::CheckMegaMap()
-{
-#ifndef FINAL_BUILD
-	INT64 tileSizeInfFile = GetMaskTileSizeInFile() + sizeof( short );
+	// where physics chunks exist both should agree up to triangle vs bilinear interpolation
+	const QualitySettings& qs = GetCurrentQualitySettings();
 
-	int count = 0;
+	float chunkSize = qs.PhysicsTileCellCount * desc.CellSize;
 
-	for( FileTextureGridMap::iterator	i = m_MegaTexGridFile_Map.begin(),
-									e = m_MegaTexGridFile_Map.end();
-									i != e;
-									++ i )
+	int compared = 0;
+	float maxDiff = 0.f;
+	double sumDiff = 0.0;
+
+	for( int i = 0, e = (int)m_PhysicsChunks.Count(); i < e; i ++ )
 	{
-		INT64 val = i->second.Value;
-		INT64 gridId = i->second.GridId;
+		const PhysicsChunk& chunk = m_PhysicsChunks[ i ];
 
-		for( FileTextureGridMap::iterator	i = m_MegaTexGridFile_Map.begin(),
-										e = m_MegaTexGridFile_Map.end();
-										i != e;
+		if( !chunk.PhysicsHeightField )
+			continue;
+
+		for( int j = 0; j < 1024; j ++ )
+		{
+			r3dPoint3D pos( chunk.ChunkX * chunkSize + u_GetRandom( 0.f, chunkSize ), 0.f, chunk.ChunkZ * chunkSize + u_GetRandom( 0.f, chunkSize ) );
+
+			float diff = fabsf( GetPhysicsHeight( pos ) - m_HeightField.GetHeight( pos.x, pos.z ) );
+
+			maxDiff = R3D_MAX( maxDiff, diff );
+			sumDiff += diff;
+			compared ++;
+		}
+	}
+
+	r3dOutToLog( "against physics chunks: %d points, max difference %.3f m, average %.4f m\n", compared, maxDiff, compared ? sumDiff / compared : 0.0 );
+
+	// rays from above at random slopes, against marching with GetHeight
+	int rayCount = R3D_MAX( pointCount / 256, 16 );
+	float rayLength = 512.f;
+	float step = desc.CellSize * 0.25f;
+
+	int hits = 0;
+	int marchHits = 0;
+	int disagree = 0;
+	float maxHitDiff = 0.f;
+
+	float rayTime = 0.f;
+	float marchTime = 0.f;
+
+	for( int i = 0; i < rayCount; i ++ )
+	{
+		r3dPoint3D from = points[ i ];
+		from.y = batchHeights[ i ] + u_GetRandom( 2.f, 100.f );
+
+		float angle = u_GetRandom( 0.f, 2.f * R3D_PI );
+		float slope = u_GetRandom( 0.02f, 1.2f );
+
+		r3dPoint3D dir( cosf( angle ) * cosf( slope ), -sinf( slope ), sinf( angle ) * cosf( slope ) );
+
+		float t = 0.f;
+
+		timeStart = r3dGetTime();
+		int hit = m_HeightField.Raycast( from, dir, rayLength, &t );
+		rayTime += r3dGetTime() - timeStart;
+
+		float marchT = -1.f;
+
+		timeStart = r3dGetTime();
+
+		for( float mt = 0.f; mt <= rayLength; mt += step )
+		{
+			r3dPoint3D pos = from + dir * mt;
+
+			if( pos.x < 0.f || pos.x > desc.XSize || pos.z < 0.f || pos.z > desc.ZSize )
+				break;
+
+			if( pos.y <= m_HeightField.GetHeight( pos.x, pos.z ) )
+			{
+				marchT = mt;
+				break;
+			}
+		}
+
+		marchTime += r3dGetTime() - timeStart;
+
+		hits += hit;
+		marchHits += marchT >= 0.f;
+
+		if( hit && marchT >= 0.f )
+		{
+			// march overshoots by up to one step
+			maxHitDiff = R3D_MAX( maxHitDiff, marchT - t );
+		}
+		else if( hit != ( marchT >= 0.f ) )
+		{
+			disagree ++;
+		}
+	}
+
+	r3dOutToLog( "rays: %d, raycast %.1f us/ray ( %d hits ), march %.1f us/ray ( %d hits ), %d disagree, max hit difference %.3f m ( march step %.3f m )\n",
+					rayCount, rayTime * 1e6f / rayCount, hits, marchTime * 1e6f / rayCount, marchHits, disagree, maxHitDiff, step );
+
+	// keep the loops from being optimized away
+	r3dOutToLog( "checksum %f\n", sum );
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3::DEBUG_CheckTileInfoConsistency()
+{
+	for( FileTextureGridMap::iterator	i = m_MegaTexGridFile_Map.begin(),
+										e = m_MegaTexGridFile_Map.end();
+										i != e;
+										++ i
+										)
+	{
+		short tx, tz;
+		char L;
+		int maskId;
+
+		MegaTexTile::DecodeID( i->first, &tx, &tz, &L, &maskId );
+
+		MegaTexTileInfo& info = m_MegaTexTileInfoMipChain[ L ][ tz ][ tx ];
+		
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3::CreateDefaultPoolResources()
+{
+	for (size_t i = 0; i < m_HeightNormalAtlas.Count(); ++i)
+	{
+		HeightNormalAtlasVolume &v = m_HeightNormalAtlas[i];
+		CreateHeightNormalTexture(v.Height, TERRA3_MEGAHEIGHT_FORMAT);
+		CreateHeightNormalTexture(v.Normal, TERRA3_MEGANORMAL_FORMAT);
+	}
+
+	for (size_t i = 0; i < m_MaskAtlas.Count(); ++i)
+	{
+		MaskAtlasVolume &v = m_MaskAtlas[i];
+		CreateMaskTexture(v.Mask);
+	}
+
+	for( int L = 0, e = (int)m_AllocMegaTexTileLodArray.Count(); L < e; L ++ )
+	{
+		MegaTexTilePtrArr& ptrArr = m_AllocMegaTexTileLodArray[ L ];
+
+		for( int i = 0, e = (int)ptrArr.Count(); i < e; i ++ )
+		{
+			MegaTexTile* mega = ptrArr[ i ];
+
+			if( mega->IsInAtlas() && mega->IsLoaded )
+			{
+				AddMegaTexTileUpdateJobs( mega,	LOADTILE_MASKS | LOADTILE_NORMAL | 
+												LOADTILE_HEIGHT | LOADTILE_UPDATEATLAS );
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3::DestroyDefaultPoolResources()
+{
+	for (size_t i = 0; i < m_HeightNormalAtlas.Count(); ++i)
+	{
+		HeightNormalAtlasVolume &v = m_HeightNormalAtlas[i];
+		v.Normal->Destroy();
+		v.Height->Destroy();
+	}
+
+	for (size_t i = 0; i < m_MaskAtlas.Count(); ++i)
+	{
+		MaskAtlasVolume &v = m_MaskAtlas[i];
+		v.Mask->Destroy();
+	}
+}
+
+//------------------------------------------------------------------------
+
+int
+r3dTerrain3::CheckMegaMap()
+{
+#ifndef FINAL_BUILD
+	INT64 tileSizeInfFile = GetMaskTileSizeInFile() + sizeof( short );
+
+	int count = 0;
+
+	for( FileTextureGridMap::iterator	i = m_MegaTexGridFile_Map.begin(),
+									e = m_MegaTexGridFile_Map.end();
+									i != e;
+									++ i )
+	{
+		INT64 val = i->second.Value;
+		INT64 gridId = i->second.GridId;
+
+		for( FileTextureGridMap::iterator	i = m_MegaTexGridFile_Map.begin(),
+										e = m_MegaTexGridFile_Map.end();
+										i != e;
 										++ i )
 		{
 			if( i->second.GridId == gridId )
@@ -6976,6 +7220,55 @@ r3dTerrain3::SwitchVFetchMode()
 
 float
 r3dTerrain3::GetHeight( int x, int z ) /*OVERRIDE*/
+{
+	if( m_HeightField.IsValid() )
+		return m_HeightField.GetHeight( x, z );
+
+	return GetPhysicsHeight( x, z );
+}
+
+//------------------------------------------------------------------------
+/*virtual*/
+
+float
+r3dTerrain3::GetHeight( const r3dPoint3D& pos )	/*OVERRIDE*/
+{
+	if( m_HeightField.IsValid() )
+		return m_HeightField.GetHeight( pos.x, pos.z );
+
+	return GetPhysicsHeight( pos );
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3::GetHeights( const r3dPoint3D* points, float* oHeights, int count )
+{
+	if( m_HeightField.IsValid() )
+	{
+		m_HeightField.GetHeights( points, oHeights, count );
+	}
+	else
+	{
+		for( int i = 0; i < count; i ++ )
+		{
+			oHeights[ i ] = GetPhysicsHeight( points[ i ] );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+const r3dTerrain3HeightField&
+r3dTerrain3::GetHeightField() const
+{
+	return m_HeightField;
+}
+
+//------------------------------------------------------------------------
+
+float
+r3dTerrain3::GetPhysicsHeight( int x, int z )
 {
 	const QualitySettings& qs = GetCurrentQualitySettings();
 	const r3dTerrainDesc& tdesc = GetDesc();
@@ -7038,10 +7331,9 @@ r3dTerrain3::GetHeight( int x, int z ) /*OVERRIDE*/
 }
 
 //------------------------------------------------------------------------
-/*virtual*/
 
 float
-r3dTerrain3::GetHeight( const r3dPoint3D& pos )	/*OVERRIDE*/
+r3dTerrain3::GetPhysicsHeight( const r3dPoint3D& pos )
 {
 	const QualitySettings& qs = GetCurrentQualitySettings();
 	const r3dTerrainDesc& tdesc = GetDesc();
@@ -7529,6 +7821,13 @@ r3dTerrain3::GetDominantTexture( const r3dPoint3D &pos ) /*OVERRIDE*/
 //------------------------------------------------------------------------
 /*virtual*/ int r3dTerrain3::IsPosWithinPreciseHeights( const r3dPoint3D& pos ) const /*OVERRIDE*/
 {
+	if( m_HeightField.IsValid() )
+	{
+		const r3dTerrainDesc& tdesc = GetDesc();
+
+		return pos.x >= 0.f && pos.x <= tdesc.XSize && pos.z >= 0.f && pos.z <= tdesc.ZSize;
+	}
+
 #if R3D_TERRAIN3_ALLOW_FULL_PHYSCHUNKS
 	if( m_FullPhysChunkModeOn )
 	{
@@ -7573,6 +7872,23 @@ r3dTerrain3::GetDominantTexture( const r3dPoint3D &pos ) /*OVERRIDE*/
 	return 0;
 }
 
+//------------------------------------------------------------------------
+/*virtual*/ int r3dTerrain3::FindRayIntersection( const r3dPoint3D& from, const r3dPoint3D& to, r3dPoint3D* oHit ) /*OVERRIDE*/
+{
+	if( !m_HeightField.IsValid() )
+		return -1;
+
+	float t;
+
+	if( !m_HeightField.Raycast( from, to - from, 1.f, &t ) )
+		return 0;
+
+	*oHit = from + ( to - from ) * t;
+	oHit->y = m_HeightField.GetHeight( oHit->x, oHit->z );
+
+	return 1;
+}
+
 //------------------------------------------------------------------------
 
 int r3dTerrain3::GetNumLoadingMegaTiles() const
@@ -8106,6 +8422,8 @@ r3dTerrain3::DoLoad( const char* dir )
 
 	UpdateDesc();
 
+	InitHeightField( dirName );
+
 	RecreateLowResNormals();
 
 	m_IsQualityUpdated = 0;
@@ -8299,6 +8617,7 @@ r3dTerrain3::DoSave( const char* targetDir, int rescaleVertexCountX, int rescale
 	if( m_WasEdited )
 	{
 		WriteMipStamps( targetDir );
+		SaveHeightField( targetDir );
 		m_WasEdited = 0;
 	}
 
@@ -16880,65 +17199,196 @@ void r3dTerrain3::WriteMipStamps( const char* levelPath )
 
 //------------------------------------------------------------------------
 
-int r3dTerrain3::LoadMegaTexTileInfos( const char* levelPath )
+void r3dTerrain3::InitHeightField( const char* levelPath )
 {
-	InitTileInfoMipChain( m_QualitySettings );
+	R3DPROFILE_FUNCTION( "r3dTerrain3::InitHeightField" );
 
-	r3dTL::T2DArray< r3dFile* > fileGrid;
+	m_HeightField.Close();
 
-	fileGrid.Resize( m_FileChunkCountX, m_FileChunkCountZ );
+	SetupHFScale();
 
-	for( int z = 0, e = fileGrid.Height(); z < e; z ++ )
+	const r3dTerrainDesc& desc = GetDesc();
+	Info info = GetInfo();
+
+	int sampleCountX = info.MegaTileCountX * m_MegaTexAtlasFile_HeightDim;
+	int sampleCountZ = info.MegaTileCountZ * m_MegaTexAtlasFile_HeightDim;
+
+	if( sampleCountX < 2 || sampleCountZ < 2 )
+		return;
+
+	float timeStart = r3dGetTime();
+
+	int built = 0;
+
+#if R3D_TERRAIN_V3_GRAPHICS
+	Bytes stamp;
+	ReadDistribStamp( levelPath, &stamp );
+
+	char path[ 512 ];
+	GetHeightFieldFileName( path );
+
+	if( stamp.Count() && m_HeightField.Open( path, &stamp[ 0 ], stamp.Count() ) )
 	{
-		for( int x = 0, e = fileGrid.Width(); x < e; x ++ )
+		if( m_HeightField.GetSampleCountX() != sampleCountX || m_HeightField.GetSampleCountZ() != sampleCountZ
+				||
+			m_HeightField.GetCellSize() != desc.CellSize || m_HeightField.GetMinHeight() != desc.MinHeight )
 		{
-			char buffer[ 512 ];
-			GetTileInfosChunkFileName( buffer, x, z );
-			fileGrid[ z ][ x ] = r3d_open( buffer, "rb" );
+			m_HeightField.Close();
 		}
 	}
 
-	for( int z = 0, e = fileGrid.Height(); z < e; z ++ )
+	if( !m_HeightField.IsValid() )
 	{
-		for( int x = 0, e = fileGrid.Width(); x < e; x ++ )
+		BuildHeightField();
+		built = 1;
+
+		// keep only the mapped copy, pages are loaded on demand and shared with other clients
+		if( stamp.Count() && m_HeightField.Save( path, &stamp[ 0 ], stamp.Count() ) )
 		{
-			if( !fileGrid[ z ][ x ] )
-				return 0;
+			if( !m_HeightField.Open( path, &stamp[ 0 ], stamp.Count() ) )
+			{
+				BuildHeightField();
+			}
 		}
 	}
+#else
+	BuildHeightField();
+	built = 1;
+#endif
 
-	struct CloseOnExit
+#ifndef FINAL_BUILD
+	// editor updates heights tile by tile
+	if( g_bEditMode )
 	{
-		~CloseOnExit()
-		{
-			r3dTL::T2DArray< r3dFile* >& fileGrid = *filesToClose;
+		m_HeightField.MakeWritable();
+	}
+#endif
 
-			for( int z = 0, e = fileGrid.Height(); z < e; z ++ )
-			{
-				for( int x = 0, e = fileGrid.Width(); x < e; x ++ )
-				{
-					if( fileGrid[ z ][ x ] )
-					{
-						fclose( fileGrid[ z ][ x ] );
-					}
-				}
-			}
-		}
+	r3dOutToLog( "r3dTerrain3::InitHeightField: %dx%d, %.1f MB, %s in %.2f sec\n", sampleCountX, sampleCountZ,
+					m_HeightField.GetDataSize() / 1024.f / 1024.f, built ? "built" : "mapped", r3dGetTime() - timeStart );
+}
 
-		r3dTL::T2DArray< r3dFile* >* filesToClose;
-	} closeOnExit; (void)closeOnExit;
+//------------------------------------------------------------------------
 
-	closeOnExit.filesToClose = &fileGrid;
+void r3dTerrain3::BuildHeightField()
+{
+	const r3dTerrainDesc& desc = GetDesc();
+	Info info = GetInfo();
 
-	//------------------------------------------------------------------------
-	for( int z = 0, e = fileGrid.Height(); z < e; z ++ )
+	int dim = m_MegaTexAtlasFile_HeightDim;
+
+	m_HeightField.Create( info.MegaTileCountX * dim, info.MegaTileCountZ * dim, desc.CellSize, desc.MinHeight, m_InvHFScale );
+
+	UShorts heights;
+
+	for( int tz = 0; tz < info.MegaTileCountZ; tz ++ )
 	{
-		for( int x = 0, e = fileGrid.Width(); x < e; x ++ )
+		for( int tx = 0; tx < info.MegaTileCountX; tx ++ )
 		{
-			char sigChars[ sizeof MEGATEXMEGATEXTILEINFOSCHUNKED_SIG ] = { 0 };
+			UnpackHeight( &heights, tx, tz, 0 );
+			r3d_assert( (int)heights.Count() == dim * dim );
 
-			if( !fread( sigChars, sizeof sigChars, 1, fileGrid[ z ][ x ] ) )
-				return 0;
+			m_HeightField.SetTile( tx, tz, dim, &heights[ 0 ] );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3::GetHeightFieldFileName( char* buff )
+{
+	GetMipFileDir( buff );
+	strcat( buff, "heights.bin" );
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3::SaveHeightField( const char* levelPath )
+{
+#if R3D_TERRAIN_V3_GRAPHICS
+	if( !m_HeightField.IsValid() )
+		return;
+
+	Bytes stamp;
+	ReadDistribStamp( levelPath, &stamp );
+
+	if( !stamp.Count() )
+		return;
+
+	char path[ 512 ];
+	GetHeightFieldFileName( path );
+
+	// mapped file can't be rewritten
+	m_HeightField.MakeWritable();
+
+	if( !m_HeightField.Save( path, &stamp[ 0 ], stamp.Count() ) )
+	{
+		r3dOutToLog( "r3dTerrain3::SaveHeightField: couldn't write %s\n", path );
+	}
+#endif
+}
+
+//------------------------------------------------------------------------
+
+int r3dTerrain3::LoadMegaTexTileInfos( const char* levelPath )
+{
+	InitTileInfoMipChain( m_QualitySettings );
+
+	r3dTL::T2DArray< r3dFile* > fileGrid;
+
+	fileGrid.Resize( m_FileChunkCountX, m_FileChunkCountZ );
+
+	for( int z = 0, e = fileGrid.Height(); z < e; z ++ )
+	{
+		for( int x = 0, e = fileGrid.Width(); x < e; x ++ )
+		{
+			char buffer[ 512 ];
+			GetTileInfosChunkFileName( buffer, x, z );
+			fileGrid[ z ][ x ] = r3d_open( buffer, "rb" );
+		}
+	}
+
+	for( int z = 0, e = fileGrid.Height(); z < e; z ++ )
+	{
+		for( int x = 0, e = fileGrid.Width(); x < e; x ++ )
+		{
+			if( !fileGrid[ z ][ x ] )
+				return 0;
+		}
+	}
+
+	struct CloseOnExit
+	{
+		~CloseOnExit()
+		{
+			r3dTL::T2DArray< r3dFile* >& fileGrid = *filesToClose;
+
+			for( int z = 0, e = fileGrid.Height(); z < e; z ++ )
+			{
+				for( int x = 0, e = fileGrid.Width(); x < e; x ++ )
+				{
+					if( fileGrid[ z ][ x ] )
+					{
+						fclose( fileGrid[ z ][ x ] );
+					}
+				}
+			}
+		}
+
+		r3dTL::T2DArray< r3dFile* >* filesToClose;
+	} closeOnExit; (void)closeOnExit;
+
+	closeOnExit.filesToClose = &fileGrid;
+
+	//------------------------------------------------------------------------
+	for( int z = 0, e = fileGrid.Height(); z < e; z ++ )
+	{
+		for( int x = 0, e = fileGrid.Width(); x < e; x ++ )
+		{
+			char sigChars[ sizeof MEGATEXMEGATEXTILEINFOSCHUNKED_SIG ] = { 0 };
+
+			if( !fread( sigChars, sizeof sigChars, 1, fileGrid[ z ][ x ] ) )
+				return 0;
 
 			if( memcmp( sigChars, MEGATEXMEGATEXTILEINFOSCHUNKED_SIG, sizeof sigChars ) )
 			{
@@ -18398,6 +18848,129 @@ void r3dTerrain3::RecalcTileCoordBorders( const TileCoords& tcoords, UShorts& te
 
 //------------------------------------------------------------------------
 
+namespace
+{
+	enum
+	{
+		HALF_MEGA_TEX_BORDER = r3dTerrain3::MEGA_TEX_BORDER / 2
+	};
+
+	// downsamples mask of child tile ( childX, childZ ) into its quarter of parent tile
+	void DownsampleMaskIntoParent( const UINT16* child, UINT16* parent, int orgDim, int childX, int childZ )
+	{
+		int dim = orgDim / 2;
+
+		int relToPrevX = childX & 1;
+		int relToPrevZ = childZ & 1;
+
+		int xTargetStart = relToPrevX * dim + ( relToPrevX ? -HALF_MEGA_TEX_BORDER : HALF_MEGA_TEX_BORDER );
+		int zTargetStart = relToPrevZ * dim + ( relToPrevZ ? -HALF_MEGA_TEX_BORDER : HALF_MEGA_TEX_BORDER );
+
+		r3dTerrain3DownsampleMask( child, orgDim, parent + zTargetStart * orgDim + xTargetStart, orgDim, dim, dim );
+	}
+
+	struct MaskMipTile
+	{
+		int X;
+		int Z;
+		int MaskId;
+		int ChildBits;	// bit ( z & 1 ) * 2 + ( x & 1 ) is set for children which have the mask
+	};
+
+	struct MaskMipBatchParams
+	{
+		const MaskMipTile*				Tiles;
+		r3dTerrain3::UShorts*			Parents;
+		const r3dTerrain3::UShorts*		Children;	// 4 per parent
+		int								Dim;
+	};
+
+	void DownsampleMaskBatchMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+	{
+		const MaskMipBatchParams& p = *static_cast< const MaskMipBatchParams* >( Data );
+
+		for( size_t i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+		{
+			const MaskMipTile& t = p.Tiles[ i ];
+
+			for( int q = 0; q < 4; q ++ )
+			{
+				if( t.ChildBits & 1 << q )
+				{
+					DownsampleMaskIntoParent( &p.Children[ i * 4 + q ][ 0 ], &p.Parents[ i ][ 0 ], p.Dim, t.X * 2 + ( q & 1 ), t.Z * 2 + ( q >> 1 ) );
+				}
+			}
+		}
+	}
+
+	struct HeightMipRowParams
+	{
+		const r3dTerrain3::UShorts*	Children[ 2 ];	// two rows of child tiles, twice as many as parents
+		r3dTerrain3::UShorts*		Parents;
+		int							Dim;
+	};
+
+	void DownsampleHeightRowMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+	{
+		const HeightMipRowParams& p = *static_cast< const HeightMipRowParams* >( Data );
+
+		int dim = p.Dim;
+		int half = dim / 2;
+
+		for( size_t i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+		{
+			UINT16* parent = &p.Parents[ i ][ 0 ];
+
+			for( int q = 0; q < 4; q ++ )
+			{
+				const r3dTerrain3::UShorts& child = p.Children[ q >> 1 ][ i * 2 + ( q & 1 ) ];
+
+				r3dTerrain3DownsampleHeights( &child[ 0 ], dim, parent + ( q & 1 ) * half + ( q >> 1 ) * half * dim, dim, half, half );
+			}
+		}
+	}
+
+	struct NormalRowParams
+	{
+		r3dTerrain3*				Terrain;
+		const r3dTerrain3::UShorts*	Rows[ 3 ];	// heights of rows above, at and below, NULL outside of level
+		int							TileCountX;
+		int							L;
+
+		r3dTerrain3::Floats*		TempHeights;	// per thread
+		r3dTerrain3::Floats*		TempNormals;	// per thread
+		r3dTerrain3::UShorts*		Normals;
+	};
+
+	void CalcNormalRowMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+	{
+		const NormalRowParams& p = *static_cast< const NormalRowParams* >( Data );
+
+		for( int x = (int)ItemStart, e = int( ItemStart + ItemCount ); x < e; x ++ )
+		{
+			const r3dTerrain3::UShorts* heights[ 9 ] = { NULL };
+
+			for( int z = 0; z < 3; z ++ )
+			{
+				if( !p.Rows[ z ] )
+					continue;
+
+				for( int dx = -1; dx <= 1; dx ++ )
+				{
+					if( x + dx >= 0 && x + dx < p.TileCountX )
+					{
+						heights[ z * 3 + dx + 1 ] = &p.Rows[ z ][ x + dx ];
+					}
+				}
+			}
+
+			p.Terrain->RecalcNormalMap( heights, &p.TempHeights[ ThreadIndex ], &p.TempNormals[ ThreadIndex ], &p.Normals[ x ], p.L );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
 void r3dTerrain3::UpdateLayerMaskMipFromLevelBelow( int tx, int tz, int L, int maskId, 
 													UShorts& tempUShorts0, UShorts& tempUShorts1, 
 													IDirect3DTexture9* packedTexture, 
@@ -18405,124 +18978,214 @@ void r3dTerrain3::UpdateLayerMaskMipFromLevelBelow( int tx, int tz, int L, int m
 {
 	const r3dTerrain3::QualitySettings& qs = GetCurrentQualitySettings();
 
-	int orgDim = qs.MaskAtlasTileDim;
-	int dim = orgDim / 2;
-
-	enum
-	{
-		HALF_MEGA_TEX_BORDER = r3dTerrain3::MEGA_TEX_BORDER / 2
-	};
-
 	UnpackMask( &tempUShorts1, packedTexture, unpackedTexture, tx, tz, L, maskId );
 
 	for( int ttz = tz * 2, e = ( tz + 1 ) * 2; ttz < e; ttz ++ )
 	{
 		for( int ttx = tx * 2, e = ( tx + 1 ) * 2; ttx < e; ttx ++ )
 		{
-			int xStart = 0;
-			int zStart = 0;
-
 			if( !HasMask( ttx, ttz, L - 1, maskId ) )
 				continue;
 
 			UnpackMask( &tempUShorts0, packedTexture, unpackedTexture, ttx, ttz, L - 1, maskId );
 
-			int relToPrevX = ( ttx - ( ttx >> 1 << 1 ) );
-			int relToPrevZ = ( ttz - ( ttz >> 1 << 1 ) );
+			DownsampleMaskIntoParent( &tempUShorts0[ 0 ], &tempUShorts1[ 0 ], qs.MaskAtlasTileDim, ttx, ttz );
+		}
+	}
 
-			int xTargetStartOrg = ( ttx - ( ttx >> 1 << 1 ) ) * dim;
-			int zTargetStartOrg = ( ttz - ( ttz >> 1 << 1 ) ) * dim;
+	UpdateMask( &tempUShorts1, packedTexture, unpackedTexture, tx, tz, L, maskId );
 
-			int xTargetStart = xTargetStartOrg;
-			int zTargetStart = zTargetStartOrg;
+}
 
-			if( relToPrevX )
-				xTargetStart -= HALF_MEGA_TEX_BORDER;
-			else
-				xTargetStart += HALF_MEGA_TEX_BORDER;
+//------------------------------------------------------------------------
 
-			if( relToPrevZ )
-				zTargetStart -= HALF_MEGA_TEX_BORDER;
-			else
-				zTargetStart += HALF_MEGA_TEX_BORDER;
+int r3dTerrain3::UpdateLayerMaskMipsFromLevelBelow( int L, IDirect3DTexture9* packedTexture, IDirect3DTexture9* unpackedTexture, void (*reportCallBack)( int, int ) )
+{
+	Info info = GetInfo();
 
-			int xTargetEnd = xTargetStart + dim;
-			int zTargetEnd = zTargetStart + dim;
+	int maskCount = GetMaskCount();
 
-			if( xStart >= r3dTerrain3::MEGA_TEX_BORDER )
-			{
-				xStart -= r3dTerrain3::MEGA_TEX_BORDER;
-				xTargetStart -= HALF_MEGA_TEX_BORDER;
-			}
+	r3dTL::TArray< MaskMipTile > tiles;
 
-			if( zStart >= r3dTerrain3::MEGA_TEX_BORDER )
+	for( int tz = 0, e = info.MegaTileCountZ >> L; tz < e; tz ++ )
+	{
+		for( int tx = 0, e = info.MegaTileCountX >> L; tx < e; tx ++ )
+		{
+			for( int m = 0; m < maskCount; m ++ )
 			{
-				zStart -= r3dTerrain3::MEGA_TEX_BORDER;
-				zTargetStart -= HALF_MEGA_TEX_BORDER;
-			}
+				MaskMipTile t;
 
-			if( xStart + dim * 2 < orgDim - r3dTerrain3::MEGA_TEX_BORDER )
-			{
-				xTargetEnd += HALF_MEGA_TEX_BORDER;
-			}
+				t.X = tx;
+				t.Z = tz;
+				t.MaskId = m;
+				t.ChildBits = 0;
 
-			if( zStart + dim * 2 < orgDim - r3dTerrain3::MEGA_TEX_BORDER )
-			{
-				zTargetEnd += HALF_MEGA_TEX_BORDER;
+				for( int q = 0; q < 4; q ++ )
+				{
+					if( HasMask( tx * 2 + ( q & 1 ), tz * 2 + ( q >> 1 ), L - 1, m ) )
+						t.ChildBits |= 1 << q;
+				}
+
+				if( t.ChildBits )
+				{
+					tiles.PushBack( t );
+				}
 			}
+		}
+	}
+
+	int dim = GetCurrentQualitySettings().MaskAtlasTileDim;
+
+	// mask tiles are big, keep a few per thread in memory
+	int batchSize = R3D_MAX( (int)g_pJobChief->GetThreadCount() * 2, 4 );
+
+	r3dTL::TArray< UShorts > parents;
+	r3dTL::TArray< UShorts > children;
+
+	parents.Resize( batchSize );
+	children.Resize( batchSize * 4 );
+
+	for( int b = 0, e = tiles.Count(); b < e; b += batchSize )
+	{
+		int count = R3D_MIN( batchSize, e - b );
+
+		// unpacking and packing go through D3D textures, they stay on this thread
+		for( int i = 0; i < count; i ++ )
+		{
+			const MaskMipTile& t = tiles[ b + i ];
+
+			UnpackMask( &parents[ i ], packedTexture, unpackedTexture, t.X, t.Z, L, t.MaskId );
 
-			for( int z = zTargetStart, lz = 0; z < zTargetEnd; z ++, lz ++ )
+			for( int q = 0; q < 4; q ++ )
 			{
-				for( int x = xTargetStart, lx = 0; x < xTargetEnd; x ++, lx ++ )
+				if( t.ChildBits & 1 << q )
 				{
-					int srcIdxes[ 4 ];
+					UnpackMask( &children[ i * 4 + q ], packedTexture, unpackedTexture, t.X * 2 + ( q & 1 ), t.Z * 2 + ( q >> 1 ), L - 1, t.MaskId );
+				}
+			}
+		}
 
-					srcIdxes[ 0 ] = ( zStart + lz * 2 + 0 ) * qs.MaskAtlasTileDim + xStart + lx * 2 + 0;
-					srcIdxes[ 1 ] = ( zStart + lz * 2 + 1 ) * qs.MaskAtlasTileDim + xStart + lx * 2 + 0;
-					srcIdxes[ 2 ] = ( zStart + lz * 2 + 0 ) * qs.MaskAtlasTileDim + xStart + lx * 2 + 1;
-					srcIdxes[ 3 ] = ( zStart + lz * 2 + 1 ) * qs.MaskAtlasTileDim + xStart + lx * 2 + 1;
+		MaskMipBatchParams params;
 
-					int rsum = 0;
-					int gsum = 0;
-					int bsum = 0;
+		params.Tiles	= &tiles[ b ];
+		params.Parents	= &parents[ 0 ];
+		params.Children	= &children[ 0 ];
+		params.Dim		= dim;
 
-					union
-					{
-						struct
-						{
-							UINT16 r : 5;
-							UINT16 g : 6;
-							UINT16 b : 5;
-						};
+		g_pJobChief->Exec( DownsampleMaskBatchMT, &params, count );
 
-						UINT16 sample;
-					};
+		for( int i = 0; i < count; i ++ )
+		{
+			const MaskMipTile& t = tiles[ b + i ];
 
-					for( int i = 0; i < 4; i ++ )
-					{
-						sample = tempUShorts0[ srcIdxes[ i ] ];
+			UpdateMask( &parents[ i ], packedTexture, unpackedTexture, t.X, t.Z, L, t.MaskId );
+		}
 
-						rsum += r;
-						gsum += g;
-						bsum += b;
-					}
+		if( reportCallBack )
+		{
+			reportCallBack( b + count, e );
+		}
+	}
+
+	return tiles.Count();
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3::RebuildHeightNormalMips( int L, HeightMipWriter* writer )
+{
+	Info info = GetInfo();
+
+	int tileCountX = info.MegaTileCountX >> L;
+	int tileCountZ = info.MegaTileCountZ >> L;
+
+	if( !tileCountX || !tileCountZ )
+		return;
+
+	int dim = GetCurrentQualitySettings().HeightNormalAtlasTileDim;
+
+	int threadCount = g_pJobChief->GetThreadCount();
+
+	r3dTL::TArray< UShorts > children[ 2 ];
+
+	children[ 0 ].Resize( tileCountX * 2 );
+	children[ 1 ].Resize( tileCountX * 2 );
+
+	// last 3 rows of level, row z is at z % 3. Normals of row need rows around it
+	r3dTL::TArray< UShorts > rows[ 3 ];
+
+	for( int i = 0; i < 3; i ++ )
+	{
+		rows[ i ].Resize( tileCountX );
+
+		for( int x = 0; x < tileCountX; x ++ )
+		{
+			rows[ i ][ x ].Resize( dim * dim );
+		}
+	}
+
+	r3dTL::TArray< UShorts > normals;
+	normals.Resize( tileCountX );
 
-					rsum /= 4;
-					gsum /= 4;
-					bsum /= 4;
+	r3dTL::TArray< Floats > tempHeights;
+	r3dTL::TArray< Floats > tempNormals;
 
-					r = rsum;
-					g = gsum;
-					b = bsum;
+	tempHeights.Resize( threadCount );
+	tempNormals.Resize( threadCount );
 
-					tempUShorts1[ z * qs.MaskAtlasTileDim + x ] = sample;
+	for( int z = 0; z <= tileCountZ; z ++ )
+	{
+		if( z < tileCountZ )
+		{
+			for( int cz = 0; cz < 2; cz ++ )
+			{
+				for( int cx = 0; cx < tileCountX * 2; cx ++ )
+				{
+					UnpackHeight( &children[ cz ][ cx ], cx, z * 2 + cz, L - 1 );
+					r3d_assert( children[ cz ][ cx ].Count() == dim * dim );
 				}
 			}
+
+			HeightMipRowParams params;
+
+			params.Children[ 0 ]	= &children[ 0 ][ 0 ];
+			params.Children[ 1 ]	= &children[ 1 ][ 0 ];
+			params.Parents			= &rows[ z % 3 ][ 0 ];
+			params.Dim				= dim;
+
+			g_pJobChief->Exec( DownsampleHeightRowMT, &params, tileCountX );
+
+			for( int x = 0; x < tileCountX; x ++ )
+			{
+				writer->WriteHeights( rows[ z % 3 ][ x ], x, z, L );
+			}
 		}
-	}
 
-	UpdateMask( &tempUShorts1, packedTexture, unpackedTexture, tx, tz, L, maskId );
+		// normals lag a row behind heights
+		if( z > 0 )
+		{
+			int nz = z - 1;
+
+			NormalRowParams params;
+
+			params.Terrain		= this;
+			params.Rows[ 0 ]	= nz > 0 ? &rows[ ( nz - 1 ) % 3 ][ 0 ] : NULL;
+			params.Rows[ 1 ]	= &rows[ nz % 3 ][ 0 ];
+			params.Rows[ 2 ]	= nz + 1 < tileCountZ ? &rows[ ( nz + 1 ) % 3 ][ 0 ] : NULL;
+			params.TileCountX	= tileCountX;
+			params.L			= L;
+			params.TempHeights	= &tempHeights[ 0 ];
+			params.TempNormals	= &tempNormals[ 0 ];
+			params.Normals		= &normals[ 0 ];
+
+			g_pJobChief->Exec( CalcNormalRowMT, &params, tileCountX );
 
+			for( int x = 0; x < tileCountX; x ++ )
+			{
+				writer->WriteNormals( normals[ x ], x, nz, L );
+			}
+		}
+	}
 }
 
 //------------------------------------------------------------------------
@@ -18598,154 +19261,42 @@ void r3dTerrain3::CreateMipFile( const char* levelPath )
 
 	float range_div_3 = r3dITerrain::LoadingProgress / 3.f;
 
-	for( int i = 1, e = info.NumActiveMegaTexLayers; i < e; i ++ )
+	struct MipFileWriter : HeightMipWriter
 	{
-		AdvanceLoadingProgress( range_div_3 / ( info.NumActiveMegaTexLayers - 1 ) );
-
-		int tileCountX = info.MegaTileCountX >> i;
-		int tileCountZ = info.MegaTileCountZ >> i;
-
-		r3dTL::TArray< UINT16 > shorts00;
-		r3dTL::TArray< UINT16 > shorts10;
-		r3dTL::TArray< UINT16 > shorts01;
-		r3dTL::TArray< UINT16 > shorts11;
-
-		r3dTL::TArray< UINT16 > resultingShorts;
-
-		Bytes tempNormalData;
-
-		UShorts heightsForNorms[ 9 ];
-		Floats tempFloats;
-		Vectors tempVectors0, tempVectors1;
-		UShorts tempForNorms;
-
-		for( int z = 0, e = tileCountZ; z < e; z ++ )
+		virtual void WriteHeights( const UShorts& heights, int X, int Z, int L ) OVERRIDE
 		{
-			for( int x = 0, e = tileCountX; x < e; x ++ )
-			{
-				UnpackHeight( &shorts00, x * 2 + 0, z * 2 + 0, i - 1 );
-				UnpackHeight( &shorts10, x * 2 + 1, z * 2 + 0, i - 1 );
-				UnpackHeight( &shorts01, x * 2 + 0, z * 2 + 1, i - 1 );
-				UnpackHeight( &shorts11, x * 2 + 1, z * 2 + 1, i - 1 );
-
-				resultingShorts.Resize( shorts00.Count() );
-
-				for( int ii = 0; ii < 4; ii ++ )
-				{
-					int offsetX = 0;
-					int offsetZ = 0;
-
-					r3dTL::TArray< UINT16 >* usedShorts( NULL );
-
-					int halfTileDim = m_QualitySettings.MaskAtlasTileDim / 2;
-
-					switch( ii )
-					{
-					case 0:
-						offsetX = 0;
-						offsetZ = 0;
-						usedShorts = &shorts00;
-						break;
-					case 1:
-						offsetX = halfTileDim;
-						offsetZ = 0;
-						usedShorts = &shorts10;
-						break;
-					case 2:
-						offsetX = 0;
-						offsetZ = halfTileDim;
-						usedShorts = &shorts01;
-						break;
-					case 3:
-						offsetX = halfTileDim;
-						offsetZ = halfTileDim;
-						usedShorts = &shorts11;
-						break;
-					}
-
-					for( int zz = 0, ee = m_QualitySettings.MaskAtlasTileDim / 2; zz < ee; zz ++ )
-					{
-						for( int xx = 0, ee = m_QualitySettings.MaskAtlasTileDim / 2; xx < ee; xx ++ )
-						{
-							int x2 = xx * 2;
-							int z2 = zz * 2;
-							int height	 = ( *usedShorts )[ x2 + 0 + ( z2 + 0 ) * m_QualitySettings.MaskAtlasTileDim ];
-							height		+= ( *usedShorts )[ x2 + 1 + ( z2 + 0 ) * m_QualitySettings.MaskAtlasTileDim ];
-							height		+= ( *usedShorts )[ x2 + 0 + ( z2 + 1 ) * m_QualitySettings.MaskAtlasTileDim ];
-							height		+= ( *usedShorts )[ x2 + 1 + ( z2 + 1 ) * m_QualitySettings.MaskAtlasTileDim ];
-
-							resultingShorts[ ( xx + offsetX ) + ( zz + offsetZ ) * m_QualitySettings.MaskAtlasTileDim ] = height / 4;
-						}
-					}
-				}
-
-				WriteHeightToMipFile( m_MegaTexAtlasMipsFile, &resultingShorts, x, z, i );
-			}
+			Terrain->WriteHeightToMipFile( File, &heights, X, Z, L );
 		}
 
-		for( int z = 0, e = tileCountZ; z < e; z ++ )
+		virtual void WriteNormals( const UShorts& normals, int X, int Z, int L ) OVERRIDE
 		{
-			for( int x = 0, e = tileCountX; x < e; x ++ )
-			{
-				const UShorts* heightsPtr[ 9 ] = { NULL };
-
-				if( x > 0 )
-				{
-					if( z > 0 )
-					{
-						heightsPtr[ 0 ] = &heightsForNorms[ 0 ];
-						UnpackHeight( &heightsForNorms[ 0 ], x - 1, z - 1, i );
-					}
-
-					heightsPtr[ 3 ] = &heightsForNorms[ 3 ];
-					UnpackHeight( &heightsForNorms[ 3 ], x - 1, z, i );
-
-					if( z < tileCountZ - 1 )
-					{
-						heightsPtr[ 6 ] = &heightsForNorms[ 6 ];
-						UnpackHeight( &heightsForNorms[ 6 ], x - 1, z + 1, i );
-					}
-				}
-
-				if( x < tileCountX - 1 )
-				{
-					if( z > 0 )
-					{
-						heightsPtr[ 2 ] = &heightsForNorms[ 2 ];
-						UnpackHeight( &heightsForNorms[ 2 ], x + 1, z - 1, i );
-					}
+			Terrain->WriteNormalsToMipFile( File, &normals, X, Z, L, Textures->unpackedTexture, Textures->packedTexture, &Temp );
+		}
 
-					heightsPtr[ 5 ] = &heightsForNorms[ 5 ];
-					UnpackHeight( &heightsForNorms[ 5 ], x + 1, z, i );
+		r3dTerrain3*	Terrain;
+		FILE*			File;
+		TwoTextures*	Textures;
+		UShorts			Temp;
+	} writer;
 
-					if( z < tileCountZ - 1 )
-					{
-						heightsPtr[ 8 ] = &heightsForNorms[ 8 ];
-						UnpackHeight( &heightsForNorms[ 8 ], x + 1, z + 1, i );
-					}
-				}
+	writer.Terrain	= this;
+	writer.File		= m_MegaTexAtlasMipsFile;
+	writer.Textures	= &texes;
 
-				if( z > 0 )
-				{
-					heightsPtr[ 1 ] = &heightsForNorms[ 1 ];
-					UnpackHeight( &heightsForNorms[ 1 ], x, z - 1, i );
-				}
+	int heightTileCount = 0;
+	float heightStart = r3dGetTime();
 
-				heightsPtr[ 4 ] = &heightsForNorms[ 4 ];
-				UnpackHeight( &heightsForNorms[ 4 ], x, z, i );
+	for( int i = 1, e = info.NumActiveMegaTexLayers; i < e; i ++ )
+	{
+		AdvanceLoadingProgress( range_div_3 / ( info.NumActiveMegaTexLayers - 1 ) );
 
-				if( z < tileCountZ - 1 )
-				{
-					heightsPtr[ 7 ] = &heightsForNorms[ 7 ];
-					UnpackHeight( &heightsForNorms[ 7 ], x, z + 1, i );
-				}
+		RebuildHeightNormalMips( i, &writer );
 
-				RecalcNormalMap( heightsPtr, &tempFloats, &tempVectors0, &tempVectors1, &tempForNorms, i );
-				WriteNormalsToMipFile( m_MegaTexAtlasMipsFile, &tempForNorms, x, z, i, texes.unpackedTexture, texes.packedTexture, &heightsForNorms[ 0 ] );
-			}
-		}
+		heightTileCount += ( info.MegaTileCountX >> i ) * ( info.MegaTileCountZ >> i );
 	}
 
+	float heightTime = r3dGetTime() - heightStart;
+
 	//------------------------------------------------------------------------
 
 	fclose( m_MegaTexAtlasMipsFile );
@@ -18784,27 +19335,14 @@ void r3dTerrain3::CreateMipFile( const char* levelPath )
 
 	//------------------------------------------------------------------------
 
+	int maskTileCount = 0;
+	float maskStart = r3dGetTime();
+
 	for( int L = 1, e = info.NumActiveMegaTexLayers; L < e; L ++ )
 	{
 		AdvanceLoadingProgress( range_div_3 / ( info.NumActiveMegaTexLayers - 1 ) );
 
-		for( int tz = 0, e = info.MegaTileCountZ >> L; tz < e; tz ++ )
-		{
-			for( int tx = 0, e = info.MegaTileCountX >> L; tx < e; tx ++ )
-			{
-				for( int m = 0, e = maskCount; m < e; m ++ )
-				{
-					if( Terrain3->HasMask( tx * 2 + 0, tz * 2 + 0, L - 1, m ) ||
-						Terrain3->HasMask( tx * 2 + 1, tz * 2 + 0, L - 1, m ) ||
-						Terrain3->HasMask( tx * 2 + 0, tz * 2 + 1, L - 1, m ) ||
-						Terrain3->HasMask( tx * 2 + 1, tz * 2 + 1, L - 1, m )
-						)
-					{
-						UpdateLayerMaskMipFromLevelBelow( tx, tz, L, m, tempUShorts0, tempUShorts1, texes.packedTexture, texes.unpackedTexture );
-					}
-				}
-			}
-		}
+		maskTileCount += UpdateLayerMaskMipsFromLevelBelow( L, texes.packedTexture, texes.unpackedTexture, NULL );
 
 		TileCoords tileCoords;
 
@@ -18832,6 +19370,8 @@ void r3dTerrain3::CreateMipFile( const char* levelPath )
 		RecalcTileCoordBorders( tileCoords, tempUShorts0, tempUShorts1, texes.packedTexture, texes.unpackedTexture, NULL );
 	}
 
+	float maskTime = r3dGetTime() - maskStart;
+
 	MergeEditedMega( levelPath );
 
 	ProcessCustomDeviceQueueItem( ReleaseTexturesInMainThread, &texes );
@@ -18844,10 +19384,43 @@ void r3dTerrain3::CreateMipFile( const char* levelPath )
 	}
 
 	r3dOutToLog( "done in %.2f seconds\n", r3dGetTime() - timeStart );
+	r3dOutToLog( "r3dTerrain3::CreateMipFile: heights and normals %d tiles, %.1f tiles/s; masks %d tiles, %.1f tiles/s ( %d threads )\n",
+					heightTileCount, heightTileCount / R3D_MAX( heightTime, 0.001f ),
+					maskTileCount, maskTileCount / R3D_MAX( maskTime, 0.001f ), g_pJobChief->GetThreadCount() );
 }
 
 //------------------------------------------------------------------------
 
+#ifndef FINAL_BUILD
+int r3dTerrain3::RebuildMipFile( const char* levelPath )
+{
+	if( m_WasEdited )
+	{
+		r3dOutToLog( "r3dTerrain3::RebuildMipFile: terrain has unsaved changes, save the level first\n" );
+		return 0;
+	}
+
+	r3dFinishBackGroundTasks();
+
+	if( m_MegaTexAtlasMipsFile )
+	{
+		fclose( m_MegaTexAtlasMipsFile );
+		m_MegaTexAtlasMipsFile = NULL;
+	}
+
+	// leaves mips file opened for reading, writes stamps
+	CreateMipFile( levelPath );
+
+	m_WasEdited = 0;
+
+	RefreshAllMaskAtlasTiles();
+
+	return 1;
+}
+#endif
+
+//------------------------------------------------------------------------
+
 r3dTerrain3::Bytes r3dTerrain3::GenerateStamp()
 {
 	m_StampID ++;
@@ -22467,6 +23040,32 @@ void ResetTerraPhysics()
 	}
 }
 
+void Terrain3HeightFieldBenchmark( int pointCount )
+{
+	if( Terrain3 )
+	{
+		Terrain3->DEBUG_HeightFieldBenchmark( pointCount );
+	}
+	else
+	{
+		r3dOutToLog( "terra3hfbench: level has no terrain 3\n" );
+	}
+}
+
+void RebuildTerrain3Mips()
+{
+#ifndef FINAL_BUILD
+	if( Terrain3 )
+	{
+		Terrain3->RebuildMipFile( r3dGameLevel::GetHomeDir() );
+	}
+	else
+	{
+		r3dOutToLog( "RebuildTerrain3Mips: level has no terrain 3\n" );
+	}
+#endif
+}
+
 
 ErosionPattern::ErosionPattern()
 : w(0)
@@ -15,6 +15,7 @@
 #include "../../eternity/SF/script.h"
 #include "../UndoHistory/UndoHistory.h"
 #include "../DebugHelpers.h"
+#include "Terrain3HeightField.h"
 
 
 
@@ -1037,10 +1038,27 @@ public:
 	void					UpdateHeight( const r3dTL::TArray< UINT16 > * data, Bytes* tempNormalData, int X, int Z, int L );
 	void					UpdateTileNormalEdges( int X, int Z, int L, r3dTL::TArray< UINT16 > * tempData0, r3dTL::TArray< UINT16 > * tempData1, r3dTL::TArray< UINT16 > * tempData2 );
 	void					UpdateNormalEdges( int X, int Z, int L, UINT16* target, int targCount, r3dTL::TArray< UINT16 > * tempData );
+	// neighbours are packed normals of 3x3 tiles around ( X, Z ), NULL outside of level
+	void					CopyNormalEdges( int X, int Z, int L, UINT16* target, int targCount, const UINT16* const ( &neighbours )[ 9 ] );
+	// UpdateTileNormalEdges of every tile of level, returns tile count
+	int						UpdateNormalEdgesOfLevel( int L, void (*reportCallBack)( int, int ) );
 	void					UpdateNormals( const r3dTL::TArray< UINT16 > * data, int X, int Z, int L, IDirect3DTexture9* unpackedTempNormals, IDirect3DTexture9* packedTempNormals, r3dTL::TArray< UINT16 > * tempData );
 	void					UpdateHeightNormalsPacked( const r3dTL::TArray< UINT16 > * heightData, const r3dTL::TArray< UINT16 > * normalData, int X, int Z, int L );
 	void					ReadNormalsPacked( r3dTL::TArray< UINT16 > * oData, int X, int Z, int L );
-	void					RecalcNormalMap( const UShorts* ( &heights )[ 9 ], Floats* tempHeights, Vectors* tempVectors0, Vectors* tempVectors1, UShorts* oTempNormals, int L );
+	void					ReadNormalsPacked( UINT16* oData, int X, int Z, int L );
+	// thread safe, tempNormals gets 6 floats per sample
+	void					RecalcNormalMap( const UShorts* ( &heights )[ 9 ], Floats* tempHeights, Floats* tempNormals, UShorts* oTempNormals, int L );
+
+	// receives tiles of RebuildHeightNormalMips on the calling thread, row after row
+	struct HeightMipWriter
+	{
+		virtual void WriteHeights( const UShorts& heights, int X, int Z, int L ) = 0;
+		virtual void WriteNormals( const UShorts& normals, int X, int Z, int L ) = 0;
+	};
+
+	// downsamples heights of level L from L - 1 and recalculates normals of L. Works on rows of tiles,
+	// tiles of a row are processed in parallel, reading and writing stay on the calling thread
+	void					RebuildHeightNormalMips( int L, HeightMipWriter* writer );
 	void					ReloadMasks( int X, int Z, int L );
 
 	Info					GetInfo() const;
@@ -1083,6 +1101,8 @@ public:
 	int						GetPhysChunkSize() const;
 
 	void					DEBUG_ResetTerraPhysics();
+	// old physics chunk lookups against whole level heightfield, prints timings and differences
+	void					DEBUG_HeightFieldBenchmark( int pointCount );
 
 	void					ClearMegaLayerInfos();
 	void					AddLayerToMegaInfo( int tx, int tz, int L, int layerIdx );
@@ -1110,6 +1130,11 @@ public:
 	virtual r3dTexture*			GetDominantTexture( const r3dPoint3D &pos ) OVERRIDE;
 	virtual r3dTexture*			GetNormalTexture() const OVERRIDE;
 	virtual int					IsPosWithinPreciseHeights( const r3dPoint3D& pos ) const OVERRIDE;
+	virtual int					FindRayIntersection( const r3dPoint3D& from, const r3dPoint3D& to, r3dPoint3D* oHit ) OVERRIDE;
+
+	// GetHeight( points[ i ] ) for every point
+	void						GetHeights( const r3dPoint3D* points, float* oHeights, int count );
+	const r3dTerrain3HeightField& GetHeightField() const;
 
 	int							GetNumLoadingMegaTiles() const;
 
@@ -1126,6 +1151,16 @@ private:
 
 	int						LoadBin( const char* dirName );
 
+	// maps whole level heightfield or builds it from level 0 height tiles if it is missing or outdated
+	void					InitHeightField( const char* levelPath );
+	void					BuildHeightField();
+	void					GetHeightFieldFileName( char* buff );
+	void					SaveHeightField( const char* levelPath );
+
+	// heights of physics chunks around camera, used when there is no heightfield
+	float					GetPhysicsHeight( int x, int z );
+	float					GetPhysicsHeight( const r3dPoint3D& pos );
+
 	void					ExtractFloatHeights( const Shorts& shorts, Floats* oFloats );
 
 	void					InitFromHeights_MEGA( const Shorts& shorts );
@@ -1398,8 +1433,16 @@ private:
 
 public:
 	void					UpdateLayerMaskMipFromLevelBelow( int tx, int tz, int L, int maskId, UShorts& tempUShorts0, UShorts& tempUShorts1, IDirect3DTexture9* packedTexture, IDirect3DTexture9* unpackedTexture );
+	// UpdateLayerMaskMipFromLevelBelow of every tile of level L which has child masks, tiles are downsampled
+	// in parallel a batch at a time. Returns tile count
+	int						UpdateLayerMaskMipsFromLevelBelow( int L, IDirect3DTexture9* packedTexture, IDirect3DTexture9* unpackedTexture, void (*reportCallBack)( int, int ) );
 	void					RecalcTileCoordBorders( const TileCoords& tcoords, UShorts& tempUShorts0, UShorts& tempUShorts1, IDirect3DTexture9* packedTexture, IDirect3DTexture9* unpackedTexture, void (*reportCallBack)( int, int ) );
 
+#ifndef FINAL_BUILD
+	// rebuilds mips file of loaded level, 0 if there are unsaved edits
+	int						RebuildMipFile( const char* levelPath );
+#endif
+
 private:
 	void					CreateMipFile( const char* levelPath );
 	Bytes					GenerateStamp();
@@ -1475,6 +1518,8 @@ private:
 	float				m_HFScale;
 	float				m_InvHFScale;
 
+	r3dTerrain3HeightField	m_HeightField;
+
 	int					m_AtlasTileCountPerSide;
 	float				m_AtlasTileCountPerSideInv;
 
@@ -0,0 +1,734 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include <emmintrin.h>
+
+#include "Terrain3HeightField.h"
+
+//------------------------------------------------------------------------
+
+struct r3dTerrain3HeightField::FileHeader
+{
+	char	Sig[ 8 ];
+	UINT32	Version;
+
+	INT32	SampleCountX;
+	INT32	SampleCountZ;
+
+	float	CellSize;
+	float	MinHeight;
+	float	HeightStep;
+
+	UINT32	StampSize;
+	char	Stamp[ MAX_STAMP_SIZE ];
+
+	// keeps heights 16 byte aligned
+	char	Reserved[ 12 ];
+};
+
+namespace
+{
+	const char	HEIGHT_FIELD_SIG[ 8 ]	= "T3HFLD";
+	const int	HEIGHT_FIELD_VERSION	= 1;
+
+	// 2D DDA over square grid cells of cellDim, X and Z stay within [ minX, maxX ] x [ minZ, maxZ ]
+	// when they are initialized
+	struct GridWalk
+	{
+		void Init( float ox, float oz, float dx, float dz, float t, float cellDim, int minX, int minZ, int maxX, int maxZ )
+		{
+			OX		= ox;
+			OZ		= oz;
+			DX		= dx;
+			DZ		= dz;
+			CellDim	= cellDim;
+
+			X = R3D_MIN( R3D_MAX( (int)floorf( ( ox + dx * t ) / cellDim ), minX ), maxX );
+			Z = R3D_MIN( R3D_MAX( (int)floorf( ( oz + dz * t ) / cellDim ), minZ ), maxZ );
+
+			StepX = dx > 0.f ? 1 : ( dx < 0.f ? -1 : 0 );
+			StepZ = dz > 0.f ? 1 : ( dz < 0.f ? -1 : 0 );
+
+			UpdateNextX();
+			UpdateNextZ();
+		}
+
+		// moves to next cell, returns t at which ray entered it
+		float Step()
+		{
+			if( NextTX < NextTZ )
+			{
+				float t = NextTX;
+				X += StepX;
+				UpdateNextX();
+				return t;
+			}
+			else
+			{
+				float t = NextTZ;
+				Z += StepZ;
+				UpdateNextZ();
+				return t;
+			}
+		}
+
+		float Exit() const
+		{
+			return R3D_MIN( NextTX, NextTZ );
+		}
+
+		void UpdateNextX()
+		{
+			// computed from origin every time so cell and block walks agree on boundaries
+			NextTX = StepX ? ( ( X + ( StepX > 0 ) ) * CellDim - OX ) / DX : FLT_MAX;
+		}
+
+		void UpdateNextZ()
+		{
+			NextTZ = StepZ ? ( ( Z + ( StepZ > 0 ) ) * CellDim - OZ ) / DZ : FLT_MAX;
+		}
+
+		float	OX, OZ;
+		float	DX, DZ;
+		float	CellDim;
+
+		int		X, Z;
+		int		StepX, StepZ;
+		float	NextTX, NextTZ;
+	};
+
+	// clips [ *ioT0, *ioT1 ] of o + d * t to [ lo, hi ], false if nothing is left
+	bool ClipSlab( float o, float d, float lo, float hi, float* ioT0, float* ioT1 )
+	{
+		if( d == 0.f )
+			return o >= lo && o <= hi;
+
+		float t0 = ( lo - o ) / d;
+		float t1 = ( hi - o ) / d;
+
+		if( t0 > t1 )
+		{
+			float t = t0; t0 = t1; t1 = t;
+		}
+
+		*ioT0 = R3D_MAX( *ioT0, t0 );
+		*ioT1 = R3D_MIN( *ioT1, t1 );
+
+		return *ioT0 <= *ioT1;
+	}
+}
+
+//------------------------------------------------------------------------
+
+r3dTerrain3HeightField::r3dTerrain3HeightField()
+: mHeights( NULL )
+, mBlockMax( NULL )
+, mFile( INVALID_HANDLE_VALUE )
+, mMapping( NULL )
+, mView( NULL )
+, mSampleCountX( 0 )
+, mSampleCountZ( 0 )
+, mBlockCountX( 0 )
+, mBlockCountZ( 0 )
+, mCellSize( 1.f )
+, mInvCellSize( 1.f )
+, mMinHeight( 0.f )
+, mHeightStep( 1.f )
+{
+
+}
+
+//------------------------------------------------------------------------
+
+r3dTerrain3HeightField::~r3dTerrain3HeightField()
+{
+	Close();
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3HeightField::Create( int sampleCountX, int sampleCountZ, float cellSize, float minHeight, float heightStep )
+{
+	r3d_assert( sampleCountX > 1 && sampleCountZ > 1 );
+
+	Close();
+
+	Setup( sampleCountX, sampleCountZ, cellSize, minHeight, heightStep );
+
+	mOwnedHeights.Resize( mBlockCountX * mBlockCountZ * BLOCK_SIZE, 0 );
+	mOwnedBlockMax.Resize( mBlockCountX * mBlockCountZ, 0 );
+
+	mHeights	= &mOwnedHeights[ 0 ];
+	mBlockMax	= &mOwnedBlockMax[ 0 ];
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3HeightField::SetTile( int tileX, int tileZ, int tileDim, const UINT16* heights )
+{
+	r3d_assert( IsWritable() );
+
+	int x0 = tileX * tileDim;
+	int z0 = tileZ * tileDim;
+
+	int x1 = R3D_MIN( x0 + tileDim, mSampleCountX );
+	int z1 = R3D_MIN( z0 + tileDim, mSampleCountZ );
+
+	if( x0 >= x1 || z0 >= z1 )
+		return;
+
+	for( int z = z0; z < z1; z ++ )
+	{
+		const UINT16* src = heights + ( z - z0 ) * tileDim;
+
+		for( int x = x0; x < x1; x ++ )
+		{
+			mOwnedHeights[ SampleIndex( x, z ) ] = src[ x - x0 ];
+		}
+	}
+
+	// max of a block includes first samples of next one
+	int bx0 = R3D_MAX( x0 - 1, 0 ) >> BLOCK_SHIFT;
+	int bz0 = R3D_MAX( z0 - 1, 0 ) >> BLOCK_SHIFT;
+	int bx1 = ( x1 - 1 ) >> BLOCK_SHIFT;
+	int bz1 = ( z1 - 1 ) >> BLOCK_SHIFT;
+
+	for( int bz = bz0; bz <= bz1; bz ++ )
+	{
+		for( int bx = bx0; bx <= bx1; bx ++ )
+		{
+			UpdateBlockMax( bx, bz );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+int
+r3dTerrain3HeightField::Open( const char* path, const void* stamp, int stampSize )
+{
+	Close();
+
+	if( stampSize <= 0 || stampSize > MAX_STAMP_SIZE )
+		return 0;
+
+	HANDLE file = CreateFile( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if( file == INVALID_HANDLE_VALUE )
+		return 0;
+
+	LARGE_INTEGER fileSize;
+	fileSize.QuadPart = 0;
+
+	GetFileSizeEx( file, &fileSize );
+
+	HANDLE mapping = NULL;
+	void* view = NULL;
+
+	if( fileSize.QuadPart >= (LONGLONG)sizeof( FileHeader ) )
+	{
+		mapping = CreateFileMapping( file, NULL, PAGE_READONLY, 0, 0, NULL );
+
+		if( mapping )
+		{
+			view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+		}
+	}
+
+	int ok = 0;
+
+	if( view )
+	{
+		const FileHeader& header = *static_cast< const FileHeader* >( view );
+
+		if( !memcmp( header.Sig, HEIGHT_FIELD_SIG, sizeof header.Sig )
+				&&
+			header.Version == HEIGHT_FIELD_VERSION
+				&&
+			header.SampleCountX > 1 && header.SampleCountZ > 1
+				&&
+			header.StampSize == (UINT32)stampSize
+				&&
+			!memcmp( header.Stamp, stamp, stampSize ) )
+		{
+			Setup( header.SampleCountX, header.SampleCountZ, header.CellSize, header.MinHeight, header.HeightStep );
+
+			INT64 blockCount = mBlockCountX * mBlockCountZ;
+			INT64 expectedSize = sizeof( FileHeader ) + ( blockCount * BLOCK_SIZE + blockCount ) * sizeof( UINT16 );
+
+			ok = fileSize.QuadPart == expectedSize;
+		}
+	}
+
+	if( !ok )
+	{
+		if( view )
+			UnmapViewOfFile( view );
+
+		if( mapping )
+			CloseHandle( mapping );
+
+		CloseHandle( file );
+
+		mSampleCountX = 0;
+		mSampleCountZ = 0;
+
+		return 0;
+	}
+
+	mFile		= file;
+	mMapping	= mapping;
+	mView		= view;
+
+	mHeights	= reinterpret_cast< const UINT16* >( static_cast< const char* >( view ) + sizeof( FileHeader ) );
+	mBlockMax	= mHeights + mBlockCountX * mBlockCountZ * BLOCK_SIZE;
+
+	return 1;
+}
+
+//------------------------------------------------------------------------
+
+int
+r3dTerrain3HeightField::Save( const char* path, const void* stamp, int stampSize ) const
+{
+	if( !IsValid() || stampSize <= 0 || stampSize > MAX_STAMP_SIZE )
+		return 0;
+
+	FILE* fout = fopen( path, "wb" );
+
+	if( !fout )
+		return 0;
+
+	FileHeader header;
+	memset( &header, 0, sizeof header );
+
+	memcpy( header.Sig, HEIGHT_FIELD_SIG, sizeof header.Sig );
+	header.Version		= HEIGHT_FIELD_VERSION;
+	header.SampleCountX	= mSampleCountX;
+	header.SampleCountZ	= mSampleCountZ;
+	header.CellSize		= mCellSize;
+	header.MinHeight	= mMinHeight;
+	header.HeightStep	= mHeightStep;
+	header.StampSize	= stampSize;
+	memcpy( header.Stamp, stamp, stampSize );
+
+	size_t blockCount = mBlockCountX * mBlockCountZ;
+
+	int ok = fwrite( &header, sizeof header, 1, fout ) == 1
+				&&
+			fwrite( mHeights, blockCount * BLOCK_SIZE * sizeof( UINT16 ), 1, fout ) == 1
+				&&
+			fwrite( mBlockMax, blockCount * sizeof( UINT16 ), 1, fout ) == 1;
+
+	ok = !fclose( fout ) && ok;
+
+	if( !ok )
+	{
+		// broken file would be rejected by Open anyway, but don't leave it lying around
+		remove( path );
+	}
+
+	return ok;
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3HeightField::MakeWritable()
+{
+	if( !mView )
+		return;
+
+	size_t blockCount = mBlockCountX * mBlockCountZ;
+
+	mOwnedHeights.Resize( blockCount * BLOCK_SIZE );
+	mOwnedBlockMax.Resize( blockCount );
+
+	memcpy( &mOwnedHeights[ 0 ], mHeights, blockCount * BLOCK_SIZE * sizeof( UINT16 ) );
+	memcpy( &mOwnedBlockMax[ 0 ], mBlockMax, blockCount * sizeof( UINT16 ) );
+
+	UnmapViewOfFile( mView );
+	CloseHandle( mMapping );
+	CloseHandle( mFile );
+
+	mView		= NULL;
+	mMapping	= NULL;
+	mFile		= INVALID_HANDLE_VALUE;
+
+	mHeights	= &mOwnedHeights[ 0 ];
+	mBlockMax	= &mOwnedBlockMax[ 0 ];
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3HeightField::Close()
+{
+	if( mView )
+	{
+		UnmapViewOfFile( mView );
+		mView = NULL;
+	}
+
+	if( mMapping )
+	{
+		CloseHandle( mMapping );
+		mMapping = NULL;
+	}
+
+	if( mFile != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( mFile );
+		mFile = INVALID_HANDLE_VALUE;
+	}
+
+	r3dTL::TArray< UINT16 >().Swap( mOwnedHeights );
+	r3dTL::TArray< UINT16 >().Swap( mOwnedBlockMax );
+
+	mHeights		= NULL;
+	mBlockMax		= NULL;
+
+	mSampleCountX	= 0;
+	mSampleCountZ	= 0;
+	mBlockCountX	= 0;
+	mBlockCountZ	= 0;
+}
+
+//------------------------------------------------------------------------
+
+float
+r3dTerrain3HeightField::GetHeight( int x, int z ) const
+{
+	if( x < 0 || z < 0 || x > mSampleCountX || z > mSampleCountZ )
+		return mMinHeight;
+
+	x = R3D_MIN( x, mSampleCountX - 1 );
+	z = R3D_MIN( z, mSampleCountZ - 1 );
+
+	return mHeights[ SampleIndex( x, z ) ] * mHeightStep + mMinHeight;
+}
+
+//------------------------------------------------------------------------
+
+float
+r3dTerrain3HeightField::GetHeight( float x, float z ) const
+{
+	// written to give the same result as GetHeights
+	if( !( x >= 0.f && x <= mSampleCountX * mCellSize && z >= 0.f && z <= mSampleCountZ * mCellSize ) )
+		return mMinHeight;
+
+	float fx = R3D_MIN( x * mInvCellSize, float( mSampleCountX - 1 ) );
+	float fz = R3D_MIN( z * mInvCellSize, float( mSampleCountZ - 1 ) );
+
+	int ix = R3D_MIN( (int)fx, mSampleCountX - 2 );
+	int iz = R3D_MIN( (int)fz, mSampleCountZ - 2 );
+
+	float tx = fx - ix;
+	float tz = fz - iz;
+
+	float h00 = mHeights[ SampleIndex( ix, iz ) ];
+	float h10 = mHeights[ SampleIndex( ix + 1, iz ) ];
+	float h01 = mHeights[ SampleIndex( ix, iz + 1 ) ];
+	float h11 = mHeights[ SampleIndex( ix + 1, iz + 1 ) ];
+
+	float h0 = h00 + ( h10 - h00 ) * tx;
+	float h1 = h01 + ( h11 - h01 ) * tx;
+
+	return ( h0 + ( h1 - h0 ) * tz ) * mHeightStep + mMinHeight;
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3HeightField::GetHeights( const r3dPoint3D* points, float* oHeights, int count ) const
+{
+	const __m128 zero		= _mm_setzero_ps();
+	const __m128 invCell	= _mm_set1_ps( mInvCellSize );
+	const __m128 limX		= _mm_set1_ps( mSampleCountX * mCellSize );
+	const __m128 limZ		= _mm_set1_ps( mSampleCountZ * mCellSize );
+	const __m128 lastX		= _mm_set1_ps( float( mSampleCountX - 1 ) );
+	const __m128 lastZ		= _mm_set1_ps( float( mSampleCountZ - 1 ) );
+	const __m128 step		= _mm_set1_ps( mHeightStep );
+	const __m128 minHeight	= _mm_set1_ps( mMinHeight );
+
+	const __m128i lastCellX	= _mm_set1_epi32( mSampleCountX - 2 );
+	const __m128i lastCellZ	= _mm_set1_epi32( mSampleCountZ - 2 );
+	const __m128i one		= _mm_set1_epi32( 1 );
+	const __m128i blockMask	= _mm_set1_epi32( BLOCK_MASK );
+	const __m128i blocksX	= _mm_set1_epi32( mBlockCountX );
+
+	union
+	{
+		__m128i	v[ 4 ];
+		int		i[ 16 ];
+	} idx;
+
+	int i = 0;
+
+	for( ; i + 4 <= count; i += 4 )
+	{
+		const r3dPoint3D* p = points + i;
+
+		__m128 wx = _mm_setr_ps( p[ 0 ].x, p[ 1 ].x, p[ 2 ].x, p[ 3 ].x );
+		__m128 wz = _mm_setr_ps( p[ 0 ].z, p[ 1 ].z, p[ 2 ].z, p[ 3 ].z );
+
+		__m128 inside = _mm_and_ps(	_mm_and_ps( _mm_cmpge_ps( wx, zero ), _mm_cmple_ps( wx, limX ) ),
+									_mm_and_ps( _mm_cmpge_ps( wz, zero ), _mm_cmple_ps( wz, limZ ) ) );
+
+		// max returns zero for NaNs, they end up outside anyway
+		__m128 fx = _mm_min_ps( _mm_max_ps( _mm_mul_ps( wx, invCell ), zero ), lastX );
+		__m128 fz = _mm_min_ps( _mm_max_ps( _mm_mul_ps( wz, invCell ), zero ), lastZ );
+
+		__m128i ix = _mm_cvttps_epi32( fx );
+		__m128i iz = _mm_cvttps_epi32( fz );
+
+		// no min_epi32 in SSE2. Coordinate is at most last sample, so step back by one if needed
+		ix = _mm_add_epi32( ix, _mm_cmpgt_epi32( ix, lastCellX ) );
+		iz = _mm_add_epi32( iz, _mm_cmpgt_epi32( iz, lastCellZ ) );
+
+		__m128 tx = _mm_sub_ps( fx, _mm_cvtepi32_ps( ix ) );
+		__m128 tz = _mm_sub_ps( fz, _mm_cvtepi32_ps( iz ) );
+
+		__m128i ix1 = _mm_add_epi32( ix, one );
+		__m128i iz1 = _mm_add_epi32( iz, one );
+
+		// block row * block count fits 16 bits, madd does the 32 bit multiply SSE2 lacks
+		__m128i row0 = _mm_add_epi32(	_mm_slli_epi32( _mm_madd_epi16( _mm_srli_epi32( iz, BLOCK_SHIFT ), blocksX ), BLOCK_SHIFT * 2 ),
+										_mm_slli_epi32( _mm_and_si128( iz, blockMask ), BLOCK_SHIFT ) );
+		__m128i row1 = _mm_add_epi32(	_mm_slli_epi32( _mm_madd_epi16( _mm_srli_epi32( iz1, BLOCK_SHIFT ), blocksX ), BLOCK_SHIFT * 2 ),
+										_mm_slli_epi32( _mm_and_si128( iz1, blockMask ), BLOCK_SHIFT ) );
+
+		__m128i col0 = _mm_add_epi32( _mm_slli_epi32( _mm_srli_epi32( ix, BLOCK_SHIFT ), BLOCK_SHIFT * 2 ), _mm_and_si128( ix, blockMask ) );
+		__m128i col1 = _mm_add_epi32( _mm_slli_epi32( _mm_srli_epi32( ix1, BLOCK_SHIFT ), BLOCK_SHIFT * 2 ), _mm_and_si128( ix1, blockMask ) );
+
+		idx.v[ 0 ] = _mm_add_epi32( row0, col0 );
+		idx.v[ 1 ] = _mm_add_epi32( row0, col1 );
+		idx.v[ 2 ] = _mm_add_epi32( row1, col0 );
+		idx.v[ 3 ] = _mm_add_epi32( row1, col1 );
+
+		// SSE2 has no gather, fetch 16 samples one by one
+		const UINT16* h = mHeights;
+
+		__m128 h00 = _mm_cvtepi32_ps( _mm_setr_epi32( h[ idx.i[ 0 ] ],	h[ idx.i[ 1 ] ],	h[ idx.i[ 2 ] ],	h[ idx.i[ 3 ] ] ) );
+		__m128 h10 = _mm_cvtepi32_ps( _mm_setr_epi32( h[ idx.i[ 4 ] ],	h[ idx.i[ 5 ] ],	h[ idx.i[ 6 ] ],	h[ idx.i[ 7 ] ] ) );
+		__m128 h01 = _mm_cvtepi32_ps( _mm_setr_epi32( h[ idx.i[ 8 ] ],	h[ idx.i[ 9 ] ],	h[ idx.i[ 10 ] ],	h[ idx.i[ 11 ] ] ) );
+		__m128 h11 = _mm_cvtepi32_ps( _mm_setr_epi32( h[ idx.i[ 12 ] ],	h[ idx.i[ 13 ] ],	h[ idx.i[ 14 ] ],	h[ idx.i[ 15 ] ] ) );
+
+		__m128 h0 = _mm_add_ps( h00, _mm_mul_ps( _mm_sub_ps( h10, h00 ), tx ) );
+		__m128 h1 = _mm_add_ps( h01, _mm_mul_ps( _mm_sub_ps( h11, h01 ), tx ) );
+
+		__m128 res = _mm_add_ps( _mm_mul_ps( _mm_add_ps( h0, _mm_mul_ps( _mm_sub_ps( h1, h0 ), tz ) ), step ), minHeight );
+
+		res = _mm_or_ps( _mm_and_ps( inside, res ), _mm_andnot_ps( inside, minHeight ) );
+
+		_mm_storeu_ps( oHeights + i, res );
+	}
+
+	for( ; i < count; i ++ )
+	{
+		oHeights[ i ] = GetHeight( points[ i ].x, points[ i ].z );
+	}
+}
+
+//------------------------------------------------------------------------
+
+int
+r3dTerrain3HeightField::Raycast( const r3dPoint3D& org, const r3dPoint3D& dir, float maxT, float* oT ) const
+{
+	if( !IsValid() )
+		return 0;
+
+	// x and z in samples, y stays in world units
+	float ox = org.x * mInvCellSize;
+	float oz = org.z * mInvCellSize;
+	float dx = dir.x * mInvCellSize;
+	float dz = dir.z * mInvCellSize;
+
+	float tmin = 0.f;
+	float tmax = maxT;
+
+	if( !ClipSlab( ox, dx, 0.f, float( mSampleCountX - 1 ), &tmin, &tmax )
+			||
+		!ClipSlab( oz, dz, 0.f, float( mSampleCountZ - 1 ), &tmin, &tmax ) )
+		return 0;
+
+	int lastCellX = mSampleCountX - 2;
+	int lastCellZ = mSampleCountZ - 2;
+
+	GridWalk blocks;
+	blocks.Init( ox, oz, dx, dz, tmin, float( BLOCK_DIM ), 0, 0, lastCellX >> BLOCK_SHIFT, lastCellZ >> BLOCK_SHIFT );
+
+	for( float t = tmin; ; )
+	{
+		float tExit = R3D_MIN( blocks.Exit(), tmax );
+
+		float yLow = R3D_MIN( org.y + dir.y * t, org.y + dir.y * tExit );
+
+		if( yLow <= mBlockMax[ blocks.Z * mBlockCountX + blocks.X ] * mHeightStep + mMinHeight )
+		{
+			int cx0 = blocks.X << BLOCK_SHIFT;
+			int cz0 = blocks.Z << BLOCK_SHIFT;
+			int cx1 = R3D_MIN( cx0 + BLOCK_MASK, lastCellX );
+			int cz1 = R3D_MIN( cz0 + BLOCK_MASK, lastCellZ );
+
+			GridWalk cells;
+			cells.Init( ox, oz, dx, dz, t, 1.f, cx0, cz0, cx1, cz1 );
+
+			for( float ct = t; ; )
+			{
+				float cExit = R3D_MIN( cells.Exit(), tExit );
+
+				if( RaycastCell( cells.X, cells.Z, ox, oz, org.y, dx, dz, dir.y, ct, cExit, oT ) )
+					return 1;
+
+				if( cExit >= tExit )
+					break;
+
+				ct = cells.Step();
+
+				// float rounding may walk out a bit earlier than block walk does
+				if( cells.X < cx0 || cells.X > cx1 || cells.Z < cz0 || cells.Z > cz1 )
+					break;
+			}
+		}
+
+		if( tExit >= tmax )
+			break;
+
+		t = blocks.Step();
+
+		if( blocks.X < 0 || blocks.X > lastCellX >> BLOCK_SHIFT || blocks.Z < 0 || blocks.Z > lastCellZ >> BLOCK_SHIFT )
+			break;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------
+
+size_t
+r3dTerrain3HeightField::GetDataSize() const
+{
+	return size_t( mBlockCountX * mBlockCountZ ) * ( BLOCK_SIZE + 1 ) * sizeof( UINT16 );
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3HeightField::Setup( int sampleCountX, int sampleCountZ, float cellSize, float minHeight, float heightStep )
+{
+	mSampleCountX	= sampleCountX;
+	mSampleCountZ	= sampleCountZ;
+	mBlockCountX	= ( sampleCountX + BLOCK_MASK ) >> BLOCK_SHIFT;
+	mBlockCountZ	= ( sampleCountZ + BLOCK_MASK ) >> BLOCK_SHIFT;
+
+	mCellSize		= cellSize;
+	mInvCellSize	= 1.f / cellSize;
+	mMinHeight		= minHeight;
+	mHeightStep		= heightStep;
+}
+
+//------------------------------------------------------------------------
+
+void
+r3dTerrain3HeightField::UpdateBlockMax( int blockX, int blockZ )
+{
+	int x0 = blockX << BLOCK_SHIFT;
+	int z0 = blockZ << BLOCK_SHIFT;
+	int x1 = R3D_MIN( x0 + BLOCK_DIM, mSampleCountX - 1 );
+	int z1 = R3D_MIN( z0 + BLOCK_DIM, mSampleCountZ - 1 );
+
+	UINT16 maxHeight = 0;
+
+	for( int z = z0; z <= z1; z ++ )
+	{
+		for( int x = x0; x <= x1; x ++ )
+		{
+			maxHeight = R3D_MAX( maxHeight, mHeights[ SampleIndex( x, z ) ] );
+		}
+	}
+
+	mOwnedBlockMax[ blockZ * mBlockCountX + blockX ] = maxHeight;
+}
+
+//------------------------------------------------------------------------
+
+// intersection of o + d * t, t in [ t0, t1 ], with bilinear patch of cell ( cx, cz )
+int
+r3dTerrain3HeightField::RaycastCell( int cx, int cz, float ox, float oz, float oy, float dx, float dz, float dy, float t0, float t1, float* oT ) const
+{
+	float h00 = mHeights[ SampleIndex( cx, cz ) ] * mHeightStep + mMinHeight;
+	float h10 = mHeights[ SampleIndex( cx + 1, cz ) ] * mHeightStep + mMinHeight;
+	float h01 = mHeights[ SampleIndex( cx, cz + 1 ) ] * mHeightStep + mMinHeight;
+	float h11 = mHeights[ SampleIndex( cx + 1, cz + 1 ) ] * mHeightStep + mMinHeight;
+
+	float y0 = oy + dy * t0;
+	float y1 = oy + dy * t1;
+
+	if( R3D_MIN( y0, y1 ) > R3D_MAX( R3D_MAX( h00, h10 ), R3D_MAX( h01, h11 ) ) )
+		return 0;
+
+	// ray - surface along the segment is a quadratic of s = t - t0
+	float u0 = ox + dx * t0 - cx;
+	float v0 = oz + dz * t0 - cz;
+
+	float a = h10 - h00;
+	float b = h01 - h00;
+	float c = h00 - h10 - h01 + h11;
+
+	float C = y0 - ( h00 + a * u0 + b * v0 + c * u0 * v0 );
+
+	if( C <= 0.f )
+	{
+		*oT = t0;
+		return 1;
+	}
+
+	float B = dy - ( a * dx + b * dz + c * ( u0 * dz + v0 * dx ) );
+	float A = -c * dx * dz;
+
+	float s1 = t1 - t0;
+	float s = FLT_MAX;
+
+	if( A == 0.f )
+	{
+		if( B < 0.f )
+		{
+			float r = -C / B;
+
+			if( r <= s1 )
+				s = r;
+		}
+	}
+	else
+	{
+		float disc = B * B - 4.f * A * C;
+
+		if( disc >= 0.f )
+		{
+			float sq = sqrtf( disc );
+			float q = -0.5f * ( B + ( B < 0.f ? -sq : sq ) );
+
+			float r0 = q / A;
+			float r1 = q != 0.f ? C / q : FLT_MAX;
+
+			if( r0 >= 0.f && r0 <= s1 )
+				s = r0;
+
+			if( r1 >= 0.f && r1 <= s1 && r1 < s )
+				s = r1;
+		}
+	}
+
+	// rounding can lose a root right at the exit
+	if( s == FLT_MAX && ( A * s1 + B ) * s1 + C <= 0.f )
+		s = s1;
+
+	if( s == FLT_MAX )
+		return 0;
+
+	*oT = t0 + s;
+	return 1;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+//------------------------------------------------------------------------
+// 16 bit heights of the whole Terrain3 level for CPU queries.
+//
+// Samples are stored in 32x32 blocks (2 KB each), so bilinear lookups and
+// ray marching touch one or two cache friendly blocks instead of whole rows
+// of a map. Every block also keeps max height of its cells, ray marching
+// skips blocks the ray passes above.
+//
+// Heights either live in memory (built from terrain tiles, writable) or are
+// mapped read only from a file written by Save. Doesn't depend on PhysX or
+// renderer, queries are thread safe as long as nobody writes tiles.
+//------------------------------------------------------------------------
+
+class r3dTerrain3HeightField
+{
+public:
+	enum
+	{
+		BLOCK_SHIFT	= 5,
+		BLOCK_DIM	= 1 << BLOCK_SHIFT,
+		BLOCK_MASK	= BLOCK_DIM - 1,
+		BLOCK_SIZE	= BLOCK_DIM * BLOCK_DIM,
+
+		MAX_STAMP_SIZE = 64
+	};
+
+	r3dTerrain3HeightField();
+	~r3dTerrain3HeightField();
+
+	// allocates writable heights, world height of sample is MinHeight + value * heightStep
+	void			Create( int sampleCountX, int sampleCountZ, float cellSize, float minHeight, float heightStep );
+
+	// copies tileDim x tileDim samples ( row after row ) with first sample at ( tileX * tileDim, tileZ * tileDim )
+	// and updates max heights of blocks it touches
+	void			SetTile( int tileX, int tileZ, int tileDim, const UINT16* heights );
+
+	// maps file written by Save, fails if it is missing, broken or has different stamp
+	int				Open( const char* path, const void* stamp, int stampSize );
+	int				Save( const char* path, const void* stamp, int stampSize ) const;
+
+	// copies mapped heights to memory so SetTile can be used
+	void			MakeWritable();
+
+	void			Close();
+
+	int				IsValid() const		{ return mHeights != NULL; }
+	int				IsWritable() const	{ return mHeights != NULL && !mView; }
+
+	int				GetSampleCountX() const	{ return mSampleCountX; }
+	int				GetSampleCountZ() const	{ return mSampleCountZ; }
+	float			GetCellSize() const		{ return mCellSize; }
+	float			GetMinHeight() const	{ return mMinHeight; }
+
+	// sample heights, MinHeight outside of [ 0, sample count ]
+	float			GetHeight( int x, int z ) const;
+
+	// bilinear height at world x, z. MinHeight outside of level
+	float			GetHeight( float x, float z ) const;
+
+	// same as GetHeight( p.x, p.z ) for every point, 4 points at a time
+	void			GetHeights( const r3dPoint3D* points, float* oHeights, int count ) const;
+
+	// first hit of org + dir * t, t in [ 0, maxT ], with bilinear surface. 0 if there is none
+	int				Raycast( const r3dPoint3D& org, const r3dPoint3D& dir, float maxT, float* oT ) const;
+
+	size_t			GetDataSize() const;
+
+private:
+	struct FileHeader;
+
+	R3D_FORCEINLINE int SampleIndex( int x, int z ) const
+	{
+		return ( ( ( z >> BLOCK_SHIFT ) * mBlockCountX + ( x >> BLOCK_SHIFT ) ) << ( BLOCK_SHIFT * 2 ) ) + ( ( z & BLOCK_MASK ) << BLOCK_SHIFT ) + ( x & BLOCK_MASK );
+	}
+
+	void			Setup( int sampleCountX, int sampleCountZ, float cellSize, float minHeight, float heightStep );
+	void			UpdateBlockMax( int blockX, int blockZ );
+	int				RaycastCell( int cx, int cz, float ox, float oz, float oy, float dx, float dz, float dy, float t0, float t1, float* oT ) const;
+
+	const UINT16*			mHeights;
+	const UINT16*			mBlockMax;	// max of samples [ b * BLOCK_DIM, ( b + 1 ) * BLOCK_DIM ], so it covers cells of the block
+
+	r3dTL::TArray< UINT16 >	mOwnedHeights;
+	r3dTL::TArray< UINT16 >	mOwnedBlockMax;
+
+	HANDLE					mFile;
+	HANDLE					mMapping;
+	void*					mView;
+
+	int						mSampleCountX;
+	int						mSampleCountZ;
+	int						mBlockCountX;
+	int						mBlockCountZ;
+
+	float					mCellSize;
+	float					mInvCellSize;
+	float					mMinHeight;
+	float					mHeightStep;
+
+	// make copy constructor and assignment operator inaccessible
+	r3dTerrain3HeightField( const r3dTerrain3HeightField& );
+	r3dTerrain3HeightField& operator = ( const r3dTerrain3HeightField& );
+};
@@ -0,0 +1,732 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include <emmintrin.h>
+
+#include "Terrain3Kernels.h"
+
+#include "JobChief.h"
+
+namespace
+{
+	R3D_FORCEINLINE void NormalizeAndStore( float x, float y, float z, float* ox, float* oy, float* oz, int idx )
+	{
+		// same as r3dPoint3D::Normalize
+		float len = sqrtf( x * x + y * y + z * z );
+
+		if( len > 0 )
+		{
+			float inv = 1.0f / len;
+
+			x *= inv;
+			y *= inv;
+			z *= inv;
+		}
+
+		ox[ idx ] = x;
+		oy[ idx ] = y;
+		oz[ idx ] = z;
+	}
+
+	// vectors here always have y > 0, no zero length check
+	R3D_FORCEINLINE void NormalizeAndStore4( __m128 x, __m128 y, __m128 z, float* ox, float* oy, float* oz, int idx )
+	{
+		__m128 len = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, x ), _mm_mul_ps( y, y ) ), _mm_mul_ps( z, z ) ) );
+		__m128 inv = _mm_div_ps( _mm_set1_ps( 1.0f ), len );
+
+		_mm_storeu_ps( ox + idx, _mm_mul_ps( x, inv ) );
+		_mm_storeu_ps( oy + idx, _mm_mul_ps( y, inv ) );
+		_mm_storeu_ps( oz + idx, _mm_mul_ps( z, inv ) );
+	}
+
+	// 8 words of one mask channel from 2x2 blocks of two source rows, a - upper row, b - lower one
+	R3D_FORCEINLINE __m128i AverageMaskChannel( __m128i a0, __m128i a1, __m128i b0, __m128i b1 )
+	{
+		// channels are at most 63, pair sums fit into signed words and madd adds horizontal pairs
+		const __m128i ones = _mm_set1_epi16( 1 );
+
+		__m128i s0 = _mm_srli_epi32( _mm_madd_epi16( _mm_add_epi16( a0, b0 ), ones ), 2 );
+		__m128i s1 = _mm_srli_epi32( _mm_madd_epi16( _mm_add_epi16( a1, b1 ), ones ), 2 );
+
+		return _mm_packs_epi32( s0, s1 );
+	}
+
+	R3D_FORCEINLINE UINT16 AverageMaskScalar( UINT16 s0, UINT16 s1, UINT16 s2, UINT16 s3 )
+	{
+		int c0 = ( ( s0 & 0x1f ) + ( s1 & 0x1f ) + ( s2 & 0x1f ) + ( s3 & 0x1f ) ) / 4;
+		int c1 = ( ( s0 >> 5 & 0x3f ) + ( s1 >> 5 & 0x3f ) + ( s2 >> 5 & 0x3f ) + ( s3 >> 5 & 0x3f ) ) / 4;
+		int c2 = ( ( s0 >> 11 ) + ( s1 >> 11 ) + ( s2 >> 11 ) + ( s3 >> 11 ) ) / 4;
+
+		return UINT16( c0 | c1 << 5 | c2 << 11 );
+	}
+
+	R3D_FORCEINLINE UINT16 PackNormalScalar( float x, float y, float z )
+	{
+		int r = R3D_MIN( R3D_MAX( int( ( x * 0.5f + 0.5f ) * 31 ), 0 ), 31 );
+		int g = R3D_MIN( R3D_MAX( int( ( y * 0.5f + 0.5f ) * 63 ), 0 ), 63 );
+		int b = R3D_MIN( R3D_MAX( int( ( z * 0.5f + 0.5f ) * 31 ), 0 ), 31 );
+
+		return UINT16( b | g << 5 | r << 11 );
+	}
+
+	R3D_FORCEINLINE __m128i QuantizeNormal8( const float* v, __m128 scale, __m128i maxVal )
+	{
+		const __m128 half = _mm_set1_ps( 0.5f );
+
+		__m128i q0 = _mm_cvttps_epi32( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( v + 0 ), half ), half ), scale ) );
+		__m128i q1 = _mm_cvttps_epi32( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( v + 4 ), half ), half ), scale ) );
+
+		return _mm_min_epi16( _mm_max_epi16( _mm_packs_epi32( q0, q1 ), _mm_setzero_si128() ), maxVal );
+	}
+
+	// one 3 tap blur pass of normals, along z if alongZ, along x otherwise. Neighbours are clamped to tile
+	void BlurNormals( const float* sx, const float* sy, const float* sz, float* tx, float* ty, float* tz, int dim, bool alongZ )
+	{
+		for( int z = 0; z < dim; z ++ )
+		{
+			int row = z * dim;
+
+			if( alongZ )
+			{
+				int rowM = R3D_MAX( z - 1, 0 ) * dim;
+				int rowP = R3D_MIN( z + 1, dim - 1 ) * dim;
+
+				int x = 0;
+
+				for( ; x + 4 <= dim; x += 4 )
+				{
+					__m128 vx = _mm_add_ps( _mm_add_ps( _mm_loadu_ps( sx + row + x ), _mm_loadu_ps( sx + rowM + x ) ), _mm_loadu_ps( sx + rowP + x ) );
+					__m128 vy = _mm_add_ps( _mm_add_ps( _mm_loadu_ps( sy + row + x ), _mm_loadu_ps( sy + rowM + x ) ), _mm_loadu_ps( sy + rowP + x ) );
+					__m128 vz = _mm_add_ps( _mm_add_ps( _mm_loadu_ps( sz + row + x ), _mm_loadu_ps( sz + rowM + x ) ), _mm_loadu_ps( sz + rowP + x ) );
+
+					NormalizeAndStore4( vx, vy, vz, tx, ty, tz, row + x );
+				}
+
+				for( ; x < dim; x ++ )
+				{
+					NormalizeAndStore(	sx[ row + x ] + sx[ rowM + x ] + sx[ rowP + x ],
+										sy[ row + x ] + sy[ rowM + x ] + sy[ rowP + x ],
+										sz[ row + x ] + sz[ rowM + x ] + sz[ rowP + x ],
+										tx, ty, tz, row + x );
+				}
+			}
+			else
+			{
+				int x = 1;
+
+				for( ; x + 4 <= dim - 1; x += 4 )
+				{
+					int i = row + x;
+
+					__m128 vx = _mm_add_ps( _mm_add_ps( _mm_loadu_ps( sx + i ), _mm_loadu_ps( sx + i - 1 ) ), _mm_loadu_ps( sx + i + 1 ) );
+					__m128 vy = _mm_add_ps( _mm_add_ps( _mm_loadu_ps( sy + i ), _mm_loadu_ps( sy + i - 1 ) ), _mm_loadu_ps( sy + i + 1 ) );
+					__m128 vz = _mm_add_ps( _mm_add_ps( _mm_loadu_ps( sz + i ), _mm_loadu_ps( sz + i - 1 ) ), _mm_loadu_ps( sz + i + 1 ) );
+
+					NormalizeAndStore4( vx, vy, vz, tx, ty, tz, i );
+				}
+
+				for( ; x < dim - 1; x ++ )
+				{
+					int i = row + x;
+					NormalizeAndStore( sx[ i ] + sx[ i - 1 ] + sx[ i + 1 ], sy[ i ] + sy[ i - 1 ] + sy[ i + 1 ], sz[ i ] + sz[ i - 1 ] + sz[ i + 1 ], tx, ty, tz, i );
+				}
+
+				int i0 = row;
+				int i1 = R3D_MIN( 1, dim - 1 ) + row;
+				NormalizeAndStore( sx[ i0 ] + sx[ i0 ] + sx[ i1 ], sy[ i0 ] + sy[ i0 ] + sy[ i1 ], sz[ i0 ] + sz[ i0 ] + sz[ i1 ], tx, ty, tz, i0 );
+
+				if( dim > 1 )
+				{
+					int iL = row + dim - 1;
+					int iM = iL - 1;
+					NormalizeAndStore( sx[ iL ] + sx[ iM ] + sx[ iL ], sy[ iL ] + sy[ iM ] + sy[ iL ], sz[ iL ] + sz[ iM ] + sz[ iL ], tx, ty, tz, iL );
+				}
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3DownsampleHeights( const UINT16* src, int srcPitch, UINT16* dst, int dstPitch, int width, int height )
+{
+	const __m128i lowWord	= _mm_set1_epi32( 0xffff );
+	const __m128i bias32	= _mm_set1_epi32( 0x8000 );
+	const __m128i bias16	= _mm_set1_epi16( (short)0x8000 );
+
+	for( int z = 0; z < height; z ++ )
+	{
+		const UINT16* row0 = src + z * 2 * srcPitch;
+		const UINT16* row1 = row0 + srcPitch;
+
+		UINT16* out = dst + z * dstPitch;
+
+		int x = 0;
+
+		for( ; x + 8 <= width; x += 8 )
+		{
+			__m128i a0 = _mm_loadu_si128( (const __m128i*)( row0 + x * 2 + 0 ) );
+			__m128i a1 = _mm_loadu_si128( (const __m128i*)( row0 + x * 2 + 8 ) );
+			__m128i b0 = _mm_loadu_si128( (const __m128i*)( row1 + x * 2 + 0 ) );
+			__m128i b1 = _mm_loadu_si128( (const __m128i*)( row1 + x * 2 + 8 ) );
+
+			// heights are unsigned and take whole word, sum them in dwords
+			__m128i s0 = _mm_add_epi32(	_mm_add_epi32( _mm_and_si128( a0, lowWord ), _mm_srli_epi32( a0, 16 ) ),
+										_mm_add_epi32( _mm_and_si128( b0, lowWord ), _mm_srli_epi32( b0, 16 ) ) );
+			__m128i s1 = _mm_add_epi32(	_mm_add_epi32( _mm_and_si128( a1, lowWord ), _mm_srli_epi32( a1, 16 ) ),
+										_mm_add_epi32( _mm_and_si128( b1, lowWord ), _mm_srli_epi32( b1, 16 ) ) );
+
+			s0 = _mm_srli_epi32( s0, 2 );
+			s1 = _mm_srli_epi32( s1, 2 );
+
+			// pack is signed, move averages to signed range and back
+			__m128i res = _mm_packs_epi32( _mm_sub_epi32( s0, bias32 ), _mm_sub_epi32( s1, bias32 ) );
+			res = _mm_xor_si128( res, bias16 );
+
+			_mm_storeu_si128( (__m128i*)( out + x ), res );
+		}
+
+		for( ; x < width; x ++ )
+		{
+			int sum = row0[ x * 2 ] + row0[ x * 2 + 1 ] + row1[ x * 2 ] + row1[ x * 2 + 1 ];
+			out[ x ] = UINT16( sum / 4 );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3DownsampleMask( const UINT16* src, int srcPitch, UINT16* dst, int dstPitch, int width, int height )
+{
+	const __m128i mask5 = _mm_set1_epi16( 0x1f );
+	const __m128i mask6 = _mm_set1_epi16( 0x3f );
+
+	for( int z = 0; z < height; z ++ )
+	{
+		const UINT16* row0 = src + z * 2 * srcPitch;
+		const UINT16* row1 = row0 + srcPitch;
+
+		UINT16* out = dst + z * dstPitch;
+
+		int x = 0;
+
+		for( ; x + 8 <= width; x += 8 )
+		{
+			__m128i a0 = _mm_loadu_si128( (const __m128i*)( row0 + x * 2 + 0 ) );
+			__m128i a1 = _mm_loadu_si128( (const __m128i*)( row0 + x * 2 + 8 ) );
+			__m128i b0 = _mm_loadu_si128( (const __m128i*)( row1 + x * 2 + 0 ) );
+			__m128i b1 = _mm_loadu_si128( (const __m128i*)( row1 + x * 2 + 8 ) );
+
+			__m128i c0 = AverageMaskChannel(	_mm_and_si128( a0, mask5 ), _mm_and_si128( a1, mask5 ),
+												_mm_and_si128( b0, mask5 ), _mm_and_si128( b1, mask5 ) );
+
+			__m128i c1 = AverageMaskChannel(	_mm_and_si128( _mm_srli_epi16( a0, 5 ), mask6 ), _mm_and_si128( _mm_srli_epi16( a1, 5 ), mask6 ),
+												_mm_and_si128( _mm_srli_epi16( b0, 5 ), mask6 ), _mm_and_si128( _mm_srli_epi16( b1, 5 ), mask6 ) );
+
+			__m128i c2 = AverageMaskChannel(	_mm_srli_epi16( a0, 11 ), _mm_srli_epi16( a1, 11 ),
+												_mm_srli_epi16( b0, 11 ), _mm_srli_epi16( b1, 11 ) );
+
+			__m128i res = _mm_or_si128( _mm_or_si128( c0, _mm_slli_epi16( c1, 5 ) ), _mm_slli_epi16( c2, 11 ) );
+
+			_mm_storeu_si128( (__m128i*)( out + x ), res );
+		}
+
+		for( ; x < width; x ++ )
+		{
+			out[ x ] = AverageMaskScalar( row0[ x * 2 ], row0[ x * 2 + 1 ], row1[ x * 2 ], row1[ x * 2 + 1 ] );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3CalcNormals( const float* heights, int dim, float cellSize, float* temp, UINT16* oNormals )
+{
+	int count = dim * dim;
+
+	float* ax = temp;
+	float* ay = temp + count;
+	float* az = temp + count * 2;
+
+	float* bx = temp + count * 3;
+	float* by = temp + count * 4;
+	float* bz = temp + count * 5;
+
+	const __m128 signBit = _mm_set1_ps( -0.f );
+	const __m128 up = _mm_set1_ps( cellSize );
+
+	// central differences, one sided ones doubled at tile borders
+	for( int z = 0; z < dim; z ++ )
+	{
+		const float* hc = heights + z * dim;
+		const float* hm = heights + R3D_MAX( z - 1, 0 ) * dim;
+		const float* hp = heights + R3D_MIN( z + 1, dim - 1 ) * dim;
+
+		float zMul = ( z == 0 || z == dim - 1 ) ? 2.f : 1.f;
+
+		int row = z * dim;
+
+		int x = 1;
+
+		const __m128 zMul4 = _mm_set1_ps( zMul );
+
+		for( ; x + 4 <= dim - 1; x += 4 )
+		{
+			__m128 sx = _mm_sub_ps( _mm_loadu_ps( hc + x + 1 ), _mm_loadu_ps( hc + x - 1 ) );
+			__m128 sy = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( hp + x ), _mm_loadu_ps( hm + x ) ), zMul4 );
+
+			NormalizeAndStore4( _mm_xor_ps( sx, signBit ), up, _mm_xor_ps( sy, signBit ), ax, ay, az, row + x );
+		}
+
+		for( ; x < dim - 1; x ++ )
+		{
+			float sx = hc[ x + 1 ] - hc[ x - 1 ];
+			float sy = ( hp[ x ] - hm[ x ] ) * zMul;
+
+			NormalizeAndStore( -sx, cellSize, -sy, ax, ay, az, row + x );
+		}
+
+		{
+			float sx = ( hc[ R3D_MIN( 1, dim - 1 ) ] - hc[ 0 ] ) * 2;
+			float sy = ( hp[ 0 ] - hm[ 0 ] ) * zMul;
+
+			NormalizeAndStore( -sx, cellSize, -sy, ax, ay, az, row );
+		}
+
+		if( dim > 1 )
+		{
+			float sx = ( hc[ dim - 1 ] - hc[ dim - 2 ] ) * 2;
+			float sy = ( hp[ dim - 1 ] - hm[ dim - 1 ] ) * zMul;
+
+			NormalizeAndStore( -sx, cellSize, -sy, ax, ay, az, row + dim - 1 );
+		}
+	}
+
+	// separable 'blur', twice
+	for( int i = 0; i < 2; i ++ )
+	{
+		BlurNormals( ax, ay, az, bx, by, bz, dim, true );
+		BlurNormals( bx, by, bz, ax, ay, az, dim, false );
+	}
+
+	const __m128 scale5 = _mm_set1_ps( 31.f );
+	const __m128 scale6 = _mm_set1_ps( 63.f );
+	const __m128i max5 = _mm_set1_epi16( 31 );
+	const __m128i max6 = _mm_set1_epi16( 63 );
+
+	int i = 0;
+
+	for( ; i + 8 <= count; i += 8 )
+	{
+		__m128i r = QuantizeNormal8( ax + i, scale5, max5 );
+		__m128i g = QuantizeNormal8( ay + i, scale6, max6 );
+		__m128i b = QuantizeNormal8( az + i, scale5, max5 );
+
+		__m128i res = _mm_or_si128( _mm_or_si128( b, _mm_slli_epi16( g, 5 ) ), _mm_slli_epi16( r, 11 ) );
+
+		_mm_storeu_si128( (__m128i*)( oNormals + i ), res );
+	}
+
+	for( ; i < count; i ++ )
+	{
+		oNormals[ i ] = PackNormalScalar( ax[ i ], ay[ i ], az[ i ] );
+	}
+}
+
+//------------------------------------------------------------------------
+
+#ifndef FINAL_BUILD
+
+void r3dTerrain3DownsampleHeightsRef( const UINT16* src, int srcPitch, UINT16* dst, int dstPitch, int width, int height )
+{
+	for( int z = 0; z < height; z ++ )
+	{
+		for( int x = 0; x < width; x ++ )
+		{
+			int avg = 0;
+
+			avg += src[ x * 2 + 0 + ( z * 2 + 0 ) * srcPitch ];
+			avg += src[ x * 2 + 1 + ( z * 2 + 0 ) * srcPitch ];
+			avg += src[ x * 2 + 0 + ( z * 2 + 1 ) * srcPitch ];
+			avg += src[ x * 2 + 1 + ( z * 2 + 1 ) * srcPitch ];
+
+			avg /= 4;
+
+			dst[ x + z * dstPitch ] = avg;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3DownsampleMaskRef( const UINT16* src, int srcPitch, UINT16* dst, int dstPitch, int width, int height )
+{
+	for( int z = 0; z < height; z ++ )
+	{
+		for( int x = 0; x < width; x ++ )
+		{
+			int srcIdxes[ 4 ];
+
+			srcIdxes[ 0 ] = ( z * 2 + 0 ) * srcPitch + x * 2 + 0;
+			srcIdxes[ 1 ] = ( z * 2 + 1 ) * srcPitch + x * 2 + 0;
+			srcIdxes[ 2 ] = ( z * 2 + 0 ) * srcPitch + x * 2 + 1;
+			srcIdxes[ 3 ] = ( z * 2 + 1 ) * srcPitch + x * 2 + 1;
+
+			int rsum = 0;
+			int gsum = 0;
+			int bsum = 0;
+
+			// same bit fields UpdateLayerMaskMipFromLevelBelow used
+			union
+			{
+				struct
+				{
+					UINT16 r : 5;
+					UINT16 g : 6;
+					UINT16 b : 5;
+				} c;
+
+				UINT16 sample;
+			} u;
+
+			for( int i = 0; i < 4; i ++ )
+			{
+				u.sample = src[ srcIdxes[ i ] ];
+
+				rsum += u.c.r;
+				gsum += u.c.g;
+				bsum += u.c.b;
+			}
+
+			u.c.r = rsum / 4;
+			u.c.g = gsum / 4;
+			u.c.b = bsum / 4;
+
+			dst[ z * dstPitch + x ] = u.sample;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void r3dTerrain3CalcNormalsRef( const float* heights, int dim, float cellSize, UINT16* oNormals )
+{
+	r3dTL::TArray< r3dPoint3D > NormalMapData;
+	r3dTL::TArray< r3dPoint3D > NormalBuf;
+
+	NormalMapData.Resize( dim * dim );
+	NormalBuf.Resize( dim * dim );
+
+	int xTotal = dim;
+	int zTotal = dim;
+
+	for ( int z = 0; z < zTotal; z++ )
+	{
+		for ( int x = 0; x < xTotal; x++ )
+		{
+			float sx = heights[ ( x < xTotal - 1 ? x + 1 : x ) + z * xTotal ] - heights[ ( x > 0 ? x - 1 : x ) + z * xTotal ];
+			if( x == 0 || x == xTotal - 1 )
+				sx *= 2;
+
+			float sy = heights[ x + ( z < zTotal - 1 ? z + 1 : z ) * xTotal ] - heights[ x + ( z > 0 ? z - 1 : z ) * xTotal ];
+			if( z == 0 || z == zTotal - 1 )
+				sy *= 2;
+
+			r3dPoint3D vN( -sx, cellSize, -sy );
+			vN.Normalize();
+
+			NormalMapData[ z * xTotal + x ] = vN;
+		}
+	}
+
+	for( int i = 0; i < 4; i ++ )
+	{
+		r3dPoint3D* source;
+		r3dPoint3D* target;
+
+		int dirx;
+		int dirz;
+
+		if( i & 1 )
+		{
+			source = &NormalBuf[ 0 ];
+			target = &NormalMapData[ 0 ];
+
+			dirx = 1;
+			dirz = 0;
+		}
+		else
+		{
+			source = &NormalMapData[ 0 ];
+			target = &NormalBuf[ 0 ];
+
+			dirx = 0;
+			dirz = 1;
+		}
+
+		for ( int z = 0; z < zTotal; z++ )
+		{
+			for ( int x = 0; x < xTotal; x++ )
+			{
+				int x0	= R3D_MAX( x - dirx, 0 ),
+					x1	= R3D_MIN( x + dirx, xTotal - 1 ),
+					z0	= R3D_MAX( z - dirz, 0 ),
+					z1	= R3D_MIN( z + dirz, zTotal - 1 );
+
+				r3dPoint3D	vN =	source[ z * xTotal + x ];
+							vN +=	source[ z0 * xTotal + x0 ];
+							vN +=	source[ z1 * xTotal + x1 ];
+
+				vN.Normalize();
+
+				target[ z * xTotal + x ] = vN;
+			}
+		}
+	}
+
+	for( int i = 0, e = dim * dim; i < e; i ++ )
+	{
+		const r3dPoint3D& n = NormalMapData[ i ];
+		oNormals[ i ] = PackNormalScalar( n.x, n.y, n.z );
+	}
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+	typedef r3dTL::TArray< UINT16 > UShorts;
+	typedef r3dTL::TArray< float > Floats;
+
+	enum BenchKernel
+	{
+		BENCH_HEIGHTS,
+		BENCH_MASKS,
+		BENCH_NORMALS
+	};
+
+	struct BenchParams
+	{
+		BenchKernel		Kernel;
+		bool			Reference;
+
+		int				Dim;
+		float			CellSize;
+
+		// parent tile i is built from sources i .. i + 3 ( wrapped )
+		const UShorts*	Sources;
+		const Floats*	FloatSources;
+		int				SourceCount;
+
+		UShorts*		Results;
+		Floats*			Temps;		// one per thread
+	};
+
+	void BenchTilesMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+	{
+		const BenchParams& p = *static_cast< const BenchParams* >( Data );
+
+		int dim = p.Dim;
+		int half = dim / 2;
+
+		for( size_t i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+		{
+			UINT16* out = &p.Results[ i ][ 0 ];
+
+			if( p.Kernel == BENCH_NORMALS )
+			{
+				const float* heights = &p.FloatSources[ i % p.SourceCount ][ 0 ];
+
+				if( p.Reference )
+					r3dTerrain3CalcNormalsRef( heights, dim, p.CellSize, out );
+				else
+					r3dTerrain3CalcNormals( heights, dim, p.CellSize, &p.Temps[ ThreadIndex ][ 0 ], out );
+
+				continue;
+			}
+
+			for( int q = 0; q < 4; q ++ )
+			{
+				const UINT16* src = &p.Sources[ ( i + q ) % p.SourceCount ][ 0 ];
+				UINT16* dst = out + ( q & 1 ) * half + ( q >> 1 ) * half * dim;
+
+				if( p.Kernel == BENCH_HEIGHTS )
+				{
+					if( p.Reference )
+						r3dTerrain3DownsampleHeightsRef( src, dim, dst, dim, half, half );
+					else
+						r3dTerrain3DownsampleHeights( src, dim, dst, dim, half, half );
+				}
+				else
+				{
+					if( p.Reference )
+						r3dTerrain3DownsampleMaskRef( src, dim, dst, dim, half, half );
+					else
+						r3dTerrain3DownsampleMask( src, dim, dst, dim, half, half );
+				}
+			}
+		}
+	}
+
+	int CountMismatches( const r3dTL::TArray< UShorts >& a, const r3dTL::TArray< UShorts >& b, int* oMaxDiff )
+	{
+		int count = 0;
+
+		for( int t = 0, e = a.Count(); t < e; t ++ )
+		{
+			for( int i = 0, ie = a[ t ].Count(); i < ie; i ++ )
+			{
+				UINT16 va = a[ t ][ i ];
+				UINT16 vb = b[ t ][ i ];
+
+				if( va == vb )
+					continue;
+
+				count ++;
+
+				if( oMaxDiff )
+				{
+					// largest difference of R5G6B5 channels
+					int d0 = abs( ( va & 0x1f ) - ( vb & 0x1f ) );
+					int d1 = abs( ( va >> 5 & 0x3f ) - ( vb >> 5 & 0x3f ) );
+					int d2 = abs( ( va >> 11 ) - ( vb >> 11 ) );
+
+					*oMaxDiff = R3D_MAX( *oMaxDiff, R3D_MAX( d0, R3D_MAX( d1, d2 ) ) );
+				}
+			}
+		}
+
+		return count;
+	}
+}
+
+void r3dTerrain3MipKernelBenchmark( int tileDim, int tileCount )
+{
+	if( tileDim < 8 || ( tileDim & ( tileDim - 1 ) ) || tileCount < 1 )
+	{
+		r3dOutToLog( "terra3mipbench: tile size has to be power of 2 >= 8\n" );
+		return;
+	}
+
+	const int SOURCE_COUNT = 16;
+
+	int threadCount = g_pJobChief->GetThreadCount();
+
+	r3dOutToLog( "terra3mipbench: %d tiles of %dx%d, %d threads\n", tileCount, tileDim, tileDim, threadCount ); CLOG_INDENT;
+
+	r3dTL::TArray< UShorts > heights;
+	r3dTL::TArray< UShorts > masks;
+	r3dTL::TArray< Floats > floatHeights;
+
+	heights.Resize( SOURCE_COUNT );
+	masks.Resize( SOURCE_COUNT );
+	floatHeights.Resize( SOURCE_COUNT );
+
+	srand( 12345 );
+
+	// rolling hills with some noise, masks are random
+	for( int s = 0; s < SOURCE_COUNT; s ++ )
+	{
+		heights[ s ].Resize( tileDim * tileDim );
+		masks[ s ].Resize( tileDim * tileDim );
+		floatHeights[ s ].Resize( tileDim * tileDim );
+
+		float phase = s * 0.7f;
+
+		for( int z = 0; z < tileDim; z ++ )
+		{
+			for( int x = 0; x < tileDim; x ++ )
+			{
+				float h = 0.5f + 0.25f * sinf( x * 0.031f + phase ) * cosf( z * 0.027f - phase ) + 0.1f * sinf( ( x + z ) * 0.13f );
+				int ih = R3D_MIN( R3D_MAX( int( h * 65535.f ) + rand() % 512 - 256, 0 ), 65535 );
+
+				int idx = x + z * tileDim;
+
+				heights[ s ][ idx ] = UINT16( ih );
+				masks[ s ][ idx ] = UINT16( ( rand() << 8 ) ^ rand() );
+				floatHeights[ s ][ idx ] = ih * ( 1024.f / 65535.f );
+			}
+		}
+	}
+
+	r3dTL::TArray< UShorts > refResults;
+	r3dTL::TArray< UShorts > results;
+
+	refResults.Resize( tileCount );
+	results.Resize( tileCount );
+
+	for( int i = 0; i < tileCount; i ++ )
+	{
+		refResults[ i ].Resize( tileDim * tileDim, 0 );
+		results[ i ].Resize( tileDim * tileDim, 0 );
+	}
+
+	r3dTL::TArray< Floats > temps;
+	temps.Resize( threadCount );
+
+	for( int i = 0; i < threadCount; i ++ )
+	{
+		temps[ i ].Resize( tileDim * tileDim * 6 );
+	}
+
+	BenchParams params;
+
+	params.Dim			= tileDim;
+	params.CellSize		= 2.f;
+	params.Sources		= NULL;
+	params.FloatSources	= &floatHeights[ 0 ];
+	params.SourceCount	= SOURCE_COUNT;
+	params.Temps		= &temps[ 0 ];
+
+	const char* names[] = { "heights", "masks", "normals" };
+
+	for( int k = BENCH_HEIGHTS; k <= BENCH_NORMALS; k ++ )
+	{
+		params.Kernel	= (BenchKernel)k;
+		params.Sources	= k == BENCH_MASKS ? &masks[ 0 ] : &heights[ 0 ];
+
+		params.Reference	= true;
+		params.Results		= &refResults[ 0 ];
+
+		float t0 = r3dGetTime();
+		BenchTilesMT( &params, 0, tileCount, 0 );
+		float refTime = r3dGetTime() - t0;
+
+		params.Reference	= false;
+		params.Results		= &results[ 0 ];
+
+		t0 = r3dGetTime();
+		BenchTilesMT( &params, 0, tileCount, 0 );
+		float serialTime = r3dGetTime() - t0;
+
+		int maxDiff = 0;
+		int serialMismatches = CountMismatches( refResults, results, k == BENCH_NORMALS ? &maxDiff : NULL );
+
+		for( int i = 0; i < tileCount; i ++ )
+		{
+			memset( &results[ i ][ 0 ], 0, results[ i ].Count() * sizeof( UINT16 ) );
+		}
+
+		t0 = r3dGetTime();
+		g_pJobChief->Exec( BenchTilesMT, &params, tileCount );
+		float parallelTime = r3dGetTime() - t0;
+
+		int parallelMismatches = CountMismatches( refResults, results, k == BENCH_NORMALS ? &maxDiff : NULL );
+
+		r3dOutToLog( "%s: scalar %.1f tiles/s, SSE %.1f tiles/s, SSE on %d threads %.1f tiles/s\n", names[ k ],
+						tileCount / R3D_MAX( refTime, 1e-6f ), tileCount / R3D_MAX( serialTime, 1e-6f ),
+						threadCount, tileCount / R3D_MAX( parallelTime, 1e-6f ) );
+
+		if( k == BENCH_NORMALS )
+		{
+			r3dOutToLog( "%s: %d samples differ from scalar ( %d in parallel run ) out of %d, max channel difference %d\n", names[ k ],
+							serialMismatches, parallelMismatches, tileCount * tileDim * tileDim, maxDiff );
+		}
+		else
+		{
+			r3dOutToLog( "%s: %s\n", names[ k ], serialMismatches || parallelMismatches ? "MISMATCH against scalar" : "bit exact against scalar" );
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+//------------------------------------------------------------------------
+// SSE2 kernels of Terrain3 mip and normal map rebuilds.
+//
+// Kernels touch only memory passed to them, so tiles can be processed by
+// any number of threads at once. Results are the same as of scalar loops
+// they replace: downsampling is bit exact, normals may differ by one step
+// of quantization where float rounding of normalization differs.
+//------------------------------------------------------------------------
+
+// dst[ x, z ] = ( sum of 2x2 block of src at ( x * 2, z * 2 ) ) / 4, width and height are in dst samples
+void r3dTerrain3DownsampleHeights( const UINT16* src, int srcPitch, UINT16* dst, int dstPitch, int width, int height );
+
+// same for R5G6B5 layer masks, every channel is averaged on its own
+void r3dTerrain3DownsampleMask( const UINT16* src, int srcPitch, UINT16* dst, int dstPitch, int width, int height );
+
+// heights are dim x dim, in world units. Computes normals, blurs them by 2 separable
+// 3 tap passes and packs them to R5G6B5 ( x - red, y - green, z - blue ).
+// temp has to hold 6 * dim * dim floats
+void r3dTerrain3CalcNormals( const float* heights, int dim, float cellSize, float* temp, UINT16* oNormals );
+
+#ifndef FINAL_BUILD
+// scalar loops which used to do the same, benchmark checks kernels against them
+void r3dTerrain3DownsampleHeightsRef( const UINT16* src, int srcPitch, UINT16* dst, int dstPitch, int width, int height );
+void r3dTerrain3DownsampleMaskRef( const UINT16* src, int srcPitch, UINT16* dst, int dstPitch, int width, int height );
+void r3dTerrain3CalcNormalsRef( const float* heights, int dim, float cellSize, UINT16* oNormals );
+
+// runs kernels on synthetic tiles against scalar reference, on 1 thread and on all threads,
+// prints tiles per second and mismatches. Doesn't need level or renderer
+void r3dTerrain3MipKernelBenchmark( int tileDim, int tileCount );
+#endif
@@ -10,6 +10,7 @@
 #include "GameCommon.h"
 
 #include "sceneBox.h"
+#include "SceneBVH.h"
 #include "../../../EclipseStudio/Sources/ObjectsCode/WORLD/obj_Prefab.h"
 
 extern bool g_bEditMode;
@@ -52,14 +53,15 @@ GameObject::GameObject()
 	InMainFrustum = false;
 	FirstUpdate = 10;
 	m_SceneBox  = 0;
+	m_SceneBVHEntry = -1;
 	hashID		 = 0;
 	ID           = invalidGameObjectID;
 	ownerID      = invalidGameObjectID;
 	CompoundID	 = 0;
 	bPersistent	 = 1;
 	
-	pPrevObject  = NULL;
-	pNextObject  = NULL;
+	DenseIndex    = -1;
+	LookupNameKey = 0;
 
 	ObjTypeFlags = OBJTYPE_Generic;
 	PrivateFlags = 0 ;
@@ -102,8 +104,7 @@ GameObject::~GameObject()
 //-----------------------------------------------------------------------
 {
 #ifndef FINAL_BUILD
-	r3d_assert(pPrevObject == NULL);
-	r3d_assert(pNextObject == NULL);
+	r3d_assert(DenseIndex == -1);
 #endif
 
 	if(PhysicsObject) delete PhysicsObject;
@@ -112,8 +113,7 @@ GameObject::~GameObject()
 
 	if(NetworkID>0)
 	{
-		GameWorld().NetworkIDMap.erase(NetworkID);
-		NetworkID = 0;
+		GameWorld().ClearNetworkID(this);
 	}
 }
 
@@ -255,9 +255,7 @@ bool GameObject::SetNetworkID(DWORD id)
 {
 	r3d_assert(NetworkID == 0);
 	
-	NetworkID = id;
-	std::pair<ObjectManager::NetMapType::iterator, bool> result = GameWorld().NetworkIDMap.insert(std::pair<DWORD, GameObject*>(NetworkID, this));
-	if(!result.second)
+	if(!GameWorld().SetNetworkID(this, id))
 	{
 		GameObject* dup = GameWorld().GetNetworkObject(id);
 		r3dOutToLog("@@@ DUP Obj pointer: 0x%X\n", (uint32_t)dup);
@@ -265,7 +263,7 @@ bool GameObject::SetNetworkID(DWORD id)
 		r3dOutToLog("@@ NetID DUPLICATE!!! ObjectName: %s, ClassName: %s, ActiveFlag: %d\n", dup->Name.c_str(), dup->Class->Name.c_str(), dup->getActiveFlag());
 
 		// and assert!
-		r3d_assert(result.second);
+		r3d_assert(false);
 	}
 	
 	return true;
@@ -425,7 +423,16 @@ void GameObject::RegenerateHash()
 	int rnd = rand();
 	char hash_string[512]= {0};
 	sprintf_s(hash_string, _countof(hash_string), "%s_%d_%d%d%d_%d:%d:%d_%d", FileName.c_str(), counter, date->tm_year, date->tm_mon, date->tm_mday, date->tm_hour, date->tm_min, date->tm_sec, rnd);
-	hashID = r3dHash::MakeHash(hash_string);
+	SetHashID(r3dHash::MakeHash(hash_string));
+}
+
+void GameObject::SetHashID(uint32_t hash)
+{
+	const uint32_t oldHash = hashID;
+	hashID = hash;
+
+	if(ID.valid() && oldHash != hash)
+		GameWorld().OnObjectHashChanged(this, oldHash);
 }
 
 BOOL GameObject::Load(const char* fname)
@@ -460,11 +467,19 @@ BOOL GameObject::Load(const char* fname)
 }
 
 
-BOOL GameObject::OnPositionChanged()
+void GameObject::OnSceneBoundsChanged()
 {
 	if(m_SceneBox)
 		m_SceneBox->Move(this);
 
+	if(m_SceneBVHEntry >= 0)
+		GameWorld().GetSceneBVH()->Move(this);
+}
+
+BOOL GameObject::OnPositionChanged()
+{
+	OnSceneBoundsChanged();
+
 	return TRUE;
 };
 
@@ -566,9 +581,10 @@ void GameObject::ReadSerializedData(pugi::xml_node& node)
 	r3dVector A;
 
 	pugi::xml_node gameObjNode = node.child("gameObject");
-	hashID = gameObjNode.attribute("hash").as_uint();
-	if(hashID == 0x7FFFFFFF)
-		hashID = 0;
+	uint32_t hash = gameObjNode.attribute("hash").as_uint();
+	if(hash == 0x7FFFFFFF)
+		hash = 0;
+	SetHashID(hash);
 	if(!gameObjNode.attribute("PhysEnable").empty())
 		m_bEnablePhysics = gameObjNode.attribute("PhysEnable").as_bool();
 	if(!gameObjNode.attribute("MinQuality").empty())
@@ -266,10 +266,12 @@ private:
 	int				PrivateFlags ;
 
 protected:
-	// linked list pointers inside ObjectManager
+	// position inside ObjectManager storage
 	friend class ObjectManager;
-	r3dSec_type<GameObject*, 0x37BFD5F5> pPrevObject;
-	r3dSec_type<GameObject*, 0x1FDA937A> pNextObject;
+	friend class ObjectSlotMap;
+	friend class ObjectLookup;
+	int			DenseIndex;		// in ObjectSlotMap dense array, -1 if not there
+	uint32_t	LookupNameKey;	// name hash ObjectLookup indexed this object with, 0 if not indexed
 
 protected:
 	int				FirstUpdate;
@@ -289,11 +291,13 @@ public:
 
 	bool			isSerializable() const { return m_isSerializable; }
 	uint32_t		GetHashID() const { return hashID; }
+	void			SetHashID(uint32_t hash); // keeps ObjectManager hash index up to date
 	
 	/** Regenerate new hash for this object. */
 	void			RegenerateHash();
 
 	class SceneBox*	m_SceneBox;
+	int				m_SceneBVHEntry;	// owned by SceneBVH, -1 if not in it
 
 private:
 
@@ -324,10 +328,12 @@ protected:
 		bbox_world.Transform( ( r3dMatrix * )&mTransform );
 		bbox_radius = R3D_MAX(R3D_MAX(bbox_world.Size.x, bbox_world.Size.y), bbox_world.Size.z);
 
-		if(m_SceneBox)
-			m_SceneBox->Move(this);
+		OnSceneBoundsChanged();
 	}
 
+	// notifies SceneBox and SceneBVH
+	void OnSceneBoundsChanged();
+
 	int		m_isActive;	// if > 0 = active. if<=0 - not active and will be deleted soon!
 public:
 
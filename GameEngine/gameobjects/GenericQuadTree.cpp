@@ -46,6 +46,7 @@ QuadTree::QuadTree(const r3dBoundBox &worldBB, GetObjectAABB getAABBFunc)
 : gridSize(std::max(worldBB.Size.x, worldBB.Size.z))
 , objAABB_Getter(getAABBFunc)
 , visibilityInfoDirty(true)
+, visibilityStarted(false)
 {
 	r3d_assert(objAABB_Getter);
 
@@ -345,9 +346,11 @@ void QuadTree::DebugVisualizeNode2D(int parentIdx, const r3dPoint3D &scaleOffset
 
 //////////////////////////////////////////////////////////////////////////
 
-void QuadTree::ComputeVisibility(r3dTL::TArray<QuadTreeObjectID> &visibleObjects)
+void QuadTree::StartComputeVisibility(JobChief::TaskGroup &group)
 {
-	R3DPROFILE_FUNCTION( "QuadTree::ComputeVisibility" );
+	R3DPROFILE_FUNCTION( "QuadTree::StartComputeVisibility" );
+
+	r3d_assert( !visibilityStarted );
 
 	if (visibilityInfo.Count() != nodesPool.Count())
 		visibilityInfoDirty = true;
@@ -384,14 +387,30 @@ void QuadTree::ComputeVisibility(r3dTL::TArray<QuadTreeObjectID> &visibleObjects
 			flattenedNodes0.Swap( flattenedNodes1 );
 		}
 
-		MTThis = this;
-
 		if( flattenedNodes1.Count() )
 		{
-			g_pJobChief->Exec( ComputeVisibilityMT, &flattenedNodes1[ 0 ], flattenedNodes1.Count() );
+			group.ParallelFor( ComputeVisibilityMT, this, flattenedNodes1.Count() );
 		}
 	}
 
+	visibilityStarted = true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void QuadTree::ComputeVisibility(r3dTL::TArray<QuadTreeObjectID> &visibleObjects)
+{
+	R3DPROFILE_FUNCTION( "QuadTree::ComputeVisibility" );
+
+	if( !visibilityStarted )
+	{
+		JobChief::TaskGroup group;
+		StartComputeVisibility( group );
+		group.Wait();
+	}
+
+	visibilityStarted = false;
+
 	visibleObjects.Clear();
 
 	for (uint32_t i = 0; i < nodesPool.Count(); ++i)
@@ -447,9 +466,11 @@ void QuadTree::ComputeVisibilityMT( void* Data, size_t ItemStart, size_t ItemCou
 {
 	(void)ThreadIndex;
 
+	QuadTree* This = static_cast<QuadTree*>( Data );
+
 	for( size_t i = ItemStart; i < ItemStart + ItemCount; i ++ )
 	{
-		MTThis->ComputeVisibilityInternal( ((int*)Data)[ i ] );
+		This->ComputeVisibilityInternal( This->flattenedNodes1[ i ] );
 	}
 }
 
@@ -748,7 +769,3 @@ void QuadTree::RecursivelyVisitNodes(int parentIdx, bool doTailRecursion, VisitN
 			fn(n, userData);
 	}
 }
-
-//////////////////////////////////////////////////////////////////////////
-
-QuadTree* QuadTree::MTThis;
\ No newline at end of file
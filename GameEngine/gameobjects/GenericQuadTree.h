@@ -7,6 +7,8 @@
 
 #include <cmath>
 
+#include "JobChief.h"
+
 //////////////////////////////////////////////////////////////////////////
 
 typedef int QuadTreeObjectID;
@@ -84,8 +86,8 @@ private:
 	/**	Get AABB function pointer. */
 	GetObjectAABB objAABB_Getter;
 
-	/** pointer to current quad tree which is processed with multithreading */
-	static QuadTree* MTThis;
+	/**	Node visibility was started with StartComputeVisibility and is not gathered yet. */
+	bool visibilityStarted;
 
 	/**	Get node index that should own given object. */
 	int GetObjectNode(const r3dPoint3D &objCenter, int depth, int parentIdx, bool shouldAllocateNodes);
@@ -173,7 +175,10 @@ public:
 	/**	Visualize quadtree as 3D picture. */
 	void DebugVisualizeTree3D(int parentIdx = 0) const;
 
-	/**	Compute visibility for quadtree. Return visible object list */
+	/**	Start visibility computation of tree nodes as tasks of group. Group must be waited before ComputeVisibility. */
+	void StartComputeVisibility(JobChief::TaskGroup &group);
+
+	/**	Compute visibility for quadtree (or use one started by StartComputeVisibility). Return visible object list */
 	void ComputeVisibility(r3dTL::TArray<QuadTreeObjectID> &visibleObjects);
 
 	/**	Save entire quadtree into file. Contained objects is not saved. */
@@ -22,6 +22,7 @@
 
 
 #include "JobChief.h"
+#include "r3dMeshBVH.h"
 
 #include "../../EclipseStudio/Sources/ObjectsCode/weapons/BulletShellManager.h"
 #include "../../EclipseStudio/Sources/Editors/CollectionElementProxyObject.h"
@@ -324,6 +325,8 @@ ObjectManager::ObjectManager()
 	bInited = 0;
 	m_FrameId = 0;
 	m_pRootBox = 0;
+	m_pSceneBVH = 0;
+	m_pSoftOcclusion = 0;
 #ifndef WO_SERVER
 	m_BulletMngr = 0;
 #endif
@@ -354,6 +357,8 @@ int ObjectManager::Init(int _MaxObjects, int _MaxStaticObjects)
 #endif //WO_SERVER
 
 	m_pRootBox = game_new SceneBox();
+	m_pSceneBVH = game_new SceneBVH();
+	m_pSoftOcclusion = game_new SoftOcclusionBuffer();
 	m_ResourceHelper = 0;
 #ifndef WO_SERVER
 	m_ResourceHelper = game_new ObjectManagerResourceHelper;
@@ -361,7 +366,6 @@ int ObjectManager::Init(int _MaxObjects, int _MaxStaticObjects)
 
 	MaxObjects           = _MaxObjects;
 	MaxStaticObjects     = _MaxStaticObjects;
-	LastFreeObject       = 0;
 	NumObjects           = 0;
 	NumStaticObjects     = 0;
 	CurObjID             = 1;
@@ -369,11 +373,7 @@ int ObjectManager::Init(int _MaxObjects, int _MaxStaticObjects)
 	m_MinimapOrigin.Assign(0,0,0);
 	m_MinimapSize.Assign(100,1,100);
 
-	pObjectArray   = game_new GameObject* [MaxObjects];
-	pFirstObject   = NULL;
-	pLastObject    = NULL;
-
-	memset(pObjectArray, 0, sizeof(GameObject*)*MaxObjects);
+	m_Objects.Init(MaxObjects);
 
 	pStaticObjectArray = game_new GameObject* [MaxStaticObjects];
 
@@ -410,20 +410,21 @@ int ObjectManager::Destroy()
 	
 	// do delete in two passes. firstly call OnDestroy on all objects, and then only call delete
 	// otherwise some objects have pointers to other objects and they might point to dead pointer and fuck up memory
-	for(i=0; i<MaxObjects; i++) 
-		if(pObjectArray[i])
-			DeleteObject(pObjectArray[i], false);
-
-	for(i=0; i<MaxObjects; i++) 
+	// DeleteObject takes object out of slot map, objects deleted by OnDestroy of others never get here
+	r3dTL::TArray< GameObject* > dynamicObjects;
+	dynamicObjects.Reserve(m_Objects.GetCount());
+	for(i=0; i<m_Objects.GetMaxSlots(); i++) 
 	{
-		if(pObjectArray[i])
+		if(GameObject* obj = m_Objects.GetSlot(i))
 		{
-			delete pObjectArray[i];
-			pObjectArray[i] = NULL;
-			NumObjects = NumObjects-1;
+			dynamicObjects.PushBack(obj);
+			DeleteObject(obj, false);
 		}
 	}
 
+	for(i=0; i<(int)dynamicObjects.Count(); i++) 
+		delete dynamicObjects[i];
+
 	for(i=0; i<MaxStaticObjects; i++) 
 		if(pStaticObjectArray[i])
 			DeleteObject(pStaticObjectArray[i], false);
@@ -444,7 +445,8 @@ int ObjectManager::Destroy()
 	while(!PrevFrameQueryList.empty())
 		PrevFrameQueryList.pop_front();
 
-	delete[] pObjectArray;
+	m_Objects.Destroy();
+	m_Lookup.Clear();
 	delete[] pStaticObjectArray;
 
 	MaxObjects = 0;
@@ -453,6 +455,9 @@ int ObjectManager::Destroy()
 	delete m_pRootBox;
 	m_pRootBox = 0;
 
+	SAFE_DELETE( m_pSceneBVH );
+	SAFE_DELETE( m_pSoftOcclusion );
+
 	gDestroyingWorld = false;
 
 	return 1;
@@ -472,113 +477,49 @@ void ObjectManager::SetDeleteObjectEvent (ObjectManager::GameObjEvent_fn pEvent)
 
 int ObjectManager::AddObject(GameObject *obj)
 {
-	int indexForAdding = -1;
-
 	if( obj->IsStatic() )
 	{
-		indexForAdding = NumStaticObjects;
-	}
-	else
-	{
-		if( LastFreeObject == -1 )
-		{
-			// can't add object - table is full
-			r3dError( "failed to add object - increase ObjectManager number of objects" );
-		}
-
-		indexForAdding = LastFreeObject;
-	}
-	
-	// Create Object ID:
-	// low word is index in ObjectManager, high is obj ID
+		// Create Object ID:
+		// low word is index in static array, high is obj ID
+		obj->ID.set(((CurObjID & 0xFFFF) << 16) | NumStaticObjects | OBJECTMANAGER_STATICBIT );
 
-	UINT staticBit = obj->IsStatic() ? OBJECTMANAGER_STATICBIT : 0;
+		CurObjID = CurObjID + 1;
 
-	obj->ID.set(((CurObjID & 0xFFFF) << 16) | indexForAdding | staticBit );
+		if( CurObjID >= 0x7fff )
+			CurObjID = 0;
 
-	CurObjID = CurObjID + 1;
-
-	if( CurObjID >= 0x7fff )
-		CurObjID = 0;
-
-	//r3dOutToLog ("OBJCREATE %s  %d\n", obj->Name.c_str(), obj->ID);
-
-	if( obj->IsStatic() )
-	{
 		pStaticObjectArray[ NumStaticObjects ] = obj;
 		NumStaticObjects = NumStaticObjects + 1;
 	}
 	else
 	{
-		r3d_assert(pObjectArray[ LastFreeObject ]==NULL);
-		pObjectArray[ LastFreeObject ] = obj;
-		NumObjects = NumObjects + 1;
-	}
-
-	// add object to linked list
-	{
-		VMPROTECT_BeginMutation("ObjectManager::AddObject-LList");
+		VMPROTECT_BeginMutation("ObjectManager::AddObject-Slot");
 
-		if( !obj->IsStatic() )
+		// ID is slot index and slot generation
+		if( !m_Objects.Add( obj ) )
 		{
-			if(pFirstObject == NULL) 
-			{
-				pFirstObject = obj;
-			}
-		
-			if(pLastObject) 
-			{
-				r3d_assert(pLastObject->pNextObject == NULL);
-				r3d_assert(obj->pPrevObject == NULL);
-				r3d_assert(obj->pNextObject == NULL);
-
-				pLastObject->pNextObject = obj;
-				obj->pPrevObject = pLastObject;
-			}
-			pLastObject = obj;
+			r3dOutToLog("Total Num Objects: %d, CurrentMax:%d\n", NumObjects, MaxObjects);
+			r3dError( "failed to add object - increase ObjectManager number of objects" );
 		}
 
+		NumObjects = NumObjects + 1;
+
 		VMPROTECT_End();
 	}
 
+	//r3dOutToLog ("OBJCREATE %s  %d\n", obj->Name.c_str(), obj->ID);
+
+	m_Lookup.Add( obj );
+
 #ifndef WO_SERVER
 	m_pRootBox->Add( obj, false );
+	m_pSceneBVH->Add( obj );
 #endif
 
 	AddToTransparentShadowCasters( obj );
 
 	if ( pObjectAddEvent ) pObjectAddEvent ( obj );
 
-	if( !obj->IsStatic() )
-	{
-		int found = 0;
-
-		// detect next free object
-		int i;
-		for(i = LastFreeObject + 1; i < MaxObjects; i++)
-		{
-			if( pObjectArray[i] == NULL )
-			{
-				LastFreeObject = i;
-				return 1;
-			}
-		}
-
-		for(i = 0; i < LastFreeObject; i++)
-		{
-			if( pObjectArray[i] == NULL )
-			{
-				LastFreeObject = i;
-				return 1;
-			}
-		}
-
-		r3dOutToLog("Total Num Objects: %d, CurrentMax:%d\n", NumObjects, MaxObjects);
-		r3dError( "failed to find free slot - increase ObjectManager number of objects" );
-	}
-
-
-
 	return 1;
 }
 
@@ -595,16 +536,10 @@ int ObjectManager::DeleteObject(GameObject* obj, bool call_delete)
 	}
 	else
 	{
-		r3d_assert(n >= 0 && n < MaxObjects);
+		r3d_assert(n >= 0 && n < MaxObjects && m_Objects.GetSlot(n) == obj);
 	}
 
-	if(obj->m_SceneBox)
-		obj->m_SceneBox->Remove(obj);
-
-	if( !obj->IsStatic() )
-	{
-		LastFreeObject = n;
-	}
+	RemoveFromScene(obj);
 
 	RemoveFromTransparentShadowCasters( obj );
 
@@ -613,26 +548,16 @@ int ObjectManager::DeleteObject(GameObject* obj, bool call_delete)
 	// ptumik: firstly remove from the list, then call OnDestroy, and then delete object
 	// otherwise from ondestroy object is still in gameworld
 
-	// remove from linked list
+	m_Lookup.Remove( obj );
+
+	// remove from slot map
 	{
-		VMPROTECT_BeginMutation("ObjectManager::DeleteObject-LList");
+		VMPROTECT_BeginMutation("ObjectManager::DeleteObject-Slot");
 
 		if( !obj->IsStatic() )
 		{
-			if(pFirstObject == obj)
-				pFirstObject = obj->pNextObject;
-			if(pLastObject == obj)
-				pLastObject = obj->pPrevObject;
-			if(obj->pPrevObject) {
-				r3d_assert(obj->pPrevObject->pNextObject == obj);
-				obj->pPrevObject->pNextObject = obj->pNextObject;
-			}
-			if(obj->pNextObject) {
-				r3d_assert(obj->pNextObject->pPrevObject == obj);
-				obj->pNextObject->pPrevObject = obj->pPrevObject;
-			}
-			obj->pNextObject = NULL;
-			obj->pPrevObject = NULL;
+			m_Objects.Remove( obj );
+			NumObjects = NumObjects-1;
 
 			for( int i = 0, e = m_ObjectListeners.Count(); i < e; i ++ )
 			{
@@ -650,6 +575,9 @@ int ObjectManager::DeleteObject(GameObject* obj, bool call_delete)
 		obj->ObjFlags |= OBJFLAG_WasDestroyed;
 	}
 
+	if(obj->NetworkID>0)
+		ClearNetworkID(obj);
+
 	if( call_delete )
 	{
 		if( obj->IsStatic() )
@@ -670,9 +598,7 @@ int ObjectManager::DeleteObject(GameObject* obj, bool call_delete)
 		}
 		else
 		{
-			pObjectArray[n] = NULL;
 			delete obj;
-			NumObjects = NumObjects-1;
 		}
 	}
 
@@ -715,26 +641,30 @@ int ObjectManager::SetDrawingOrder(GameObject *obj, int order)
 
 GameObject* ObjectManager::GetObject(const char* name)
 {
-	for(GameObject* obj = pFirstObject; obj; obj = obj->pNextObject)
+	GameObject* obj = m_Lookup.FindByName(name);
+
+	// name index doesn't see renames, so miss has to be confirmed by search
+	if(!obj)
 	{
-		if(obj->Name == name)
+		for( ObjectIterator iter = GetFirstOfAllObjects(); iter.current; iter = GetNextOfAllObjects( iter ) )
 		{
-			if(obj->isActive())
-				return obj;
-			else
-				return NULL;
+			if( iter.current->Name == name )
+			{
+				obj = iter.current;
+				m_Lookup.UpdateName(obj);
+				break;
+			}
 		}
-	}
 
-	for( int i = 0, e = NumStaticObjects; i < e; i ++ )
-	{
-		GameObject* obj = pStaticObjectArray[ i ];
-
-		if( obj->Name == name )
-			return obj;
+		if(!obj)
+			return NULL;
 	}
 
-	return NULL;
+	// do not return dynamic objects that are no longer active
+	if(!obj->IsStatic() && !obj->isActive())
+		return NULL;
+
+	return obj;
 }
 
 GameObject* ObjectManager::GetObjectByHash(uint32_t hash)
@@ -742,26 +672,25 @@ GameObject* ObjectManager::GetObjectByHash(uint32_t hash)
 	if(hash == 0)
 		return NULL;
 
-	for(GameObject* obj = pFirstObject; obj; obj = obj->pNextObject)
+	GameObject* obj = m_Lookup.FindByHash(hash);
+
+	// only one of objects with same hash is in index
+	if(!obj && m_Lookup.HasHashDuplicates())
 	{
-		if(obj->GetHashID()==hash)
+		for( ObjectIterator iter = GetFirstOfAllObjects(); iter.current; iter = GetNextOfAllObjects( iter ) )
 		{
-			if(obj->isActive())
-				return obj;
-			else
-				return NULL;
+			if( iter.current->GetHashID() == hash )
+			{
+				obj = iter.current;
+				break;
+			}
 		}
 	}
 
-	for( int i = 0, e = NumStaticObjects; i < e; i ++ )
-	{
-		GameObject* obj = pStaticObjectArray[ i ];
-
-		if(obj->GetHashID()==hash)
-			return obj;
-	}
+	if(!obj || (!obj->IsStatic() && !obj->isActive()))
+		return NULL;
 
-	return NULL;
+	return obj;
 }
 
 GameObject* ObjectManager::GetObject(gobjid_t ID)
@@ -787,15 +716,10 @@ GameObject* ObjectManager::GetObject(gobjid_t ID)
 	}
 	else
 	{
-		r3d_assert(n >= 0 && n < MaxObjects);
+		GameObject* obj = m_Objects.Get( ID );
 
-		if(pObjectArray[ n ] && pObjectArray[ n ]->ID == ID)
-		{
-			if(pObjectArray[n]->isActive()) // do not return objects that are no longer active, to prevent someone else trying to work with object that is about to be deleted
-				return pObjectArray[ n ];
-			else
-				return NULL;
-		}
+		if(obj && obj->isActive()) // do not return objects that are no longer active, to prevent someone else trying to work with object that is about to be deleted
+			return obj;
 	}
 
 	return NULL;
@@ -808,22 +732,41 @@ GameObject* ObjectManager::GetNetworkObject(DWORD netID)
 	if(netID == invalidGameObjectID)
 		return NULL;
 
-	GameObject* obj = NULL;
-	NetMapType::iterator it = NetworkIDMap.find(netID);
-	if(it!=NetworkIDMap.end())
+	GameObject* obj = m_Lookup.FindByNetworkID(netID);
+	if(obj && obj->isActive())
+		return obj;
+
+	return NULL;
+}
+
+bool ObjectManager::SetNetworkID(GameObject* obj, DWORD netID)
+{
+	return m_Lookup.SetNetworkID(obj, netID);
+}
+
+void ObjectManager::ClearNetworkID(GameObject* obj)
+{
+	m_Lookup.ClearNetworkID(obj);
+}
+
+void ObjectManager::OnObjectHashChanged(GameObject* obj, uint32_t oldHash)
+{
+	if(IsInWorld(obj))
+		m_Lookup.OnHashChanged(obj, oldHash);
+}
+
+bool ObjectManager::IsInWorld(const GameObject* obj) const
+{
+	if(!obj->IsStatic())
+		return m_Objects.Get(obj->ID) == obj;
+
+	for(int idx = R3D_MIN((int)(obj->ID.get() & 0xFFFF), (int)NumStaticObjects - 1); idx >= 0; idx --)
 	{
-		obj = (*it).second;
-		if(obj && obj->isActive())
-			return obj;
-		else
-			return NULL;
+		if(pStaticObjectArray[ idx ] == obj)
+			return true;
 	}
 
-// 	for(GameObject* obj = pFirstObject; obj; obj = obj->pNextObject)
-// 		if(obj->NetworkID == netID)
-// 			return obj;
-
-	return NULL;
+	return false;
 }
 
 void ObjectManager::StartFrame()
@@ -952,19 +895,25 @@ void UpdateZombies()
 
 				ZombieAnimIdx += ANIMATED_ZOMBIES_COUNT / 2;
 
+				r3d_assert( NonAnimatedZombies.Count() + chunk0Count + chunk1Count == TemporaryZombies.Count() );
+
+				// both sets go to one group - threads which are done with expensive animated
+				// zombies pick up cheap ones instead of waiting at barrier in between
+				JobChief::TaskGroup zombieGroup;
+
 				if( chunk0Count + chunk1Count )
 				{
-					g_pJobChief->Exec( CallZombieUpdateWithAnim, &AnimatedZombies[ 0 ], chunk0Count + chunk1Count );
+					zombieGroup.ParallelFor( CallZombieUpdateWithAnim, &AnimatedZombies[ 0 ], chunk0Count + chunk1Count, 1 );
 				}
 
-				r3d_assert( NonAnimatedZombies.Count() + chunk0Count + chunk1Count == TemporaryZombies.Count() );
-
-				R3DPROFILE_START("Not Animated");
 				if( NonAnimatedZombies.Count() )
 				{
-					g_pJobChief->Exec( CallZombieUpdateWithoutAnim, &NonAnimatedZombies[ 0 ], NonAnimatedZombies.Count() );
+					zombieGroup.ParallelFor( CallZombieUpdateWithoutAnim, &NonAnimatedZombies[ 0 ], NonAnimatedZombies.Count() );
 				}
-				R3DPROFILE_END("Not Animated");
+
+				R3DPROFILE_START("Wait for zombies");
+				zombieGroup.Wait();
+				R3DPROFILE_END("Wait for zombies");
 			}
 		}
 		else
@@ -1001,11 +950,12 @@ void ObjectManager::Update()
 	vObjs.clear();
 	vObjs.reserve(MaxObjects);
 
-	// fill objects array to be processed
+	// fill objects array to be processed, dense array is grouped by class
 	R3DPROFILE_START("UpdateLoading");
-	for(GameObject* obj = pFirstObject; obj; obj = obj->pNextObject)
+	for(int i = 0; i < m_Objects.GetDenseCount(); i++)
 	{
-		if(!obj->isActive())
+		GameObject* obj = m_Objects.GetDense(i);
+		if(!obj || !obj->isActive())
 			continue;
 
 		// async loaded stray child
@@ -1155,15 +1105,16 @@ void ObjectManager::Update()
 
 #endif //WO_SERVER
 	m_pRootBox->PrepareForRender();
+	m_pSceneBVH->Update();
 }
 
 
 void ObjectManager::EndFrame()
 {
 	// Update all objects, remove all inactive
-	for(int i = 0; i < MaxObjects; i++)
+	for(int i = 0; i < m_Objects.GetDenseCount(); i++)
 	{
-		GameObject* obj = pObjectArray[i];
+		GameObject* obj = m_Objects.GetDense(i);
 		if(obj == NULL)
 			continue;
 		int activeFlag = obj->getActiveFlag();
@@ -1179,8 +1130,7 @@ void ObjectManager::EndFrame()
 		if(obj->getActiveFlag() == 0) // schedule for deletion
 		{
 			// remove it from scene rendering
-			if(obj->m_SceneBox)
-				obj->m_SceneBox->Remove(obj);
+			RemoveFromScene(obj);
 			// remove it from physics
 			if(obj->PhysicsObject)
 			{
@@ -1195,8 +1145,7 @@ void ObjectManager::EndFrame()
 			}
 			if(obj->NetworkID>0)
 			{
-				NetworkIDMap.erase(obj->NetworkID);
-				obj->NetworkID = 0;
+				ClearNetworkID(obj);
 			}
 
 			obj->setActiveFlag(-1);
@@ -1214,6 +1163,8 @@ void ObjectManager::EndFrame()
 		ObjectManager_Copy_OldState(obj);
 	}
 
+	// fill holes of deleted objects and put new ones to their class group
+	m_Objects.Compact();
 }
 
 #if USE_VMPROTECT
@@ -1223,7 +1174,7 @@ GameObject* ObjectManager::GetFirstObject()
 {
 	VMPROTECT_BeginMutation("ObjectManager::GetFirstObject");
 
-	for(GameObject* obj = pFirstObject; obj; obj = obj->pNextObject)
+	for(GameObject* obj = m_Objects.FindDense(0); obj; obj = m_Objects.FindDense(obj->DenseIndex + 1))
 	{
 		if(obj->ObjFlags & OBJFLAG_Removed)
 			continue;
@@ -1238,7 +1189,11 @@ GameObject* ObjectManager::GetNextObject(const GameObject* in_obj)
 {
 	VMPROTECT_BeginMutation("ObjectManager::GetNextObject");
 
-	for(GameObject* obj = in_obj->pNextObject; obj; obj = obj->pNextObject)
+	// object was deleted during iteration
+	if(in_obj->DenseIndex < 0)
+		return NULL;
+
+	for(GameObject* obj = m_Objects.FindDense(in_obj->DenseIndex + 1); obj; obj = m_Objects.FindDense(obj->DenseIndex + 1))
 	{
 		if(obj->ObjFlags & OBJFLAG_Removed)
 			continue;
@@ -1259,7 +1214,7 @@ ObjectIterator ObjectManager::GetFirstOfAllObjects()
 {
 	ObjectIterator iter;
 
-	iter.current = pFirstObject;
+	iter.current = m_Objects.FindDense( 0 );
 	iter.staticIndex = -1;
 
 	if( !iter.current )
@@ -1288,9 +1243,10 @@ ObjectIterator ObjectManager::GetNextOfAllObjects( const ObjectIterator& it )
 	}
 	else
 	{
-		if( iter.current->pNextObject )
+		GameObject* next = iter.current->DenseIndex >= 0 ? m_Objects.FindDense( iter.current->DenseIndex + 1 ) : NULL;
+		if( next )
 		{
-			iter.current = iter.current->pNextObject;
+			iter.current = next;
 		}
 		else
 		{
@@ -1329,7 +1285,7 @@ GameObject* ObjectManager::CastRay(const r3dPoint3D& vStart, const r3dPoint3D& v
 	//	Location selection for spawn points
 	int selectedLocation = -1;
 
-	GameObject* obj_i = pFirstObject; 
+	GameObject* obj_i = m_Objects.FindDense( 0 ); 
 	GameObject* nextObj = NULL;
 
 	int sidx = 0, se = NumStaticObjects;
@@ -1340,7 +1296,7 @@ GameObject* ObjectManager::CastRay(const r3dPoint3D& vStart, const r3dPoint3D& v
 
 		if( obj_i )
 		{
-			nextObj = obj_i->pNextObject;
+			nextObj = m_Objects.FindDense( obj_i->DenseIndex + 1 );
 			obj = obj_i;
 		}
 		else
@@ -1539,7 +1495,7 @@ GameObject* ObjectManager::CastMeshRay(const r3dPoint3D& vStart, const r3dPoint3
 	int		CFaceN = 0;
 	float 		dst = 999999;
 
-	GameObject* obj_i = pFirstObject; 
+	GameObject* obj_i = m_Objects.FindDense( 0 ); 
 	GameObject* nextObj = NULL;
 
 	int sidx = 0, se = NumStaticObjects;
@@ -1550,7 +1506,7 @@ GameObject* ObjectManager::CastMeshRay(const r3dPoint3D& vStart, const r3dPoint3
 
 		if( obj_i )
 		{
-			nextObj = obj_i->pNextObject;
+			nextObj = m_Objects.FindDense( obj_i->DenseIndex + 1 );
 			obj = obj_i;
 		}
 		else
@@ -1722,7 +1678,7 @@ ObjectManager::ResetObjFlags()
 void
 ObjectManager::IssueOcclusionQueries()
 {
-	if( r_use_oq->GetInt() && r3dRenderer->SupportsOQ )
+	if( r_use_oq->GetInt() && r3dRenderer->SupportsOQ && !r_soft_oq->GetInt() )
 	{
 		m_pRootBox->DoOcclusionQueries( PrepCam );
 	}
@@ -1730,6 +1686,17 @@ ObjectManager::IssueOcclusionQueries()
 
 void ObjectManager::GetObjectsInCube(const r3dBoundBox& box, GameObject**& result, int& objectsCount)
 {
+	if( r_scene_bvh->GetInt() )
+	{
+		// tests object bounds, not just SceneBox nodes they are in
+		m_BoxQueryResult.Clear();
+		m_pSceneBVH->GetObjectsInBox( box, m_BoxQueryResult );
+
+		objectsCount = m_BoxQueryResult.Count();
+		result = objectsCount ? &m_BoxQueryResult[ 0 ] : box_scene_query;
+		return;
+	}
+
 	m_pRootBox->TraverseTree( 0, box, box_scene_query, objectsCount);
 	result = box_scene_query;
 }
@@ -2063,7 +2030,10 @@ ObjectManager::PrepareSlicedShadowsInterm( const r3dCamera& Cam, D3DXPLANE (&mai
 {
 	n_draw_interm = 0;
 
-	m_pRootBox->TraverseTree( 1, Cam, draw_interm, n_draw_interm, r_shadow_slice0_min_size->GetFloat() );
+	if( r_scene_bvh->GetInt() )
+		m_pSceneBVH->TraverseFrustum( 1, Cam, r3dRenderer->FrustumPlanes, draw_interm, n_draw_interm, r_shadow_slice0_min_size->GetFloat() );
+	else
+		m_pRootBox->TraverseTree( 1, Cam, draw_interm, n_draw_interm, r_shadow_slice0_min_size->GetFloat() );
 
 	bool newRecalcShadowExData = false ;
 	ShadowCullNeedsRecalc = false ;
@@ -2217,9 +2187,20 @@ ObjectManager::PrepareSlicedShadowsInterm( const r3dCamera& Cam, D3DXPLANE (&mai
 void
 ObjectManager::PrepareShadowsInterm( const r3dCamera& Cam )
 {
+#ifndef WO_SERVER
+	// tree nodes are tested by jobs while objects are traversed
+	JobChief::TaskGroup treeGroup;
+
+	if( TreeObject )
+		gCollectionsManager.StartVisibility( treeGroup );
+#endif
+
 	n_draw_interm = 0;
 
-	m_pRootBox->TraverseTree( 1, Cam, draw_interm, n_draw_interm, 0.f );
+	if( r_scene_bvh->GetInt() )
+		m_pSceneBVH->TraverseFrustum( 1, Cam, r3dRenderer->FrustumPlanes, draw_interm, n_draw_interm, 0.f );
+	else
+		m_pRootBox->TraverseTree( 1, Cam, draw_interm, n_draw_interm, 0.f );
 
 	g_render_arrays[ rsCreateSM ].Clear();
 
@@ -2234,6 +2215,7 @@ ObjectManager::PrepareShadowsInterm( const r3dCamera& Cam )
 	// tree hack
 	if( TreeObject )
 	{
+		treeGroup.Wait();
 		gCollectionsManager.ComputeVisibility(true, false);
 		TreeObject->AppendShadowRenderables( g_render_arrays[ rsCreateSM ], 0, Cam );
 	}
@@ -2410,7 +2392,15 @@ ObjectManager::PrepareObjectArray( const r3dCamera& Cam )
 
 	n_draw = 0;
 
-	if( r_use_oq->GetInt() && r3dRenderer->SupportsOQ )
+#ifndef WO_SERVER
+	// tree nodes are tested by jobs while objects are traversed and occlusion culled
+	JobChief::TaskGroup treeGroup;
+
+	if( TreeObject )
+		gCollectionsManager.StartVisibility( treeGroup );
+#endif
+
+	if( r_use_oq->GetInt() && r3dRenderer->SupportsOQ && !r_soft_oq->GetInt() )
 	{
 		AppendSkippOcclusionCheckRenderables( Cam ) ;
 
@@ -2420,9 +2410,22 @@ ObjectManager::PrepareObjectArray( const r3dCamera& Cam )
 	{
 		AppendSkippOcclusionCheckRenderables( Cam ) ;
 
-		m_pRootBox->TraverseTree( 0, Cam, draw, n_draw, 0.f );
+		int firstObject = n_draw;
+
+		if( r_scene_bvh->GetInt() )
+			m_pSceneBVH->TraverseFrustum( 0, Cam, r3dRenderer->FrustumPlanes, draw, n_draw, 0.f );
+		else
+			m_pRootBox->TraverseTree( 0, Cam, draw, n_draw, 0.f );
+
+		if( r_soft_oq->GetInt() )
+			ApplySoftwareOcclusion( Cam, firstObject );
 	}
 
+#ifndef FINAL_BUILD
+	void SoftOcclusionRecordFrame( const D3DXMATRIX& viewProj, const r3dPoint3D& camPos );
+	SoftOcclusionRecordFrame( r3dRenderer->ViewProjMatrix, Cam );
+#endif
+
 	UpdateSceneTraversalStats();
 #ifndef WO_SERVER
 #if !R3D_NO_BULLET_MGR
@@ -2434,6 +2437,7 @@ ObjectManager::PrepareObjectArray( const r3dCamera& Cam )
 	// tree hack
 	if( TreeObject )
 	{
+		treeGroup.Wait();
 		gCollectionsManager.ComputeVisibility(false, false);
 		gCollectionsManager.SaveVisibility();
 
@@ -2448,6 +2452,99 @@ ObjectManager::PrepareObjectArray( const r3dCamera& Cam )
 
 //------------------------------------------------------------------------
 
+void
+ObjectManager::ApplySoftwareOcclusion( const r3dCamera& Cam, int firstObject )
+{
+	R3DPROFILE_FUNCTION( "ObjectManager::ApplySoftwareOcclusion" );
+
+	m_SoftOccluders.Clear();
+
+	float minScore = r_soft_oq_min_occluder->GetFloat();
+
+	for( int i = firstObject; i < n_draw; i ++ )
+	{
+		GameObject* obj = draw[ i ].obj;
+
+		if( !obj->isObjType( OBJTYPE_Mesh ) || !obj->IsStatic() )
+			continue;
+
+		SoftOcclusionBuffer::OccluderCandidate c;
+
+		c.Score = SoftOcclusionBuffer::GetOccluderScore( obj->GetBBoxWorld(), Cam, minScore );
+		if( c.Score <= 0.f )
+			continue;
+
+		// same LOD as rendered, so occluder never covers more than what is on screen
+		c.NumTriangles = SoftOcclusionBuffer::GetMeshTriangleCount( obj->GetObjectLodMesh() );
+		if( !c.NumTriangles )
+			continue;
+
+		c.Index = i;
+
+		m_SoftOccluders.PushBack( c );
+	}
+
+	SoftOcclusionBuffer::SelectOccluders( m_SoftOccluders, r_soft_oq_max_tris->GetInt() );
+
+	if( !m_SoftOccluders.Count() )
+		return;
+
+	m_pSoftOcclusion->Begin( r3dRenderer->ViewProjMatrix );
+
+	for( int i = 0, e = m_SoftOccluders.Count(); i < e; i ++ )
+	{
+		GameObject* obj = draw[ m_SoftOccluders[ i ].Index ].obj;
+		m_pSoftOcclusion->AddMesh( obj->GetObjectLodMesh(), obj->GetTransformMatrix() );
+	}
+
+	bool multithreaded = r_multithreading->GetInt() && g_pJobChief->GetThreadCount() > 1;
+
+	m_pSoftOcclusion->Rasterize( multithreaded );
+
+	m_SoftOcclusionVisible.Resize( n_draw );
+
+	if( multithreaded )
+		g_pJobChief->Exec( SoftOcclusionCullMT, this, n_draw );
+	else
+		SoftOcclusionCullMT( this, 0, n_draw, 0 );
+
+	int count = firstObject;
+
+	for( int i = firstObject, e = n_draw; i < e; i ++ )
+	{
+		if( m_SoftOcclusionVisible[ i ] )
+			draw[ count ++ ] = draw[ i ];
+	}
+
+	n_draw = count;
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+void
+ObjectManager::SoftOcclusionCullMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+{
+	ObjectManager* This = static_cast< ObjectManager* >( Data );
+
+	for( size_t i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+	{
+		GameObject* obj = draw[ i ].obj;
+
+		if( obj->wasSetSkipOcclusionCheck || obj->GetBBoxLocal().Size.x < 0 )
+		{
+			This->m_SoftOcclusionVisible[ i ] = 1;
+			continue;
+		}
+
+		const r3dBoundBox& bbox = obj->GetBBoxWorld();
+
+		This->m_SoftOcclusionVisible[ i ] = This->m_pSoftOcclusion->IsBoxVisible( bbox.Org, bbox.Org + bbox.Size );
+	}
+}
+
+//------------------------------------------------------------------------
+
 void
 ObjectManager::Prepare( const r3dCamera& Cam )
 {
@@ -2971,9 +3068,23 @@ SceneBox* ObjectManager::GetRoot() const
 	return m_pRootBox ;
 }
 
+SceneBVH* ObjectManager::GetSceneBVH() const
+{
+	return m_pSceneBVH ;
+}
+
+void ObjectManager::RemoveFromScene( GameObject* obj )
+{
+	if( obj->m_SceneBox )
+		obj->m_SceneBox->Remove( obj );
+
+	if( obj->m_SceneBVHEntry >= 0 )
+		m_pSceneBVH->Remove( obj );
+}
+
 void ObjectManager::OnGameEnded()
 {
-	for(GameObject* obj = pFirstObject; obj; obj = obj->pNextObject)
+	for(GameObject* obj = m_Objects.FindDense(0); obj; obj = m_Objects.FindDense(obj->DenseIndex + 1))
 	{
 		obj->OnGameEnded();
 	}
@@ -3067,3 +3178,34 @@ void DumpPhysStats()
 	ConPrint( "Controversial wakers: %d\n", controversialWakers ) ;
 	ConPrint( "Controversial sleepers: %d\n", controversialSleepers ) ;
 }
+
+#ifndef FINAL_BUILD
+void MeshRayBenchmark( int numRays )
+{
+	// LOD0 meshes of level objects, what CastRay traces
+	r3dTL::TArray< r3dMesh* > meshes;
+
+	for( ObjectIterator iter = GameWorld().GetFirstOfAllObjects(); iter.current; iter = GameWorld().GetNextOfAllObjects( iter ) )
+	{
+		GameObject* obj = iter.current;
+
+		if( !obj->isObjType( OBJTYPE_Mesh ) || ( obj->ObjFlags & OBJFLAG_Removed ) )
+			continue;
+
+		r3dMesh* mesh = static_cast< MeshGameObject* >( obj )->MeshLOD[ 0 ];
+		if( !mesh )
+			continue;
+
+		bool found = false;
+		for( int i = 0, e = meshes.Count(); i < e && !found; i ++ )
+		{
+			found = meshes[ i ] == mesh;
+		}
+
+		if( !found )
+			meshes.PushBack( mesh );
+	}
+
+	r3dMeshRayBenchmark( meshes.Count() ? &meshes[ 0 ] : NULL, meshes.Count(), numRays );
+}
+#endif
@@ -35,6 +35,9 @@ struct draw_s {
 #define OBJECTMANAGER_STATICBIT 0x80000000
 
 #include "sceneBox.h"
+#include "SceneBVH.h"
+#include "SoftOcclusion.h"
+#include "ObjectSlotMap.h"
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 //	>	
@@ -89,6 +92,12 @@ private:
 
 	int				m_FrameId ;
 	SceneBox*		m_pRootBox;
+	SceneBVH*		m_pSceneBVH;
+	r3dTL::TArray< GameObject* > m_BoxQueryResult;
+
+	SoftOcclusionBuffer*	m_pSoftOcclusion;
+	r3dTL::TArray< SoftOcclusionBuffer::OccluderCandidate > m_SoftOccluders;
+	r3dTL::TArray< char >	m_SoftOcclusionVisible;
 	ObjectManagerResourceHelper* m_ResourceHelper;
 
 	CRITICAL_SECTION m_CS ;
@@ -101,15 +110,16 @@ public:
 	int				GetFrameId() ;
 
 	r3dSec_type<int, 0x135C85E1> MaxObjects;
-	r3dSec_type<GameObject*, 0x0F9CD8CA> pFirstObject;
 	r3dSec_type<int, 0x13F17D8F> NumObjects;
-	r3dSec_type<GameObject*, 0xFF3D8CD2> pLastObject;
 
 	int		bInited;
 
-	r3dSec_type<int, 0x12D54B5C> CurObjID;
-	r3dSec_type<GameObject**, 0x3016FD4C> pObjectArray;
-	r3dSec_type<int, 0x926C3865> LastFreeObject;
+	r3dSec_type<int, 0x12D54B5C> CurObjID; // high word of static object IDs
+
+	// dynamic objects
+	ObjectSlotMap	m_Objects;
+	// name, hash and network ID indices of dynamic and static objects
+	ObjectLookup	m_Lookup;
 
 	r3dSec_type<int, 0x2F5C72E3> MaxStaticObjects;
 	r3dSec_type<int, 0x1D59C68F> NumStaticObjects;
@@ -117,9 +127,6 @@ public:
 
 	int LastStaticUpdateIdx;
 
-	typedef r3dgameUnorderedMap(DWORD, GameObject*) NetMapType;
-	NetMapType NetworkIDMap;
-
 	// prolly no need to protect these - they're unimportant - used for particle
 	// shadow casting only
 	r3dTL::TFixedArray< GameObject*, 512 >	TransparentShadowCasters ;
@@ -172,6 +179,10 @@ public:
 	int			GetStaticObjectCount() const;
 
 	GameObject*	GetNetworkObject(DWORD netID);
+	bool		SetNetworkID(GameObject* obj, DWORD netID); // false if netID is already taken
+	void		ClearNetworkID(GameObject* obj);
+
+	void		OnObjectHashChanged(GameObject* obj, uint32_t oldHash);
 
 	void		GetObjectsInCube(const r3dBoundBox& box, GameObject**& result, int& objectsCount);
 
@@ -210,6 +221,9 @@ public:
 	void		RecalcObjectMatrices();
 
 	SceneBox*	GetRoot() const ;
+	SceneBVH*	GetSceneBVH() const ;
+	// removes object from SceneBox and SceneBVH, so it isn't returned by scene queries anymore
+	void		RemoveFromScene( GameObject* obj );
 
 	void		UpdateTransparentShadowCaster( GameObject* obj ) ;
 
@@ -220,11 +234,17 @@ public:
 	void		AddObjectListener( IObjectListener* listener );
 
 private:
+	bool		IsInWorld(const GameObject* obj) const;
+
 	void		DoPreparedDraw( const r3dCamera& Cam, eRenderStageID DrawState, int startRenderable, int endRenderable );
 
 	void		AddToTransparentShadowCasters( GameObject* obj ) ;
 	void		RemoveFromTransparentShadowCasters( GameObject* obj ) ;
 
+	// culls draw[ firstObject .. n_draw ) against software depth buffer of biggest static meshes in view
+	void		ApplySoftwareOcclusion( const r3dCamera& Cam, int firstObject );
+	static void	SoftOcclusionCullMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex );
+
 	r3dTL::TArray< IObjectListener* > m_ObjectListeners;
 };
 
@@ -0,0 +1,527 @@
+//
+//
+// Object Manager storage
+//
+//
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include "GameObj.h"
+#include "ObjectSlotMap.h"
+
+#include <algorithm>
+
+namespace
+{
+	struct ClassLess
+	{
+		bool operator()( GameObject* a, GameObject* b ) const
+		{
+			return a->Class->ID < b->Class->ID;
+		}
+	};
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ObjectSlotMap::ObjectSlotMap()
+: mSlots( NULL )
+, mMaxSlots( 0 )
+, mCount( 0 )
+, mGroupedCount( 0 )
+, mDirty( false )
+{
+}
+
+ObjectSlotMap::~ObjectSlotMap()
+{
+	Destroy();
+}
+
+void ObjectSlotMap::Init( int maxObjects )
+{
+	r3d_assert( !mSlots );
+	r3d_assert( maxObjects > 0 && maxObjects <= MAX_SLOTS );
+
+	mMaxSlots	= maxObjects;
+	mCount		= 0;
+	mSlots		= game_new Slot[ mMaxSlots ];
+
+	// lowest slots are taken first
+	mFreeSlots.Resize( mMaxSlots );
+	for( int i = 0; i < mMaxSlots; i ++ )
+	{
+		mSlots[ i ].Obj			= NULL;
+		mSlots[ i ].Generation	= 1;
+		mFreeSlots[ i ]			= mMaxSlots - 1 - i;
+	}
+
+	mDense.Clear();
+	mDense.Reserve( mMaxSlots );
+
+	mGroupedCount	= 0;
+	mDirty			= false;
+}
+
+void ObjectSlotMap::Destroy()
+{
+	SAFE_DELETE_ARRAY( mSlots );
+
+	mMaxSlots		= 0;
+	mCount			= 0;
+	mGroupedCount	= 0;
+	mDirty			= false;
+
+	mFreeSlots.Clear();
+	mDense.Clear();
+	mCompactTemp.Clear();
+}
+
+bool ObjectSlotMap::Add( GameObject* obj )
+{
+	r3d_assert( obj->DenseIndex == -1 );
+
+	if( mFreeSlots.Count() == 0 )
+		return false;
+
+	const int slot = mFreeSlots[ mFreeSlots.Count() - 1 ];
+	mFreeSlots.Resize( mFreeSlots.Count() - 1 );
+
+	Slot& s = mSlots[ slot ];
+	r3d_assert( s.Obj == NULL );
+
+	s.Obj = obj;
+	obj->ID.set( ( s.Generation << GENERATION_SHIFT ) | slot );
+
+	obj->DenseIndex = mDense.Count();
+	mDense.PushBack( obj );
+
+	mCount ++;
+	mDirty = true;
+
+	return true;
+}
+
+void ObjectSlotMap::Remove( GameObject* obj )
+{
+	const int slot = obj->ID.get() & ( MAX_SLOTS - 1 );
+	r3d_assert( slot < mMaxSlots );
+
+	Slot& s = mSlots[ slot ];
+	r3d_assert( s.Obj == obj );
+
+	s.Obj = NULL;
+	// generation is never 0, so ID of slot 0 is never invalidGameObjectID
+	s.Generation = s.Generation % GENERATION_MASK + 1;
+	mFreeSlots.PushBack( slot );
+
+	r3d_assert( obj->DenseIndex >= 0 && mDense[ obj->DenseIndex ] == obj );
+	mDense[ obj->DenseIndex ] = NULL;
+	obj->DenseIndex = -1;
+
+	mCount --;
+	mDirty = true;
+}
+
+GameObject* ObjectSlotMap::Get( gobjid_t id ) const
+{
+	const int slot = id.get() & ( MAX_SLOTS - 1 );
+	if( slot >= mMaxSlots )
+		return NULL;
+
+	GameObject* obj = mSlots[ slot ].Obj;
+	if( obj && obj->ID == id )
+		return obj;
+
+	return NULL;
+}
+
+GameObject* ObjectSlotMap::FindDense( int idx ) const
+{
+	for( int i = idx, e = mDense.Count(); i < e; i ++ )
+	{
+		if( mDense[ i ] )
+			return mDense[ i ];
+	}
+
+	return NULL;
+}
+
+void ObjectSlotMap::Compact()
+{
+	if( !mDirty )
+		return;
+
+	R3DPROFILE_FUNCTION( "ObjectSlotMap::Compact" );
+
+	// squeeze out holes, keeping order. everything before mGroupedCount is already grouped by class
+	int count = 0;
+	int grouped = 0;
+	for( int i = 0, e = mDense.Count(); i < e; i ++ )
+	{
+		if( i == mGroupedCount )
+			grouped = count;
+
+		if( mDense[ i ] )
+			mDense[ count ++ ] = mDense[ i ];
+	}
+
+	if( mGroupedCount >= (int)mDense.Count() )
+		grouped = count;
+
+	mDense.Resize( count );
+
+	// objects added since last compact are usually few, so sort them and merge into grouped part
+	if( count > grouped )
+	{
+		GameObject** dense = &mDense[ 0 ];
+
+		std::stable_sort( dense + grouped, dense + count, ClassLess() );
+
+		mCompactTemp.Resize( count );
+		std::merge( dense, dense + grouped, dense + grouped, dense + count, &mCompactTemp[ 0 ], ClassLess() );
+		memcpy( dense, &mCompactTemp[ 0 ], count * sizeof( GameObject* ) );
+	}
+
+	for( int i = 0; i < count; i ++ )
+	{
+		mDense[ i ]->DenseIndex = i;
+	}
+
+	mGroupedCount	= count;
+	mDirty			= false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ObjectLookup::ObjectLookup()
+: mHashDuplicates( 0 )
+{
+}
+
+void ObjectLookup::Add( GameObject* obj )
+{
+	UpdateName( obj );
+	AddHash( obj, obj->GetHashID() );
+}
+
+void ObjectLookup::Remove( GameObject* obj )
+{
+	if( obj->LookupNameKey )
+	{
+		IndexMap::iterator it = mByName.find( obj->LookupNameKey );
+		if( it != mByName.end() && it->second == obj )
+			mByName.erase( it );
+
+		obj->LookupNameKey = 0;
+	}
+
+	RemoveHash( obj, obj->GetHashID() );
+}
+
+void ObjectLookup::Clear()
+{
+	mByName.clear();
+	mByHash.clear();
+	mByNetworkID.clear();
+	mHashDuplicates = 0;
+}
+
+GameObject* ObjectLookup::FindByName( const char* name )
+{
+	IndexMap::iterator it = mByName.find( r3dHash::MakeHash( name ) );
+	if( it == mByName.end() )
+		return NULL;
+
+	GameObject* obj = it->second;
+	if( obj->Name == name )
+		return obj;
+
+	// renamed since it was indexed, or other name with same hash
+	obj->LookupNameKey = 0;
+	mByName.erase( it );
+
+	return NULL;
+}
+
+void ObjectLookup::UpdateName( GameObject* obj )
+{
+	const uint32_t key = r3dHash::MakeHash( obj->Name.c_str() );
+	if( key == 0 || key == obj->LookupNameKey )
+		return;
+
+	// first object with this name stays in index
+	std::pair< IndexMap::iterator, bool > res = mByName.insert( IndexMap::value_type( key, obj ) );
+	if( !res.second && res.first->second->Name != obj->Name )
+	{
+		res.first->second->LookupNameKey = 0;
+		res.first->second = obj;
+	}
+	else if( !res.second )
+		return;
+
+	if( obj->LookupNameKey )
+	{
+		IndexMap::iterator it = mByName.find( obj->LookupNameKey );
+		if( it != mByName.end() && it->second == obj )
+			mByName.erase( it );
+	}
+
+	obj->LookupNameKey = key;
+}
+
+GameObject* ObjectLookup::FindByHash( uint32_t hash ) const
+{
+	IndexMap::const_iterator it = mByHash.find( hash );
+	if( it == mByHash.end() )
+		return NULL;
+
+	return it->second;
+}
+
+void ObjectLookup::OnHashChanged( GameObject* obj, uint32_t oldHash )
+{
+	RemoveHash( obj, oldHash );
+	AddHash( obj, obj->GetHashID() );
+}
+
+void ObjectLookup::AddHash( GameObject* obj, uint32_t hash )
+{
+	if( hash == 0 )
+		return;
+
+	if( !mByHash.insert( IndexMap::value_type( hash, obj ) ).second )
+		mHashDuplicates ++;
+}
+
+void ObjectLookup::RemoveHash( GameObject* obj, uint32_t hash )
+{
+	if( hash == 0 )
+		return;
+
+	IndexMap::iterator it = mByHash.find( hash );
+	if( it != mByHash.end() && it->second == obj )
+		mByHash.erase( it );
+}
+
+bool ObjectLookup::SetNetworkID( GameObject* obj, DWORD netID )
+{
+	obj->NetworkID = netID;
+	return mByNetworkID.insert( IndexMap::value_type( netID, obj ) ).second;
+}
+
+void ObjectLookup::ClearNetworkID( GameObject* obj )
+{
+	IndexMap::iterator it = mByNetworkID.find( obj->NetworkID );
+	if( it != mByNetworkID.end() && it->second == obj )
+		mByNetworkID.erase( it );
+
+	obj->NetworkID = 0;
+}
+
+GameObject* ObjectLookup::FindByNetworkID( DWORD netID ) const
+{
+	IndexMap::const_iterator it = mByNetworkID.find( netID );
+	if( it == mByNetworkID.end() )
+		return NULL;
+
+	return it->second;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef FINAL_BUILD
+namespace
+{
+	// two classes with different update functions, like real objects of different types
+	class BenchObjectA : public GameObject
+	{
+	public:
+		int Counter;
+		BenchObjectA() : Counter( 0 ) {}
+		virtual BOOL Update() { Counter ++; return TRUE; }
+	};
+
+	class BenchObjectB : public GameObject
+	{
+	public:
+		float Accum;
+		BenchObjectB() : Accum( 0.f ) {}
+		virtual BOOL Update() { Accum += 1.f; return TRUE; }
+	};
+
+	float BenchUpdateWalk( const ObjectSlotMap& slots, int passes )
+	{
+		const float t0 = r3dGetTime();
+		for( int p = 0; p < passes; p ++ )
+		{
+			for( int i = 0, e = slots.GetDenseCount(); i < e; i ++ )
+			{
+				GameObject* obj = slots.GetDense( i );
+				if( obj && obj->isActive() )
+					obj->Update();
+			}
+		}
+		return ( r3dGetTime() - t0 ) / passes;
+	}
+}
+
+// add numObjects dynamic objects to separate storage and measure what ObjectManager does with them every frame
+void ObjectManagerBenchmark( int numObjects )
+{
+	numObjects = R3D_CLAMP( numObjects, 1000, (int)ObjectSlotMap::MAX_SLOTS );
+
+	r3dOutToLog( "ObjectManager benchmark, %d objects\n", numObjects ); CLOG_INDENT;
+
+	static AClass benchClassA( &GameObject::ClassData, "BenchObjectA", "Object", NULL );
+	static AClass benchClassB( &GameObject::ClassData, "BenchObjectB", "Object", NULL );
+	benchClassA.ID = -2;
+	benchClassB.ID = -1;
+
+	ObjectSlotMap slots;
+	ObjectLookup lookup;
+	slots.Init( numObjects );
+
+	r3dTL::TArray< GameObject* > objs;
+	objs.Reserve( numObjects );
+
+	// classes interleaved like objects spawned during game
+	for( int i = 0; i < numObjects; i ++ )
+	{
+		GameObject* obj;
+		if( rand() & 1 )
+		{
+			obj = game_new BenchObjectA;
+			obj->Class = &benchClassA;
+		}
+		else
+		{
+			obj = game_new BenchObjectB;
+			obj->Class = &benchClassB;
+		}
+
+		char name[ 64 ];
+		sprintf( name, "bench_%d", i );
+		obj->Name = name;
+		obj->SetHashID( 0x10000 + i );
+
+		slots.Add( obj );
+		lookup.Add( obj );
+		lookup.SetNetworkID( obj, 0x1000 + i );
+
+		objs.PushBack( obj );
+	}
+
+	const int UPDATE_PASSES = 20;
+	const float tMixed = BenchUpdateWalk( slots, UPDATE_PASSES );
+
+	float t0 = r3dGetTime();
+	slots.Compact();
+	const float tCompact = r3dGetTime() - t0;
+
+	const float tGrouped = BenchUpdateWalk( slots, UPDATE_PASSES );
+
+	r3dOutToLog( "update walk: %.3f ms in creation order, %.3f ms grouped by class, compact took %.3f ms\n", tMixed * 1000.f, tGrouped * 1000.f, tCompact * 1000.f );
+
+	// lookups of random live objects
+	const int NUM_LOOKUPS = 200000;
+	const int NUM_SCANS = 200;
+
+	r3dTL::TArray< int > picks;
+	picks.Resize( NUM_LOOKUPS );
+	for( int i = 0; i < NUM_LOOKUPS; i ++ )
+		picks[ i ] = ( rand() * ( RAND_MAX + 1 ) + rand() ) % numObjects;
+
+	int found = 0;
+
+	t0 = r3dGetTime();
+	for( int i = 0; i < NUM_LOOKUPS; i ++ )
+		found += slots.Get( objs[ picks[ i ] ]->ID ) != NULL;
+	const float tById = ( r3dGetTime() - t0 ) / NUM_LOOKUPS;
+
+	t0 = r3dGetTime();
+	for( int i = 0; i < NUM_LOOKUPS; i ++ )
+		found += lookup.FindByHash( 0x10000 + picks[ i ] ) != NULL;
+	const float tByHash = ( r3dGetTime() - t0 ) / NUM_LOOKUPS;
+
+	t0 = r3dGetTime();
+	for( int i = 0; i < NUM_LOOKUPS; i ++ )
+		found += lookup.FindByNetworkID( 0x1000 + picks[ i ] ) != NULL;
+	const float tByNetID = ( r3dGetTime() - t0 ) / NUM_LOOKUPS;
+
+	t0 = r3dGetTime();
+	for( int i = 0; i < NUM_LOOKUPS; i ++ )
+		found += lookup.FindByName( objs[ picks[ i ] ]->Name.c_str() ) != NULL;
+	const float tByName = ( r3dGetTime() - t0 ) / NUM_LOOKUPS;
+
+	// what GetObject(name) and GetObjectByHash did before indices
+	t0 = r3dGetTime();
+	for( int i = 0; i < NUM_SCANS; i ++ )
+	{
+		const r3dString& name = objs[ picks[ i ] ]->Name;
+		for( int k = 0, e = slots.GetDenseCount(); k < e; k ++ )
+		{
+			if( slots.GetDense( k )->Name == name )
+			{
+				found ++;
+				break;
+			}
+		}
+	}
+	const float tScanName = ( r3dGetTime() - t0 ) / NUM_SCANS;
+
+	t0 = r3dGetTime();
+	for( int i = 0; i < NUM_SCANS; i ++ )
+	{
+		const uint32_t hash = 0x10000 + picks[ i ];
+		for( int k = 0, e = slots.GetDenseCount(); k < e; k ++ )
+		{
+			if( slots.GetDense( k )->GetHashID() == hash )
+			{
+				found ++;
+				break;
+			}
+		}
+	}
+	const float tScanHash = ( r3dGetTime() - t0 ) / NUM_SCANS;
+
+	r3d_assert( found == NUM_LOOKUPS * 4 + NUM_SCANS * 2 );
+
+	r3dOutToLog( "lookup, us: by ID %.3f, by network ID %.3f, by hash %.3f (scan %.1f), by name %.3f (scan %.1f)\n",
+		tById * 1e6f, tByNetID * 1e6f, tByHash * 1e6f, tScanHash * 1e6f, tByName * 1e6f, tScanName * 1e6f );
+
+	// churn: IDs of removed objects must not resolve to objects that reused their slots
+	r3dTL::TArray< gobjid_t > staleIDs;
+	for( int i = 0; i < numObjects; i += 4 )
+	{
+		GameObject* obj = objs[ i ];
+		staleIDs.PushBack( obj->ID );
+
+		lookup.Remove( obj );
+		slots.Remove( obj );
+
+		obj->ID = invalidGameObjectID;
+		slots.Add( obj );
+		lookup.Add( obj );
+	}
+
+	int stale = 0;
+	for( int i = 0, e = staleIDs.Count(); i < e; i ++ )
+		stale += slots.Get( staleIDs[ i ] ) != NULL;
+
+	t0 = r3dGetTime();
+	slots.Compact();
+	r3dOutToLog( "re-added %d objects, %d stale IDs resolved, compact took %.3f ms\n", staleIDs.Count(), stale, ( r3dGetTime() - t0 ) * 1000.f );
+
+	for( int i = 0; i < numObjects; i ++ )
+	{
+		GameObject* obj = objs[ i ];
+		lookup.ClearNetworkID( obj );
+		lookup.Remove( obj );
+		slots.Remove( obj );
+		delete obj;
+	}
+
+	slots.Destroy();
+}
+#endif
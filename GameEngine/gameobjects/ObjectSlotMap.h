@@ -0,0 +1,117 @@
+#ifndef	__PWAR_OBJECTSLOTMAP_H
+#define	__PWAR_OBJECTSLOTMAP_H
+
+#include "GameObj.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//	>	Storage of dynamic objects for ObjectManager
+//
+//	Object ID is slot index in low word and slot generation in high word. Generation is bumped
+//	every time slot is freed, so stale IDs never resolve to object that reused the slot.
+//
+//	Objects are also kept in dense array, which is what all iteration walks. Removed objects leave
+//	NULL holes there until Compact(), which also groups objects by class, so update loop calls same
+//	virtual functions in a row. Creation order is kept inside one class.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ObjectSlotMap
+{
+public:
+	enum
+	{
+		MAX_SLOTS			= 0x10000,
+		GENERATION_SHIFT	= 16,
+		GENERATION_MASK		= 0x7FFF,	// top bit of ID is OBJECTMANAGER_STATICBIT
+	};
+
+	ObjectSlotMap();
+	~ObjectSlotMap();
+
+	void		Init( int maxObjects );
+	void		Destroy();
+
+	// sets obj->ID, returns false if all slots are taken
+	bool		Add( GameObject* obj );
+	void		Remove( GameObject* obj );
+
+	// NULL if ID is stale
+	GameObject*	Get( gobjid_t id ) const;
+	GameObject*	GetSlot( int slot ) const		{ return mSlots[ slot ].Obj; }
+	int			GetMaxSlots() const				{ return mMaxSlots; }
+	int			GetCount() const				{ return mCount; }
+
+	// dense array, can have NULLs for objects removed after last Compact()
+	int			GetDenseCount() const			{ return mDense.Count(); }
+	GameObject*	GetDense( int idx ) const		{ return mDense[ idx ]; }
+	// first object at dense index idx or after it
+	GameObject*	FindDense( int idx ) const;
+
+	// must not be called while someone walks dense array
+	void		Compact();
+
+private:
+	struct Slot
+	{
+		GameObject*	Obj;
+		int			Generation;
+	};
+
+	Slot*							mSlots;
+	int								mMaxSlots;
+	int								mCount;
+	r3dTL::TArray< int >			mFreeSlots;
+
+	r3dTL::TArray< GameObject* >	mDense;
+	int								mGroupedCount;	// dense prefix that is grouped by class
+	bool							mDirty;
+
+	r3dTL::TArray< GameObject* >	mCompactTemp;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//	>	Hash indices of world objects by name, hash ID and network ID
+//
+//	Hash ID and network ID changes go through ObjectManager, so these indices are exact.
+//	Name is public member changed directly all over game code, so name entries are verified on lookup
+//	and FindByName miss doesn't mean there is no such object - caller has to fall back to search.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class ObjectLookup
+{
+public:
+	ObjectLookup();
+
+	void		Add( GameObject* obj );
+	void		Remove( GameObject* obj );
+	void		Clear();
+
+	GameObject*	FindByName( const char* name );
+	void		UpdateName( GameObject* obj );
+
+	GameObject*	FindByHash( uint32_t hash ) const;
+	void		OnHashChanged( GameObject* obj, uint32_t oldHash );
+	// objects with same hash ID were added, FindByHash miss isn't exact anymore
+	bool		HasHashDuplicates() const		{ return mHashDuplicates > 0; }
+
+	// returns false if other object already has this network ID
+	bool		SetNetworkID( GameObject* obj, DWORD netID );
+	void		ClearNetworkID( GameObject* obj );
+	GameObject*	FindByNetworkID( DWORD netID ) const;
+
+private:
+	typedef r3dgameUnorderedMap(uint32_t, GameObject*) IndexMap;
+
+	IndexMap	mByName;
+	IndexMap	mByHash;
+	IndexMap	mByNetworkID;
+	int			mHashDuplicates;
+
+	void		AddHash( GameObject* obj, uint32_t hash );
+	void		RemoveHash( GameObject* obj, uint32_t hash );
+};
+
+#endif	//__PWAR_OBJECTSLOTMAP_H
@@ -0,0 +1,1599 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include <emmintrin.h>
+
+#include "GameObj.h"
+#include "ObjManag.h"
+#include "SceneBVH.h"
+
+#include "JobChief.h"
+
+uint8_t getShadowSliceBit(GameObject* userObject, const r3dCamera& Cam );
+
+namespace
+{
+	const float EMPTY_BOUND = 1e30f;
+
+	R3D_FORCEINLINE int MakeItemChild( int item )	{ return -2 - item; }
+	R3D_FORCEINLINE bool IsItemChild( int child )	{ return child <= -2; }
+	R3D_FORCEINLINE int GetChildItem( int child )	{ return -2 - child; }
+
+	// spreads low 10 bits of v so there are 2 zero bits between them
+	R3D_FORCEINLINE uint32_t SpreadBits( uint32_t v )
+	{
+		v = ( v * 0x00010001u ) & 0xFF0000FFu;
+		v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+		v = ( v * 0x00000011u ) & 0xC30C30C3u;
+		v = ( v * 0x00000005u ) & 0x49249249u;
+		return v;
+	}
+
+	R3D_FORCEINLINE uint32_t QuantizeMorton( float v, float org, float scale )
+	{
+		float t = ( v - org ) * scale;
+
+		// written this way so NaN ends up as 0
+		t = t > 0.f ? t : 0.f;
+		t = t < 1023.f ? t : 1023.f;
+
+		return (uint32_t)t;
+	}
+
+	// returns mask of children which are outside of frustum, partial gets mask of children which are not fully inside
+	R3D_FORCEINLINE int CullNode( const SceneBVHTree::Node& node, const SceneBVHFrustum& frustum, int& partial )
+	{
+		const __m128 zero = _mm_setzero_ps();
+
+		__m128 outsideMask = zero;
+		__m128 partialMask = zero;
+
+		for( int i = 0; i < 6; i ++ )
+		{
+			const SceneBVHFrustum::Plane& p = frustum.Planes[ i ];
+
+			const __m128 a = _mm_loadu_ps( p.A );
+			const __m128 b = _mm_loadu_ps( p.B );
+			const __m128 c = _mm_loadu_ps( p.C );
+			const __m128 d = _mm_loadu_ps( p.D );
+
+			// box corner farthest along plane normal is behind the plane - whole box is
+			__m128 pd = _mm_add_ps( _mm_mul_ps( a, _mm_loadu_ps( node.Bounds[ p.PX ] ) ), _mm_mul_ps( b, _mm_loadu_ps( node.Bounds[ p.PY ] ) ) );
+			pd = _mm_add_ps( _mm_add_ps( pd, _mm_mul_ps( c, _mm_loadu_ps( node.Bounds[ p.PZ ] ) ) ), d );
+
+			__m128 nd = _mm_add_ps( _mm_mul_ps( a, _mm_loadu_ps( node.Bounds[ p.NX ] ) ), _mm_mul_ps( b, _mm_loadu_ps( node.Bounds[ p.NY ] ) ) );
+			nd = _mm_add_ps( _mm_add_ps( nd, _mm_mul_ps( c, _mm_loadu_ps( node.Bounds[ p.NZ ] ) ) ), d );
+
+			outsideMask = _mm_or_ps( outsideMask, _mm_cmplt_ps( pd, zero ) );
+			partialMask = _mm_or_ps( partialMask, _mm_cmplt_ps( nd, zero ) );
+		}
+
+		partial = _mm_movemask_ps( partialMask );
+		return _mm_movemask_ps( outsideMask );
+	}
+
+	// returns mask of children overlapping box
+	R3D_FORCEINLINE int OverlapNode( const SceneBVHTree::Node& node, const __m128 (&boxMin)[ 3 ], const __m128 (&boxMax)[ 3 ] )
+	{
+		__m128 mask = _mm_cmple_ps( _mm_loadu_ps( node.Bounds[ SceneBVHTree::MIN_X ] ), boxMax[ 0 ] );
+		mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_loadu_ps( node.Bounds[ SceneBVHTree::MIN_Y ] ), boxMax[ 1 ] ) );
+		mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_loadu_ps( node.Bounds[ SceneBVHTree::MIN_Z ] ), boxMax[ 2 ] ) );
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( _mm_loadu_ps( node.Bounds[ SceneBVHTree::MAX_X ] ), boxMin[ 0 ] ) );
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( _mm_loadu_ps( node.Bounds[ SceneBVHTree::MAX_Y ] ), boxMin[ 1 ] ) );
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( _mm_loadu_ps( node.Bounds[ SceneBVHTree::MAX_Z ] ), boxMin[ 2 ] ) );
+
+		return _mm_movemask_ps( mask );
+	}
+
+	void GetObjectBounds( GameObject* obj, r3dPoint3D& mn, r3dPoint3D& mx )
+	{
+		// bbox isn't calculated yet, position is all we know
+		if( obj->GetBBoxLocal().Size.x < 0 )
+		{
+			mn = obj->GetPosition();
+			mx = mn;
+			return;
+		}
+
+		const r3dBoundBox& bbox = obj->GetBBoxWorld();
+
+		mn = bbox.Org;
+		mx = bbox.Org + bbox.Size;
+	}
+
+	// these skip frustum check in SceneBox traversal too, their bounds aren't reliable
+	R3D_FORCEINLINE bool IsUnbounded( GameObject* obj )
+	{
+		return obj->wasSetSkipOcclusionCheck && ( obj->ObjFlags & OBJFLAG_AlwaysDraw );
+	}
+
+	R3D_FORCEINLINE bool IsQueryVisible( GameObject* obj, int shadowPass )
+	{
+		if( !obj->isActive() || obj->ObjFlags & OBJFLAG_SkipDraw || obj->ObjFlags & OBJFLAG_JustCreated || obj->ObjFlags & OBJFLAG_Removed || !obj->isDetailedVisible() )
+			return false;
+
+		if( shadowPass && obj->ObjFlags & OBJFLAG_DisableShadows )
+			return false;
+
+		return true;
+	}
+
+	struct DrawFilter
+	{
+		const r3dCamera*	Cam;
+		r3dPoint3D			CullRefPos;
+		float				DefDrawDistanceSq;
+		float				MinObjectSize;
+		int					ShadowPass;
+	};
+
+	// same checks as SceneBox::AppendNodeObjects, frustum is already checked by tree
+	R3D_FORCEINLINE bool MakeDraw( GameObject* obj, const DrawFilter& filter, draw_s& out )
+	{
+		if( !IsQueryVisible( obj, filter.ShadowPass ) )
+			return false;
+
+		float cullDistSq = ( filter.CullRefPos - obj->GetPosition() ).LengthSq();
+
+		if( !CheckObjectDistance( obj, cullDistSq, filter.DefDrawDistanceSq ) )
+			return false;
+
+		if( !CheckObjectSize( obj, filter.MinObjectSize ) )
+			return false;
+
+		out.obj = obj;
+		out.distSq = ( obj->GetPosition() - *filter.Cam ).LengthSq();
+		out.shadow_slice = getShadowSliceBit( obj, *filter.Cam );
+
+		return true;
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHFrustum::Set( const D3DXPLANE (&planes)[ 6 ] )
+{
+	for( int i = 0; i < 6; i ++ )
+	{
+		const D3DXPLANE& src = planes[ i ];
+		Plane& p = Planes[ i ];
+
+		for( int k = 0; k < 4; k ++ )
+		{
+			p.A[ k ] = src.a;
+			p.B[ k ] = src.b;
+			p.C[ k ] = src.c;
+			p.D[ k ] = src.d;
+		}
+
+		p.PX = src.a >= 0.f ? SceneBVHTree::MAX_X : SceneBVHTree::MIN_X;
+		p.PY = src.b >= 0.f ? SceneBVHTree::MAX_Y : SceneBVHTree::MIN_Y;
+		p.PZ = src.c >= 0.f ? SceneBVHTree::MAX_Z : SceneBVHTree::MIN_Z;
+
+		p.NX = src.a >= 0.f ? SceneBVHTree::MIN_X : SceneBVHTree::MAX_X;
+		p.NY = src.b >= 0.f ? SceneBVHTree::MIN_Y : SceneBVHTree::MAX_Y;
+		p.NZ = src.c >= 0.f ? SceneBVHTree::MIN_Z : SceneBVHTree::MAX_Z;
+	}
+}
+
+//------------------------------------------------------------------------
+
+SceneBVHTree::SceneBVHTree()
+: mBuildCost( 0.f )
+, mBuildItems( NULL )
+{
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::Clear()
+{
+	mNodes.Clear();
+	mItemEntry.Clear();
+	mItemSlot.Clear();
+	mBuildCost = 0.f;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::Build( const BuildItem* items, int count )
+{
+	R3DPROFILE_FUNCTION( "SceneBVHTree::Build" );
+
+	Clear();
+
+	if( !count )
+		return;
+
+	// Morton codes of item centers, quantized inside of bounds of all centers
+	r3dPoint3D cmin( FLT_MAX, FLT_MAX, FLT_MAX );
+	r3dPoint3D cmax( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+
+	for( int i = 0; i < count; i ++ )
+	{
+		r3dPoint3D c = ( items[ i ].Min + items[ i ].Max ) * 0.5f;
+		cmin = ElementalMinimum( cmin, c );
+		cmax = ElementalMaximum( cmax, c );
+	}
+
+	r3dPoint3D size = cmax - cmin;
+	r3dPoint3D scale( size.x > 0.f ? 1023.f / size.x : 0.f, size.y > 0.f ? 1023.f / size.y : 0.f, size.z > 0.f ? 1023.f / size.z : 0.f );
+
+	mSorted.Resize( count );
+	mSortTemp.Resize( count );
+
+	for( int i = 0; i < count; i ++ )
+	{
+		r3dPoint3D c = ( items[ i ].Min + items[ i ].Max ) * 0.5f;
+
+		mSorted[ i ].Code	=	SpreadBits( QuantizeMorton( c.x, cmin.x, scale.x ) )
+							|	SpreadBits( QuantizeMorton( c.y, cmin.y, scale.y ) ) << 1
+							|	SpreadBits( QuantizeMorton( c.z, cmin.z, scale.z ) ) << 2;
+		mSorted[ i ].Item	= i;
+	}
+
+	// 30 bit codes, LSD radix sort in 3 passes of 10 bits
+	{
+		SortItem* src = &mSorted[ 0 ];
+		SortItem* dst = &mSortTemp[ 0 ];
+
+		for( int shift = 0; shift < 30; shift += 10 )
+		{
+			int offsets[ 1024 ];
+			memset( offsets, 0, sizeof offsets );
+
+			for( int i = 0; i < count; i ++ )
+				offsets[ src[ i ].Code >> shift & 1023 ] ++;
+
+			for( int i = 0, sum = 0; i < 1024; i ++ )
+			{
+				int n = offsets[ i ];
+				offsets[ i ] = sum;
+				sum += n;
+			}
+
+			for( int i = 0; i < count; i ++ )
+				dst[ offsets[ src[ i ].Code >> shift & 1023 ] ++ ] = src[ i ];
+
+			std::swap( src, dst );
+		}
+
+		// odd number of passes, result is in temp
+		mSorted.Swap( mSortTemp );
+	}
+
+	// items are indexed in Morton order
+	mItemEntry.Resize( count );
+	mItemSlot.Resize( count );
+
+	for( int i = 0; i < count; i ++ )
+		mItemEntry[ i ] = items[ mSorted[ i ].Item ].Entry;
+
+	// every node has at least 2 children
+	mNodes.Reserve( count / 2 + 1 );
+
+	mBuildItems = items;
+	BuildNode( 0, count, 0 );
+	mBuildItems = NULL;
+
+	mBuildCost = CalcCost();
+}
+
+//------------------------------------------------------------------------
+
+int
+SceneBVHTree::BuildNode( int begin, int end, int depth )
+{
+	r3d_assert( depth < MAX_DEPTH );
+
+	const int nodeIdx = mNodes.Count();
+
+	{
+		Node empty;
+		const float emptyBounds[ 6 ] = { EMPTY_BOUND, EMPTY_BOUND, EMPTY_BOUND, -EMPTY_BOUND, -EMPTY_BOUND, -EMPTY_BOUND };
+
+		for( int k = 0; k < 6; k ++ )
+		{
+			for( int i = 0; i < 4; i ++ )
+				empty.Bounds[ k ][ i ] = emptyBounds[ k ];
+		}
+
+		for( int i = 0; i < 4; i ++ )
+			empty.Child[ i ] = EMPTY_CHILD;
+
+		mNodes.PushBack( empty );
+	}
+
+	// up to 4 ranges, split twice by highest differing Morton bit
+	int ranges[ 5 ];
+	int numRanges = 0;
+
+	if( end - begin <= 4 )
+	{
+		for( int i = begin; i <= end; i ++ )
+			ranges[ numRanges ++ ] = i;
+
+		numRanges --;
+	}
+	else
+	{
+		struct Splitter
+		{
+			static int FindSplit( const SortItem* sorted, int begin, int end )
+			{
+				uint32_t first = sorted[ begin ].Code;
+				uint32_t last = sorted[ end - 1 ].Code;
+
+				if( first == last )
+					return ( begin + end ) >> 1;
+
+				uint32_t diff = first ^ last;
+				uint32_t bit = 0x80000000;
+				while( !( diff & bit ) )
+					bit >>= 1;
+
+				// codes share all bits above, so this bit goes from 0 to 1 once inside of range
+				int lo = begin, hi = end - 1;
+				while( lo < hi )
+				{
+					int mid = ( lo + hi ) >> 1;
+					if( sorted[ mid ].Code & bit )
+						hi = mid;
+					else
+						lo = mid + 1;
+				}
+
+				return lo;
+			}
+		};
+
+		const SortItem* sorted = &mSorted[ 0 ];
+
+		int mid = Splitter::FindSplit( sorted, begin, end );
+
+		ranges[ numRanges ++ ] = begin;
+		if( mid - begin > 1 )
+			ranges[ numRanges ++ ] = Splitter::FindSplit( sorted, begin, mid );
+		ranges[ numRanges ++ ] = mid;
+		if( end - mid > 1 )
+			ranges[ numRanges ++ ] = Splitter::FindSplit( sorted, mid, end );
+		ranges[ numRanges ] = end;
+	}
+
+	for( int i = 0; i < numRanges; i ++ )
+	{
+		const int rb = ranges[ i ];
+		const int re = ranges[ i + 1 ];
+
+		float bounds[ 6 ];
+
+		if( re - rb == 1 )
+		{
+			const BuildItem& item = mBuildItems[ mSorted[ rb ].Item ];
+
+			bounds[ MIN_X ] = item.Min.x; bounds[ MIN_Y ] = item.Min.y; bounds[ MIN_Z ] = item.Min.z;
+			bounds[ MAX_X ] = item.Max.x; bounds[ MAX_Y ] = item.Max.y; bounds[ MAX_Z ] = item.Max.z;
+
+			SetChild( nodeIdx, i, MakeItemChild( rb ), bounds );
+			mItemSlot[ rb ] = nodeIdx * 4 + i;
+		}
+		else
+		{
+			int child = BuildNode( rb, re, depth + 1 );
+
+			const Node& childNode = mNodes[ child ];
+			for( int k = 0; k < 3; k ++ )
+			{
+				const float* mn = childNode.Bounds[ MIN_X + k ];
+				const float* mx = childNode.Bounds[ MAX_X + k ];
+				bounds[ MIN_X + k ] = R3D_MIN( R3D_MIN( mn[ 0 ], mn[ 1 ] ), R3D_MIN( mn[ 2 ], mn[ 3 ] ) );
+				bounds[ MAX_X + k ] = R3D_MAX( R3D_MAX( mx[ 0 ], mx[ 1 ] ), R3D_MAX( mx[ 2 ], mx[ 3 ] ) );
+			}
+
+			SetChild( nodeIdx, i, child, bounds );
+		}
+	}
+
+	return nodeIdx;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::SetChild( int node, int slot, int child, const float* bounds )
+{
+	Node& n = mNodes[ node ];
+
+	for( int k = 0; k < 6; k ++ )
+		n.Bounds[ k ][ slot ] = bounds[ k ];
+
+	n.Child[ slot ] = child;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::SetItemBounds( int item, const r3dPoint3D& mn, const r3dPoint3D& mx )
+{
+	const int slot = mItemSlot[ item ];
+	Node& n = mNodes[ slot >> 2 ];
+
+	n.Bounds[ MIN_X ][ slot & 3 ] = mn.x;
+	n.Bounds[ MIN_Y ][ slot & 3 ] = mn.y;
+	n.Bounds[ MIN_Z ][ slot & 3 ] = mn.z;
+	n.Bounds[ MAX_X ][ slot & 3 ] = mx.x;
+	n.Bounds[ MAX_Y ][ slot & 3 ] = mx.y;
+	n.Bounds[ MAX_Z ][ slot & 3 ] = mx.z;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::RemoveItem( int item )
+{
+	mItemEntry[ item ] = -1;
+
+	SetItemBounds( item, r3dPoint3D( EMPTY_BOUND, EMPTY_BOUND, EMPTY_BOUND ), r3dPoint3D( -EMPTY_BOUND, -EMPTY_BOUND, -EMPTY_BOUND ) );
+}
+
+//------------------------------------------------------------------------
+
+float
+SceneBVHTree::Refit()
+{
+	R3DPROFILE_FUNCTION( "SceneBVHTree::Refit" );
+
+	// children are always created after their parent
+	for( int n = (int)mNodes.Count() - 1; n >= 0; n -- )
+	{
+		Node& node = mNodes[ n ];
+
+		for( int i = 0; i < 4; i ++ )
+		{
+			const int child = node.Child[ i ];
+			if( child < 0 )
+				continue;
+
+			const Node& childNode = mNodes[ child ];
+			for( int k = 0; k < 3; k ++ )
+			{
+				const float* mn = childNode.Bounds[ MIN_X + k ];
+				const float* mx = childNode.Bounds[ MAX_X + k ];
+				node.Bounds[ MIN_X + k ][ i ] = R3D_MIN( R3D_MIN( mn[ 0 ], mn[ 1 ] ), R3D_MIN( mn[ 2 ], mn[ 3 ] ) );
+				node.Bounds[ MAX_X + k ][ i ] = R3D_MAX( R3D_MAX( mx[ 0 ], mx[ 1 ] ), R3D_MAX( mx[ 2 ], mx[ 3 ] ) );
+			}
+		}
+	}
+
+	return CalcCost();
+}
+
+//------------------------------------------------------------------------
+
+float
+SceneBVHTree::CalcCost() const
+{
+	float cost = 0.f;
+
+	for( int n = 0, e = mNodes.Count(); n < e; n ++ )
+	{
+		const Node& node = mNodes[ n ];
+
+		for( int i = 0; i < 4; i ++ )
+		{
+			float dx = node.Bounds[ MAX_X ][ i ] - node.Bounds[ MIN_X ][ i ];
+			float dy = node.Bounds[ MAX_Y ][ i ] - node.Bounds[ MIN_Y ][ i ];
+			float dz = node.Bounds[ MAX_Z ][ i ] - node.Bounds[ MIN_Z ][ i ];
+
+			// empty child
+			if( dx < 0.f )
+				continue;
+
+			cost += dx * dy + dy * dz + dz * dx;
+		}
+	}
+
+	return cost;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::AddItemEntries( int startNode, r3dTL::TArray< int >& entries ) const
+{
+	const Node* nodes = &mNodes[ 0 ];
+	const int* itemEntry = &mItemEntry[ 0 ];
+
+	int stack[ MAX_DEPTH * 4 ];
+	int stackSize = 0;
+
+	stack[ stackSize ++ ] = startNode;
+
+	while( stackSize )
+	{
+		const Node& node = nodes[ stack[ -- stackSize ] ];
+
+		for( int i = 0; i < 4; i ++ )
+		{
+			const int child = node.Child[ i ];
+
+			if( IsItemChild( child ) )
+			{
+				const int entry = itemEntry[ GetChildItem( child ) ];
+				if( entry >= 0 )
+					entries.PushBack( entry );
+			}
+			else if( child != EMPTY_CHILD )
+			{
+				stack[ stackSize ++ ] = child;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::QueryFrustum( const SceneBVHFrustum& frustum, r3dTL::TArray< int >& entries ) const
+{
+	if( !mNodes.Count() )
+		return;
+
+	Task root = { 0, 0 };
+	QueryFrustum( frustum, root, entries );
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::QueryFrustum( const SceneBVHFrustum& frustum, const Task& task, r3dTL::TArray< int >& entries ) const
+{
+	if( task.Inside )
+	{
+		AddItemEntries( task.Node, entries );
+		return;
+	}
+
+	const Node* nodes = &mNodes[ 0 ];
+	const int* itemEntry = &mItemEntry[ 0 ];
+
+	int stack[ MAX_DEPTH * 4 ];
+	int stackSize = 0;
+
+	stack[ stackSize ++ ] = task.Node;
+
+	while( stackSize )
+	{
+		const Node& node = nodes[ stack[ -- stackSize ] ];
+
+		int partial;
+		const int outside = CullNode( node, frustum, partial );
+
+		if( outside == 0xF )
+			continue;
+
+		for( int i = 0; i < 4; i ++ )
+		{
+			const int child = node.Child[ i ];
+
+			if( outside & ( 1 << i ) || child == EMPTY_CHILD )
+				continue;
+
+			if( IsItemChild( child ) )
+			{
+				const int entry = itemEntry[ GetChildItem( child ) ];
+				if( entry >= 0 )
+					entries.PushBack( entry );
+			}
+			else if( partial & ( 1 << i ) )
+			{
+				stack[ stackSize ++ ] = child;
+			}
+			else
+			{
+				AddItemEntries( child, entries );
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::QueryBox( const r3dPoint3D& mn, const r3dPoint3D& mx, r3dTL::TArray< int >& entries ) const
+{
+	if( !mNodes.Count() )
+		return;
+
+	const __m128 boxMin[ 3 ] = { _mm_set1_ps( mn.x ), _mm_set1_ps( mn.y ), _mm_set1_ps( mn.z ) };
+	const __m128 boxMax[ 3 ] = { _mm_set1_ps( mx.x ), _mm_set1_ps( mx.y ), _mm_set1_ps( mx.z ) };
+
+	const Node* nodes = &mNodes[ 0 ];
+	const int* itemEntry = &mItemEntry[ 0 ];
+
+	int stack[ MAX_DEPTH * 4 ];
+	int stackSize = 0;
+
+	stack[ stackSize ++ ] = 0;
+
+	while( stackSize )
+	{
+		const Node& node = nodes[ stack[ -- stackSize ] ];
+
+		const int overlap = OverlapNode( node, boxMin, boxMax );
+
+		for( int i = 0; i < 4; i ++ )
+		{
+			const int child = node.Child[ i ];
+
+			if( !( overlap & ( 1 << i ) ) || child == EMPTY_CHILD )
+				continue;
+
+			if( IsItemChild( child ) )
+			{
+				const int entry = itemEntry[ GetChildItem( child ) ];
+				if( entry >= 0 )
+					entries.PushBack( entry );
+			}
+			else
+			{
+				stack[ stackSize ++ ] = child;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVHTree::SplitFrustumQuery( const SceneBVHFrustum& frustum, int minTasks, r3dTL::TArray< Task >& tasks, r3dTL::TArray< int >& entries ) const
+{
+	if( !mNodes.Count() )
+		return;
+
+	const int first = tasks.Count();
+
+	Task root = { 0, 0 };
+	tasks.PushBack( root );
+
+	// breadth first, so tasks end up of similar size
+	int numTasks = 1;
+	for( int t = first; t < (int)tasks.Count() && numTasks < minTasks; t ++ )
+	{
+		const Task task = tasks[ t ];
+
+		tasks[ t ].Node = -1;
+		numTasks --;
+
+		const Node& node = mNodes[ task.Node ];
+
+		int outside = 0;
+		int partial = 0;
+
+		if( !task.Inside )
+			outside = CullNode( node, frustum, partial );
+
+		for( int i = 0; i < 4; i ++ )
+		{
+			const int child = node.Child[ i ];
+
+			if( outside & ( 1 << i ) || child == EMPTY_CHILD )
+				continue;
+
+			if( IsItemChild( child ) )
+			{
+				const int entry = mItemEntry[ GetChildItem( child ) ];
+				if( entry >= 0 )
+					entries.PushBack( entry );
+			}
+			else
+			{
+				Task childTask = { child, !( partial & ( 1 << i ) ) };
+				tasks.PushBack( childTask );
+				numTasks ++;
+			}
+		}
+	}
+
+	// drop expanded tasks
+	int count = first;
+	for( int t = first, e = tasks.Count(); t < e; t ++ )
+	{
+		if( tasks[ t ].Node >= 0 )
+			tasks[ count ++ ] = tasks[ t ];
+	}
+
+	tasks.Resize( count );
+}
+
+//------------------------------------------------------------------------
+
+SceneBVH::SceneBVH()
+: mStaticDead( 0 )
+, mDynamicDead( 0 )
+, mDynamicDirty( false )
+, mFrame( 0 )
+{
+}
+
+//------------------------------------------------------------------------
+
+SceneBVH::~SceneBVH()
+{
+	// objects can be already deleted at this point, so they are not touched
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::Clear()
+{
+	for( int i = 0, e = mEntries.Count(); i < e; i ++ )
+	{
+		if( mEntries[ i ].Obj )
+			mEntries[ i ].Obj->m_SceneBVHEntry = -1;
+	}
+
+	mEntries.Clear();
+	mFreeEntries.Clear();
+	mUnbounded.Clear();
+
+	mStatic.Clear();
+	mDynamic.Clear();
+
+	mStaticDead = 0;
+	mDynamicDead = 0;
+	mDynamicDirty = false;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::Add( GameObject* obj )
+{
+	r3d_assert( obj->m_SceneBVHEntry < 0 );
+
+	Entry e;
+	e.Obj = obj;
+	e.Tree = TREE_DYNAMIC;
+	e.Item = -1;
+	e.LastMoveFrame = mFrame;
+	e.Moved = 0;
+
+	int idx;
+
+	if( mFreeEntries.Count() )
+	{
+		idx = mFreeEntries[ mFreeEntries.Count() - 1 ];
+		mFreeEntries.PopBack();
+		mEntries[ idx ] = e;
+	}
+	else
+	{
+		idx = mEntries.Count();
+		mEntries.PushBack( e );
+	}
+
+	obj->m_SceneBVHEntry = idx;
+
+	mDynamicDirty = true;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::Remove( GameObject* obj )
+{
+	const int idx = obj->m_SceneBVHEntry;
+	if( idx < 0 )
+		return;
+
+	Entry& e = mEntries[ idx ];
+	r3d_assert( e.Obj == obj );
+
+	DetachItem( e );
+
+	e.Obj = NULL;
+	obj->m_SceneBVHEntry = -1;
+
+	mFreeEntries.PushBack( idx );
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::Move( GameObject* obj )
+{
+	mEntries[ obj->m_SceneBVHEntry ].Moved = 1;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::DetachItem( Entry& e )
+{
+	if( e.Item >= 0 && e.Tree != TREE_UNBOUNDED )
+	{
+		GetTree( e.Tree ).RemoveItem( e.Item );
+
+		if( e.Tree == TREE_STATIC )
+			mStaticDead ++;
+		else
+			mDynamicDead ++;
+	}
+
+	e.Item = -1;
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::RebuildTree( int tree )
+{
+	mBuildItems.Clear();
+
+	for( int i = 0, e = mEntries.Count(); i < e; i ++ )
+	{
+		const Entry& en = mEntries[ i ];
+
+		if( !en.Obj || en.Tree != tree )
+			continue;
+
+		SceneBVHTree::BuildItem item;
+		GetObjectBounds( en.Obj, item.Min, item.Max );
+		item.Entry = i;
+
+		mBuildItems.PushBack( item );
+	}
+
+	SceneBVHTree& t = GetTree( tree );
+
+	t.Build( mBuildItems.Count() ? &mBuildItems[ 0 ] : NULL, mBuildItems.Count() );
+
+	for( int i = 0, e = t.GetItemCount(); i < e; i ++ )
+		mEntries[ t.GetItemEntry( i ) ].Item = i;
+
+	if( tree == TREE_STATIC )
+	{
+		mStaticDead = 0;
+	}
+	else
+	{
+		mDynamicDead = 0;
+		mDynamicDirty = false;
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::Update()
+{
+	R3DPROFILE_FUNCTION( "SceneBVH::Update" );
+
+	mFrame ++;
+	mUnbounded.Clear();
+
+	bool rebuildDynamic = mDynamicDirty;
+	bool refitDynamic = false;
+
+	int staticCount = 0;
+	int dynamicCount = 0;
+	int settledCount = 0;
+
+	for( int i = 0, e = mEntries.Count(); i < e; i ++ )
+	{
+		Entry& en = mEntries[ i ];
+
+		GameObject* obj = en.Obj;
+		if( !obj )
+			continue;
+
+		int moved = en.Moved;
+		en.Moved = 0;
+
+		if( IsUnbounded( obj ) )
+		{
+			if( en.Tree != TREE_UNBOUNDED )
+			{
+				DetachItem( en );
+				en.Tree = TREE_UNBOUNDED;
+			}
+
+			mUnbounded.PushBack( i );
+			continue;
+		}
+
+		if( en.Tree == TREE_UNBOUNDED )
+		{
+			en.Tree = TREE_DYNAMIC;
+			rebuildDynamic = true;
+			moved = 1;
+		}
+
+		if( moved )
+		{
+			en.LastMoveFrame = mFrame;
+
+			if( en.Tree == TREE_STATIC )
+			{
+				DetachItem( en );
+				en.Tree = TREE_DYNAMIC;
+				rebuildDynamic = true;
+			}
+			else if( en.Item >= 0 )
+			{
+				r3dPoint3D mn, mx;
+				GetObjectBounds( obj, mn, mx );
+				mDynamic.SetItemBounds( en.Item, mn, mx );
+				refitDynamic = true;
+			}
+		}
+
+		if( en.Tree == TREE_STATIC )
+		{
+			staticCount ++;
+		}
+		else
+		{
+			dynamicCount ++;
+
+			if( mFrame - en.LastMoveFrame > SETTLE_FRAMES )
+				settledCount ++;
+		}
+	}
+
+	if( settledCount >= R3D_MAX( (int)MIN_MIGRATE_COUNT, dynamicCount / 4 ) || mStaticDead > R3D_MAX( (int)MIN_MIGRATE_COUNT, staticCount / 4 ) )
+	{
+		for( int i = 0, e = mEntries.Count(); i < e; i ++ )
+		{
+			Entry& en = mEntries[ i ];
+
+			if( en.Obj && en.Tree == TREE_DYNAMIC && mFrame - en.LastMoveFrame > SETTLE_FRAMES )
+			{
+				en.Tree = TREE_STATIC;
+				en.Item = -1;
+			}
+		}
+
+		RebuildTree( TREE_STATIC );
+		RebuildTree( TREE_DYNAMIC );
+	}
+	else if( rebuildDynamic || mDynamicDead > R3D_MAX( (int)MIN_MIGRATE_COUNT, dynamicCount / 4 ) )
+	{
+		RebuildTree( TREE_DYNAMIC );
+	}
+	else if( refitDynamic )
+	{
+		if( mDynamic.Refit() > R3D_MAX( mDynamic.GetBuildCost(), 1.f ) * 2.f )
+			RebuildTree( TREE_DYNAMIC );
+	}
+}
+
+//------------------------------------------------------------------------
+
+struct SceneBVHTraverseParams
+{
+	SceneBVH*				BVH;
+	const SceneBVHFrustum*	Frustum;
+	const DrawFilter*		Filter;
+	int						StaticTaskCount;
+};
+
+void
+SceneBVH::TraverseFrustumMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+{
+	SceneBVHTraverseParams* params = static_cast< SceneBVHTraverseParams* >( Data );
+	SceneBVH* bvh = params->BVH;
+
+	r3dTL::TArray< int >& hits = bvh->mThreadHits[ ThreadIndex ];
+	r3dTL::TArray< draw_s >& draws = bvh->mThreadDraws[ ThreadIndex ];
+
+	for( int i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+	{
+		const SceneBVHTree& tree = i < params->StaticTaskCount ? bvh->mStatic : bvh->mDynamic;
+
+		hits.Clear();
+		tree.QueryFrustum( *params->Frustum, bvh->mTasks[ i ], hits );
+
+		for( int j = 0, je = hits.Count(); j < je; j ++ )
+		{
+			draw_s d;
+			if( MakeDraw( bvh->mEntries[ hits[ j ] ].Obj, *params->Filter, d ) )
+				draws.PushBack( d );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::TraverseFrustum( int shadowPass, const r3dCamera& Cam, const D3DXPLANE (&planes)[ 6 ], draw_s* result, int& numObjects, float minObjectSize )
+{
+	R3DPROFILE_FUNCTION( "SceneBVH::TraverseFrustum" );
+
+	SceneBVHFrustum frustum;
+	frustum.Set( planes );
+
+	DrawFilter filter;
+	filter.Cam = &Cam;
+	filter.CullRefPos = r3dRenderer->DistanceCullRefPos;
+	filter.DefDrawDistanceSq = r_default_draw_distance->GetFloat() * r_default_draw_distance->GetFloat();
+	filter.MinObjectSize = minObjectSize;
+	filter.ShadowPass = shadowPass;
+
+	const int threadCount = r_multithreading->GetInt() ? (int)g_pJobChief->GetThreadCount() : 1;
+
+	bool overflow = false;
+
+	mHits.Clear();
+
+	if( threadCount > 1 )
+	{
+		if( (int)mThreadHits.Count() < threadCount )
+		{
+			mThreadHits.Resize( threadCount );
+			mThreadDraws.Resize( threadCount );
+		}
+
+		for( int i = 0; i < threadCount; i ++ )
+			mThreadDraws[ i ].Clear();
+
+		// items met while splitting end up in mHits
+		mTasks.Clear();
+		mStatic.SplitFrustumQuery( frustum, threadCount * 4, mTasks, mHits );
+
+		SceneBVHTraverseParams params;
+		params.BVH = this;
+		params.Frustum = &frustum;
+		params.Filter = &filter;
+		params.StaticTaskCount = mTasks.Count();
+
+		mDynamic.SplitFrustumQuery( frustum, threadCount, mTasks, mHits );
+
+		if( mTasks.Count() )
+			g_pJobChief->Exec( TraverseFrustumMT, &params, mTasks.Count() );
+
+		R3DPROFILE_START( "Copy objects" );
+
+		for( int i = 0; i < threadCount; i ++ )
+		{
+			const r3dTL::TArray< draw_s >& draws = mThreadDraws[ i ];
+
+			int copyCount = draws.Count();
+			if( numObjects + copyCount > OBJECTMANAGER_MAXOBJECTS )
+			{
+				copyCount = OBJECTMANAGER_MAXOBJECTS - numObjects;
+				overflow = true;
+			}
+
+			if( copyCount > 0 )
+			{
+				memcpy( result + numObjects, &draws[ 0 ], sizeof result[ 0 ] * copyCount );
+				numObjects += copyCount;
+			}
+		}
+
+		R3DPROFILE_END( "Copy objects" );
+	}
+	else
+	{
+		mStatic.QueryFrustum( frustum, mHits );
+		mDynamic.QueryFrustum( frustum, mHits );
+	}
+
+	for( int i = 0, e = mHits.Count(); i < e; i ++ )
+	{
+		if( numObjects >= OBJECTMANAGER_MAXOBJECTS )
+		{
+			overflow = true;
+			break;
+		}
+
+		if( MakeDraw( mEntries[ mHits[ i ] ].Obj, filter, result[ numObjects ] ) )
+			numObjects ++;
+	}
+
+	for( int i = 0, e = mUnbounded.Count(); i < e; i ++ )
+	{
+		const Entry& en = mEntries[ mUnbounded[ i ] ];
+
+		// removed after Update()
+		if( !en.Obj || en.Tree != TREE_UNBOUNDED )
+			continue;
+
+		if( numObjects >= OBJECTMANAGER_MAXOBJECTS )
+		{
+			overflow = true;
+			break;
+		}
+
+		if( MakeDraw( en.Obj, filter, result[ numObjects ] ) )
+			numObjects ++;
+	}
+
+	if( overflow )
+	{
+		static bool overflowReported = false;
+
+		if( !overflowReported )
+		{
+			r3dOutToLog( "SceneBVH::TraverseFrustum: too many objects in traversal ( large shadow area? ), some are not drawn\n" );
+			overflowReported = true;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SceneBVH::GetObjectsInBox( const r3dBoundBox& box, r3dTL::TArray< GameObject* >& result ) const
+{
+	const r3dPoint3D mn = box.Org;
+	const r3dPoint3D mx = box.Org + box.Size;
+
+	r3dTL::TArray< int > hits;
+
+	mStatic.QueryBox( mn, mx, hits );
+	mDynamic.QueryBox( mn, mx, hits );
+
+	for( int i = 0, e = hits.Count(); i < e; i ++ )
+	{
+		GameObject* obj = mEntries[ hits[ i ] ].Obj;
+
+		if( IsQueryVisible( obj, 0 ) )
+			result.PushBack( obj );
+	}
+
+	for( int i = 0, e = mUnbounded.Count(); i < e; i ++ )
+	{
+		const Entry& en = mEntries[ mUnbounded[ i ] ];
+
+		if( !en.Obj || en.Tree != TREE_UNBOUNDED || !IsQueryVisible( en.Obj, 0 ) )
+			continue;
+
+		r3dPoint3D omn, omx;
+		GetObjectBounds( en.Obj, omn, omx );
+
+		if( omn.x <= mx.x && omn.y <= mx.y && omn.z <= mx.z && omx.x >= mn.x && omx.y >= mn.y && omx.z >= mn.z )
+			result.PushBack( en.Obj );
+	}
+}
+
+//------------------------------------------------------------------------
+
+#pragma pack(push,1)
+struct SceneBVHBoundsHeader
+{
+	enum
+	{
+		MAGIC	= 'DBHV',
+		VERSION	= 1
+	};
+
+	DWORD	Magic;
+	DWORD	Version;
+	DWORD	Count;
+};
+
+struct SceneBVHBoundsRecord
+{
+	float	Min[ 3 ];
+	float	Max[ 3 ];
+	DWORD	Dynamic;
+};
+#pragma pack(pop)
+
+void
+SceneBVH::SaveBounds( const char* fileName ) const
+{
+	FILE* f = fopen( fileName, "wb" );
+	if( !f )
+	{
+		r3dOutToLog( "SceneBVH::SaveBounds: can't open %s\n", fileName );
+		return;
+	}
+
+	SceneBVHBoundsHeader header;
+	header.Magic = SceneBVHBoundsHeader::MAGIC;
+	header.Version = SceneBVHBoundsHeader::VERSION;
+	header.Count = 0;
+
+	for( int i = 0, e = mEntries.Count(); i < e; i ++ )
+	{
+		if( mEntries[ i ].Obj && mEntries[ i ].Tree != TREE_UNBOUNDED )
+			header.Count ++;
+	}
+
+	fwrite( &header, sizeof header, 1, f );
+
+	for( int i = 0, e = mEntries.Count(); i < e; i ++ )
+	{
+		const Entry& en = mEntries[ i ];
+
+		if( !en.Obj || en.Tree == TREE_UNBOUNDED )
+			continue;
+
+		r3dPoint3D mn, mx;
+		GetObjectBounds( en.Obj, mn, mx );
+
+		SceneBVHBoundsRecord rec;
+		rec.Min[ 0 ] = mn.x; rec.Min[ 1 ] = mn.y; rec.Min[ 2 ] = mn.z;
+		rec.Max[ 0 ] = mx.x; rec.Max[ 1 ] = mx.y; rec.Max[ 2 ] = mx.z;
+		rec.Dynamic = en.Tree == TREE_DYNAMIC;
+
+		fwrite( &rec, sizeof rec, 1, f );
+	}
+
+	fclose( f );
+
+	r3dOutToLog( "SceneBVH: saved bounds of %d objects to %s\n", header.Count, fileName );
+}
+
+//------------------------------------------------------------------------
+
+#ifndef FINAL_BUILD
+
+namespace
+{
+	void MakeBenchFrustum( SceneBVHFrustum& out, const r3dPoint3D& eye, const r3dPoint3D& dir, float farDist )
+	{
+		D3DXVECTOR3 eyeV( eye.x, eye.y, eye.z );
+		D3DXVECTOR3 atV( eye.x + dir.x, eye.y + dir.y, eye.z + dir.z );
+		D3DXVECTOR3 upV( 0.f, 1.f, 0.f );
+
+		D3DXMATRIX view, proj, viewProj, invViewProj;
+		D3DXMatrixLookAtLH( &view, &eyeV, &atV, &upV );
+		D3DXMatrixPerspectiveFovLH( &proj, D3DX_PI / 3.f, 16.f / 9.f, 0.5f, farDist );
+		D3DXMatrixMultiply( &viewProj, &view, &proj );
+		D3DXMatrixInverse( &invViewProj, NULL, &viewProj );
+
+		// same way as renderer does it
+		D3DXVECTOR3 corners[ 8 ] =
+		{
+			D3DXVECTOR3( -1.0f, -1.0f, 0.f ),
+			D3DXVECTOR3(  1.0f, -1.0f, 0.f ),
+			D3DXVECTOR3( -1.0f,  1.0f, 0.f ),
+			D3DXVECTOR3(  1.0f,  1.0f, 0.f ),
+			D3DXVECTOR3( -1.0f, -1.0f, 1.f ),
+			D3DXVECTOR3(  1.0f, -1.0f, 1.f ),
+			D3DXVECTOR3( -1.0f,  1.0f, 1.f ),
+			D3DXVECTOR3(  1.0f,  1.0f, 1.f )
+		};
+
+		for( int i = 0; i < 8; i ++ )
+			D3DXVec3TransformCoord( &corners[ i ], &corners[ i ], &invViewProj );
+
+		D3DXPLANE planes[ 6 ];
+		D3DXPlaneFromPoints( &planes[ 0 ], &corners[ 0 ], &corners[ 1 ], &corners[ 2 ] );
+		D3DXPlaneFromPoints( &planes[ 1 ], &corners[ 6 ], &corners[ 7 ], &corners[ 5 ] );
+		D3DXPlaneFromPoints( &planes[ 2 ], &corners[ 2 ], &corners[ 6 ], &corners[ 4 ] );
+		D3DXPlaneFromPoints( &planes[ 3 ], &corners[ 7 ], &corners[ 3 ], &corners[ 5 ] );
+		D3DXPlaneFromPoints( &planes[ 4 ], &corners[ 2 ], &corners[ 3 ], &corners[ 6 ] );
+		D3DXPlaneFromPoints( &planes[ 5 ], &corners[ 1 ], &corners[ 0 ], &corners[ 4 ] );
+
+		// make sure planes point inside
+		D3DXVECTOR3 inside = eyeV + D3DXVECTOR3( dir.x, dir.y, dir.z ) * ( farDist * 0.5f );
+		for( int i = 0; i < 6; i ++ )
+		{
+			if( D3DXPlaneDotCoord( &planes[ i ], &inside ) < 0.f )
+				planes[ i ] = -planes[ i ];
+		}
+
+		out.Set( planes );
+	}
+
+	// same test as CullNode for one box
+	bool IsOutsideScalar( const SceneBVHFrustum& frustum, const SceneBVHTree::BuildItem& item )
+	{
+		const float bounds[ 6 ] = { item.Min.x, item.Min.y, item.Min.z, item.Max.x, item.Max.y, item.Max.z };
+
+		for( int i = 0; i < 6; i ++ )
+		{
+			const SceneBVHFrustum::Plane& p = frustum.Planes[ i ];
+
+			if( p.A[ 0 ] * bounds[ p.PX ] + p.B[ 0 ] * bounds[ p.PY ] + p.C[ 0 ] * bounds[ p.PZ ] + p.D[ 0 ] < 0.f )
+				return true;
+		}
+
+		return false;
+	}
+
+	struct BenchQueryParams
+	{
+		const SceneBVHTree*						Tree;
+		const SceneBVHFrustum*					Frustums;
+		int*									Counts;
+		r3dTL::TArray< r3dTL::TArray< int > >*	ThreadHits;
+	};
+
+	void BenchQueryMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+	{
+		BenchQueryParams* params = static_cast< BenchQueryParams* >( Data );
+		r3dTL::TArray< int >& hits = ( *params->ThreadHits )[ ThreadIndex ];
+
+		for( int i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+		{
+			hits.Clear();
+			params->Tree->QueryFrustum( params->Frustums[ i ], hits );
+			params->Counts[ i ] = hits.Count();
+		}
+	}
+
+	struct BenchSplitParams
+	{
+		const SceneBVHTree*						Tree;
+		const SceneBVHFrustum*					Frustum;
+		const SceneBVHTree::Task*				Tasks;
+		r3dTL::TArray< r3dTL::TArray< int > >*	ThreadHits;
+	};
+
+	void BenchSplitMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+	{
+		BenchSplitParams* params = static_cast< BenchSplitParams* >( Data );
+		r3dTL::TArray< int >& hits = ( *params->ThreadHits )[ ThreadIndex ];
+
+		for( int i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+			params->Tree->QueryFrustum( *params->Frustum, params->Tasks[ i ], hits );
+	}
+}
+
+void SceneBVHDumpBounds( const char* fileName )
+{
+	GameWorld().GetSceneBVH()->SaveBounds( fileName );
+}
+
+// loads bounds saved by SceneBVH::SaveBounds and measures tree build, refit and queries against brute force,
+// doesn't need level or renderer
+void SceneBVHBenchmark( const char* fileName, int numQueries )
+{
+	FILE* f = fopen( fileName, "rb" );
+	if( !f )
+	{
+		r3dOutToLog( "scenebvhbench: can't open %s\n", fileName );
+		return;
+	}
+
+	SceneBVHBoundsHeader header;
+	if( fread( &header, sizeof header, 1, f ) != 1 || header.Magic != SceneBVHBoundsHeader::MAGIC || header.Version != SceneBVHBoundsHeader::VERSION )
+	{
+		r3dOutToLog( "scenebvhbench: %s is not a scene bounds file\n", fileName );
+		fclose( f );
+		return;
+	}
+
+	r3dTL::TArray< SceneBVHTree::BuildItem > items;
+	items.Reserve( header.Count );
+
+	int numDynamic = 0;
+	r3dPoint3D sceneMin( FLT_MAX, FLT_MAX, FLT_MAX );
+	r3dPoint3D sceneMax( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+
+	for( int i = 0, e = header.Count; i < e; i ++ )
+	{
+		SceneBVHBoundsRecord rec;
+		if( fread( &rec, sizeof rec, 1, f ) != 1 )
+			break;
+
+		SceneBVHTree::BuildItem item;
+		item.Min = r3dPoint3D( rec.Min[ 0 ], rec.Min[ 1 ], rec.Min[ 2 ] );
+		item.Max = r3dPoint3D( rec.Max[ 0 ], rec.Max[ 1 ], rec.Max[ 2 ] );
+		item.Entry = items.Count();
+
+		sceneMin = ElementalMinimum( sceneMin, item.Min );
+		sceneMax = ElementalMaximum( sceneMax, item.Max );
+
+		numDynamic += rec.Dynamic ? 1 : 0;
+
+		items.PushBack( item );
+	}
+
+	fclose( f );
+
+	const int count = items.Count();
+	if( !count )
+	{
+		r3dOutToLog( "scenebvhbench: no objects in %s\n", fileName );
+		return;
+	}
+
+	numQueries = R3D_MAX( numQueries, 1 );
+
+	r3dOutToLog( "scenebvhbench: %s, %d objects (%d dynamic), %d queries\n", fileName, count, numDynamic, numQueries ); CLOG_INDENT;
+
+	SceneBVHTree tree;
+
+	// build
+	const int BUILD_PASSES = 10;
+
+	float t0 = r3dGetTime();
+	for( int i = 0; i < BUILD_PASSES; i ++ )
+		tree.Build( &items[ 0 ], count );
+	const float buildTime = ( r3dGetTime() - t0 ) / BUILD_PASSES;
+
+	r3dOutToLog( "build: %.3f ms, %d nodes\n", buildTime * 1000.f, tree.GetNodeCount() );
+
+	// refit after moving every 10th object by up to 2 meters, like dynamic tree does every frame
+	{
+		for( int i = 0, e = tree.GetItemCount(); i < e; i ++ )
+		{
+			const SceneBVHTree::BuildItem& item = items[ tree.GetItemEntry( i ) ];
+			if( item.Entry % 10 )
+				continue;
+
+			r3dPoint3D offset( u_GetRandom( -2.f, 2.f ), u_GetRandom( -2.f, 2.f ), u_GetRandom( -2.f, 2.f ) );
+			tree.SetItemBounds( i, item.Min + offset, item.Max + offset );
+		}
+
+		t0 = r3dGetTime();
+		float cost = 0.f;
+		for( int i = 0; i < BUILD_PASSES; i ++ )
+			cost = tree.Refit();
+		const float refitTime = ( r3dGetTime() - t0 ) / BUILD_PASSES;
+
+		r3dOutToLog( "refit: %.3f ms, cost %.2f of build cost\n", refitTime * 1000.f, cost / R3D_MAX( tree.GetBuildCost(), 1.f ) );
+
+		tree.Build( &items[ 0 ], count );
+	}
+
+	// camera frustums from random spots at lower quarter of scene height
+	r3dTL::TArray< SceneBVHFrustum > frustums;
+	frustums.Resize( numQueries );
+
+	const float farDist = r_default_draw_distance->GetFloat();
+
+	for( int i = 0; i < numQueries; i ++ )
+	{
+		r3dPoint3D eye(	u_GetRandom( sceneMin.x, sceneMax.x ),
+						u_GetRandom( sceneMin.y, sceneMin.y + ( sceneMax.y - sceneMin.y ) * 0.25f ) + 2.f,
+						u_GetRandom( sceneMin.z, sceneMax.z ) );
+
+		float yaw = u_GetRandom( 0.f, R3D_PI * 2.f );
+		float pitch = u_GetRandom( -0.3f, 0.1f );
+
+		r3dPoint3D dir( sinf( yaw ) * cosf( pitch ), sinf( pitch ), cosf( yaw ) * cosf( pitch ) );
+
+		MakeBenchFrustum( frustums[ i ], eye, dir, farDist );
+	}
+
+	r3dTL::TArray< int > refCounts;
+	refCounts.Resize( numQueries );
+
+	// brute force over all boxes
+	t0 = r3dGetTime();
+	double totalVisible = 0;
+	for( int q = 0; q < numQueries; q ++ )
+	{
+		int visible = 0;
+		for( int i = 0; i < count; i ++ )
+			visible += IsOutsideScalar( frustums[ q ], items[ i ] ) ? 0 : 1;
+
+		refCounts[ q ] = visible;
+		totalVisible += visible;
+	}
+	const float bruteTime = ( r3dGetTime() - t0 ) / numQueries;
+
+	// tree, one query at a time
+	r3dTL::TArray< int > hits;
+	hits.Reserve( count );
+
+	int mismatches = 0;
+
+	t0 = r3dGetTime();
+	for( int q = 0; q < numQueries; q ++ )
+	{
+		hits.Clear();
+		tree.QueryFrustum( frustums[ q ], hits );
+
+		mismatches += (int)hits.Count() != refCounts[ q ];
+	}
+	const float treeTime = ( r3dGetTime() - t0 ) / numQueries;
+
+	r3dOutToLog( "frustum: %.1f visible avg, brute force %.3f ms, tree %.3f ms (x%.1f), %d mismatches\n",
+					totalVisible / numQueries, bruteTime * 1000.f, treeTime * 1000.f, bruteTime / R3D_MAX( treeTime, 1e-6f ), mismatches );
+
+	const int threadCount = g_pJobChief->GetThreadCount();
+
+	r3dTL::TArray< r3dTL::TArray< int > > threadHits;
+	threadHits.Resize( threadCount );
+
+	// all queries in parallel, like main view, shadow cascades and box queries of one frame would
+	{
+		r3dTL::TArray< int > counts;
+		counts.Resize( numQueries );
+
+		BenchQueryParams params;
+		params.Tree = &tree;
+		params.Frustums = &frustums[ 0 ];
+		params.Counts = &counts[ 0 ];
+		params.ThreadHits = &threadHits;
+
+		t0 = r3dGetTime();
+		g_pJobChief->Exec( BenchQueryMT, &params, numQueries );
+		const float parallelTime = ( r3dGetTime() - t0 ) / numQueries;
+
+		mismatches = 0;
+		for( int q = 0; q < numQueries; q ++ )
+			mismatches += counts[ q ] != refCounts[ q ];
+
+		r3dOutToLog( "frustum, parallel queries on %d threads: %.3f ms per query, %d mismatches\n", threadCount, parallelTime * 1000.f, mismatches );
+	}
+
+	// one query split between threads, like SceneBVH::TraverseFrustum does
+	{
+		r3dTL::TArray< SceneBVHTree::Task > tasks;
+
+		t0 = r3dGetTime();
+		for( int q = 0; q < numQueries; q ++ )
+		{
+			for( int i = 0; i < threadCount; i ++ )
+				threadHits[ i ].Clear();
+
+			tasks.Clear();
+			tree.SplitFrustumQuery( frustums[ q ], threadCount * 4, tasks, threadHits[ 0 ] );
+
+			BenchSplitParams params;
+			params.Tree = &tree;
+			params.Frustum = &frustums[ q ];
+			params.Tasks = tasks.Count() ? &tasks[ 0 ] : NULL;
+			params.ThreadHits = &threadHits;
+
+			if( tasks.Count() )
+				g_pJobChief->Exec( BenchSplitMT, &params, tasks.Count() );
+		}
+		const float splitTime = ( r3dGetTime() - t0 ) / numQueries;
+
+		r3dOutToLog( "frustum, each query split on %d threads: %.3f ms\n", threadCount, splitTime * 1000.f );
+	}
+
+	// boxes of 10 to 50 meters, like editor brush queries
+	{
+		r3dTL::TArray< r3dPoint3D > boxes;
+		boxes.Resize( numQueries * 2 );
+
+		for( int q = 0; q < numQueries; q ++ )
+		{
+			r3dPoint3D c( u_GetRandom( sceneMin.x, sceneMax.x ), u_GetRandom( sceneMin.y, sceneMax.y ), u_GetRandom( sceneMin.z, sceneMax.z ) );
+			float halfSize = u_GetRandom( 5.f, 25.f );
+
+			boxes[ q * 2 + 0 ] = c - r3dPoint3D( halfSize, halfSize, halfSize );
+			boxes[ q * 2 + 1 ] = c + r3dPoint3D( halfSize, halfSize, halfSize );
+		}
+
+		t0 = r3dGetTime();
+		for( int q = 0; q < numQueries; q ++ )
+		{
+			const r3dPoint3D& mn = boxes[ q * 2 + 0 ];
+			const r3dPoint3D& mx = boxes[ q * 2 + 1 ];
+
+			int n = 0;
+			for( int i = 0; i < count; i ++ )
+			{
+				const SceneBVHTree::BuildItem& item = items[ i ];
+				n += item.Min.x <= mx.x && item.Min.y <= mx.y && item.Min.z <= mx.z && item.Max.x >= mn.x && item.Max.y >= mn.y && item.Max.z >= mn.z;
+			}
+
+			refCounts[ q ] = n;
+		}
+		const float boxBruteTime = ( r3dGetTime() - t0 ) / numQueries;
+
+		mismatches = 0;
+
+		t0 = r3dGetTime();
+		for( int q = 0; q < numQueries; q ++ )
+		{
+			hits.Clear();
+			tree.QueryBox( boxes[ q * 2 + 0 ], boxes[ q * 2 + 1 ], hits );
+
+			mismatches += (int)hits.Count() != refCounts[ q ];
+		}
+		const float boxTreeTime = ( r3dGetTime() - t0 ) / numQueries;
+
+		r3dOutToLog( "box: brute force %.4f ms, tree %.4f ms, %d mismatches\n", boxBruteTime * 1000.f, boxTreeTime * 1000.f, mismatches );
+	}
+}
+
+#endif
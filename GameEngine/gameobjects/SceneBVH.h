@@ -0,0 +1,205 @@
+#ifndef __SCENEBVH_H__
+#define __SCENEBVH_H__
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//	>	Linear BVH of scene objects for frustum and box queries
+//
+//	Tree is 4 wide, node keeps bounds of its 4 children as SoA so one SSE pass culls all of them.
+//	It is built from items sorted by Morton code of their centers. When items move only node
+//	bounds are refit, tree is rebuilt when refit made it too loose.
+//
+//	Queries don't touch renderer state or tree itself, so any number of them can run in parallel.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SceneBVHFrustum
+{
+	// plane a, b, c, d splatted for SSE, planes point inside of frustum
+	struct Plane
+	{
+		float	A[ 4 ];
+		float	B[ 4 ];
+		float	C[ 4 ];
+		float	D[ 4 ];
+
+		// SceneBVHTree::Node::Bounds rows of box corner farthest along plane normal (P) and opposite one (N)
+		int		PX, PY, PZ;
+		int		NX, NY, NZ;
+	};
+
+	Plane	Planes[ 6 ];
+
+	void	Set( const D3DXPLANE (&planes)[ 6 ] );
+};
+
+class SceneBVHTree
+{
+public:
+	enum
+	{
+		EMPTY_CHILD = -1,	// items are stored as -2 - item
+
+		MIN_X = 0, MIN_Y, MIN_Z,
+		MAX_X, MAX_Y, MAX_Z,
+
+		MAX_DEPTH = 64
+	};
+
+	struct Node
+	{
+		float	Bounds[ 6 ][ 4 ];	// MIN_X..MAX_Z rows, one column per child
+		int		Child[ 4 ];
+	};
+
+	struct BuildItem
+	{
+		r3dPoint3D	Min;
+		r3dPoint3D	Max;
+		int			Entry;		// returned by queries
+	};
+
+	struct Task
+	{
+		int		Node;
+		int		Inside;		// node is fully inside of frustum, no need to test its children
+	};
+
+	SceneBVHTree();
+
+	void		Build( const BuildItem* items, int count );
+	void		Clear();
+
+	int			GetItemCount() const					{ return mItemEntry.Count(); }
+	int			GetNodeCount() const					{ return mNodes.Count(); }
+	int			GetItemEntry( int item ) const			{ return mItemEntry[ item ]; }
+
+	// takes effect in node bounds after Refit()
+	void		SetItemBounds( int item, const r3dPoint3D& mn, const r3dPoint3D& mx );
+	// item stays in tree with empty bounds until next Build()
+	void		RemoveItem( int item );
+
+	// returns surface area sum of all node children, compare with GetBuildCost() to decide on rebuild
+	float		Refit();
+	float		GetBuildCost() const					{ return mBuildCost; }
+
+	// append entries of items that are not outside of frustum
+	void		QueryFrustum( const SceneBVHFrustum& frustum, r3dTL::TArray< int >& entries ) const;
+	void		QueryFrustum( const SceneBVHFrustum& frustum, const Task& task, r3dTL::TArray< int >& entries ) const;
+	void		QueryBox( const r3dPoint3D& mn, const r3dPoint3D& mx, r3dTL::TArray< int >& entries ) const;
+
+	// culls top of the tree until there are at least minTasks subtrees to query in parallel,
+	// items met on the way are appended to entries
+	void		SplitFrustumQuery( const SceneBVHFrustum& frustum, int minTasks, r3dTL::TArray< Task >& tasks, r3dTL::TArray< int >& entries ) const;
+
+private:
+	struct SortItem
+	{
+		uint32_t	Code;
+		int			Item;
+	};
+
+	int			BuildNode( int begin, int end, int depth );
+	void		SetChild( int node, int slot, int child, const float* bounds );
+	void		AddItemEntries( int node, r3dTL::TArray< int >& entries ) const;
+	float		CalcCost() const;
+
+	r3dTL::TArray< Node >		mNodes;
+	r3dTL::TArray< int >		mItemEntry;		// -1 for removed items
+	r3dTL::TArray< int >		mItemSlot;		// node * 4 + child
+
+	float						mBuildCost;
+
+	// build temporaries
+	const BuildItem*			mBuildItems;
+	r3dTL::TArray< SortItem >	mSorted;
+	r3dTL::TArray< SortItem >	mSortTemp;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//	>	Scene objects in static and dynamic SceneBVHTree
+//
+//	New and moving objects are kept in dynamic tree, which is refit every frame it has moved objects.
+//	Objects that didn't move for SETTLE_FRAMES migrate to static tree in batches, so static tree
+//	is rebuilt rarely. Objects that are always drawn don't have useful bounds and are kept aside.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class SceneBVH
+{
+public:
+	enum
+	{
+		SETTLE_FRAMES		= 120,
+		MIN_MIGRATE_COUNT	= 64,
+	};
+
+	SceneBVH();
+	~SceneBVH();
+
+	void		Add( GameObject* obj );
+	void		Remove( GameObject* obj );
+	// only marks object, so can be called from any thread. Picked up by next Update()
+	void		Move( GameObject* obj );
+
+	// call once per frame before queries
+	void		Update();
+	// removes all objects, they must be still alive
+	void		Clear();
+
+	// same output as SceneBox::TraverseTree, planes are taken from caller instead of renderer
+	void		TraverseFrustum( int shadowPass, const r3dCamera& Cam, const D3DXPLANE (&planes)[ 6 ], struct draw_s* result, int& numObjects, float minObjectSize );
+	// visible objects with bounds intersecting box, can run in parallel with other queries
+	void		GetObjectsInBox( const r3dBoundBox& box, r3dTL::TArray< GameObject* >& result ) const;
+
+	// bounds of all objects for SceneBVHBenchmark
+	void		SaveBounds( const char* fileName ) const;
+
+	int			GetStaticCount() const		{ return mStatic.GetItemCount(); }
+	int			GetDynamicCount() const		{ return mDynamic.GetItemCount(); }
+
+private:
+	enum
+	{
+		TREE_STATIC,
+		TREE_DYNAMIC,
+		TREE_UNBOUNDED,
+	};
+
+	struct Entry
+	{
+		GameObject*		Obj;
+		int				Tree;
+		int				Item;			// in its tree, -1 until tree is rebuilt
+		int				LastMoveFrame;
+		volatile int	Moved;
+	};
+
+	SceneBVHTree&	GetTree( int tree )		{ return tree == TREE_STATIC ? mStatic : mDynamic; }
+	void			DetachItem( Entry& e );
+	void			RebuildTree( int tree );
+
+	static void		TraverseFrustumMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex );
+
+	r3dTL::TArray< Entry >	mEntries;
+	r3dTL::TArray< int >	mFreeEntries;
+	r3dTL::TArray< int >	mUnbounded;
+
+	SceneBVHTree			mStatic;
+	SceneBVHTree			mDynamic;
+	int						mStaticDead;
+	int						mDynamicDead;
+	bool					mDynamicDirty;
+	int						mFrame;
+
+	r3dTL::TArray< SceneBVHTree::BuildItem >	mBuildItems;
+
+	// TraverseFrustum temporaries
+	r3dTL::TArray< int >						mHits;
+	r3dTL::TArray< SceneBVHTree::Task >			mTasks;
+	r3dTL::TArray< r3dTL::TArray< int > >		mThreadHits;
+	r3dTL::TArray< r3dTL::TArray< draw_s > >	mThreadDraws;
+};
+
+#endif //__SCENEBVH_H__
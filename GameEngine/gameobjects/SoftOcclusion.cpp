@@ -0,0 +1,1139 @@
+#include "r3dPCH.h"
+#include "r3d.h"
+
+#include <emmintrin.h>
+
+#include "GameObj.h"
+#include "ObjManag.h"
+#include "obj_Mesh.h"
+#include "SoftOcclusion.h"
+
+#include "JobChief.h"
+
+namespace
+{
+	enum
+	{
+		CLIP_LEFT	= 1 << 0,
+		CLIP_RIGHT	= 1 << 1,
+		CLIP_BOTTOM	= 1 << 2,
+		CLIP_TOP	= 1 << 3,
+		CLIP_NEAR	= 1 << 4,
+
+		NUM_CLIP_PLANES	= 5,
+		// triangle clipped by 5 planes has at most 8 vertices
+		MAX_CLIP_VERTICES = 9
+	};
+
+	// clip space distance to frustum plane, D3D clip volume is -w <= x,y <= w, 0 <= z <= w. Far plane is not clipped
+	R3D_FORCEINLINE float ClipDistance( const float* v, int plane )
+	{
+		switch( plane )
+		{
+		case 0: return v[ 3 ] + v[ 0 ];
+		case 1: return v[ 3 ] - v[ 0 ];
+		case 2: return v[ 3 ] + v[ 1 ];
+		case 3: return v[ 3 ] - v[ 1 ];
+		default: return v[ 2 ];
+		}
+	}
+
+	R3D_FORCEINLINE int ClipCode( const float* v )
+	{
+		int code = 0;
+
+		for( int i = 0; i < NUM_CLIP_PLANES; i ++ )
+		{
+			if( ClipDistance( v, i ) < 0.f )
+				code |= 1 << i;
+		}
+
+		return code;
+	}
+
+	// Sutherland-Hodgman against planes in mask, returns vertex count
+	int ClipPolygon( float (&poly)[ MAX_CLIP_VERTICES ][ 4 ], int count, int planes )
+	{
+		float temp[ MAX_CLIP_VERTICES ][ 4 ];
+
+		for( int p = 0; p < NUM_CLIP_PLANES && count >= 3; p ++ )
+		{
+			if( !( planes & ( 1 << p ) ) )
+				continue;
+
+			int outCount = 0;
+
+			for( int i = 0; i < count; i ++ )
+			{
+				const float* a = poly[ i ];
+				const float* b = poly[ ( i + 1 ) % count ];
+
+				float da = ClipDistance( a, p );
+				float db = ClipDistance( b, p );
+
+				if( da >= 0.f )
+				{
+					memcpy( temp[ outCount ++ ], a, sizeof temp[ 0 ] );
+				}
+
+				if( ( da >= 0.f ) != ( db >= 0.f ) )
+				{
+					float t = da / ( da - db );
+
+					for( int k = 0; k < 4; k ++ )
+						temp[ outCount ][ k ] = a[ k ] + ( b[ k ] - a[ k ] ) * t;
+
+					outCount ++;
+				}
+			}
+
+			memcpy( poly, temp, sizeof temp[ 0 ] * outCount );
+			count = outCount;
+		}
+
+		return count >= 3 ? count : 0;
+	}
+
+	R3D_FORCEINLINE void ProjectVertex( const float* v, float& x, float& y, float& z )
+	{
+		float iw = 1.f / v[ 3 ];
+
+		x = ( v[ 0 ] * iw * 0.5f + 0.5f ) * SoftOcclusionBuffer::WIDTH;
+		y = ( 0.5f - v[ 1 ] * iw * 0.5f ) * SoftOcclusionBuffer::HEIGHT;
+		z = v[ 2 ] * iw;
+	}
+
+	R3D_FORCEINLINE void TransformVertex( const __m128 (&rows)[ 4 ], const r3dPoint3D& p, float* out )
+	{
+		__m128 v = _mm_add_ps( _mm_mul_ps( rows[ 0 ], _mm_set1_ps( p.x ) ), _mm_mul_ps( rows[ 1 ], _mm_set1_ps( p.y ) ) );
+		v = _mm_add_ps( v, _mm_add_ps( _mm_mul_ps( rows[ 2 ], _mm_set1_ps( p.z ) ), rows[ 3 ] ) );
+		_mm_storeu_ps( out, v );
+	}
+
+	R3D_FORCEINLINE void LoadMatrixRows( const D3DXMATRIX& m, __m128 (&rows)[ 4 ] )
+	{
+		for( int i = 0; i < 4; i ++ )
+			rows[ i ] = _mm_loadu_ps( m.m[ i ] );
+	}
+
+	R3D_FORCEINLINE float HorizontalMax( __m128 v )
+	{
+		v = _mm_max_ps( v, _mm_shuffle_ps( v, v, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+		v = _mm_max_ps( v, _mm_shuffle_ps( v, v, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+		return _mm_cvtss_f32( v );
+	}
+
+	struct CandidateScoreGreater
+	{
+		bool operator()( const SoftOcclusionBuffer::OccluderCandidate& a, const SoftOcclusionBuffer::OccluderCandidate& b ) const
+		{
+			return a.Score > b.Score;
+		}
+	};
+}
+
+//------------------------------------------------------------------------
+
+SoftOcclusionBuffer::SoftOcclusionBuffer()
+: mNumTriangles( 0 )
+, mThreadCount( 1 )
+{
+	D3DXMatrixIdentity( &mViewProj );
+
+	mDepth.Resize( WIDTH * HEIGHT, 1.f );
+	// padded for 4 wide reads in IsBoxVisible
+	mHiZ.Resize( HIZ_WIDTH * HIZ_HEIGHT + 4, 1.f );
+}
+
+//------------------------------------------------------------------------
+
+SoftOcclusionBuffer::~SoftOcclusionBuffer()
+{
+}
+
+//------------------------------------------------------------------------
+
+void
+SoftOcclusionBuffer::Begin( const D3DXMATRIX& viewProj )
+{
+	mViewProj = viewProj;
+	mJobs.Clear();
+	mNumTriangles = 0;
+}
+
+//------------------------------------------------------------------------
+
+void
+SoftOcclusionBuffer::AddOccluder( const r3dPoint3D* positions, const uint32_t* indices, int numIndices, const D3DXMATRIX& world )
+{
+	Job job;
+	job.Positions = positions;
+	D3DXMatrixMultiply( &job.WorldViewProj, &world, &mViewProj );
+
+	const int numTriangles = numIndices / 3;
+
+	for( int i = 0; i < numTriangles; i += MAX_JOB_TRIANGLES )
+	{
+		job.Indices = indices + i * 3;
+		job.NumTriangles = R3D_MIN( numTriangles - i, (int)MAX_JOB_TRIANGLES );
+
+		mJobs.PushBack( job );
+	}
+
+	mNumTriangles += numTriangles;
+}
+
+//------------------------------------------------------------------------
+
+void
+SoftOcclusionBuffer::AddMesh( const r3dMesh* mesh, const D3DXMATRIX& world )
+{
+	for( int i = 0, e = mesh->NumMatChunks; i < e; i ++ )
+	{
+		const r3dTriBatch& batch = mesh->MatChunks[ i ];
+
+		if( IsOccluderBatch( batch ) )
+			AddOccluder( mesh->VertexPositions, mesh->Indices + batch.StartIndex, batch.EndIndex - batch.StartIndex, world );
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SoftOcclusionBuffer::Rasterize( bool multithreaded )
+{
+	R3DPROFILE_FUNCTION( "SoftOcclusionBuffer::Rasterize" );
+
+	mThreadCount = multithreaded ? (int)g_pJobChief->GetThreadCount() : 1;
+
+	if( (int)mBins.Count() < mThreadCount * NUM_TILES )
+		mBins.Resize( mThreadCount * NUM_TILES );
+
+	for( int i = 0, e = mThreadCount * NUM_TILES; i < e; i ++ )
+		mBins[ i ].Clear();
+
+	if( mThreadCount > 1 )
+	{
+		if( mJobs.Count() )
+			g_pJobChief->Exec( SetupJobsMT, this, mJobs.Count() );
+
+		g_pJobChief->Exec( RasterizeTilesMT, this, NUM_TILES );
+	}
+	else
+	{
+		SetupJobsMT( this, 0, mJobs.Count(), 0 );
+		RasterizeTilesMT( this, 0, NUM_TILES, 0 );
+	}
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+void
+SoftOcclusionBuffer::SetupJobsMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+{
+	SoftOcclusionBuffer* This = static_cast< SoftOcclusionBuffer* >( Data );
+
+	for( size_t i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+		This->SetupJob( This->mJobs[ i ], (int)ThreadIndex );
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+void
+SoftOcclusionBuffer::RasterizeTilesMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex )
+{
+	SoftOcclusionBuffer* This = static_cast< SoftOcclusionBuffer* >( Data );
+
+	for( size_t i = ItemStart, e = ItemStart + ItemCount; i < e; i ++ )
+		This->RasterizeTile( (int)i );
+}
+
+//------------------------------------------------------------------------
+
+void
+SoftOcclusionBuffer::SetupJob( const Job& job, int threadIndex )
+{
+	__m128 rows[ 4 ];
+	LoadMatrixRows( job.WorldViewProj, rows );
+
+	const uint32_t* indices = job.Indices;
+
+	for( int t = 0; t < job.NumTriangles; t ++, indices += 3 )
+	{
+		float poly[ MAX_CLIP_VERTICES ][ 4 ];
+		int codes[ 3 ];
+
+		for( int k = 0; k < 3; k ++ )
+		{
+			TransformVertex( rows, job.Positions[ indices[ k ] ], poly[ k ] );
+			codes[ k ] = ClipCode( poly[ k ] );
+		}
+
+		// all vertices outside of same plane
+		if( codes[ 0 ] & codes[ 1 ] & codes[ 2 ] )
+			continue;
+
+		const int clipPlanes = codes[ 0 ] | codes[ 1 ] | codes[ 2 ];
+
+		if( !clipPlanes )
+		{
+			BinTriangle( poly[ 0 ], poly[ 1 ], poly[ 2 ], threadIndex );
+			continue;
+		}
+
+		int count = ClipPolygon( poly, 3, clipPlanes );
+
+		for( int i = 1; i < count - 1; i ++ )
+			BinTriangle( poly[ 0 ], poly[ i ], poly[ i + 1 ], threadIndex );
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SoftOcclusionBuffer::BinTriangle( const float (&v0)[ 4 ], const float (&v1)[ 4 ], const float (&v2)[ 4 ], int threadIndex )
+{
+	float x[ 3 ], y[ 3 ], z[ 3 ];
+
+	ProjectVertex( v0, x[ 0 ], y[ 0 ], z[ 0 ] );
+	ProjectVertex( v1, x[ 1 ], y[ 1 ], z[ 1 ] );
+	ProjectVertex( v2, x[ 2 ], y[ 2 ], z[ 2 ] );
+
+	float area = ( x[ 1 ] - x[ 0 ] ) * ( y[ 2 ] - y[ 0 ] ) - ( x[ 2 ] - x[ 0 ] ) * ( y[ 1 ] - y[ 0 ] );
+
+	// degenerate or NaN
+	if( !( fabsf( area ) > 1e-6f ) )
+		return;
+
+	// no back face culling - occluders don't have to be closed, make winding positive instead
+	if( area < 0.f )
+	{
+		std::swap( x[ 1 ], x[ 2 ] );
+		std::swap( y[ 1 ], y[ 2 ] );
+		std::swap( z[ 1 ], z[ 2 ] );
+		area = -area;
+	}
+
+	// pixels with centers inside of triangle bounds
+	float minX = R3D_MIN( R3D_MIN( x[ 0 ], x[ 1 ] ), x[ 2 ] );
+	float maxX = R3D_MAX( R3D_MAX( x[ 0 ], x[ 1 ] ), x[ 2 ] );
+	float minY = R3D_MIN( R3D_MIN( y[ 0 ], y[ 1 ] ), y[ 2 ] );
+	float maxY = R3D_MAX( R3D_MAX( y[ 0 ], y[ 1 ] ), y[ 2 ] );
+
+	int pixMinX = R3D_MAX( (int)ceilf( minX - 0.5f ), 0 );
+	int pixMaxX = R3D_MIN( (int)floorf( maxX - 0.5f ), (int)WIDTH - 1 );
+	int pixMinY = R3D_MAX( (int)ceilf( minY - 0.5f ), 0 );
+	int pixMaxY = R3D_MIN( (int)floorf( maxY - 0.5f ), (int)HEIGHT - 1 );
+
+	if( pixMinX > pixMaxX || pixMinY > pixMaxY )
+		return;
+
+	BinnedTriangle tri;
+
+	for( int i = 0; i < 3; i ++ )
+	{
+		int a = i, b = ( i + 1 ) % 3;
+
+		tri.EdgeA[ i ] = y[ a ] - y[ b ];
+		tri.EdgeB[ i ] = x[ b ] - x[ a ];
+		tri.EdgeC[ i ] = x[ a ] * y[ b ] - x[ b ] * y[ a ];
+	}
+
+	float invArea = 1.f / area;
+
+	tri.ZdX = ( ( z[ 1 ] - z[ 0 ] ) * ( y[ 2 ] - y[ 0 ] ) - ( z[ 2 ] - z[ 0 ] ) * ( y[ 1 ] - y[ 0 ] ) ) * invArea;
+	tri.ZdY = ( ( z[ 2 ] - z[ 0 ] ) * ( x[ 1 ] - x[ 0 ] ) - ( z[ 1 ] - z[ 0 ] ) * ( x[ 2 ] - x[ 0 ] ) ) * invArea;
+	tri.Z0 = z[ 0 ] - tri.ZdX * x[ 0 ] - tri.ZdY * y[ 0 ];
+
+	tri.MinX = (short)pixMinX;
+	tri.MaxX = (short)pixMaxX;
+	tri.MinY = (short)pixMinY;
+	tri.MaxY = (short)pixMaxY;
+
+	TriangleBin* bins = &mBins[ threadIndex * NUM_TILES ];
+
+	for( int ty = pixMinY / TILE_HEIGHT, tye = pixMaxY / TILE_HEIGHT; ty <= tye; ty ++ )
+	{
+		for( int tx = pixMinX / TILE_WIDTH, txe = pixMaxX / TILE_WIDTH; tx <= txe; tx ++ )
+		{
+			bins[ ty * TILES_X + tx ].PushBack( tri );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void
+SoftOcclusionBuffer::RasterizeTile( int tile )
+{
+	const int tileMinX = tile % TILES_X * TILE_WIDTH;
+	const int tileMinY = tile / TILES_X * TILE_HEIGHT;
+	const int tileMaxX = tileMinX + TILE_WIDTH - 1;
+	const int tileMaxY = tileMinY + TILE_HEIGHT - 1;
+
+	float* depth = &mDepth[ 0 ];
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.f );
+
+	for( int y = tileMinY; y <= tileMaxY; y ++ )
+	{
+		for( int x = tileMinX; x <= tileMaxX; x += 4 )
+			_mm_storeu_ps( depth + y * WIDTH + x, one );
+	}
+
+	const __m128 pixelCenters = _mm_setr_ps( 0.5f, 1.5f, 2.5f, 3.5f );
+
+	for( int t = 0; t < mThreadCount; t ++ )
+	{
+		const TriangleBin& bin = mBins[ t * NUM_TILES + tile ];
+
+		for( int i = 0, e = bin.Count(); i < e; i ++ )
+		{
+			const BinnedTriangle& tri = bin[ i ];
+
+			// tile and rows are multiple of 4 pixels, so 4 pixel groups never cross tile
+			const int x0 = R3D_MAX( (int)tri.MinX, tileMinX ) & ~3;
+			const int x1 = R3D_MIN( (int)tri.MaxX, tileMaxX );
+			const int y0 = R3D_MAX( (int)tri.MinY, tileMinY );
+			const int y1 = R3D_MIN( (int)tri.MaxY, tileMaxY );
+
+			const __m128 a0 = _mm_set1_ps( tri.EdgeA[ 0 ] );
+			const __m128 a1 = _mm_set1_ps( tri.EdgeA[ 1 ] );
+			const __m128 a2 = _mm_set1_ps( tri.EdgeA[ 2 ] );
+			const __m128 zdx = _mm_set1_ps( tri.ZdX );
+
+			const __m128 stepA0 = _mm_set1_ps( tri.EdgeA[ 0 ] * 4.f );
+			const __m128 stepA1 = _mm_set1_ps( tri.EdgeA[ 1 ] * 4.f );
+			const __m128 stepA2 = _mm_set1_ps( tri.EdgeA[ 2 ] * 4.f );
+			const __m128 stepZ = _mm_set1_ps( tri.ZdX * 4.f );
+
+			const __m128 fx = _mm_add_ps( _mm_set1_ps( (float)x0 ), pixelCenters );
+
+			for( int y = y0; y <= y1; y ++ )
+			{
+				const float fy = y + 0.5f;
+
+				__m128 e0 = _mm_add_ps( _mm_mul_ps( a0, fx ), _mm_set1_ps( tri.EdgeB[ 0 ] * fy + tri.EdgeC[ 0 ] ) );
+				__m128 e1 = _mm_add_ps( _mm_mul_ps( a1, fx ), _mm_set1_ps( tri.EdgeB[ 1 ] * fy + tri.EdgeC[ 1 ] ) );
+				__m128 e2 = _mm_add_ps( _mm_mul_ps( a2, fx ), _mm_set1_ps( tri.EdgeB[ 2 ] * fy + tri.EdgeC[ 2 ] ) );
+				__m128 z = _mm_add_ps( _mm_mul_ps( zdx, fx ), _mm_set1_ps( tri.ZdY * fy + tri.Z0 ) );
+
+				float* row = depth + y * WIDTH;
+
+				for( int x = x0; x <= x1; x += 4 )
+				{
+					__m128 inside = _mm_and_ps( _mm_and_ps( _mm_cmpge_ps( e0, zero ), _mm_cmpge_ps( e1, zero ) ), _mm_cmpge_ps( e2, zero ) );
+
+					if( _mm_movemask_ps( inside ) )
+					{
+						__m128 d = _mm_loadu_ps( row + x );
+						__m128 nd = _mm_min_ps( d, _mm_max_ps( z, zero ) );
+
+						_mm_storeu_ps( row + x, _mm_or_ps( _mm_and_ps( inside, nd ), _mm_andnot_ps( inside, d ) ) );
+					}
+
+					e0 = _mm_add_ps( e0, stepA0 );
+					e1 = _mm_add_ps( e1, stepA1 );
+					e2 = _mm_add_ps( e2, stepA2 );
+					z = _mm_add_ps( z, stepZ );
+				}
+			}
+		}
+	}
+
+	// farthest depth of every block
+	for( int by = tileMinY / HIZ_BLOCK, bye = ( tileMaxY + 1 ) / HIZ_BLOCK; by < bye; by ++ )
+	{
+		for( int bx = tileMinX / HIZ_BLOCK, bxe = ( tileMaxX + 1 ) / HIZ_BLOCK; bx < bxe; bx ++ )
+		{
+			const float* block = depth + by * HIZ_BLOCK * WIDTH + bx * HIZ_BLOCK;
+
+			__m128 m = zero;
+
+			for( int y = 0; y < HIZ_BLOCK; y ++, block += WIDTH )
+			{
+				for( int x = 0; x < HIZ_BLOCK; x += 4 )
+					m = _mm_max_ps( m, _mm_loadu_ps( block + x ) );
+			}
+
+			mHiZ[ by * HIZ_WIDTH + bx ] = HorizontalMax( m );
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+bool
+SoftOcclusionBuffer::IsBoxVisible( const r3dPoint3D& mn, const r3dPoint3D& mx ) const
+{
+	__m128 rows[ 4 ];
+	LoadMatrixRows( mViewProj, rows );
+
+	float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+	for( int i = 0; i < 8; i ++ )
+	{
+		r3dPoint3D corner( i & 1 ? mx.x : mn.x, i & 2 ? mx.y : mn.y, i & 4 ? mx.z : mn.z );
+
+		float v[ 4 ];
+		TransformVertex( rows, corner, v );
+
+		// crosses near plane ( or is behind camera )
+		if( !( v[ 2 ] > 0.f ) )
+			return true;
+
+		float x, y, z;
+		ProjectVertex( v, x, y, z );
+
+		minX = R3D_MIN( minX, x );
+		maxX = R3D_MAX( maxX, x );
+		minY = R3D_MIN( minY, y );
+		maxY = R3D_MAX( maxY, y );
+		minZ = R3D_MIN( minZ, z );
+	}
+
+	// frustum culling decides on these
+	if( maxX < 0.f || maxY < 0.f || minX > (float)WIDTH || minY > (float)HEIGHT )
+		return true;
+
+	const int bx0 = R3D_MAX( (int)minX, 0 ) / HIZ_BLOCK;
+	const int by0 = R3D_MAX( (int)minY, 0 ) / HIZ_BLOCK;
+	const int bx1 = R3D_MIN( (int)maxX / HIZ_BLOCK, (int)HIZ_WIDTH - 1 );
+	const int by1 = R3D_MIN( (int)maxY / HIZ_BLOCK, (int)HIZ_HEIGHT - 1 );
+
+	const __m128 boxZ = _mm_set1_ps( minZ );
+
+	for( int by = by0; by <= by1; by ++ )
+	{
+		const float* row = &mHiZ[ by * HIZ_WIDTH ];
+
+		for( int bx = bx0; bx <= bx1; bx += 4 )
+		{
+			const int lanes = R3D_MIN( bx1 - bx + 1, 4 );
+
+			// some block has something farther than nearest point of box
+			if( _mm_movemask_ps( _mm_cmpge_ps( _mm_loadu_ps( row + bx ), boxZ ) ) & ( ( 1 << lanes ) - 1 ) )
+				return true;
+		}
+	}
+
+	return false;
+}
+
+//------------------------------------------------------------------------
+
+int
+SoftOcclusionBuffer::GetBinnedTriangleCount() const
+{
+	int count = 0;
+
+	for( int i = 0, e = mThreadCount * NUM_TILES; i < e; i ++ )
+		count += mBins[ i ].Count();
+
+	return count;
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+int
+SoftOcclusionBuffer::GetMeshTriangleCount( const r3dMesh* mesh )
+{
+	if( !mesh || !mesh->IsDrawable() || !mesh->VertexPositions || !mesh->Indices )
+		return 0;
+
+	// animated geometry doesn't match system copy
+	if( mesh->IsSkeletal() || mesh->VertexFlags & r3dMesh::vfBending )
+		return 0;
+
+	int count = 0;
+
+	for( int i = 0, e = mesh->NumMatChunks; i < e; i ++ )
+	{
+		const r3dTriBatch& batch = mesh->MatChunks[ i ];
+
+		if( IsOccluderBatch( batch ) )
+			count += ( batch.EndIndex - batch.StartIndex ) / 3;
+	}
+
+	return count;
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+bool
+SoftOcclusionBuffer::IsOccluderBatch( const r3dTriBatch& batch )
+{
+	if( !batch.Mat )
+		return false;
+
+	const int NOT_OPAQUE = R3D_MAT_HASALPHA | R3D_MAT_FORCEHASALPHA | R3D_MAT_TRANSPARENT | R3D_MAT_TRANSPARENT_CAMOUFLAGE | R3D_MAT_SKIP_DRAW;
+
+	return !( batch.Mat->Flags & NOT_OPAQUE ) && batch.EndIndex > batch.StartIndex;
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+float
+SoftOcclusionBuffer::GetOccluderScore( const r3dBoundBox& bbox, const r3dPoint3D& camPos, float minScore )
+{
+	r3dPoint3D center = bbox.Org + bbox.Size * 0.5f;
+
+	float radius = bbox.Size.Length() * 0.5f;
+	float dist = ( center - camPos ).Length();
+
+	float score = radius / R3D_MAX( dist, 1.f );
+
+	return score >= minScore ? score : 0.f;
+}
+
+//------------------------------------------------------------------------
+
+/*static*/
+void
+SoftOcclusionBuffer::SelectOccluders( r3dTL::TArray< OccluderCandidate >& candidates, int maxTriangles )
+{
+	if( !candidates.Count() )
+		return;
+
+	std::sort( &candidates[ 0 ], &candidates[ 0 ] + candidates.Count(), CandidateScoreGreater() );
+
+	int count = 0;
+	int numTriangles = 0;
+
+	for( int i = 0, e = candidates.Count(); i < e; i ++ )
+	{
+		const OccluderCandidate& c = candidates[ i ];
+
+		// smaller ones further down the list may still fit
+		if( numTriangles + c.NumTriangles > maxTriangles )
+			continue;
+
+		numTriangles += c.NumTriangles;
+		candidates[ count ++ ] = c;
+	}
+
+	candidates.Resize( count );
+}
+
+//------------------------------------------------------------------------
+
+#ifndef FINAL_BUILD
+
+#pragma pack(push,1)
+struct SoftOcclusionPathHeader
+{
+	enum
+	{
+		MAGIC	= 'SOCP',
+		VERSION	= 1
+	};
+
+	DWORD	Magic;
+	DWORD	Version;
+	DWORD	NumOccluders;
+	DWORD	NumVertices;
+	DWORD	NumBoxes;
+	DWORD	NumFrames;
+};
+
+// world space triangle list
+struct SoftOcclusionPathOccluder
+{
+	float	Min[ 3 ];
+	float	Max[ 3 ];
+	DWORD	FirstVertex;
+	DWORD	NumVertices;
+};
+
+struct SoftOcclusionPathBox
+{
+	float	Min[ 3 ];
+	float	Max[ 3 ];
+};
+
+struct SoftOcclusionPathFrame
+{
+	float	ViewProj[ 16 ];
+	float	CamPos[ 3 ];
+};
+#pragma pack(pop)
+
+namespace
+{
+	FILE*	gSoftOcclusionRecordFile;
+	float	gSoftOcclusionRecordEnd;
+	DWORD	gSoftOcclusionRecordFrames;
+
+	void RecordObject( GameObject* obj, r3dTL::TArray< SoftOcclusionPathOccluder >& occluders, r3dTL::TArray< r3dPoint3D >& vertices, r3dTL::TArray< SoftOcclusionPathBox >& boxes )
+	{
+		if( obj->ObjFlags & ( OBJFLAG_SkipDraw | OBJFLAG_Removed ) || obj->wasSetSkipOcclusionCheck || obj->GetBBoxLocal().Size.x < 0 )
+			return;
+
+		const r3dBoundBox& bbox = obj->GetBBoxWorld();
+
+		SoftOcclusionPathBox box;
+		box.Min[ 0 ] = bbox.Org.x;
+		box.Min[ 1 ] = bbox.Org.y;
+		box.Min[ 2 ] = bbox.Org.z;
+		box.Max[ 0 ] = bbox.Org.x + bbox.Size.x;
+		box.Max[ 1 ] = bbox.Org.y + bbox.Size.y;
+		box.Max[ 2 ] = bbox.Org.z + bbox.Size.z;
+
+		boxes.PushBack( box );
+
+		if( !obj->isObjType( OBJTYPE_Mesh ) || !obj->IsStatic() )
+			return;
+
+		const r3dMesh* mesh = static_cast< MeshGameObject* >( obj )->MeshLOD[ 0 ];
+
+		int numTriangles = SoftOcclusionBuffer::GetMeshTriangleCount( mesh );
+		if( !numTriangles || numTriangles > r_soft_oq_max_tris->GetInt() )
+			return;
+
+		SoftOcclusionPathOccluder occ;
+		memcpy( occ.Min, box.Min, sizeof occ.Min );
+		memcpy( occ.Max, box.Max, sizeof occ.Max );
+		occ.FirstVertex = vertices.Count();
+		occ.NumVertices = numTriangles * 3;
+
+		const D3DXMATRIX& world = obj->GetTransformMatrix();
+
+		for( int i = 0, e = mesh->NumMatChunks; i < e; i ++ )
+		{
+			const r3dTriBatch& batch = mesh->MatChunks[ i ];
+
+			if( !SoftOcclusionBuffer::IsOccluderBatch( batch ) )
+				continue;
+
+			for( int j = batch.StartIndex, je = batch.StartIndex + ( batch.EndIndex - batch.StartIndex ) / 3 * 3; j < je; j ++ )
+			{
+				r3dPoint3D p;
+				D3DXVec3TransformCoord( p.d3dx(), mesh->VertexPositions[ mesh->Indices[ j ] ].d3dx(), &world );
+				vertices.PushBack( p );
+			}
+		}
+
+		occluders.PushBack( occ );
+	}
+
+	void StopRecording()
+	{
+		// patch frame count
+		fseek( gSoftOcclusionRecordFile, offsetof( SoftOcclusionPathHeader, NumFrames ), SEEK_SET );
+		fwrite( &gSoftOcclusionRecordFrames, sizeof gSoftOcclusionRecordFrames, 1, gSoftOcclusionRecordFile );
+		fclose( gSoftOcclusionRecordFile );
+
+		gSoftOcclusionRecordFile = NULL;
+
+		r3dOutToLog( "socrecord: recorded %d frames\n", gSoftOcclusionRecordFrames );
+	}
+}
+
+// saves occluder geometry and boxes of current level, then camera of every frame for given time
+void SoftOcclusionStartRecording( const char* fileName, float seconds )
+{
+	if( gSoftOcclusionRecordFile )
+		StopRecording();
+
+	r3dTL::TArray< SoftOcclusionPathOccluder > occluders;
+	r3dTL::TArray< r3dPoint3D > vertices;
+	r3dTL::TArray< SoftOcclusionPathBox > boxes;
+
+	ObjectManager& GW = GameWorld();
+
+	for( GameObject* obj = GW.GetFirstObject(); obj; obj = GW.GetNextObject( obj ) )
+		RecordObject( obj, occluders, vertices, boxes );
+
+	for( int i = 0, e = GW.GetStaticObjectCount(); i < e; i ++ )
+	{
+		if( GameObject* obj = GW.GetStaticObject( i ) )
+			RecordObject( obj, occluders, vertices, boxes );
+	}
+
+	gSoftOcclusionRecordFile = fopen( fileName, "wb" );
+	if( !gSoftOcclusionRecordFile )
+	{
+		r3dOutToLog( "socrecord: can't open %s\n", fileName );
+		return;
+	}
+
+	SoftOcclusionPathHeader header;
+	header.Magic = SoftOcclusionPathHeader::MAGIC;
+	header.Version = SoftOcclusionPathHeader::VERSION;
+	header.NumOccluders = occluders.Count();
+	header.NumVertices = vertices.Count();
+	header.NumBoxes = boxes.Count();
+	header.NumFrames = 0;
+
+	fwrite( &header, sizeof header, 1, gSoftOcclusionRecordFile );
+
+	if( occluders.Count() )
+		fwrite( &occluders[ 0 ], sizeof occluders[ 0 ], occluders.Count(), gSoftOcclusionRecordFile );
+	if( vertices.Count() )
+		fwrite( &vertices[ 0 ], sizeof vertices[ 0 ], vertices.Count(), gSoftOcclusionRecordFile );
+	if( boxes.Count() )
+		fwrite( &boxes[ 0 ], sizeof boxes[ 0 ], boxes.Count(), gSoftOcclusionRecordFile );
+
+	gSoftOcclusionRecordEnd = r3dGetTime() + seconds;
+	gSoftOcclusionRecordFrames = 0;
+
+	r3dOutToLog( "socrecord: %d occluders ( %d triangles ), %d boxes, recording camera for %.0f sec to %s\n", header.NumOccluders, header.NumVertices / 3, header.NumBoxes, seconds, fileName );
+}
+
+void SoftOcclusionRecordFrame( const D3DXMATRIX& viewProj, const r3dPoint3D& camPos )
+{
+	if( !gSoftOcclusionRecordFile )
+		return;
+
+	SoftOcclusionPathFrame frame;
+	memcpy( frame.ViewProj, &viewProj, sizeof frame.ViewProj );
+	frame.CamPos[ 0 ] = camPos.x;
+	frame.CamPos[ 1 ] = camPos.y;
+	frame.CamPos[ 2 ] = camPos.z;
+
+	fwrite( &frame, sizeof frame, 1, gSoftOcclusionRecordFile );
+	gSoftOcclusionRecordFrames ++;
+
+	if( r3dGetTime() > gSoftOcclusionRecordEnd )
+		StopRecording();
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+	// plain per pixel rasterizer for checking SoftOcclusionBuffer
+	void RasterizeReference( float* depth, const D3DXMATRIX& viewProj, const r3dPoint3D* vertices, int numVertices )
+	{
+		for( int i = 0; i < numVertices; i += 3 )
+		{
+			float poly[ MAX_CLIP_VERTICES ][ 4 ];
+			int clipAnd = ~0, clipOr = 0;
+
+			for( int k = 0; k < 3; k ++ )
+			{
+				D3DXVECTOR4 v;
+				D3DXVec3Transform( &v, vertices[ i + k ].d3dx(), &viewProj );
+				poly[ k ][ 0 ] = v.x; poly[ k ][ 1 ] = v.y; poly[ k ][ 2 ] = v.z; poly[ k ][ 3 ] = v.w;
+
+				int code = ClipCode( poly[ k ] );
+				clipAnd &= code;
+				clipOr |= code;
+			}
+
+			if( clipAnd )
+				continue;
+
+			int count = clipOr ? ClipPolygon( poly, 3, clipOr ) : 3;
+
+			for( int t = 1; t < count - 1; t ++ )
+			{
+				float x[ 3 ], y[ 3 ], z[ 3 ];
+				ProjectVertex( poly[ 0 ], x[ 0 ], y[ 0 ], z[ 0 ] );
+				ProjectVertex( poly[ t ], x[ 1 ], y[ 1 ], z[ 1 ] );
+				ProjectVertex( poly[ t + 1 ], x[ 2 ], y[ 2 ], z[ 2 ] );
+
+				float area = ( x[ 1 ] - x[ 0 ] ) * ( y[ 2 ] - y[ 0 ] ) - ( x[ 2 ] - x[ 0 ] ) * ( y[ 1 ] - y[ 0 ] );
+				if( !( fabsf( area ) > 1e-6f ) )
+					continue;
+
+				for( int py = 0; py < SoftOcclusionBuffer::HEIGHT; py ++ )
+				{
+					float fy = py + 0.5f;
+
+					for( int px = 0; px < SoftOcclusionBuffer::WIDTH; px ++ )
+					{
+						float fx = px + 0.5f;
+
+						// barycentrics
+						float w1 = ( ( x[ 2 ] - x[ 0 ] ) * ( fy - y[ 0 ] ) - ( fx - x[ 0 ] ) * ( y[ 2 ] - y[ 0 ] ) ) / -area;
+						float w2 = ( ( x[ 1 ] - x[ 0 ] ) * ( fy - y[ 0 ] ) - ( fx - x[ 0 ] ) * ( y[ 1 ] - y[ 0 ] ) ) / area;
+						float w0 = 1.f - w1 - w2;
+
+						if( w0 < 0.f || w1 < 0.f || w2 < 0.f )
+							continue;
+
+						float pz = R3D_MAX( w0 * z[ 0 ] + w1 * z[ 1 ] + w2 * z[ 2 ], 0.f );
+						float& d = depth[ py * SoftOcclusionBuffer::WIDTH + px ];
+						d = R3D_MIN( d, pz );
+					}
+				}
+			}
+		}
+	}
+
+	// box is occluded if all pixels of its screen rectangle are nearer than box
+	bool IsBoxVisibleReference( const float* depth, const D3DXMATRIX& viewProj, const r3dPoint3D& mn, const r3dPoint3D& mx )
+	{
+		float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+		float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+		for( int i = 0; i < 8; i ++ )
+		{
+			r3dPoint3D corner( i & 1 ? mx.x : mn.x, i & 2 ? mx.y : mn.y, i & 4 ? mx.z : mn.z );
+
+			D3DXVECTOR4 v;
+			D3DXVec3Transform( &v, corner.d3dx(), &viewProj );
+
+			if( !( v.z > 0.f ) )
+				return true;
+
+			float x, y, z;
+			ProjectVertex( v, x, y, z );
+
+			minX = R3D_MIN( minX, x );
+			maxX = R3D_MAX( maxX, x );
+			minY = R3D_MIN( minY, y );
+			maxY = R3D_MAX( maxY, y );
+			minZ = R3D_MIN( minZ, z );
+		}
+
+		int px0 = R3D_MAX( (int)floorf( minX ), 0 );
+		int py0 = R3D_MAX( (int)floorf( minY ), 0 );
+		int px1 = R3D_MIN( (int)floorf( maxX ), (int)SoftOcclusionBuffer::WIDTH - 1 );
+		int py1 = R3D_MIN( (int)floorf( maxY ), (int)SoftOcclusionBuffer::HEIGHT - 1 );
+
+		if( px0 > px1 || py0 > py1 )
+			return true;
+
+		for( int py = py0; py <= py1; py ++ )
+		{
+			for( int px = px0; px <= px1; px ++ )
+			{
+				if( depth[ py * SoftOcclusionBuffer::WIDTH + px ] >= minZ )
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool IsBoxOutsideFrustum( const D3DXPLANE (&planes)[ 6 ], const float* mn, const float* mx )
+	{
+		for( int i = 0; i < 6; i ++ )
+		{
+			const D3DXPLANE& p = planes[ i ];
+
+			float px = p.a >= 0.f ? mx[ 0 ] : mn[ 0 ];
+			float py = p.b >= 0.f ? mx[ 1 ] : mn[ 1 ];
+			float pz = p.c >= 0.f ? mx[ 2 ] : mn[ 2 ];
+
+			if( p.a * px + p.b * py + p.c * pz + p.d < 0.f )
+				return true;
+		}
+
+		return false;
+	}
+
+	// planes pointing inside, from columns of view projection matrix
+	void ExtractFrustumPlanes( const D3DXMATRIX& m, D3DXPLANE (&planes)[ 6 ] )
+	{
+		planes[ 0 ] = D3DXPLANE( m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41 );
+		planes[ 1 ] = D3DXPLANE( m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41 );
+		planes[ 2 ] = D3DXPLANE( m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42 );
+		planes[ 3 ] = D3DXPLANE( m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42 );
+		planes[ 4 ] = D3DXPLANE( m._13, m._23, m._33, m._43 );
+		planes[ 5 ] = D3DXPLANE( m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43 );
+	}
+}
+
+// replays camera path recorded by SoftOcclusionStartRecording, checks rasterizer and box tests against
+// per pixel reference and measures them. Doesn't need level or renderer
+void SoftOcclusionBenchmark( const char* fileName )
+{
+	FILE* f = fopen( fileName, "rb" );
+	if( !f )
+	{
+		r3dOutToLog( "socbench: can't open %s\n", fileName );
+		return;
+	}
+
+	SoftOcclusionPathHeader header;
+	if( fread( &header, sizeof header, 1, f ) != 1 || header.Magic != SoftOcclusionPathHeader::MAGIC || header.Version != SoftOcclusionPathHeader::VERSION )
+	{
+		r3dOutToLog( "socbench: %s is not a camera path file\n", fileName );
+		fclose( f );
+		return;
+	}
+
+	r3dTL::TArray< SoftOcclusionPathOccluder > occluders;
+	r3dTL::TArray< r3dPoint3D > vertices;
+	r3dTL::TArray< SoftOcclusionPathBox > boxes;
+	r3dTL::TArray< SoftOcclusionPathFrame > frames;
+
+	occluders.Resize( header.NumOccluders );
+	vertices.Resize( header.NumVertices );
+	boxes.Resize( header.NumBoxes );
+	frames.Resize( header.NumFrames );
+
+	bool ok = true;
+
+	if( occluders.Count() )
+		ok = ok && fread( &occluders[ 0 ], sizeof occluders[ 0 ], occluders.Count(), f ) == occluders.Count();
+	if( vertices.Count() )
+		ok = ok && fread( &vertices[ 0 ], sizeof vertices[ 0 ], vertices.Count(), f ) == vertices.Count();
+	if( boxes.Count() )
+		ok = ok && fread( &boxes[ 0 ], sizeof boxes[ 0 ], boxes.Count(), f ) == boxes.Count();
+	if( frames.Count() )
+		ok = ok && fread( &frames[ 0 ], sizeof frames[ 0 ], frames.Count(), f ) == frames.Count();
+
+	fclose( f );
+
+	if( !ok || !frames.Count() )
+	{
+		r3dOutToLog( "socbench: %s is truncated or has no frames\n", fileName );
+		return;
+	}
+
+	r3dOutToLog( "socbench: %s, %d occluders ( %d triangles ), %d boxes, %d frames\n", fileName, header.NumOccluders, header.NumVertices / 3, header.NumBoxes, header.NumFrames ); CLOG_INDENT;
+
+	// recorded occluders are world space triangle lists
+	r3dTL::TArray< uint32_t > indices;
+	{
+		uint32_t maxVertices = 0;
+		for( int i = 0, e = occluders.Count(); i < e; i ++ )
+			maxVertices = R3D_MAX( maxVertices, (uint32_t)occluders[ i ].NumVertices );
+
+		indices.Resize( maxVertices );
+		for( uint32_t i = 0; i < maxVertices; i ++ )
+			indices[ i ] = i;
+	}
+
+	D3DXMATRIX identity;
+	D3DXMatrixIdentity( &identity );
+
+	SoftOcclusionBuffer buffer;
+
+	r3dTL::TArray< SoftOcclusionBuffer::OccluderCandidate > candidates;
+	r3dTL::TArray< float > refDepth;
+	r3dTL::TArray< float > serialDepth;
+
+	double serialTime = 0, parallelTime = 0, testTime = 0;
+	double numTriangles = 0, numOccluders = 0, numTested = 0, numCulled = 0;
+	int depthMismatches = 0, threadMismatches = 0, falseCulls = 0;
+
+	for( int fi = 0, fe = frames.Count(); fi < fe; fi ++ )
+	{
+		const SoftOcclusionPathFrame& frame = frames[ fi ];
+
+		D3DXMATRIX viewProj;
+		memcpy( &viewProj, frame.ViewProj, sizeof viewProj );
+
+		r3dPoint3D camPos( frame.CamPos[ 0 ], frame.CamPos[ 1 ], frame.CamPos[ 2 ] );
+
+		D3DXPLANE planes[ 6 ];
+		ExtractFrustumPlanes( viewProj, planes );
+
+		// same selection as ObjectManager::ApplySoftwareOcclusion
+		candidates.Clear();
+		for( int i = 0, e = occluders.Count(); i < e; i ++ )
+		{
+			const SoftOcclusionPathOccluder& occ = occluders[ i ];
+
+			if( IsBoxOutsideFrustum( planes, occ.Min, occ.Max ) )
+				continue;
+
+			r3dBoundBox bbox;
+			bbox.Org = r3dPoint3D( occ.Min[ 0 ], occ.Min[ 1 ], occ.Min[ 2 ] );
+			bbox.Size = r3dPoint3D( occ.Max[ 0 ], occ.Max[ 1 ], occ.Max[ 2 ] ) - bbox.Org;
+
+			float score = SoftOcclusionBuffer::GetOccluderScore( bbox, camPos, r_soft_oq_min_occluder->GetFloat() );
+			if( score <= 0.f )
+				continue;
+
+			SoftOcclusionBuffer::OccluderCandidate c;
+			c.Score = score;
+			c.NumTriangles = occ.NumVertices / 3;
+			c.Index = i;
+
+			candidates.PushBack( c );
+		}
+
+		SoftOcclusionBuffer::SelectOccluders( candidates, r_soft_oq_max_tris->GetInt() );
+
+		buffer.Begin( viewProj );
+		for( int i = 0, e = candidates.Count(); i < e; i ++ )
+		{
+			const SoftOcclusionPathOccluder& occ = occluders[ candidates[ i ].Index ];
+			buffer.AddOccluder( &vertices[ occ.FirstVertex ], &indices[ 0 ], occ.NumVertices, identity );
+		}
+
+		numOccluders += candidates.Count();
+		numTriangles += buffer.GetOccluderTriangleCount();
+
+		float t0 = r3dGetTime();
+		buffer.Rasterize( false );
+		serialTime += r3dGetTime() - t0;
+
+		serialDepth.Resize( SoftOcclusionBuffer::WIDTH * SoftOcclusionBuffer::HEIGHT );
+		memcpy( &serialDepth[ 0 ], buffer.GetDepth(), sizeof( float ) * serialDepth.Count() );
+
+		t0 = r3dGetTime();
+		buffer.Rasterize( true );
+		parallelTime += r3dGetTime() - t0;
+
+		// min of same values, order of bins doesn't matter
+		threadMismatches += memcmp( &serialDepth[ 0 ], buffer.GetDepth(), sizeof( float ) * serialDepth.Count() ) ? 1 : 0;
+
+		refDepth.Clear();
+		refDepth.Resize( SoftOcclusionBuffer::WIDTH * SoftOcclusionBuffer::HEIGHT, 1.f );
+		for( int i = 0, e = candidates.Count(); i < e; i ++ )
+		{
+			const SoftOcclusionPathOccluder& occ = occluders[ candidates[ i ].Index ];
+			RasterizeReference( &refDepth[ 0 ], viewProj, &vertices[ occ.FirstVertex ], occ.NumVertices );
+		}
+
+		for( int i = 0, e = refDepth.Count(); i < e; i ++ )
+		{
+			if( fabsf( refDepth[ i ] - buffer.GetDepth()[ i ] ) > 1e-3f )
+				depthMismatches ++;
+		}
+
+		t0 = r3dGetTime();
+		for( int i = 0, e = boxes.Count(); i < e; i ++ )
+		{
+			const SoftOcclusionPathBox& box = boxes[ i ];
+
+			if( IsBoxOutsideFrustum( planes, box.Min, box.Max ) )
+				continue;
+
+			numTested ++;
+
+			if( !buffer.IsBoxVisible( r3dPoint3D( box.Min[ 0 ], box.Min[ 1 ], box.Min[ 2 ] ), r3dPoint3D( box.Max[ 0 ], box.Max[ 1 ], box.Max[ 2 ] ) ) )
+				numCulled ++;
+		}
+		testTime += r3dGetTime() - t0;
+
+		// hierarchical Z must never hide box that is visible in per pixel reference
+		for( int i = 0, e = boxes.Count(); i < e; i ++ )
+		{
+			const SoftOcclusionPathBox& box = boxes[ i ];
+
+			if( IsBoxOutsideFrustum( planes, box.Min, box.Max ) )
+				continue;
+
+			r3dPoint3D mn( box.Min[ 0 ], box.Min[ 1 ], box.Min[ 2 ] );
+			r3dPoint3D mx( box.Max[ 0 ], box.Max[ 1 ], box.Max[ 2 ] );
+
+			if( !buffer.IsBoxVisible( mn, mx ) && IsBoxVisibleReference( &refDepth[ 0 ], viewProj, mn, mx ) )
+				falseCulls ++;
+		}
+	}
+
+	const float numFrames = (float)frames.Count();
+
+	r3dOutToLog( "occluders: %.1f per frame, %.0f triangles\n", numOccluders / numFrames, numTriangles / numFrames );
+	r3dOutToLog( "rasterize: %.3f ms on 1 thread, %.3f ms on %d threads\n", serialTime * 1000.f / numFrames, parallelTime * 1000.f / numFrames, g_pJobChief->GetThreadCount() );
+	r3dOutToLog( "box tests: %.0f per frame in frustum, %.1f%% culled, %.3f ms per frame\n", numTested / numFrames, numTested ? numCulled * 100.f / numTested : 0.f, testTime * 1000.f / numFrames );
+	r3dOutToLog( "checks: %.1f depth pixels per frame differ from reference, %d frames differ between 1 and %d threads, %d boxes culled while visible in reference\n",
+					depthMismatches / numFrames, threadMismatches, g_pJobChief->GetThreadCount(), falseCulls );
+}
+
+#endif
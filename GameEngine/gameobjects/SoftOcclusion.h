@@ -0,0 +1,123 @@
+#ifndef __SOFTOCCLUSION_H__
+#define __SOFTOCCLUSION_H__
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//	>	CPU occlusion culling against low resolution depth buffer
+//
+//	Occluder triangles are transformed, clipped and binned to screen tiles in parallel, then every tile
+//	is rasterized by one thread with SSE, 4 pixels at a time. After tile is done its depth is reduced
+//	to hierarchical Z of HIZ_BLOCK x HIZ_BLOCK pixel blocks, keeping farthest depth of block.
+//
+//	Boxes are tested against hierarchical Z only: box is occluded if its nearest depth is behind
+//	farthest depth of every block its screen rectangle touches. Result is ready in the same frame,
+//	so there is no pop-in of GPU queries that come back late.
+//
+//	Depth is post projection z / w, cleared to 1. Buffer doesn't know about game objects and
+//	can be fed and tested from recorded data.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+class r3dMesh;
+
+class SoftOcclusionBuffer
+{
+public:
+	enum
+	{
+		WIDTH			= 320,
+		HEIGHT			= 192,
+
+		TILE_WIDTH		= 64,
+		TILE_HEIGHT		= 48,
+		TILES_X			= WIDTH / TILE_WIDTH,
+		TILES_Y			= HEIGHT / TILE_HEIGHT,
+		NUM_TILES		= TILES_X * TILES_Y,
+
+		HIZ_BLOCK		= 8,
+		HIZ_WIDTH		= WIDTH / HIZ_BLOCK,
+		HIZ_HEIGHT		= HEIGHT / HIZ_BLOCK,
+
+		// occluders are split to jobs of this many triangles
+		MAX_JOB_TRIANGLES	= 1024,
+	};
+
+	struct OccluderCandidate
+	{
+		float	Score;
+		int		NumTriangles;
+		int		Index;			// caller data
+	};
+
+	SoftOcclusionBuffer();
+	~SoftOcclusionBuffer();
+
+	void			Begin( const D3DXMATRIX& viewProj );
+
+	// positions and indices must stay alive until Rasterize()
+	void			AddOccluder( const r3dPoint3D* positions, const uint32_t* indices, int numIndices, const D3DXMATRIX& world );
+	// adds opaque batches of mesh
+	void			AddMesh( const r3dMesh* mesh, const D3DXMATRIX& world );
+
+	// with multithreaded false everything runs on calling thread
+	void			Rasterize( bool multithreaded );
+
+	// can be called from any number of threads after Rasterize()
+	bool			IsBoxVisible( const r3dPoint3D& mn, const r3dPoint3D& mx ) const;
+
+	const float*	GetDepth() const				{ return &mDepth[ 0 ]; }
+	const float*	GetHiZ() const					{ return &mHiZ[ 0 ]; }
+	int				GetOccluderTriangleCount() const	{ return mNumTriangles; }
+	int				GetBinnedTriangleCount() const;
+
+	// 0 if mesh can't be used as occluder - no system copy of geometry, skinned or bending
+	static int		GetMeshTriangleCount( const r3dMesh* mesh );
+	// alpha tested and transparent batches don't hide what's behind them
+	static bool		IsOccluderBatch( const r3dTriBatch& batch );
+	// angular size of box seen from camPos, 0 if it is too small to be worth drawing
+	static float	GetOccluderScore( const r3dBoundBox& bbox, const r3dPoint3D& camPos, float minScore );
+	// sorts candidates by score and keeps best ones that fit into triangle budget
+	static void		SelectOccluders( r3dTL::TArray< OccluderCandidate >& candidates, int maxTriangles );
+
+private:
+	struct Job
+	{
+		const r3dPoint3D*	Positions;
+		const uint32_t*		Indices;
+		int					NumTriangles;
+		D3DXMATRIX			WorldViewProj;
+	};
+
+	// edge equations and depth plane in pixel coordinates, pixel x is covered at x + 0.5
+	struct BinnedTriangle
+	{
+		float	EdgeA[ 3 ];
+		float	EdgeB[ 3 ];
+		float	EdgeC[ 3 ];
+		float	Z0, ZdX, ZdY;
+		short	MinX, MinY, MaxX, MaxY;
+	};
+
+	typedef r3dTL::TArray< BinnedTriangle > TriangleBin;
+
+	static void		SetupJobsMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex );
+	static void		RasterizeTilesMT( void* Data, size_t ItemStart, size_t ItemCount, size_t ThreadIndex );
+
+	void			SetupJob( const Job& job, int threadIndex );
+	void			BinTriangle( const float (&v0)[ 4 ], const float (&v1)[ 4 ], const float (&v2)[ 4 ], int threadIndex );
+	void			RasterizeTile( int tile );
+
+	D3DXMATRIX					mViewProj;
+
+	r3dTL::TArray< Job >		mJobs;
+	int							mNumTriangles;
+
+	// NUM_TILES bins per thread, so setup doesn't need locks
+	r3dTL::TArray< TriangleBin >	mBins;
+	int								mThreadCount;
+
+	r3dTL::TArray< float >		mDepth;
+	r3dTL::TArray< float >		mHiZ;
+};
+
+#endif //__SOFTOCCLUSION_H__
@@ -2,6 +2,7 @@
 #include "r3d.h"
 
 #include "r3dBackgroundTaskDispatcher.h"
+#include "r3dResourceRegistry.h"
 
 #include "GameObj.h"
 #include "obj_Mesh.h"
@@ -20,6 +21,8 @@ int		g_DrawPlayerOnlyCollisionMeshes = 0;
 
 // static to prevent extern
 static r3dgameVector(r3dMesh*) s_MeshCache;
+// s_MeshCache by file name
+static r3dResourceRegistry< r3dMesh > s_MeshCacheIndex;
 
 #define COMMON_DEPOT_PREFIX "data/objectsdepot/"
 
@@ -133,9 +136,16 @@ void ReloadMesh(const char* fname)
 
 		bool was_player = pFreeMesh->Flags & r3dMesh::obfPlayerMesh ? true : false ;
 
+		s_MeshCacheIndex.Remove( pFreeMesh );
+
 		SAFE_DELETE( s_MeshCache[i] )
 		s_MeshCache[i] = CacheMesh( szFixedName, false, false, was_player, false );
 
+		if( s_MeshCache[i] )
+		{
+			s_MeshCacheIndex.Add( s_MeshCache[i], s_MeshCache[i]->FileName.c_str() );
+		}
+
 		for( ObjectIterator iter = GameWorld().GetFirstOfAllObjects(); iter.current ; iter = GameWorld().GetNextOfAllObjects( iter ) )
 		{
 			GameObject* pObj = iter.current;
@@ -149,31 +159,44 @@ void ReloadMesh(const char* fname)
 }
 
 
+//--------------------------------------------------------------------------------------------------------
+namespace
+{
+	struct MeshNameMatch
+	{
+		const char* FileName;
+
+		explicit MeshNameMatch( const char* fileName ) : FileName( fileName ) { }
+
+		bool operator() ( const r3dMesh* mesh ) const
+		{
+			return mesh->FileName == FileName;
+		}
+	};
+}
+
 //--------------------------------------------------------------------------------------------------------
 r3dMesh *r3dGOBAddMesh(const char* fname, bool addToLibrary, bool use_default_material, bool allow_async, bool player_mesh, bool use_thumbnails )
 {
 	char szFixedName[MAX_PATH];	
 	FixFileName(fname, szFixedName);
 
-	for (size_t i=0;i<s_MeshCache.size();++i)
+	// mesh that is still being loaded asynchronously is shared as well
+	if( r3dMesh* mesh = s_MeshCacheIndex.Find( szFixedName, MeshNameMatch( szFixedName ) ) )
 	{
-		r3dMesh* mesh = s_MeshCache[i] ;
-		if( mesh->FileName == szFixedName ) 
+		if( !allow_async && !mesh->IsDrawablePure() )
 		{
-			if( !allow_async && !mesh->IsDrawablePure() )
+			r3dOutToLog( "r3dGOBAddMesh: Lazy mesh '%s' encountered on sync loading request. Waiting for completion\n", mesh->FileName.c_str() ) ;
+			for( ; !mesh->IsDrawablePure(); )
 			{
-				r3dOutToLog( "r3dGOBAddMesh: Lazy mesh '%s' encountered on sync loading request. Waiting for completion\n", mesh->FileName.c_str() ) ;
-				for( ; !mesh->IsDrawablePure(); )
-				{
-					ProcessDeviceQueue( r3dGetTime(), 0.067f );
-					Sleep( 1 );
-				}
+				ProcessDeviceQueue( r3dGetTime(), 0.067f );
+				Sleep( 1 );
 			}
+		}
 
-			mesh->RefCount ++ ;
+		mesh->RefCount ++ ;
 
-			return mesh ;
-		}
+		return mesh ;
 	}
 
 	if(s_MeshCache.size() > 2048)
@@ -193,7 +216,10 @@ r3dMesh *r3dGOBAddMesh(const char* fname, bool addToLibrary, bool use_default_ma
 		}
 
 		if(addToLibrary)
+		{
 			s_MeshCache.push_back(loadedMesh);
+			s_MeshCacheIndex.Add(loadedMesh, loadedMesh->FileName.c_str());
+		}
 		return loadedMesh;
 	}
 
@@ -248,6 +274,7 @@ static void DoReleaseMesh( r3dMesh* mesh )
 
 		r3dOutToLog( "Unloading mesh %s\n", mesh->Name ) ;
 		s_MeshCache.erase(it); // firstly remove from array, and only then delete pointer
+		s_MeshCacheIndex.Remove( mesh );
 		SAFE_DELETE( mesh ) ;
 
 #ifndef FINAL_BUILD
@@ -320,10 +347,87 @@ void r3dFreeGOBMeshes()
 		SAFE_DELETE(s_MeshCache[i]);
 	}
 	s_MeshCache.clear();
+	s_MeshCacheIndex.Clear();
 
 	g_ReleasedMeshes.Clear() ;
 }
 
+#ifndef FINAL_BUILD
+// loop r3dGOBAddMesh did before s_MeshCacheIndex, as reference
+static r3dMesh* FindCachedMeshLinear( const char* fname )
+{
+	for( size_t i = 0; i < s_MeshCache.size(); ++ i )
+	{
+		if( s_MeshCache[ i ]->FileName == fname )
+			return s_MeshCache[ i ];
+	}
+
+	return NULL;
+}
+
+void r3dMeshCacheLookupBenchmark( int passes )
+{
+	passes = R3D_MAX( passes, 1 );
+
+	r3dTL::TArray< r3dSTLString > requests;
+
+	for( size_t i = 0; i < s_MeshCache.size(); ++ i )
+	{
+		requests.PushBack( s_MeshCache[ i ]->FileName.c_str() );
+		requests.PushBack( r3dSTLString( s_MeshCache[ i ]->FileName.c_str() ) + ".missing" );
+	}
+
+	if( !requests.Count() )
+	{
+		r3dOutToLog( "reslookupbench: mesh cache is empty\n" );
+		return;
+	}
+
+	r3dOutToLog( "reslookupbench: %d cached meshes, %d lookups x %d passes\n", (int)s_MeshCache.size(), requests.Count(), passes ); CLOG_INDENT;
+
+	int mismatches = 0;
+
+	for( int i = 0, e = requests.Count(); i < e; i ++ )
+	{
+		if( FindCachedMeshLinear( requests[ i ].c_str() ) != s_MeshCacheIndex.Find( requests[ i ].c_str(), MeshNameMatch( requests[ i ].c_str() ) ) )
+		{
+			mismatches ++;
+		}
+	}
+
+	// keeps optimizer from dropping the loops
+	size_t sum = 0;
+
+	float t0 = r3dGetTime();
+
+	for( int p = 0; p < passes; p ++ )
+	{
+		for( int i = 0, e = requests.Count(); i < e; i ++ )
+		{
+			sum += (size_t)FindCachedMeshLinear( requests[ i ].c_str() );
+		}
+	}
+
+	float t1 = r3dGetTime();
+
+	for( int p = 0; p < passes; p ++ )
+	{
+		for( int i = 0, e = requests.Count(); i < e; i ++ )
+		{
+			sum += (size_t)s_MeshCacheIndex.Find( requests[ i ].c_str(), MeshNameMatch( requests[ i ].c_str() ) );
+		}
+	}
+
+	float t2 = r3dGetTime();
+
+	float numLookups = float( requests.Count() ) * passes;
+
+	r3dOutToLog( "mismatches %d (%d)\n", mismatches, (int)( sum & 1 ) );
+	r3dOutToLog( "cache walk: %.2f ms, %.3f us per lookup\n", ( t1 - t0 ) * 1000.f, ( t1 - t0 ) * 1e6f / numLookups );
+	r3dOutToLog( "registry:   %.2f ms, %.3f us per lookup\n", ( t2 - t1 ) * 1000.f, ( t2 - t1 ) * 1e6f / numLookups );
+}
+#endif
+
 IMPLEMENT_CLASS(MeshGameObject, "MeshGameObject", "Object");
 AUTOREGISTER_CLASS(MeshGameObject);
 
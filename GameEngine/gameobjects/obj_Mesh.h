@@ -151,6 +151,11 @@ void		r3dFlushReleasedMeshes();
 
 void	r3dUpdateMeshMaterials();
 
+#ifndef FINAL_BUILD
+// replays s_MeshCache lookups through old array walk and registry, checks they agree and prints timings
+void	r3dMeshCacheLookupBenchmark( int passes );
+#endif
+
 struct MeshObjDeferredHighlightRenderable : MeshDeferredHighlightRenderable
 {
 	typedef MeshDeferredHighlightRenderable ParentType;
@@ -1455,25 +1455,27 @@ void obj_Vehicle::SendUpdate()
 		wheels = vd->tank;
 
 	// get wheel turn angle and speed
-	for (uint32_t i = 0; i < vd->numWheels; ++i)
+	md.numWheels = R3D_MIN((int)vd->numWheels, (int)CVehicleNetCellMover::MAX_WHEELS);
+	for (int i = 0; i < md.numWheels; ++i)
 	{
 		// get suspension travel
-		moveRel.wheelSuspTravel[ i ] = (short)floor(wheels->mWheelsDynData.getSuspJounce(i) * 65535 / 1000);
+		md.wheelSuspTravel[i] = wheels->mWheelsDynData.getSuspJounce(i);
 
 		// get rotations
-		moveRel.wheelRotation[i] = (short)floor(wheels->mWheelsDynData.getWheelRotationAngle(i) * 65535 / 1000);
-		moveRel.wheelTurnAngle[i] = (short)floor(wheels->mWheelsDynData.getSteer(i) * 65535 / 1000);
+		md.wheelRotation[i]  = wheels->mWheelsDynData.getWheelRotationAngle(i);
+		md.wheelTurnAngle[i] = wheels->mWheelsDynData.getSteer(i);
 	}
 
-	moveRel.engineRpm = (int)GetEngineRpm();
-	moveRel.sideSpeed = sideSpeedVolume > 0 ? (BYTE)sideSpeedVolume * 10 : (BYTE)0;
+	md.speed     = vd->GetSpeed();
+	md.engineRpm = GetEngineRpm();
+	md.sideSpeed = R3D_MAX(sideSpeedVolume, 0.0f);
 
 	DWORD pktFlags = netMover.SendPosUpdate(md, &setCell, &moveRel);
 
 	if(pktFlags & 0x1)
 		p2pSendToHost(this, &setCell, sizeof(setCell), true);
 	if(pktFlags & 0x2)
-		p2pSendToHost(this, &moveRel, sizeof(moveRel), false);
+		p2pSendToHost(this, &moveRel, moveRel.GetPacketSize(), false);
 }
 
 void obj_Vehicle::CheckDistanceFromGround()
@@ -2505,7 +2507,7 @@ BOOL obj_Vehicle::OnNetReceive(DWORD EventID, const void* packetData, int packet
 	case PKT_C2C_VehicleMoveRel:
 		{
 			const PKT_C2C_VehicleMoveRel_s& n = *(PKT_C2C_VehicleMoveRel_s*)packetData;
-			r3d_assert(packetSize == sizeof(n));
+			r3d_assert(n.IsValidSize(packetSize));
 
 			OnNetPacket(n);
 			break;
@@ -2586,18 +2588,19 @@ void obj_Vehicle::OnNetPacket(const PKT_C2C_VehicleMoveRel_s& n)
 
 		netVelocity = vel;
 
-		reportedSpeed = (float)n.speed;
-		reportedRpm	 = (float)n.engineRpm;
-		reportedSideSpeed = (float)n.sideSpeed / 10.0f;
+		reportedSpeed = md.speed;
+		reportedRpm	 = md.engineRpm;
+		reportedSideSpeed = md.sideSpeed;
 		
 		lastRotationVector = r3dVector(md.rot.x, md.rot.y, md.rot.z);
 
 		{
-			for( uint32_t i = 0; i < vd->numWheels; ++i )
+			const uint32_t numWheels = R3D_MIN(vd->numWheels, (uint32_t)md.numWheels);
+			for( uint32_t i = 0; i < numWheels; ++i )
 			{
-				float turn = (float)n.wheelTurnAngle[i] * 1000 / 65535;
-				float wheelRot = (float)n.wheelRotation[i] * 1000 / 65535;
-				float wheelSuspTravel = (float)n.wheelSuspTravel[i] * 1000 / 65535;
+				float turn = md.wheelTurnAngle[i];
+				float wheelRot = md.wheelRotation[i];
+				float wheelSuspTravel = md.wheelSuspTravel[i];
 
 				D3DXQUATERNION rotation, turnAngle;
 				D3DXQuaternionRotationYawPitchRoll(&turnAngle, turn, 0, 0);
@@ -2,9 +2,12 @@
 #include "r3d.h"
 
 #include "GameLevel.h"
+#include "GameLevel_Binary.h"
 #include "main.h"
 #include "r3dFSBuilder.h"
 #include "BuilderConfig.h"
+#include "FileSystem/r3dFSStructs.h"
+#include "FileSystem/r3dFSChunks.h"
 
 extern	HANDLE		r3d_CurrentProcess;
 extern	r3dFSBuilder	builder("");
@@ -32,9 +35,12 @@ void CreateArchive()
     return;
   }
   
+  float t1 = r3dGetTime();
   builder.ReconvertAllSCO();
+  builder.CompileLevelData();
   builder.BuildFileList();
   builder.CreateArchive();
+  r3dOutToLog("Build done, %.2f sec\n", r3dGetTime() - t1);
 }
 
 void TestArchive()
@@ -53,8 +59,451 @@ void TestArchive()
   return;
 }
 
+//
+// multithreaded archive read benchmark: -benchfs <archive base name>
+//
+	const char*	g_benchArchive = NULL;
+
+struct BenchFSThreadData_s
+{
+  r3dFileSystem* fs;
+  int		idx;
+  int		numThreads;
+  
+  __int64	bytes;
+  int		files;
+};
+
+static unsigned int __stdcall BenchFS_ThreadEntry(LPVOID in)
+{
+  BenchFSThreadData_s& td = *(BenchFSThreadData_s*)in;
+  
+  const r3dFS_FileList::FileEntriesVec& files = td.fs->fl_.files_;
+  for(size_t i=td.idx; i<files.size(); i+=td.numThreads)
+  {
+    // go thru name lookup as real loaders do
+    const r3dFS_FileEntry* fe = td.fs->GetFileEntry(files[i]->name);
+    r3d_assert(fe);
+
+    BYTE* data = NULL;
+    DWORD size = 0;
+    if(!td.fs->GetFileData(fe, &data, &size))
+      r3dError("benchfs: failed to read %s\n", fe->name);
+    delete[] data;
+    
+    td.bytes += size;
+    td.files++;
+  }
+  
+  return 0;
+}
+
+void BenchArchiveRead()
+{
+  r3dFileSystem fs;
+  if(!fs.OpenArchive(g_benchArchive))
+    r3dError("benchfs: can't open archive %s\n", g_benchArchive);
+  fs.OpenVolumesForRead();
+  
+  r3dOutToLog("benchfs: %s, %d files\n", g_benchArchive, fs.GetNumFiles());
+
+  const int MAX_BENCH_THREADS = 16;
+  float time1 = 0;
+  for(int numThreads=1; numThreads<=MAX_BENCH_THREADS; numThreads*=2)
+  {
+    BenchFSThreadData_s td[MAX_BENCH_THREADS];
+    HANDLE threads[MAX_BENCH_THREADS];
+  
+    float t1 = r3dGetTime();
+    for(int i=0; i<numThreads; i++)
+    {
+      td[i].fs         = &fs;
+      td[i].idx        = i;
+      td[i].numThreads = numThreads;
+      td[i].bytes      = 0;
+      td[i].files      = 0;
+      threads[i] = (HANDLE)_beginthreadex(NULL, 0, &BenchFS_ThreadEntry, &td[i], 0, NULL);
+    }
+    ::WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
+    float time = r3dGetTime() - t1;
+    
+    __int64 bytes = 0;
+    for(int i=0; i<numThreads; i++) {
+      bytes += td[i].bytes;
+      CloseHandle(threads[i]);
+    }
+    if(numThreads == 1)
+      time1 = time;
+
+    r3dOutToLog("benchfs: %2d threads: %.2f sec, %.1f mb/sec, %.2fx\n", 
+      numThreads, 
+      time, 
+      (float)bytes / 1024 / 1024 / time,
+      time1 / time);
+  }
+
+  fs.CloseVolumes();
+}
+
+//
+// archive name lookup benchmark: -benchhash
+// compares old chained HashTableDynamic with r3dTL::TStringHashMap
+//
+	bool		g_benchHash = false;
+
+struct BenchHashFunc_T
+{
+  inline int operator () ( const char * szKey )
+  {
+    return r3dHash::MakeHash( szKey );
+  }
+};
+
+void BenchNameHash()
+{
+  const int NUM_LOOKUPS = 2000000;
+  const int sizes[] = {10000, 100000, 1000000};
+  
+  for(int si=0; si<R3D_ARRAYSIZE(sizes); si++)
+  {
+    const int numKeys = sizes[si];
+    
+    // typical archive names
+    std::vector<std::string> keys(numKeys);
+    for(int i=0; i<numKeys; i++) {
+      char buf[MAX_PATH];
+      sprintf(buf, "data\\objectsdepot\\set_%03d\\textures\\object_%07d_diff.dds", i % 347, i);
+      keys[i] = buf;
+    }
+    
+    // lookup order, with 25% of misses
+    std::vector<std::string> lookups(4096);
+    for(size_t i=0; i<lookups.size(); i++) {
+      int k = (int)(((unsigned)i * 2654435761u) % numKeys);
+      lookups[i] = (i & 3) == 3 ? keys[k] + "_miss" : keys[k];
+    }
+
+    HashTableDynamic<const void*, FixedString256, BenchHashFunc_T, 1024>* oldHash = game_new HashTableDynamic<const void*, FixedString256, BenchHashFunc_T, 1024>();
+    r3dTL::TStringHashMap<const void*> newHash;
+
+    float t1 = r3dGetTime();
+    for(int i=0; i<numKeys; i++)
+      oldHash->Add(keys[i].c_str(), &keys[i]);
+    float oldAdd = r3dGetTime() - t1;
+
+    t1 = r3dGetTime();
+    for(int i=0; i<numKeys; i++)
+      newHash.Add(keys[i].c_str(), &keys[i]);
+    float newAdd = r3dGetTime() - t1;
+    
+    int found1 = 0, found2 = 0;
+    t1 = r3dGetTime();
+    for(int i=0; i<NUM_LOOKUPS; i++) {
+      const void* v = NULL;
+      found1 += oldHash->GetObject(lookups[i & 4095].c_str(), &v) ? 1 : 0;
+    }
+    float oldFind = r3dGetTime() - t1;
+
+    t1 = r3dGetTime();
+    for(int i=0; i<NUM_LOOKUPS; i++) {
+      const void* v = NULL;
+      found2 += newHash.Find(lookups[i & 4095].c_str(), &v) ? 1 : 0;
+    }
+    float newFind = r3dGetTime() - t1;
+    
+    if(found1 != found2)
+      r3dError("benchhash: results mismatch %d vs %d\n", found1, found2);
+
+    r3dOutToLog("benchhash: %7d keys: HashTableDynamic add %.3fs, find %.1f ns | TStringHashMap add %.3fs, find %.1f ns, %.1f mb\n",
+      numKeys,
+      oldAdd, oldFind * 1e9f / NUM_LOOKUPS,
+      newAdd, newFind * 1e9f / NUM_LOOKUPS,
+      (float)newHash.GetMemoryUsage() / 1024 / 1024);
+      
+    oldHash->Clear();
+    delete oldHash;
+  }
+}
+
+//
+// read throughput for each crc check mode: -benchcrc <archive base name>
+//
+	const char*	g_benchCrcArchive = NULL;
+
+static float BenchCrc_ReadAll(r3dFileSystem& fs, __int64* out_bytes)
+{
+  *out_bytes = 0;
+  
+  float t1 = r3dGetTime();
+  for(size_t i=0; i<fs.fl_.files_.size(); i++)
+  {
+    BYTE* data = NULL;
+    DWORD size = 0;
+    if(!fs.GetFileData(fs.fl_.files_[i], &data, &size))
+      r3dError("benchcrc: failed to read %s\n", fs.fl_.files_[i]->name);
+    delete[] data;
+    *out_bytes += size;
+  }
+
+  return r3dGetTime() - t1;
+}
+
+void BenchCrcModes()
+{
+  // raw kernel speed
+  {
+    const DWORD size = 64 * 1024 * 1024;
+    BYTE* buf = game_new BYTE[size];
+    for(DWORD i=0; i<size; i++)
+      buf[i] = (BYTE)(i * 7 + (i >> 8));
+    
+    float t1 = r3dGetTime();
+    DWORD crc = 0;
+    for(int i=0; i<4; i++)
+      crc ^= r3dCRC32(buf, size);
+    float time = r3dGetTime() - t1;
+    r3dOutToLog("benchcrc: r3dCRC32 %.1f mb/sec (%08x)\n", 4.0f * size / 1024 / 1024 / time, crc);
+    delete[] buf;
+  }
+
+  const char* modeNames[] = {"always", "first read", "after validate"};
+  for(int mode=r3dFileSystem::CRC_CHECK_ALWAYS; mode<=r3dFileSystem::CRC_CHECK_VALIDATED; mode++)
+  {
+    r3dFileSystem fs;
+    if(!fs.OpenArchive(g_benchCrcArchive))
+      r3dError("benchcrc: can't open archive %s\n", g_benchCrcArchive);
+    fs.SetCrcCheckMode(mode);
+    
+    if(mode == r3dFileSystem::CRC_CHECK_VALIDATED) 
+    {
+      __int64 total, cur;
+      if(!fs.ValidateArchive(true, total, cur))
+        r3dError("benchcrc: archive %s is damaged\n", g_benchCrcArchive);
+    }
+
+    fs.OpenVolumesForRead();
+    
+    // first pass reads cold entries, second one is what reloads will see
+    __int64 bytes1, bytes2;
+    float time1 = BenchCrc_ReadAll(fs, &bytes1);
+    float time2 = BenchCrc_ReadAll(fs, &bytes2);
+    
+    r3dOutToLog("benchcrc: %-14s pass1: %.1f mb/sec, pass2: %.1f mb/sec\n", 
+      modeNames[mode], 
+      (float)bytes1 / 1024 / 1024 / time1,
+      (float)bytes2 / 1024 / 1024 / time2);
+      
+    fs.CloseVolumes();
+  }
+}
+
+//
+// delta update simulation: -benchdelta <old archive base name> <new archive base name>
+// chunk store files of new archive are used as local stand-in for CDN
+//
+	const char*	g_benchDeltaOld = NULL;
+	const char*	g_benchDeltaNew = NULL;
+
+class BenchDelta_LocalSource : public r3dFSChunkSource
+{
+  public:
+	const char*	baseName_;
+	FILE*		volumes_[r3dFileSystem::MAX_VOLUMES];
+	
+	BenchDelta_LocalSource(const char* baseName) : baseName_(baseName)
+	{
+	  memset(volumes_, 0, sizeof(volumes_));
+	}
+	~BenchDelta_LocalSource()
+	{
+	  for(int i=0; i<r3dFileSystem::MAX_VOLUMES; i++)
+	    if(volumes_[i]) fclose(volumes_[i]);
+	}
+	
+	virtual bool Read(int volume, DWORD offset, DWORD size, BYTE* out_data)
+	{
+	  if(volume >= r3dFileSystem::MAX_VOLUMES)
+	    return false;
+	  if(volumes_[volume] == NULL) {
+	    char fname[MAX_PATH];
+	    sprintf(fname, "%s_ch%02d.bin", baseName_, volume);
+	    volumes_[volume] = fopen(fname, "rb");
+	    if(volumes_[volume] == NULL)
+	      return false;
+	  }
+	  
+	  fseek(volumes_[volume], offset, SEEK_SET);
+	  return fread(out_data, 1, size, volumes_[volume]) == size;
+	}
+};
+
+void BenchDeltaUpdate()
+{
+  r3dFileSystem fsold;
+  r3dFileSystem fsnew;
+  if(!fsold.OpenArchive(g_benchDeltaOld))
+    r3dError("benchdelta: can't open archive %s\n", g_benchDeltaOld);
+  if(!fsnew.OpenArchive(g_benchDeltaNew))
+    r3dError("benchdelta: can't open archive %s\n", g_benchDeltaNew);
+  fsold.OpenVolumesForRead();
+  
+  char mname[MAX_PATH];
+  sprintf(mname, "%s_cm.bin", g_benchDeltaNew);
+  r3dFile* mf = r3d_open(mname, "rb");
+  if(mf == NULL)
+    r3dError("benchdelta: no chunk manifest %s\n", mname);
+  DWORD msize = mf->size;
+  BYTE* mdata = game_new BYTE[msize + 1];
+  fread(mdata, 1, msize, mf);
+  fclose(mf);
+
+  r3dFSChunkManifest man;
+  if(!man.Load(mdata, msize))
+    r3dError("benchdelta: bad chunk manifest %s\n", mname);
+  delete[] mdata;
+  
+  BenchDelta_LocalSource src(g_benchDeltaNew);
+  r3dFSDeltaStats stats;
+  __int64 fullBytes  = 0;	// whole files download
+  __int64 deltaBytes = 0;	// with chunks
+  int     numChanged = 0;
+  int     numFallback = 0;
+  
+  float t1 = r3dGetTime();
+  for(int i=0; i<fsnew.GetNumFiles(); i++)
+  {
+    const r3dFS_FileEntry* fe  = fsnew.fl_.files_[i];
+    const r3dFS_FileEntry* old = fsold.GetFileEntry(fe->name);
+    if(old && old->crc32 == fe->crc32)
+      continue;
+      
+    numChanged++;
+    fullBytes += fe->csize;
+    
+    const r3dFSChunkManifest::file_s* mfile = man.Find(fe->name, fe->crc32);
+    BYTE* odata = NULL;
+    DWORD osize = 0;
+    if(old && !fsold.GetFileData(old, &odata, &osize))
+      r3dError("benchdelta: failed to read %s\n", old->name);
+    
+    BYTE* ndata = NULL;
+    const __int64 before = stats.downloadedBytes;
+    if(mfile && r3dFSRebuildFromChunks(man, *mfile, odata, osize, src, &ndata, &stats)) {
+      deltaBytes += stats.downloadedBytes - before;
+    } else {
+      deltaBytes += fe->csize;
+      numFallback++;
+    }
+    
+    delete[] odata;
+    delete[] ndata;
+  }
+  
+  fsold.CloseVolumes();
+  
+  r3dOutToLog("benchdelta: %d changed files, %d full downloads, %.2f sec\n", numChanged, numFallback, r3dGetTime() - t1);
+  r3dOutToLog("benchdelta: chunks reused %d (%.1f mb), downloaded %d in %d requests\n", 
+    stats.reusedChunks, (float)stats.reusedBytes / 1024 / 1024, stats.downloadedChunks, stats.requests);
+  r3dOutToLog("benchdelta: whole files %.2f mb, delta %.2f mb, saved %.1f%%\n", 
+    (float)fullBytes / 1024 / 1024, 
+    (float)deltaBytes / 1024 / 1024, 
+    fullBytes ? 100.0f * (fullBytes - deltaBytes) / fullBytes : 0.0f);
+}
+
+//
+// level data compile: -compilelevel <level dir>
+// compiles level xmls to .bin and compares loading xml with loading .bin
+//
+	const char*	g_compileLevel = NULL;
+
+void CompileLevel()
+{
+  static const char* levelFiles[] = {"LevelData", "SoundData", "ServerData"};
+
+  for(size_t i=0; i<R3D_ARRAYSIZE(levelFiles); i++)
+  {
+    char xml[MAX_PATH];
+    char bin[MAX_PATH];
+    sprintf(xml, "%s\\%s.xml", g_compileLevel, levelFiles[i]);
+    sprintf(bin, "%s\\%s.bin", g_compileLevel, levelFiles[i]);
+
+    float t1 = r3dGetTime();
+    if(!CompiledLevelFile::Compile(xml, bin)) {
+      r3dOutToLog("compilelevel: failed to compile %s\n", xml);
+      continue;
+    }
+    float compileTime = r3dGetTime() - t1;
+
+    // xml as LoadLevel_Objects takes it: read, parse, walk objects
+    t1 = r3dGetTime();
+    r3dFile* f = r3d_open(xml, "rb");
+    int xmlSize = f->size;
+    char* xmlData = game_new char[xmlSize + 1];
+    fread(xmlData, xmlSize, 1, f);
+    xmlData[xmlSize] = 0;
+    fclose(f);
+
+    int numObjects = 0;
+    int hasTerrain = 0;
+    {
+      pugi::xml_document doc;
+      doc.load_buffer_inplace(xmlData, xmlSize);
+      pugi::xml_node root = doc.first_child();
+      for(pugi::xml_node obj = root.child("object"); obj; obj = obj.next_sibling()) {
+        numObjects++;
+        hasTerrain |= !stricmp(obj.attribute("className").value(), "obj_Terrain");
+      }
+    }
+    delete[] xmlData;
+    float xmlTime = r3dGetTime() - t1;
+
+    // .bin: validate, then rebuild property nodes of every object
+    t1 = r3dGetTime();
+    CompiledLevelFile file;
+    if(!file.Open(bin, xml))
+      r3dError("compilelevel: %s doesn't load back\n", bin);
+
+    UINT32 numNodes = 0;
+    {
+      pugi::xml_document doc;
+      for(UINT32 j=0; j<file.GetHeader().ObjectCount; j++)
+        numNodes += !file.AppendNode(doc, file.GetLevelObject(j).Node).empty();
+    }
+    float binTime = r3dGetTime() - t1;
+
+    if((int)numNodes != numObjects || (int)file.GetHeader().HasTerrain != hasTerrain)
+      r3dError("compilelevel: %s has %d objects, %s %d\n", xml, numObjects, bin, numNodes);
+
+    r3dOutToLog("compilelevel: %s, %d objects, %d classes, compile %.3f sec | xml %.1f kb, %.3f sec | bin %.1f kb, %.3f sec\n",
+      levelFiles[i], numObjects, file.GetHeader().ClassCount, compileTime,
+      xmlSize / 1024.0f, xmlTime,
+      (file.GetHeader().StringOffset + file.GetHeader().StringSize) / 1024.0f, binTime);
+  }
+}
+
 void DoSomeWork()
 {
+  if(g_compileLevel) {
+    CompileLevel();
+    return;
+  }
+  if(g_benchArchive) {
+    BenchArchiveRead();
+    return;
+  }
+  if(g_benchHash) {
+    BenchNameHash();
+    return;
+  }
+  if(g_benchCrcArchive) {
+    BenchCrcModes();
+    return;
+  }
+  if(g_benchDeltaOld) {
+    BenchDeltaUpdate();
+    return;
+  }
+
   CreateArchive();
   //TestArchive();
 }
@@ -85,8 +534,39 @@ static void ParseArgs(int argc, char* argv[])
 {
   r3dOutToLog("cmd: %d\n", argc);
   for(int i=1; i<argc; i++) {
-    g_configFile = argv[i];
     r3dOutToLog("%d: %s\n", i, argv[i]);
+
+    if(strcmp(argv[i], "-benchfs") == 0 && i + 1 < argc) {
+      g_benchArchive = argv[++i];
+      continue;
+    }
+    if(strcmp(argv[i], "-benchcrc") == 0 && i + 1 < argc) {
+      g_benchCrcArchive = argv[++i];
+      continue;
+    }
+    if(strcmp(argv[i], "-benchdelta") == 0 && i + 2 < argc) {
+      g_benchDeltaOld = argv[++i];
+      g_benchDeltaNew = argv[++i];
+      continue;
+    }
+    if(strcmp(argv[i], "-nochunks") == 0) {
+      builder.createChunks_ = false;
+      continue;
+    }
+    if(strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) {
+      builder.SetNumJobs(atoi(argv[++i]));
+      continue;
+    }
+    if(strcmp(argv[i], "-compilelevel") == 0 && i + 1 < argc) {
+      g_compileLevel = argv[++i];
+      continue;
+    }
+    if(strcmp(argv[i], "-benchhash") == 0) {
+      g_benchHash = true;
+      continue;
+    }
+
+    g_configFile = argv[i];
   }
 
   return;
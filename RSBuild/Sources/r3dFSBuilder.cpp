@@ -8,7 +8,9 @@
 #include "r3dFSBuilder.h"
 #include "FileSystem/r3dFSStructs.h"
 #include "FileSystem/r3dFSCompress.h"
+#include "FileSystem/r3dFSChunks.h"
 #include "r3dMeshConvert.h"
+#include "GameLevel_Binary.h"
 
 bool pattern_match(const char *str_, const char *pattern) 
 {
@@ -94,6 +96,11 @@ r3dFSBuilder::r3dFSBuilder(const char* path)
   DWORD min   = t.wMinute;
   buildVersion_ = year | month | day | hour | min;
   
+  SYSTEM_INFO sysinfo;
+  GetSystemInfo(&sysinfo);
+  SetNumJobs(sysinfo.dwNumberOfProcessors);
+  createChunks_ = true;
+  
   return;
 }
 
@@ -101,6 +108,61 @@ r3dFSBuilder::~r3dFSBuilder()
 {
 }
 
+void r3dFSBuilder::SetNumJobs(int jobs)
+{
+  numJobs_ = R3D_MAX(jobs, 1);
+  numJobs_ = R3D_MIN(numJobs_, MAXIMUM_WAIT_OBJECTS);
+}
+
+struct r3dFSBuilderJobs
+{
+  r3dFSBuilder*	bld;
+  r3dFSBuilder::JobFunc func;
+  void*		data;
+  int		count;
+  volatile LONG	next;
+};
+
+static unsigned int __stdcall r3dFSBuilderJobThread(LPVOID in_ptr)
+{
+  r3dFSBuilderJobs* jobs = (r3dFSBuilderJobs*)in_ptr;
+  for(;;)
+  {
+    int idx = InterlockedIncrement(&jobs->next) - 1;
+    if(idx >= jobs->count)
+      break;
+    jobs->func(jobs->bld, jobs->data, idx);
+  }
+  return 0;
+}
+
+void r3dFSBuilder::RunJobs(JobFunc func, void* data, int count)
+{
+  r3dFSBuilderJobs jobs;
+  jobs.bld   = this;
+  jobs.func  = func;
+  jobs.data  = data;
+  jobs.count = count;
+  jobs.next  = 0;
+
+  int numThreads = R3D_MIN(numJobs_, count);
+  if(numThreads <= 1) {
+    r3dFSBuilderJobThread(&jobs);
+    return;
+  }
+
+  HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+  for(int i=0; i<numThreads; i++) {
+    threads[i] = (HANDLE)_beginthreadex(NULL, 0, r3dFSBuilderJobThread, &jobs, 0, NULL);
+    if(threads[i] == NULL)
+      r3dError("RunJobs: failed to begin thread");
+  }
+
+  WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
+  for(int i=0; i<numThreads; i++)
+    CloseHandle(threads[i]);
+}
+
 void r3dFSBuilder::AddExclude(const char* name, EMatchType type)
 {
   match_s match;
@@ -202,13 +264,34 @@ bool r3dFSBuilder::BuildFileList()
   r3d_assert(flist_.size() == 0);
   flist_.reserve(32000);
   
-  ScanDirectory(NULL);
-  r3dOutToLog(" %d files\n", flist_.size());
+  float t1 = r3dGetTime();
+  ScanDirectoryParallel();
+  r3dOutToLog(" %d files, %.2f sec\n", flist_.size(), r3dGetTime() - t1);
   
   return true;
 }
 
-void r3dFSBuilder::ScanDirectory(const char* dir)
+static void ScanPartJob(r3dFSBuilder* bld, void* data, int idx)
+{
+  r3dFSBuilder::scanpart_s& part = (*(std::vector<r3dFSBuilder::scanpart_s>*)data)[idx];
+  if(part.dir[0])
+    bld->ScanDirectory(part.dir, part.files);
+}
+
+// top directory is scanned first, every subdirectory of it is scanned by separate job.
+// parts are merged back in scan order, so file list is the same as from ScanDirectory(NULL)
+void r3dFSBuilder::ScanDirectoryParallel()
+{
+  std::vector<scanpart_s> parts;
+  ScanDirectory(NULL, flist_, &parts);
+
+  RunJobs(&ScanPartJob, &parts, (int)parts.size());
+
+  for(size_t i=0; i<parts.size(); i++)
+    flist_.insert(flist_.end(), parts[i].files.begin(), parts[i].files.end());
+}
+
+void r3dFSBuilder::ScanDirectory(const char* dir, std::vector<file_s>& out, std::vector<scanpart_s>* parts)
 {
   WIN32_FIND_DATA ffblk;
   HANDLE hFind;
@@ -243,7 +326,13 @@ void r3dFSBuilder::ScanDirectory(const char* dir)
     // recurse to directory
     if(isDir) 
     {
-      ScanDirectory(buf);
+      if(parts) {
+        // delay it to separate job
+        parts->resize(parts->size() + 1);
+        strcpy(parts->back().dir, buf);
+      } else {
+        ScanDirectory(buf, out);
+      }
     } 
     else 
     {
@@ -255,7 +344,16 @@ void r3dFSBuilder::ScanDirectory(const char* dir)
       file_s f;
       strcpy(f.name, buf);
       f.size  = ffblk.nFileSizeLow;
-      flist_.push_back(f);
+      
+      if(parts) {
+        if(parts->empty() || parts->back().dir[0]) {
+          parts->resize(parts->size() + 1);
+          parts->back().dir[0] = 0;
+        }
+        parts->back().files.push_back(f);
+      } else {
+        out.push_back(f);
+      }
     }
     
   } while(FindNextFile(hFind, &ffblk) != 0);
@@ -287,15 +385,18 @@ void r3dFSBuilder::CreateFileSystem()
   size_t numFiles = flist_.size();
   r3d_assert(numFiles);
   
+  float t1 = r3dGetTime();
   fs_ = new r3dFileSystem();
   fs_->fl_.files_.reserve(numFiles);
   fs_->fl_.buildVersion_ = buildVersion_;
   //fs_->VOLUME_SIZE = 250 * 1024 * 1024; // force s3 amazon max upload size
   fs_->VOLUME_SIZE = 1024 * 1024 * 1024; // no more problems with amazon. using BucketExplorer to upload files
+  
+  CalcBaseArchiveCrcs();
 
   for(size_t i=0; i<numFiles; i++) 
   {
-    if(ExistInBaseArchive(flist_[i], i, numFiles))
+    if(ExistInBaseArchive(flist_[i]))
       continue;
   
     r3dFS_FileEntry* fe = fs_->fl_.AddNew(flist_[i].name);
@@ -303,6 +404,7 @@ void r3dFSBuilder::CreateFileSystem()
     fe->flags |= DetectFileFlags(fe->name);
   }
   
+  r3dOutToLog("%d new or changed files, %.2f sec\n", fs_->GetNumFiles(), r3dGetTime() - t1);
   return;
 }
 
@@ -322,7 +424,45 @@ bool r3dFSBuilder::OpenBaseArchive(const char* base)
   return true;
 }
 
-bool r3dFSBuilder::ExistInBaseArchive(const file_s& file, int curFile, int totFiles)
+static void CrcJob(r3dFSBuilder* bld, void* data, int idx)
+{
+  r3dFSBuilder::file_s& file = *((r3dFSBuilder::file_s**)data)[idx];
+  
+  DWORD size;
+  if(!r3dGetFileCrc32(file.name, &file.crc32, &size))
+    r3dError("Can't get crc for file %s\n", file.name);
+  file.crcValid = true;
+}
+
+// read all files with same size as in base archive, crc is needed to detect change
+void r3dFSBuilder::CalcBaseArchiveCrcs()
+{
+  if(basefs_ == NULL)
+    return;
+
+  std::vector<file_s*> tocheck;
+  __int64 totalSize = 0;
+  for(size_t i=0; i<flist_.size(); i++)
+  {
+    const r3dFS_FileEntry* fe = basefs_->GetFileEntry(flist_[i].name);
+    if(fe == NULL || fe->size != flist_[i].size)
+      continue;
+      
+    tocheck.push_back(&flist_[i]);
+    totalSize += flist_[i].size;
+  }
+  
+  if(tocheck.empty())
+    return;
+
+  r3dOutToLog("comparing %d files, %.0f mb\n", tocheck.size(), (float)totalSize / 1024 / 1024);
+  
+  float t1 = r3dGetTime();
+  RunJobs(&CrcJob, &tocheck[0], (int)tocheck.size());
+  r3dOutToLog("crc done, %.2f sec\n", r3dGetTime() - t1);
+}
+
+bool r3dFSBuilder::ExistInBaseArchive(const file_s& file)
 {
   if(basefs_ == NULL)
     return false;
@@ -338,13 +478,8 @@ bool r3dFSBuilder::ExistInBaseArchive(const file_s& file, int curFile, int totFi
   }
   
   // need to compare CRC
-  r3dOutToLog("comparing [%04d/%04d]\r", curFile+1, totFiles); //file.name
-
-  DWORD crc32;
-  DWORD size;
-  if(!r3dGetFileCrc32(file.name, &crc32, &size))
-    r3dError("Can't get crc for file %s\n", file.name);
-  if(crc32 != fe->crc32) {
+  r3d_assert(file.crcValid);
+  if(file.crc32 != fe->crc32) {
     r3dOutToLog("changed file %s\n", file.name);
     return false;
   }
@@ -364,7 +499,7 @@ bool r3dFSBuilder::CheckTextures()
   CLOG_INDENT;
   
   flist_.reserve(32000);
-  ScanDirectory(NULL);
+  ScanDirectoryParallel();
   
   int numBads = 0;
   
@@ -417,7 +552,7 @@ bool r3dFSBuilder::ReconvertAllSCO()
   CLOG_INDENT;
   
   flist_.reserve(32000);
-  ScanDirectory(NULL);
+  ScanDirectoryParallel();
   
   int stat1 = 0;
   int stat2 = 0;
@@ -485,6 +620,91 @@ bool r3dFSBuilder::ReconvertAllSCO()
   return true;
 }
 
+struct compilelevel_s
+{
+  char		xml[MAX_PATH];
+  char		bin[MAX_PATH];
+  int		result;		// 0 - up to date, 1 - compiled, -1 - failed
+};
+
+static void CompileLevelJob(r3dFSBuilder* bld, void* data, int idx)
+{
+  compilelevel_s& lvl = ((compilelevel_s*)data)[idx];
+
+  CompiledLevelFile bin;
+  if(bin.Open(lvl.bin, lvl.xml)) {
+    lvl.result = 0;
+    return;
+  }
+  bin.Close();
+
+  lvl.result = CompiledLevelFile::Compile(lvl.xml, lvl.bin) ? 1 : -1;
+}
+
+bool r3dFSBuilder::CompileLevelData()
+{
+  if(flist_.size() != 0) {
+    r3dError("CompileLevelData() must be called before all\n");
+    return false;
+  }
+
+  static const char* levelFiles[] = {"LevelData.xml", "SoundData.xml", "ServerData.xml"};
+
+  // do a temporary scan for files, search level xmls after that
+  r3dOutToLog("Scanning for level data files\n");
+  CLOG_INDENT;
+
+  flist_.reserve(32000);
+  ScanDirectoryParallel();
+
+  std::vector<compilelevel_s> levels;
+
+  for(size_t i=0; i<flist_.size(); i++)
+  {
+    const char* xml = flist_[i].name;
+    const char* name = strrchr(xml, '\\');
+    name = name ? name + 1 : xml;
+
+    for(size_t j=0; j<R3D_ARRAYSIZE(levelFiles); j++)
+    {
+      if(stricmp(name, levelFiles[j]) != 0)
+        continue;
+
+      compilelevel_s lvl;
+      r3dscpy(lvl.xml, xml);
+      r3dscpy(lvl.bin, xml);
+      strcpy(lvl.bin + strlen(lvl.bin) - 4, ".bin");
+      lvl.result = 0;
+      levels.push_back(lvl);
+      break;
+    }
+  }
+
+  flist_.clear();
+
+  if(levels.empty())
+    return true;
+
+  float t1 = r3dGetTime();
+  RunJobs(&CompileLevelJob, &levels[0], (int)levels.size());
+
+  int stat1 = 0;
+  for(size_t i=0; i<levels.size(); i++)
+  {
+    if(levels[i].result < 0)
+      r3dError("failed to compile %s\n", levels[i].xml);
+
+    if(levels[i].result > 0) {
+      r3dOutToLog("* %s\n", levels[i].xml);
+      stat1++;
+    }
+  }
+
+  r3dOutToLog("%d level files compiled, %d up to date, %.2f sec\n", stat1, (int)levels.size() - stat1, r3dGetTime() - t1);
+
+  return true;
+}
+
 void r3dFSBuilder::FilterOutSCO()
 {
   r3dOutToLog("Filtering out unneeded .sco\n");
@@ -620,7 +840,10 @@ bool r3dFSBuilder::CreateArchive()
 
   r3dOutToLog("Creating%s archive %s\n", basefs_ ? " incremental" : "", vname);
   CLOG_INDENT;
-  fs_->BuildNewArchive(vname);
+  fs_->BuildNewArchive(vname, numJobs_);
+  
+  if(createChunks_)
+    CreateChunkStore(vname);
 
   char xmlname[MAX_PATH];
   sprintf(xmlname, "%s\\%s.xml", outputDir_, outputBaseName_);
@@ -653,6 +876,155 @@ bool r3dFSBuilder::CreateArchive()
   return true;
 }
 
+struct chunkjob_s
+{
+  const r3dFS_FileEntry* fe;
+  std::vector<r3dFSChunk> chunks;	// offset is in cdata
+  std::vector<BYTE> cdata;
+};
+
+static void ChunkJob(r3dFSBuilder* bld, void* data, int idx)
+{
+  chunkjob_s& job = ((chunkjob_s*)data)[idx];
+  const r3dFS_FileEntry& fe = *job.fe;
+  
+  // archive data was built from the same files
+  FILE* f = fopen(fe.name, "rb");
+  if(f == NULL)
+    r3dError("CreateChunkStore: can't open %s\n", fe.name);
+  BYTE* fdata = game_new BYTE[fe.size + 1];
+  if(fread(fdata, 1, fe.size, f) != fe.size)
+    r3dError("CreateChunkStore: failed to read %s\n", fe.name);
+  fclose(f);
+  
+  std::vector<DWORD> ends;
+  r3dFSSplitChunks(fdata, fe.size, ends);
+  job.chunks.resize(ends.size());
+
+  r3dFSCompress compress;
+  DWORD start = 0;
+  for(size_t i=0; i<ends.size(); i++)
+  {
+    r3dFSChunk& ch = job.chunks[i];
+    const BYTE* cur = fdata + start;
+    memset(&ch, 0, sizeof(ch));
+    ch.size   = ends[i] - start;
+    ch.crc32  = r3dCRC32(cur, ch.size);
+    ch.hash2  = r3dFSChunkHash2(cur, ch.size);
+    ch.offset = (DWORD)job.cdata.size();
+    
+    // stored files are not worth compressing chunk by chunk either
+    BYTE* cdata = NULL;
+    DWORD csize = 0;
+    if(fe.cmethod != r3dFSCompress::COMPRESS_STORE && compress.CompressInflate(cur, ch.size, &cdata, &csize) && csize < ch.size) {
+      ch.cmethod = r3dFSCompress::COMPRESS_INFLATE;
+      ch.csize   = csize;
+      job.cdata.insert(job.cdata.end(), cdata, cdata + csize);
+    } else {
+      ch.cmethod = r3dFSCompress::COMPRESS_STORE;
+      ch.csize   = ch.size;
+      job.cdata.insert(job.cdata.end(), cur, cur + ch.size);
+    }
+    delete[] cdata;
+    
+    start = ends[i];
+  }
+  
+  delete[] fdata;
+}
+
+// write deduplicated chunks of all archive files to <vname>_chNN.bin and chunk manifest to <vname>_cm.bin
+void r3dFSBuilder::CreateChunkStore(const char* vname)
+{
+  r3dOutToLog("Creating chunk store\n");
+  CLOG_INDENT;
+  
+  const DWORD CHUNK_VOLUME_SIZE = 1024 * 1024 * 1024;
+  
+  float t1 = r3dGetTime();
+  
+  typedef std::map<std::pair<unsigned __int64, DWORD>, r3dFSChunk> ChunksMap;
+  ChunksMap stored;
+  
+  r3dFSChunkManifest man;
+  int   volume = 0;
+  DWORD volumeSize = 0;
+  FILE* f = NULL;
+  
+  __int64 stat_size = 0;
+  __int64 stat_csize = 0;
+  int     stat_chunks = 0;
+  
+  // files are processed by batches, so only few of them are in memory
+  const int numFiles  = fs_->GetNumFiles();
+  const int batchSize = numJobs_ * 2;
+  std::vector<chunkjob_s> jobs;
+  for(int b=0; b<numFiles; b+=batchSize)
+  {
+    const int count = R3D_MIN(batchSize, numFiles - b);
+    jobs.clear();
+    jobs.resize(count);
+    for(int i=0; i<count; i++)
+      jobs[i].fe = fs_->fl_.files_[b + i];
+      
+    RunJobs(&ChunkJob, &jobs[0], count);
+    
+    // ordered writer
+    for(int i=0; i<count; i++)
+    {
+      chunkjob_s& job = jobs[i];
+      for(size_t c=0; c<job.chunks.size(); c++)
+      {
+        r3dFSChunk& ch = job.chunks[c];
+        stat_size += ch.size;
+        stat_chunks++;
+        
+        std::pair<unsigned __int64, DWORD> key(((unsigned __int64)ch.crc32 << 32) | ch.hash2, ch.size);
+        ChunksMap::const_iterator it = stored.find(key);
+        if(it != stored.end()) {
+          ch = it->second;
+          continue;
+        }
+        
+        if(f == NULL || volumeSize + ch.csize > CHUNK_VOLUME_SIZE) 
+        {
+          if(f) {
+            fclose(f);
+            volume++;
+          }
+          
+          char fname[MAX_PATH];
+          sprintf(fname, "%s_ch%02d.bin", vname, volume);
+          f = fopen_for_write(fname, "wb");
+          if(f == NULL)
+            r3dError("can't open %s for writing\n", fname);
+          volumeSize = 0;
+        }
+        
+        fwrite(&job.cdata[ch.offset], 1, ch.csize, f);
+        ch.volume = (BYTE)volume;
+        ch.offset = volumeSize;
+        volumeSize += ch.csize;
+        stat_csize += ch.csize;
+        
+        stored.insert(ChunksMap::value_type(key, ch));
+      }
+      
+      man.AddFile(job.fe->name, job.fe->crc32, job.fe->size, job.chunks.empty() ? NULL : &job.chunks[0], (DWORD)job.chunks.size());
+    }
+  }
+  
+  if(f)
+    fclose(f);
+  
+  char mname[MAX_PATH];
+  sprintf(mname, "%s_cm.bin", vname);
+  if(!man.Save(mname))
+    r3dError("can't write chunk manifest %s\n", mname);
+
+  r3dOutToLog("%d chunks, %d unique, %I64d -> %I64d, %.2f sec\n", stat_chunks, stored.size(), stat_size, stat_csize, r3dGetTime() - t1);
+}
+
 void r3dFSBuilder::DeleteVolumes()
 {
   if(fs_ == NULL)
@@ -9,11 +9,15 @@ class r3dFSBuilder
 	{
 	  char		name[MAX_PATH];
 	  DWORD		size;
+	  DWORD		crc32;		// valid only if crcValid
+	  bool		crcValid;
 	  
 	  file_s()
 	  {
-	    name[0] = 0;
-	    size    = -1;
+	    name[0]  = 0;
+	    size     = -1;
+	    crc32    = 0;
+	    crcValid = false;
 	  }
 	};
 	
@@ -22,6 +26,8 @@ class r3dFSBuilder
 	char		outputBaseName_[MAX_PATH];
 	char		basePath_[MAX_PATH];
 	DWORD		buildVersion_;
+	int		numJobs_;	// worker threads for scan/crc/compression
+	bool		createChunks_;	// write chunk store for delta updates
 	
 	enum EMatchType
 	{
@@ -43,16 +49,30 @@ class r3dFSBuilder
 	bool		ShouldExclude(const char* full, const char* name, int isDir);
 	bool		IsDefaultSkippedDir(const char* name);
 
-	void		ScanDirectory(const char* dir);
+	// part of file list, filled by separate scan job
+	struct scanpart_s
+	{
+	  char		dir[MAX_PATH];	// empty for files from top directory
+	  std::vector<file_s> files;
+	};
+
+	void		ScanDirectory(const char* dir, std::vector<file_s>& out, std::vector<scanpart_s>* parts = NULL);
+	void		ScanDirectoryParallel();
+
+	// run func(this, data, idx) for idx in [0..count) on numJobs_ threads
+	typedef void (*JobFunc)(r3dFSBuilder* bld, void* data, int idx);
+	void		RunJobs(JobFunc func, void* data, int count);
 	DWORD		DetectFileFlags(const char* fname);
 
 	r3dFileSystem*	basefs_;
-	bool		ExistInBaseArchive(const file_s& file, int curFile, int totFiles);
+	bool		ExistInBaseArchive(const file_s& file);
+	void		CalcBaseArchiveCrcs();
 	
 	r3dFileSystem*	fs_;
 	void		CreateFileSystem();
 	void		FilterOutSCO();
 	void		FilterAndDeleteLostSCB();
+	void		CreateChunkStore(const char* vname);
   
   public:
 	r3dFSBuilder(const char* path);
@@ -61,8 +81,11 @@ class r3dFSBuilder
 	void		AddExclude(const char* name, EMatchType type = MATCH_FULL);
 	//@NOTE: include does work only on file level, excluded directories skipped completely for now
 	void		AddInclude(const char* name, EMatchType type = MATCH_FULL);
+	
+	void		SetNumJobs(int jobs);
 
 	bool		ReconvertAllSCO();
+	bool		CompileLevelData();
 	bool		CheckTextures();
 		
 	bool		OpenBaseArchive(const char* base);
@@ -3,6 +3,23 @@
 
 #include "HttpDownload.h"
 
+// scheme decides ssl, port is taken from url if present, i.e. local test server at http://localhost:8080/
+static int GetUrlPort(const char* url, bool* out_ssl)
+{
+  *out_ssl = strnicmp(url, "https://", 8) == 0;
+  int port = *out_ssl ? 443 : 80;
+
+  if(const char* host = strstr(url, "://")) {
+    host += 3;
+    const char* colon = strchr(host, ':');
+    const char* slash = strchr(host, '/');
+    if(colon && (slash == NULL || colon < slash))
+      port = atoi(colon + 1);
+  }
+  
+  return port;
+}
+
 HttpDownload::HttpDownload() :
  prg_(_base_progress)
 {
@@ -101,11 +118,10 @@ bool HttpDownload::Get(const char* full_url, CkByteData& data, DWORD start, DWOR
     req.AddHeader("Range", range);
   }
   
-  int port = 80;
-  if(strnicmp(full_url, "https", 5) == 0)
-    port = 443;
+  bool ssl;
+  int  port = GetUrlPort(full_url, &ssl);
 
-  CkHttpResponse* resp = http_.SynchronousRequest(domain, port, port != 80, req);
+  CkHttpResponse* resp = http_.SynchronousRequest(domain, port, ssl, req);
   if(!resp) {
     r3dOutToLog("!resp %s\n", http_.lastErrorText());
     return false;
@@ -135,7 +151,8 @@ bool HttpDownload::Get(const char* full_url, CkByteData& data, DWORD start, DWOR
     delete resp;
 
     domain = http_.getDomain(relocatedUrl_);
-    resp = http_.SynchronousRequest(domain, 80, false, req2);
+    port   = GetUrlPort(relocatedUrl_, &ssl);
+    resp = http_.SynchronousRequest(domain, port, ssl, req2);
     if(!resp) {
       r3dOutToLog("!resp %s redirected\n", http_.lastErrorText());
       return false;
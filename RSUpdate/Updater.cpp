@@ -93,6 +93,8 @@ CUpdater::CUpdater()
   updaterVersionOk_ = false;
   
   numUpdatedFiles_ = 0;
+  deltaFullBytes_  = 0;
+  deltaNumFiles_   = 0;
 
   mainThread_   = NULL;
   newsThread_   = NULL;
@@ -326,6 +328,11 @@ void CUpdater::MarkUpdatedFiles(const r3dFS_FileList& fl, bool incremental)
       updjob_s* job = new updjob_s();
       job->isInc = incremental;
       job->fe    = &fe;
+      if(!isNew && fe_local->IsValid()) {
+        // keep copy, local entry can be changed by the time job is processed
+        job->hasOld = true;
+        job->oldFe  = *fe_local;
+      }
       updateJobs_.push_back(job);
       
       prgTotal_.total += fe.csize;
@@ -433,6 +440,9 @@ void CUpdater::FinalizeJob(const updjob_s& job)
   }
   *fe = *job.fe;
   fe->flags |= r3dFS_FileEntry::FLAG_UPDATE_EXIST;
+  // data can be recompressed locally after delta rebuild
+  fe->cmethod = (BYTE)job.cmethod;
+  fe->csize   = job.data.getSize();
   
   // place it to archive
   int   volume;
@@ -443,7 +453,7 @@ void CUpdater::FinalizeJob(const updjob_s& job)
 
   fswork_.WriteFileData(*fe, job.data.getBytes(), job.data.getSize());
 
-  prgTotal_.cur += fe->csize;
+  prgTotal_.cur += job.fe->csize;
 
   if(fe->flags & r3dFS_FileEntry::FLAG_EXTRACT) {
     ExtractJobFile(fe, job.data);
@@ -603,6 +613,13 @@ bool CUpdater::ProcessUpdates()
     }
   }
 
+  if(deltaNumFiles_) {
+    r3dOutToLog("delta update: %d files, %d chunks reused, %d downloaded in %d requests\n", 
+      deltaNumFiles_, deltaStats_.reusedChunks, deltaStats_.downloadedChunks, deltaStats_.requests);
+    r3dOutToLog("delta update: downloaded %I64d bytes instead of %I64d, saved %I64d\n", 
+      deltaStats_.downloadedBytes, deltaFullBytes_, deltaFullBytes_ - deltaStats_.downloadedBytes);
+  }
+
   RemoveDeletedFiles();
   
   // finally set our build version to indicate that we're done.
@@ -660,6 +677,94 @@ void CUpdater::MakeSureExtractedFilesExists()
   return;
 }
 
+// read old file version from local volumes. fswork_ is writing to same volumes at this time,
+// so data is read by shared handle instead of mapping. old data is never overwritten by update
+bool CUpdater::ReadLocalFileData(const r3dFS_FileEntry& fe, BYTE** out_data, DWORD* out_size)
+{
+  char fname[MAX_PATH];
+  fslocal_.GetVolumeName(fname, fe.volume + 1);
+  
+  HANDLE h = ::CreateFile(fname, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(h == INVALID_HANDLE_VALUE)
+    return false;
+    
+  const DWORD readSize = fe.csize + sizeof(r3dFS_FileHeader);
+  BYTE* cdata = new BYTE[readSize];
+  DWORD bytesRead = 0;
+  bool res = ::SetFilePointer(h, fe.offset, NULL, FILE_BEGIN) != INVALID_SET_FILE_POINTER &&
+             ::ReadFile(h, cdata, readSize, &bytesRead, NULL) && 
+             bytesRead == readSize &&
+             ((const r3dFS_FileHeader*)cdata)->id == r3dFS_FileHeader::ID;
+  ::CloseHandle(h);
+  
+  BYTE* data = NULL;
+  if(res)
+  {
+    r3dFSCompress comp;
+    comp.failOnError = false;
+    data = new BYTE[fe.size + 1];
+    res = comp.Decompress(fe.name, fe.cmethod, cdata + sizeof(r3dFS_FileHeader), fe.csize, fe.size, data, out_size) &&
+          *out_size == fe.size &&
+          r3dCRC32(data, fe.size) == fe.crc32;
+  }
+  delete[] cdata;
+  
+  if(!res) {
+    delete[] data;
+    return false;
+  }
+  
+  *out_data = data;
+  return true;
+}
+
+// try to rebuild file from old local version and changed chunks
+bool CUpdater::DlThread_ProcessDelta(updjob_s& job, HttpDownload& http)
+{
+  const r3dHttpFS& fs = job.isInc ? fsinc_ : fsbase_;
+  if(!job.hasOld || !fs.chunks_.IsValid() || fs.chunks_.Find(job.fe->name, job.fe->crc32) == NULL)
+    return false;
+    
+  BYTE* oldData = NULL;
+  DWORD oldSize = 0;
+  if(!ReadLocalFileData(job.oldFe, &oldData, &oldSize))
+    return false;
+    
+  r3dFSDeltaStats stats;
+  BYTE* data = NULL;
+  bool res = fs.GetFileDelta(http, *job.fe, oldData, oldSize, &data, &stats);
+  delete[] oldData;
+  if(!res)
+    return false;
+    
+  // compress it back the same way builder did
+  r3dFSCompress comp;
+  BYTE* cdata = NULL;
+  DWORD csize = 0;
+  job.cmethod = job.fe->cmethod == r3dFSCompress::COMPRESS_STORE ? r3dFSCompress::COMPRESS_STORE : r3dFSCompress::COMPRESS_INFLATE;
+  if(job.fe->size == 0 || job.cmethod == r3dFSCompress::COMPRESS_STORE || !comp.CompressInflate(data, job.fe->size, &cdata, &csize) || csize > job.fe->size) {
+    delete[] cdata;
+    job.cmethod = r3dFSCompress::COMPRESS_STORE;
+    job.data.append2(data, job.fe->size);
+  } else {
+    job.data.append2(cdata, csize);
+    delete[] cdata;
+  }
+  delete[] data;
+
+  ::EnterCriticalSection(&csJobs_);
+  deltaStats_.reusedBytes      += stats.reusedBytes;
+  deltaStats_.downloadedBytes  += stats.downloadedBytes;
+  deltaStats_.reusedChunks     += stats.reusedChunks;
+  deltaStats_.downloadedChunks += stats.downloadedChunks;
+  deltaStats_.requests         += stats.requests;
+  deltaFullBytes_ += job.fe->csize;
+  deltaNumFiles_++;
+  ::LeaveCriticalSection(&csJobs_);
+  
+  return true;
+}
+
 bool CUpdater::DlThread_ProcessJob(updjob_s& job, int dlIdx)
 {
   char dbgmsg[256];
@@ -675,6 +780,12 @@ bool CUpdater::DlThread_ProcessJob(updjob_s& job, int dlIdx)
 
     job.data.clear();
     HttpDownload http(&prgHttp_[dlIdx]);
+    
+    // only first try is delta, after error just download whole file
+    if(curRetry == 0 && DlThread_ProcessDelta(job, http))
+      break;
+    job.data.clear();
+    job.cmethod = job.fe->cmethod;
   
     bool       res;
     if(job.isInc)
@@ -1544,9 +1655,8 @@ void CUpdater::Stop()
       SetRSUpdateStatus(10); // just aborted in middle
   }
 
-  // wait for any archive operations
-  extern CRITICAL_SECTION g_FileSysCritSection;
-  r3dCSHolder csHolder1(g_FileSysCritSection);
+  // wait for any archive operations, including lock-free readers
+  r3dFS_WriteLock wrLock1;
   
   // terminate thread only when header write operation not in progress
   r3dCSHolder csHolder2(csDataWrite_);
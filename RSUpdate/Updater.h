@@ -63,12 +63,23 @@ class CUpdater
 	  bool isInc;                // updating from incremental archive
 	  const r3dFS_FileEntry* fe; // ptr
 	  CkByteData data;
+	  int  cmethod;              // of data, can differ from fe for delta rebuilt files
+	  
+	  bool hasOld;               // old version of file exist in local archive
+	  r3dFS_FileEntry oldFe;
+	  
+	  updjob_s() : isInc(false), fe(NULL), cmethod(0), hasOld(false) {}
 	};
 	std::list<updjob_s*> updateJobs_;
 	std::list<updjob_s*> readyJobs_;
 	CRITICAL_SECTION csJobs_;
 	int		numUpdatedFiles_;
 	
+	// delta update stats, guarded by csJobs_
+	r3dFSDeltaStats	deltaStats_;
+	__int64		deltaFullBytes_;	// size of files updated by delta, if downloaded whole
+	int		deltaNumFiles_;
+	
 	CRITICAL_SECTION csDataWrite_;
 
 	enum EUpdaterStatus
@@ -108,6 +119,8 @@ class CUpdater
 	friend static unsigned int __stdcall CUpdater_DownloadThreadEntry(LPVOID in);
 	void		DownloadThreadEntry();
 	bool		 DlThread_ProcessJob(updjob_s& job, int dlIdx);
+	bool		 DlThread_ProcessDelta(updjob_s& job, HttpDownload& http);
+	bool		 ReadLocalFileData(const r3dFS_FileEntry& fe, BYTE** out_data, DWORD* out_size);
 	volatile LONG	 dlThreadIdx_;
 	volatile LONG	 dlThreadError_; // TRUE if one of download thread failed
 
@@ -48,6 +48,19 @@ bool r3dHttpFS::OpenFromWeb(const char* baseUrl, updProgress* upd)
     maxVolume = R3D_MAX(maxVolume, (int)files_[j]->volume);
   }
 
+  // chunk manifest, archives from old builder don't have it
+  {
+    char url[512];
+    sprintf(url, "%s_cm.bin", baseUrl_);
+
+    CkByteData data2;
+    HttpDownload http2(upd);
+    if(http2.Get(url, data2) && chunks_.Load(data2.getBytes(), data2.getSize()))
+      r3dOutToLog("chunk manifest: %d files, %d chunks\n", chunks_.files_.size(), chunks_.chunks_.size());
+    else
+      r3dOutToLog("no chunk manifest, delta updates disabled\n");
+  }
+
   // ptumik:
   // disabled redirect. Right now CDN doesn't redirect us, and for some people this code isn't working. Just being stuck forever. 
   // I think it might be something to do with putting a HTML header range-bytes:0-0, as I think it is trying to read the whole file, which is one gig.
@@ -122,3 +135,39 @@ bool r3dHttpFS::GetFile(HttpDownload& http, const r3dFS_FileEntry& fe, CkByteDat
   
   return true;
 }
+
+class r3dHttpChunkSource : public r3dFSChunkSource
+{
+  public:
+	HttpDownload&	http_;
+	const char*	baseUrl_;
+	
+	r3dHttpChunkSource(HttpDownload& http, const char* baseUrl) : http_(http), baseUrl_(baseUrl) {}
+	
+	virtual bool Read(int volume, DWORD offset, DWORD size, BYTE* out_data)
+	{
+	  char url[1024];
+	  sprintf(url, "%s_ch%02d.bin", baseUrl_, volume);
+	  
+	  CkByteData data;
+	  if(!http_.Get(url, data, offset, size))
+	    return false;
+	  if(data.getSize() != size) {
+	    r3dOutToLog("httpFS chunks (%d:%d), bad received size\n", volume, offset);
+	    return false;
+	  }
+	    
+	  memcpy(out_data, data.getBytes(), size);
+	  return true;
+	}
+};
+
+bool r3dHttpFS::GetFileDelta(HttpDownload& http, const r3dFS_FileEntry& fe, const BYTE* oldData, DWORD oldSize, BYTE** out_data, r3dFSDeltaStats* stats) const
+{
+  const r3dFSChunkManifest::file_s* file = chunks_.Find(fe.name, fe.crc32);
+  if(file == NULL || file->size != fe.size)
+    return false;
+
+  r3dHttpChunkSource src(http, baseUrl_);
+  return r3dFSRebuildFromChunks(chunks_, *file, oldData, oldSize, src, out_data, stats);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "FileSystem/r3dFileSystem.h"
+#include "FileSystem/r3dFSChunks.h"
 #include "CkByteData.h"
 
 class HttpDownload;
@@ -11,6 +12,9 @@ class r3dHttpFS : public r3dFS_FileList
   public:
 	char		baseUrl_[512];
 	char		volumeUrl_[r3dFileSystem::MAX_VOLUMES][1024];
+	
+	// optional chunk manifest for delta updates, invalid if archive was built without it
+	r3dFSChunkManifest chunks_;
 
   public:
 	r3dHttpFS();
@@ -18,4 +22,6 @@ class r3dHttpFS : public r3dFS_FileList
 
 	bool		OpenFromWeb(const char* baseUrl, updProgress* upd);
 	bool		GetFile(HttpDownload& http, const r3dFS_FileEntry& fe, CkByteData& data) const;
+	// rebuild file from old version data and missing chunks, out_data is uncompressed file
+	bool		GetFileDelta(HttpDownload& http, const r3dFS_FileEntry& fe, const BYTE* oldData, DWORD oldSize, BYTE** out_data, r3dFSDeltaStats* stats) const;
 };
\ No newline at end of file
@@ -0,0 +1,121 @@
+// standalone check of r3dFSMappedFile (POSIX mmap path) outside of the engine.
+// build & run from repository root:
+//   g++ -O2 -Wall -IEternity/Source/FileSystem Tools/FSVolumeMapTest/FSVolumeMapTest.cpp Eternity/Source/FileSystem/r3dFSVolumeMap.cpp -o FSVolumeMapTest
+//   ./FSVolumeMapTest
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "r3dFSVolumeMap.h"
+
+static int numFailed = 0;
+
+#define CHECK(x) \
+  if(!(x)) { printf("FAILED: %s, line %d\n", #x, __LINE__); numFailed++; }
+
+static unsigned char PatternByte(long long pos)
+{
+  return (unsigned char)((pos * 131) ^ (pos >> 8));
+}
+
+static void CheckRegion(const r3dFSMappedFile& mf, long long offset, size_t size)
+{
+  void*  base    = NULL;
+  size_t mapSize = 0;
+  const unsigned char* data = mf.MapRegion(offset, size, &base, &mapSize);
+  CHECK(data != NULL);
+  if(data == NULL)
+    return;
+
+  CHECK(base != NULL && mapSize >= size);
+  CHECK((size_t)(data - (const unsigned char*)base) == (size_t)(offset % (long long)r3dFSMappedFile::GetGranularity()));
+
+  size_t bad = 0;
+  for(size_t i=0; i<size; i++)
+    if(data[i] != PatternByte(offset + i))
+      bad++;
+  CHECK(bad == 0);
+
+  r3dFSMappedFile::UnmapRegion(base, mapSize);
+}
+
+int main()
+{
+  const size_t gran = r3dFSMappedFile::GetGranularity();
+  CHECK(gran > 0 && (gran & (gran - 1)) == 0);
+
+  // volume of few granularity pages with odd tail
+  char fname[] = "/tmp/r3dFSVolumeMapTestXXXXXX";
+  int fd = mkstemp(fname);
+  CHECK(fd >= 0);
+  if(fd < 0)
+    return 1;
+
+  const long long fileSize = (long long)gran * 3 + 123;
+  unsigned char* buf = (unsigned char*)malloc((size_t)fileSize);
+  for(long long i=0; i<fileSize; i++)
+    buf[i] = PatternByte(i);
+  CHECK(write(fd, buf, (size_t)fileSize) == (ssize_t)fileSize);
+  close(fd);
+  free(buf);
+
+  {
+    r3dFSMappedFile mf;
+    CHECK(!mf.IsOpen());
+    CHECK(mf.Open(fname));
+    CHECK(mf.IsOpen());
+    CHECK(mf.size_ == fileSize);
+
+    CheckRegion(mf, 0, 1);
+    CheckRegion(mf, 0, (size_t)fileSize);
+    CheckRegion(mf, 17, 1000);                       // unaligned start
+    CheckRegion(mf, (long long)gran - 5, 10);        // crosses granularity boundary
+    CheckRegion(mf, (long long)gran * 2, gran);      // aligned start
+    CheckRegion(mf, fileSize - 1, 1);                // last byte
+
+    // two live views of same range
+    void* b1; size_t s1;
+    void* b2; size_t s2;
+    const unsigned char* d1 = mf.MapRegion(100, 50, &b1, &s1);
+    const unsigned char* d2 = mf.MapRegion(100, 50, &b2, &s2);
+    CHECK(d1 && d2 && memcmp(d1, d2, 50) == 0);
+    r3dFSMappedFile::UnmapRegion(b1, s1);
+    CHECK(d2[49] == PatternByte(149));
+    r3dFSMappedFile::UnmapRegion(b2, s2);
+
+    // reopen closes previous file
+    CHECK(mf.Open(fname));
+    CHECK(mf.size_ == fileSize);
+
+    mf.Close();
+    CHECK(!mf.IsOpen());
+    r3dFSMappedFile::UnmapRegion(NULL, 0);
+  }
+
+  // missing and empty files can't be opened
+  {
+    r3dFSMappedFile mf;
+    CHECK(!mf.Open("/tmp/r3dFSVolumeMapTest_does_not_exist"));
+    CHECK(r3dFSMappedFile::GetLastErrorCode() != 0);
+    CHECK(!mf.IsOpen());
+
+    FILE* f = fopen(fname, "wb");
+    CHECK(f != NULL);
+    if(f)
+      fclose(f);
+    CHECK(!mf.Open(fname));
+    CHECK(!mf.IsOpen());
+  }
+
+  unlink(fname);
+
+  if(numFailed)
+  {
+    printf("r3dFSMappedFile: %d checks failed\n", numFailed);
+    return 1;
+  }
+
+  printf("r3dFSMappedFile: all checks passed, granularity %u\n", (unsigned)gran);
+  return 0;
+}
@@ -0,0 +1,1109 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//	>	VisGridBaker - CPU baker of visibility grid ( Grid.vis )
+//
+//	Does what VisibiltyGrid::Calculate does on GPU: from 1 + 2^3 + 4^3 points of every cell renders
+//	level depth into 6 cube faces and tests boxes of all other cells against it. Rendering is done with
+//	software rasterizer, source cells are split between all cores. Doesn't need the engine or D3D,
+//	input is written by "vgridexport" console command in the editor.
+//
+//	Usage:
+//		VisGridBaker bake <bake input> <Grid.vis> [-threads N] [-res N] [-div N]
+//		VisGridBaker diff <reference Grid.vis> <Grid.vis>
+//
+//	Linux:
+//		g++ -O2 -msse2 -pthread VisGridBaker.cpp -o VisGridBaker
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+#include "../../EclipseStudio/Sources/RENDERING/Deffered/VisibilityGridBake.h"
+
+//------------------------------------------------------------------------
+// platform
+
+namespace
+{
+	double GetTimeSec()
+	{
+#ifdef _WIN32
+		LARGE_INTEGER freq, count;
+		QueryPerformanceFrequency( &freq );
+		QueryPerformanceCounter( &count );
+		return (double)count.QuadPart / freq.QuadPart;
+#else
+		timeval tv;
+		gettimeofday( &tv, NULL );
+		return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+	}
+
+	int AtomicIncrement( volatile long* val )
+	{
+#ifdef _WIN32
+		return InterlockedIncrement( val );
+#else
+		return __sync_add_and_fetch( val, 1 );
+#endif
+	}
+
+	int GetCPUCount()
+	{
+#ifdef _WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo( &si );
+		return si.dwNumberOfProcessors;
+#else
+		return (int)sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+	}
+
+	typedef void ( *ThreadFunc )( void* arg );
+
+	struct ThreadStart
+	{
+		ThreadFunc	Func;
+		void*		Arg;
+	};
+
+#ifdef _WIN32
+	DWORD WINAPI ThreadEntry( LPVOID param )
+	{
+		ThreadStart* ts = (ThreadStart*)param;
+		ts->Func( ts->Arg );
+		return 0;
+	}
+#else
+	void* ThreadEntry( void* param )
+	{
+		ThreadStart* ts = (ThreadStart*)param;
+		ts->Func( ts->Arg );
+		return NULL;
+	}
+#endif
+
+	// runs func( args[ i ] ) on separate threads and waits for all of them
+	void RunThreads( ThreadFunc func, void** args, int count )
+	{
+		std::vector< ThreadStart > starts( count );
+
+#ifdef _WIN32
+		std::vector< HANDLE > threads( count );
+#else
+		std::vector< pthread_t > threads( count );
+#endif
+
+		for( int i = 0; i < count; i ++ )
+		{
+			starts[ i ].Func = func;
+			starts[ i ].Arg = args[ i ];
+#ifdef _WIN32
+			threads[ i ] = CreateThread( NULL, 0, ThreadEntry, &starts[ i ], 0, NULL );
+#else
+			pthread_create( &threads[ i ], NULL, ThreadEntry, &starts[ i ] );
+#endif
+		}
+
+		for( int i = 0; i < count; i ++ )
+		{
+#ifdef _WIN32
+			WaitForSingleObject( threads[ i ], INFINITE );
+			CloseHandle( threads[ i ] );
+#else
+			pthread_join( threads[ i ], NULL );
+#endif
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+// Grid.vis, must match VisibiltyGrid::Save / Load
+
+namespace
+{
+	const char VIS_FILE_TAG[] = "VGRID100";
+
+	struct VisGrid
+	{
+		float	Width;
+		float	Height;
+		float	Depth;
+
+		float	Start[ 3 ];
+
+		int		CellCountX;
+		int		CellCountY;
+		int		CellCountZ;
+
+		float	DesiredCellHeight;
+
+		std::vector< VisGridBakeHeightRange >	HeightRanges;
+		std::vector< unsigned char >			Bits;
+
+		int CellCount() const
+		{
+			return CellCountX * CellCountY * CellCountZ;
+		}
+
+		// VisibiltyGrid::GetCellPairIDX
+		int CellIndex( int cx, int cy, int cz ) const
+		{
+			return cx + cy * CellCountX * CellCountZ + cz * CellCountX;
+		}
+
+		bool IsValidCell( int cell ) const
+		{
+			int cy = cell / ( CellCountX * CellCountZ );
+			int cxz = cell % ( CellCountX * CellCountZ );
+
+			return cy < HeightRanges[ cxz ].CellCount;
+		}
+
+		bool GetBit( int pair ) const
+		{
+			return ( Bits[ pair >> 3 ] >> ( pair & 7 ) & 1 ) != 0;
+		}
+
+		void SetBit( int pair )
+		{
+			Bits[ pair >> 3 ] |= 1 << ( pair & 7 );
+		}
+	};
+
+	bool LoadVisGrid( const char* fileName, VisGrid& grid )
+	{
+		FILE* file = fopen( fileName, "rb" );
+		if( !file )
+		{
+			printf( "Can't open %s\n", fileName );
+			return false;
+		}
+
+		char tag[ sizeof VIS_FILE_TAG ];
+
+		bool ok = fread( tag, sizeof tag, 1, file ) == 1 && !memcmp( tag, VIS_FILE_TAG, sizeof tag );
+
+		ok = ok && fread( &grid.Width, sizeof grid.Width, 1, file ) == 1;
+		ok = ok && fread( &grid.Height, sizeof grid.Height, 1, file ) == 1;
+		ok = ok && fread( &grid.Depth, sizeof grid.Depth, 1, file ) == 1;
+		ok = ok && fread( grid.Start, sizeof grid.Start, 1, file ) == 1;
+		ok = ok && fread( &grid.CellCountX, sizeof grid.CellCountX, 1, file ) == 1;
+		ok = ok && fread( &grid.CellCountY, sizeof grid.CellCountY, 1, file ) == 1;
+		ok = ok && fread( &grid.CellCountZ, sizeof grid.CellCountZ, 1, file ) == 1;
+		ok = ok && fread( &grid.DesiredCellHeight, sizeof grid.DesiredCellHeight, 1, file ) == 1;
+
+		ok = ok && grid.CellCountX > 0 && grid.CellCountY > 0 && grid.CellCountZ > 0;
+
+		if( ok )
+		{
+			int count = grid.CellCount();
+
+			grid.HeightRanges.resize( grid.CellCountX * grid.CellCountZ );
+			grid.Bits.resize( ( count * count + 7 ) / 8 );
+
+			ok = fread( &grid.HeightRanges[ 0 ], sizeof grid.HeightRanges[ 0 ] * grid.HeightRanges.size(), 1, file ) == 1;
+			ok = ok && fread( &grid.Bits[ 0 ], count * count / 8, 1, file ) == 1;
+		}
+
+		fclose( file );
+
+		if( !ok )
+			printf( "%s is not a visibility grid or is truncated\n", fileName );
+
+		return ok;
+	}
+
+	bool SaveVisGrid( const char* fileName, const VisGrid& grid )
+	{
+		FILE* file = fopen( fileName, "wb" );
+		if( !file )
+		{
+			printf( "Can't open %s\n", fileName );
+			return false;
+		}
+
+		int count = grid.CellCount();
+
+		fwrite( VIS_FILE_TAG, sizeof VIS_FILE_TAG, 1, file );
+
+		fwrite( &grid.Width, sizeof grid.Width, 1, file );
+		fwrite( &grid.Height, sizeof grid.Height, 1, file );
+		fwrite( &grid.Depth, sizeof grid.Depth, 1, file );
+		fwrite( grid.Start, sizeof grid.Start, 1, file );
+		fwrite( &grid.CellCountX, sizeof grid.CellCountX, 1, file );
+		fwrite( &grid.CellCountY, sizeof grid.CellCountY, 1, file );
+		fwrite( &grid.CellCountZ, sizeof grid.CellCountZ, 1, file );
+		fwrite( &grid.DesiredCellHeight, sizeof grid.DesiredCellHeight, 1, file );
+
+		fwrite( &grid.HeightRanges[ 0 ], sizeof grid.HeightRanges[ 0 ] * grid.HeightRanges.size(), 1, file );
+
+		// VisibiltyGrid::Save writes whole bytes only
+		fwrite( &grid.Bits[ 0 ], count * count / 8, 1, file );
+
+		bool ok = !ferror( file );
+		fclose( file );
+
+		return ok;
+	}
+}
+
+//------------------------------------------------------------------------
+// depth rasterizer for one cube face, 90 degree fov
+
+namespace
+{
+	const float NEAR_CLIP = 0.05f;
+
+	enum
+	{
+		HIZ_BLOCK = 8,
+		MAX_CLIP_VERTICES = 9,
+
+		CLIP_NEAR = 1 << 4
+	};
+
+	// camera space vertex, x right, y up, z forward
+	struct CamVertex
+	{
+		float x, y, z;
+	};
+
+	inline int ClipCode( const CamVertex& v )
+	{
+		return	( v.z - v.x < 0.f ? 1 << 0 : 0 ) |
+				( v.z + v.x < 0.f ? 1 << 1 : 0 ) |
+				( v.z - v.y < 0.f ? 1 << 2 : 0 ) |
+				( v.z + v.y < 0.f ? 1 << 3 : 0 ) |
+				( v.z < NEAR_CLIP ? CLIP_NEAR : 0 );
+	}
+
+	inline float ClipDistance( const CamVertex& v, int plane )
+	{
+		switch( plane )
+		{
+		case 0: return v.z - v.x;
+		case 1: return v.z + v.x;
+		case 2: return v.z - v.y;
+		case 3: return v.z + v.y;
+		default: return v.z - NEAR_CLIP;
+		}
+	}
+
+	int ClipPolygon( CamVertex ( &poly )[ MAX_CLIP_VERTICES ], int count, int planes )
+	{
+		CamVertex temp[ MAX_CLIP_VERTICES ];
+
+		for( int p = 0; p < 5 && count >= 3; p ++ )
+		{
+			if( !( planes & ( 1 << p ) ) )
+				continue;
+
+			int outCount = 0;
+
+			for( int i = 0; i < count; i ++ )
+			{
+				const CamVertex& a = poly[ i ];
+				const CamVertex& b = poly[ ( i + 1 ) % count ];
+
+				float da = ClipDistance( a, p );
+				float db = ClipDistance( b, p );
+
+				if( da >= 0.f )
+					temp[ outCount ++ ] = a;
+
+				if( ( da >= 0.f ) != ( db >= 0.f ) )
+				{
+					float t = da / ( da - db );
+
+					CamVertex& v = temp[ outCount ++ ];
+					v.x = a.x + ( b.x - a.x ) * t;
+					v.y = a.y + ( b.y - a.y ) * t;
+					v.z = a.z + ( b.z - a.z ) * t;
+				}
+			}
+
+			memcpy( poly, temp, sizeof temp[ 0 ] * outCount );
+			count = outCount;
+		}
+
+		return count >= 3 ? count : 0;
+	}
+
+	// depth is 1 / z so it interpolates linearly in screen space, bigger is nearer, 0 is nothing drawn
+	class FaceRasterizer
+	{
+	public:
+		explicit FaceRasterizer( int res )
+		: mRes( res )
+		, mHiZRes( ( res + HIZ_BLOCK - 1 ) / HIZ_BLOCK )
+		{
+			mDepth.resize( res * res );
+			mHiZ.resize( mHiZRes * mHiZRes );
+		}
+
+		void Clear()
+		{
+			std::fill( mDepth.begin(), mDepth.end(), 0.f );
+		}
+
+		void DrawTriangle( const CamVertex& v0, const CamVertex& v1, const CamVertex& v2 )
+		{
+			ClipAndRaster( v0, v1, v2, false );
+		}
+
+		// true if any pixel of triangle is at or in front of depth
+		bool TestTriangle( const CamVertex& v0, const CamVertex& v1, const CamVertex& v2 )
+		{
+			return ClipAndRaster( v0, v1, v2, true );
+		}
+
+		// nearest farthest depth of every block
+		void BuildHiZ()
+		{
+			for( int by = 0; by < mHiZRes; by ++ )
+			{
+				for( int bx = 0; bx < mHiZRes; bx ++ )
+				{
+					float m = FLT_MAX;
+
+					for( int y = by * HIZ_BLOCK, ye = std::min( y + HIZ_BLOCK, mRes ); y < ye; y ++ )
+					{
+						const float* row = &mDepth[ y * mRes ];
+
+						for( int x = bx * HIZ_BLOCK, xe = std::min( x + HIZ_BLOCK, mRes ); x < xe; x ++ )
+							m = std::min( m, row[ x ] );
+					}
+
+					mHiZ[ by * mHiZRes + bx ] = m;
+				}
+			}
+		}
+
+		// false if box with these projected bounds is certainly behind depth. Needs BuildHiZ()
+		bool TestRect( float minX, float minY, float maxX, float maxY, float nearestDepth ) const
+		{
+			int bx0 = std::max( (int)minX, 0 ) / HIZ_BLOCK;
+			int by0 = std::max( (int)minY, 0 ) / HIZ_BLOCK;
+			int bx1 = std::min( (int)maxX / HIZ_BLOCK, mHiZRes - 1 );
+			int by1 = std::min( (int)maxY / HIZ_BLOCK, mHiZRes - 1 );
+
+			for( int by = by0; by <= by1; by ++ )
+			{
+				for( int bx = bx0; bx <= bx1; bx ++ )
+				{
+					if( mHiZ[ by * mHiZRes + bx ] <= nearestDepth )
+						return true;
+				}
+			}
+
+			return false;
+		}
+
+		void Project( const CamVertex& v, float& x, float& y ) const
+		{
+			float iz = 1.f / v.z;
+
+			x = ( v.x * iz * 0.5f + 0.5f ) * mRes;
+			y = ( 0.5f - v.y * iz * 0.5f ) * mRes;
+		}
+
+	private:
+		bool ClipAndRaster( const CamVertex& v0, const CamVertex& v1, const CamVertex& v2, bool test )
+		{
+			int c0 = ClipCode( v0 ), c1 = ClipCode( v1 ), c2 = ClipCode( v2 );
+
+			if( c0 & c1 & c2 )
+				return false;
+
+			if( !( c0 | c1 | c2 ) )
+				return Raster( v0, v1, v2, test );
+
+			CamVertex poly[ MAX_CLIP_VERTICES ] = { v0, v1, v2 };
+
+			int count = ClipPolygon( poly, 3, c0 | c1 | c2 );
+
+			for( int i = 1; i < count - 1; i ++ )
+			{
+				if( Raster( poly[ 0 ], poly[ i ], poly[ i + 1 ], test ) )
+					return true;
+			}
+
+			return false;
+		}
+
+		bool Raster( const CamVertex& v0, const CamVertex& v1, const CamVertex& v2, bool test )
+		{
+			float x[ 3 ], y[ 3 ], z[ 3 ];
+
+			Project( v0, x[ 0 ], y[ 0 ] ); z[ 0 ] = 1.f / v0.z;
+			Project( v1, x[ 1 ], y[ 1 ] ); z[ 1 ] = 1.f / v1.z;
+			Project( v2, x[ 2 ], y[ 2 ] ); z[ 2 ] = 1.f / v2.z;
+
+			float area = ( x[ 1 ] - x[ 0 ] ) * ( y[ 2 ] - y[ 0 ] ) - ( x[ 2 ] - x[ 0 ] ) * ( y[ 1 ] - y[ 0 ] );
+
+			if( !( fabsf( area ) > 1e-8f ) )
+				return false;
+
+			// no back face culling, same as D3DCULL_NONE in VisibiltyGrid::Calculate
+			if( area < 0.f )
+			{
+				std::swap( x[ 1 ], x[ 2 ] );
+				std::swap( y[ 1 ], y[ 2 ] );
+				std::swap( z[ 1 ], z[ 2 ] );
+				area = -area;
+			}
+
+			int px0 = std::max( (int)ceilf( std::min( std::min( x[ 0 ], x[ 1 ] ), x[ 2 ] ) - 0.5f ), 0 );
+			int px1 = std::min( (int)floorf( std::max( std::max( x[ 0 ], x[ 1 ] ), x[ 2 ] ) - 0.5f ), mRes - 1 );
+			int py0 = std::max( (int)ceilf( std::min( std::min( y[ 0 ], y[ 1 ] ), y[ 2 ] ) - 0.5f ), 0 );
+			int py1 = std::min( (int)floorf( std::max( std::max( y[ 0 ], y[ 1 ] ), y[ 2 ] ) - 0.5f ), mRes - 1 );
+
+			if( px0 > px1 || py0 > py1 )
+				return false;
+
+			float ea[ 3 ], eb[ 3 ], ec[ 3 ];
+
+			for( int i = 0; i < 3; i ++ )
+			{
+				int a = i, b = ( i + 1 ) % 3;
+
+				ea[ i ] = y[ a ] - y[ b ];
+				eb[ i ] = x[ b ] - x[ a ];
+				ec[ i ] = x[ a ] * y[ b ] - x[ b ] * y[ a ];
+			}
+
+			float invArea = 1.f / area;
+
+			float zdx = ( ( z[ 1 ] - z[ 0 ] ) * ( y[ 2 ] - y[ 0 ] ) - ( z[ 2 ] - z[ 0 ] ) * ( y[ 1 ] - y[ 0 ] ) ) * invArea;
+			float zdy = ( ( z[ 2 ] - z[ 0 ] ) * ( x[ 1 ] - x[ 0 ] ) - ( z[ 1 ] - z[ 0 ] ) * ( x[ 2 ] - x[ 0 ] ) ) * invArea;
+			float z0 = z[ 0 ] - zdx * x[ 0 ] - zdy * y[ 0 ];
+
+			float fx0 = px0 + 0.5f;
+
+			for( int py = py0; py <= py1; py ++ )
+			{
+				float fy = py + 0.5f;
+
+				float e0 = ea[ 0 ] * fx0 + eb[ 0 ] * fy + ec[ 0 ];
+				float e1 = ea[ 1 ] * fx0 + eb[ 1 ] * fy + ec[ 1 ];
+				float e2 = ea[ 2 ] * fx0 + eb[ 2 ] * fy + ec[ 2 ];
+				float pz = zdx * fx0 + zdy * fy + z0;
+
+				float* row = &mDepth[ py * mRes ];
+
+				for( int px = px0; px <= px1; px ++ )
+				{
+					if( e0 >= 0.f && e1 >= 0.f && e2 >= 0.f )
+					{
+						if( test )
+						{
+							if( pz >= row[ px ] )
+								return true;
+						}
+						else
+						{
+							row[ px ] = std::max( row[ px ], pz );
+						}
+					}
+
+					e0 += ea[ 0 ];
+					e1 += ea[ 1 ];
+					e2 += ea[ 2 ];
+					pz += zdx;
+				}
+			}
+
+			return false;
+		}
+
+		int						mRes;
+		int						mHiZRes;
+
+		std::vector< float >	mDepth;
+		std::vector< float >	mHiZ;
+	};
+}
+
+//------------------------------------------------------------------------
+// baker
+
+namespace
+{
+	// axis and sign of camera right, up and forward in world space. Orientation of faces doesn't
+	// matter as long as they cover whole sphere
+	struct CubeFace
+	{
+		int		AxisR, AxisU, AxisF;
+		float	SignR, SignU, SignF;
+	};
+
+	const CubeFace CUBE_FACES[ 6 ] =
+	{
+		{ 2, 1, 0, -1.f, +1.f, +1.f },		// +X
+		{ 2, 1, 0, +1.f, +1.f, -1.f },		// -X
+		{ 0, 2, 1, +1.f, -1.f, +1.f },		// +Y
+		{ 0, 2, 1, +1.f, +1.f, -1.f },		// -Y
+		{ 0, 1, 2, +1.f, +1.f, +1.f },		// +Z
+		{ 0, 1, 2, -1.f, +1.f, -1.f },		// -Z
+	};
+
+	inline CamVertex ToCamera( const CubeFace& face, const float* eye, const float* p )
+	{
+		CamVertex v;
+		v.x = ( p[ face.AxisR ] - eye[ face.AxisR ] ) * face.SignR;
+		v.y = ( p[ face.AxisU ] - eye[ face.AxisU ] ) * face.SignU;
+		v.z = ( p[ face.AxisF ] - eye[ face.AxisF ] ) * face.SignF;
+		return v;
+	}
+
+	struct BakeCell
+	{
+		int		Index;
+		int		X, Y, Z;
+
+		float	Min[ 3 ];
+		float	Max[ 3 ];
+	};
+
+	struct BakeContext
+	{
+		VisGridBakeHeader						Header;
+		std::vector< VisGridBakeHeightRange >	HeightRanges;
+		std::vector< VisGridBakeCluster >		Clusters;
+		std::vector< VisGridBakeTriangle >		Triangles;
+
+		std::vector< BakeCell >					Cells;		// only cells that exist in their column
+
+		int										Res;
+		int										MaxDiv;
+
+		// visibility seen from every cell, RowWords per cell
+		std::vector< unsigned int >				Rows;
+		int										RowWords;
+
+		volatile long							NextCell;
+		volatile long							DoneCells;
+
+		double									StartTime;
+		double									LastReport;
+	};
+
+	bool LoadBakeInput( const char* fileName, BakeContext& ctx )
+	{
+		FILE* file = fopen( fileName, "rb" );
+		if( !file )
+		{
+			printf( "Can't open %s\n", fileName );
+			return false;
+		}
+
+		VisGridBakeHeader& h = ctx.Header;
+
+		bool ok = fread( &h, sizeof h, 1, file ) == 1 && !memcmp( h.Tag, VISGRID_BAKE_TAG, sizeof h.Tag );
+
+		ok = ok && h.CellCountX > 0 && h.CellCountY > 0 && h.CellCountZ > 0 && h.NumClusters >= 0 && h.NumTriangles >= 0;
+
+		if( ok )
+		{
+			ctx.HeightRanges.resize( h.CellCountX * h.CellCountZ );
+			ctx.Clusters.resize( h.NumClusters );
+			ctx.Triangles.resize( h.NumTriangles );
+
+			ok = fread( &ctx.HeightRanges[ 0 ], sizeof ctx.HeightRanges[ 0 ] * ctx.HeightRanges.size(), 1, file ) == 1;
+
+			if( ok && h.NumClusters )
+			{
+				ok = fread( &ctx.Clusters[ 0 ], sizeof ctx.Clusters[ 0 ] * ctx.Clusters.size(), 1, file ) == 1;
+				ok = ok && fread( &ctx.Triangles[ 0 ], sizeof ctx.Triangles[ 0 ] * ctx.Triangles.size(), 1, file ) == 1;
+			}
+		}
+
+		fclose( file );
+
+		if( !ok )
+			printf( "%s is not a visibility grid bake input or is truncated\n", fileName );
+
+		return ok;
+	}
+
+	// VisibiltyGrid::SetupCell
+	void SetupCells( BakeContext& ctx )
+	{
+		const VisGridBakeHeader& h = ctx.Header;
+
+		float cellWidth = h.Width / h.CellCountX;
+		float cellDepth = h.Depth / h.CellCountZ;
+
+		for( int z = 0; z < h.CellCountZ; z ++ )
+		{
+			for( int x = 0; x < h.CellCountX; x ++ )
+			{
+				const VisGridBakeHeightRange& hr = ctx.HeightRanges[ x + z * h.CellCountX ];
+
+				float cellHeight = ( hr.Max - hr.Min ) / hr.CellCount;
+
+				for( int y = 0; y < hr.CellCount; y ++ )
+				{
+					BakeCell cell;
+
+					cell.Index = x + y * h.CellCountX * h.CellCountZ + z * h.CellCountX;
+					cell.X = x;
+					cell.Y = y;
+					cell.Z = z;
+
+					cell.Min[ 0 ] = h.Start[ 0 ] + x * cellWidth;
+					cell.Min[ 1 ] = h.Start[ 1 ] + hr.Min + y * cellHeight;
+					cell.Min[ 2 ] = h.Start[ 2 ] + z * cellDepth;
+
+					cell.Max[ 0 ] = cell.Min[ 0 ] + cellWidth;
+					cell.Max[ 1 ] = cell.Min[ 1 ] + cellHeight;
+					cell.Max[ 2 ] = cell.Min[ 2 ] + cellDepth;
+
+					ctx.Cells.push_back( cell );
+				}
+			}
+		}
+	}
+
+	bool IsBoxInFace( const CubeFace& face, const float* eye, const float* mn, const float* mx )
+	{
+		int codes = ~0;
+
+		for( int i = 0; i < 8; i ++ )
+		{
+			float p[ 3 ] = { i & 1 ? mx[ 0 ] : mn[ 0 ], i & 2 ? mx[ 1 ] : mn[ 1 ], i & 4 ? mx[ 2 ] : mn[ 2 ] };
+
+			codes &= ClipCode( ToCamera( face, eye, p ) );
+
+			if( !codes )
+				return true;
+		}
+
+		return false;
+	}
+
+	bool IsCellVisible( FaceRasterizer& rast, const CubeFace& face, const float* eye, const BakeCell& cell )
+	{
+		CamVertex v[ 8 ];
+
+		int codeAnd = ~0, codeOr = 0;
+
+		for( int i = 0; i < 8; i ++ )
+		{
+			float p[ 3 ] = { i & 1 ? cell.Max[ 0 ] : cell.Min[ 0 ], i & 2 ? cell.Max[ 1 ] : cell.Min[ 1 ], i & 4 ? cell.Max[ 2 ] : cell.Min[ 2 ] };
+
+			v[ i ] = ToCamera( face, eye, p );
+
+			int code = ClipCode( v[ i ] );
+			codeAnd &= code;
+			codeOr |= code;
+		}
+
+		if( codeAnd )
+			return false;
+
+		// quick reject against hierarchical depth when box is completely in front of camera
+		if( !( codeOr & CLIP_NEAR ) )
+		{
+			float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+
+			for( int i = 0; i < 8; i ++ )
+			{
+				float x, y;
+				rast.Project( v[ i ], x, y );
+
+				minX = std::min( minX, x ); maxX = std::max( maxX, x );
+				minY = std::min( minY, y ); maxY = std::max( maxY, y );
+				minZ = std::min( minZ, v[ i ].z );
+			}
+
+			if( !rast.TestRect( minX, minY, maxX, maxY, 1.f / minZ ) )
+				return false;
+		}
+
+		// all 6 sides, corner i has bit 0 for x, 1 for y, 2 for z
+		static const int QUADS[ 6 ][ 4 ] =
+		{
+			{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+			{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+			{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }
+		};
+
+		for( int i = 0; i < 6; i ++ )
+		{
+			const int* q = QUADS[ i ];
+
+			if( rast.TestTriangle( v[ q[ 0 ] ], v[ q[ 1 ] ], v[ q[ 2 ] ] ) || rast.TestTriangle( v[ q[ 0 ] ], v[ q[ 2 ] ], v[ q[ 3 ] ] ) )
+				return true;
+		}
+
+		return false;
+	}
+
+	void BakeCellRow( BakeContext& ctx, FaceRasterizer& rast, const BakeCell& src )
+	{
+		unsigned int* row = &ctx.Rows[ src.Index * ctx.RowWords ];
+
+		int numTargets = (int)ctx.Cells.size() - 1;
+		int numVisible = 0;
+
+		float cellSize[ 3 ] = { src.Max[ 0 ] - src.Min[ 0 ], src.Max[ 1 ] - src.Min[ 1 ], src.Max[ 2 ] - src.Min[ 2 ] };
+
+		// same points as VisibiltyGrid::Calculate
+		for( int div = 1; div <= ctx.MaxDiv && numVisible < numTargets; div *= 2 )
+		{
+			for( int dz = 0; dz < div; dz ++ )
+			for( int dy = 0; dy < div; dy ++ )
+			for( int dx = 0; dx < div && numVisible < numTargets; dx ++ )
+			{
+				float eye[ 3 ] =
+				{
+					src.Min[ 0 ] + ( dx + 0.5f ) * cellSize[ 0 ] / div,
+					src.Min[ 1 ] + ( dy + 0.5f ) * cellSize[ 1 ] / div,
+					src.Min[ 2 ] + ( dz + 0.5f ) * cellSize[ 2 ] / div
+				};
+
+				for( int f = 0; f < 6 && numVisible < numTargets; f ++ )
+				{
+					const CubeFace& face = CUBE_FACES[ f ];
+
+					rast.Clear();
+
+					for( size_t c = 0, ce = ctx.Clusters.size(); c < ce; c ++ )
+					{
+						const VisGridBakeCluster& cl = ctx.Clusters[ c ];
+
+						if( !IsBoxInFace( face, eye, cl.Min, cl.Max ) )
+							continue;
+
+						for( int t = cl.FirstTriangle, te = cl.FirstTriangle + cl.NumTriangles; t < te; t ++ )
+						{
+							const VisGridBakeTriangle& tri = ctx.Triangles[ t ];
+
+							rast.DrawTriangle( ToCamera( face, eye, tri.V[ 0 ] ), ToCamera( face, eye, tri.V[ 1 ] ), ToCamera( face, eye, tri.V[ 2 ] ) );
+						}
+					}
+
+					rast.BuildHiZ();
+
+					for( size_t c = 0, ce = ctx.Cells.size(); c < ce; c ++ )
+					{
+						const BakeCell& dst = ctx.Cells[ c ];
+
+						if( dst.Index == src.Index || row[ dst.Index >> 5 ] & 1u << ( dst.Index & 31 ) )
+							continue;
+
+						if( IsCellVisible( rast, face, eye, dst ) )
+						{
+							row[ dst.Index >> 5 ] |= 1u << ( dst.Index & 31 );
+							numVisible ++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void BakeThread( void* arg )
+	{
+		BakeContext& ctx = *(BakeContext*)arg;
+
+		FaceRasterizer rast( ctx.Res );
+
+		for( ;; )
+		{
+			int i = AtomicIncrement( &ctx.NextCell ) - 1;
+
+			if( i >= (int)ctx.Cells.size() )
+				break;
+
+			BakeCellRow( ctx, rast, ctx.Cells[ i ] );
+
+			int done = AtomicIncrement( &ctx.DoneCells );
+
+			double time = GetTimeSec();
+
+			// racy, at worst report is printed twice
+			if( time - ctx.LastReport > 5.0 || done == (int)ctx.Cells.size() )
+			{
+				ctx.LastReport = time;
+
+				double elapsed = time - ctx.StartTime;
+				double left = elapsed / done * ( ctx.Cells.size() - done );
+
+				printf( "%d of %d cells done, %.0f sec elapsed, %.0f sec left\n", done, (int)ctx.Cells.size(), elapsed, left );
+			}
+		}
+	}
+
+	int Bake( const char* inputName, const char* outputName, int numThreads, int res, int maxDiv )
+	{
+		BakeContext ctx;
+
+		if( !LoadBakeInput( inputName, ctx ) )
+			return 2;
+
+		const VisGridBakeHeader& h = ctx.Header;
+
+		SetupCells( ctx );
+
+		int cellCount = h.CellCountX * h.CellCountY * h.CellCountZ;
+
+		ctx.Res = res;
+		ctx.MaxDiv = maxDiv;
+		ctx.RowWords = ( cellCount + 31 ) / 32;
+		ctx.Rows.resize( cellCount * ctx.RowWords, 0 );
+		ctx.NextCell = 0;
+		ctx.DoneCells = 0;
+		ctx.StartTime = GetTimeSec();
+		ctx.LastReport = ctx.StartTime;
+
+		printf( "Baking %dx%dx%d grid ( %d cells ), %d clusters, %d triangles, %dx%d cube faces, %d threads\n",
+					h.CellCountX, h.CellCountY, h.CellCountZ, (int)ctx.Cells.size(), h.NumClusters, h.NumTriangles, res, res, numThreads );
+
+		std::vector< void* > args( numThreads, &ctx );
+		RunThreads( BakeThread, &args[ 0 ], numThreads );
+
+		VisGrid grid;
+
+		grid.Width				= h.Width;
+		grid.Height				= h.Height;
+		grid.Depth				= h.Depth;
+		grid.Start[ 0 ]			= h.Start[ 0 ];
+		grid.Start[ 1 ]			= h.Start[ 1 ];
+		grid.Start[ 2 ]			= h.Start[ 2 ];
+		grid.CellCountX			= h.CellCountX;
+		grid.CellCountY			= h.CellCountY;
+		grid.CellCountZ			= h.CellCountZ;
+		grid.DesiredCellHeight	= h.DesiredCellHeight;
+		grid.HeightRanges		= ctx.HeightRanges;
+
+		grid.Bits.resize( ( cellCount * cellCount + 7 ) / 8, 0 );
+
+		// visible from either side, like VisibiltyGrid::Calculate
+		int numVisible = 0;
+
+		for( size_t i = 0, e = ctx.Cells.size(); i < e; i ++ )
+		{
+			int a = ctx.Cells[ i ].Index;
+
+			for( size_t j = 0; j < e; j ++ )
+			{
+				int b = ctx.Cells[ j ].Index;
+
+				const unsigned int* rowA = &ctx.Rows[ a * ctx.RowWords ];
+				const unsigned int* rowB = &ctx.Rows[ b * ctx.RowWords ];
+
+				if( ( rowA[ b >> 5 ] >> ( b & 31 ) | rowB[ a >> 5 ] >> ( a & 31 ) ) & 1 )
+				{
+					grid.SetBit( a + b * cellCount );
+					numVisible ++;
+				}
+			}
+		}
+
+		if( !SaveVisGrid( outputName, grid ) )
+			return 2;
+
+		size_t numPairs = ctx.Cells.size() * ( ctx.Cells.size() - 1 );
+
+		printf( "Saved %s: %.1f%% of cell pairs visible, %.0f sec\n", outputName, numPairs ? numVisible * 100.0 / numPairs : 0.0, GetTimeSec() - ctx.StartTime );
+
+		return 0;
+	}
+}
+
+//------------------------------------------------------------------------
+// diff
+
+namespace
+{
+	struct CellDiff
+	{
+		int		Cell;
+		int		OnlyRef;
+		int		OnlyNew;
+
+		bool operator < ( const CellDiff& rhs ) const
+		{
+			return OnlyRef + OnlyNew > rhs.OnlyRef + rhs.OnlyNew;
+		}
+	};
+
+	// exit code is 0 when grids are the same, 1 when visibility differs, 2 when they can't be compared
+	int Diff( const char* refName, const char* newName )
+	{
+		VisGrid ref, cmp;
+
+		if( !LoadVisGrid( refName, ref ) || !LoadVisGrid( newName, cmp ) )
+			return 2;
+
+		if( ref.CellCountX != cmp.CellCountX || ref.CellCountY != cmp.CellCountY || ref.CellCountZ != cmp.CellCountZ
+			|| memcmp( &ref.HeightRanges[ 0 ], &cmp.HeightRanges[ 0 ], sizeof ref.HeightRanges[ 0 ] * ref.HeightRanges.size() ) )
+		{
+			printf( "Grids have different layout ( %dx%dx%d and %dx%dx%d cells or different cell heights ), re-export bake input from the same level setup\n",
+						ref.CellCountX, ref.CellCountY, ref.CellCountZ, cmp.CellCountX, cmp.CellCountY, cmp.CellCountZ );
+			return 2;
+		}
+
+		int cellCount = ref.CellCount();
+
+		std::vector< int > cells;
+
+		for( int i = 0; i < cellCount; i ++ )
+		{
+			if( ref.IsValidCell( i ) )
+				cells.push_back( i );
+		}
+
+		double both = 0, neither = 0, onlyRef = 0, onlyNew = 0;
+
+		std::vector< CellDiff > diffs;
+
+		for( size_t i = 0, e = cells.size(); i < e; i ++ )
+		{
+			CellDiff d;
+			d.Cell = cells[ i ];
+			d.OnlyRef = 0;
+			d.OnlyNew = 0;
+
+			for( size_t j = 0; j < e; j ++ )
+			{
+				if( i == j )
+					continue;
+
+				// last few pairs aren't saved when pair count isn't multiple of 8
+				int pair = cells[ i ] + cells[ j ] * cellCount;
+				if( pair >= cellCount * cellCount / 8 * 8 )
+					continue;
+
+				bool a = ref.GetBit( pair );
+				bool b = cmp.GetBit( pair );
+
+				if( a && b )
+					both ++;
+				else if( a )
+					d.OnlyRef ++;
+				else if( b )
+					d.OnlyNew ++;
+				else
+					neither ++;
+			}
+
+			onlyRef += d.OnlyRef;
+			onlyNew += d.OnlyNew;
+
+			if( d.OnlyRef || d.OnlyNew )
+				diffs.push_back( d );
+		}
+
+		double total = both + neither + onlyRef + onlyNew;
+
+		printf( "%d cells, %.0f cell pairs\n", (int)cells.size(), total );
+		printf( "visible in both:    %10.0f ( %.2f%% )\n", both, total ? both * 100 / total : 0 );
+		printf( "hidden in both:     %10.0f ( %.2f%% )\n", neither, total ? neither * 100 / total : 0 );
+		printf( "visible only in %s: %.0f ( %.2f%% ) - objects may pop in\n", refName, onlyRef, total ? onlyRef * 100 / total : 0 );
+		printf( "visible only in %s: %.0f ( %.2f%% ) - less culling\n", newName, onlyNew, total ? onlyNew * 100 / total : 0 );
+
+		std::sort( diffs.begin(), diffs.end() );
+
+		if( diffs.size() )
+		{
+			printf( "cells with most differences ( x y z: only in reference / only in new ):\n" );
+
+			for( size_t i = 0, e = std::min( diffs.size(), (size_t)16 ); i < e; i ++ )
+			{
+				int cell = diffs[ i ].Cell;
+
+				int cy = cell / ( ref.CellCountX * ref.CellCountZ );
+				int cz = cell % ( ref.CellCountX * ref.CellCountZ ) / ref.CellCountX;
+				int cx = cell % ref.CellCountX;
+
+				printf( "\t%3d %d %3d: %d / %d\n", cx, cy, cz, diffs[ i ].OnlyRef, diffs[ i ].OnlyNew );
+			}
+		}
+
+		return onlyRef || onlyNew ? 1 : 0;
+	}
+}
+
+//------------------------------------------------------------------------
+
+int main( int argc, const char* argv[] )
+{
+	const char* usage =
+		"Usage:\n"
+		"  VisGridBaker bake <bake input> <Grid.vis> [options]\n"
+		"      -threads N    worker threads, default is number of CPUs\n"
+		"      -res N        cube face resolution, default 512 as in editor\n"
+		"      -div N        sample points per cell edge at finest level, 1, 2 or 4 ( default )\n"
+		"  VisGridBaker diff <reference Grid.vis> <Grid.vis>\n"
+		"      compares visibility, exit code 1 if it differs\n"
+		"Bake input is written by \"vgridexport\" console command in the editor\n";
+
+	if( argc >= 4 && !strcmp( argv[ 1 ], "bake" ) )
+	{
+		int threads = GetCPUCount();
+		int res = 512;
+		int div = 4;
+
+		for( int i = 4; i < argc; i ++ )
+		{
+			if( i + 1 >= argc )
+			{
+				printf( "Option %s needs value\n%s", argv[ i ], usage );
+				return 2;
+			}
+
+			int val = atoi( argv[ i + 1 ] );
+
+			if( !strcmp( argv[ i ], "-threads" ) )
+				threads = val;
+			else if( !strcmp( argv[ i ], "-res" ) )
+				res = val;
+			else if( !strcmp( argv[ i ], "-div" ) )
+				div = val;
+			else
+			{
+				printf( "Invalid option %s\n%s", argv[ i ], usage );
+				return 2;
+			}
+
+			i ++;
+		}
+
+		if( threads < 1 || res < HIZ_BLOCK || div < 1 )
+		{
+			printf( "Invalid option value\n%s", usage );
+			return 2;
+		}
+
+		return Bake( argv[ 2 ], argv[ 3 ], threads, res, div );
+	}
+
+	if( argc == 4 && !strcmp( argv[ 1 ], "diff" ) )
+	{
+		return Diff( argv[ 2 ], argv[ 3 ] );
+	}
+
+	printf( "%s", usage );
+	return 2;
+}